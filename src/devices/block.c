@@ -3,7 +3,14 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
 /* A block device. */
 struct block
@@ -17,10 +24,43 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    struct blk_stats stats;             /* Changed with interrupts off. */
+
+    /* Request queue, protected by QUEUE_LOCK. */
+    struct lock queue_lock;
+    struct list queues[BIO_CLASS_CNT];  /* Waiting requests, by sector. */
+    unsigned credit[BIO_CLASS_CNT];     /* Picks left in this round. */
+    int last_issuer[BIO_CLASS_CNT];     /* Process served last, by class. */
+    bool busy;                          /* A request is being served? */
+    block_sector_t head;                /* Sector after the last served. */
   };
 
+/* How requests get served.
+
+   A synchronous caller does its own transfer, but only when the
+   queue picks its request.  A thread that finds the device busy
+   queues its request and sleeps until the thread finishing the
+   transfer in progress picks it, or serves it along with its own
+   because it continues where that one ends.  An asynchronous
+   request that gets picked is served on SERVE_QUEUE instead, and
+   its DONE function runs on DONE_QUEUE, so that a DONE function
+   that sleeps holds up no transfer. */
+static struct work_queue *serve_queue;
+static struct work_queue *done_queue;
+
+/* Classes in the order they are served, and how many requests of
+   each are served in a round while the others wait.  Every class
+   that has requests waiting gets its share of a round, so bulk
+   write-back cannot starve, nor hold up faults for long. */
+static const enum bio_class class_order[BIO_CLASS_CNT] =
+  { BIO_FAULT, BIO_SYNC, BIO_ASYNC };
+static const unsigned class_weight[BIO_CLASS_CNT] =
+  { [BIO_FAULT] = 8, [BIO_SYNC] = 4, [BIO_ASYNC] = 1 };
+
+/* Most sectors that one transfer serves, counting the requests it
+   takes along. */
+#define MERGE_MAX 64
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -113,6 +153,401 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Sets the class of the running thread's block requests to CLASS
+   and returns the one it had. */
+enum bio_class
+block_set_class (enum bio_class class)
+{
+  struct thread *t = thread_current ();
+  enum bio_class old = t->io_class;
+
+  ASSERT (class < BIO_CLASS_CNT);
+  t->io_class = class;
+  return old;
+}
+
+/* Returns the class that BLOCK serves next: the first in
+   class_order with requests waiting and credit left in the round.
+   Once every class with requests waiting has used up its credit, a
+   new round begins.  Returns BIO_CLASS_CNT if no request waits.
+   queue_lock must be held. */
+static enum bio_class
+pick_class (struct block *block)
+{
+  enum bio_class waiting = BIO_CLASS_CNT;
+  int i;
+
+  for (i = 0; i < BIO_CLASS_CNT; i++)
+    {
+      enum bio_class c = class_order[i];
+      if (list_empty (&block->queues[c]))
+        continue;
+      if (block->credit[c] > 0)
+        return c;
+      if (waiting == BIO_CLASS_CNT)
+        waiting = c;
+    }
+  if (waiting != BIO_CLASS_CNT)
+    for (i = 0; i < BIO_CLASS_CNT; i++)
+      block->credit[i] = class_weight[i];
+  return waiting;
+}
+
+/* Returns the request in sorted list L that BLOCK serves next,
+   which must not be empty.  That is one of the requests of the
+   highest priority, from the process after LAST in tid order
+   among those that have one, or else from the first of them.  Of
+   that process's requests, it is the one C-LOOK serves next from
+   HEAD: the first at or after HEAD, or else the first of all. */
+static struct bio *
+pick_in_class (struct list *l, int last, block_sector_t head)
+{
+  struct list_elem *e;
+  struct bio *first = NULL;
+  int priority = PRI_MIN;
+  int issuer = -1, lowest = -1;
+
+  for (e = list_begin (l); e != list_end (l); e = list_next (e))
+    {
+      struct bio *r = list_entry (e, struct bio, elem);
+      if (r->priority > priority)
+        priority = r->priority;
+    }
+  for (e = list_begin (l); e != list_end (l); e = list_next (e))
+    {
+      struct bio *r = list_entry (e, struct bio, elem);
+      if (r->priority != priority)
+        continue;
+      if (lowest == -1 || r->issuer < lowest)
+        lowest = r->issuer;
+      if (r->issuer > last && (issuer == -1 || r->issuer < issuer))
+        issuer = r->issuer;
+    }
+  if (issuer == -1)
+    issuer = lowest;
+
+  for (e = list_begin (l); e != list_end (l); e = list_next (e))
+    {
+      struct bio *r = list_entry (e, struct bio, elem);
+      if (r->priority != priority || r->issuer != issuer)
+        continue;
+      if (r->sector >= head)
+        return r;
+      if (first == NULL)
+        first = r;
+    }
+  return first;
+}
+
+/* Removes and returns the request that BLOCK serves next, or
+   returns a null pointer if none is waiting.  queue_lock must be
+   held. */
+static struct bio *
+pick_request (struct block *block)
+{
+  enum bio_class c = pick_class (block);
+  struct bio *r;
+
+  if (c == BIO_CLASS_CNT)
+    return NULL;
+  r = pick_in_class (&block->queues[c], block->last_issuer[c],
+                     block->head);
+  block->credit[c]--;
+  block->last_issuer[c] = r->issuer;
+  list_remove (&r->elem);
+  return r;
+}
+
+/* Returns the waiting request in direction WRITE that starts at
+   sector END, or a null pointer if there is none.  A request into a
+   user buffer, such as a direct read() of a large file, is left for
+   its issuer to serve, because the buffer is only mapped in its own
+   process.  queue_lock must be held. */
+static struct bio *
+find_next (struct block *block, block_sector_t end, bool write)
+{
+  int c;
+
+  for (c = 0; c < BIO_CLASS_CNT; c++)
+    {
+      struct list *l = &block->queues[c];
+      struct list_elem *e;
+
+      for (e = list_begin (l); e != list_end (l); e = list_next (e))
+        {
+          struct bio *o = list_entry (e, struct bio, elem);
+          if (o->sector > end)
+            break;
+          if (o->sector == end && o->write == write
+              && is_kernel_vaddr (o->buffer))
+            return o;
+        }
+    }
+  return NULL;
+}
+
+/* Transfers the CNT sectors of request R, in one operation if the
+   driver has one for runs of sectors. */
+static void
+transfer (struct block *block, const struct bio *r)
+{
+  uint8_t *buffer = r->buffer;
+  size_t i;
+
+  if (r->write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, r->sector, r->cnt, buffer);
+  else if (!r->write && block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, r->sector, r->cnt, buffer);
+  else
+    for (i = 0; i < r->cnt; i++)
+      if (r->write)
+        block->ops->write (block->aux, r->sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+      else
+        block->ops->read (block->aux, r->sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+static void serve_async (void *);
+
+/* Runs asynchronous request B's DONE function. */
+static void
+run_done (void *b_)
+{
+  struct bio *b = b_;
+  b->done (b);
+}
+
+/* Records request B, which has just ended, in the statistics of
+   the device it was submitted to. */
+static void
+account (struct bio *b)
+{
+  struct blk_stats *s = &b->origin->stats;
+  struct blk_stat *dir = b->write ? &s->write : &s->read;
+  uint64_t ns = clock_ns () - b->start_ns;
+  enum intr_level old_level;
+  int bucket;
+
+  for (bucket = 0; bucket < BLK_LATENCY_BUCKETS - 1 && ns >> (bucket + 1);
+       bucket++)
+    continue;
+
+  old_level = intr_disable ();
+  dir->requests++;
+  dir->sectors += b->cnt;
+  dir->ns += ns;
+  if (ns > dir->max_ns)
+    dir->max_ns = ns;
+  dir->latency[bucket]++;
+  s->class_requests[b->class]++;
+  s->class_ns[b->class] += ns;
+  s->in_flight--;
+  intr_set_level (old_level);
+}
+
+/* Reports that request B is over, to its DONE function or to the
+   waiting synchronous caller. */
+static void
+complete (struct bio *b)
+{
+  TRACE (TRACE_BLOCK_COMPLETE, b->sector);
+  account (b);
+  if (b->done != NULL)
+    {
+      work_init (&b->work, run_done, b);
+      work_enqueue (done_queue, &b->work);
+    }
+  else
+    {
+      b->finished = true;
+      sema_up (&b->go);
+    }
+}
+
+/* Hands BLOCK, which has just finished a transfer, to the request
+   it serves next, or marks it idle.  queue_lock must be held. */
+static void
+hand_off (struct block *block)
+{
+  struct bio *b = pick_request (block);
+
+  if (b == NULL)
+    block->busy = false;
+  else if (b->done != NULL)
+    {
+      work_init (&b->work, serve_async, b);
+      work_enqueue (serve_queue, &b->work);
+    }
+  else
+    sema_up (&b->go);
+}
+
+/* Serves R, along with any waiting requests in the same direction
+   that continue where it ends, whatever their class, then hands
+   BLOCK to the next request.  BLOCK must be busy on R's behalf and
+   queue_lock held; it is released. */
+static void
+serve (struct block *block, struct bio *r)
+{
+  struct bio *merged[MERGE_MAX];
+  size_t merge_cnt = 0;
+  block_sector_t end;
+  size_t sectors;
+  size_t i;
+
+  /* Take along the waiting requests that continue this one. */
+  end = r->sector + r->cnt;
+  sectors = r->cnt;
+  while (merge_cnt < MERGE_MAX)
+    {
+      struct bio *m = find_next (block, end, r->write);
+
+      if (m == NULL || sectors + m->cnt > MERGE_MAX)
+        break;
+      list_remove (&m->elem);
+      merged[merge_cnt++] = m;
+      end += m->cnt;
+      sectors += m->cnt;
+    }
+  lock_release (&block->queue_lock);
+
+  transfer (block, r);
+  for (i = 0; i < merge_cnt; i++)
+    transfer (block, merged[i]);
+
+  lock_acquire (&block->queue_lock);
+  block->head = end;
+  for (i = 0; i < merge_cnt; i++)
+    {
+      enum intr_level old_level = intr_disable ();
+      merged[i]->origin->stats.merged++;
+      intr_set_level (old_level);
+      complete (merged[i]);
+    }
+  if (r->done != NULL)
+    complete (r);
+  else
+    account (r);
+  hand_off (block);
+  lock_release (&block->queue_lock);
+}
+
+/* Serves asynchronous request B_, which its device has picked. */
+static void
+serve_async (void *b_)
+{
+  struct bio *b = b_;
+
+  lock_acquire (&b->block->queue_lock);
+  serve (b->block, b);
+}
+
+/* Checks B, sends it to the device that really holds its sectors
+   and counts it.  Then queues it, unless the device is idle, and
+   returns true if the device was idle, in which case it is now busy
+   on B's behalf and queue_lock is held. */
+static bool
+enqueue (struct bio *b)
+{
+  struct block *block = b->block;
+  struct thread *t = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (b->cnt > 0);
+  check_sector (block, b->sector);
+  check_sector (block, b->sector + b->cnt - 1);
+  ASSERT (!b->write || block->type != BLOCK_FOREIGN);
+  b->origin = block;
+  b->start_ns = clock_ns ();
+  if (b->write)
+    t->rusage.block_writes++;
+  else
+    t->rusage.block_reads++;
+  b->class = t->io_class;
+  /* Synchronous requests of a niced thread wait like background
+     writeback does. */
+  if (b->class == BIO_SYNC && t->nice > 0)
+    b->class = BIO_ASYNC;
+  b->priority = t->priority;
+#ifdef USERPROG
+  b->issuer = t->proc != NULL ? t->proc->tid : t->tid;
+#else
+  b->issuer = t->tid;
+#endif
+  old_level = intr_disable ();
+  if (++block->stats.in_flight > block->stats.max_in_flight)
+    block->stats.max_in_flight = block->stats.in_flight;
+  intr_set_level (old_level);
+  while (block->ops->remap != NULL)
+    block = block->ops->remap (block->aux, &b->sector);
+  b->block = block;
+  TRACE (TRACE_BLOCK_SUBMIT, b->sector);
+
+  lock_acquire (&block->queue_lock);
+  if (!block->busy)
+    {
+      block->busy = true;
+      return true;
+    }
+  list_insert_ordered_by (&block->queues[b->class], &b->elem, struct bio,
+                          elem, sector);
+  lock_release (&block->queue_lock);
+  return false;
+}
+
+/* Queues request B, which the caller has filled in, and returns
+   at once.  B->DONE (B) is called once it is over. */
+void
+block_submit (struct bio *b)
+{
+  ASSERT (b->done != NULL);
+  ASSERT (is_kernel_vaddr (b->buffer));
+
+  if (enqueue (b))
+    {
+      work_init (&b->work, serve_async, b);
+      work_enqueue (serve_queue, &b->work);
+      lock_release (&b->block->queue_lock);
+    }
+}
+
+/* Does request B, which has no DONE function, and waits until it
+   is over. */
+static void
+submit_wait (struct bio *b)
+{
+  b->done = NULL;
+  b->finished = false;
+  sema_init (&b->go, 0);
+  if (!enqueue (b))
+    {
+      sema_down (&b->go);
+      if (b->finished)
+        return;
+      lock_acquire (&b->block->queue_lock);
+    }
+  serve (b->block, b);
+}
+
+/* Reads or writes CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, and waits until that is done. */
+static void
+transfer_wait (struct block *block, block_sector_t sector, size_t cnt,
+               void *buffer, bool write)
+{
+  struct bio b;
+
+  if (cnt == 0)
+    return;
+  b.block = block;
+  b.sector = sector;
+  b.cnt = cnt;
+  b.buffer = buffer;
+  b.write = write;
+  submit_wait (&b);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +555,22 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer_wait (block, sector, 1, buffer, false);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Callers that have a run of sectors to read should use this
+   rather than calling block_read() for each.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded.  Requests from several
+   threads are served by class and priority, and in elevator
+   order within a process's requests. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  transfer_wait (block, sector, cnt, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +581,19 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer_wait (block, sector, 1, (void *) buffer, true);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns after
+   the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  transfer_wait (block, sector, cnt, (void *) buffer, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,20 +617,53 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Copies BLOCK's statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct blk_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Prints one direction's counters from S, named NAME. */
+static void
+print_stat (const char *name, const struct blk_stat *s)
+{
+  printf ("  %llu %s (%llu sectors), latency avg %llu us, max %llu us\n",
+          s->requests, name, s->sectors,
+          s->requests > 0 ? s->ns / s->requests / 1000 : 0,
+          s->max_ns / 1000);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
 {
-  int i;
+  static const char *class_names[BIO_CLASS_CNT] =
+    { [BIO_SYNC] = "sync", [BIO_FAULT] = "fault", [BIO_ASYNC] = "async" };
+  int i, c;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          struct blk_stats s;
+
+          block_get_stats (block, &s);
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  s.read.sectors, s.write.sectors);
+          print_stat ("read requests", &s.read);
+          print_stat ("write requests", &s.write);
+          printf ("  %llu merged, up to %"PRIu32" in flight\n",
+                  s.merged, s.max_in_flight);
+          for (c = 0; c < BIO_CLASS_CNT; c++)
+            if (s.class_requests[c] > 0)
+              printf ("  %llu %s requests, latency avg %llu us\n",
+                      s.class_requests[c], class_names[c],
+                      s.class_ns[c] / s.class_requests[c] / 1000);
         }
     }
 }
@@ -189,8 +679,17 @@ block_register (const char *name, enum block_type type,
                 const struct block_operations *ops, void *aux)
 {
   struct block *block = malloc (sizeof *block);
+  int i;
+
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
+  if (serve_queue == NULL)
+    {
+      serve_queue = work_queue_create ("block", PRI_DEFAULT, 2);
+      done_queue = work_queue_create ("bio-done", PRI_DEFAULT, 2);
+      if (serve_queue == NULL || done_queue == NULL)
+        PANIC ("Failed to start block I/O work queues");
+    }
 
   list_push_back (&all_blocks, &block->list_elem);
   strlcpy (block->name, name, sizeof block->name);
@@ -198,8 +697,16 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  lock_init (&block->queue_lock);
+  for (i = 0; i < BIO_CLASS_CNT; i++)
+    {
+      list_init (&block->queues[i]);
+      block->credit[i] = class_weight[i];
+      block->last_issuer[i] = -1;
+    }
+  block->busy = false;
+  block->head = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
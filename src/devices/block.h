@@ -1,8 +1,13 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <blkstat.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/workqueue.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -52,19 +57,90 @@ struct block *block_next (struct block *);
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* I/O classes.  Each request gets the class of the thread that
+   issues it, which is BIO_SYNC unless the thread says otherwise
+   with block_set_class().  The queue serves the classes by weight,
+   so a bulk transfer in one class delays the others only a little,
+   and within a class serves the issuing threads' priorities in
+   order, going round the processes of the same priority. */
+enum bio_class
+  {
+    BIO_SYNC = BLK_CLASS_SYNC,          /* A thread waits for it. */
+    BIO_FAULT = BLK_CLASS_FAULT,        /* A page fault waits for it. */
+    BIO_ASYNC = BLK_CLASS_ASYNC,        /* Readahead and write-back. */
+    BIO_CLASS_CNT = BLK_CLASS_CNT
+  };
+
+enum bio_class block_set_class (enum bio_class);
+
+/* Asynchronous I/O.
+
+   The caller fills in the first group of members of a bio and
+   passes it to block_submit(), which queues it and returns at
+   once.  The buffer must be in kernel memory, because another
+   thread may transfer it.  DONE(BIO) is called on a work queue
+   thread once the transfer is over; until then the block layer
+   owns the bio and the caller must not touch it or its buffer.  By
+   then, BLOCK and SECTOR may name the device underneath, for a
+   partition.  A DONE function may sleep, even on more block I/O,
+   but should not take long. */
+struct bio;
+typedef void bio_done_func (struct bio *);
+
+struct bio
+  {
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                         /* Write, or read? */
+    bio_done_func *done;                /* Called when done. */
+    void *aux;                          /* For DONE's use. */
+
+    /* Owned by the block layer. */
+    struct block *origin;               /* Device as submitted. */
+    enum bio_class class;               /* Issuing thread's class. */
+    int priority;                       /* Issuing thread's priority. */
+    int issuer;                         /* Issuing process's tid. */
+    uint64_t start_ns;                  /* When submitted. */
+    struct list_elem elem;              /* Element in the device's queue. */
+    struct work work;                   /* Runs the transfer or DONE. */
+    bool finished;                      /* Served by another thread? */
+    struct semaphore go;                /* Wakes a synchronous caller. */
+  };
+
+void block_submit (struct bio *);
+
 /* Statistics. */
+void block_get_stats (struct block *, struct blk_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTIPLE and WRITE_MULTIPLE, which transfer a run of
+   sectors at once, may be null, in which case the block layer
+   transfers one sector at a time instead.  A device that is part
+   of another, such as a partition, provides REMAP instead of
+   transfers of its own: it returns the device that holds the
+   sector that *SECTOR points to, which it updates to the sector's
+   number there, and the block layer sends the request there. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+    struct block *(*remap) (void *aux, block_sector_t *sector);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -3,12 +3,17 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stats.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +39,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -43,12 +49,35 @@
 #define DEV_LBA 0x40            /* Linear based addressing. */
 #define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
 
+/* Bus master IDE registers, at the I/O base in PCI BAR 4 of the
+   controller, plus 8 for the secondary channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master command register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master status register bits.  Writing 1 clears them. */
+#define BMS_ERR 0x02            /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk interrupted. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors that one command transfers.  A sector count of 0
+   would mean 256, which we never ask for. */
+#define MAX_NSECT 255
 
 /* An ATA device. */
 struct ata_disk
@@ -57,7 +86,24 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ/WRITE
+                                   MULTIPLE, or 0 if they are off. */
+    bool dma;                   /* Use bus master DMA? */
+  };
+
+/* Physical region descriptor: one physically contiguous piece of
+   a DMA transfer's buffer, which may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
   };
+#define PRD_EOT 0x8000
+
+/* Descriptors per channel.  The biggest transfer, of MAX_NSECT
+   sectors, needs at most 3. */
+#define PRD_CNT 8
 
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
@@ -71,21 +117,41 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    unsigned unexpected_cnt;    /* Interrupts while none was expected. */
+
+    uint16_t bm_base;           /* Bus master I/O base, or 0 if none. */
+    struct prd *prdt;           /* PRD table for bus master DMA. */
+
+    /* Statistics, changed with interrupts off. */
+    int in_flight;              /* Transfers waiting for or using LOCK. */
+    int max_in_flight;          /* Most in flight at once. */
+    unsigned long long transfers;       /* Transfers done. */
+    uint64_t busy_ns;           /* Time spent holding LOCK for transfers. */
+    uint64_t busy_since;        /* When the current transfer began. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
-#define CHANNEL_CNT 2
+#define CHANNEL_CNT IDE_CHANNELS
 static struct channel channels[CHANNEL_CNT];
 
+/* Channels in the middle of a transfer, and the time spent with
+   both at once, which shows how well they overlap.  Changed with
+   interrupts off. */
+static int busy_channels;
+static uint64_t overlap_ns;
+static uint64_t overlap_since;
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master (void);
+static void set_multiple_mode (struct ata_disk *, int cnt);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -96,13 +162,29 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static thread_func probe_channel;
+
+/* Upped by probe_channel() as each channel is done. */
+static struct semaphore probe_done;
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and detect disks.  Resetting a
+   channel takes at least 150 ms, and much longer if a device is
+   slow to come ready, so the channels are probed at once, each by
+   a thread of its own.  The disks found are then identified and
+   registered in channel order, so that block device names and
+   roles do not depend on which probe finished first. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
+  struct prd *prdt = NULL;
   size_t chan_no;
 
+  /* The PRD tables share a page, so that none crosses a 64 kB
+     boundary. */
+  if (bm_base != 0)
+    prdt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -126,6 +208,8 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = bm_base != 0 ? bm_base + 8 * chan_no : 0;
+      c->prdt = prdt != NULL ? prdt + PRD_CNT * chan_no : NULL;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,27 +220,95 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
+    }
+
+  /* Reset hardware and distinguish ATA hard disks from other
+     devices. */
+  sema_init (&probe_done, 0);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
 
-      /* Reset hardware. */
-      reset_channel (c);
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c)
+          == TID_ERROR)
+        probe_channel (c);
+    }
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probe_done);
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  /* Read hard disk identity information. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
     }
 }
+
+/* Resets channel C_ and checks which of its devices are ATA
+   disks. */
+static void
+probe_channel (void *c_)
+{
+  struct channel *c = c_;
+
+  reset_channel (c);
+  if (check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+  sema_up (&probe_done);
+}
 
 /* Disk detection and identification. */
 
+/* Looks on PCI bus 0 for an IDE controller that can be a bus
+   master, turns bus mastering on and returns its bus master I/O
+   base.  Returns 0 if there is none, which leaves every transfer
+   to PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+        uint32_t class = pci_read_config (dev, func, 0x08);
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Mass storage, IDE, bus master capable. */
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O and bus mastering in the command register. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        printf ("ide: bus master DMA at I/O port %#x\n",
+                (unsigned) (bar4 & 0xfffc));
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -303,6 +455,13 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Move several sectors per interrupt, as many as the disk
+     allows (in the low byte of word 47), if it supports that.  Use
+     DMA if both the controller and the disk (in bit 8 of word 49)
+     can. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -337,23 +496,301 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Turns on READ/WRITE MULTIPLE for disk D with CNT sectors per
+   interrupt, if CNT is positive and D accepts it.  Otherwise,
+   leaves them off. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt)
+{
+  struct channel *c = d->channel;
+
+  d->multiple = 0;
+  if (cnt <= 0)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
+
+/* Acquires channel C's lock for a transfer, keeping count of the
+   transfers in flight and the time C is busy. */
+static void
+channel_acquire (struct channel *c)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (++c->in_flight > c->max_in_flight)
+    c->max_in_flight = c->in_flight;
+  intr_set_level (old_level);
+
+  lock_acquire (&c->lock);
+
+  old_level = intr_disable ();
+  c->busy_since = clock_ns ();
+  if (busy_channels++ == 1)
+    overlap_since = c->busy_since;
+  intr_set_level (old_level);
+}
+
+/* Releases channel C's lock after a transfer. */
+static void
+channel_release (struct channel *c)
+{
+  enum intr_level old_level;
+  uint64_t now;
+
+  old_level = intr_disable ();
+  now = clock_ns ();
+  c->busy_ns += now - c->busy_since;
+  c->transfers++;
+  c->in_flight--;
+  if (busy_channels-- == 2)
+    overlap_ns += now - overlap_since;
+  intr_set_level (old_level);
+
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each channel with a disk. */
+void
+ide_print_stats (void)
+{
+  size_t chan_no;
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        printf ("%s: %llu transfers, busy %llu ms, "
+                "up to %d in flight\n",
+                c->name, c->transfers, c->busy_ns / 1000000,
+                c->max_in_flight);
+    }
+  printf ("ide: both channels busy for %llu ms\n", overlap_ns / 1000000);
+}
+
+/* Fills in S with statistics for each channel and for both. */
+void
+ide_get_stats (struct ide_stats *s)
+{
+  enum intr_level old_level;
+  size_t chan_no;
+
+  old_level = intr_disable ();
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+
+      s->transfers[chan_no] = c->transfers;
+      s->busy_ns[chan_no] = c->busy_ns;
+      s->max_in_flight[chan_no] = c->max_in_flight;
+    }
+  s->overlap_ns = overlap_ns;
+  intr_set_level (old_level);
+}
+
+/* Transfers the CNT sectors, at most MAX_NSECT, starting at
+   SEC_NO between disk D and BUFFER by bus master DMA, reading from
+   the disk if WRITE is false.  Returns true if successful, false
+   if D does not do DMA, BUFFER cannot take part in it, or the
+   transfer fails; for the last, DMA is turned off for D.  The
+   CPU is free for other threads while the transfer runs.  D's
+   channel lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t status;
+  uintptr_t phys;
+  size_t i;
+
+  if (!d->dma || !is_kernel_vaddr (buffer))
+    return false;
+
+  /* Describe BUFFER, which is physically contiguous as all kernel
+     memory is, in pieces that do not cross 64 kB boundaries. */
+  phys = vtop (buffer);
+  for (i = 0; size > 0; i++)
+    {
+      size_t piece = 0x10000 - (phys & 0xffff);
+
+      if (i >= PRD_CNT)
+        return false;
+      if (piece > size)
+        piece = size;
+      c->prdt[i].addr = phys;
+      c->prdt[i].size = piece & 0xffff;
+      c->prdt[i].flags = 0;
+      phys += piece;
+      size -= piece;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  /* Program the controller, then the disk, then start. */
+  outb (reg_bm_command (c), write ? 0 : BMC_READ);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BMS_ERR | BMS_INTR);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BMC_READ) | BMC_START);
+
+  /* The disk interrupts once, when it is done. */
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), 0);
+  status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), status | BMS_ERR | BMS_INTR);
+  if ((status & BMS_ERR) != 0 || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA transfer failed, sector=%"PRDSNu", "
+              "using PIO from now on\n", d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/* Reads the CNT sectors, at most MAX_NSECT, starting at SEC_NO
+   from disk D into BUFFER by PIO, using as few interrupts as D
+   allows.  D's channel lock must be held. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                        : CMD_READ_SECTOR_RETRY);
+
+  /* The disk interrupts once per block of sectors. */
+  while (cnt > 0)
+    {
+      size_t block = d->multiple > 0 ? (size_t) d->multiple : 1;
+      size_t i;
+
+      if (block > cnt)
+        block = cnt;
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+      for (i = 0; i < block; i++)
+        {
+          input_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+        }
+      cnt -= block;
+      sec_no += block;
+    }
+}
+
+/* Writes the CNT sectors, at most MAX_NSECT, starting at SEC_NO
+   to disk D from BUFFER by PIO, using as few interrupts as D
+   allows.  D's channel lock must be held. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                        : CMD_WRITE_SECTOR_RETRY);
+
+  /* The first block goes as soon as the disk asks for it, each
+     later one after the interrupt for the block before. */
+  while (cnt > 0)
+    {
+      size_t block = d->multiple > 0 ? (size_t) d->multiple : 1;
+      size_t i;
+
+      if (block > cnt)
+        block = cnt;
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      for (i = 0; i < block; i++)
+        {
+          output_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+        }
+      sema_down (&c->completion_wait);
+      cnt -= block;
+      sec_no += block;
+    }
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes,
+   by DMA if possible and by PIO otherwise, using as few commands
+   as it can.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  uint8_t *buffer = buffer_;
+
+  channel_acquire (c);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+
+      if (!dma_transfer (d, sec_no, nsect, buffer, false))
+        pio_read (d, sec_no, nsect, buffer);
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
+  channel_release (c);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, by DMA if
+   possible and by PIO otherwise, using as few commands as it can.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  channel_acquire (c);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+
+      if (!dma_transfer (d, sec_no, nsect, buffer, true))
+        pio_write (d, sec_no, nsect, buffer);
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
+  channel_release (c);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -362,38 +799,34 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d, sec_no, 1, buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and MAX_NSECT,
+   to the disk's sector selection registers.  (We use LBA
+   mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_NSECT);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -517,7 +950,16 @@ interrupt_handler (struct intr_frame *f)
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
-          printf ("%s: unexpected interrupt\n", c->name);
+          {
+            /* Acknowledge it too, so that the device stops asking.
+               Print the first time and at each power of 2, so that
+               a storm does not tie up the console. */
+            inb (reg_status (c));
+            c->unexpected_cnt++;
+            if ((c->unexpected_cnt & (c->unexpected_cnt - 1)) == 0)
+              printf ("%s: %u unexpected interrupts\n",
+                      c->name, c->unexpected_cnt);
+          }
         return;
       }
 
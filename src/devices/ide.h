@@ -1,6 +1,10 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+struct ide_stats;
+
 void ide_init (void);
+void ide_print_stats (void);
+void ide_get_stats (struct ide_stats *);
 
 #endif /* devices/ide.h */
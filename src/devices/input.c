@@ -41,6 +41,21 @@ input_getc (void)
   return key;
 }
 
+/* Returns true if a key is waiting in the input buffer.  Otherwise,
+   if E is nonnull, registers it for poller W, to be woken once a key
+   arrives. */
+bool
+input_poll (struct poll_entry *e, struct poll_wait *w)
+{
+  enum intr_level old_level;
+  bool ready;
+
+  old_level = intr_disable ();
+  ready = intq_poll (&buffer, e, w);
+  intr_set_level (old_level);
+  return ready;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
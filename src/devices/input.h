@@ -9,4 +9,8 @@ void input_putc (uint8_t);
 uint8_t input_getc (void);
 bool input_full (void);
 
+struct poll_entry;
+struct poll_wait;
+bool input_poll (struct poll_entry *, struct poll_wait *);
+
 #endif /* devices/input.h */
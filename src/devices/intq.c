@@ -12,6 +12,7 @@ intq_init (struct intq *q)
 {
   lock_init (&q->lock);
   q->not_full = q->not_empty = NULL;
+  poll_queue_init (&q->pollers);
   q->head = q->tail = 0;
 }
 
@@ -72,6 +73,20 @@ intq_putc (struct intq *q, uint8_t byte)
   q->buf[q->head] = byte;
   q->head = next (q->head);
   signal (q, &q->not_empty);
+  poll_queue_wake (&q->pollers);
+}
+
+/* Returns true if Q holds a byte to read.  Otherwise, if E is
+   nonnull, registers it for poller W, to be woken once Q changes. */
+bool
+intq_poll (struct intq *q, struct poll_entry *e, struct poll_wait *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (!intq_empty (q))
+    return true;
+  if (e != NULL)
+    poll_queue_add (&q->pollers, e, w);
+  return false;
 }
 
 /* Returns the position after POS within an intq. */
@@ -2,6 +2,7 @@
 #define DEVICES_INTQ_H
 
 #include "threads/interrupt.h"
+#include "threads/pollq.h"
 #include "threads/synch.h"
 
 /* An "interrupt queue", a circular buffer shared between
@@ -27,6 +28,7 @@ struct intq
     struct lock lock;           /* Only one thread may wait at once. */
     struct thread *not_full;    /* Thread waiting for not-full condition. */
     struct thread *not_empty;   /* Thread waiting for not-empty condition. */
+    struct poll_queue pollers;  /* Threads polling for not-empty. */
 
     /* Queue. */
     uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
@@ -39,5 +41,6 @@ bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
+bool intq_poll (struct intq *, struct poll_entry *, struct poll_wait *);
 
 #endif /* devices/intq.h */
@@ -317,8 +317,21 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Returns the device that partition P is part of and turns
+   *SECTOR, a sector within P, into that device's sector number. */
+static struct block *
+partition_remap (void *p_, block_sector_t *sector)
+{
+  struct partition *p = p_;
+  *sector += p->start;
+  return p->block;
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    NULL,
+    NULL,
+    partition_remap
   };
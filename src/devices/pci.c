@@ -0,0 +1,26 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* PCI configuration space access, mechanism #1. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register at offset REG of
+   device DEV, function FUNC on bus 0. */
+uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (func << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit PCI configuration register at offset
+   REG of device DEV, function FUNC on bus 0. */
+void
+pci_write_config (int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDRESS,
+        0x80000000 | (dev << 11) | (func << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, data);
+}
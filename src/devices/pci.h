@@ -0,0 +1,10 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+
+/* PCI configuration space, on bus 0 only. */
+uint32_t pci_read_config (int dev, int func, int reg);
+void pci_write_config (int dev, int func, int reg, uint32_t data);
+
+#endif /* devices/pci.h */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,44 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Programs PIT channel CHANNEL to raise a single interrupt after
+   COUNT cycles of its PIT_HZ clock (mode 0, "interrupt on
+   terminal count").  COUNT must be between 1 and 65536.  Only
+   channel 0 is wired to an interrupt.  Use
+   pit_configure_channel() to go back to a periodic timer. */
+void
+pit_start_oneshot (int channel, unsigned count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0);
+  ASSERT (count >= 1 && count <= 65536);
+
+  /* A count of 65536 is written as 0. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of PIT channel CHANNEL's down
+   counter. */
+unsigned
+pit_read_count (int channel)
+{
+  enum intr_level old_level;
+  unsigned lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Latch the counter so that the two bytes read are consistent. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  return lo | (hi << 8);
+}
@@ -0,0 +1,157 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* RAM disks.
+
+   Each RAM disk is an array of kernel pool pages, allocated and
+   zeroed at boot, that holds the disk's sectors in order.  The
+   pages need not be contiguous, so even a large disk only needs
+   that much free memory, not a run of it.  A transfer is a memcpy
+   per page it touches, done on the block layer's work queue
+   threads like any other device's, so the single-sector,
+   multi-sector and asynchronous interfaces all work unchanged.
+
+   RAM disks register as "rd0", "rd1", ... of type BLOCK_RAW, so
+   that no role goes to one by default.  Name one in -filesys=,
+   -scratch= or -swap= to use it; a file system on it needs -f. */
+
+/* Most RAM disks. */
+#define RAMDISK_MAX 4
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    void **pages;               /* Pages holding the sectors. */
+    block_sector_t size;        /* Size in sectors. */
+  };
+
+/* Sizes in MB of the RAM disks to create, set by -ramdisk. */
+static const char *ramdisk_sizes;
+
+static struct block_operations ramdisk_operations;
+
+/* Sets the sizes of the RAM disks that ramdisk_init() creates
+   from SIZES, a comma-separated list of sizes in MB. */
+void
+ramdisk_set_sizes (const char *sizes)
+{
+  ramdisk_sizes = sizes;
+}
+
+/* Creates one RAM disk of MB megabytes, named NAME. */
+static void
+create_ramdisk (const char *name, size_t mb)
+{
+  struct ramdisk *rd;
+  size_t page_cnt = mb * (1024 * 1024 / PGSIZE);
+  size_t i;
+
+  rd = malloc (sizeof *rd);
+  if (rd != NULL)
+    rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd == NULL || rd->pages == NULL)
+    PANIC ("%s: out of memory", name);
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("%s: out of memory after %zu of %zu pages "
+               "(-ul can free some for the kernel)", name, i, page_cnt);
+    }
+  rd->size = page_cnt * SECTORS_PER_PAGE;
+  block_register (name, BLOCK_RAW, "RAM disk", rd->size,
+                  &ramdisk_operations, rd);
+}
+
+/* Creates the RAM disks asked for with ramdisk_set_sizes(). */
+void
+ramdisk_init (void)
+{
+  const char *p = ramdisk_sizes;
+  int n = 0;
+
+  while (p != NULL && *p != '\0')
+    {
+      char name[16];
+      int mb = atoi (p);
+
+      if (mb <= 0 || n >= RAMDISK_MAX)
+        PANIC ("bad -ramdisk size list `%s'", ramdisk_sizes);
+      snprintf (name, sizeof name, "rd%d", n++);
+      create_ramdisk (name, mb);
+      p = strchr (p, ',');
+      if (p != NULL)
+        p++;
+    }
+}
+
+/* Copies CNT sectors starting at SECTOR of RD to or from BUFFER: out
+   of BUFFER if WRITE, otherwise into it. */
+static void
+ramdisk_copy (struct ramdisk *rd, block_sector_t sector, size_t cnt,
+              void *buffer, bool write)
+{
+  uint8_t *buf = buffer;
+
+  ASSERT (sector + cnt <= rd->size);
+  while (cnt > 0)
+    {
+      size_t ofs = sector % SECTORS_PER_PAGE;
+      size_t n = SECTORS_PER_PAGE - ofs;
+      uint8_t *page = rd->pages[sector / SECTORS_PER_PAGE];
+
+      if (n > cnt)
+        n = cnt;
+      if (write)
+        memcpy (page + ofs * BLOCK_SECTOR_SIZE, buf, n * BLOCK_SECTOR_SIZE);
+      else
+        memcpy (buf, page + ofs * BLOCK_SECTOR_SIZE, n * BLOCK_SECTOR_SIZE);
+      buf += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  ramdisk_copy (rd, sector, 1, buffer, false);
+}
+
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  ramdisk_copy (rd, sector, 1, (void *) buffer, true);
+}
+
+static void
+ramdisk_read_multiple (void *rd, block_sector_t sector, size_t cnt,
+                       void *buffer)
+{
+  ramdisk_copy (rd, sector, cnt, buffer, false);
+}
+
+static void
+ramdisk_write_multiple (void *rd, block_sector_t sector, size_t cnt,
+                        const void *buffer)
+{
+  ramdisk_copy (rd, sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL,
+  };
@@ -0,0 +1,7 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+void ramdisk_set_sizes (const char *sizes);
+void ramdisk_init (void);
+
+#endif /* devices/ramdisk.h */
@@ -1,5 +1,6 @@
 #include "devices/rtc.h"
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/io.h"
 
 /* This code is an interface to the MC146818A-compatible real
@@ -28,14 +29,27 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_RATE	0x0f	/* Periodic interrupt rate select. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Periodic interrupt enable. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
+/* Rate select values and the frequencies they give: rate R
+   interrupts 32768 >> (R - 1) times a second.  Rates 1 and 2 do
+   not work on every chip. */
+#define RTC_RATE_MIN 3          /* 8192 Hz. */
+#define RTC_RATE_MAX 15         /* 2 Hz. */
+
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t);
+
+/* Called on each periodic interrupt. */
+static intr_handler_func *periodic_handler;
+static intr_handler_func rtc_interrupt;
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -95,6 +109,40 @@ rtc_get_time (void)
   return time;
 }
 
+/* Starts the real-time clock's periodic interrupt at the fastest
+   rate it supports that is no faster than HZ, but at least 2 Hz,
+   calling HANDLER from each interrupt.  Returns the rate chosen,
+   in interrupts per second. */
+unsigned
+rtc_start_periodic (unsigned hz, intr_handler_func *handler)
+{
+  enum intr_level old_level;
+  int rate;
+
+  for (rate = RTC_RATE_MIN; rate < RTC_RATE_MAX; rate++)
+    if (32768u >> (rate - 1) <= hz)
+      break;
+
+  old_level = intr_disable ();
+  periodic_handler = handler;
+  intr_register_ext (0x28, rtc_interrupt, "RTC");
+  cmos_write (RTC_REG_A, (cmos_read (RTC_REG_A) & ~RTCSA_RATE) | rate);
+  cmos_write (RTC_REG_B, cmos_read (RTC_REG_B) | RTCSB_PIE);
+  cmos_read (RTC_REG_C);
+  intr_set_level (old_level);
+
+  return 32768u >> (rate - 1);
+}
+
+/* Periodic interrupt handler.  Reading register C acknowledges
+   the interrupt; until then, the chip raises no more. */
+static void
+rtc_interrupt (struct intr_frame *f)
+{
+  cmos_read (RTC_REG_C);
+  periodic_handler (f);
+}
+
 /* Returns the integer value of the given BCD byte. */
 static int
 bcd_to_bin (uint8_t x)
@@ -110,3 +158,11 @@ cmos_read (uint8_t index)
   outb (CMOS_REG_SET, index);
   return inb (CMOS_REG_IO);
 }
+
+/* Writes BYTE to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t byte)
+{
+  outb (CMOS_REG_SET, index);
+  outb (CMOS_REG_IO, byte);
+}
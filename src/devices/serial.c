@@ -1,7 +1,6 @@
 #include "devices/serial.h"
 #include <debug.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -44,6 +43,10 @@
 /* MODEM Control Register. */
 #define MCR_OUT2 0x08           /* Output line 2. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear receive and transmit FIFOs. */
+
 /* Line Status Register. */
 #define LSR_DR 0x01             /* Data Ready: received data byte is in RBR. */
 #define LSR_THRE 0x20           /* THR Empty. */
@@ -51,11 +54,27 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
+/* Bytes the 16550A's transmit FIFO holds. */
+#define XMIT_FIFO 16
+
+/* Data to be transmitted, in a circular buffer of TXQ_SIZE bytes.
+   TXQ_HEAD and TXQ_TAIL count the bytes ever added and removed, so
+   their difference is the number queued.  Interrupts must be off
+   to touch them.
+
+   Writers only wait on the port when the buffer fills up.  With
+   interrupts on they sleep on TXQ_ROOM until the interrupt handler
+   has drained half the buffer; with interrupts off they send the
+   oldest byte by polling to make room. */
+#define TXQ_SIZE 4096
+static uint8_t txq[TXQ_SIZE];
+static unsigned txq_head, txq_tail;
+static struct semaphore txq_room;
+static int txq_waiters;
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
+static void putc_queue (uint8_t, enum intr_level);
 static void write_ier (void);
 static intr_handler_func serial_interrupt;
 
@@ -71,7 +90,6 @@ init_poll (void)
   outb (FCR_REG, 0);                    /* Disable FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
   mode = POLL;
 } 
 
@@ -87,7 +105,9 @@ serial_init_queue (void)
     init_poll ();
   ASSERT (mode == POLL);
 
+  sema_init (&txq_room, 0);
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);
   mode = QUEUE;
   old_level = intr_disable ();
   write_ier ();
@@ -112,31 +132,48 @@ serial_putc (uint8_t byte)
     {
       /* Otherwise, queue a byte and update the interrupt enable
          register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
-        {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
-        }
-
-      intq_putc (&txq, byte); 
+      putc_queue (byte, old_level);
       write_ier ();
     }
   
   intr_set_level (old_level);
 }
 
+/* Sends the SIZE bytes in BUFFER to the serial port.  Returns as
+   soon as they are queued, which only waits on the port if the
+   transmit buffer fills up. */
+void
+serial_putbuf (const void *buffer, size_t size)
+{
+  const uint8_t *p = buffer;
+  enum intr_level old_level = intr_disable ();
+
+  if (mode != QUEUE)
+    {
+      if (mode == UNINIT)
+        init_poll ();
+      while (size-- > 0)
+        putc_poll (*p++);
+    }
+  else
+    {
+      while (size-- > 0)
+        putc_queue (*p++, old_level);
+      write_ier ();
+    }
+
+  intr_set_level (old_level);
+}
+
 /* Flushes anything in the serial buffer out the port in polling
-   mode. */
+   mode.  Only needed when the kernel is about to stop, at panic
+   or shutdown. */
 void
 serial_flush (void) 
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  while (txq_head != txq_tail)
+    putc_poll (txq[txq_tail++ % TXQ_SIZE]);
   intr_set_level (old_level);
 }
 
@@ -182,7 +219,7 @@ write_ier (void)
 
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (txq_head != txq_tail)
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
@@ -205,6 +242,33 @@ putc_poll (uint8_t byte)
   outb (THR_REG, byte);
 }
 
+/* Adds BYTE to the transmit buffer, first making room if it is
+   full.  OLD_LEVEL is the interrupt level the caller had before
+   turning interrupts off. */
+static void
+putc_queue (uint8_t byte, enum intr_level old_level)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (txq_head - txq_tail == TXQ_SIZE)
+    {
+      if (old_level == INTR_OFF || intr_context ())
+        {
+          /* Waiting for the queue to drain would mean turning
+             interrupts back on, which is impolite, so send a
+             character by polling instead. */
+          putc_poll (txq[txq_tail++ % TXQ_SIZE]);
+        }
+      else
+        {
+          txq_waiters++;
+          write_ier ();
+          sema_down (&txq_room);
+        }
+    }
+  txq[txq_head++ % TXQ_SIZE] = byte;
+}
+
 /* Serial interrupt handler. */
 static void
 serial_interrupt (struct intr_frame *f UNUSED) 
@@ -218,10 +282,19 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* Once the transmit FIFO is empty, refill it from the queue. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0)
+    {
+      int i;
+
+      for (i = 0; i < XMIT_FIFO && txq_head != txq_tail; i++)
+        outb (THR_REG, txq[txq_tail++ % TXQ_SIZE]);
+    }
+
+  /* Wake writers waiting for room once half the queue is free. */
+  if (txq_waiters > 0 && txq_head - txq_tail <= TXQ_SIZE / 2)
+    for (; txq_waiters > 0; txq_waiters--)
+      sema_up (&txq_room);
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
@@ -4,15 +4,27 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/alloctrack.h"
+#include "threads/fpu.h"
+#include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/scstat.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/ide.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/vmstat.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -91,12 +103,14 @@ shutdown_power_off (void)
   const char *p;
 
 #ifdef FILESYS
+  trace_save ();
   filesys_done ();
 #endif
 
   print_stats ();
 
   printf ("Powering off...\n");
+  console_flush ();
   serial_flush ();
 
   /* This is a special power-off sequence supported by Bochs and
@@ -119,13 +133,26 @@ static void
 print_stats (void)
 {
   timer_print_stats ();
+  intr_print_stats ();
+  intr_latency_print ();
   thread_print_stats ();
+  fpu_print_stats ();
+  lock_profile_print ();
+  profile_print ();
+  trace_print ();
+  palloc_print_stats ();
+  alloctrack_print ();
 #ifdef FILESYS
   block_print_stats ();
+  ide_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  scstat_print ();
+#endif
+#ifdef VM
+  vmstat_print ();
 #endif
 }
@@ -7,6 +7,8 @@
 
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -22,28 +24,98 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Timers waiting to fire, kept in a hierarchical timer wheel.
+   Level L has WHEEL_SIZE slots that each cover WHEEL_SIZE**L
+   ticks, so a timer due less than WHEEL_SIZE**(L+1) ticks from
+   now sits in level L.  Each tick runs one level-0 slot, and
+   every time a level's index wraps around the next level's
+   current slot is emptied into the lower levels.  A timer is
+   thus moved at most WHEEL_LEVELS times before it fires.  Timers
+   due beyond the top level's range are parked in its farthest
+   slot and placed again when it comes around. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* Tickless idle.  While only the idle thread runs, channel 0 is
+   switched to a one-shot count that ends at the next tick when
+   something must happen: a timer is due, a wheel level cascades,
+   or, under -o mlfqs, load_avg is recomputed.  idle_deadline is
+   that tick, or 0 while the timer is periodic.  The PIT counter
+   is only 16 bits, so at most IDLE_TICKS_MAX ticks are skipped at
+   once. */
+#define PIT_CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define IDLE_TICKS_MAX (65536 / PIT_CYCLES_PER_TICK)
+static int64_t idle_deadline;
+
+/* TSC clock calibration, from timer_calibrate().  tsc_hz is 0
+   until then, and clock_ns() falls back to counting ticks. */
+#define NS_PER_SEC 1000000000ULL
+#define CLOCK_CALIBRATE_TICKS (TIMER_FREQ / 4)
+static uint64_t tsc_hz;
+static uint64_t clock_base_tsc;
+static uint64_t clock_base_ns;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Calibration given on the command line, 0 if none. */
+static unsigned preset_loops_per_tick;
+static uint64_t preset_tsc_hz;
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops(unsigned loops);
 static void busy_wait(int64_t loops);
 static void real_time_sleep(int64_t num, int32_t denom);
 static void real_time_delay(int64_t num, int32_t denom);
+static void wheel_insert(struct timer*);
+static void wheel_advance(void);
+static void idle_account(int64_t skipped);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void timer_init(void) {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++) list_init(&wheel[level][slot]);
+
   pit_configure_channel(0, 2, TIMER_FREQ);
   intr_register_ext(0x20, timer_interrupt, "8254 Timer");
 }
 
+/* Makes timer_calibrate() use LOOPS_PER_TICK and a TSC of
+   TSC_KHZ kHz, as it printed on an earlier boot on the same
+   machine, instead of measuring them, which takes about half a
+   second. */
+void timer_set_calibration(unsigned loops_per_tick_, unsigned tsc_khz) {
+  preset_loops_per_tick = loops_per_tick_;
+  preset_tsc_hz = (uint64_t)tsc_khz * 1000;
+}
+
 /* Calibrates loops_per_tick, used to implement brief delays. */
 void timer_calibrate(void) {
   unsigned high_bit, test_bit;
+  uint64_t tsc_start, tsc_end;
+  int64_t start;
 
   ASSERT(intr_get_level() == INTR_ON);
+  if (preset_loops_per_tick != 0 && preset_tsc_hz != 0) {
+    enum intr_level old_level = intr_disable();
+    loops_per_tick = preset_loops_per_tick;
+    clock_base_ns = ticks * (NS_PER_SEC / TIMER_FREQ);
+    clock_base_tsc = rdtsc();
+    tsc_hz = preset_tsc_hz;
+    intr_set_level(old_level);
+    printf("Timer calibration from command line: %'" PRIu64
+           " loops/s, TSC at %'" PRIu64 " Hz.\n",
+           (uint64_t)loops_per_tick * TIMER_FREQ, tsc_hz);
+    return;
+  }
+
   printf("Calibrating timer...  ");
 
   /* Approximate loops_per_tick as the largest power-of-two
@@ -60,6 +132,35 @@ void timer_calibrate(void) {
     if (!too_many_loops(high_bit | test_bit)) loops_per_tick |= test_bit;
 
   printf("%'" PRIu64 " loops/s.\n", (uint64_t)loops_per_tick * TIMER_FREQ);
+
+  /* Count TSC cycles across whole timer ticks, starting right at
+     a tick edge. */
+  start = ticks;
+  while (ticks == start) barrier();
+  tsc_start = rdtsc();
+  start = ticks;
+  while (ticks - start < CLOCK_CALIBRATE_TICKS) barrier();
+  tsc_end = rdtsc();
+
+  clock_base_ns = start * (NS_PER_SEC / TIMER_FREQ);
+  clock_base_tsc = tsc_start;
+  tsc_hz = (tsc_end - tsc_start) * TIMER_FREQ / CLOCK_CALIBRATE_TICKS;
+  printf("TSC runs at %'" PRIu64 " Hz.  "
+         "Pass -calibrate=%u,%" PRIu64 " to skip calibration.\n",
+         tsc_hz, loops_per_tick, tsc_hz / 1000);
+}
+
+/* Returns CYCLES time-stamp counter cycles in nanoseconds. */
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+  if (tsc_hz == 0) return 0;
+  /* Split off whole seconds so the product cannot overflow. */
+  return cycles / tsc_hz * NS_PER_SEC + cycles % tsc_hz * NS_PER_SEC / tsc_hz;
+}
+
+/* Returns the number of nanoseconds since the OS booted. */
+uint64_t clock_ns(void) {
+  if (tsc_hz == 0) return timer_ticks() * (NS_PER_SEC / TIMER_FREQ);
+  return clock_base_ns + clock_cycles_to_ns(rdtsc() - clock_base_tsc);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -133,12 +234,143 @@ void timer_print_stats(void) {
   printf("Timer: %" PRId64 " ticks\n", timer_ticks());
 }
 
+/* Arms timer T to call FUNC(AUX) at tick WHEN.  If WHEN has
+   already passed, FUNC is called at the next tick.  T must not be
+   armed already. */
+void timer_arm(struct timer* t, int64_t when, timer_func* func, void* aux) {
+  enum intr_level old_level;
+
+  ASSERT(t != NULL);
+  ASSERT(func != NULL);
+
+  old_level = intr_disable();
+  ASSERT(!t->armed);
+  timer_idle_exit();
+  t->expires = when > ticks ? when : ticks + 1;
+  t->func = func;
+  t->aux = aux;
+  t->armed = true;
+  wheel_insert(t);
+  intr_set_level(old_level);
+}
+
+/* Disarms timer T.  Returns true if T was armed, false if it had
+   already fired or was never armed. */
+bool timer_cancel(struct timer* t) {
+  enum intr_level old_level;
+  bool was_armed;
+
+  old_level = intr_disable();
+  was_armed = t->armed;
+  if (was_armed) {
+    list_remove(&t->elem);
+    t->armed = false;
+  }
+  intr_set_level(old_level);
+  return was_armed;
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  Stops the periodic timer interrupt until the
+   next tick at which there is work to do, if that is more than
+   one tick away. */
+void timer_idle_enter(void) {
+  int64_t when;
+  int skip;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (idle_deadline != 0) return;
+  for (skip = 1; skip < IDLE_TICKS_MAX; skip++) {
+    when = ticks + skip;
+    if (!list_empty(&wheel[0][when & WHEEL_MASK]) || (when & WHEEL_MASK) == 0 ||
+        (thread_mlfqs && when % TIMER_FREQ == 0))
+      break;
+  }
+  if (skip <= 1) return;
+
+  idle_deadline = ticks + skip;
+  pit_start_oneshot(0, skip * PIT_CYCLES_PER_TICK);
+}
+
+/* Ends tickless idle early, because a thread other than the idle
+   thread is about to run or a timer is being armed.  Counts the
+   whole ticks that have passed so far and restarts the periodic
+   timer.  Interrupts must be off. */
+void timer_idle_exit(void) {
+  unsigned programmed, elapsed;
+  int64_t skipped;
+
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (idle_deadline == 0) return;
+  programmed = (idle_deadline - ticks) * PIT_CYCLES_PER_TICK;
+  elapsed = programmed - pit_read_count(0);
+  skipped = elapsed / PIT_CYCLES_PER_TICK;
+  /* The deadline tick itself belongs to timer_interrupt(). */
+  if (skipped > idle_deadline - ticks - 1) skipped = idle_deadline - ticks - 1;
+  idle_account(skipped);
+}
+
+/* Adds SKIPPED idle ticks that passed without a timer interrupt
+   and goes back to a periodic timer.  No timer is due and no
+   wheel level cascades during those ticks, so there is nothing to
+   run for them. */
+static void idle_account(int64_t skipped) {
+  ticks += skipped;
+  thread_idle_ticks(skipped);
+  idle_deadline = 0;
+  pit_configure_channel(0, 2, TIMER_FREQ);
+}
+
 /* Timer interrupt handler. */
-static void timer_interrupt(struct intr_frame* args UNUSED) {
-  thread_tick();
+static void timer_interrupt(struct intr_frame* args) {
+  if (idle_deadline != 0) idle_account(idle_deadline - ticks - 1);
   ticks++;
+  thread_tick(args->cs != SEL_KCSEG);
+  profile_tick(args);
+
+  wheel_advance();
+}
 
-  thread_wake_sleeping(ticks);
+/* Puts armed timer T in the wheel slot matching how far in the
+   future it expires.  T must not expire before the current tick.
+   Interrupts must be off. */
+static void wheel_insert(struct timer* t) {
+  int64_t expires = t->expires;
+  int64_t delta = expires - ticks;
+  int level;
+
+  ASSERT(delta >= 0);
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < (int64_t)1 << (WHEEL_BITS * (level + 1))) break;
+  if (delta >= (int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+    expires = ticks + ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+  list_push_back(&wheel[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                 &t->elem);
+}
+
+/* Runs the timers due at the current tick, first moving timers
+   from any higher-level slot that has come around into the lower
+   levels.  Interrupts must be off. */
+static void wheel_advance(void) {
+  struct list* slot;
+  int level;
+
+  for (level = 1; level < WHEEL_LEVELS; level++) {
+    if (((ticks >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) != 0) break;
+    slot = &wheel[level][(ticks >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    while (!list_empty(slot))
+      wheel_insert(list_entry(list_pop_front(slot), struct timer, elem));
+  }
+
+  slot = &wheel[0][ticks & WHEEL_MASK];
+  while (!list_empty(slot)) {
+    struct timer* t = list_entry(list_pop_front(slot), struct timer, elem);
+    ASSERT(t->expires <= ticks);
+    t->armed = false;
+    t->func(t->aux);
+  }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -9,6 +11,7 @@
 
 void timer_init (void);
 void timer_calibrate (void);
+void timer_set_calibration (unsigned loops_per_tick, unsigned tsc_khz);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
@@ -26,4 +29,40 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* High-resolution monotonic clock, driven by the CPU's
+   time-stamp counter and calibrated against the PIT at boot. */
+uint64_t clock_ns (void);
+uint64_t clock_cycles_to_ns (uint64_t cycles);
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Kernel timers.  A timer armed for tick T calls its function,
+   with interrupts off from the timer interrupt handler, at the
+   first timer tick that is at least T.  Arming, cancelling and
+   firing are all O(1) amortized. */
+typedef void timer_func (void *aux);
+
+struct timer
+  {
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+    int64_t expires;            /* Tick at which to fire. */
+    timer_func *func;           /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+    bool armed;                 /* Waiting to fire? */
+  };
+
+void timer_arm (struct timer *, int64_t when, timer_func *, void *aux);
+bool timer_cancel (struct timer *);
+
 #endif /* devices/timer.h */
@@ -26,6 +26,14 @@ static size_t cx, cy;
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+/* Framebuffer row that shows screen row 0.  Only nonzero while a
+   batch of output is being rendered: scrolling just moves it
+   along, and the end of the batch puts the rows back in order
+   with a single copy, however many lines the batch scrolled. */
+static size_t first_row;
+
+static void put_char (uint8_t c);
+static void end_batch (void);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
@@ -51,12 +59,55 @@ init (void)
 void
 vga_putc (int c)
 {
+  uint8_t byte = c;
+  vga_putbuf (&byte, 1);
+}
+
+/* Writes the SIZE characters in BUFFER to the VGA text display,
+   like vga_putc() for each, but scrolling and moving the hardware
+   cursor just once. */
+void
+vga_putbuf (const void *buffer, size_t size)
+{
+  const uint8_t *p = buffer;
+
   /* Disable interrupts to lock out interrupt handlers
      that might write to the console. */
   enum intr_level old_level = intr_disable ();
 
   init ();
-  
+
+  while (size-- > 0)
+    {
+      uint8_t c = *p++;
+
+      if (c == '\a')
+        {
+          end_batch ();
+          intr_set_level (old_level);
+          speaker_beep ();
+          intr_disable ();
+        }
+      else
+        put_char (c);
+    }
+  end_batch ();
+
+  intr_set_level (old_level);
+}
+
+/* Returns screen row Y. */
+static uint8_t
+(*row (size_t y))[2]
+{
+  return fb[(first_row + y) % ROW_CNT];
+}
+
+/* Renders C, which is not '\a', without moving the hardware
+   cursor. */
+static void
+put_char (uint8_t c)
+{
   switch (c) 
     {
     case '\n':
@@ -82,26 +133,33 @@ vga_putc (int c)
         newline ();
       break;
 
-    case '\a':
-      intr_set_level (old_level);
-      speaker_beep ();
-      intr_disable ();
-      break;
-      
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      row (cy)[cx][0] = c;
+      row (cy)[cx][1] = GRAY_ON_BLACK;
       if (++cx >= COL_CNT)
         newline ();
       break;
     }
+}
 
-  /* Update cursor position. */
-  move_cursor ();
+/* Finishes rendering a batch: puts the framebuffer rows back in
+   screen order and updates the hardware cursor. */
+static void
+end_batch (void)
+{
+  if (first_row != 0)
+    {
+      static uint8_t top[ROW_CNT][COL_CNT][2];
+      size_t cnt = ROW_CNT - first_row;
 
-  intr_set_level (old_level);
+      memcpy (top, fb, sizeof fb[0] * first_row);
+      memmove (&fb[0], &fb[first_row], sizeof fb[0] * cnt);
+      memcpy (&fb[cnt], top, sizeof fb[0] * first_row);
+      first_row = 0;
+    }
+  move_cursor ();
 }
-
+
 /* Clears the screen and moves the cursor to the upper left. */
 static void
 cls (void)
@@ -111,8 +169,7 @@ cls (void)
   for (y = 0; y < ROW_CNT; y++)
     clear_row (y);
 
-  cx = cy = 0;
-  move_cursor ();
+  cx = cy = first_row = 0;
 }
 
 /* Clears row Y to spaces. */
@@ -123,8 +180,8 @@ clear_row (size_t y)
 
   for (x = 0; x < COL_CNT; x++)
     {
-      fb[y][x][0] = ' ';
-      fb[y][x][1] = GRAY_ON_BLACK;
+      row (y)[x][0] = ' ';
+      row (y)[x][1] = GRAY_ON_BLACK;
     }
 }
 
@@ -139,7 +196,7 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
+      first_row = (first_row + 1) % ROW_CNT;
       clear_row (ROW_CNT - 1);
     }
 }
@@ -0,0 +1,489 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <packed.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtio block devices, through the legacy PCI interface of the
+   virtio 0.9.5 specification, which QEMU offers for its
+   "virtio-blk-pci" devices unless told to be modern-only.
+
+   Unlike an emulated IDE disk, where every register access and
+   every word of PIO traps to the hypervisor, a virtio disk takes a
+   request as a chain of descriptors in shared memory and costs
+   one exit to notify per request, however large, plus one
+   interrupt to complete it.
+
+   A request is a chain of a header that names the operation and
+   the first sector, one descriptor per page of the data buffer,
+   and a status byte the device writes.  The caller sleeps until
+   the interrupt handler finds the chain in the used ring.  The
+   block layer sends one request at a time to each device, but
+   the driver takes any number, up to what the queue holds.
+
+   The device needs physical addresses, which only kernel memory
+   has at a fixed offset.  A user buffer, as a direct read() of a
+   large file brings, is copied through a kernel page instead, a
+   page at a time. */
+
+/* Legacy virtio PCI registers, at the I/O base in BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /* 32 bits, read-only. */
+#define REG_GUEST_FEATURES 0x04         /* 32 bits. */
+#define REG_QUEUE_PFN 0x08              /* 32 bits: ring's page number. */
+#define REG_QUEUE_SIZE 0x0c             /* 16 bits, read-only. */
+#define REG_QUEUE_SELECT 0x0e           /* 16 bits. */
+#define REG_QUEUE_NOTIFY 0x10           /* 16 bits. */
+#define REG_STATUS 0x12                 /* 8 bits. */
+#define REG_ISR 0x13                    /* 8 bits, cleared by reading. */
+#define REG_CAPACITY 0x14               /* 64 bits: size in sectors. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Guest saw the device. */
+#define STATUS_DRIVER 0x02              /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+
+/* PCI IDs of a legacy or transitional virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Virtqueue descriptor flags. */
+#define VRING_DESC_F_NEXT 1             /* NEXT is valid. */
+#define VRING_DESC_F_WRITE 2            /* Device writes the buffer. */
+
+/* Legacy virtqueues align the used ring to a page. */
+#define VRING_ALIGN 4096
+
+/* Request types. */
+#define VIRTIO_BLK_T_IN 0               /* Read. */
+#define VIRTIO_BLK_T_OUT 1              /* Write. */
+
+/* Most queue entries used, even if the device offers more. */
+#define QUEUE_MAX 256
+
+/* Most data segments in one request, and so about the most pages
+   one request transfers; larger transfers take several. */
+#define SEG_MAX 32
+
+/* Interrupt lines other drivers own: the timer, keyboard, PIC
+   cascade, serial port, RTC and the IDE channels. */
+#define RESERVED_LINES 0xc117
+
+/* Most virtio block devices. */
+#define VBLK_MAX 4
+
+/* A descriptor: one physically contiguous buffer. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next in chain, with F_NEXT. */
+  } PACKED;
+
+/* Chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    uint16_t ring[];            /* Heads of chains. */
+  } PACKED;
+
+/* A chain the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of the chain. */
+    uint32_t len;               /* Bytes written into it. */
+  } PACKED;
+
+/* Chains the device is done with. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next. */
+    struct vring_used_elem ring[];
+  } PACKED;
+
+/* Header of a request. */
+struct virtio_blk_req_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  } PACKED;
+
+/* A request in flight.  Lives on the issuing thread's stack,
+   which, like all kernel memory, is mapped at its physical address
+   plus PHYS_BASE, so that the device can get at it. */
+struct vblk_req
+  {
+    struct virtio_blk_req_hdr hdr;
+    uint8_t status;             /* 0 once the device succeeds. */
+    struct semaphore done;      /* Upped at completion. */
+  };
+
+/* A virtio block device. */
+struct vblk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Legacy registers. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    uint16_t qsize;             /* Entries in the queue. */
+    uint16_t max_segs;          /* Data segments per request. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t used_seen;         /* Used entries handled so far. */
+    struct vblk_req *reqs[QUEUE_MAX];   /* Request by chain head. */
+
+    struct lock lock;           /* Protects descriptors, avail ring. */
+    struct condition room;      /* Signaled when descriptors free up. */
+    uint16_t free_head;         /* First free descriptor. */
+    uint16_t free_cnt;          /* Number of free descriptors. */
+
+    struct lock bounce_lock;    /* Protects BOUNCE. */
+    uint8_t *bounce;            /* Kernel page for user buffers. */
+  };
+
+static struct vblk vblks[VBLK_MAX];
+static size_t vblk_cnt;
+
+static struct block_operations vblk_operations;
+
+static void probe_device (int dev, int func);
+static bool setup_queue (struct vblk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds the virtio block devices on PCI bus 0 and registers
+   them as "vda", "vdb" and so on, scanning each for partitions as
+   ide_init() does for IDE disks. */
+void
+virtio_blk_init (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            if (func == 0)
+              break;
+            continue;
+          }
+        if ((id & 0xffff) == VIRTIO_VENDOR
+            && (id >> 16) == VIRTIO_BLK_DEVICE)
+          probe_device (dev, func);
+      }
+}
+
+/* Sets up the virtio block device at DEV, FUNC and registers it. */
+static void
+probe_device (int dev, int func)
+{
+  struct vblk *d;
+  struct block *block;
+  uint32_t bar0 = pci_read_config (dev, func, 0x10);
+  uint8_t line = pci_read_config (dev, func, 0x3c) & 0xff;
+  uint64_t capacity;
+  size_t i;
+
+  if (vblk_cnt >= VBLK_MAX || (bar0 & 1) == 0)
+    return;
+  d = &vblks[vblk_cnt];
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) vblk_cnt);
+
+  if (line > 15 || (RESERVED_LINES & (1u << line)) != 0)
+    {
+      printf ("%s: unusable interrupt line %d, ignoring device\n",
+              d->name, line);
+      return;
+    }
+  d->io_base = bar0 & 0xfffc;
+  d->irq = 0x20 + line;
+  lock_init (&d->lock);
+  cond_init (&d->room);
+  lock_init (&d->bounce_lock);
+  d->bounce = palloc_get_page (0);
+  if (d->bounce == NULL)
+    {
+      printf ("%s: out of memory, ignoring device\n", d->name);
+      return;
+    }
+
+  /* Enable I/O and bus mastering in the command register. */
+  pci_write_config (dev, func, 0x04,
+                    pci_read_config (dev, func, 0x04) | 0x05);
+
+  /* Reset, then say we see it and drive it.  We use no optional
+     features: each data segment is at most a page, within the
+     size_max any device has, and SEG_MAX keeps chains short. */
+  outb (d->io_base + REG_STATUS, 0);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (d->io_base + REG_DEVICE_FEATURES);
+  outl (d->io_base + REG_GUEST_FEATURES, 0);
+  if (!setup_queue (d))
+    {
+      printf ("%s: no usable virtqueue, ignoring device\n", d->name);
+      outb (d->io_base + REG_STATUS, 0);
+      palloc_free_page (d->bounce);
+      return;
+    }
+
+  /* Devices on the same line share one handler. */
+  for (i = 0; i < vblk_cnt; i++)
+    if (vblks[i].irq == d->irq)
+      break;
+  if (i == vblk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  vblk_cnt++;
+  outb (d->io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  capacity = inl (d->io_base + REG_CAPACITY)
+             | (uint64_t) inl (d->io_base + REG_CAPACITY + 4) << 32;
+  if (capacity > UINT32_MAX)
+    capacity = UINT32_MAX;
+  block = block_register (d->name, BLOCK_RAW, "virtio-blk", capacity,
+                          &vblk_operations, d);
+  partition_scan (block);
+}
+
+/* Allocates and zeroes D's queue 0, in the legacy layout: the
+   descriptor table, then the available ring, then, at the next
+   page, the used ring, all physically contiguous.  Returns false
+   if the device has no queue 0 or memory is short. */
+static bool
+setup_queue (struct vblk *d)
+{
+  size_t avail_end, used_ofs, size, i;
+  uint8_t *ring;
+
+  outw (d->io_base + REG_QUEUE_SELECT, 0);
+  d->qsize = inw (d->io_base + REG_QUEUE_SIZE);
+  if (d->qsize < 4 || d->qsize > QUEUE_MAX
+      || (d->qsize & (d->qsize - 1)) != 0)
+    return false;
+
+  avail_end = (sizeof *d->desc * d->qsize
+               + sizeof *d->avail + sizeof (uint16_t) * (d->qsize + 1));
+  used_ofs = ROUND_UP (avail_end, VRING_ALIGN);
+  size = used_ofs + sizeof *d->used
+         + sizeof (struct vring_used_elem) * d->qsize + sizeof (uint16_t);
+  ring = palloc_get_multiple (PAL_ZERO, DIV_ROUND_UP (size, PGSIZE));
+  if (ring == NULL)
+    return false;
+
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + sizeof *d->desc * d->qsize);
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->used_seen = 0;
+  for (i = 0; i < d->qsize; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->qsize;
+  d->max_segs = d->qsize - 2 < SEG_MAX ? d->qsize - 2 : SEG_MAX;
+
+  outl (d->io_base + REG_QUEUE_PFN, vtop (ring) / VRING_ALIGN);
+  return true;
+}
+
+/* Takes a free descriptor of D, filling it in to describe SIZE
+   bytes at kernel address BUF, with FLAGS.  Returns its index.
+   D's lock must be held and a descriptor must be free. */
+static uint16_t
+take_desc (struct vblk *d, const void *buf, size_t size, uint16_t flags)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  d->desc[i].addr = vtop (buf);
+  d->desc[i].len = size;
+  d->desc[i].flags = flags;
+  return i;
+}
+
+/* Transfers CNT sectors starting at SECTOR between D and BUFFER,
+   which is in kernel memory, writing them if WRITE, in one request
+   of at most SEG_MAX pages of BUFFER.  Returns the number of
+   sectors transferred. */
+static size_t
+transfer_once (struct vblk *d, block_sector_t sector, size_t cnt,
+               uint8_t *buffer, bool write)
+{
+  struct vblk_req req;
+  size_t segs = 0, done = 0;
+  uint16_t head, prev, i;
+
+  req.hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  req.hdr.reserved = 0;
+  req.hdr.sector = sector;
+  req.status = 0xff;
+  sema_init (&req.done, 0);
+
+  lock_acquire (&d->lock);
+  while (d->free_cnt < d->max_segs + 2)
+    cond_wait (&d->room, &d->lock);
+
+  head = prev = take_desc (d, &req.hdr, sizeof req.hdr, VRING_DESC_F_NEXT);
+  while (done < cnt && segs < d->max_segs)
+    {
+      /* Up to the end of the page, in whole sectors. */
+      uint8_t *p = buffer + done * BLOCK_SECTOR_SIZE;
+      size_t n = DIV_ROUND_UP (PGSIZE - pg_ofs (p), BLOCK_SECTOR_SIZE);
+
+      if (n > cnt - done)
+        n = cnt - done;
+      i = take_desc (d, p, n * BLOCK_SECTOR_SIZE,
+                     VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE));
+      d->desc[prev].next = i;
+      prev = i;
+      done += n;
+      segs++;
+    }
+  i = take_desc (d, &req.status, 1, VRING_DESC_F_WRITE);
+  d->desc[prev].next = i;
+  d->reqs[head] = &req;
+
+  /* Publish the chain, then the index, then tell the device. */
+  d->avail->ring[d->avail->idx % d->qsize] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->io_base + REG_QUEUE_NOTIFY, 0);
+  lock_release (&d->lock);
+
+  sema_down (&req.done);
+
+  /* Free the chain. */
+  lock_acquire (&d->lock);
+  for (i = head; ; i = d->desc[i].next)
+    {
+      d->free_cnt++;
+      if ((d->desc[i].flags & VRING_DESC_F_NEXT) == 0)
+        break;
+    }
+  d->desc[i].next = d->free_head;
+  d->free_head = head;
+  d->reqs[head] = NULL;
+  cond_broadcast (&d->room, &d->lock);
+  lock_release (&d->lock);
+
+  if (req.status != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+           write ? "write" : "read", sector);
+  return done;
+}
+
+/* Transfers CNT sectors starting at SECTOR between disk D_ and
+   BUFFER_, writing if WRITE.  A BUFFER_ in user memory, which has
+   no physical address to hand the device, goes through D_'s bounce
+   page. */
+static void
+vblk_transfer (void *d_, block_sector_t sector, size_t cnt, void *buffer_,
+               bool write)
+{
+  struct vblk *d = d_;
+  uint8_t *buffer = buffer_;
+  bool bounce = !is_kernel_vaddr (buffer);
+
+  if (bounce)
+    lock_acquire (&d->bounce_lock);
+  while (cnt > 0)
+    {
+      size_t n;
+
+      if (bounce)
+        {
+          n = cnt < PGSIZE / BLOCK_SECTOR_SIZE ? cnt
+                                               : PGSIZE / BLOCK_SECTOR_SIZE;
+          if (write)
+            memcpy (d->bounce, buffer, n * BLOCK_SECTOR_SIZE);
+          n = transfer_once (d, sector, n, d->bounce, write);
+          if (!write)
+            memcpy (buffer, d->bounce, n * BLOCK_SECTOR_SIZE);
+        }
+      else
+        n = transfer_once (d, sector, cnt, buffer, write);
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  if (bounce)
+    lock_release (&d->bounce_lock);
+}
+
+static void
+vblk_read_multiple (void *d, block_sector_t sector, size_t cnt, void *buffer)
+{
+  vblk_transfer (d, sector, cnt, buffer, false);
+}
+
+static void
+vblk_write_multiple (void *d, block_sector_t sector, size_t cnt,
+                     const void *buffer)
+{
+  vblk_transfer (d, sector, cnt, (void *) buffer, true);
+}
+
+static void
+vblk_read (void *d, block_sector_t sector, void *buffer)
+{
+  vblk_transfer (d, sector, 1, buffer, false);
+}
+
+static void
+vblk_write (void *d, block_sector_t sector, const void *buffer)
+{
+  vblk_transfer (d, sector, 1, (void *) buffer, true);
+}
+
+static struct block_operations vblk_operations =
+  {
+    vblk_read,
+    vblk_write,
+    vblk_read_multiple,
+    vblk_write_multiple,
+    NULL,
+  };
+
+/* Virtio block interrupt handler: wakes the issuer of every
+   request that a device on this line has completed. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < vblk_cnt; i++)
+    {
+      struct vblk *d = &vblks[i];
+
+      /* Reading the ISR acknowledges the interrupt. */
+      if (d->irq != f->vec_no || inb (d->io_base + REG_ISR) == 0)
+        continue;
+      while (d->used_seen != d->used->idx)
+        {
+          uint32_t id;
+
+          barrier ();
+          id = d->used->ring[d->used_seen % d->qsize].id;
+          if (id < d->qsize && d->reqs[id] != NULL)
+            sema_up (&d->reqs[id]->done);
+          d->used_seen++;
+        }
+    }
+}
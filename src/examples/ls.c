@@ -6,8 +6,9 @@
 
    By default, only the name of each file is printed.  If "-l" is
    given as the first argument, the type, size, and inumber of
-   each file is also printed.  This won't work until project 4. */
+   each file is also printed. */
 
+#include <inttypes.h>
 #include <syscall.h>
 #include <stdio.h>
 #include <string.h>
@@ -15,47 +16,42 @@
 static bool
 list_dir (const char *dir, bool verbose) 
 {
+  struct dirent ents[32];
   int dir_fd = open (dir);
+  int flags = verbose ? GETDENTS_STAT : 0;
+  int cnt;
+
   if (dir_fd == -1) 
     {
       printf ("%s: not found\n", dir);
       return false;
     }
 
-  if (isdir (dir_fd))
+  /* Entries come a batch at a time, so a large directory takes a
+     few system calls instead of one per entry. */
+  cnt = getdents (dir_fd, ents, sizeof ents, flags);
+  if (cnt >= 0)
     {
-      char name[READDIR_MAX_LEN];
-
-      printf ("%s", dir);
-      if (verbose)
-        printf (" (inumber %d)", inumber (dir_fd));
-      printf (":\n");
-
-      while (readdir (dir_fd, name)) 
+      printf ("%s:\n", dir);
+      while (cnt > 0)
         {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
-
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+          int i;
 
-              printf (": ");
-              if (entry_fd != -1)
+          for (i = 0; i < cnt; i++)
+            {
+              printf ("%s", ents[i].d_name);
+              if (verbose)
                 {
-                  if (isdir (entry_fd))
+                  printf (": ");
+                  if (ents[i].d_isdir)
                     printf ("directory");
                   else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
+                    printf ("%"PRIu32"-byte file", ents[i].d_size);
+                  printf (", inumber %"PRIu32, ents[i].d_ino);
                 }
-              else
-                printf ("open failed");
-              close (entry_fd);
+              printf ("\n");
             }
-          printf ("\n");
+          cnt = getdents (dir_fd, ents, sizeof ents, flags);
         }
     }
   else 
@@ -0,0 +1,69 @@
+/* mmbench.c
+
+   Timing and fault counting shared by the benchmark modes of mcat
+   and mcp. */
+
+#include "mmbench.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <syscall.h>
+
+#define PGSIZE 4096
+
+/* Starts timing a phase in B. */
+void
+mmbench_start (struct mmbench *b)
+{
+  vmstat (&b->start);
+  gettime (&b->start_ns);
+}
+
+/* Prints how long the phase started in B took to process BYTES
+   bytes, the resulting throughput, and the page faults taken and
+   file pages mapped around them meanwhile. */
+void
+mmbench_report (const struct mmbench *b, const char *what, size_t bytes)
+{
+  struct vm_stats end;
+  uint64_t end_ns, ns;
+  uint64_t mb_per_s;
+
+  gettime (&end_ns);
+  vmstat (&end);
+
+  ns = end_ns - b->start_ns;
+  if (ns == 0)
+    ns = 1;
+  mb_per_s = (uint64_t) bytes * 1000 / ns;
+  printf ("%-16s %8zu kB %6"PRIu64".%03"PRIu64" ms %6"PRIu64" MB/s "
+          "%6"PRIu64" faults %6"PRIu64" around\n",
+          what, bytes / 1024, ns / 1000000, ns / 1000 % 1000, mb_per_s,
+          end.page_faults - b->start.page_faults,
+          end.fault_arounds - b->start.fault_arounds);
+}
+
+/* Reads one byte from each page of the SIZE bytes at P, faulting
+   them all in. */
+void
+mmbench_touch (const void *p, size_t size)
+{
+  const volatile uint8_t *bytes = p;
+  size_t ofs;
+
+  for (ofs = 0; ofs < size; ofs += PGSIZE)
+    (void) bytes[ofs];
+}
+
+/* Returns the sum of the words in the SIZE bytes at P, a trailing
+   partial word aside, so that every byte has to be read. */
+uint32_t
+mmbench_sum (const void *p, size_t size)
+{
+  const uint32_t *words = p;
+  uint32_t sum = 0;
+  size_t i;
+
+  for (i = 0; i < size / sizeof *words; i++)
+    sum += words[i];
+  return sum;
+}
@@ -0,0 +1,21 @@
+#ifndef EXAMPLES_MMBENCH_H
+#define EXAMPLES_MMBENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vmstat.h>
+
+/* Times one phase of a benchmark and counts the page faults taken
+   during it, for mcat and mcp's -b modes. */
+struct mmbench
+  {
+    uint64_t start_ns;          /* gettime() at mmbench_start(). */
+    struct vm_stats start;      /* vmstat() at mmbench_start(). */
+  };
+
+void mmbench_start (struct mmbench *);
+void mmbench_report (const struct mmbench *, const char *what, size_t bytes);
+void mmbench_touch (const void *, size_t);
+uint32_t mmbench_sum (const void *, size_t);
+
+#endif /* examples/mmbench.h */
@@ -0,0 +1,29 @@
+/* resume.c
+
+   Starts a process from a snapshot written by snapshot(), and
+   waits for it.  The process resumes where it made the snapshot,
+   with memory paged in from the file as it is touched.
+
+   Usage: resume SNAPSHOT */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  pid_t pid;
+
+  if (argc != 2)
+    {
+      printf ("usage: resume SNAPSHOT\n");
+      return EXIT_FAILURE;
+    }
+  pid = restore (argv[1]);
+  if (pid == PID_ERROR)
+    {
+      printf ("%s: restore failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  return wait (pid);
+}
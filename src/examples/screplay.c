@@ -0,0 +1,258 @@
+/* screplay.c
+
+   Re-issues the file system calls of a trace written by the
+   kernel for a process run under "-sctrace=PROG", back to back,
+   and compares the time they take now with the time they took
+   when traced.
+
+   Usage: screplay TRACE [DIR]
+
+   With DIR, the calls run from that directory instead of the
+   current one, so they go to test files of their own.  File
+   descriptors are translated from the traced process's to ours.
+   Console I/O and calls other than file system ones are skipped,
+   and so are descriptors that no longer open. */
+
+#include <sctrace.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Descriptors translated. */
+#define FD_MAX 128
+
+/* Largest read or write issued at once. */
+#define BUF_SIZE 65536
+
+/* Counts for one system call. */
+struct call_stat
+  {
+    const char *name;
+    unsigned calls;             /* Replayed. */
+    unsigned mismatches;        /* Returned something else than traced. */
+    uint64_t traced_ns;         /* Time taken when traced. */
+    uint64_t replay_ns;         /* Time taken now. */
+  };
+
+static struct call_stat call_stats[SCSTAT_CNT] =
+  {
+    [SYS_CREATE] = {"create"}, [SYS_REMOVE] = {"remove"},
+    [SYS_OPEN] = {"open"}, [SYS_FILESIZE] = {"filesize"},
+    [SYS_READ] = {"read"}, [SYS_WRITE] = {"write"},
+    [SYS_SEEK] = {"seek"}, [SYS_TELL] = {"tell"},
+    [SYS_CLOSE] = {"close"}, [SYS_MKDIR] = {"mkdir"},
+    [SYS_PREAD] = {"pread"}, [SYS_PWRITE] = {"pwrite"},
+    [SYS_FALLOCATE] = {"fallocate"}, [SYS_FSYNC] = {"fsync"},
+    [SYS_SYNC] = {"sync"},
+  };
+
+/* Our descriptor for each of the traced process's, or -1. */
+static int fds[FD_MAX];
+
+static char buf[BUF_SIZE];
+
+/* Reads or writes SIZE bytes at FD, BUF_SIZE at a time, at OFS if
+   AT is true.  Returns the total bytes transferred, or -1 if the
+   first transfer fails. */
+static int
+transfer (int fd, bool write_op, bool at, unsigned size, unsigned ofs)
+{
+  int total = 0;
+
+  while (size > 0)
+    {
+      unsigned n = size < BUF_SIZE ? size : BUF_SIZE;
+      int r;
+
+      if (at)
+        r = write_op ? pwrite (fd, buf, n, ofs) : pread (fd, buf, n, ofs);
+      else
+        r = write_op ? write (fd, buf, n) : read (fd, buf, n);
+      if (r < 0)
+        return total > 0 ? total : -1;
+      total += r;
+      if ((unsigned) r < n)
+        break;
+      size -= n;
+      ofs += n;
+    }
+  return total;
+}
+
+/* Returns our descriptor for the traced process's FD, or -1. */
+static int
+map_fd (uint32_t fd)
+{
+  return fd < FD_MAX ? fds[fd] : -1;
+}
+
+/* Re-issues the call in R.  Returns false if it is not one we
+   replay, otherwise stores what it returned in *RESULT. */
+static bool
+replay (const struct sctrace_rec *r, uint32_t *result)
+{
+  int fd = -1;
+
+  switch (r->nr)
+    {
+    case SYS_FILESIZE: case SYS_READ: case SYS_WRITE: case SYS_SEEK:
+    case SYS_TELL: case SYS_CLOSE: case SYS_PREAD: case SYS_PWRITE:
+    case SYS_FALLOCATE: case SYS_FSYNC:
+      fd = map_fd (r->args[0]);
+      if (fd < 0)
+        return false;
+      break;
+    }
+
+  switch (r->nr)
+    {
+    case SYS_CREATE:
+      *result = create (r->path, r->args[1]);
+      return true;
+    case SYS_REMOVE:
+      *result = remove (r->path);
+      return true;
+    case SYS_MKDIR:
+      *result = mkdir (r->path);
+      return true;
+    case SYS_OPEN:
+      *result = open (r->path);
+      if ((int) r->result >= 0 && r->result < FD_MAX)
+        fds[r->result] = *result;
+      return true;
+    case SYS_FILESIZE:
+      *result = filesize (fd);
+      return true;
+    case SYS_READ:
+    case SYS_WRITE:
+      *result = transfer (fd, r->nr == SYS_WRITE, false, r->args[2], 0);
+      return true;
+    case SYS_PREAD:
+    case SYS_PWRITE:
+      *result = transfer (fd, r->nr == SYS_PWRITE, true, r->args[2],
+                          r->args[3]);
+      return true;
+    case SYS_SEEK:
+      seek (fd, r->args[1]);
+      *result = r->result;
+      return true;
+    case SYS_TELL:
+      *result = tell (fd);
+      return true;
+    case SYS_CLOSE:
+      close (fd);
+      fds[r->args[0]] = -1;
+      *result = r->result;
+      return true;
+    case SYS_FALLOCATE:
+      *result = fallocate (fd, r->args[1]);
+      return true;
+    case SYS_FSYNC:
+      *result = fsync (fd);
+      return true;
+    case SYS_SYNC:
+      sync ();
+      *result = r->result;
+      return true;
+    default:
+      return false;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct sctrace_header h;
+  struct sctrace_rec r;
+  uint64_t traced_ns = 0, replay_ns = 0;
+  unsigned replayed = 0, skipped = 0;
+  unsigned i;
+  int trace;
+
+  if (argc != 2 && argc != 3)
+    {
+      printf ("usage: screplay TRACE [DIR]\n");
+      return EXIT_FAILURE;
+    }
+  trace = open (argv[1]);
+  if (trace < 0)
+    {
+      printf ("%s: open failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  if (read (trace, &h, sizeof h) != sizeof h || h.magic != SCTRACE_MAGIC)
+    {
+      printf ("%s: not a system call trace\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  if (argc == 3 && !chdir (argv[2]))
+    {
+      printf ("%s: chdir failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  if (h.dropped > 0)
+    printf ("%s: the first %llu calls were overwritten; descriptors "
+            "opened by them are skipped\n", argv[1], h.dropped);
+
+  for (i = 0; i < FD_MAX; i++)
+    fds[i] = -1;
+  memset (buf, 'r', sizeof buf);
+
+  for (i = 0; i < h.rec_cnt; i++)
+    {
+      struct call_stat *c;
+      uint64_t start, end;
+      uint32_t result;
+      bool console;
+
+      if (read (trace, &r, sizeof r) != sizeof r)
+        {
+          printf ("%s: truncated after %u records\n", argv[1], i);
+          break;
+        }
+      console = ((r.nr == SYS_READ || r.nr == SYS_WRITE)
+                 && r.args[0] < 2);
+      if (r.nr >= SCSTAT_CNT || call_stats[r.nr].name == NULL || console)
+        {
+          skipped++;
+          continue;
+        }
+
+      gettime (&start);
+      if (!replay (&r, &result))
+        {
+          skipped++;
+          continue;
+        }
+      gettime (&end);
+
+      c = &call_stats[r.nr];
+      c->calls++;
+      if (result != r.result)
+        c->mismatches++;
+      c->replay_ns += end - start;
+      c->traced_ns += r.cycles * h.ns_per_mcycle / 1000000;
+      replayed++;
+    }
+  close (trace);
+
+  for (i = 0; i < FD_MAX; i++)
+    if (fds[i] >= 0)
+      close (fds[i]);
+
+  for (i = 0; i < SCSTAT_CNT; i++)
+    {
+      const struct call_stat *c = &call_stats[i];
+
+      if (c->calls == 0)
+        continue;
+      printf ("%-10s %6u calls %6u differ %10llu ns traced %10llu ns now\n",
+              c->name, c->calls, c->mismatches, c->traced_ns, c->replay_ns);
+      traced_ns += c->traced_ns;
+      replay_ns += c->replay_ns;
+    }
+  printf ("%u calls replayed, %u skipped: %llu ns traced, %llu ns now\n",
+          replayed, skipped, traced_ns, replay_ns);
+  return EXIT_SUCCESS;
+}
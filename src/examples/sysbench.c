@@ -0,0 +1,53 @@
+/* sysbench.c
+
+   Times a null system call round trip through the int $0x30 gate
+   and, if the CPU has it, through SYSENTER. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+
+#define ITERATIONS 100000
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the average cycles per round trip with syscall_fast set
+   to FAST.  ring_enter() with no ring registered returns at once,
+   so this measures little beyond kernel entry and exit. */
+static unsigned
+time_round_trip (bool fast)
+{
+  uint64_t start;
+  int i;
+
+  syscall_fast = fast;
+  start = rdtsc ();
+  for (i = 0; i < ITERATIONS; i++)
+    ring_enter ();
+  return (rdtsc () - start) / ITERATIONS;
+}
+
+int
+main (void)
+{
+  bool have_sysenter = syscall_fast;
+  unsigned slow = time_round_trip (false);
+
+  printf ("int $0x30: %u cycles per system call\n", slow);
+  if (have_sysenter)
+    {
+      unsigned fast = time_round_trip (true);
+      printf ("sysenter:  %u cycles per system call (%u%% of int $0x30)\n",
+              fast, fast * 100 / slow);
+    }
+  else
+    printf ("sysenter:  not supported by this CPU\n");
+  return EXIT_SUCCESS;
+}
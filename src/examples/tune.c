@@ -0,0 +1,52 @@
+/* tune.c
+
+   Reads or sets kernel tunables.
+
+   Usage: tune [NAME [VALUE]]
+   With no arguments, lists every tunable with its range and
+   setting.  With NAME, prints that tunable's setting, and with
+   VALUE too, changes it. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  struct tunable_info info;
+  int i;
+
+  if (argc > 3)
+    {
+      printf ("usage: tune [NAME [VALUE]]\n");
+      return EXIT_FAILURE;
+    }
+  if (argc == 3)
+    {
+      if (settunable (argv[1], atoi (argv[2])) < 0)
+        {
+          printf ("%s: no such tunable, or %s out of range\n",
+                  argv[1], argv[2]);
+          return EXIT_FAILURE;
+        }
+      return EXIT_SUCCESS;
+    }
+
+  for (i = 0; gettunable (i, &info) == 0; i++)
+    if (argc == 1)
+      printf ("%-20s %d (%d..%d)\n", info.name, info.value,
+              info.min, info.max);
+    else if (!strcmp (info.name, argv[1]))
+      {
+        printf ("%d\n", info.value);
+        return EXIT_SUCCESS;
+      }
+  if (argc == 2)
+    {
+      printf ("%s: no such tunable\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
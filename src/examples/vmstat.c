@@ -0,0 +1,109 @@
+/* vmstat.c
+
+   Prints a line of kernel activity every second, like Unix
+   vmstat: the change in each counter since the line before.
+
+   Usage: vmstat [COUNT]
+   Prints COUNT lines, 10 by default. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* One sample of every category that the columns come from. */
+struct sample
+  {
+    struct sched_stats sched;
+    struct vm_stats vm;
+    struct cache_stats cache;
+    struct blk_stats fs;
+    struct sc_stats sc;
+  };
+
+/* Fills in S.  A category that the kernel does not have, such as
+   the file system device's when there is none, reads as zeros. */
+static void
+take_sample (struct sample *s)
+{
+  memset (s, 0, sizeof *s);
+  stats (STATS_SCHED, &s->sched, sizeof s->sched);
+  stats (STATS_VM, &s->vm, sizeof s->vm);
+  stats (STATS_CACHE, &s->cache, sizeof s->cache);
+  stats (STATS_BLOCK + BLKSTAT_FILESYS, &s->fs, sizeof s->fs);
+  stats (STATS_SYSCALL, &s->sc, sizeof s->sc);
+}
+
+/* Returns the number of system calls counted in S. */
+static uint64_t
+syscalls (const struct sample *s)
+{
+  uint64_t cnt = 0;
+  int i;
+
+  for (i = 0; i < SCSTAT_CNT; i++)
+    cnt += s->sc.sc[i].calls;
+  return cnt;
+}
+
+/* Returns PART as a percentage of WHOLE. */
+static unsigned
+percent (uint64_t part, uint64_t whole)
+{
+  return whole > 0 ? part * 100 / whole : 0;
+}
+
+/* Prints the column headings. */
+static void
+print_header (void)
+{
+  printf ("  r   cs  sc/s   flt   si   so  hit%%  miss   wb   "
+          "bi   bo  us sy id\n");
+}
+
+/* Prints the change from A to B. */
+static void
+print_delta (const struct sample *a, const struct sample *b)
+{
+  uint64_t us = b->sched.user_ticks - a->sched.user_ticks;
+  uint64_t sy = b->sched.kernel_ticks - a->sched.kernel_ticks;
+  uint64_t id = b->sched.idle_ticks - a->sched.idle_ticks;
+  uint64_t hits = b->cache.hits - a->cache.hits;
+  uint64_t misses = b->cache.misses - a->cache.misses;
+
+  printf ("%3u %4llu %5llu %5llu %4llu %4llu  %3u%% %5llu %4llu %4llu %4llu"
+          " %3u %2u %2u\n",
+          b->sched.ready,
+          (b->sched.voluntary_switches + b->sched.involuntary_switches)
+          - (a->sched.voluntary_switches + a->sched.involuntary_switches),
+          syscalls (b) - syscalls (a),
+          b->vm.page_faults - a->vm.page_faults,
+          b->vm.swap_ins - a->vm.swap_ins,
+          b->vm.swap_outs - a->vm.swap_outs,
+          percent (hits, hits + misses), misses,
+          b->cache.writebacks - a->cache.writebacks,
+          b->fs.read.sectors - a->fs.read.sectors,
+          b->fs.write.sectors - a->fs.write.sectors,
+          percent (us, us + sy + id), percent (sy, us + sy + id),
+          percent (id, us + sy + id));
+}
+
+int
+main (int argc, char *argv[])
+{
+  static struct sample samples[2];
+  int count = argc > 1 ? atoi (argv[1]) : 10;
+  int i;
+
+  take_sample (&samples[0]);
+  for (i = 0; i < count; i++)
+    {
+      if (i % 20 == 0)
+        print_header ();
+      msleep (1000);
+      take_sample (&samples[(i + 1) % 2]);
+      print_delta (&samples[i % 2], &samples[(i + 1) % 2]);
+    }
+  return EXIT_SUCCESS;
+}
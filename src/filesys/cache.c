@@ -0,0 +1,786 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Number of sectors cached. */
+#define CACHE_SIZE 64
+
+/* Marks an entry that caches no sector. */
+#define SECTOR_NONE ((block_sector_t) -1)
+
+/* A cached sector.
+
+   An entry is pinned while a thread is using it, and only unpinned
+   entries are evicted.  A thread pins an entry before it waits for
+   the entry's lock, so the lock of an unpinned entry is always
+   free.  An entry is held while it has metadata that the journal
+   has not committed yet: it is neither evicted nor written back
+   until then. */
+struct cache_entry
+  {
+    /* Protected by cache_lock. */
+    block_sector_t sector;      /* Sector cached here, or SECTOR_NONE. */
+    block_sector_t flushing;    /* Old sector being written back. */
+    bool accessed;              /* Used since the clock hand passed? */
+    int pins;                   /* Number of threads using the entry. */
+    bool held;                  /* Uncommitted metadata?  Set under LOCK too. */
+    unsigned uses;              /* Lookups since it took its sector. */
+
+    /* Protected by LOCK. */
+    struct lock lock;
+    bool valid;                 /* DATA holds the sector's contents? */
+    bool dirty;                 /* DATA is newer than the disk? */
+    uint8_t data[BLOCK_SECTOR_SIZE];
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the sector mapping and the replacement state. */
+static struct lock cache_lock;
+
+/* Signaled when an entry's last pin is dropped. */
+static struct condition cache_unpinned;
+
+/* Clock hand for replacement. */
+static size_t hand;
+
+/* Statistics, under cache_lock, except for readaheads, which is
+   under readahead_lock. */
+static struct cache_stats stats;
+
+/* Sectors queued by cache_readahead(), read in the background by
+   readahead_work on the readahead work queue.  Requests that find
+   the ring full are dropped: read-ahead is only a hint. */
+#define READAHEAD_RING 64
+static block_sector_t readahead_ring[READAHEAD_RING];
+static size_t readahead_head, readahead_tail;   /* Next to read, to add. */
+static struct lock readahead_lock;              /* Protects the ring. */
+static struct work_queue *readahead_queue;
+static struct work readahead_work;
+
+static void readahead (void *aux);
+
+/* Write-behind.  Dirty entries are written back by flush_work on
+   the flush work queue, every flush_interval ticks and whenever
+   the number of dirty entries reaches FLUSH_HIGH, so that writers
+   seldom have to wait for the disk themselves and at most about
+   flush_interval ticks of writes stay in memory only. */
+#define FLUSH_HIGH (CACHE_SIZE / 2)
+#define FLUSH_RUN_MAX 16        /* Maximum sectors per coalesced write. */
+int cache_flush_ms = 5000;
+static int64_t flush_interval = 5 * TIMER_FREQ;
+static size_t dirty_cnt;        /* Dirty entries, under cache_lock. */
+static struct work_queue *flush_queue;
+static struct work flush_work;
+
+static void flush (void *aux);
+static void flush_timer (void *aux);
+static void writeback (block_sector_t lo, block_sector_t hi);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_register (&cache_lock, "buffer cache");
+  cond_init (&cache_unpinned);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      e->sector = e->flushing = SECTOR_NONE;
+      lock_init (&e->lock);
+    }
+
+  /* Without a worker, cache_readahead() does nothing. */
+  lock_init (&readahead_lock);
+  work_init (&readahead_work, readahead, NULL);
+  readahead_queue = work_queue_create ("readahead", PRI_DEFAULT, 1);
+
+  /* Without a worker, dirty sectors wait for eviction or
+     cache_flush(). */
+  work_init (&flush_work, flush, NULL);
+  flush_queue = work_queue_create ("cache-flush", PRI_DEFAULT, 1);
+  if (flush_queue != NULL)
+    thread_create ("flush-timer", PRI_DEFAULT, flush_timer, NULL);
+}
+
+/* Sets the interval between periodic write-backs to MS
+   milliseconds, or turns periodic write-back off if MS is 0.
+   Dirty sectors are still written back under pressure.  A new
+   interval takes effect after the current one runs out. */
+void
+cache_set_flush_interval (int ms)
+{
+  ASSERT (ms >= 0);
+  cache_flush_ms = ms;
+  flush_interval = ms > 0 ? DIV_ROUND_UP ((int64_t) ms * TIMER_FREQ, 1000) : 0;
+}
+
+/* Starts a write-back in the background. */
+static void
+kick_flush (void)
+{
+  if (flush_queue != NULL)
+    work_enqueue (flush_queue, &flush_work);
+}
+
+/* Marks locked entry E, which must be valid, as dirty. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  bool pressure;
+
+  if (e->dirty)
+    return;
+  e->dirty = true;
+
+  lock_acquire (&cache_lock);
+  pressure = ++dirty_cnt == FLUSH_HIGH;
+  lock_release (&cache_lock);
+  if (pressure)
+    kick_flush ();
+}
+
+/* Marks locked entry E as clean, after its data has reached the
+   disk or been discarded. */
+static void
+mark_clean (struct cache_entry *e)
+{
+  if (!e->dirty)
+    return;
+  e->dirty = false;
+
+  lock_acquire (&cache_lock);
+  dirty_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Picks an unpinned entry to evict with the clock algorithm, or
+   returns a null pointer if every entry is pinned.  cache_lock must
+   be held. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[hand];
+
+      hand = (hand + 1) % CACHE_SIZE;
+      if (e->pins > 0 || e->held)
+        continue;
+      if (!e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, pinned and locked.  If READ is
+   true, its data is read in when not yet valid; otherwise the
+   caller is about to overwrite the whole sector.  If HIT is
+   nonnull, stores in *HIT whether SECTOR was cached already. */
+static struct cache_entry *
+get_entry (block_sector_t sector, bool read, bool *hit)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      struct cache_entry *busy = NULL;
+      size_t i;
+
+      for (i = 0; i < CACHE_SIZE; i++)
+        if (cache[i].sector == sector)
+          break;
+        else if (cache[i].flushing == sector)
+          busy = &cache[i];
+
+      if (i < CACHE_SIZE)
+        {
+          e = &cache[i];
+          stats.hits++;
+          e->pins++;
+          e->accessed = true;
+          e->uses++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          if (hit != NULL)
+            *hit = true;
+          break;
+        }
+
+      if (busy != NULL)
+        {
+          /* An evicted copy of SECTOR is still on its way to the
+             disk.  Wait for it to get there before reading it back. */
+          busy->pins++;
+          lock_release (&cache_lock);
+          lock_acquire (&busy->lock);
+          lock_release (&busy->lock);
+          lock_acquire (&cache_lock);
+          if (--busy->pins == 0)
+            cond_signal (&cache_unpinned, &cache_lock);
+          continue;
+        }
+
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&cache_unpinned, &cache_lock);
+          continue;
+        }
+
+      /* Take over the victim.  Its lock is free, since it was
+         unpinned. */
+      stats.misses++;
+      e->pins++;
+      e->accessed = true;
+      e->uses = 1;
+      lock_acquire (&e->lock);
+      e->flushing = e->valid && e->dirty ? e->sector : SECTOR_NONE;
+      e->sector = sector;
+      if (e->flushing != SECTOR_NONE)
+        stats.evict_writes++;
+      lock_release (&cache_lock);
+
+      if (e->flushing != SECTOR_NONE)
+        {
+          /* The write-behind fell behind.  Write the victim out
+             here, and get the flusher going on the rest. */
+          block_write (fs_device, e->flushing, e->data);
+          lock_acquire (&cache_lock);
+          e->flushing = SECTOR_NONE;
+          lock_release (&cache_lock);
+          kick_flush ();
+        }
+      mark_clean (e);
+      e->valid = false;
+      if (hit != NULL)
+        *hit = false;
+      break;
+    }
+
+  if (!e->valid)
+    {
+      if (read)
+        block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Returns the entry for SECTOR, pinned and locked, as
+   get_entry() does. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  return get_entry (sector, read, NULL);
+}
+
+/* Unlocks and unpins entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  if (--e->pins == 0)
+    cond_signal (&cache_unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Commits the journal and writes every dirty sector in the cache
+   to disk. */
+void
+cache_flush (void)
+{
+  journal_commit ();
+  writeback (0, SECTOR_NONE);
+}
+
+/* Writes the CNT sectors starting at SECTOR to disk, if they are
+   cached and dirty, and returns once they are there. */
+void
+cache_flush_range (block_sector_t sector, size_t cnt)
+{
+  if (cnt > 0)
+    writeback (sector, sector + cnt);
+}
+
+/* Writes the N entries in RUN, which cache consecutive sectors in
+   ascending order and are locked, to disk as one run.  The entries
+   are copied together so that one multi-sector write covers them;
+   if there is no memory for that, they go out one at a time. */
+static void
+write_run (struct cache_entry **run, size_t n)
+{
+  uint8_t *buffer = n > 1 ? malloc (n * BLOCK_SECTOR_SIZE) : NULL;
+  size_t i;
+
+  if (buffer == NULL)
+    {
+      for (i = 0; i < n; i++)
+        block_write (fs_device, run[i]->sector, run[i]->data);
+      return;
+    }
+  for (i = 0; i < n; i++)
+    memcpy (buffer + i * BLOCK_SECTOR_SIZE, run[i]->data, BLOCK_SECTOR_SIZE);
+  block_write_multiple (fs_device, run[0]->sector, n, buffer);
+  free (buffer);
+}
+
+/* Writes every dirty entry in the cache for a sector in [LO, HI)
+   back to disk, coalescing entries for adjacent sectors into runs
+   of up to FLUSH_RUN_MAX sectors.  Also waits for any sector in
+   the range that an eviction is writing out. */
+static void
+writeback (block_sector_t lo, block_sector_t hi)
+{
+  struct cache_entry *pinned[CACHE_SIZE];
+  struct cache_entry *run[FLUSH_RUN_MAX];
+  size_t pin_cnt = 0, run_cnt = 0;
+  size_t i, j;
+
+  /* Pin every cached entry, so that none is evicted or reassigned
+     while we work, and sort them by sector.  Entries are locked in
+     ascending sector order below; nobody else holds more than one
+     entry lock at a time, so this cannot deadlock. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (((e->sector < lo || e->sector >= hi)
+           && (e->flushing < lo || e->flushing >= hi))
+          || e->held)
+        continue;
+      e->pins++;
+      for (j = pin_cnt++; j > 0 && pinned[j - 1]->sector > e->sector; j--)
+        pinned[j] = pinned[j - 1];
+      pinned[j] = e;
+    }
+  lock_release (&cache_lock);
+
+  for (i = 0; i <= pin_cnt; i++)
+    {
+      struct cache_entry *e = i < pin_cnt ? pinned[i] : NULL;
+
+      if (e != NULL)
+        {
+          /* E may have been held since it was pinned, but not
+             after it is locked, since holding takes the lock. */
+          lock_acquire (&e->lock);
+          if (!e->valid || !e->dirty || e->held
+              || e->sector < lo || e->sector >= hi)
+            {
+              cache_put (e);
+              continue;
+            }
+        }
+
+      /* E, if any, is locked and dirty.  Write out the run so far
+         unless E extends it. */
+      if (run_cnt > 0
+          && (e == NULL || run_cnt == FLUSH_RUN_MAX
+              || e->sector != run[run_cnt - 1]->sector + 1))
+        {
+          write_run (run, run_cnt);
+          lock_acquire (&cache_lock);
+          stats.writebacks += run_cnt;
+          lock_release (&cache_lock);
+          for (j = 0; j < run_cnt; j++)
+            {
+              mark_clean (run[j]);
+              cache_put (run[j]);
+            }
+          run_cnt = 0;
+        }
+      if (e != NULL)
+        run[run_cnt++] = e;
+    }
+}
+
+/* Runs on the flush worker. */
+static void
+flush (void *aux UNUSED)
+{
+  block_set_class (BIO_ASYNC);
+  journal_commit ();
+  writeback (0, SECTOR_NONE);
+}
+
+/* Starts a write-back every flush_interval ticks.  While periodic
+   write-back is off, checks once a second for it to be turned on. */
+static void
+flush_timer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      int64_t interval = flush_interval;
+
+      timer_sleep (interval > 0 ? interval : TIMER_FREQ);
+      if (interval > 0)
+        kick_flush ();
+    }
+}
+
+/* Asks for SECTOR to be read into the cache in the background, for
+   a read that is expected soon.  Returns at once. */
+void
+cache_readahead (block_sector_t sector)
+{
+  if (readahead_queue == NULL)
+    return;
+
+  lock_acquire (&readahead_lock);
+  if (readahead_tail - readahead_head < READAHEAD_RING)
+    {
+      readahead_ring[readahead_tail++ % READAHEAD_RING] = sector;
+      stats.readaheads++;
+    }
+  lock_release (&readahead_lock);
+  work_enqueue (readahead_queue, &readahead_work);
+}
+
+/* Drops SECTOR from the cache if it is cached, clean and not in
+   use, so that its entry is the next one reused.  Returns true if
+   it was dropped. */
+bool
+cache_drop (block_sector_t sector)
+{
+  bool dropped = false;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->sector != sector)
+        continue;
+      /* The lock of an unpinned entry is free, and the dirty bit is
+         only set under it. */
+      if (e->pins == 0 && !e->held)
+        {
+          lock_acquire (&e->lock);
+          if (!e->dirty)
+            {
+              e->sector = SECTOR_NONE;
+              e->valid = false;
+              e->accessed = false;
+              stats.drops++;
+              dropped = true;
+            }
+          lock_release (&e->lock);
+        }
+      break;
+    }
+  lock_release (&cache_lock);
+  return dropped;
+}
+
+/* Runs on the readahead worker: reads in every queued sector that
+   is not cached already. */
+static void
+readahead (void *aux UNUSED)
+{
+  block_set_class (BIO_ASYNC);
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&readahead_lock);
+      if (readahead_head == readahead_tail)
+        {
+          lock_release (&readahead_lock);
+          break;
+        }
+      sector = readahead_ring[readahead_head++ % READAHEAD_RING];
+      lock_release (&readahead_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
+
+/* Reads the CNT sectors starting at SECTOR into the cache with
+   one multi-sector read, for sectors that are expected to be used
+   soon.  Those already cached are left as they are.  CNT must not
+   exceed CACHE_PREFETCH_MAX.  The entries are taken for the whole
+   run, in ascending order, before the read, so that nobody else
+   reads or writes a sector in between. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  struct cache_entry *run[CACHE_PREFETCH_MAX];
+  bool hit[CACHE_PREFETCH_MAX];
+  uint8_t *buffer;
+  size_t i, read_cnt = 0;
+
+  ASSERT (cnt <= CACHE_PREFETCH_MAX);
+
+  for (i = 0; i < cnt; i++)
+    {
+      run[i] = get_entry (sector + i, false, &hit[i]);
+      if (!hit[i])
+        read_cnt++;
+    }
+
+  buffer = read_cnt > 1 ? malloc (cnt * BLOCK_SECTOR_SIZE) : NULL;
+  if (buffer != NULL)
+    block_read_multiple (fs_device, sector, cnt, buffer);
+  for (i = 0; i < cnt; i++)
+    {
+      if (hit[i])
+        continue;
+      if (buffer != NULL)
+        memcpy (run[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+                BLOCK_SECTOR_SIZE);
+      else
+        block_read (fs_device, sector + i, run[i]->data);
+    }
+  free (buffer);
+
+  for (i = 0; i < cnt; i++)
+    cache_put (run[i]);
+  lock_acquire (&cache_lock);
+  stats.prefetches += read_cnt;
+  lock_release (&cache_lock);
+}
+
+/* Stores in SECTORS the sectors in the cache, most used first, up
+   to MAX of them, and returns how many it stored. */
+size_t
+cache_hot_sectors (block_sector_t *sectors, size_t max)
+{
+  struct cache_entry *hot[CACHE_SIZE];
+  size_t cnt = 0, i, j;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->sector == SECTOR_NONE)
+        continue;
+      /* Insertion sort, by decreasing use count. */
+      for (j = cnt++; j > 0 && hot[j - 1]->uses < e->uses; j--)
+        hot[j] = hot[j - 1];
+      hot[j] = e;
+    }
+  if (cnt > max)
+    cnt = max;
+  for (i = 0; i < cnt; i++)
+    sectors[i] = hot[i]->sector;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Copies the cache's statistics into S. */
+void
+cache_get_stats (struct cache_stats *s)
+{
+  lock_acquire (&readahead_lock);
+  lock_acquire (&cache_lock);
+  *s = stats;
+  s->dirty = dirty_cnt;
+  s->size = CACHE_SIZE;
+  lock_release (&cache_lock);
+  lock_release (&readahead_lock);
+}
+
+/* Reads SIZE bytes at offset OFS within SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Reads all of SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, size_t ofs,
+                size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  cache_put (e);
+}
+
+/* Returns true if SECTOR is in the cache or on its way out of it.
+   cache_lock must be held. */
+static bool
+is_cached (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector || cache[i].flushing == sector)
+      return true;
+  return false;
+}
+
+/* Reads the CNT sectors starting at SECTOR into BUFFER without
+   caching them, for bulk reads that would only flush the cache.
+   Sectors that are cached, and so may be newer than the disk,
+   are copied from the cache; runs of the rest are read from the
+   disk straight into BUFFER. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t run = 0;
+
+      lock_acquire (&cache_lock);
+      while (run < cnt && !is_cached (sector + run))
+        run++;
+      lock_release (&cache_lock);
+
+      if (run > 0)
+        block_read_multiple (fs_device, sector, run, buffer);
+      else
+        {
+          cache_read (sector, buffer);
+          run = 1;
+        }
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR, and
+   zeros in the rest of SECTOR, whose old contents are not needed.
+   Unlike cache_write_at(), never reads SECTOR from disk. */
+void
+cache_write_new (block_sector_t sector, const void *buffer, size_t ofs,
+                 size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false);
+  memset (e->data, 0, ofs);
+  memcpy (e->data + ofs, buffer, size);
+  memset (e->data + ofs + size, 0, BLOCK_SECTOR_SIZE - ofs - size);
+  mark_dirty (e);
+  cache_put (e);
+}
+
+/* Writes all of SECTOR from BUFFER. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Adds locked entry E, just written with metadata, to the running
+   thread's journal transaction, and holds it until that commits. */
+static void
+hold (struct cache_entry *e)
+{
+  if (!e->held && journal_add (e->sector))
+    {
+      lock_acquire (&cache_lock);
+      e->held = true;
+      lock_release (&cache_lock);
+    }
+}
+
+/* Writes SIZE bytes of metadata from BUFFER at offset OFS within
+   SECTOR, like cache_write_at(), as part of the running thread's
+   journal transaction. */
+void
+cache_write_meta_at (block_sector_t sector, const void *buffer, size_t ofs,
+                     size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  hold (e);
+  cache_put (e);
+}
+
+/* Writes all of metadata SECTOR from BUFFER, as part of the running
+   thread's journal transaction. */
+void
+cache_write_meta (block_sector_t sector, const void *buffer)
+{
+  cache_write_meta_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Lets SECTOR, held for the journal, be written back and evicted
+   again, once the journal has committed it. */
+void
+cache_unhold (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      {
+        cache[i].held = false;
+        cond_broadcast (&cache_unpinned, &cache_lock);
+        break;
+      }
+  lock_release (&cache_lock);
+}
+
+/* Returns true if SECTOR may be newer in the cache than on disk. */
+bool
+cache_is_dirty (block_sector_t sector)
+{
+  bool dirty = false;
+  size_t i;
+
+  /* DIRTY is only stable under the entry's lock, but a stale answer
+     only costs the journal a copy it did not need. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      dirty = cache[i].dirty;
+    else if (cache[i].flushing == sector)
+      dirty = true;
+  lock_release (&cache_lock);
+  return dirty;
+}
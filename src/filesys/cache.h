@@ -0,0 +1,48 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stats.h>
+#include "devices/block.h"
+
+/* Buffer cache of file system device sectors.
+
+   All file system I/O goes through here.  Writes only dirty the
+   cached copy.  Dirty sectors reach the disk in the background,
+   periodically and when many are dirty, and also when they are
+   evicted or when cache_flush() is called. */
+
+/* Milliseconds between periodic write-backs, 0 if off; tunable
+   "fs.flush_ms", set through cache_set_flush_interval(). */
+extern int cache_flush_ms;
+
+void cache_init (void);
+void cache_set_flush_interval (int ms);
+void cache_flush (void);
+void cache_flush_range (block_sector_t, size_t cnt);
+void cache_readahead (block_sector_t);
+
+/* Most sectors cache_prefetch() reads at once. */
+#define CACHE_PREFETCH_MAX 8
+
+void cache_prefetch (block_sector_t, size_t cnt);
+size_t cache_hot_sectors (block_sector_t *, size_t max);
+bool cache_drop (block_sector_t);
+void cache_get_stats (struct cache_stats *);
+
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_read_direct (block_sector_t, size_t cnt, void *);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_write_new (block_sector_t, const void *, size_t ofs, size_t size);
+
+/* Metadata writes, held back for the journal. */
+void cache_write_meta (block_sector_t, const void *);
+void cache_write_meta_at (block_sector_t, const void *, size_t ofs,
+                          size_t size);
+void cache_unhold (block_sector_t);
+bool cache_is_dirty (block_sector_t);
+
+#endif /* filesys/cache.h */
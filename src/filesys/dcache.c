@@ -0,0 +1,164 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of names cached. */
+#define DCACHE_SIZE 128
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within DIR. */
+    block_sector_t sector;              /* Inode, or DCACHE_NEGATIVE. */
+  };
+
+static struct dentry dentries_storage[DCACHE_SIZE];
+
+/* Cached names, indexed by directory and name. */
+static struct hash dentries;
+
+/* Every entry, used or not, least recently used first.  Unused
+   entries have DIR set to DCACHE_NEGATIVE and are not in
+   dentries. */
+static struct list lru;
+
+/* Protects all of the above. */
+static struct lock dcache_lock;
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the name cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  lock_init (&dcache_lock);
+  lock_register (&dcache_lock, "name cache");
+  list_init (&lru);
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("name cache creation failed");
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      dentries_storage[i].dir = DCACHE_NEGATIVE;
+      list_push_back (&lru, &dentries_storage[i].lru_elem);
+    }
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer if
+   there is none.  dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in directory DIR.  Returns false if the cache does
+   not know it.  Otherwise stores into *SECTORP the sector of the
+   inode it refers to, or DCACHE_NEGATIVE if DIR has no entry by
+   that name, and returns true. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      *sectorp = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in directory DIR refers to the inode in
+   SECTOR, or to nothing if SECTOR is DCACHE_NEGATIVE, replacing
+   anything known about it before. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_front (&lru), struct dentry, lru_elem);
+      if (d->dir != DCACHE_NEGATIVE)
+        hash_delete (&dentries, &d->hash_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_remove (&d->lru_elem);
+  list_push_back (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for directory DIR, for when the sector
+   holding DIR's inode starts holding a different directory. */
+void
+dcache_forget_dir (block_sector_t dir)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      struct dentry *d = &dentries_storage[i];
+
+      if (d->dir == dir)
+        {
+          hash_delete (&dentries, &d->hash_elem);
+          d->dir = DCACHE_NEGATIVE;
+          list_remove (&d->lru_elem);
+          list_push_front (&lru, &d->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Name cache.
+
+   Remembers, for recently looked up names, which inode sector a
+   name in a directory refers to, or that it refers to nothing, so
+   that repeated lookups of the same path do not read the
+   directory.  Directories keep it up to date as they change. */
+
+/* Sector recorded for a name that is known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sectorp);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector);
+void dcache_forget_dir (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
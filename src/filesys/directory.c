@@ -1,9 +1,14 @@
 #include "filesys/directory.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -21,12 +26,192 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory's file is a B+-tree of its entries, keyed by the
+   hash of their names, with one tree node in each block of the
+   file.  The root is always block 0.  A leaf holds up to LEAF_CNT
+   entries, in no particular order.  An index node holds up to
+   INDEX_CNT slots, in hash order, each pointing to a child whose
+   subtree holds the hashes from its own up to the next slot's.
+   A full node splits in two, adding a slot to its parent, and a
+   full root moves to a new block and is replaced by an index node
+   over it and its new sibling, so the tree grows at the top.
+
+   Finding an entry reads one block per level of the tree, and
+   each block is one sector, so lookups and inserts cost
+   O(log n) sector reads, and in practice two or three.  Nodes are
+   never merged: removing an entry only frees its slot. */
+#define DIR_BLOCK BLOCK_SECTOR_SIZE     /* Size of a tree node. */
+#define LEAF_MAGIC 0x4641454c           /* "LEAF". */
+#define INDEX_MAGIC 0x58444e49          /* "INDX". */
+#define LEAF_CNT 25                     /* Entries per leaf. */
+#define INDEX_CNT 63                    /* Slots per index node. */
+#define MAX_DEPTH 8                     /* Deeper trees are corrupt. */
+
+/* Leaf node. */
+struct dir_leaf
+  {
+    uint32_t magic;                     /* LEAF_MAGIC. */
+    uint32_t cnt;                       /* Entries in use. */
+    uint32_t unused;                    /* Not used. */
+    struct dir_entry entries[LEAF_CNT]; /* Entries. */
+  };
+
+/* Index node slot. */
+struct dir_slot
+  {
+    uint32_t hash;                      /* Least hash in the child. */
+    uint32_t block;                     /* Child's block number. */
+  };
+
+/* Index node. */
+struct dir_index
+  {
+    uint32_t magic;                     /* INDEX_MAGIC. */
+    uint32_t cnt;                       /* Slots in use. */
+    struct dir_slot slots[INDEX_CNT];   /* Slots, in hash order. */
+  };
+
+/* Any tree node. */
+union dir_block
+  {
+    uint32_t magic;                     /* LEAF_MAGIC or INDEX_MAGIC. */
+    struct dir_leaf leaf;
+    struct dir_index index;
+  };
+
+/* Returns the key of an entry named NAME. */
+static uint32_t
+name_hash (const char *name)
+{
+  return hash_string (name);
+}
+
+/* Returns the byte offset of block BLOCK in a directory's file. */
+static off_t
+block_ofs (uint32_t block)
+{
+  return (off_t) block * DIR_BLOCK;
+}
+
+/* Returns the byte offset of entry I of the leaf in BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t i)
+{
+  return (block_ofs (block) + offsetof (struct dir_leaf, entries)
+          + i * sizeof (struct dir_entry));
+}
+
+/* Reads SIZE bytes at OFS in INODE into BUFFER.  Returns true if
+   successful, false on a short read. */
+static bool
+read_at (struct inode *inode, void *buffer, size_t size, off_t ofs)
+{
+  return inode_read_at (inode, buffer, size, ofs) == (off_t) size;
+}
+
+/* Writes SIZE bytes from BUFFER at OFS in INODE, as metadata.
+   Returns true if successful, false on a short write. */
+static bool
+write_at (struct inode *inode, const void *buffer, size_t size, off_t ofs)
+{
+  inode_set_metadata (inode);
+  return inode_write_at (inode, buffer, size, ofs) == (off_t) size;
+}
+
+/* Returns the number of the next block past the end of INODE's
+   file, where a new node goes. */
+static uint32_t
+new_block (struct inode *inode)
+{
+  return DIV_ROUND_UP (inode_length (inode), DIR_BLOCK);
+}
+
+/* Returns the index of the last of the CNT slots in index node
+   BLOCK of INODE whose hash is at most HASH, or CNT if reading
+   fails.  The first slot covers every hash below the second's. */
+static size_t
+find_slot (struct inode *inode, uint32_t block, size_t cnt, uint32_t hash)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      struct dir_slot slot;
+
+      if (!read_at (inode, &slot, sizeof slot,
+                    block_ofs (block)
+                    + offsetof (struct dir_index, slots[mid])))
+        return cnt;
+      if (slot.hash <= hash)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Finds the leaf of INODE's tree into which entries with HASH go
+   and stores its block number into *BLOCKP.  Returns true if
+   successful, false if the directory could not be read. */
+static bool
+find_leaf (struct inode *inode, uint32_t hash, uint32_t *blockp)
+{
+  uint32_t block = 0;
+  int depth;
+
+  for (depth = 0; depth < MAX_DEPTH; depth++)
+    {
+      struct dir_slot slot;
+      uint32_t head[2];                 /* Magic and count. */
+      size_t i;
+
+      if (!read_at (inode, head, sizeof head, block_ofs (block)))
+        return false;
+      if (head[0] == LEAF_MAGIC)
+        {
+          *blockp = block;
+          return true;
+        }
+      if (head[0] != INDEX_MAGIC || head[1] == 0)
+        return false;
+
+      i = find_slot (inode, block, head[1], hash);
+      if (i == head[1]
+          || !read_at (inode, &slot, sizeof slot,
+                       block_ofs (block)
+                       + offsetof (struct dir_index, slots[i])))
+        return false;
+      block = slot.block;
+    }
+  return false;
+}
+
+/* Creates a directory in the given SECTOR.  ENTRY_CNT is only a
+   hint kept for the callers: the directory starts out as one
+   empty leaf and grows as entries are added.  Returns true if
+   successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt UNUSED)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct inode *inode;
+  uint32_t magic = LEAF_MAGIC;
+  bool success;
+
+  ASSERT (sizeof (struct dir_leaf) <= DIR_BLOCK);
+  ASSERT (sizeof (struct dir_index) <= DIR_BLOCK);
+
+  journal_begin ();
+  success = inode_create (sector, DIR_BLOCK);
+  if (success)
+    {
+      dcache_forget_dir (sector);
+      inode = inode_open (sector);
+      success = inode != NULL && write_at (inode, &magic, sizeof magic, 0);
+      inode_close (inode);
+    }
+  journal_end ();
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -93,19 +278,22 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  uint32_t block;
+  size_t i;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
+  if (!find_leaf (dir->inode, name_hash (name), &block))
+    return false;
+  for (i = 0; i < LEAF_CNT; i++)
+    if (read_at (dir->inode, &e, sizeof e, entry_ofs (block, i))
+        && e.in_use && !strcmp (name, e.name))
       {
         if (ep != NULL)
           *ep = e;
         if (ofsp != NULL)
-          *ofsp = ofs;
+          *ofsp = entry_ofs (block, i);
         return true;
       }
   return false;
@@ -114,35 +302,202 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Names looked up recently are answered from the name cache,
+   without reading DIR. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = (lookup (dir, name, &e, NULL)
+                ? e.inode_sector : DCACHE_NEGATIVE);
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != DCACHE_NEGATIVE ? inode_open (sector) : NULL;
 
   return *inode != NULL;
 }
 
+/* Chooses where to split the full leaf L, which is about to get
+   an entry with hash HASH as well: entries with hashes at or above
+   the returned hash move to a new leaf.  Both halves keep at least
+   one entry and entries with equal hashes stay together.  Returns
+   0 if every entry has the same hash, so that L cannot split. */
+static uint32_t
+choose_split (const struct dir_leaf *l, uint32_t hash)
+{
+  uint32_t hashes[LEAF_CNT + 1];
+  size_t i, j;
+
+  /* Sort the hashes by insertion. */
+  for (i = 0; i <= LEAF_CNT; i++)
+    {
+      uint32_t h = i < LEAF_CNT ? name_hash (l->entries[i].name) : hash;
+
+      for (j = i; j > 0 && hashes[j - 1] > h; j--)
+        hashes[j] = hashes[j - 1];
+      hashes[j] = h;
+    }
+
+  /* Split at the median, or else above the least hash. */
+  i = (LEAF_CNT + 1) / 2;
+  if (hashes[i] == hashes[0])
+    for (i = 1; i <= LEAF_CNT && hashes[i] == hashes[0]; i++)
+      continue;
+  return i <= LEAF_CNT ? hashes[i] : 0;
+}
+
+/* Adds E to leaf L, which must have a free slot. */
+static void
+leaf_add (struct dir_leaf *l, const struct dir_entry *e)
+{
+  size_t i;
+
+  for (i = 0; i < LEAF_CNT; i++)
+    if (!l->entries[i].in_use)
+      {
+        l->entries[i] = *e;
+        l->cnt++;
+        return;
+      }
+  NOT_REACHED ();
+}
+
+/* Adds SLOT to index node X, which must have a free slot, at
+   position I. */
+static void
+index_add (struct dir_index *x, size_t i, const struct dir_slot *slot)
+{
+  memmove (&x->slots[i + 1], &x->slots[i],
+           (x->cnt - i) * sizeof *x->slots);
+  x->slots[i] = *slot;
+  x->cnt++;
+}
+
+/* Inserts E, whose name hashes to HASH, into the subtree whose
+   root node is in BLOCK of INODE, DEPTH levels below the root of
+   the tree.  Returns true if successful, false on failure.  If the
+   node had to split, stores the block and least hash of its new
+   right sibling into *SPLIT, and otherwise sets SPLIT->block to 0,
+   the root's block, which is never a sibling. */
+static bool
+insert (struct inode *inode, uint32_t block, const struct dir_entry *e,
+        uint32_t hash, int depth, struct dir_slot *split)
+{
+  union dir_block *b = NULL, *sib = NULL;
+  struct dir_slot child;
+  bool success = false;
+  size_t i;
+
+  split->block = 0;
+  if (depth >= MAX_DEPTH)
+    return false;
+  b = malloc (sizeof *b);
+  sib = malloc (sizeof *sib);
+  if (b == NULL || sib == NULL
+      || !read_at (inode, b, sizeof *b, block_ofs (block)))
+    goto done;
+
+  if (b->magic == LEAF_MAGIC)
+    {
+      struct dir_leaf *l = &b->leaf;
+
+      if (l->cnt < LEAF_CNT)
+        {
+          leaf_add (l, e);
+          success = write_at (inode, l, sizeof *l, block_ofs (block));
+          goto done;
+        }
+
+      /* Split L, moving its upper hashes to a new leaf. */
+      split->hash = choose_split (l, hash);
+      if (split->hash == 0)
+        goto done;
+      memset (sib, 0, sizeof *sib);
+      sib->leaf.magic = LEAF_MAGIC;
+      for (i = 0; i < LEAF_CNT; i++)
+        if (name_hash (l->entries[i].name) >= split->hash)
+          {
+            leaf_add (&sib->leaf, &l->entries[i]);
+            l->entries[i].in_use = false;
+            l->cnt--;
+          }
+      leaf_add (hash < split->hash ? l : &sib->leaf, e);
+      split->block = new_block (inode);
+      success = (write_at (inode, &sib->leaf, sizeof sib->leaf,
+                           block_ofs (split->block))
+                 && write_at (inode, l, sizeof *l, block_ofs (block)));
+    }
+  else if (b->magic == INDEX_MAGIC && b->index.cnt > 0)
+    {
+      struct dir_index *x = &b->index;
+
+      for (i = 1; i < x->cnt && x->slots[i].hash <= hash; i++)
+        continue;
+      i--;
+      if (!insert (inode, x->slots[i].block, e, hash, depth + 1, &child))
+        goto done;
+      if (child.block == 0)
+        {
+          success = true;
+          goto done;
+        }
+
+      /* Add a slot for the child's new sibling after the child's,
+         splitting X in half first if it is full. */
+      i++;
+      if (x->cnt < INDEX_CNT)
+        {
+          index_add (x, i, &child);
+          success = write_at (inode, x, sizeof *x, block_ofs (block));
+          goto done;
+        }
+      memset (sib, 0, sizeof *sib);
+      sib->index.magic = INDEX_MAGIC;
+      sib->index.cnt = x->cnt - INDEX_CNT / 2;
+      memcpy (sib->index.slots, &x->slots[INDEX_CNT / 2],
+              sib->index.cnt * sizeof *x->slots);
+      x->cnt = INDEX_CNT / 2;
+      if (i <= x->cnt)
+        index_add (x, i, &child);
+      else
+        index_add (&sib->index, i - x->cnt, &child);
+      split->hash = sib->index.slots[0].hash;
+      split->block = new_block (inode);
+      success = (write_at (inode, &sib->index, sizeof sib->index,
+                           block_ofs (split->block))
+                 && write_at (inode, x, sizeof *x, block_ofs (block)));
+    }
+
+ done:
+  free (b);
+  free (sib);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   error occurs, or, very rarely, if more than LEAF_CNT names in
+   DIR share NAME's hash. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
-  off_t ofs;
+  struct dir_slot split;
+  union dir_block *root;
+  uint32_t block;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -154,27 +509,36 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
-    goto done;
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!insert (dir->inode, 0, &e, name_hash (name), 0, &split))
+    return false;
+  dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  if (split.block == 0)
+    return true;
 
- done:
+  /* The root split.  Move its left half out of block 0 and make
+     the root an index node over both halves. */
+  root = malloc (sizeof *root);
+  if (root == NULL)
+    return false;
+  block = new_block (dir->inode);
+  if (read_at (dir->inode, root, sizeof *root, 0)
+      && write_at (dir->inode, root, sizeof *root, block_ofs (block)))
+    {
+      memset (root, 0, sizeof *root);
+      root->index.magic = INDEX_MAGIC;
+      root->index.cnt = 2;
+      root->index.slots[0].hash = 0;
+      root->index.slots[0].block = block;
+      root->index.slots[1] = split;
+      success = write_at (dir->inode, root, sizeof *root, 0);
+    }
+  free (root);
   return success;
 }
 
@@ -187,7 +551,8 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  off_t ofs, cnt_ofs;
+  uint32_t cnt;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
@@ -201,9 +566,16 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Erase directory entry. */
+  /* Erase directory entry, and count it out of its leaf. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  cnt_ofs = ofs / DIR_BLOCK * DIR_BLOCK + offsetof (struct dir_leaf, cnt);
+  if (!write_at (dir->inode, &e, sizeof e, ofs))
+    goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+  if (!read_at (dir->inode, &cnt, sizeof cnt, cnt_ofs))
+    goto done;
+  cnt--;
+  if (!write_at (dir->inode, &cnt, sizeof cnt, cnt_ofs))
     goto done;
 
   /* Remove inode. */
@@ -217,16 +589,31 @@ dir_remove (struct dir *dir, const char *name)
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Entries come in the order of the
+   leaves in the directory's file, skipping index nodes. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
-
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (dir->pos < inode_length (dir->inode))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      uint32_t block = dir->pos / DIR_BLOCK;
+      off_t first = entry_ofs (block, 0);
+      struct dir_entry e;
+      uint32_t magic;
+      size_t i;
+
+      if (!read_at (dir->inode, &magic, sizeof magic, block_ofs (block)))
+        break;
+      i = dir->pos < first ? 0 : (dir->pos - first) / sizeof e;
+      if (magic != LEAF_MAGIC || i >= LEAF_CNT)
+        {
+          dir->pos = block_ofs (block + 1);
+          continue;
+        }
+
+      dir->pos = entry_ofs (block, i + 1);
+      if (read_at (dir->inode, &e, sizeof e, entry_ofs (block, i))
+          && e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
@@ -234,3 +621,64 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Reads up to CNT of the entries in DIR from its position on into
+   ENTRIES, in the order of dir_readdir(), and returns how many were
+   read, 0 at the end of the directory.  Each leaf takes one read of
+   its whole block instead of one read per entry. */
+size_t
+dir_read_entries (struct dir *dir, struct dir_info *entries, size_t cnt)
+{
+  struct dir_leaf *leaf;
+  size_t n = 0;
+
+  if (cnt == 0)
+    return 0;
+  leaf = malloc (sizeof *leaf);
+  if (leaf == NULL)
+    return 0;
+
+  while (n < cnt && dir->pos < inode_length (dir->inode))
+    {
+      uint32_t block = dir->pos / DIR_BLOCK;
+      off_t first = entry_ofs (block, 0);
+      size_t i = (dir->pos < first ? 0
+                  : (dir->pos - first) / sizeof *leaf->entries);
+
+      if (!read_at (dir->inode, leaf, sizeof *leaf, block_ofs (block)))
+        break;
+      if (leaf->magic != LEAF_MAGIC)
+        {
+          dir->pos = block_ofs (block + 1);
+          continue;
+        }
+
+      for (; i < LEAF_CNT && n < cnt; i++)
+        if (leaf->entries[i].in_use)
+          {
+            entries[n].inumber = leaf->entries[i].inode_sector;
+            strlcpy (entries[n].name, leaf->entries[i].name,
+                     sizeof entries[n].name);
+            n++;
+          }
+      dir->pos = i < LEAF_CNT ? entry_ofs (block, i) : block_ofs (block + 1);
+    }
+  free (leaf);
+  return n;
+}
+
+/* Returns the position of the next entry dir_readdir() reads from
+   DIR. */
+off_t
+dir_tell (const struct dir *dir)
+{
+  return dir->pos;
+}
+
+/* Makes dir_readdir() on DIR go on from POS, a position returned by
+   dir_tell() for the same directory. */
+void
+dir_seek (struct dir *dir, off_t pos)
+{
+  dir->pos = pos;
+}
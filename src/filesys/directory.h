@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -13,6 +14,13 @@
 
 struct inode;
 
+/* An entry as read by dir_read_entries(). */
+struct dir_info
+  {
+    block_sector_t inumber;             /* Sector of the entry's inode. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -26,5 +34,8 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_read_entries (struct dir *, struct dir_info *, size_t cnt);
+off_t dir_tell (const struct dir *);
+void dir_seek (struct dir *, off_t pos);
 
 #endif /* filesys/directory.h */
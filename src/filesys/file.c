@@ -1,13 +1,21 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <stdint.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
+    struct lock pos_lock;       /* Makes each read or write's use of
+                                   pos atomic; the inode locks itself. */
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
@@ -22,6 +30,7 @@ file_open (struct inode *inode)
     {
       file->inode = inode;
       file->pos = 0;
+      lock_init (&file->pos_lock);
       file->deny_write = false;
       return file;
     }
@@ -68,10 +77,42 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  lock_acquire (&file->pos_lock);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  lock_release (&file->pos_lock);
+  return bytes_read;
+}
+
+#ifdef VM
+/* Reads whole pages of FILE, from its current position, into the
+   page-aligned user buffer UPAGE, up to SIZE bytes, by mapping the
+   page cache's frames there copy-on-write instead of copying them.
+   Stops at the first page that cannot be mapped so, and returns
+   the number of bytes read, a multiple of PGSIZE; 0 if FILE's
+   position is not page-aligned.  Advances FILE's position by that
+   many bytes. */
+off_t
+file_read_lend (struct file *file, void *upage, off_t size)
+{
+  off_t bytes_read = 0;
+
+  ASSERT (pg_ofs (upage) == 0);
+  lock_acquire (&file->pos_lock);
+  if (file->pos % PGSIZE == 0)
+    while (size - bytes_read >= PGSIZE
+           && frame_cache_lend (file->inode, file->pos,
+                                (uint8_t *) upage + bytes_read))
+      {
+        file->pos += PGSIZE;
+        bytes_read += PGSIZE;
+      }
+  lock_release (&file->pos_lock);
   return bytes_read;
 }
+#endif
 
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
@@ -94,8 +135,12 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  lock_acquire (&file->pos_lock);
+  bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
+  lock_release (&file->pos_lock);
   return bytes_written;
 }
 
@@ -113,6 +158,108 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads into the IOVCNT buffers of IOV in turn from FILE, starting
+   at the file's current position, as a single read.
+   Returns the number of bytes actually read.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, int iovcnt)
+{
+  off_t bytes_read;
+
+  lock_acquire (&file->pos_lock);
+  bytes_read = inode_readv_at (file->inode, iov, iovcnt, file->pos);
+  file->pos += bytes_read;
+  lock_release (&file->pos_lock);
+  return bytes_read;
+}
+
+/* Writes the IOVCNT buffers of IOV in turn into FILE, starting at
+   the file's current position, as a single write.
+   Returns the number of bytes actually written.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, int iovcnt)
+{
+  off_t bytes_written;
+
+  lock_acquire (&file->pos_lock);
+  bytes_written = inode_writev_at (file->inode, iov, iovcnt, file->pos);
+  file->pos += bytes_written;
+  lock_release (&file->pos_lock);
+  return bytes_written;
+}
+
+/* Bytes moved per step by file_copy(). */
+#define COPY_CHUNK 4096
+
+/* Copies up to SIZE bytes from IN, starting at its current position,
+   to OUT at its current position, without the data leaving the
+   kernel.  Returns the number of bytes copied, which may be less
+   than SIZE at end of file or if memory runs out.
+   Advances both positions by the number of bytes copied. */
+off_t
+file_copy (struct file *out, struct file *in, off_t size)
+{
+  struct lock *first, *second;
+  off_t bytes_copied = 0;
+  uint8_t *buffer;
+
+  buffer = malloc (COPY_CHUNK);
+  if (buffer == NULL)
+    return 0;
+
+  /* Lock both positions in a fixed order, so that two copies in
+     opposite directions cannot deadlock. */
+  first = in < out ? &in->pos_lock : &out->pos_lock;
+  second = in < out ? &out->pos_lock : &in->pos_lock;
+  lock_acquire (first);
+  if (in != out)
+    lock_acquire (second);
+
+  while (bytes_copied < size)
+    {
+      off_t chunk = size - bytes_copied < COPY_CHUNK
+                    ? size - bytes_copied : COPY_CHUNK;
+      off_t n = inode_read_at (in->inode, buffer, chunk, in->pos);
+      off_t written;
+
+      if (n == 0)
+        break;
+      written = inode_write_at (out->inode, buffer, n, out->pos);
+      in->pos += written;
+      out->pos += written;
+      bytes_copied += written;
+      if (written < n)
+        break;
+    }
+
+  if (in != out)
+    lock_release (second);
+  lock_release (first);
+  free (buffer);
+  return bytes_copied;
+}
+
+/* Allocates disk space for the first LENGTH bytes of FILE without
+   changing its length, so that writes there need no allocation.
+   Returns true if successful, false if the disk is full. */
+bool
+file_reserve (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_reserve (file->inode, length);
+}
+
+/* Writes FILE's data and metadata to disk, returning once they
+   are there. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -155,7 +302,9 @@ file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
+  lock_acquire (&file->pos_lock);
   file->pos = new_pos;
+  lock_release (&file->pos_lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -163,6 +312,11 @@ file_seek (struct file *file, off_t new_pos)
 off_t
 file_tell (struct file *file) 
 {
+  off_t pos;
+
   ASSERT (file != NULL);
-  return file->pos;
+  lock_acquire (&file->pos_lock);
+  pos = file->pos;
+  lock_release (&file->pos_lock);
+  return pos;
 }
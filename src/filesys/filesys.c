@@ -2,14 +2,25 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/warmup.h"
+#include "threads/synch.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Protects the directory tree: lookups hold it for reading, so they
+   run side by side, and updates hold it for writing.  File data has
+   per-inode locks and the free map its own lock, so this is never
+   held for I/O on file contents. */
+static struct rw_lock dir_lock;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,13 +32,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  rw_lock_init (&dir_lock);
+  cache_init ();
+  dcache_init ();
   inode_init ();
+  journal_init (format);
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  warmup_start ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,9 +51,30 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  warmup_save ();
   free_map_close ();
+  cache_flush ();
 }
 
+/* Writes every dirty sector of the file system to disk and
+   returns once they are there. */
+void
+filesys_sync (void)
+{
+  cache_flush ();
+}
+
+/* Allocates a sector for a new inode in DIR and stores it into
+   *SECTORP.  The sector is taken near DIR's own inode, and the new
+   file's data then goes near its inode, so the files of one
+   directory cluster together. */
+static bool
+allocate_inode_sector (struct dir *dir, block_sector_t *sectorp)
+{
+  return free_map_allocate_near (inode_get_inumber (dir_get_inode (dir)), 1,
+                                 sectorp);
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -46,14 +83,21 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  rw_lock_acquire_write (&dir_lock);
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && allocate_inode_sector (dir, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  rw_lock_release_write (&dir_lock);
+  journal_end ();
 
   return success;
 }
@@ -66,16 +110,44 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  struct dir *dir;
   struct inode *inode = NULL;
 
+  rw_lock_acquire_read (&dir_lock);
+  dir = dir_open_root ();
   if (dir != NULL)
     dir_lookup (dir, name, &inode);
   dir_close (dir);
+  rw_lock_release_read (&dir_lock);
 
   return file_open (inode);
 }
 
+/* Opens the directory with the given NAME, which must be "/" or
+   ".", since the root is the only directory.  Returns the new
+   directory if successful or a null pointer otherwise. */
+struct dir *
+filesys_open_dir (const char *name)
+{
+  if (strcmp (name, "/") && strcmp (name, "."))
+    return NULL;
+  return dir_open_root ();
+}
+
+/* Reads up to CNT entries of DIR into ENTRIES, as dir_read_entries()
+   does, while no entry is added or removed.  Returns how many were
+   read. */
+size_t
+filesys_read_dir (struct dir *dir, struct dir_info *entries, size_t cnt)
+{
+  size_t n;
+
+  rw_lock_acquire_read (&dir_lock);
+  n = dir_read_entries (dir, entries, cnt);
+  rw_lock_release_read (&dir_lock);
+  return n;
+}
+
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
@@ -83,9 +155,16 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  rw_lock_acquire_write (&dir_lock);
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  rw_lock_release_write (&dir_lock);
+  journal_end ();
 
   return success;
 }
@@ -98,6 +177,7 @@ do_format (void)
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
+  warmup_format ();
   free_map_close ();
   printf ("done.\n");
 }
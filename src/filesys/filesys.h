@@ -2,11 +2,16 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
+struct dir;
+struct dir_info;
+
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
@@ -15,6 +20,9 @@ void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
+struct dir *filesys_open_dir (const char *name);
+size_t filesys_read_dir (struct dir *, struct dir_info *, size_t cnt);
 bool filesys_remove (const char *name);
+void filesys_sync (void);
 
 #endif /* filesys/filesys.h */
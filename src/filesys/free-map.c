@@ -4,49 +4,127 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/warmup.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map and file. */
+static block_sector_t cursor;        /* End of the last allocation. */
+
+/* Writes the bits for the CNT sectors starting at SECTOR to the
+   free map file, if it is open.  Only the bytes holding them are
+   written, into the buffer cache, so an allocation costs the same
+   however big the device is.  Returns true if successful, false
+   otherwise.  free_map_lock must be held. */
+static bool
+write_bits (block_sector_t sector, size_t cnt)
+{
+  return (free_map_file == NULL
+          || bitmap_write_range (free_map, free_map_file, sector, cnt));
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
+  lock_register (&free_map_lock, "free map");
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  /* Without a summary, allocation just searches more slowly. */
+  bitmap_summarize (free_map);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  if (block_size (fs_device) < JOURNAL_SECTOR + JOURNAL_SECTORS)
+    PANIC ("file system device too small for the journal");
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  if (block_size (fs_device) > WARMUP_SECTOR)
+    bitmap_mark (free_map, WARMUP_SECTOR);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search starts where the last
+   allocation ended, so that sectors allocated one after another
+   end up next to each other.
    Returns true if successful, false if not enough consecutive
    sectors were available or if the free_map file could not be
    written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after sector GOAL as it can, and stores the first into *SECTORP.
+   The search runs forward from GOAL to the end of the device, then
+   from the start.  A GOAL of 0, which is never a data sector,
+   means no preference, as for free_map_allocate().
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if the free_map file could not be
+   written. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (goal == 0)
+    goal = cursor;
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  sector = bitmap_scan_and_flip (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal > 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR && !write_bits (sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
       sector = BITMAP_ERROR;
     }
+  if (sector != BITMAP_ERROR)
+    cursor = sector + cnt;
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT sectors starting at SECTOR, if they are all
+   free.  Returns true if successful, false if some of them are in
+   use or past the end of the device, or if the free_map file
+   could not be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector <= bitmap_size (free_map)
+      && cnt <= bitmap_size (free_map) - sector
+      && bitmap_none (free_map, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      success = write_bits (sector, cnt);
+      if (!success)
+        bitmap_set_multiple (free_map, sector, cnt, false);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  write_bits (sector, cnt);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,11 +134,14 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Closes the free map file.  Every change to the free map has
+   already been written to it, through the buffer cache, which
+   cache_flush() later writes to disk. */
 void
 free_map_close (void) 
 {
@@ -72,12 +153,21 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
-  /* Create inode. */
+  struct inode *inode;
+
+  /* Create inode, with all of its sectors allocated, so that
+     writing the free map never needs the free map.  That has to
+     happen before free_map_file is set, while allocations do not
+     write it yet. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
+  inode = inode_open (FREE_MAP_SECTOR);
+  if (inode == NULL || !inode_reserve (inode, bitmap_file_size (free_map)))
+    PANIC ("free map creation failed");
+  inode_set_metadata (inode);
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
@@ -1,6 +1,7 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
 #include <stdio.h>
+#include <round.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
@@ -68,7 +69,10 @@ fsutil_rm (char **argv)
 }
 
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.  File data is read a page
+   at a time, in one multi-sector read, and written a page at a
+   time into a file whose sectors are all reserved up front, so
+   that the file lands in as few runs as the free map allows. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
@@ -79,7 +83,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_page (0);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -117,20 +121,25 @@ fsutil_extract (char **argv UNUSED)
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
-          /* Create destination file. */
-          if (!filesys_create (file_name, size))
+          /* Create destination file, empty so that its sectors
+             need not be zeroed, and reserve them all. */
+          if (!filesys_create (file_name, 0))
             PANIC ("%s: create failed", file_name);
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
+          if (!file_reserve (dst, size))
+            PANIC ("%s: reserve failed", file_name);
 
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              int chunk_size = size > PGSIZE ? PGSIZE : size;
+              size_t sector_cnt = DIV_ROUND_UP (chunk_size,
+                                                BLOCK_SECTOR_SIZE);
+
+              block_read_multiple (src, sector, sector_cnt, data);
+              sector += sector_cnt;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -151,7 +160,7 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  palloc_free_page (data);
   free (header);
 }
 
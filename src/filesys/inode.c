@@ -1,25 +1,129 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
+
+/* Identify an inode and its layout. */
+#define INODE_MAGIC 0x494e4f44          /* Indexed: "INOD". */
+#define EXTENT_MAGIC 0x45585453         /* Extents: "EXTS". */
+#define INLINE_MAGIC 0x494e4c4e         /* Inline data: "INLN". */
+
+/* Number of direct and indirect sector pointers in an inode, and
+   number of sector pointers in an index sector. */
+#define DIRECT_CNT 124
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Number of data sectors reachable through direct, indirect and
+   doubly indirect pointers, and in all. */
+#define DIRECT_SECTORS DIRECT_CNT
+#define INDIRECT_SECTORS PTRS_PER_SECTOR
+#define DOUBLY_SECTORS (PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+#define MAX_SECTORS (DIRECT_SECTORS + INDIRECT_SECTORS + DOUBLY_SECTORS)
+
+/* Indexed layout.
+
+   Data sectors are found through DIRECT_CNT direct pointers, then
+   an indirect sector of pointers, then a doubly indirect sector of
+   pointers to indirect sectors.  A null pointer (sector 0, which
+   holds the free map inode and so is never a data sector) is a
+   hole that reads as zeros; writing to it allocates a sector. */
+struct indexed_map
+  {
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect index sector. */
+    block_sector_t doubly_indirect;     /* Doubly indirect index sector. */
+  };
+
+/* A run of consecutive sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
+
+/* Extent layout.
+
+   The file's sectors are a list of extents, in file order, with no
+   holes.  The first INLINE_EXTENTS are in the inode.  The rest go
+   in an overflow B+-tree of height two: a root sector indexes leaf
+   sectors of extents by the file sector each leaf starts at.
+   Files only grow at the end, so new extents always go in the
+   last leaf and the tree never needs splitting.  Growth extends
+   the last extent in place while the sectors after it are free,
+   so a file written sequentially takes a few long runs. */
+#define INLINE_EXTENTS 61
+struct extent_map
+  {
+    struct extent extents[INLINE_EXTENTS]; /* First extents. */
+    uint32_t extent_cnt;                /* Extents in use above. */
+    uint32_t sectors;                   /* Sectors in all extents. */
+    block_sector_t overflow;            /* Root of the overflow tree, or 0. */
+    uint32_t unused;                    /* Not used. */
+  };
+
+/* Overflow tree root sector. */
+#define ROOT_CNT 63
+struct extent_root
+  {
+    uint32_t cnt;                       /* Leaves in use. */
+    uint32_t unused;                    /* Not used. */
+    struct
+      {
+        uint32_t first;                 /* File sector the leaf starts at. */
+        block_sector_t leaf;            /* Leaf sector. */
+      }
+    leaves[ROOT_CNT];
+  };
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Overflow tree leaf sector. */
+#define LEAF_CNT 63
+struct extent_leaf
+  {
+    uint32_t cnt;                       /* Extents in use. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[LEAF_CNT];    /* Extents, in file order. */
+  };
+
+/* Bytes of data that fit inside an inode. */
+#define INLINE_MAX (sizeof (struct indexed_map))
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file of up to INLINE_MAX bytes keeps its data in the inode
+   itself, with INLINE_MAGIC, and so needs no data sector and no
+   read beyond the inode's.  Bytes past the end of such a file are
+   zeros.  When the file grows past INLINE_MAX, its data moves to a
+   data sector and it takes the layout new inodes get. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        struct indexed_map indexed;     /* If magic is INODE_MAGIC. */
+        struct extent_map extents;      /* If magic is EXTENT_MAGIC. */
+        uint8_t data[INLINE_MAX];       /* If magic is INLINE_MAGIC. */
+      }
+    map;
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
+/* Layout for new inodes. */
+static unsigned new_inode_magic = INODE_MAGIC;
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -31,37 +135,631 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in its shard's table. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    unsigned generation;                /* Bumped by every write. */
+    off_t ra_next;                      /* Where a sequential read starts. */
+    off_t ra_end;                       /* End of data read ahead so far. */
+    size_t ra_window;                   /* Read-ahead sectors, 0 if off. */
+    enum inode_access access;           /* Access pattern advised. */
+    bool metadata;                      /* Data is journaled metadata? */
+    struct rw_lock rw;                  /* Readers, or one writer of layout. */
+    struct lock range_lock;             /* Protects RANGES and GENERATION
+                                           under a read lock on RW. */
+    struct condition range_freed;       /* Signaled when a range ends. */
+    struct list ranges;                 /* Byte ranges written in place. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* How follow() fills in a newly allocated sector. */
+enum fill
+  {
+    FILL_NONE,                          /* Leave it unwritten. */
+    FILL_DATA,                          /* Zero it, as data. */
+    FILL_INDEX                          /* Zero it, as metadata. */
+  };
+
+/* Returns the sector that *SLOTP points to.  If it points nowhere
+   and ALLOCATE is true, first allocates a sector as near after GOAL
+   as it can, fills it in as FILL says, points *SLOTP at it and sets
+   *CHANGED to true.  Returns 0 if there is no sector or the disk
+   is full. */
+static block_sector_t
+follow (block_sector_t *slotp, block_sector_t goal, bool allocate,
+        enum fill fill, bool *changed)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  if (*slotp == 0 && allocate && free_map_allocate_near (goal, 1, slotp))
+    {
+      if (fill == FILL_DATA)
+        cache_write (*slotp, zeros);
+      else if (fill == FILL_INDEX)
+        cache_write_meta (*slotp, zeros);
+      *changed = true;
+    }
+  return *slotp;
+}
+
+/* Returns the sector that pointer I in index sector INDEX points
+   to, allocating it as follow() does. */
+static block_sector_t
+follow_index (block_sector_t index, size_t i, block_sector_t goal,
+              bool allocate, enum fill fill)
+{
+  block_sector_t slot;
+  bool changed = false;
+
+  cache_read_at (index, &slot, i * sizeof slot, sizeof slot);
+  follow (&slot, goal, allocate, fill, &changed);
+  if (changed)
+    cache_write_meta_at (index, &slot, i * sizeof slot, sizeof slot);
+  return slot;
+}
+
+/* Does the work of indexed_to_sector(), allocating any sectors
+   it needs near GOAL.  Index sectors are always zeroed, a data
+   sector only if ZERO is true. */
+static block_sector_t
+indexed_walk (struct indexed_map *m, size_t idx, block_sector_t goal,
+              bool allocate, bool zero, bool *changed)
+{
+  enum fill fill = zero ? FILL_DATA : FILL_NONE;
+  block_sector_t sector;
+
+  if (idx < DIRECT_SECTORS)
+    return follow (&m->direct[idx], goal, allocate, fill, changed);
+  idx -= DIRECT_SECTORS;
+
+  if (idx < INDIRECT_SECTORS)
+    {
+      sector = follow (&m->indirect, goal, allocate, FILL_INDEX, changed);
+      return sector != 0
+             ? follow_index (sector, idx, goal, allocate, fill) : 0;
+    }
+  idx -= INDIRECT_SECTORS;
+
+  if (idx < DOUBLY_SECTORS)
+    {
+      sector = follow (&m->doubly_indirect, goal, allocate, FILL_INDEX,
+                       changed);
+      if (sector != 0)
+        sector = follow_index (sector, idx / PTRS_PER_SECTOR, goal,
+                               allocate, FILL_INDEX);
+      return sector != 0
+             ? follow_index (sector, idx % PTRS_PER_SECTOR, goal, allocate,
+                             fill)
+             : 0;
+    }
+  return 0;
+}
+
+/* Returns the sector holding data sector IDX in indexed map M,
+   or 0 if it is a hole.  If ALLOCATE is true, fills in the hole
+   and any index sectors leading to it, and sets *CHANGED to true
+   if M itself changed; then 0 means the disk is full or IDX is
+   beyond the largest possible file.  A new data sector goes right
+   after the one before it in the file if it can, or else as near
+   after GOAL as it can, and is zeroed if ZERO is true. */
+static block_sector_t
+indexed_to_sector (struct indexed_map *m, size_t idx, block_sector_t goal,
+                   bool allocate, bool zero, bool *changed)
+{
+  block_sector_t sector = indexed_walk (m, idx, 0, false, false, NULL);
+
+  if (sector != 0 || !allocate)
+    return sector;
+  if (idx > 0)
+    {
+      block_sector_t prev = indexed_walk (m, idx - 1, 0, false, false, NULL);
+      if (prev != 0)
+        goal = prev + 1;
+    }
+  return indexed_walk (m, idx, goal, true, zero, changed);
+}
+
+/* Returns the first data sector index at or after IDX in indexed
+   map M that may be allocated, skipping over the index sectors
+   that are holes as a whole.  So walking a sparse file costs in
+   proportion to what it stores, not to its length. */
+static size_t
+indexed_skip_holes (const struct indexed_map *m, size_t idx)
+{
+  size_t base = DIRECT_SECTORS + INDIRECT_SECTORS;
+  block_sector_t slot;
+
+  if (idx < DIRECT_SECTORS)
+    return idx;
+  if (idx < base)
+    return m->indirect != 0 ? idx : base;
+  if (idx >= MAX_SECTORS || m->doubly_indirect == 0)
+    return MAX_SECTORS;
+
+  cache_read_at (m->doubly_indirect, &slot,
+                 (idx - base) / PTRS_PER_SECTOR * sizeof slot, sizeof slot);
+  return slot != 0 ? idx : ROUND_UP (idx - base + 1, PTRS_PER_SECTOR) + base;
+}
+
+/* Reads the root entry for leaf I of overflow root ROOT into
+   *FIRST and *LEAF. */
+static void
+read_root_entry (block_sector_t root, size_t i, uint32_t *first,
+                 block_sector_t *leaf)
+{
+  cache_read_at (root, first, offsetof (struct extent_root, leaves[i].first),
+                 sizeof *first);
+  cache_read_at (root, leaf, offsetof (struct extent_root, leaves[i].leaf),
+                 sizeof *leaf);
+}
+
+/* Returns the count at the start of overflow tree sector SECTOR. */
+static uint32_t
+read_cnt (block_sector_t sector)
+{
+  uint32_t cnt;
+
+  cache_read_at (sector, &cnt, 0, sizeof cnt);
+  return cnt;
+}
+
+/* Sets the count at the start of overflow tree sector SECTOR. */
+static void
+write_cnt (block_sector_t sector, uint32_t cnt)
+{
+  cache_write_meta_at (sector, &cnt, 0, sizeof cnt);
+}
+
+/* Returns the sector holding file sector IDX, which must be in
+   the overflow tree at ROOT. */
+static block_sector_t
+overflow_to_sector (block_sector_t root, uint32_t idx)
+{
+  size_t lo = 0, hi = read_cnt (root);
+  uint32_t first, cnt, i;
+  block_sector_t leaf;
+
+  /* Find the last leaf starting at or before IDX. */
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+
+      read_root_entry (root, mid, &first, &leaf);
+      if (first <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  read_root_entry (root, lo, &first, &leaf);
+
+  cnt = read_cnt (leaf);
+  for (i = 0; i < cnt; i++)
+    {
+      struct extent e;
+
+      cache_read_at (leaf, &e, offsetof (struct extent_leaf, extents[i]),
+                     sizeof e);
+      if (idx - first < e.length)
+        return e.start + (idx - first);
+      first += e.length;
+    }
+  NOT_REACHED ();
+}
+
+/* Finds the last extent in M.  Returns false if M has no extents.
+   Otherwise stores it into *E and returns true, and stores into
+   *SECTORP and *OFSP the overflow tree sector and offset that
+   hold it, or 0 and the index of an inline extent. */
+static bool
+last_extent (const struct extent_map *m, struct extent *e,
+             block_sector_t *sectorp, size_t *ofsp)
+{
+  if (m->overflow != 0 && read_cnt (m->overflow) > 0)
+    {
+      uint32_t first;
+      block_sector_t leaf;
+
+      read_root_entry (m->overflow, read_cnt (m->overflow) - 1, &first,
+                       &leaf);
+      *sectorp = leaf;
+      *ofsp = offsetof (struct extent_leaf, extents[read_cnt (leaf) - 1]);
+      cache_read_at (leaf, e, *ofsp, sizeof *e);
+      return true;
+    }
+  if (m->extent_cnt > 0)
+    {
+      *sectorp = 0;
+      *ofsp = m->extent_cnt - 1;
+      *e = m->extents[*ofsp];
+      return true;
+    }
+  return false;
+}
+
+/* Returns a newly allocated zeroed sector for the overflow tree,
+   as near after GOAL as it can, or 0 if the disk is full. */
+static block_sector_t
+new_tree_sector (block_sector_t goal)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (!free_map_allocate_near (goal, 1, &sector))
+    return 0;
+  cache_write_meta (sector, zeros);
+  return sector;
+}
+
+/* Appends an extent of CNT sectors starting at START to M.
+   Returns false if the overflow tree is full or the disk is. */
+static bool
+add_extent (struct extent_map *m, block_sector_t start, uint32_t cnt)
+{
+  struct extent e;
+  block_sector_t leaf;
+  uint32_t root_cnt, leaf_cnt = LEAF_CNT;
+
+  e.start = start;
+  e.length = cnt;
+  if (m->overflow == 0 && m->extent_cnt < INLINE_EXTENTS)
+    {
+      m->extents[m->extent_cnt++] = e;
+      return true;
+    }
+
+  if (m->overflow == 0 && (m->overflow = new_tree_sector (start)) == 0)
+    return false;
+  root_cnt = read_cnt (m->overflow);
+  if (root_cnt > 0)
+    {
+      uint32_t first;
+
+      read_root_entry (m->overflow, root_cnt - 1, &first, &leaf);
+      leaf_cnt = read_cnt (leaf);
+    }
+  if (leaf_cnt == LEAF_CNT)
+    {
+      /* Start a new leaf. */
+      if (root_cnt == ROOT_CNT || (leaf = new_tree_sector (start)) == 0)
+        return false;
+      cache_write_meta_at (m->overflow, &m->sectors,
+                           offsetof (struct extent_root,
+                                     leaves[root_cnt].first),
+                           sizeof m->sectors);
+      cache_write_meta_at (m->overflow, &leaf,
+                           offsetof (struct extent_root,
+                                     leaves[root_cnt].leaf),
+                           sizeof leaf);
+      write_cnt (m->overflow, root_cnt + 1);
+      leaf_cnt = 0;
+    }
+  cache_write_meta_at (leaf, &e,
+                       offsetof (struct extent_leaf, extents[leaf_cnt]),
+                       sizeof e);
+  write_cnt (leaf, leaf_cnt + 1);
+  return true;
+}
+
+/* Adds CNT sectors, zeroed if ZERO is true, to the end of the
+   file that M maps, extending its last extent where the sectors
+   after it are free and otherwise taking the longest free runs it
+   can, searching from the end of the last extent or, for the
+   first, from GOAL.  Returns false if the disk fills up first,
+   keeping the sectors added so far. */
+static bool
+extent_grow (struct extent_map *m, size_t cnt, block_sector_t goal,
+             bool zero)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  while (cnt > 0)
+    {
+      struct extent last;
+      block_sector_t sector, start;
+      size_t ofs, k;
+
+      bool have_last = last_extent (m, &last, &sector, &ofs);
+
+      if (have_last)
+        goal = last.start + last.length;
+      if (have_last && free_map_allocate_at (goal, cnt))
+        {
+          start = goal;
+          k = cnt;
+          last.length += k;
+          if (sector != 0)
+            cache_write_meta_at (sector, &last, ofs, sizeof last);
+          else
+            m->extents[ofs] = last;
+        }
+      else
+        {
+          for (k = cnt; k > 0; k /= 2)
+            if (free_map_allocate_near (goal, k, &start))
+              break;
+          if (k == 0)
+            return false;
+          if (!add_extent (m, start, k))
+            {
+              free_map_release (start, k);
+              return false;
+            }
+        }
+
+      m->sectors += k;
+      cnt -= k;
+      for (; zero && k > 0; k--)
+        cache_write (start++, zeros);
+    }
+  return true;
+}
+
+/* Returns the sector holding data sector IDX in extent map M, or
+   0 if M does not reach that far.  If ALLOCATE is true, first
+   grows M to reach IDX, if it can, allocating near GOAL as
+   extent_grow() does, and sets *CHANGED to true if M changed. */
+static block_sector_t
+extent_to_sector (struct extent_map *m, size_t idx, block_sector_t goal,
+                  bool allocate, bool *changed)
+{
+  uint32_t first = 0;
+  size_t i;
+
+  if (idx >= m->sectors)
+    {
+      if (!allocate)
+        return 0;
+      *changed = true;
+      if (!extent_grow (m, idx + 1 - m->sectors, goal, true))
+        return 0;
+    }
+
+  for (i = 0; i < m->extent_cnt; i++)
+    {
+      const struct extent *e = &m->extents[i];
+
+      if (idx - first < e->length)
+        return e->start + (idx - first);
+      first += e->length;
+    }
+  return overflow_to_sector (m->overflow, idx);
+}
+
+/* Returns the sector holding data sector IDX of the file that
+   DISK describes, or 0 if there is none.  If ALLOCATE is true,
+   allocates the sector if needed, following the rest of the file
+   or else near GOAL, usually the inode's own sector, and sets
+   *CHANGED to true if DISK itself changed; then 0 means the disk
+   is full or IDX is beyond the largest possible file. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk, size_t idx, block_sector_t goal,
+                 bool allocate, bool *changed)
+{
+  if (disk->magic == INLINE_MAGIC)
+    {
+      /* The caller must move the data out first. */
+      ASSERT (!allocate);
+      return 0;
+    }
+  else if (disk->magic == EXTENT_MAGIC)
+    return extent_to_sector (&disk->map.extents, idx, goal, allocate,
+                             changed);
+  else
+    return indexed_to_sector (&disk->map.indexed, idx, goal, allocate, true,
+                              changed);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns 0 if INODE has no sector there: POS is in a hole or
+   past the end of file. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return index_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE, 0, false,
+                            NULL);
+  else
+    return 0;
+}
+
+/* Releases SECTOR, if it is not 0, and, if LEVEL > 0, the sectors
+   it points to as an index sector LEVEL levels above the data. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t slot;
+
+          cache_read_at (sector, &slot, i * sizeof slot, sizeof slot);
+          release_tree (slot, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Releases every sector of the extents in LEAF, then LEAF. */
+static void
+release_leaf (block_sector_t leaf)
+{
+  uint32_t cnt = read_cnt (leaf);
+  uint32_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct extent e;
+
+      cache_read_at (leaf, &e, offsetof (struct extent_leaf, extents[i]),
+                     sizeof e);
+      free_map_release (e.start, e.length);
+    }
+  free_map_release (leaf, 1);
+}
+
+/* Releases every data and index sector of the file that DISK
+   describes. */
+static void
+release_sectors (const struct inode_disk *disk)
+{
+  size_t i;
+
+  if (disk->magic == INLINE_MAGIC)
+    return;
+  else if (disk->magic == EXTENT_MAGIC)
+    {
+      const struct extent_map *m = &disk->map.extents;
+
+      for (i = 0; i < m->extent_cnt; i++)
+        free_map_release (m->extents[i].start, m->extents[i].length);
+      if (m->overflow != 0)
+        {
+          uint32_t cnt = read_cnt (m->overflow);
+
+          for (i = 0; i < cnt; i++)
+            {
+              uint32_t first;
+              block_sector_t leaf;
+
+              read_root_entry (m->overflow, i, &first, &leaf);
+              release_leaf (leaf);
+            }
+          free_map_release (m->overflow, 1);
+        }
+    }
   else
-    return -1;
+    {
+      const struct indexed_map *m = &disk->map.indexed;
+
+      for (i = 0; i < DIRECT_CNT; i++)
+        release_tree (m->direct[i], 0);
+      release_tree (m->indirect, 1);
+      release_tree (m->doubly_indirect, 2);
+    }
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, so that opening a single inode twice returns the
+   same `struct inode'.  They are split by sector among
+   OPEN_SHARDS shards, each a hash table with its own lock, so
+   finding an inode takes O(1) time and opens of inodes in
+   different shards do not contend.
+
+   A shard's lock protects its table and the open_cnt and removed
+   members of each inode in it.  Each inode's data is protected by
+   its own rw lock instead, so I/O to different files does not
+   serialize.
+
+   Finding or reopening an already open inode only needs its
+   shard's lock for reading, so those run side by side; readers
+   bump open_cnt with open_cnt_inc().  Adding, dropping or removing
+   an inode takes it for writing. */
+#define OPEN_SHARDS 16
+struct open_shard
+  {
+    struct hash inodes;                 /* Open inodes, by sector. */
+    struct rw_lock lock;                /* Protects the shard. */
+  };
+static struct open_shard open_shards[OPEN_SHARDS];
+
+/* Returns the shard for the inode in SECTOR. */
+static struct open_shard *
+shard_of (block_sector_t sector)
+{
+  return &open_shards[sector % OPEN_SHARDS];
+}
+
+/* Returns the hash value of the open inode for SECTOR. */
+static inline unsigned
+open_sector_hash (block_sector_t sector)
+{
+  return hash_u32 (sector / OPEN_SHARDS);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return open_sector_hash (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* open_lookup (INODES, SECTOR): hash_find() on a shard's inodes,
+   with the hash and less functions inlined. */
+HASH_FIND_BY_KEY (open_lookup, struct inode, elem, block_sector_t, sector,
+                  open_sector_hash)
+
+/* Adds an opener to INODE, with its shard's lock held at least for
+   reading.  Other readers may be doing the same. */
+static void
+open_cnt_inc (struct inode *inode)
+{
+  enum intr_level old_level = intr_disable ();
+  inode->open_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Returns the open inode for SECTOR with an opener added, or a
+   null pointer if it is not open.  The lock of SECTOR's shard must
+   be held. */
+static struct inode *
+find_open (block_sector_t sector)
+{
+  struct inode *inode = open_lookup (&shard_of (sector)->inodes, sector);
+
+  if (inode == NULL)
+    return NULL;
+  open_cnt_inc (inode);
+  return inode;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < OPEN_SHARDS; i++)
+    {
+      if (!hash_init (&open_shards[i].inodes, open_inode_hash,
+                      open_inode_less, NULL))
+        PANIC ("open inode table creation failed");
+      rw_lock_init (&open_shards[i].lock);
+    }
+}
+
+/* Selects the layout of inodes created from now on: "indexed"
+   (the default) for blocks found through direct and indirect
+   pointers, which allows holes, or "extent" for runs of sectors,
+   which keeps mapping cheap for large sequential files.  Returns
+   false if NAME is not a layout.  Existing inodes keep their
+   layout. */
+bool
+inode_set_layout (const char *name)
+{
+  if (!strcmp (name, "indexed"))
+    new_inode_magic = INODE_MAGIC;
+  else if (!strcmp (name, "extent"))
+    new_inode_magic = EXTENT_MAGIC;
+  else
+    return false;
+  return true;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -81,27 +779,34 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  journal_begin ();
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      bool inline_data = length <= (off_t) INLINE_MAX;
+      size_t sectors = 0;
+      bool changed = false;
+
+      /* An indexed inode starts out as one big hole, allocated
+         only as it is written; inode_reserve() allocates it up
+         front instead.  Extent inodes cannot have holes, so they
+         get all of the initial length at once, in one run. */
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->magic = inline_data ? INLINE_MAGIC : new_inode_magic;
+      if (disk_inode->magic == EXTENT_MAGIC)
+        sectors = bytes_to_sectors (length);
+      if (sectors == 0
+          || index_to_sector (disk_inode, sectors - 1, sector, true,
+                              &changed) != 0)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_write_meta (sector, disk_inode);
           success = true; 
-        } 
+        }
+      else
+        release_sectors (disk_inode);
       free (disk_inode);
     }
+  journal_end ();
   return success;
 }
 
@@ -111,33 +816,52 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct open_shard *shard = shard_of (sector);
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  rw_lock_acquire_read (&shard->lock);
+  inode = find_open (sector);
+  rw_lock_release_read (&shard->lock);
+  if (inode != NULL)
+    return inode;
+
+  /* Check again now that we may add it: another opener may have
+     beaten us to it. */
+  rw_lock_acquire_write (&shard->lock);
+  inode = find_open (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      rw_lock_release_write (&shard->lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      rw_lock_release_write (&shard->lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read with the shard locked, so that a
+     second opener cannot see it before its data is there. */
   inode->sector = sector;
+  hash_insert (&shard->inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->generation = 0;
+  inode->ra_next = inode->ra_end = 0;
+  inode->ra_window = 0;
+  inode->access = INODE_ACCESS_NORMAL;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  rw_lock_init (&inode->rw);
+  lock_init (&inode->range_lock);
+  cond_init (&inode->range_freed);
+  list_init (&inode->ranges);
+  cache_read (inode->sector, &inode->data);
+  rw_lock_release_write (&shard->lock);
   return inode;
 }
 
@@ -146,7 +870,13 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      struct open_shard *shard = shard_of (inode->sector);
+
+      rw_lock_acquire_read (&shard->lock);
+      open_cnt_inc (inode);
+      rw_lock_release_read (&shard->lock);
+    }
   return inode;
 }
 
@@ -163,26 +893,36 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  struct open_shard *shard;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
+  shard = shard_of (inode->sector);
+  rw_lock_acquire_write (&shard->lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from its shard and release lock.  Nobody else can
+         find INODE now, so the rest needs no lock; the free map has
+         its own. */
+      hash_delete (&shard->inodes, &inode->elem);
+      rw_lock_release_write (&shard->lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (&inode->data);
+          journal_end ();
         }
 
       free (inode); 
     }
+  else
+    rw_lock_release_write (&shard->lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -190,19 +930,191 @@ inode_close (struct inode *inode)
 void
 inode_remove (struct inode *inode) 
 {
+  struct open_shard *shard;
+
   ASSERT (inode != NULL);
+  shard = shard_of (inode->sector);
+  rw_lock_acquire_write (&shard->lock);
   inode->removed = true;
+  rw_lock_release_write (&shard->lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Read-ahead window bounds, in sectors.  The window starts at
+   READAHEAD_MIN on the first sequential read and doubles with each
+   one after, up to inode_readahead_max, READAHEAD_MAX unless tuned.
+   For a file advised to be read sequentially it starts there and
+   goes on to READAHEAD_SEQ_MAX, half the buffer cache. */
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 16
+#define READAHEAD_SEQ_MAX 32
+
+int inode_readahead_max = READAHEAD_MAX;
+
+/* Drops the clean cached sectors of INODE's bytes [START, END),
+   rounded out to whole sectors. */
+static void
+drop_cached (struct inode *inode, off_t start, off_t end)
+{
+  off_t pos;
+
+  if (inode->data.magic == INLINE_MAGIC)
+    return;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (pos = ROUND_DOWN (start, BLOCK_SECTOR_SIZE); pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_drop (sector);
+    }
+}
+
+/* Notes a read of INODE's bytes [START, END) and, if it carries on
+   where the last read stopped, queues read-ahead of the sectors
+   that follow.  Concurrent readers may race on the read-ahead
+   state, but it only steers hints. */
+static void
+readahead (struct inode *inode, off_t start, off_t end)
+{
+  bool seq = inode->access == INODE_ACCESS_SEQUENTIAL;
+  size_t tuned = inode_readahead_max;
+  size_t max = seq ? READAHEAD_SEQ_MAX : tuned;
+  off_t pos, limit;
+
+  if (inode->access == INODE_ACCESS_RANDOM)
+    return;
+  if (start != inode->ra_next)
+    {
+      /* Not sequential: stop until reads line up again. */
+      inode->ra_window = 0;
+      inode->ra_next = inode->ra_end = end;
+      return;
+    }
+  inode->ra_next = end;
+  if (inode->ra_window == 0)
+    inode->ra_window = seq ? tuned : READAHEAD_MIN;
+  else
+    inode->ra_window *= 2;
+  if (inode->ra_window > max)
+    inode->ra_window = max;
+
+  /* A stream read once has no use for what it read, up to the
+     sector it is in the middle of: let it go before anything
+     hotter. */
+  if (seq)
+    drop_cached (inode, start, ROUND_DOWN (end, BLOCK_SECTOR_SIZE));
+
+  /* The sector holding END, if any of it was read, is cached now. */
+  pos = ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (pos < inode->ra_end)
+    pos = inode->ra_end;
+  limit = end + (off_t) inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (limit > inode_length (inode))
+    limit = inode_length (inode);
+  for (; pos < limit; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+  if (pos > inode->ra_end)
+    inode->ra_end = pos;
+}
+
+/* Advises how INODE's data will be read, as ACCESS. */
+void
+inode_set_access (struct inode *inode, enum inode_access access)
+{
+  inode->access = access;
+  inode->ra_window = 0;
+}
+
+/* Queues read-ahead of INODE's bytes [OFFSET, OFFSET + SIZE) into
+   the buffer cache, for reads expected soon.  Returns at once;
+   sectors beyond what the read-ahead ring holds are skipped. */
+void
+inode_prefetch (struct inode *inode, off_t offset, off_t size)
+{
+  off_t pos, end;
+
+  rw_lock_acquire_read (&inode->rw);
+  end = inode_length (inode);
+  if (size < end - offset)
+    end = offset + size;
+  if (inode->data.magic != INLINE_MAGIC)
+    for (pos = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); pos < end;
+         pos += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = byte_to_sector (inode, pos);
+        if (sector != 0)
+          cache_readahead (sector);
+      }
+  rw_lock_release_read (&inode->rw);
+}
+
+/* Drops INODE's clean sectors in [OFFSET, OFFSET + SIZE) from the
+   buffer cache, for data that will not be read again soon.  Dirty
+   sectors stay until written back. */
+void
+inode_drop_cache (struct inode *inode, off_t offset, off_t size)
+{
+  rw_lock_acquire_read (&inode->rw);
+  drop_cached (inode, offset,
+               size < inode_length (inode) - offset
+               ? offset + size : inode_length (inode));
+  rw_lock_release_read (&inode->rw);
+}
+
+/* Aligned reads of at least DIRECT_IO_MIN contiguous sectors skip
+   the buffer cache and go from the disk straight into the caller's
+   buffer, up to DIRECT_IO_MAX sectors per request.  Smaller reads,
+   such as page-at-a-time executable loads, stay cached. */
+#define DIRECT_IO_MIN 16
+#define DIRECT_IO_MAX 128
+
+/* Returns the number of sectors, starting with SECTOR at OFFSET,
+   of a read of SIZE bytes from INODE that can be read directly,
+   or 0 if the read should go through the cache. */
+static size_t
+direct_run (struct inode *inode, block_sector_t sector, off_t offset,
+            off_t size)
+{
+  off_t inode_left = inode_length (inode) - offset;
+  size_t cnt;
+
+  if (inode->data.magic == INLINE_MAGIC || sector == 0
+      || offset % BLOCK_SECTOR_SIZE != 0)
+    return 0;
+  if (size > inode_left)
+    size = inode_left;
+  if (size < DIRECT_IO_MIN * BLOCK_SECTOR_SIZE)
+    return 0;
+
+  for (cnt = 0; cnt < DIRECT_IO_MAX; cnt++)
+    {
+      off_t pos = offset + (off_t) cnt * BLOCK_SECTOR_SIZE;
+
+      if (pos + BLOCK_SECTOR_SIZE > offset + size
+          || (cnt > 0 && byte_to_sector (inode, pos) != sector + cnt))
+        break;
+#ifdef VM
+      /* Leave pages in the page cache to the normal path, which
+         reads them from there.  A zero-byte read only asks whether
+         the page is cached. */
+      if (frame_cache_rw (inode, pos, NULL, 0, false))
+        break;
+#endif
+    }
+  return cnt >= DIRECT_IO_MIN ? cnt : 0;
+}
+
+/* Reads like inode_read_at(), with INODE already locked for
+   reading. */
+static off_t
+read_locked (struct inode *inode, uint8_t *buffer, off_t size, off_t offset)
 {
-  uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
@@ -217,113 +1129,567 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       /* Number of bytes to actually copy out of this sector. */
       int chunk_size = size < min_left ? size : min_left;
+      size_t direct_cnt;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      direct_cnt = direct_run (inode, sector_idx, offset, size);
+      if (direct_cnt > 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          off_t direct_size = (off_t) direct_cnt * BLOCK_SECTOR_SIZE;
+
+          cache_read_direct (sector_idx, direct_cnt, buffer + bytes_read);
+          size -= direct_size;
+          offset += direct_size;
+          bytes_read += direct_size;
+          continue;
         }
+
+#ifdef VM
+      /* A page in the page cache may be newer than the disk, if it
+         is mapped writable, and is faster to read anyway. */
+      if (frame_cache_rw (inode, offset, buffer + bytes_read, chunk_size,
+                          false))
+        ;
+      else
+#endif
+      if (inode->data.magic == INLINE_MAGIC)
+        memcpy (buffer + bytes_read, inode->data.map.data + offset,
+                chunk_size);
+      else if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  if (bytes_read > 0)
+    readahead (inode, offset - bytes_read, offset);
+  return bytes_read;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  off_t bytes_read;
+
+  rw_lock_acquire_read (&inode->rw);
+  bytes_read = read_locked (inode, buffer, size, offset);
+  rw_lock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Reads into the IOVCNT buffers of IOV in turn from INODE, starting
+   at OFFSET, as one operation under a single lock.  Returns the
+   number of bytes read, which stops short where a read does. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_readv_at (struct inode *inode, const struct iovec *iov, int iovcnt,
+                off_t offset)
+{
+  off_t bytes_read = 0;
+  int i;
+
+  rw_lock_acquire_read (&inode->rw);
+  for (i = 0; i < iovcnt; i++)
+    {
+      off_t n = read_locked (inode, iov[i].iov_base, iov[i].iov_len,
+                             offset + bytes_read);
+      bytes_read += n;
+      if (n < (off_t) iov[i].iov_len)
+        break;
+    }
+  rw_lock_release_read (&inode->rw);
+
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET into INODE, which keeps
+   its data inline and has room for them there, with INODE locked
+   for writing. */
+static off_t
+write_inline (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset)
+{
+  struct inode_disk *disk = &inode->data;
+
+  memcpy (disk->map.data + offset, buffer, size);
+#ifdef VM
+  frame_cache_rw (inode, offset, (void *) buffer, size, true);
+#endif
+  if (offset + size > disk->length)
+    disk->length = offset + size;
+  cache_write_meta (inode->sector, disk);
+  if (size > 0)
+    inode->generation++;
+  return size;
+}
+
+/* Moves the data of INODE, which keeps it inline, to a data sector
+   and switches INODE to the layout that new inodes get.  Returns
+   true if successful, false if memory or disk allocation fails. */
+static bool
+uninline (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  uint8_t *data;
+  block_sector_t sector = 0;
+  bool changed = false;
+
+  data = calloc (1, BLOCK_SECTOR_SIZE);
+  if (data == NULL)
+    return false;
+  memcpy (data, disk->map.data, INLINE_MAX);
+
+  memset (&disk->map, 0, sizeof disk->map);
+  disk->magic = new_inode_magic;
+  if (disk->length > 0)
+    {
+      sector = index_to_sector (disk, 0, inode->sector, true, &changed);
+      if (sector == 0)
+        {
+          /* Leave it inline. */
+          memcpy (disk->map.data, data, INLINE_MAX);
+          disk->magic = INLINE_MAGIC;
+          free (data);
+          return false;
+        }
+      cache_write (sector, data);
+    }
+  cache_write_meta (inode->sector, disk);
+  free (data);
+  return true;
+}
+
+/* Zeros the sectors of INODE, locked for writing, that lie wholly
+   between its end of file and END, which is past it.  Sectors past
+   the end of file may have been reserved by inode_reserve() and
+   never written, and a write past the end would otherwise leave
+   them in the file with their old contents.  Holes need nothing. */
+static void
+zero_gap (struct inode *inode, off_t end)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  struct inode_disk *disk = &inode->data;
+  size_t idx = bytes_to_sectors (disk->length);
+  size_t limit = end / BLOCK_SECTOR_SIZE;
+
+  if (disk->magic == EXTENT_MAGIC && limit > disk->map.extents.sectors)
+    limit = disk->map.extents.sectors;
+  for (; idx < limit; idx++)
+    {
+      block_sector_t sector;
+
+      if (disk->magic == INODE_MAGIC)
+        {
+          idx = indexed_skip_holes (&disk->map.indexed, idx);
+          if (idx >= limit)
+            break;
+        }
+      sector = index_to_sector (disk, idx, 0, false, NULL);
+      if (sector != 0)
+        cache_write (sector, zeros);
+    }
+}
+
+/* Writes like inode_write_at(), with INODE already locked for
+   writing and writes to it allowed. */
+static off_t
+write_locked (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool changed = false;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  if (inode->data.magic == INLINE_MAGIC)
+    {
+      if (offset + size <= (off_t) INLINE_MAX)
+        return write_inline (inode, buffer, size, offset);
+      if (!uninline (inode))
+        return 0;
+    }
+
+  if (offset > inode->data.length)
+    zero_gap (inode, offset);
+
+  /* Grow an extent file to cover all of the write at once, so that
+     the write lands in as few runs as possible. */
+  if (size > 0 && inode->data.magic == EXTENT_MAGIC)
+    index_to_sector (&inode->data, (offset + size - 1) / BLOCK_SECTOR_SIZE,
+                     inode->sector, true, &changed);
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Sector to write, allocated if it is a hole or past the end
+         of file, and starting byte offset within sector. */
+      block_sector_t sector_idx
+        = index_to_sector (&inode->data, offset / BLOCK_SECTOR_SIZE,
+                           inode->sector, true, &changed);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* A sector wholly past the old end of file holds nothing to
+         keep, so a partial write need not read it first. */
+      if (inode->metadata)
+        cache_write_meta_at (sector_idx, buffer + bytes_written, sector_ofs,
+                             chunk_size);
+      else if (offset - sector_ofs >= inode->data.length)
+        cache_write_new (sector_idx, buffer + bytes_written, sector_ofs,
+                         chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
+#ifdef VM
+      /* Keep any cached copy of the page, and so every process that
+         maps it, in step with the disk. */
+      frame_cache_rw (inode, offset, (void *) (buffer + bytes_written),
+                      chunk_size, true);
+#endif
+
+      /* Advance. */
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      changed = true;
+    }
+  if (changed)
+    cache_write_meta (inode->sector, &inode->data);
+  if (bytes_written > 0)
+    inode->generation++;
+  return bytes_written;
+}
+
+/* A byte range of an inode being written in place. */
+struct byte_range
+  {
+    struct list_elem elem;              /* Element in inode's RANGES. */
+    off_t start, end;                   /* Bytes [START, END). */
+  };
+
+/* Waits until no other write in place to INODE overlaps bytes
+   [START, END), then claims them with R. */
+static void
+range_acquire (struct inode *inode, struct byte_range *r, off_t start,
+               off_t end)
+{
+  struct list_elem *e;
+
+  r->start = start;
+  r->end = end;
+  lock_acquire (&inode->range_lock);
+ retry:
+  for (e = list_begin (&inode->ranges); e != list_end (&inode->ranges);
+       e = list_next (e))
+    {
+      struct byte_range *o = list_entry (e, struct byte_range, elem);
+      if (o->start < end && start < o->end)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          cond_wait (&inode->range_freed, &inode->range_lock);
+          goto retry;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+    }
+  list_push_back (&inode->ranges, &r->elem);
+  lock_release (&inode->range_lock);
+}
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+/* Releases the bytes claimed by R, noting that WRITTEN bytes of
+   INODE's data changed. */
+static void
+range_release (struct inode *inode, struct byte_range *r, off_t written)
+{
+  lock_acquire (&inode->range_lock);
+  list_remove (&r->elem);
+  if (written > 0)
+    inode->generation++;
+  cond_broadcast (&inode->range_freed, &inode->range_lock);
+  lock_release (&inode->range_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE at OFFSET, which must
+   all lie within the file, without changing its layout: stops at
+   the first hole, since filling it would.  Returns the number of
+   bytes written.  A read lock on INODE's rw lock and a range
+   covering the bytes must be held. */
+static off_t
+write_in_place (struct inode *inode, const uint8_t *buffer, off_t size,
+                off_t offset)
+{
+  off_t bytes_written = 0;
+
+  while (size > 0)
+    {
+      block_sector_t sector_idx
+        = index_to_sector (&inode->data, offset / BLOCK_SECTOR_SIZE, 0,
+                           false, NULL);
+      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
+        break;
+
+      if (inode->metadata)
+        cache_write_meta_at (sector_idx, buffer + bytes_written, sector_ofs,
+                             chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
+#ifdef VM
+      frame_cache_rw (inode, offset, (void *) (buffer + bytes_written),
+                      chunk_size, true);
+#endif
 
-      /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  return bytes_written;
+}
+
+/* Writes the IOVCNT buffers of IOV in turn into INODE, starting at
+   OFFSET, as one operation.  A write that lies within the file and
+   needs no allocation runs under a read lock, and so alongside
+   reads and other such writes that do not overlap it.  Anything
+   else -- growing the file, filling a hole, an inline file -- takes
+   the write lock, which keeps its changes to the layout and length
+   from the readers walking them.  Returns the number of bytes
+   written, which stops short where a write does. */
+static off_t
+write_iov (struct inode *inode, const struct iovec *iov, int iovcnt,
+           off_t offset)
+{
+  off_t bytes_written = 0;
+  off_t total = 0;
+  size_t done = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    total += iov[i].iov_len;
+
+  /* Write what we can in place.  DONE counts the bytes of IOV[I]
+     already written. */
+  i = 0;
+  rw_lock_acquire_read (&inode->rw);
+  if (inode->deny_write_cnt)
+    iovcnt = 0;
+  else if (inode->data.magic != INLINE_MAGIC
+           && offset + total <= inode->data.length)
+    {
+      struct byte_range r;
+
+      range_acquire (inode, &r, offset, offset + total);
+      for (; i < iovcnt; i++)
+        {
+          done = write_in_place (inode, iov[i].iov_base, iov[i].iov_len,
+                                 offset + bytes_written);
+          bytes_written += done;
+          if (done < iov[i].iov_len)
+            break;
+        }
+      range_release (inode, &r, bytes_written);
+    }
+  rw_lock_release_read (&inode->rw);
+  if (i == iovcnt)
+    return bytes_written;
+
+  /* Do the rest under the write lock. */
+  rw_lock_acquire_write (&inode->rw);
+  for (; i < iovcnt && !inode->deny_write_cnt; i++)
+    {
+      size_t len = iov[i].iov_len - done;
+      off_t n = write_locked (inode, (const uint8_t *) iov[i].iov_base + done,
+                              len, offset + bytes_written);
+      bytes_written += n;
+      done = 0;
+      if (n < (off_t) len)
+        break;
+    }
+  rw_lock_release_write (&inode->rw);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Writing past end of file extends the file, leaving any gap
+   before OFFSET as a hole.  Returns the number of bytes actually
+   written, which may be less than SIZE if the disk fills up or an
+   error occurs. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  struct iovec iov;
+  off_t bytes_written;
+
+  iov.iov_base = (void *) buffer;
+  iov.iov_len = size;
+  journal_begin ();
+  bytes_written = write_iov (inode, &iov, 1, offset);
+  journal_end ();
 
   return bytes_written;
 }
 
+/* Writes the IOVCNT buffers of IOV in turn into INODE, starting at
+   OFFSET, as one operation.  Returns the number of bytes written,
+   which stops short where a write does. */
+off_t
+inode_writev_at (struct inode *inode, const struct iovec *iov, int iovcnt,
+                 off_t offset)
+{
+  off_t bytes_written;
+
+  journal_begin ();
+  bytes_written = write_iov (inode, iov, iovcnt, offset);
+  journal_end ();
+
+  return bytes_written;
+}
+
+/* Allocates every sector of the first LENGTH bytes of INODE that
+   is not allocated yet, without changing the file's length, so
+   that later writes there need no allocation and land in long
+   runs.  Sectors within the file are zeroed.  Sectors past its
+   end are only allocated, not written: they read as zeros once
+   the file grows over them, since writes zero what they do not
+   cover.  Returns false if the disk fills up or LENGTH is beyond
+   the largest possible file, keeping the sectors allocated so
+   far. */
+bool
+inode_reserve (struct inode *inode, off_t length)
+{
+  struct inode_disk *disk = &inode->data;
+  size_t sectors = bytes_to_sectors (length);
+  bool changed = false;
+  bool ok = true;
+
+  journal_begin ();
+  rw_lock_acquire_write (&inode->rw);
+  if (disk->magic == INLINE_MAGIC && length > (off_t) INLINE_MAX)
+    ok = uninline (inode);
+  if (!ok || disk->magic == INLINE_MAGIC)
+    ;
+  else if (disk->magic == EXTENT_MAGIC)
+    {
+      struct extent_map *m = &disk->map.extents;
+
+      /* Extent files have no holes, so only grow past the end. */
+      if (sectors > m->sectors)
+        {
+          changed = true;
+          ok = extent_grow (m, sectors - m->sectors, inode->sector, false);
+        }
+    }
+  else
+    {
+      size_t eof = bytes_to_sectors (disk->length);
+      size_t idx;
+
+      for (idx = 0; ok && idx < sectors; idx++)
+        ok = indexed_to_sector (&disk->map.indexed, idx, inode->sector, true,
+                                idx < eof, &changed) != 0;
+    }
+  if (changed)
+    cache_write_meta (inode->sector, disk);
+  rw_lock_release_write (&inode->rw);
+  journal_end ();
+
+  return ok;
+}
+
+/* A run of consecutive sectors collected for inode_sync(). */
+struct sync_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors, or 0. */
+  };
+
+/* Writes out the sectors collected in R and empties it. */
+static void
+sync_run_flush (struct sync_run *r)
+{
+  cache_flush_range (r->start, r->cnt);
+  r->cnt = 0;
+}
+
+/* Adds SECTOR, unless it is 0, to R, first writing R out if SECTOR
+   does not extend it. */
+static void
+sync_run_add (struct sync_run *r, block_sector_t sector)
+{
+  if (sector == 0)
+    return;
+  if (r->cnt > 0 && sector != r->start + r->cnt)
+    sync_run_flush (r);
+  if (r->cnt++ == 0)
+    r->start = sector;
+}
+
+/* Writes INODE's dirty sectors in the buffer cache to disk and
+   returns once they are there.  The data goes first, in runs of
+   adjacent sectors, then a journal commit takes the metadata that
+   leads to it, so that after a crash partway through the inode
+   never points to sectors that did not make it.  Must not be
+   called inside a journal transaction. */
+void
+inode_sync (struct inode *inode)
+{
+  struct inode_disk *disk = &inode->data;
+  struct sync_run r = { 0, 0 };
+  size_t idx, sectors;
+
+  rw_lock_acquire_read (&inode->rw);
+  sectors = bytes_to_sectors (disk->length);
+  for (idx = 0; disk->magic != INLINE_MAGIC && idx < sectors; idx++)
+    {
+      if (disk->magic == INODE_MAGIC)
+        {
+          idx = indexed_skip_holes (&disk->map.indexed, idx);
+          if (idx >= sectors)
+            break;
+        }
+      sync_run_add (&r, index_to_sector (disk, idx, 0, false, NULL));
+    }
+  sync_run_flush (&r);
+  rw_lock_release_read (&inode->rw);
+
+  /* Outside the lock: the commit waits for transactions in
+     progress, which may be waiting for it. */
+  journal_commit ();
+}
+
+/* Marks INODE's data as metadata, such as a directory's, so that
+   writes to it are journaled along with the inode itself. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  inode->metadata = true;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  /* Waits for writes in progress to finish. */
+  rw_lock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1698,37 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rw_lock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release_write (&inode->rw);
+}
+
+/* Returns INODE's generation, which changes whenever its data does,
+   so that anything derived from the data can tell it is stale. */
+unsigned
+inode_generation (struct inode *inode)
+{
+  unsigned generation;
+
+  rw_lock_acquire_read (&inode->rw);
+  generation = inode->generation;
+  rw_lock_release_read (&inode->rw);
+  return generation;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (struct inode *inode)
+{
+  struct open_shard *shard = shard_of (inode->sector);
+  bool removed;
+
+  rw_lock_acquire_read (&shard->lock);
+  removed = inode->removed;
+  rw_lock_release_read (&shard->lock);
+  return removed;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -1,13 +1,28 @@
 #ifndef FILESYS_INODE_H
 #define FILESYS_INODE_H
 
+#include <iovec.h>
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
 
+/* How an inode's data is expected to be read, as advised by
+   fadvise(). */
+enum inode_access
+  {
+    INODE_ACCESS_NORMAL,        /* Read-ahead as reads line up. */
+    INODE_ACCESS_RANDOM,        /* No read-ahead. */
+    INODE_ACCESS_SEQUENTIAL     /* Big read-ahead, drop behind. */
+  };
+
+/* Most sectors read-ahead runs ahead of a sequential reader;
+   tunable "fs.readahead_max". */
+extern int inode_readahead_max;
+
 void inode_init (void);
+bool inode_set_layout (const char *);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -16,8 +31,20 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_readv_at (struct inode *, const struct iovec *, int iovcnt,
+                      off_t offset);
+off_t inode_writev_at (struct inode *, const struct iovec *, int iovcnt,
+                       off_t offset);
+bool inode_reserve (struct inode *, off_t length);
+void inode_sync (struct inode *);
+void inode_set_metadata (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+unsigned inode_generation (struct inode *);
+bool inode_is_removed (struct inode *);
+void inode_set_access (struct inode *, enum inode_access);
+void inode_prefetch (struct inode *, off_t offset, off_t size);
+void inode_drop_cache (struct inode *, off_t offset, off_t size);
 
 #endif /* filesys/inode.h */
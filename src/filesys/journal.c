@@ -0,0 +1,294 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* The journal is two halves of HALF_SECTORS sectors, each a header
+   sector followed by copies of up to LOG_BLOCKS logged sectors.
+   Commits alternate between the halves, so that writing one never
+   disturbs the one before, and the valid header with the highest
+   sequence number belongs to the last commit.  Each commit also
+   logs those sectors of the commit before it that have not reached
+   their homes yet, so the last commit alone says everything that
+   needs replaying. */
+#define HALF_SECTORS (JOURNAL_SECTORS / 2)
+#define LOG_BLOCKS (HALF_SECTORS - 1)
+#define JOURNAL_MAGIC 0x4a524e4c        /* "JRNL". */
+
+/* Header sector of a journal half.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Commit sequence number. */
+    uint32_t cnt;                       /* Sectors logged, 0 if none. */
+    block_sector_t sectors[LOG_BLOCKS]; /* Home of each logged copy. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+                   - LOG_BLOCKS * sizeof (block_sector_t)];
+  };
+
+/* A transaction is expected to log at most TX_MAX sectors, and one
+   starts only when the group has room for that many more for each
+   transaction in progress.  A group commits when its last
+   transaction ends, once it has logged COMMIT_HIGH sectors or
+   someone is waiting for a commit.  A transaction that logs more
+   than its share still fits, up to GROUP_MAX sectors in the group;
+   that keeps sectors held back from write-back to half of the
+   buffer cache.  Past it, sectors are written in place without
+   journaling rather than stall. */
+#define TX_MAX 6
+#define GROUP_MAX 32
+#define COMMIT_HIGH 16
+
+/* Protects the state below. */
+static struct lock journal_lock;
+
+/* Signaled when a transaction ends or a commit finishes. */
+static struct condition journal_cond;
+
+static int outstanding;                 /* Transactions in progress. */
+static bool committing;                 /* Commit in progress? */
+static int commit_wanted;               /* Threads in journal_commit(). */
+static uint32_t seq;                    /* Number of the last commit. */
+
+/* Sectors logged by the transactions of the current group.  Not
+   changed while committing, since no transaction is in progress
+   then. */
+static block_sector_t group[GROUP_MAX];
+static size_t group_cnt;
+
+/* Sectors of the last commit, which may not be home yet.  Only
+   used by the committing thread. */
+static block_sector_t carry[LOG_BLOCKS];
+static size_t carry_cnt;
+
+/* Scratch space for commits, which run one at a time. */
+static struct journal_header header;
+static uint8_t buffer[LOG_BLOCKS * BLOCK_SECTOR_SIZE];
+
+static void replay (void);
+static void commit (void);
+
+/* Returns the first sector of the journal half that commit number
+   N goes in. */
+static block_sector_t
+half_start (uint32_t n)
+{
+  return JOURNAL_SECTOR + n % 2 * HALF_SECTORS;
+}
+
+/* Initializes the journal.  If FORMAT is false, first replays the
+   last commit, in case the file system was not shut down cleanly;
+   this must happen before anything else reads the disk. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  lock_register (&journal_lock, "journal");
+  cond_init (&journal_cond);
+
+  if (!format)
+    replay ();
+
+  /* Start both halves out empty. */
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = seq;
+  block_write (fs_device, half_start (0), &header);
+  block_write (fs_device, half_start (1), &header);
+}
+
+/* Copies the sectors of the last commit to their homes. */
+static void
+replay (void)
+{
+  static struct journal_header halves[2];
+  struct journal_header *last = NULL;
+  uint32_t i;
+
+  for (i = 0; i < 2; i++)
+    {
+      struct journal_header *h = &halves[i];
+
+      block_read (fs_device, half_start (i), h);
+      if (h->magic == JOURNAL_MAGIC && h->cnt <= LOG_BLOCKS
+          && (last == NULL || h->seq > last->seq))
+        last = h;
+    }
+  if (last == NULL)
+    return;
+
+  seq = last->seq;
+  block_read_multiple (fs_device, half_start (last->seq) + 1, last->cnt,
+                       buffer);
+  for (i = 0; i < last->cnt; i++)
+    block_write (fs_device, last->sectors[i],
+                 buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Begins a transaction in the running thread, or joins the one it
+   is already in: transactions nest, and only the outermost one
+   counts.  Waits for a commit in progress, or for room in the
+   group. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (;;)
+    {
+      if (committing || commit_wanted > 0)
+        cond_wait (&journal_cond, &journal_lock);
+      else if (group_cnt + (outstanding + 1) * TX_MAX <= GROUP_MAX)
+        break;
+      else if (outstanding == 0)
+        commit ();
+      else
+        cond_wait (&journal_cond, &journal_lock);
+    }
+  outstanding++;
+  lock_release (&journal_lock);
+}
+
+/* Ends the running thread's transaction, committing the group if
+   it was the last one in progress and the group is due. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--outstanding == 0 && (group_cnt >= COMMIT_HIGH || commit_wanted > 0))
+    commit ();
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Commits every transaction that has ended, waiting for those in
+   progress to end first, and returns once the commit is on disk.
+   Must not be called inside a transaction. */
+void
+journal_commit (void)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  commit_wanted++;
+  while (outstanding > 0 || committing)
+    cond_wait (&journal_cond, &journal_lock);
+  commit_wanted--;
+  commit ();
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Adds metadata SECTOR, just written in the buffer cache, to the
+   running thread's transaction.  Returns true if the cache must
+   keep SECTOR from being written back until it commits, false if
+   the thread is not in a transaction or the group is full. */
+bool
+journal_add (block_sector_t sector)
+{
+  bool added = true;
+  size_t i;
+
+  if (thread_current ()->journal_depth == 0)
+    return false;
+
+  lock_acquire (&journal_lock);
+  ASSERT (!committing);
+  for (i = 0; i < group_cnt; i++)
+    if (group[i] == sector)
+      break;
+  if (i == group_cnt)
+    {
+      if (group_cnt < GROUP_MAX)
+        group[group_cnt++] = sector;
+      else
+        added = false;
+    }
+  lock_release (&journal_lock);
+
+  return added;
+}
+
+/* Returns true if SECTOR is in the current group. */
+static bool
+in_group (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < group_cnt; i++)
+    if (group[i] == sector)
+      return true;
+  return false;
+}
+
+/* Writes the current group to the journal and releases its sectors
+   to write-back.  journal_lock must be held and no transaction may
+   be in progress.  Releases the lock while writing. */
+static void
+commit (void)
+{
+  block_sector_t start;
+  size_t cnt = 0;
+  size_t i;
+
+  ASSERT (outstanding == 0 && !committing);
+  if (group_cnt == 0)
+    return;
+  committing = true;
+  lock_release (&journal_lock);
+
+  /* Log the group, and whatever of the last commit is not home
+     yet, since this commit takes its place.  If that is too much,
+     send the rest of the last commit home now: it has committed,
+     so it may go there. */
+  for (i = 0; i < group_cnt; i++)
+    header.sectors[cnt++] = group[i];
+  for (i = 0; i < carry_cnt; i++)
+    if (!in_group (carry[i]) && cache_is_dirty (carry[i]))
+      {
+        if (cnt < LOG_BLOCKS)
+          header.sectors[cnt++] = carry[i];
+        else
+          cache_flush_range (carry[i], 1);
+      }
+
+  /* Copy the sectors to the journal, in one write, then write the
+     header, which commits them. */
+  start = half_start (seq + 1);
+  for (i = 0; i < cnt; i++)
+    cache_read (header.sectors[i], buffer + i * BLOCK_SECTOR_SIZE);
+  block_write_multiple (fs_device, start + 1, cnt, buffer);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = seq + 1;
+  header.cnt = cnt;
+  block_write (fs_device, start, &header);
+
+  /* Let write-back take the group's sectors home in its own time. */
+  for (i = 0; i < group_cnt; i++)
+    cache_unhold (group[i]);
+  memcpy (carry, header.sectors, cnt * sizeof *carry);
+  carry_cnt = cnt;
+
+  lock_acquire (&journal_lock);
+  seq++;
+  group_cnt = 0;
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Write-ahead journal of metadata sectors.
+
+   Operations that change metadata -- inodes, index sectors,
+   directories and the free map -- run as transactions between
+   journal_begin() and journal_end().  The cache keeps every
+   metadata sector that a transaction writes from reaching its home
+   on disk until the transaction commits, by copying the sector into
+   the journal and then writing a header that names it.  Transactions
+   that run close together share a commit, so one sequential log
+   write covers many of them.  Committed sectors reach their homes
+   later, through ordinary write-back.  After a crash,
+   journal_init() copies the last commit's sectors home again. */
+
+/* Sectors taken by the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 128
+
+void journal_init (bool format);
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+bool journal_add (block_sector_t);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,129 @@
+#include "filesys/warmup.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* "WARM", at the start of a valid list. */
+#define WARMUP_MAGIC 0x4d524157
+
+/* Most sectors the list holds. */
+#define WARMUP_MAX ((BLOCK_SECTOR_SIZE - 2 * sizeof (uint32_t)) \
+                    / sizeof (block_sector_t))
+
+/* On-disk list of hot sectors.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct warmup_list
+  {
+    uint32_t magic;                     /* WARMUP_MAGIC. */
+    uint32_t cnt;                       /* Sectors listed. */
+    block_sector_t sectors[WARMUP_MAX]; /* Most used first. */
+  };
+
+bool warmup_enabled = true;
+
+/* Whether WARMUP_SECTOR is ours to write.  A file system formatted
+   before the sector was set aside may have given it to a file. */
+static bool owned;
+
+static void warmup (void *list_);
+
+/* Writes an empty list to WARMUP_SECTOR of a newly formatted file
+   system. */
+void
+warmup_format (void)
+{
+  static struct warmup_list list;
+
+  ASSERT (sizeof list == BLOCK_SECTOR_SIZE);
+  list.magic = WARMUP_MAGIC;
+  list.cnt = 0;
+  cache_write (WARMUP_SECTOR, &list);
+}
+
+/* Reads the list saved at the last shutdown and starts reading its
+   sectors in the background.  Call this once the free map is
+   open. */
+void
+warmup_start (void)
+{
+  struct warmup_list *list = malloc (sizeof *list);
+  size_t i, cnt;
+
+  if (list == NULL)
+    return;
+  cache_read_direct (WARMUP_SECTOR, 1, list);
+  owned = list->magic == WARMUP_MAGIC && list->cnt <= WARMUP_MAX;
+  if (!owned)
+    {
+      /* An older file system: take the sector if it is free. */
+      journal_begin ();
+      owned = free_map_allocate_at (WARMUP_SECTOR, 1);
+      journal_end ();
+      list->cnt = 0;
+    }
+
+  /* Keep only sectors of the device, in case the list is stale. */
+  for (i = cnt = 0; i < list->cnt; i++)
+    if (list->sectors[i] < block_size (fs_device)
+        && list->sectors[i] != WARMUP_SECTOR)
+      list->sectors[cnt++] = list->sectors[i];
+  list->cnt = cnt;
+
+  if (!warmup_enabled || list->cnt == 0
+      || thread_create ("fs-warmup", PRI_MIN, warmup, list) == TID_ERROR)
+    free (list);
+}
+
+/* Saves the most used sectors in the cache to WARMUP_SECTOR, for
+   warmup_start() at the next boot.  Call this before the final
+   cache_flush(). */
+void
+warmup_save (void)
+{
+  static struct warmup_list list;
+
+  if (!owned || !warmup_enabled)
+    return;
+  list.magic = WARMUP_MAGIC;
+  list.cnt = cache_hot_sectors (list.sectors, WARMUP_MAX);
+  cache_write (WARMUP_SECTOR, &list);
+}
+
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const block_sector_t *a = a_, *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Runs on the warmup thread: reads the sectors in LIST_ into the
+   cache and frees it. */
+static void
+warmup (void *list_)
+{
+  struct warmup_list *list = list_;
+  size_t i, n;
+
+  block_set_class (BIO_ASYNC);
+  qsort (list->sectors, list->cnt, sizeof *list->sectors, compare_sectors);
+  for (i = 0; i < list->cnt; i += n)
+    {
+      n = 1;
+      while (i + n < list->cnt && n < CACHE_PREFETCH_MAX
+             && list->sectors[i + n] == list->sectors[i] + n)
+        n++;
+      cache_prefetch (list->sectors[i], n);
+
+      /* Skip duplicates of the run's last sector. */
+      while (i + n < list->cnt
+             && list->sectors[i + n] == list->sectors[i + n - 1])
+        n++;
+    }
+  free (list);
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_WARMUP_H
+#define FILESYS_WARMUP_H
+
+#include <stdbool.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+
+/* Buffer cache warmup across reboots.
+
+   At shutdown, the sectors the buffer cache used most are listed
+   in WARMUP_SECTOR, which the free map keeps for this.  At boot, a
+   low-priority thread reads them back into the cache, in ascending
+   order and in runs of consecutive sectors, so that the first
+   lookups after a reboot find the directories, inodes and data
+   that were hot before it. */
+
+/* Sector that holds the list, just after the journal. */
+#define WARMUP_SECTOR (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+/* Whether the list is saved and read back; tunable "fs.warmup". */
+extern bool warmup_enabled;
+
+void warmup_format (void);
+void warmup_start (void);
+void warmup_save (void);
+
+#endif /* filesys/warmup.h */
@@ -0,0 +1,47 @@
+#ifndef __LIB_BLKSTAT_H
+#define __LIB_BLKSTAT_H
+
+#include <stdint.h>
+
+/* Devices the blkstat system call reports on, by role, numbered
+   as in the kernel's enum block_type. */
+#define BLKSTAT_KERNEL 0        /* Pintos kernel. */
+#define BLKSTAT_FILESYS 1       /* File system. */
+#define BLKSTAT_SCRATCH 2       /* Scratch. */
+#define BLKSTAT_SWAP 3          /* Swap. */
+
+/* Number of buckets in the latency histograms.  Bucket N counts
+   requests that took 2**N to 2**(N+1)-1 ns from submission to
+   completion. */
+#define BLK_LATENCY_BUCKETS 32
+
+/* I/O classes, numbered as in the kernel's enum bio_class. */
+#define BLK_CLASS_SYNC 0        /* A thread waits for it. */
+#define BLK_CLASS_FAULT 1       /* A page fault waits for it. */
+#define BLK_CLASS_ASYNC 2       /* Readahead and write-back. */
+#define BLK_CLASS_CNT 3
+
+/* Counters for one direction of transfer. */
+struct blk_stat
+  {
+    uint64_t requests;          /* Requests completed. */
+    uint64_t sectors;           /* Sectors transferred. */
+    uint64_t ns;                /* Total time from submission to end. */
+    uint64_t max_ns;            /* Slowest single request. */
+    uint64_t latency[BLK_LATENCY_BUCKETS]; /* Latency histogram. */
+  };
+
+/* Block device statistics, as returned by the blkstat system
+   call. */
+struct blk_stats
+  {
+    struct blk_stat read;
+    struct blk_stat write;
+    uint64_t merged;            /* Requests served with an earlier one. */
+    uint32_t in_flight;         /* Requests submitted, not yet done. */
+    uint32_t max_in_flight;     /* Most in flight at once. */
+    uint64_t class_requests[BLK_CLASS_CNT]; /* Requests by I/O class. */
+    uint64_t class_ns[BLK_CLASS_CNT];       /* Their total latency. */
+  };
+
+#endif /* lib/blkstat.h */
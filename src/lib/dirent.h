@@ -0,0 +1,22 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Longest file name in a directory entry, as for readdir. */
+#define DIRENT_NAME_MAX 14
+
+/* Flags for SYS_GETDENTS. */
+#define GETDENTS_STAT 0x1       /* Fill in d_size and d_isdir too. */
+
+/* One directory entry read by the getdents system call. */
+struct dirent
+  {
+    uint32_t d_ino;                     /* Inode number. */
+    uint32_t d_size;                    /* Size in bytes (GETDENTS_STAT). */
+    bool d_isdir;                       /* Directory? (GETDENTS_STAT). */
+    char d_name[DIRENT_NAME_MAX + 1];   /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
@@ -0,0 +1,16 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/* Maximum number of buffers in one readv or writev call. */
+#define IOV_MAX 64
+
+/* One buffer of a readv or writev system call. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Bytes in the buffer. */
+  };
+
+#endif /* lib/iovec.h */
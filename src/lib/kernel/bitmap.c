@@ -23,11 +23,19 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   A bitmap given a summary by bitmap_summarize() also has a
+   smaller bitmap with one bit per element, set when every bit in
+   the element is true.  The summary has a summary of its own, and
+   so on down to a single element, so a search for a false bit
+   skips ELEM_BITS**K full bits at level K and takes O(log n)
+   steps when most bits are true. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    struct bitmap *summary; /* Full elements, or null. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -69,6 +77,94 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a mask of the bits of the element holding bit START
+   that lie in the span of CNT bits beginning there.  CNT must not
+   reach past that element. */
+static inline elem_type
+span_mask (size_t start, size_t cnt)
+{
+  elem_type ones = cnt == ELEM_BITS ? (elem_type) -1
+                                    : ((elem_type) 1 << cnt) - 1;
+  return ones << (start % ELEM_BITS);
+}
+
+/* Returns the number of bits in the span beginning at START and
+   running to END, exclusive, that lie in START's element. */
+static inline size_t
+span_cnt (size_t start, size_t end)
+{
+  size_t left = ELEM_BITS - start % ELEM_BITS;
+  return end - start < left ? end - start : left;
+}
+
+/* Returns element E with every bit inverted if VALUE is false, so
+   that bits equal to VALUE are the ones set. */
+static inline elem_type
+match (elem_type e, bool value)
+{
+  return value ? e : ~e;
+}
+
+/* Returns the number of bits set in E, which like the "orl" and
+   "andl" below assumes a 32-bit elem_type. */
+static inline size_t
+popcount (elem_type e)
+{
+  /* Add adjacent bits, then pairs, then nibbles, then bytes. */
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.  Whole
+   elements are tested at a time, and bit scan finds the bit.  A
+   search for a false bit skips full elements through B's summary,
+   if it has one. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  while (start < end)
+    {
+      size_t cnt;
+
+      if (!value && b->summary != NULL && start % ELEM_BITS == 0)
+        {
+          size_t idx = find_next (b->summary, elem_idx (start),
+                                  elem_cnt (end), false);
+          if (idx * ELEM_BITS >= end)
+            return end;
+          if (idx * ELEM_BITS > start)
+            start = idx * ELEM_BITS;
+        }
+
+      cnt = span_cnt (start, end);
+      elem_type hits = match (b->bits[elem_idx (start)], value)
+                       & span_mask (start, cnt);
+      if (hits != 0)
+        return elem_idx (start) * ELEM_BITS + __builtin_ctzl (hits);
+      start += cnt;
+    }
+  return end;
+}
+
+/* Brings the summary bit for B's element IDX up to date, after a
+   change to that element. */
+static void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type used;
+  bool full;
+
+  if (b->summary == NULL)
+    return;
+  used = idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+  full = (b->bits[idx] & used) == used;
+  if (bitmap_test (b->summary, idx) != full)
+    bitmap_set (b->summary, idx, full);
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -83,6 +179,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->summary = NULL;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +202,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->summary = NULL;
   bitmap_set_all (b, false);
   return b;
 }
@@ -125,10 +223,39 @@ bitmap_destroy (struct bitmap *b)
 {
   if (b != NULL) 
     {
+      bitmap_destroy (b->summary);
       free (b->bits);
       free (b);
     }
 }
+
+/* Gives B, which must have been created with bitmap_create(), a
+   summary that makes searches for false bits near O(log n), at a
+   cost of about one bit in ELEM_BITS more memory and a little work
+   on every change.  Returns false if memory ran out, in which case
+   B works as before.  Changes to a summarized bitmap are not
+   atomic, so its users must lock it. */
+bool
+bitmap_summarize (struct bitmap *b)
+{
+  size_t i, cnt = elem_cnt (b->bit_cnt);
+
+  ASSERT (b != NULL);
+  ASSERT (b->summary == NULL);
+
+  if (cnt <= 1)
+    return true;
+  b->summary = bitmap_create (cnt);
+  if (b->summary == NULL || !bitmap_summarize (b->summary))
+    {
+      bitmap_destroy (b->summary);
+      b->summary = NULL;
+      return false;
+    }
+  for (i = 0; i < cnt; i++)
+    update_summary (b, i);
+  return true;
+}
 
 /* Bitmap size. */
 
@@ -164,6 +291,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -177,6 +305,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -192,6 +321,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -214,18 +344,31 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element's bits are set atomically, with one instruction. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (start < end)
+    {
+      size_t n = span_cnt (start, end);
+      elem_type *e = &b->bits[elem_idx (start)];
+      elem_type mask = span_mask (start, n);
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+      update_summary (b, elem_idx (start));
+      start += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,16 +376,21 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (start < end)
+    {
+      size_t n = span_cnt (start, end);
+      value_cnt += popcount (match (b->bits[elem_idx (start)], value)
+                             & span_mask (start, n));
+      start += n;
+    }
   return value_cnt;
 }
 
@@ -251,16 +399,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) != start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,15 +442,23 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+
+  /* Find the next bit set to VALUE, then where its run ends.  A run
+     too short means the next candidate is past its end. */
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t end;
+
+      start = find_next (b, start, b->bit_cnt, value);
+      if (b->bit_cnt - start < cnt)
+        return BITMAP_ERROR;
+      end = find_next (b, start, start + cnt, !value);
+      if (end == start + cnt)
+        return start;
+      start = end;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -345,8 +496,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_summary (b, i);
     }
   return success;
 }
@@ -359,6 +514,30 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to the same place in FILE, as written by bitmap_write(), leaving
+   the rest of FILE alone.  Returns true if successful, false
+   otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
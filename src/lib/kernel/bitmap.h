@@ -12,6 +12,7 @@ struct bitmap *bitmap_create (size_t bit_cnt);
 struct bitmap *bitmap_create_in_buf (size_t bit_cnt, void *, size_t byte_cnt);
 size_t bitmap_buf_size (size_t bit_cnt);
 void bitmap_destroy (struct bitmap *);
+bool bitmap_summarize (struct bitmap *);
 
 /* Bitmap size. */
 size_t bitmap_size (const struct bitmap *);
@@ -43,6 +44,8 @@ struct file;
 size_t bitmap_file_size (const struct bitmap *);
 bool bitmap_read (struct bitmap *, struct file *);
 bool bitmap_write (const struct bitmap *, struct file *);
+bool bitmap_write_range (const struct bitmap *, struct file *,
+                         size_t start, size_t cnt);
 #endif
 
 /* Debugging. */
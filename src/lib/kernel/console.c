@@ -1,14 +1,20 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
-static void vprintf_helper (char, void *);
-static void putchar_have_lock (uint8_t c);
+static void vprintf_helper (const char *, size_t, void *);
+static void acquire_console (void);
+static void release_console (void);
+static void log_write (const char *, size_t);
+static void log_render (void);
+static void logger (void *);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,21 +65,63 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Kernel log.  Output is appended to the log ring, with interrupts
+   off, which is safe from any context and never waits for the
+   devices.  Once console_start() has run, the logger thread renders
+   the ring to the vga display and serial port in the background, at
+   the lowest priority; before that, after a kernel panic, and
+   whenever the ring fills up, the writer renders it itself.  Text
+   between LOG_TAIL and LOG_HEAD is waiting; both only grow, and are
+   taken modulo LOG_SIZE to index the ring. */
+#define LOG_SIZE 16384
+static char log_ring[LOG_SIZE];
+static uint32_t log_head, log_tail;
+
+/* Characters the renderer takes out of the ring at a time. */
+#define LOG_RUN 128
+
+static struct semaphore log_wake;   /* Ups the logger thread. */
+static bool log_kicked;             /* LOG_WAKE upped, not yet seen? */
+static bool logger_running;         /* Logger thread started? */
+
 /* Enable console locking. */
 void
 console_init (void) 
 {
   lock_init (&console_lock);
+  lock_register (&console_lock, "console");
   use_console_lock = true;
 }
 
+/* Starts the logger thread that renders the kernel log.  Until it
+   runs, output is rendered as it is written. */
+void
+console_start (void)
+{
+  sema_init (&log_wake, 0);
+  logger_running = thread_create ("logger", PRI_MIN, logger, NULL)
+                   != TID_ERROR;
+}
+
+/* Renders everything written so far before returning, as for
+   shutdown. */
+void
+console_flush (void)
+{
+  acquire_console ();
+  log_render ();
+  release_console ();
+}
+
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
-   now on. */
+   now on.  What is still in the log is rendered right away, and
+   so is all output from now on. */
 void
 console_panic (void) 
 {
   use_console_lock = false;
+  log_render ();
 }
 
 /* Prints console statistics. */
@@ -109,29 +157,144 @@ release_console (void)
     }
 }
 
-/* Returns true if the current thread has the console lock,
-   false otherwise. */
-static bool
-console_locked_by_current_thread (void) 
+/* Renders the kernel log to the vga display and serial port.  In
+   thread context with interrupts on, the caller must hold the
+   console lock, so that renderers take turns in the order they
+   took text out of the ring; elsewhere we may not wait for it. */
+static void
+log_render (void)
+{
+  char run[LOG_RUN];
+
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      size_t n = log_head - log_tail;
+      size_t ofs = log_tail % LOG_SIZE;
+
+      if (n == 0)
+        {
+          intr_set_level (old_level);
+          break;
+        }
+      if (n > LOG_RUN)
+        n = LOG_RUN;
+      if (n > LOG_SIZE - ofs)
+        n = LOG_SIZE - ofs;
+      memcpy (run, log_ring + ofs, n);
+      log_tail += n;
+      write_cnt += n;
+      intr_set_level (old_level);
+
+      serial_putbuf (run, n);
+      vga_putbuf (run, n);
+    }
+}
+
+/* Logger thread: renders the kernel log whenever there is new
+   text in it. */
+static void
+logger (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+
+      sema_down (&log_wake);
+      old_level = intr_disable ();
+      log_kicked = false;
+      intr_set_level (old_level);
+
+      acquire_console ();
+      log_render ();
+      release_console ();
+    }
+}
+
+/* Renders the kernel log in the running context, taking the console
+   lock if we can wait for it. */
+static void
+log_render_now (void)
 {
-  return (intr_context ()
-          || !use_console_lock
-          || lock_held_by_current_thread (&console_lock));
+  if (intr_get_level () == INTR_ON)
+    console_flush ();
+  else
+    log_render ();
 }
 
+/* Appends the N characters in BUFFER to the kernel log, rendering
+   the log first whenever it is full, and wakes the logger thread,
+   or renders the log right away if there is no logger thread to do
+   it. */
+static void
+log_write (const char *buffer, size_t n)
+{
+  enum intr_level old_level;
+  bool kick;
+
+  while (n > 0)
+    {
+      size_t room, ofs, cnt;
+
+      old_level = intr_disable ();
+      room = LOG_SIZE - (log_head - log_tail);
+      ofs = log_head % LOG_SIZE;
+      cnt = n < room ? n : room;
+      if (cnt > LOG_SIZE - ofs)
+        {
+          memcpy (log_ring + ofs, buffer, LOG_SIZE - ofs);
+          memcpy (log_ring, buffer + (LOG_SIZE - ofs),
+                  cnt - (LOG_SIZE - ofs));
+        }
+      else
+        memcpy (log_ring + ofs, buffer, cnt);
+      log_head += cnt;
+      intr_set_level (old_level);
+
+      buffer += cnt;
+      n -= cnt;
+      if (n > 0)
+        log_render_now ();
+    }
+
+  if (!logger_running || !use_console_lock)
+    {
+      log_render_now ();
+      return;
+    }
+  old_level = intr_disable ();
+  kick = !log_kicked;
+  log_kicked = true;
+  intr_set_level (old_level);
+  if (kick)
+    sema_up (&log_wake);
+}
+
+/* Output of vprintf() collected for writing in batches.  A
+   message that fits in BUF goes into the log in one piece, so
+   other threads' output cannot split it. */
+struct vprintf_batch
+  {
+    int char_cnt;               /* Characters output so far. */
+    size_t cnt;                 /* Characters in BUF. */
+    char buf[128];              /* Characters not yet written. */
+  };
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
-   Writes its output to both vga display and serial port. */
+   Writes its output to the kernel log, for both vga display and
+   serial port. */
 int
 vprintf (const char *format, va_list args) 
 {
-  int char_cnt = 0;
+  struct vprintf_batch batch;
 
-  acquire_console ();
-  __vprintf (format, args, vprintf_helper, &char_cnt);
-  release_console ();
+  batch.char_cnt = 0;
+  batch.cnt = 0;
+  __vprintf (format, args, vprintf_helper, &batch);
+  log_write (batch.buf, batch.cnt);
 
-  return char_cnt;
+  return batch.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
@@ -139,11 +302,8 @@ vprintf (const char *format, va_list args)
 int
 puts (const char *s) 
 {
-  acquire_console ();
-  while (*s != '\0')
-    putchar_have_lock (*s++);
-  putchar_have_lock ('\n');
-  release_console ();
+  log_write (s, strlen (s));
+  log_write ("\n", 1);
 
   return 0;
 }
@@ -152,40 +312,36 @@ puts (const char *s)
 void
 putbuf (const char *buffer, size_t n) 
 {
-  acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
-  release_console ();
+  log_write (buffer, n);
 }
 
 /* Writes C to the vga display and serial port. */
 int
 putchar (int c) 
 {
-  acquire_console ();
-  putchar_have_lock (c);
-  release_console ();
-  
+  char ch = c;
+
+  log_write (&ch, 1);
   return c;
 }
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (const char *run, size_t size, void *batch_) 
 {
-  int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
-}
+  struct vprintf_batch *batch = batch_;
 
-/* Writes C to the vga display and serial port.
-   The caller has already acquired the console lock if
-   appropriate. */
-static void
-putchar_have_lock (uint8_t c) 
-{
-  ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
-  serial_putc (c);
-  vga_putc (c);
+  batch->char_cnt += size;
+  if (batch->cnt + size > sizeof batch->buf)
+    {
+      log_write (batch->buf, batch->cnt);
+      batch->cnt = 0;
+    }
+  if (size >= sizeof batch->buf)
+    log_write (run, size);
+  else
+    {
+      memcpy (batch->buf + batch->cnt, run, size);
+      batch->cnt += size;
+    }
 }
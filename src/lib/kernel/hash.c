@@ -3,7 +3,15 @@
    This data structure is thoroughly documented in the Tour of
    Pintos for Project 3.
 
-   See hash.h for basic information. */
+   See hash.h for basic information.
+
+   Resizing is incremental, so that no single operation pays for
+   moving the whole table.  A resize allocates the new bucket array
+   and keeps the old one alongside it.  Every later insertion or
+   deletion then moves MIGRATE_STEP old buckets into the new array,
+   until the old one is empty and can be freed.  Until then an
+   element lives in its old bucket if that bucket has not been
+   moved yet, and in its new bucket otherwise. */
 
 #include "hash.h"
 #include "../debug.h"
@@ -18,6 +26,9 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void migrate (struct hash *, size_t bucket_cnt);
+static void clear_buckets (struct hash *, struct list *, size_t,
+                           hash_action_func *);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -28,6 +39,9 @@ hash_init (struct hash *h,
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = 0;
+  h->migrated = 0;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -41,23 +55,17 @@ hash_init (struct hash *h,
     return false;
 }
 
-/* Removes all the elements from H.
-   
-   If DESTRUCTOR is non-null, then it is called for each element
-   in the hash.  DESTRUCTOR may, if appropriate, deallocate the
-   memory used by the hash element.  However, modifying hash
-   table H while hash_clear() is running, using any of the
-   functions hash_clear(), hash_destroy(), hash_insert(),
-   hash_replace(), or hash_delete(), yields undefined behavior,
-   whether done in DESTRUCTOR or elsewhere. */
-void
-hash_clear (struct hash *h, hash_action_func *destructor) 
+/* Empties the CNT lists in BUCKETS of hash table H, calling
+   DESTRUCTOR, if it is non-null, for each element. */
+static void
+clear_buckets (struct hash *h, struct list *buckets, size_t cnt,
+               hash_action_func *destructor)
 {
   size_t i;
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (i = 0; i < cnt; i++) 
     {
-      struct list *bucket = &h->buckets[i];
+      struct list *bucket = &buckets[i];
 
       if (destructor != NULL) 
         while (!list_empty (bucket)) 
@@ -69,6 +77,28 @@ hash_clear (struct hash *h, hash_action_func *destructor)
 
       list_init (bucket); 
     }    
+}
+
+/* Removes all the elements from H.
+   
+   If DESTRUCTOR is non-null, then it is called for each element
+   in the hash.  DESTRUCTOR may, if appropriate, deallocate the
+   memory used by the hash element.  However, modifying hash
+   table H while hash_clear() is running, using any of the
+   functions hash_clear(), hash_destroy(), hash_insert(),
+   hash_replace(), or hash_delete(), yields undefined behavior,
+   whether done in DESTRUCTOR or elsewhere. */
+void
+hash_clear (struct hash *h, hash_action_func *destructor) 
+{
+  clear_buckets (h, h->buckets, h->bucket_cnt, destructor);
+  if (h->old_buckets != NULL)
+    {
+      clear_buckets (h, h->old_buckets, h->old_bucket_cnt, destructor);
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+      h->old_bucket_cnt = 0;
+    }
 
   h->elem_cnt = 0;
 }
@@ -89,6 +119,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
   if (destructor != NULL)
     hash_clear (h, destructor);
   free (h->buckets);
+  free (h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -166,9 +197,11 @@ hash_apply (struct hash *h, hash_action_func *action)
   
   ASSERT (action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (i = 0; i < h->bucket_cnt + h->old_bucket_cnt; i++) 
     {
-      struct list *bucket = &h->buckets[i];
+      struct list *bucket = i < h->bucket_cnt
+                            ? &h->buckets[i]
+                            : &h->old_buckets[i - h->bucket_cnt];
       struct list_elem *elem, *next;
 
       for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
@@ -223,7 +256,13 @@ hash_next (struct hash_iterator *i)
   i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem (list_end (i->bucket)))
     {
-      if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt)
+      struct hash *h = i->hash;
+
+      /* The new buckets come first, then any old ones. */
+      if (++i->bucket == h->buckets + h->bucket_cnt)
+        i->bucket = h->old_buckets;
+      if (i->bucket == NULL
+          || i->bucket == h->old_buckets + h->old_bucket_cnt)
         {
           i->elem = NULL;
           break;
@@ -257,10 +296,6 @@ hash_empty (struct hash *h)
   return h->elem_cnt == 0;
 }
 
-/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
-#define FNV_32_PRIME 16777619u
-#define FNV_32_BASIS 2166136261u
-
 /* Returns a hash of the SIZE bytes in BUF. */
 unsigned
 hash_bytes (const void *buf_, size_t size)
@@ -298,15 +333,14 @@ hash_string (const char *s_)
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  return hash_u32 (i);
 }
 
 /* Returns the bucket in H that E belongs in. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) 
 {
-  size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-  return &h->buckets[bucket_idx];
+  return hash_bucket (h, h->hash (e, h->aux));
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -344,22 +378,38 @@ is_power_of_2 (size_t x)
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Old buckets moved per insertion or deletion during a resize.
+   A resize starts only when the load is off by a factor of two
+   from the ideal, which takes at least as many operations as there
+   are old buckets, so at 2 per operation it is done long before
+   the next one is due. */
+#define MIGRATE_STEP 2
+
+/* Moves the next MIGRATE_STEP old buckets of H, if it is resizing,
+   or starts a resize if H has strayed outside the bounds given by
+   MIN_ELEMS_PER_BUCKET and MAX_ELEMS_PER_BUCKET.  Starting a resize
+   can fail because of an out-of-memory condition, but that'll just
+   make hash accesses less efficient; we can still continue. */
 static void
 rehash (struct hash *h) 
 {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
+  size_t new_bucket_cnt;
+  struct list *new_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
+  if (h->old_buckets != NULL)
+    {
+      migrate (h, MIGRATE_STEP);
+      return;
+    }
+
+  /* Keep the bucket count while the load is within bounds. */
+  if (h->elem_cnt <= h->bucket_cnt * MAX_ELEMS_PER_BUCKET
+      && (h->elem_cnt >= h->bucket_cnt * MIN_ELEMS_PER_BUCKET
+          || h->bucket_cnt == 4))
+    return;
 
   /* Calculate the number of buckets to use now.
      We want one bucket for about every BEST_ELEMS_PER_BUCKET.
@@ -372,7 +422,7 @@ rehash (struct hash *h)
     new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
 
   /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
+  if (new_bucket_cnt == h->bucket_cnt)
     return;
 
   /* Allocate new buckets and initialize them as empty. */
@@ -387,29 +437,41 @@ rehash (struct hash *h)
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Install new bucket info.  The elements move over later. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = h->bucket_cnt;
+  h->migrated = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
+  migrate (h, MIGRATE_STEP);
+}
 
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
+/* Moves the elements of up to BUCKET_CNT more old buckets of H
+   into the new ones, and frees the old buckets once they are all
+   empty. */
+static void
+migrate (struct hash *h, size_t bucket_cnt) 
+{
+  for (; bucket_cnt > 0 && h->migrated < h->old_bucket_cnt; bucket_cnt--)
     {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
+      struct list *old_bucket = &h->old_buckets[h->migrated++];
 
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
+      /* With the bucket counted as moved, find_bucket() now gives
+         each element's new bucket. */
+      while (!list_empty (old_bucket))
         {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
+          struct list_elem *elem = list_pop_front (old_bucket);
+          list_push_front (find_bucket (h, list_elem_to_hash_elem (elem)),
+                           elem);
         }
     }
 
-  free (old_buckets);
+  if (h->migrated == h->old_bucket_cnt)
+    {
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+      h->old_bucket_cnt = 0;
+    }
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -61,6 +61,9 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    struct list *old_buckets;   /* Buckets being moved from, or null. */
+    size_t old_bucket_cnt;      /* Number of old buckets. */
+    size_t migrated;            /* Old buckets already moved. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -100,4 +103,69 @@ unsigned hash_bytes (const void *, size_t);
 unsigned hash_string (const char *);
 unsigned hash_int (int);
 
+/* Fowler-Noll-Vo hash constants, for 32-bit word sizes. */
+#define FNV_32_PRIME 16777619u
+#define FNV_32_BASIS 2166136261u
+
+/* Returns a hash of X, the same as hash_bytes (&X, sizeof X) and
+   hash_int (X), but inline. */
+static inline unsigned
+hash_u32 (uint32_t x)
+{
+  unsigned hash = FNV_32_BASIS;
+
+  hash = (hash * FNV_32_PRIME) ^ (x & 0xff);
+  hash = (hash * FNV_32_PRIME) ^ ((x >> 8) & 0xff);
+  hash = (hash * FNV_32_PRIME) ^ ((x >> 16) & 0xff);
+  hash = (hash * FNV_32_PRIME) ^ (x >> 24);
+  return hash;
+}
+
+/* Returns the bucket of H that an element with hash value HASH
+   belongs in.  While H is being resized, that is its old bucket
+   until the old bucket has been moved. */
+static inline struct list *
+hash_bucket (struct hash *h, unsigned hash)
+{
+  if (h->old_buckets != NULL)
+    {
+      size_t old_idx = hash & (h->old_bucket_cnt - 1);
+      if (old_idx >= h->migrated)
+        return &h->old_buckets[old_idx];
+    }
+  return &h->buckets[hash & (h->bucket_cnt - 1)];
+}
+
+/* Defines NAME (struct hash *H, KEY_TYPE KEY), a lookup for a hash
+   table of STRUCTs linked through their hash_elem MEMBER and keyed
+   by their KEY_TYPE member FIELD.  It returns the STRUCT in H whose
+   FIELD equals KEY, or a null pointer if there is none, as
+   hash_find() would, but with the hashing and comparisons inlined
+   instead of called through H's function pointers.  HASH (KEY)
+   must compute the same value as H's hash function, and FIELD must
+   be what H's less function orders by, with <.  For example:
+
+      static inline unsigned foo_key_hash (int key)
+      {
+        return hash_u32 (key);
+      }
+      HASH_FIND_BY_KEY (foo_lookup, struct foo, hash_elem, int, key,
+                        foo_key_hash)
+*/
+#define HASH_FIND_BY_KEY(NAME, STRUCT, MEMBER, KEY_TYPE, FIELD, HASH)   \
+        static inline STRUCT *                                          \
+        NAME (struct hash *h, KEY_TYPE key)                             \
+        {                                                               \
+          struct list *bucket = hash_bucket (h, HASH (key));            \
+          struct list_elem *e;                                          \
+                                                                        \
+          for (e = bucket->head.next; e != &bucket->tail; e = e->next)  \
+            {                                                           \
+              STRUCT *s = list_entry (e, STRUCT, MEMBER.list_elem);     \
+              if (s->FIELD == key)                                      \
+                return s;                                               \
+            }                                                           \
+          return NULL;                                                  \
+        }
+
 #endif /* lib/kernel/hash.h */
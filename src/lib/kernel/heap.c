@@ -0,0 +1,207 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* The heap is a complete binary tree: position 1 is the root, and
+   position K has children 2K and 2K+1, so the bits of K below its
+   leading 1 spell the path to it from the root, 0 for left and 1
+   for right.  Elements move by relinking, never by copying, since
+   they are embedded in their owners. */
+
+/* Initializes H as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux)
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->size = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h)
+{
+  return h->size;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+heap_empty (const struct heap *h)
+{
+  return h->size == 0;
+}
+
+/* Returns the maximum element of H, or a null pointer if H is
+   empty. */
+struct heap_elem *
+heap_top (const struct heap *h)
+{
+  return h->root;
+}
+
+/* Returns the element at position POS in H, 1 <= POS <= size. */
+static struct heap_elem *
+elem_at (const struct heap *h, size_t pos)
+{
+  struct heap_elem *e = h->root;
+  size_t bit = 1;
+
+  while (bit <= pos / 2)
+    bit <<= 1;
+  for (bit >>= 1; bit != 0; bit >>= 1)
+    e = pos & bit ? e->right : e->left;
+  return e;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as H's root
+   if PARENT is null. */
+static void
+relink (struct heap *h, struct heap_elem *parent, struct heap_elem *old,
+        struct heap_elem *new)
+{
+  if (parent == NULL)
+    h->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Exchanges the tree positions of E and its parent in H. */
+static void
+swap_with_parent (struct heap *h, struct heap_elem *e)
+{
+  struct heap_elem *p = e->parent;
+  struct heap_elem *left = e->left, *right = e->right;
+
+  relink (h, p->parent, p, e);
+  e->parent = p->parent;
+  if (p->left == e)
+    {
+      e->left = p;
+      e->right = p->right;
+      if (e->right != NULL)
+        e->right->parent = e;
+    }
+  else
+    {
+      e->right = p;
+      e->left = p->left;
+      if (e->left != NULL)
+        e->left->parent = e;
+    }
+
+  p->parent = e;
+  p->left = left;
+  p->right = right;
+  if (left != NULL)
+    left->parent = p;
+  if (right != NULL)
+    right->parent = p;
+}
+
+/* Moves E up H while it is greater than its parent. */
+static void
+sift_up (struct heap *h, struct heap_elem *e)
+{
+  while (e->parent != NULL && h->less (e->parent, e, h->aux))
+    swap_with_parent (h, e);
+}
+
+/* Moves E down H while it is less than its greater child. */
+static void
+sift_down (struct heap *h, struct heap_elem *e)
+{
+  for (;;)
+    {
+      struct heap_elem *c = e->left;
+
+      if (c == NULL)
+        break;
+      if (e->right != NULL && h->less (c, e->right, h->aux))
+        c = e->right;
+      if (!h->less (e, c, h->aux))
+        break;
+      swap_with_parent (h, c);
+    }
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e)
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->left = e->right = NULL;
+  h->size++;
+  if (h->size == 1)
+    {
+      e->parent = NULL;
+      h->root = e;
+      return;
+    }
+
+  e->parent = elem_at (h, h->size / 2);
+  if (h->size & 1)
+    e->parent->right = e;
+  else
+    e->parent->left = e;
+  sift_up (h, e);
+}
+
+/* Removes and returns the maximum element of H, which must not be
+   empty. */
+struct heap_elem *
+heap_pop (struct heap *h)
+{
+  struct heap_elem *top = h->root;
+
+  ASSERT (top != NULL);
+  heap_remove (h, top);
+  return top;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e)
+{
+  struct heap_elem *last;
+
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+  ASSERT (h->size > 0);
+
+  /* Detach the last element, then put it in E's place. */
+  last = elem_at (h, h->size);
+  relink (h, last->parent, last, NULL);
+  h->size--;
+  if (last == e)
+    return;
+
+  last->parent = e->parent;
+  last->left = e->left;
+  last->right = e->right;
+  relink (h, e->parent, e, last);
+  if (last->left != NULL)
+    last->left->parent = last;
+  if (last->right != NULL)
+    last->right->parent = last;
+  heap_update (h, last);
+}
+
+/* Restores the order of H after the value of E, which must be in
+   H, has changed. */
+void
+heap_update (struct heap *h, struct heap_elem *e)
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  sift_up (h, e);
+  sift_down (h, e);
+}
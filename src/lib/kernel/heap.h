@@ -0,0 +1,91 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Binary heap.
+
+   Like the doubly linked list in list.h, this heap does not use
+   dynamically allocated memory.  Each structure that can be in a
+   heap embeds a struct heap_elem member, and the heap is a
+   complete binary tree linked through those members, so pushing,
+   popping, removing an arbitrary element and restoring the order
+   after an element's key changes all take O(log n) time, and
+   finding the top takes O(1).  The heap_entry macro converts a
+   struct heap_elem back to the structure that contains it.
+
+   The heap is ordered by a heap_less_func, and the top is the
+   maximum under it, the element list_max() would return from an
+   equivalent list.  Pass a "greater than" function to get the
+   minimum instead.  Equal elements come off in no particular
+   order.
+
+   For example, a heap of `struct foo' by priority:
+
+      struct foo
+        {
+          struct heap_elem elem;
+          int priority;
+        };
+
+      static bool
+      foo_less (const struct heap_elem *a, const struct heap_elem *b,
+                void *aux UNUSED)
+      {
+        return (heap_entry (a, struct foo, elem)->priority
+                < heap_entry (b, struct foo, elem)->priority);
+      }
+
+      struct heap foo_heap;
+      heap_init (&foo_heap, foo_less, NULL);
+
+   After changing the priority of a foo F that is in foo_heap,
+   call heap_update (&foo_heap, &F->elem). */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem
+  {
+    struct heap_elem *parent;   /* Parent, or null at the top. */
+    struct heap_elem *left;     /* Left child, or null. */
+    struct heap_elem *right;    /* Right child, or null. */
+  };
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element.  See the big comment at the top of the
+   file for an example. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->parent     \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap
+  {
+    struct heap_elem *root;     /* Top element, or null if empty. */
+    size_t size;                /* Number of elements. */
+    heap_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+size_t heap_size (const struct heap *);
+bool heap_empty (const struct heap *);
+struct heap_elem *heap_top (const struct heap *);
+
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+
+#endif /* lib/kernel/heap.h */
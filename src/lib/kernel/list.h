@@ -174,6 +174,27 @@ void list_insert_ordered (struct list *, struct list_elem *,
 void list_unique (struct list *, struct list *duplicates,
                   list_less_func *, void *aux);
 
+/* Inserts ELEM, the list_elem MEMBER of a STRUCT, into LIST, which
+   must be sorted by the STRUCTs' member FIELD, in the place
+   list_insert_ordered() would with a less function comparing FIELD
+   with <.  The comparison is inlined instead of called through a
+   pointer. */
+#define list_insert_ordered_by(LIST, ELEM, STRUCT, MEMBER, FIELD)      \
+        do                                                              \
+          {                                                             \
+            struct list *list_ = (LIST);                                \
+            struct list_elem *elem_ = (ELEM);                           \
+            struct list_elem *e_;                                       \
+                                                                        \
+            for (e_ = list_->head.next; e_ != &list_->tail;             \
+                 e_ = e_->next)                                         \
+              if (list_entry (elem_, STRUCT, MEMBER)->FIELD             \
+                  < list_entry (e_, STRUCT, MEMBER)->FIELD)             \
+                break;                                                  \
+            list_insert (e_, elem_);                                    \
+          }                                                             \
+        while (0)
+
 /* Max and min. */
 struct list_elem *list_max (struct list *, list_less_func *, void *aux);
 struct list_elem *list_min (struct list *, list_less_func *, void *aux);
@@ -0,0 +1,244 @@
+/* Open-addressing hash table keyed by pointers.
+
+   See ptrmap.h for basic information. */
+
+#include "ptrmap.h"
+#include <stdint.h>
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Smallest slot array allocated. */
+#define MIN_SLOTS 8
+
+/* The table grows before it would become more than 7/8 full,
+   and shrinks once it is less than 1/8 full. */
+#define MAX_LOAD(SLOTS) ((SLOTS) / 8 * 7)
+#define MIN_LOAD(SLOTS) ((SLOTS) / 8)
+
+static bool resize (struct ptrmap *, size_t slot_cnt);
+
+/* Initializes MAP as an empty table.  No memory is allocated
+   until the first insertion, so this cannot fail. */
+void
+ptrmap_init (struct ptrmap *map)
+{
+  map->cnt = 0;
+  map->slot_cnt = 0;
+  map->slots = NULL;
+}
+
+/* Frees MAP's slot array and leaves it empty.  The values it
+   mapped to are up to the caller. */
+void
+ptrmap_destroy (struct ptrmap *map)
+{
+  free (map->slots);
+  ptrmap_init (map);
+}
+
+/* Returns the home slot of KEY in MAP.  Pointers tend to share
+   their low bits (page addresses share twelve), so the bits are
+   mixed before masking. */
+static inline size_t
+home (const struct ptrmap *map, const void *key)
+{
+  uint32_t h = (uintptr_t) key;
+
+  h ^= h >> 16;
+  h *= 0x9e3779b1;
+  h ^= h >> 15;
+  return h & (map->slot_cnt - 1);
+}
+
+/* Returns how far slot IDX in MAP is past the home slot of the
+   KEY stored there. */
+static inline size_t
+distance (const struct ptrmap *map, size_t idx, const void *key)
+{
+  return (idx - home (map, key)) & (map->slot_cnt - 1);
+}
+
+/* Returns the slot holding KEY in MAP, or a null pointer if KEY is
+   not in MAP. */
+static struct ptrmap_slot *
+find_slot (const struct ptrmap *map, const void *key)
+{
+  size_t mask = map->slot_cnt - 1;
+  size_t idx, d;
+
+  if (map->slot_cnt == 0 || key == NULL)
+    return NULL;
+
+  for (idx = home (map, key), d = 0; ; idx = (idx + 1) & mask, d++)
+    {
+      struct ptrmap_slot *s = &map->slots[idx];
+
+      if (s->key == key)
+        return s;
+
+      /* Had KEY been inserted, it would have displaced this entry,
+         which is closer to home than KEY would be here. */
+      if (s->key == NULL || distance (map, idx, s->key) < d)
+        return NULL;
+    }
+}
+
+/* Stores KEY and VALUE in MAP, which must not already contain
+   KEY and must have an empty slot. */
+static void
+place (struct ptrmap *map, const void *key, void *value)
+{
+  size_t mask = map->slot_cnt - 1;
+  size_t idx, d;
+
+  for (idx = home (map, key), d = 0; ; idx = (idx + 1) & mask, d++)
+    {
+      struct ptrmap_slot *s = &map->slots[idx];
+      size_t sd;
+
+      if (s->key == NULL)
+        {
+          s->key = key;
+          s->value = value;
+          map->cnt++;
+          return;
+        }
+
+      /* Robin Hood: take the slot of an entry nearer its home, and
+         carry on inserting that entry instead. */
+      sd = distance (map, idx, s->key);
+      if (sd < d)
+        {
+          const void *k = s->key;
+          void *v = s->value;
+
+          s->key = key;
+          s->value = value;
+          key = k;
+          value = v;
+          d = sd;
+        }
+    }
+}
+
+/* Rebuilds MAP with SLOT_CNT slots, a power of 2 greater than its
+   number of entries.  Returns false, leaving MAP unchanged, if
+   memory is not available. */
+static bool
+resize (struct ptrmap *map, size_t slot_cnt)
+{
+  struct ptrmap_slot *old_slots = map->slots;
+  size_t old_slot_cnt = map->slot_cnt;
+  struct ptrmap_slot *slots;
+  size_t i;
+
+  ASSERT (slot_cnt > map->cnt);
+  ASSERT ((slot_cnt & (slot_cnt - 1)) == 0);
+
+  slots = calloc (slot_cnt, sizeof *slots);
+  if (slots == NULL)
+    return false;
+
+  map->slots = slots;
+  map->slot_cnt = slot_cnt;
+  map->cnt = 0;
+  for (i = 0; i < old_slot_cnt; i++)
+    if (old_slots[i].key != NULL)
+      place (map, old_slots[i].key, old_slots[i].value);
+  free (old_slots);
+  return true;
+}
+
+/* Returns the value KEY maps to in MAP, or a null pointer if KEY
+   is not in MAP. */
+void *
+ptrmap_find (const struct ptrmap *map, const void *key)
+{
+  struct ptrmap_slot *s = find_slot (map, key);
+  return s != NULL ? s->value : NULL;
+}
+
+/* Maps KEY, which must not be null, to VALUE in MAP, replacing
+   any value KEY already had.  Returns false if MAP had to grow
+   and memory was not available. */
+bool
+ptrmap_insert (struct ptrmap *map, const void *key, void *value)
+{
+  struct ptrmap_slot *s;
+
+  ASSERT (key != NULL);
+
+  s = find_slot (map, key);
+  if (s != NULL)
+    {
+      s->value = value;
+      return true;
+    }
+
+  /* Growing can fail without harm while a slot is left to keep
+     probe sequences finite. */
+  if (map->cnt + 1 > MAX_LOAD (map->slot_cnt)
+      && !resize (map, map->slot_cnt ? map->slot_cnt * 2 : MIN_SLOTS)
+      && map->cnt + 1 >= map->slot_cnt)
+    return false;
+
+  place (map, key, value);
+  return true;
+}
+
+/* Removes KEY from MAP and returns the value it mapped to, or a
+   null pointer if KEY was not in MAP. */
+void *
+ptrmap_remove (struct ptrmap *map, const void *key)
+{
+  struct ptrmap_slot *s = find_slot (map, key);
+  size_t mask = map->slot_cnt - 1;
+  size_t idx, next;
+  void *value;
+
+  if (s == NULL)
+    return NULL;
+  value = s->value;
+
+  /* Shift the rest of the probe sequence back by one slot, up to
+     an empty slot or an entry already in its home slot. */
+  idx = s - map->slots;
+  for (next = (idx + 1) & mask;
+       map->slots[next].key != NULL
+         && distance (map, next, map->slots[next].key) > 0;
+       idx = next, next = (next + 1) & mask)
+    map->slots[idx] = map->slots[next];
+  map->slots[idx].key = NULL;
+  map->slots[idx].value = NULL;
+  map->cnt--;
+
+  /* Failing to shrink just wastes some memory. */
+  if (map->slot_cnt > MIN_SLOTS && map->cnt < MIN_LOAD (map->slot_cnt))
+    resize (map, map->slot_cnt / 2);
+  return value;
+}
+
+/* Returns the number of entries in MAP. */
+size_t
+ptrmap_size (const struct ptrmap *map)
+{
+  return map->cnt;
+}
+
+/* Iterates through MAP.  *POS must be 0 for the first call.
+   Returns the next occupied slot and advances *POS past it, or
+   returns a null pointer after the last one.  Slots come in no
+   particular order.  Inserting into or removing from MAP during
+   an iteration may skip or repeat entries, but a slot's value
+   may be changed. */
+struct ptrmap_slot *
+ptrmap_next (const struct ptrmap *map, size_t *pos)
+{
+  while (*pos < map->slot_cnt)
+    {
+      struct ptrmap_slot *s = &map->slots[(*pos)++];
+      if (s->key != NULL)
+        return s;
+    }
+  return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef __LIB_KERNEL_PTRMAP_H
+#define __LIB_KERNEL_PTRMAP_H
+
+/* Open-addressing hash table keyed by pointers.
+
+   Where struct hash chains struct hash_elems through per-bucket
+   lists, a ptrmap keeps each key and its value side by side in
+   one flat array of slots, so a lookup usually touches a single
+   cache line and never dereferences the objects it maps.  The
+   price is that keys must be pointers (or anything that fits in
+   one), compared by identity, and that a null key is reserved to
+   mark empty slots.
+
+   Collisions are resolved by linear probing with Robin Hood
+   insertion: an entry that is further from its home slot takes
+   the place of one that is closer.  That keeps probe sequences
+   short and lets an unsuccessful lookup stop as soon as it meets
+   an entry closer to home than the key would be.  Deletion
+   shifts the following entries back, so there are no tombstones.
+
+   The slot array is allocated on the first insertion and grows
+   and shrinks by powers of 2 with the number of entries. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* One slot: a key, or null if the slot is empty, and its value. */
+struct ptrmap_slot
+  {
+    const void *key;
+    void *value;
+  };
+
+/* Pointer-keyed hash table. */
+struct ptrmap
+  {
+    size_t cnt;                 /* Number of entries. */
+    size_t slot_cnt;            /* Number of slots, 0 or a power of 2. */
+    struct ptrmap_slot *slots;  /* Array of `slot_cnt' slots. */
+  };
+
+void ptrmap_init (struct ptrmap *);
+void ptrmap_destroy (struct ptrmap *);
+
+void *ptrmap_find (const struct ptrmap *, const void *key);
+bool ptrmap_insert (struct ptrmap *, const void *key, void *value);
+void *ptrmap_remove (struct ptrmap *, const void *key);
+
+size_t ptrmap_size (const struct ptrmap *);
+struct ptrmap_slot *ptrmap_next (const struct ptrmap *, size_t *pos);
+
+#endif /* lib/kernel/ptrmap.h */
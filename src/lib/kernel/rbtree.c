@@ -0,0 +1,399 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* The tree keeps the usual red-black invariants: the root is
+   black, a red node has no red child, and every path from a node
+   down to a null child passes the same number of black nodes.  A
+   null child counts as black.  Together these keep the height
+   within twice that of a perfectly balanced tree. */
+
+/* Initializes T as an empty tree ordered by LESS, given
+   auxiliary data AUX. */
+void
+rb_init (struct rb_tree *t, rb_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->size = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Returns true if N is a red node, false if it is black or
+   null. */
+static inline bool
+is_red (const struct rb_node *n)
+{
+  return n != NULL && n->red;
+}
+
+/* Makes NEW take OLD's place as a child of PARENT, or as T's root
+   if PARENT is null. */
+static void
+relink (struct rb_tree *t, struct rb_node *parent, struct rb_node *old,
+        struct rb_node *new)
+{
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+}
+
+/* Rotates the subtree at X left, making X's right child its
+   parent. */
+static void
+rotate_left (struct rb_tree *t, struct rb_node *x)
+{
+  struct rb_node *y = x->right;
+
+  x->right = y->left;
+  if (y->left != NULL)
+    y->left->parent = x;
+  y->parent = x->parent;
+  relink (t, x->parent, x, y);
+  y->left = x;
+  x->parent = y;
+}
+
+/* Rotates the subtree at X right, making X's left child its
+   parent. */
+static void
+rotate_right (struct rb_tree *t, struct rb_node *x)
+{
+  struct rb_node *y = x->left;
+
+  x->left = y->right;
+  if (y->right != NULL)
+    y->right->parent = x;
+  y->parent = x->parent;
+  relink (t, x->parent, x, y);
+  y->right = x;
+  x->parent = y;
+}
+
+/* Inserts N into T, after any nodes equal to it. */
+void
+rb_insert (struct rb_tree *t, struct rb_node *n)
+{
+  struct rb_node *parent = NULL;
+  struct rb_node **link = &t->root;
+
+  ASSERT (t != NULL);
+  ASSERT (n != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = t->less (n, parent, t->aux) ? &parent->left : &parent->right;
+    }
+  n->parent = parent;
+  n->left = n->right = NULL;
+  n->red = true;
+  *link = n;
+  t->size++;
+
+  /* N is red, so only a red parent breaks the invariants.  A red
+     uncle lets the grandparent take the red up a level; otherwise
+     one or two rotations end it. */
+  while (is_red (n->parent))
+    {
+      struct rb_node *p = n->parent;
+      struct rb_node *g = p->parent;
+
+      if (p == g->left)
+        {
+          struct rb_node *u = g->right;
+
+          if (is_red (u))
+            {
+              p->red = u->red = false;
+              g->red = true;
+              n = g;
+              continue;
+            }
+          if (n == p->right)
+            {
+              rotate_left (t, p);
+              p = n;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_right (t, g);
+          break;
+        }
+      else
+        {
+          struct rb_node *u = g->left;
+
+          if (is_red (u))
+            {
+              p->red = u->red = false;
+              g->red = true;
+              n = g;
+              continue;
+            }
+          if (n == p->left)
+            {
+              rotate_right (t, p);
+              p = n;
+            }
+          p->red = false;
+          g->red = true;
+          rotate_left (t, g);
+          break;
+        }
+    }
+  t->root->red = false;
+}
+
+/* Restores the invariants after a black node was removed from
+   above X, a child (possibly null) of PARENT, leaving every path
+   through X one black node short. */
+static void
+remove_fixup (struct rb_tree *t, struct rb_node *x, struct rb_node *parent)
+{
+  while (x != t->root && !is_red (x))
+    {
+      if (x == parent->left)
+        {
+          struct rb_node *w = parent->right;
+
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_left (t, parent);
+              w = parent->right;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->right))
+            {
+              w->left->red = false;
+              w->red = true;
+              rotate_right (t, w);
+              w = parent->right;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->right->red = false;
+          rotate_left (t, parent);
+        }
+      else
+        {
+          struct rb_node *w = parent->left;
+
+          if (is_red (w))
+            {
+              w->red = false;
+              parent->red = true;
+              rotate_right (t, parent);
+              w = parent->left;
+            }
+          if (!is_red (w->left) && !is_red (w->right))
+            {
+              w->red = true;
+              x = parent;
+              parent = x->parent;
+              continue;
+            }
+          if (!is_red (w->left))
+            {
+              w->right->red = false;
+              w->red = true;
+              rotate_left (t, w);
+              w = parent->left;
+            }
+          w->red = parent->red;
+          parent->red = false;
+          w->left->red = false;
+          rotate_right (t, parent);
+        }
+      x = t->root;
+    }
+  if (x != NULL)
+    x->red = false;
+}
+
+/* Removes N, which must be in T, from T. */
+void
+rb_remove (struct rb_tree *t, struct rb_node *n)
+{
+  struct rb_node *child, *parent;
+  bool red;
+
+  ASSERT (t != NULL);
+  ASSERT (n != NULL);
+  ASSERT (t->size > 0);
+
+  if (n->left != NULL && n->right != NULL)
+    {
+      /* Move N's successor Y, which has no left child, into N's
+         place, and fix up where Y used to be. */
+      struct rb_node *y = n->right;
+
+      while (y->left != NULL)
+        y = y->left;
+      child = y->right;
+      parent = y->parent;
+      red = y->red;
+      if (parent == n)
+        parent = y;
+      else
+        {
+          if (child != NULL)
+            child->parent = parent;
+          parent->left = child;
+          y->right = n->right;
+          n->right->parent = y;
+        }
+      y->left = n->left;
+      n->left->parent = y;
+      y->parent = n->parent;
+      relink (t, n->parent, n, y);
+      y->red = n->red;
+    }
+  else
+    {
+      child = n->left != NULL ? n->left : n->right;
+      parent = n->parent;
+      red = n->red;
+      if (child != NULL)
+        child->parent = parent;
+      relink (t, parent, n, child);
+    }
+  t->size--;
+
+  if (!red)
+    remove_fixup (t, child, parent);
+}
+
+/* Returns the first node in T equal to KEY, or a null pointer if
+   there is none. */
+struct rb_node *
+rb_find (const struct rb_tree *t, const struct rb_node *key)
+{
+  struct rb_node *n = rb_lower_bound (t, key);
+  return n != NULL && !t->less (key, n, t->aux) ? n : NULL;
+}
+
+/* Returns the first node in T that is not less than KEY, or a
+   null pointer if there is none. */
+struct rb_node *
+rb_lower_bound (const struct rb_tree *t, const struct rb_node *key)
+{
+  struct rb_node *n = t->root;
+  struct rb_node *bound = NULL;
+
+  while (n != NULL)
+    if (!t->less (n, key, t->aux))
+      {
+        bound = n;
+        n = n->left;
+      }
+    else
+      n = n->right;
+  return bound;
+}
+
+/* Returns the first node in T that is greater than KEY, or a null
+   pointer if there is none. */
+struct rb_node *
+rb_upper_bound (const struct rb_tree *t, const struct rb_node *key)
+{
+  struct rb_node *n = t->root;
+  struct rb_node *bound = NULL;
+
+  while (n != NULL)
+    if (t->less (key, n, t->aux))
+      {
+        bound = n;
+        n = n->left;
+      }
+    else
+      n = n->right;
+  return bound;
+}
+
+/* Returns the least node in T, or a null pointer if T is
+   empty. */
+struct rb_node *
+rb_first (const struct rb_tree *t)
+{
+  struct rb_node *n = t->root;
+
+  if (n != NULL)
+    while (n->left != NULL)
+      n = n->left;
+  return n;
+}
+
+/* Returns the greatest node in T, or a null pointer if T is
+   empty. */
+struct rb_node *
+rb_last (const struct rb_tree *t)
+{
+  struct rb_node *n = t->root;
+
+  if (n != NULL)
+    while (n->right != NULL)
+      n = n->right;
+  return n;
+}
+
+/* Returns the node after N in its tree, or a null pointer if N is
+   the last. */
+struct rb_node *
+rb_next (const struct rb_node *n)
+{
+  if (n->right != NULL)
+    {
+      n = n->right;
+      while (n->left != NULL)
+        n = n->left;
+      return (struct rb_node *) n;
+    }
+  while (n->parent != NULL && n == n->parent->right)
+    n = n->parent;
+  return n->parent;
+}
+
+/* Returns the node before N in its tree, or a null pointer if N
+   is the first. */
+struct rb_node *
+rb_prev (const struct rb_node *n)
+{
+  if (n->left != NULL)
+    {
+      n = n->left;
+      while (n->right != NULL)
+        n = n->right;
+      return (struct rb_node *) n;
+    }
+  while (n->parent != NULL && n == n->parent->left)
+    n = n->parent;
+  return n->parent;
+}
+
+/* Returns the number of nodes in T. */
+size_t
+rb_size (const struct rb_tree *t)
+{
+  return t->size;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *t)
+{
+  return t->size == 0;
+}
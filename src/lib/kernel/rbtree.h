@@ -0,0 +1,96 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   A balanced binary search tree that, like list.h and hash.h,
+   does not use dynamically allocated memory.  Each structure that
+   can be in a tree embeds a struct rb_node member, and the
+   rb_entry macro converts a struct rb_node back to the structure
+   that contains it.  Insertion, removal and the searches take
+   O(log n) time, and stepping to the next or previous node takes
+   O(1) amortized time.
+
+   Nodes are ordered by an rb_less_func.  Equal nodes are allowed
+   and keep their insertion order.  The searches take a key in the
+   form of a node, usually a local structure with only the key
+   members filled in, as with hash_find().  For example, with
+   `struct foo' ordered by its `start' member:
+
+      struct foo key;
+      struct rb_node *n;
+
+      key.start = addr;
+      for (n = rb_lower_bound (&foo_tree, &key.node); n != NULL;
+           n = rb_next (n))
+        {
+          struct foo *f = rb_entry (n, struct foo, node);
+          ...do something with each foo starting at or after addr...
+        }
+
+   A null pointer stands for the position past either end of the
+   tree. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree node. */
+struct rb_node
+  {
+    struct rb_node *parent;     /* Parent, or null at the root. */
+    struct rb_node *left;       /* Left child, or null. */
+    struct rb_node *right;      /* Right child, or null. */
+    bool red;                   /* Red or black. */
+  };
+
+/* Converts pointer to tree node RB_NODE into a pointer to the
+   structure that RB_NODE is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree node.  See the big comment at the top of the file for an
+   example. */
+#define rb_entry(RB_NODE, STRUCT, MEMBER)                       \
+        ((STRUCT *) ((uint8_t *) &(RB_NODE)->parent             \
+                     - offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two tree nodes A and B, given auxiliary
+   data AUX.  Returns true if A is less than B, or false if A is
+   greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_node *a,
+                           const struct rb_node *b,
+                           void *aux);
+
+/* Red-black tree. */
+struct rb_tree
+  {
+    struct rb_node *root;       /* Root node, or null if empty. */
+    size_t size;                /* Number of nodes. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+/* Basic life cycle. */
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+
+/* Modification. */
+void rb_insert (struct rb_tree *, struct rb_node *);
+void rb_remove (struct rb_tree *, struct rb_node *);
+
+/* Searches. */
+struct rb_node *rb_find (const struct rb_tree *, const struct rb_node *);
+struct rb_node *rb_lower_bound (const struct rb_tree *,
+                                const struct rb_node *);
+struct rb_node *rb_upper_bound (const struct rb_tree *,
+                                const struct rb_node *);
+
+/* In-order traversal. */
+struct rb_node *rb_first (const struct rb_tree *);
+struct rb_node *rb_last (const struct rb_tree *);
+struct rb_node *rb_next (const struct rb_node *);
+struct rb_node *rb_prev (const struct rb_node *);
+
+/* Information. */
+size_t rb_size (const struct rb_tree *);
+bool rb_empty (const struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
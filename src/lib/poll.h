@@ -0,0 +1,22 @@
+#ifndef __LIB_POLL_H
+#define __LIB_POLL_H
+
+/* Events a descriptor passed to the poll system call can be ready
+   for.  POLLERR, POLLHUP and POLLNVAL are reported whether asked
+   for or not. */
+#define POLLIN 0x01             /* Can read without blocking. */
+#define POLLOUT 0x04            /* Can write without blocking. */
+#define POLLERR 0x08            /* Pipe's read end is closed. */
+#define POLLHUP 0x10            /* Pipe's write end is closed. */
+#define POLLNVAL 0x20           /* Descriptor is not open. */
+
+/* One descriptor for the poll system call.  A negative FD is
+   skipped, with REVENTS set to 0. */
+struct pollfd
+  {
+    int fd;                     /* Descriptor to watch. */
+    short events;               /* Events asked for. */
+    short revents;              /* Events that are ready. */
+  };
+
+#endif /* lib/poll.h */
@@ -0,0 +1,25 @@
+#ifndef __LIB_RUSAGE_H
+#define __LIB_RUSAGE_H
+
+#include <stdint.h>
+
+/* Whose resource usage the getrusage system call reports. */
+#define RUSAGE_SELF 0           /* The calling process, all its threads. */
+#define RUSAGE_CHILDREN 1       /* Children it waited for, and theirs. */
+#define RUSAGE_THREAD 2         /* The calling thread alone. */
+
+/* Resources used, as returned by the getrusage system call. */
+struct rusage
+  {
+    uint64_t user_ticks;        /* Timer ticks running user code. */
+    uint64_t kernel_ticks;      /* Timer ticks running in the kernel. */
+    uint64_t minor_faults;      /* Page faults that read no disk. */
+    uint64_t major_faults;      /* Page faults that read a disk. */
+    uint64_t swap_ins;          /* Pages read back from swap. */
+    uint64_t block_reads;       /* Block read requests issued. */
+    uint64_t block_writes;      /* Block write requests issued. */
+    uint64_t voluntary_switches;   /* Times it blocked or exited. */
+    uint64_t involuntary_switches; /* Times it was preempted or yielded. */
+  };
+
+#endif /* lib/rusage.h */
@@ -0,0 +1,31 @@
+#ifndef __LIB_SCSTAT_H
+#define __LIB_SCSTAT_H
+
+#include <stdint.h>
+
+/* Number of counter slots, indexed by SYS_* number.  Must be more
+   than the highest system call number. */
+#define SCSTAT_CNT 64
+
+/* Which counters the scstat system call reports. */
+#define SCSTAT_SELF 0           /* The calling process's. */
+#define SCSTAT_ALL 1            /* Every process's, since boot. */
+
+/* Counters for one system call.  A call counts as an error if it
+   returns -1.  Cycles are TSC cycles from dispatch to return, so
+   calls that never return (exit, halt) add none. */
+struct sc_stat
+  {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t cycles;            /* Total. */
+    uint64_t max_cycles;        /* Slowest single call. */
+  };
+
+/* System call statistics, as returned by the scstat system call. */
+struct sc_stats
+  {
+    struct sc_stat sc[SCSTAT_CNT];
+  };
+
+#endif /* lib/scstat.h */
@@ -0,0 +1,34 @@
+#ifndef __LIB_SCTRACE_H
+#define __LIB_SCTRACE_H
+
+#include <stdint.h>
+
+/* System call traces, as the kernel writes them at the exit of a
+   process traced with "-sctrace=PROG".  A trace file is a header
+   followed by its records, oldest first. */
+
+#define SCTRACE_MAGIC 0x52544353 /* "SCTR". */
+#define SCTRACE_ARGS 4          /* Argument words kept per call. */
+#define SCTRACE_PATH 32         /* Bytes of a file name argument kept. */
+
+struct sctrace_header
+  {
+    uint32_t magic;             /* SCTRACE_MAGIC. */
+    uint32_t rec_cnt;           /* Records that follow. */
+    uint64_t dropped;           /* Older calls the ring overwrote. */
+    uint64_t ns_per_mcycle;     /* Nanoseconds per 1,000,000 TSC cycles. */
+  };
+
+/* One system call.  Calls that never return (exit, halt) keep a
+   result and cycle count of 0. */
+struct sctrace_rec
+  {
+    uint32_t nr;                /* SYS_* number. */
+    uint32_t args[SCTRACE_ARGS]; /* Argument words, as passed. */
+    uint32_t result;            /* Value returned in eax. */
+    uint64_t tsc;               /* Time-stamp counter at entry. */
+    uint64_t cycles;            /* TSC cycles from dispatch to return. */
+    char path[SCTRACE_PATH];    /* File name argument, cut short, or "". */
+  };
+
+#endif /* lib/sctrace.h */
@@ -0,0 +1,71 @@
+#ifndef __LIB_STATS_H
+#define __LIB_STATS_H
+
+#include <stdint.h>
+#include <blkstat.h>
+#include <scstat.h>
+#include <vmstat.h>
+
+/* Categories of statistics that the stats system call reports,
+   and the structure each one fills in. */
+#define STATS_VM 0              /* struct vm_stats. */
+#define STATS_CACHE 1           /* struct cache_stats. */
+#define STATS_SCHED 2           /* struct sched_stats. */
+#define STATS_SYSCALL 3         /* struct sc_stats, for every process. */
+#define STATS_BLOCK 4           /* struct blk_stats for the device
+                                   playing role STATS_BLOCK + BLKSTAT_*. */
+#define STATS_IDE (STATS_BLOCK + BLKSTAT_SWAP + 1) /* struct ide_stats. */
+#define STATS_CNT (STATS_IDE + 1)
+
+/* The structures only ever grow, by new members at their ends, so
+   a program built against an older kernel reads the members it
+   knows about.  stats() copies out no more than the caller asks
+   for and returns the size the kernel has, which tells the caller
+   which members it filled in. */
+
+/* Buffer cache statistics. */
+struct cache_stats
+  {
+    uint64_t hits;              /* Lookups that found the sector. */
+    uint64_t misses;            /* Lookups that took a new entry. */
+    uint64_t evict_writes;      /* Dirty victims written on eviction. */
+    uint64_t writebacks;        /* Sectors written back in the background
+                                   or by cache_flush(). */
+    uint64_t readaheads;        /* Sectors queued for read-ahead. */
+    uint32_t dirty;             /* Entries dirty now. */
+    uint32_t size;              /* Entries in total. */
+    uint64_t drops;             /* Clean sectors dropped on advice. */
+    uint64_t prefetches;        /* Sectors read in by cache_prefetch(). */
+  };
+
+/* Number of buckets in the ready wait histogram.  Bucket N counts
+   waits in the ready queue of 2**N to 2**(N+1)-1 TSC cycles. */
+#define SCHED_WAIT_BUCKETS 32
+
+/* Scheduler statistics. */
+struct sched_stats
+  {
+    uint64_t idle_ticks;        /* Timer ticks spent idle. */
+    uint64_t kernel_ticks;      /* Timer ticks in kernel threads. */
+    uint64_t user_ticks;        /* Timer ticks in user programs. */
+    uint64_t voluntary_switches;   /* Blocks and yields. */
+    uint64_t involuntary_switches; /* Preemptions. */
+    uint32_t threads;           /* Threads alive now. */
+    uint32_t ready;             /* Threads ready to run now. */
+    uint64_t ready_waits[SCHED_WAIT_BUCKETS]; /* Ready wait histogram. */
+  };
+
+/* Number of IDE channels. */
+#define IDE_CHANNELS 2
+
+/* IDE statistics, for each channel and for both at once. */
+struct ide_stats
+  {
+    uint64_t transfers[IDE_CHANNELS]; /* Transfers done. */
+    uint64_t busy_ns[IDE_CHANNELS];   /* Time spent transferring. */
+    uint32_t max_in_flight[IDE_CHANNELS]; /* Most transfers waiting for
+                                         or using a channel at once. */
+    uint64_t overlap_ns;        /* Time both channels were busy. */
+  };
+
+#endif /* lib/stats.h */
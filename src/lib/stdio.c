@@ -13,7 +13,7 @@ struct vsnprintf_aux
     int max_length;     /* Max length of output string. */
   };
 
-static void vsnprintf_helper (char, void *);
+static void vsnprintf_helper (const char *, size_t, void *);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -43,12 +43,18 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
 
 /* Helper function for vsnprintf(). */
 static void
-vsnprintf_helper (char ch, void *aux_)
+vsnprintf_helper (const char *run, size_t cnt, void *aux_)
 {
   struct vsnprintf_aux *aux = aux_;
+  size_t room = aux->max_length - aux->length;
 
-  if (aux->length++ < aux->max_length)
-    *aux->p++ = ch;
+  if (aux->length < aux->max_length)
+    {
+      size_t n = cnt < room ? cnt : room;
+      memcpy (aux->p, run, n);
+      aux->p += n;
+    }
+  aux->length += cnt;
 }
 
 /* Like printf(), except that output is stored into BUFFER,
@@ -88,7 +94,12 @@ printf (const char *format, ...)
   return retval;
 }
 
-/* printf() formatting internals. */
+/* printf() formatting internals.
+
+   The formatter hands its output to the OUTPUT function in runs:
+   whole spans of literal text from the format string, each
+   converted number, each string argument and padding in chunks,
+   so that sinks can copy or write them out in bulk. */
 
 /* A printf() conversion. */
 struct printf_conversion 
@@ -146,25 +157,29 @@ static const char *parse_conversion (const char *format,
 static void format_integer (uintmax_t value, bool is_signed, bool negative, 
                             const struct integer_base *,
                             const struct printf_conversion *,
-                            void (*output) (char, void *), void *aux);
+                            printf_output_func *output, void *aux);
 static void output_dup (char ch, size_t cnt,
-                        void (*output) (char, void *), void *aux);
+                        printf_output_func *output, void *aux);
 static void format_string (const char *string, int length,
                            struct printf_conversion *,
-                           void (*output) (char, void *), void *aux);
+                           printf_output_func *output, void *aux);
 
 void
 __vprintf (const char *format, va_list args,
-           void (*output) (char, void *), void *aux)
+           printf_output_func *output, void *aux)
 {
   for (; *format != '\0'; format++)
     {
       struct printf_conversion c;
 
-      /* Literally copy non-conversions to output. */
+      /* Literally copy non-conversions to output, a span at a
+         time. */
       if (*format != '%') 
         {
-          output (*format, aux);
+          const char *start = format;
+          while (format[1] != '\0' && format[1] != '%')
+            format++;
+          output (start, format - start + 1, aux);
           continue;
         }
       format++;
@@ -172,7 +187,7 @@ __vprintf (const char *format, va_list args,
       /* %% => %. */
       if (*format == '%') 
         {
-          output ('%', aux);
+          output ("%", 1, aux);
           continue;
         }
 
@@ -470,9 +485,9 @@ static void
 format_integer (uintmax_t value, bool is_signed, bool negative, 
                 const struct integer_base *b,
                 const struct printf_conversion *c,
-                void (*output) (char, void *), void *aux)
+                printf_output_func *output, void *aux)
 {
-  char buf[64], *cp;            /* Buffer and current position. */
+  char buf[64], *cp;            /* Buffer and start of the digits. */
   int x;                        /* `x' character to use or 0 if none. */
   int sign;                     /* Sign character or 0 if none. */
   int precision;                /* Rendered precision. */
@@ -498,60 +513,85 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
      nonzero value with the # flag. */
   x = (c->flags & POUND) && value ? b->x : 0;
 
-  /* Accumulate digits into buffer.
-     This algorithm produces digits in reverse order, so later we
-     will output the buffer's content in reverse. */
-  cp = buf;
+  /* Accumulate digits into the end of the buffer, from least
+     significant back, so that they read forward from CP. */
+  cp = buf + sizeof buf;
   digit_cnt = 0;
   while (value > 0) 
     {
       if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-        *cp++ = ',';
-      *cp++ = b->digits[value % b->base];
+        *--cp = ',';
+      *--cp = b->digits[value % b->base];
       value /= b->base;
       digit_cnt++;
     }
 
-  /* Append enough zeros to match precision.
+  /* Prepend enough zeros to match precision, leaving room in front
+     for a sign and `0x'.
      If requested precision is 0, then a value of zero is
      rendered as a null string, otherwise as "0".
      If the # flag is used with base 8, the result must always
      begin with a zero. */
   precision = c->precision < 0 ? 1 : c->precision;
-  while (cp - buf < precision && cp < buf + sizeof buf - 1)
-    *cp++ = '0';
-  if ((c->flags & POUND) && b->base == 8 && (cp == buf || cp[-1] != '0'))
-    *cp++ = '0';
+  while (buf + sizeof buf - cp < precision && cp > buf + 4)
+    *--cp = '0';
+  if ((c->flags & POUND) && b->base == 8
+      && (cp == buf + sizeof buf || *cp != '0'))
+    *--cp = '0';
 
   /* Calculate number of pad characters to fill field width. */
-  pad_cnt = c->width - (cp - buf) - (x ? 2 : 0) - (sign != 0);
+  pad_cnt = c->width - (buf + sizeof buf - cp) - (x ? 2 : 0) - (sign != 0);
   if (pad_cnt < 0)
     pad_cnt = 0;
 
-  /* Do output. */
+  /* Do output.  Without padding, or with zero padding, the sign
+     and `0x' go right in front of the digits, in the same run. */
   if ((c->flags & (MINUS | ZERO)) == 0)
     output_dup (' ', pad_cnt, output, aux);
-  if (sign)
-    output (sign, aux);
-  if (x) 
+  if (c->flags & ZERO)
     {
-      output ('0', aux);
-      output (x, aux); 
+      char prefix[3], *pp = prefix;
+
+      if (sign)
+        *pp++ = sign;
+      if (x)
+        {
+          *pp++ = '0';
+          *pp++ = x;
+        }
+      if (pp > prefix)
+        output (prefix, pp - prefix, aux);
+      output_dup ('0', pad_cnt, output, aux);
     }
-  if (c->flags & ZERO)
-    output_dup ('0', pad_cnt, output, aux);
-  while (cp > buf)
-    output (*--cp, aux);
+  else
+    {
+      if (x)
+        {
+          *--cp = x;
+          *--cp = '0';
+        }
+      if (sign)
+        *--cp = sign;
+    }
+  output (cp, buf + sizeof buf - cp, aux);
   if (c->flags & MINUS)
     output_dup (' ', pad_cnt, output, aux);
 }
 
 /* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
 static void
-output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) 
+output_dup (char ch, size_t cnt, printf_output_func *output, void *aux) 
 {
-  while (cnt-- > 0)
-    output (ch, aux);
+  char run[16];
+  size_t n = cnt < sizeof run ? cnt : sizeof run;
+
+  memset (run, ch, n);
+  while (cnt > 0)
+    {
+      n = cnt < sizeof run ? cnt : sizeof run;
+      output (run, n, aux);
+      cnt -= n;
+    }
 }
 
 /* Formats the LENGTH characters starting at STRING according to
@@ -560,13 +600,11 @@ output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux)
 static void
 format_string (const char *string, int length,
                struct printf_conversion *c,
-               void (*output) (char, void *), void *aux) 
+               printf_output_func *output, void *aux) 
 {
-  int i;
   if (c->width > length && (c->flags & MINUS) == 0)
     output_dup (' ', c->width - length, output, aux);
-  for (i = 0; i < length; i++)
-    output (string[i], aux);
+  output (string, length, aux);
   if (c->width > length && (c->flags & MINUS) != 0)
     output_dup (' ', c->width - length, output, aux);
 }
@@ -575,7 +613,7 @@ format_string (const char *string, int length,
    va_list. */
 void
 __printf (const char *format,
-          void (*output) (char, void *), void *aux, ...) 
+          printf_output_func *output, void *aux, ...) 
 {
   va_list args;
 
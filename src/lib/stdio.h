@@ -27,11 +27,13 @@ int puts (const char *);
 void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
 void print_human_readable_size (uint64_t sz);
 
-/* Internal functions. */
+/* Internal functions.  The formatter passes its output to OUTPUT
+   as runs of SIZE characters, which are not null-terminated. */
+typedef void printf_output_func (const char *run, size_t size, void *aux);
 void __vprintf (const char *format, va_list args,
-                void (*output) (char, void *), void *aux);
-void __printf (const char *format,
-               void (*output) (char, void *), void *aux, ...);
+                printf_output_func *output, void *aux);
+void __printf (const char *format, printf_output_func *output, void *aux,
+               ...);
 
 /* Try to be helpful. */
 #define sprintf dont_use_sprintf_use_snprintf
@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -52,7 +53,7 @@ compare_thunk (const void *a, const void *b, void *aux)
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void
 qsort (void *array, size_t cnt, size_t size,
@@ -61,21 +62,51 @@ qsort (void *array, size_t cnt, size_t size,
   sort (array, cnt, size, compare_thunk, &compare);
 }
 
+/* Swaps the SIZE-byte elements at A and B.  4- and 8-byte
+   elements, the usual ints and pointers and pairs of them, get
+   loops of their own. */
+static inline void
+swap_elems (unsigned char *a, unsigned char *b, size_t size)
+{
+  typedef uint32_t __attribute__ ((may_alias)) word;
+
+  if (size == 4)
+    {
+      word t = *(word *) a;
+      *(word *) a = *(word *) b;
+      *(word *) b = t;
+    }
+  else if (size == 8)
+    {
+      word t0 = ((word *) a)[0], t1 = ((word *) a)[1];
+      ((word *) a)[0] = ((word *) b)[0];
+      ((word *) a)[1] = ((word *) b)[1];
+      ((word *) b)[0] = t0;
+      ((word *) b)[1] = t1;
+    }
+  else
+    {
+      for (; size >= 4; size -= 4, a += 4, b += 4)
+        {
+          word t = *(word *) a;
+          *(word *) a = *(word *) b;
+          *(word *) b = t;
+        }
+      for (; size > 0; size--, a++, b++)
+        {
+          unsigned char t = *a;
+          *a = *b;
+          *b = t;
+        }
+    }
+}
+
 /* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
    with elements of SIZE bytes each. */
 static void
 do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
-  size_t i;
-
-  for (i = 0; i < size; i++)
-    {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
-    }
+  swap_elems (array + (a_idx - 1) * size, array + (b_idx - 1) * size, size);
 }
 
 /* Compares elements with 1-based indexes A_IDX and B_IDX in
@@ -122,33 +153,142 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
     }
 }
 
+/* Heapsorts ARRAY, which contains CNT elements of SIZE bytes
+   each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+heap_sort (unsigned char *array, size_t cnt, size_t size,
+           int (*compare) (const void *, const void *, void *aux),
+           void *aux)
+{
+  size_t i;
+
+  /* Build a heap. */
+  for (i = cnt / 2; i > 0; i--)
+    heapify (array, i, cnt, size, compare, aux);
+
+  /* Sort the heap. */
+  for (i = cnt; i > 1; i--) 
+    {
+      do_swap (array, 1, i, size);
+      heapify (array, 1, i - 1, size, compare, aux); 
+    }
+}
+
+/* Ranges this short are insertion sorted. */
+#define INSERTION_SORT_MAX 12
+
+/* Insertion sorts ARRAY, which contains CNT elements of SIZE
+   bytes each, using COMPARE to compare elements, passing AUX as
+   auxiliary data. */
+static void
+insertion_sort (unsigned char *array, size_t cnt, size_t size,
+                int (*compare) (const void *, const void *, void *aux),
+                void *aux)
+{
+  unsigned char *end = array + cnt * size;
+  unsigned char *p, *q;
+
+  for (p = array + size; p < end; p += size)
+    for (q = p; q > array && compare (q - size, q, aux) > 0; q -= size)
+      swap_elems (q - size, q, size);
+}
+
+/* Introsorts ARRAY, which contains CNT elements of SIZE bytes
+   each, using COMPARE to compare elements, passing AUX as
+   auxiliary data.  Quicksorts with median-of-three pivots, but
+   heapsorts a range that is still big after DEPTH partitioning
+   steps, which bounds the time at O(n lg n), and leaves short
+   ranges to insertion sort.  Recursing only into the smaller side
+   of each partition bounds the stack at O(lg n). */
+static void
+intro_sort (unsigned char *array, size_t cnt, size_t size,
+            int (*compare) (const void *, const void *, void *aux),
+            void *aux, int depth)
+{
+  while (cnt > INSERTION_SORT_MAX)
+    {
+      unsigned char *lo = array;
+      unsigned char *mid = array + cnt / 2 * size;
+      unsigned char *hi = array + (cnt - 1) * size;
+      unsigned char *i, *j;
+      size_t left_cnt, right_cnt;
+
+      if (depth-- == 0)
+        {
+          heap_sort (array, cnt, size, compare, aux);
+          return;
+        }
+
+      /* Order LO, MID and HI, then move the median, the pivot, to
+         the front.  HI is then no less than the pivot, which stops
+         the scan up, and the pivot itself stops the scan down. */
+      if (compare (mid, lo, aux) < 0)
+        swap_elems (mid, lo, size);
+      if (compare (hi, mid, aux) < 0)
+        {
+          swap_elems (hi, mid, size);
+          if (compare (mid, lo, aux) < 0)
+            swap_elems (mid, lo, size);
+        }
+      swap_elems (lo, mid, size);
+
+      /* Partition around the pivot and put it between the
+         halves. */
+      i = lo;
+      j = array + cnt * size;
+      for (;;)
+        {
+          do
+            i += size;
+          while (compare (i, lo, aux) < 0);
+          do
+            j -= size;
+          while (compare (j, lo, aux) > 0);
+          if (i >= j)
+            break;
+          swap_elems (i, j, size);
+        }
+      swap_elems (lo, j, size);
+
+      left_cnt = (j - array) / size;
+      right_cnt = cnt - left_cnt - 1;
+      if (left_cnt < right_cnt)
+        {
+          intro_sort (array, left_cnt, size, compare, aux, depth);
+          array = j + size;
+          cnt = right_cnt;
+        }
+      else
+        {
+          intro_sort (j + size, right_cnt, size, compare, aux, depth);
+          cnt = left_cnt;
+        }
+    }
+  insertion_sort (array, cnt, size, compare, aux);
+}
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE to compare elements, passing AUX as auxiliary
    data.  When COMPARE is passed a pair of elements A and B,
    respectively, it must return a strcmp()-type result, i.e. less
    than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
 void
 sort (void *array, size_t cnt, size_t size,
       int (*compare) (const void *, const void *, void *aux),
       void *aux) 
 {
-  size_t i;
+  int depth = 0;
+  size_t n;
 
   ASSERT (array != NULL || cnt == 0);
   ASSERT (compare != NULL);
   ASSERT (size > 0);
 
-  /* Build a heap. */
-  for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
-
-  /* Sort the heap. */
-  for (i = cnt; i > 1; i--) 
-    {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
-    }
+  for (n = cnt; n > 1; n /= 2)
+    depth += 2;
+  intro_sort (array, cnt, size, compare, aux, depth);
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
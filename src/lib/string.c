@@ -1,5 +1,24 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* memcpy(), memmove() and memset() handle blocks at least this
+   long a 32-bit word at a time, with REP MOVSL and REP STOSL once
+   the destination is word-aligned.  Shorter blocks are not worth
+   the string instructions' startup cost. */
+#define WORD_BLOCK_MIN 32
+
+/* A 32-bit word that may alias any other type.  x86 allows the
+   unaligned accesses that memmove() and memcmp() make with it. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
+
+/* Nonzero if and only if word W has a zero byte: the lowest byte
+   of W whose top bit the subtraction sets but W does not have set
+   is a zero byte.  strlen(), strchr() and memchr() scan whole
+   aligned words with it.  An aligned word never crosses a page
+   boundary, so reading all of one that holds the end of a string
+   or block cannot fault. */
+#define HAS_ZERO(W) (((W) - 0x01010101u) & ~(W) & 0x80808080u)
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +31,18 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= WORD_BLOCK_MIN)
+    {
+      /* Align DST, then move whole words. */
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+
+      size -= head + words * 4;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -29,20 +60,29 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
-  else 
+  /* Copying upward, as memcpy() does, is safe unless DST starts
+     inside SRC: REP MOVS moves one element at a time, so it reads
+     each byte before overwriting it. */
+  if (dst <= src || dst >= src + size)
+    return memcpy (dst_, src_, size);
+
+  dst += size;
+  src += size;
+  if (size >= WORD_BLOCK_MIN)
     {
-      dst += size;
-      src += size;
-      while (size-- > 0)
+      for (; (uintptr_t) dst & 3; size--)
         *--dst = *--src;
+      for (; size >= 4; size -= 4)
+        {
+          dst -= 4;
+          src -= 4;
+          *(word_t *) dst = *(const word_t *) src;
+        }
     }
+  while (size-- > 0)
+    *--dst = *--src;
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +98,12 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words, then find the differing byte. */
+  for (; size >= 4 && *(const word_t *) a == *(const word_t *) b; size -= 4)
+    {
+      a += 4;
+      b += 4;
+    }
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -98,6 +144,20 @@ memchr (const void *block_, int ch_, size_t size)
 
   ASSERT (block != NULL || size == 0);
 
+  for (; size > 0 && ((uintptr_t) block & 3) != 0; size--, block++)
+    if (*block == ch)
+      return (void *) block;
+  if (size >= 4)
+    {
+      uint32_t pattern = ch * 0x01010101u;
+
+      for (; size >= 4; size -= 4, block += 4)
+        {
+          uint32_t w = *(const word_t *) block ^ pattern;
+          if (HAS_ZERO (w))
+            break;
+        }
+    }
   for (; size-- > 0; block++)
     if (*block == ch)
       return (void *) block;
@@ -113,9 +173,24 @@ char *
 strchr (const char *string, int c_) 
 {
   char c = c_;
+  uint32_t pattern = (unsigned char) c * 0x01010101u;
 
   ASSERT (string != NULL);
 
+  /* Skip whole words that hold neither C nor a null terminator. */
+  for (; ((uintptr_t) string & 3) != 0; string++)
+    if (*string == c)
+      return (char *) string;
+    else if (*string == '\0')
+      return NULL;
+  for (;;)
+    {
+      uint32_t w = *(const word_t *) string;
+      if (HAS_ZERO (w) || HAS_ZERO (w ^ pattern))
+        break;
+      string += 4;
+    }
+
   for (;;) 
     if (*string == c)
       return (char *) string;
@@ -281,7 +356,20 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORD_BLOCK_MIN)
+    {
+      /* Align DST, then store whole words of VALUE. */
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+      uint32_t pattern = (unsigned char) value * 0x01010101u;
+
+      size -= head + words * 4;
+      asm volatile ("rep stosb"
+                    : "+D" (dst), "+c" (head) : "a" (pattern) : "memory");
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (pattern) : "memory");
+    }
   while (size-- > 0)
     *dst++ = value;
 
@@ -296,7 +384,12 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
+  for (p = string; ((uintptr_t) p & 3) != 0; p++)
+    if (*p == '\0')
+      return p - string;
+  while (!HAS_ZERO (*(const word_t *) p))
+    p += 4;
+  for (; *p != '\0'; p++)
     continue;
   return p - string;
 }
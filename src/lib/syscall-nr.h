@@ -28,7 +28,71 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_VMSTAT,                 /* Reports virtual memory statistics. */
+    SYS_MMAP_FLAGS,             /* Map a file into memory, with flags. */
+    SYS_MSYNC,                  /* Write back part of a memory mapping. */
+    SYS_MADVISE,                /* Advise on the use of memory. */
+    SYS_MMAP_ANON,              /* Map anonymous memory. */
+    SYS_SBRK,                   /* Grow or shrink the heap. */
+    SYS_READV,                  /* Read into several buffers. */
+    SYS_WRITEV,                 /* Write from several buffers. */
+    SYS_PREAD,                  /* Read from a file at an offset. */
+    SYS_PWRITE,                 /* Write to a file at an offset. */
+    SYS_COPY_FILE_RANGE,        /* Copy between files in the kernel. */
+    SYS_RING_SETUP,             /* Register a batched syscall ring. */
+    SYS_RING_ENTER,             /* Run the operations queued on the ring. */
+    SYS_SCSTAT,                 /* Reports system call statistics. */
+    SYS_FORK,                   /* Duplicates the calling process. */
+    SYS_SPAWN,                  /* Starts a process without waiting. */
+    SYS_GETTIME,                /* Reads the monotonic clock. */
+    SYS_FUTEX_WAIT,             /* Sleeps on a user lock word. */
+    SYS_FUTEX_WAKE,             /* Wakes sleepers on a user lock word. */
+    SYS_THREAD_SPAWN,           /* Starts a thread in the same process. */
+    SYS_ALLOCSTAT,              /* Prints kernel allocator statistics. */
+    SYS_FALLOCATE,              /* Reserves disk space for a file. */
+    SYS_FSYNC,                  /* Writes a file's data to disk. */
+    SYS_SYNC,                   /* Writes all cached data to disk. */
+    SYS_BLKSTAT,                /* Reports block device statistics. */
+    SYS_STATS,                  /* Reports one category of statistics. */
+    SYS_MSLEEP,                 /* Sleeps for a number of milliseconds. */
+    SYS_PIPE,                   /* Opens a pipe. */
+    SYS_SHM_CREATE,             /* Creates a shared memory segment. */
+    SYS_SHM_ATTACH,             /* Maps a shared memory segment. */
+    SYS_SHM_DETACH,             /* Unmaps a shared memory segment. */
+    SYS_GETDENTS,               /* Reads a batch of directory entries. */
+    SYS_SETPRIORITY,            /* Sets the calling thread's priority. */
+    SYS_NICE,                   /* Changes the calling thread's niceness. */
+    SYS_GETRUSAGE,              /* Reports resources used. */
+    SYS_WAIT_ANY,               /* Waits for whichever child exits first. */
+    SYS_POLL,                   /* Waits for descriptors to be ready. */
+    SYS_FADVISE,                /* Advises how a file will be read. */
+    SYS_GETTUNABLE,             /* Reports a kernel tunable. */
+    SYS_SETTUNABLE,             /* Changes a kernel tunable. */
+    SYS_SNAPSHOT,               /* Saves the calling process to a file. */
+    SYS_RESTORE                 /* Starts a process from a snapshot. */
   };
 
+/* Flags for SYS_WAIT_ANY. */
+#define WAIT_NOHANG 0x1         /* Return 0 at once if no child exited. */
+
+/* Flags for SYS_MMAP_FLAGS. */
+#define MAP_POPULATE 0x1        /* Read the whole mapping in right away. */
+
+/* Advice for SYS_MADVISE. */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random access: no readahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED 3         /* Will be needed soon: read it in. */
+#define MADV_DONTNEED 4         /* Contents no longer needed. */
+
+/* Advice for SYS_FADVISE. */
+#define FADV_NORMAL 0           /* No special treatment. */
+#define FADV_RANDOM 1           /* Expect random reads: no readahead. */
+#define FADV_SEQUENTIAL 2       /* Expect one sequential pass. */
+#define FADV_WILLNEED 3         /* Will be read soon: read it in. */
+#define FADV_DONTNEED 4         /* Not read again soon: uncache it. */
+
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,33 @@
+#ifndef __LIB_SYSENTER_H
+#define __LIB_SYSENTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Returns true if the CPU has the SYSENTER and SYSEXIT
+   instructions, which CPUID reports in bit 11 (SEP) of EDX for
+   leaf 1.  Pentium Pros before model 3, stepping 3 set the bit
+   without implementing the instructions.
+
+   The kernel asks this before setting up SYSENTER and the user
+   library asks it before using it, so a process enters through
+   SYSENTER exactly when the kernel is ready for it.  See
+   [IA32-v3a] 5.8.7 "Performing Fast Calls to System Procedures
+   with the SYSENTER and SYSEXIT Instructions". */
+static inline bool
+sysenter_supported (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if (!(edx & (1u << 11)))
+    return false;
+
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  return !(family == 6 && model < 3 && stepping < 3);
+}
+
+#endif /* lib/sysenter.h */
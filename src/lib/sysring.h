@@ -0,0 +1,51 @@
+#ifndef __LIB_SYSRING_H
+#define __LIB_SYSRING_H
+
+#include <stdint.h>
+
+/* Batched system calls.  A process registers a struct sys_ring with
+   ring_setup(), queues operations in its submission array, and has the
+   kernel run all queued operations with a single ring_enter() trap.
+   Each finished operation posts its result to the completion array.
+
+   Heads and tails count up without wrapping; entry N of an array is
+   at index N % ENTRIES.  The process writes sq_tail and cq_head, and
+   the kernel writes sq_head and cq_tail. */
+
+/* Operations. */
+#define RING_OP_READ 0          /* read (fd, buf, len) */
+#define RING_OP_WRITE 1         /* write (fd, buf, len) */
+#define RING_OP_SEEK 2          /* seek (fd, offset) */
+#define RING_OP_PREAD 3         /* pread (fd, buf, len, offset) */
+#define RING_OP_PWRITE 4        /* pwrite (fd, buf, len, offset) */
+
+/* A queued operation. */
+struct ring_sqe
+  {
+    uint32_t op;                /* RING_OP_*. */
+    int32_t fd;                 /* File descriptor. */
+    void *buf;                  /* Buffer, for reads and writes. */
+    uint32_t len;               /* Bytes to transfer. */
+    uint32_t offset;            /* File offset, for seek and p*. */
+    uint32_t user_data;         /* Copied to the completion. */
+  };
+
+/* A finished operation. */
+struct ring_cqe
+  {
+    uint32_t user_data;         /* From the submission. */
+    int32_t result;             /* What the system call returned, or -1
+                                   for an unknown op. */
+  };
+
+/* A submission and completion ring. */
+struct sys_ring
+  {
+    uint32_t entries;           /* Entries in each array. */
+    uint32_t sq_head, sq_tail;  /* Submissions consumed, queued. */
+    uint32_t cq_head, cq_tail;  /* Completions consumed, posted. */
+    struct ring_sqe *sqes;      /* Submission array. */
+    struct ring_cqe *cqes;      /* Completion array. */
+  };
+
+#endif /* lib/sysring.h */
@@ -0,0 +1,15 @@
+#ifndef __LIB_TUNABLE_H
+#define __LIB_TUNABLE_H
+
+/* Longest tunable name, counting the null terminator. */
+#define TUNABLE_NAME_MAX 32
+
+/* A kernel tunable, as reported by gettunable(). */
+struct tunable_info
+  {
+    char name[TUNABLE_NAME_MAX];        /* E.g. "sched.time_slice". */
+    int value;                          /* Current setting. */
+    int min, max;                       /* Settings accepted. */
+  };
+
+#endif /* lib/tunable.h */
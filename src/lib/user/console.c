@@ -8,7 +8,7 @@
 int
 vprintf (const char *format, va_list args) 
 {
-  return vhprintf (STDOUT_FILENO, format, args);
+  return vfprintf (stdout, format, args);
 }
 
 /* Like printf(), but writes output to the given HANDLE. */
@@ -30,7 +30,7 @@ hprintf (int handle, const char *format, ...)
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
+  fputs (s, stdout);
   putchar ('\n');
 
   return 0;
@@ -40,9 +40,7 @@ puts (const char *s)
 int
 putchar (int c) 
 {
-  char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
-  return c;
+  return fputc (c, stdout);
 }
 
 /* Auxiliary data for vhprintf_helper(). */
@@ -54,34 +52,46 @@ struct vhprintf_aux
     int handle;         /* Output file handle. */
   };
 
-static void add_char (char, void *);
+static void add_run (const char *, size_t, void *);
 static void flush (struct vhprintf_aux *);
 
 /* Formats the printf() format specification FORMAT with
    arguments given in ARGS and writes the output to the given
-   HANDLE. */
+   HANDLE.  Output to STDOUT_FILENO goes through stdout's buffer,
+   so that it stays in order with printf(). */
 int
 vhprintf (int handle, const char *format, va_list args) 
 {
   struct vhprintf_aux aux;
+
+  if (handle == STDOUT_FILENO)
+    return vfprintf (stdout, format, args);
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
-  __vprintf (format, args, add_char, &aux);
+  __vprintf (format, args, add_run, &aux);
   flush (&aux);
   return aux.char_cnt;
 }
 
-/* Adds C to the buffer in AUX, flushing it if the buffer fills
-   up. */
+/* Adds the SIZE characters in RUN to the buffer in AUX, flushing
+   it first if they do not fit.  Writes runs too big for the buffer
+   directly. */
 static void
-add_char (char c, void *aux_) 
+add_run (const char *run, size_t size, void *aux_) 
 {
   struct vhprintf_aux *aux = aux_;
-  *aux->p++ = c;
-  if (aux->p >= aux->buf + sizeof aux->buf)
+
+  if (aux->p + size > aux->buf + sizeof aux->buf)
     flush (aux);
-  aux->char_cnt++;
+  if (size >= sizeof aux->buf)
+    write (aux->handle, run, size);
+  else
+    {
+      memcpy (aux->p, run, size);
+      aux->p += size;
+    }
+  aux->char_cnt += size;
 }
 
 /* Flushes the buffer in AUX. */
@@ -1,4 +1,5 @@
 #include <syscall.h>
+#include <sysenter.h>
 
 int main (int, char *[]);
 void _start (int argc, char *argv[]);
@@ -6,5 +7,6 @@ void _start (int argc, char *argv[]);
 void
 _start (int argc, char *argv[]) 
 {
+  syscall_fast = sysenter_supported ();
   exit (main (argc, argv));
 }
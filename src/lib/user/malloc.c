@@ -0,0 +1,416 @@
+#include <stdlib.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* User-level malloc(), on top of the heap that sbrk() grows.
+
+   Like the kernel's malloc(), requests of up to half a page go to
+   the descriptor for the smallest size class that fits.  Each
+   descriptor carves one-page arenas into blocks of its size and
+   keeps a free list of them; an arena whose blocks are all free
+   again goes back to the page allocator below.  Threads started
+   with thread_spawn() share the heap, so one lock, built on
+   futex_wait() and futex_wake(), guards all of it.
+
+   Bigger requests take whole pages, with the page count stored
+   in the arena header at the start of the first page.
+
+   The page allocator hands out runs of pages, first fit from a
+   list of free spans kept in address order, and grows the heap
+   with sbrk() when none fits.  Freed runs are merged with their
+   neighbours.  Once a free span is RELEASE_PAGES or more long,
+   its pages are handed back to the kernel with
+   madvise(MADV_DONTNEED), except for the first, which holds the
+   span's header.  They read back as zeros if they are used again. */
+
+#define PGSIZE 4096
+#define pg_ofs(P) ((uintptr_t) (P) & (PGSIZE - 1))
+#define pg_round_down(P) ((void *) ((uintptr_t) (P) & ~(PGSIZE - 1)))
+
+/* Free spans this long or longer go back to the kernel. */
+#define RELEASE_PAGES 4
+
+/* Descriptor. */
+struct desc
+  {
+    size_t block_size;          /* Size of each element in bytes. */
+    size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    struct block *free_list;    /* Free blocks. */
+  };
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x75a1ec0d
+
+/* Arena, at the start of each page of small blocks and of each
+   big block.  16 bytes, to keep blocks 16-byte aligned. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    struct desc *desc;          /* Owning descriptor, null for big block. */
+    size_t free_cnt;            /* Free blocks; pages in big block. */
+    unsigned unused;
+  };
+
+/* Free block. */
+struct block
+  {
+    struct block *prev, *next;  /* Neighbours in the free list. */
+  };
+
+/* Free run of pages, stored in its first page. */
+struct span
+  {
+    size_t page_cnt;            /* Length in pages. */
+    struct span *next;          /* Next free span, in address order. */
+  };
+
+/* Size classes, about 1.5 apart so that no more than a third of a
+   block goes to waste. */
+#define DESC(SIZE) { SIZE, (PGSIZE - sizeof (struct arena)) / (SIZE), NULL }
+static struct desc descs[] =
+  {
+    DESC (16), DESC (32), DESC (48), DESC (64), DESC (96), DESC (128),
+    DESC (192), DESC (256), DESC (384), DESC (512), DESC (768),
+    DESC (1024), DESC (1360), DESC (2032),
+  };
+#define DESC_CNT (sizeof descs / sizeof *descs)
+
+static struct span *free_spans; /* Free spans, in address order. */
+static bool heap_aligned;       /* Has the heap been page aligned? */
+
+/* Heap lock: 0 if free, 1 if held, 2 if held and someone may be
+   sleeping on it. */
+static int heap_lock;
+
+/* Acquires the heap lock, sleeping while another thread has it. */
+static void
+lock_heap (void)
+{
+  int c = __sync_val_compare_and_swap (&heap_lock, 0, 1);
+
+  while (c != 0)
+    {
+      /* Mark the lock contended before sleeping, so that the
+         holder knows to wake us. */
+      if (c == 2 || __sync_val_compare_and_swap (&heap_lock, 1, 2) != 0)
+        futex_wait (&heap_lock, 2);
+      c = __sync_val_compare_and_swap (&heap_lock, 0, 2);
+    }
+}
+
+/* Releases the heap lock, waking a sleeper if there may be one. */
+static void
+unlock_heap (void)
+{
+  if (__sync_fetch_and_sub (&heap_lock, 1) != 1)
+    {
+      heap_lock = 0;
+      futex_wake (&heap_lock, 1);
+    }
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena *
+block_to_arena (struct block *b)
+{
+  struct arena *a = pg_round_down (b);
+
+  ASSERT (a->magic == ARENA_MAGIC);
+  ASSERT (a->desc == NULL
+          || ((uint8_t *) b - (uint8_t *) (a + 1)) % a->desc->block_size == 0);
+  return a;
+}
+
+/* Obtains PAGE_CNT contiguous pages from the heap and returns
+   them, or a null pointer if the heap cannot grow. */
+static void *
+get_pages (size_t page_cnt)
+{
+  struct span **sp, *s;
+  void *pages;
+
+  /* First fit. */
+  for (sp = &free_spans; (s = *sp) != NULL; sp = &s->next)
+    if (s->page_cnt >= page_cnt)
+      {
+        if (s->page_cnt == page_cnt)
+          *sp = s->next;
+        else
+          {
+            /* Hand out the end of the span, which leaves its
+               header where it is. */
+            s->page_cnt -= page_cnt;
+            return (uint8_t *) s + s->page_cnt * PGSIZE;
+          }
+        return s;
+      }
+
+  /* The program break starts wherever the data segment ended.
+     Round it up to a page boundary once. */
+  if (!heap_aligned)
+    {
+      uintptr_t brk = (uintptr_t) sbrk (0);
+      if (sbrk (ROUND_UP (brk, PGSIZE) - brk) == (void *) -1)
+        return NULL;
+      heap_aligned = true;
+    }
+  pages = sbrk (page_cnt * PGSIZE);
+  return pages != (void *) -1 ? pages : NULL;
+}
+
+/* Returns the PAGE_CNT pages at PAGES to the free spans. */
+static void
+put_pages (void *pages, size_t page_cnt)
+{
+  uint8_t *start = pages;
+  uint8_t *release = start + PGSIZE;
+  struct span *prev = NULL;
+  struct span *next = free_spans;
+  struct span *s;
+
+  /* Find the spans on either side and merge with them. */
+  while (next != NULL && (uint8_t *) next < start)
+    {
+      prev = next;
+      next = next->next;
+    }
+  if (prev != NULL && (uint8_t *) prev + prev->page_cnt * PGSIZE == start)
+    {
+      /* The first page no longer needs to hold a header. */
+      s = prev;
+      s->page_cnt += page_cnt;
+      release = start;
+    }
+  else
+    {
+      s = (struct span *) start;
+      s->page_cnt = page_cnt;
+      s->next = next;
+      if (prev != NULL)
+        prev->next = s;
+      else
+        free_spans = s;
+    }
+  if (next != NULL && start + page_cnt * PGSIZE == (uint8_t *) next)
+    {
+      s->page_cnt += next->page_cnt;
+      s->next = next->next;
+    }
+
+  /* Give the newly freed pages back to the kernel if the span is
+     long.  Pages merged in from NEXT were released, if at all,
+     when they were freed. */
+  if (s->page_cnt >= RELEASE_PAGES && release < start + page_cnt * PGSIZE)
+    madvise (release, start + page_cnt * PGSIZE - release, MADV_DONTNEED);
+}
+
+/* Does the work of malloc(), with the heap lock held. */
+static void *
+malloc_locked (size_t size)
+{
+  struct desc *d;
+  struct block *b;
+  struct arena *a;
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + DESC_CNT; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + DESC_CNT)
+    {
+      /* SIZE is too big for any descriptor.
+         Allocate enough pages to hold SIZE plus an arena. */
+      size_t page_cnt;
+
+      if (size > SIZE_MAX - sizeof *a - PGSIZE)
+        return NULL;
+      page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+      a = get_pages (page_cnt);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize the arena to indicate a big block of PAGE_CNT
+         pages, and return it. */
+      a->magic = ARENA_MAGIC;
+      a->desc = NULL;
+      a->free_cnt = page_cnt;
+      return a + 1;
+    }
+
+  /* If the free list is empty, create a new arena. */
+  if (d->free_list == NULL)
+    {
+      size_t i;
+
+      a = get_pages (1);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          b = (struct block *) ((uint8_t *) (a + 1) + i * d->block_size);
+          b->prev = NULL;
+          b->next = d->free_list;
+          if (d->free_list != NULL)
+            d->free_list->prev = b;
+          d->free_list = b;
+        }
+    }
+
+  /* Get a block from free list and return it. */
+  b = d->free_list;
+  d->free_list = b->next;
+  if (b->next != NULL)
+    b->next->prev = NULL;
+  block_to_arena (b)->free_cnt--;
+  return b;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  void *p;
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0)
+    return NULL;
+
+  lock_heap ();
+  p = malloc_locked (size);
+  unlock_heap ();
+  return p;
+}
+
+/* Allocates and returns A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  /* Allocate and zero memory. */
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+block_size (void *block)
+{
+  struct block *b = block;
+  struct arena *a = block_to_arena (b);
+  struct desc *d = a->desc;
+
+  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  else if (old_block != NULL && new_size <= block_size (old_block))
+    return old_block;
+  else
+    {
+      void *new_block = malloc (new_size);
+      if (old_block != NULL && new_block != NULL)
+        {
+          memcpy (new_block, old_block, block_size (old_block));
+          free (old_block);
+        }
+      return new_block;
+    }
+}
+
+/* Does the work of free() on block B, with the heap lock held. */
+static void
+free_locked (struct block *b)
+{
+  struct arena *a;
+  struct desc *d;
+
+  a = block_to_arena (b);
+  d = a->desc;
+  if (d == NULL)
+    {
+      /* It's a big block.  Free its pages. */
+      a->magic = 0;
+      put_pages (a, a->free_cnt);
+      return;
+    }
+
+#ifndef NDEBUG
+  /* Clear the block to help detect use-after-free bugs. */
+  memset (b, 0xcc, d->block_size);
+#endif
+
+  /* Add block to free list. */
+  b->prev = NULL;
+  b->next = d->free_list;
+  if (d->free_list != NULL)
+    d->free_list->prev = b;
+  d->free_list = b;
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena)
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *fb = (struct block *) ((uint8_t *) (a + 1)
+                                               + i * d->block_size);
+          if (fb->prev != NULL)
+            fb->prev->next = fb->next;
+          else
+            d->free_list = fb->next;
+          if (fb->next != NULL)
+            fb->next->prev = fb->prev;
+        }
+      a->magic = 0;
+      put_pages (a, 1);
+    }
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  if (p == NULL)
+    return;
+
+  lock_heap ();
+  free_locked (p);
+  unlock_heap ();
+}
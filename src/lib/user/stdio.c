@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Buffered streams over file descriptors.
+
+   A stream buffers either what it has read ahead or what it has
+   yet to write, never both: switching direction first flushes
+   pending output, or seeks back over unread input.  stdout is
+   line buffered, so that console output still appears a line at
+   a time, and stdin is unbuffered, because reading the console
+   waits until every byte asked for has been typed.  Streams that
+   fopen() and fdopen() return are fully buffered.  exit()
+   flushes every stream. */
+
+/* Buffering modes. */
+enum buffering
+  {
+    FULL_BUF,                   /* Write when the buffer fills. */
+    LINE_BUF,                   /* Also write at each new-line. */
+    NO_BUF                      /* Go straight to the descriptor. */
+  };
+
+/* A stream. */
+struct __FILE
+  {
+    bool in_use;                /* Open? */
+    int fd;                     /* File descriptor. */
+    bool readable, writable;    /* Mode given to fopen(). */
+    enum buffering buffering;
+    bool writing;               /* Does BUF hold output? */
+    bool eof, error;            /* Reached end of file, had an error? */
+    size_t pos, len;            /* Next byte and end of data in BUF. */
+    char buf[BUFSIZ];
+  };
+
+static FILE streams[FOPEN_MAX] =
+  {
+    { true, STDIN_FILENO, true, false, NO_BUF, false, false, false, 0, 0,
+      {0} },
+    { true, STDOUT_FILENO, false, true, LINE_BUF, false, false, false, 0, 0,
+      {0} },
+  };
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+
+/* Returns an unused stream for FD opened in MODE, or a null
+   pointer if MODE is invalid or every stream is in use. */
+static FILE *
+new_stream (int fd, const char *mode)
+{
+  bool readable = mode[0] == 'r' || strchr (mode, '+') != NULL;
+  bool writable = mode[0] != 'r' || strchr (mode, '+') != NULL;
+  size_t i;
+
+  if (fd < 0 || strchr ("rwa", mode[0]) == NULL)
+    return NULL;
+
+  for (i = 0; i < FOPEN_MAX; i++)
+    {
+      FILE *f = &streams[i];
+
+      if (!f->in_use)
+        {
+          memset (f, 0, sizeof *f);
+          f->in_use = true;
+          f->fd = fd;
+          f->readable = readable;
+          f->writable = writable;
+          f->buffering = FULL_BUF;
+          return f;
+        }
+    }
+  return NULL;
+}
+
+/* Opens file NAME as a stream.  MODE is "r" to read it, "w" to
+   write it from scratch, or "a" to write at its end, and may add
+   "+" to allow both reading and writing.  "w" and "a" create NAME
+   if it does not exist.  Returns the new stream, or a null
+   pointer on failure. */
+FILE *
+fopen (const char *name, const char *mode)
+{
+  FILE *f;
+  int fd;
+
+  if (mode[0] == 'w')
+    {
+      remove (name);
+      if (!create (name, 0))
+        return NULL;
+    }
+  else if (mode[0] == 'a')
+    create (name, 0);
+
+  fd = open (name);
+  if (fd < 0)
+    return NULL;
+  f = new_stream (fd, mode);
+  if (f == NULL)
+    {
+      close (fd);
+      return NULL;
+    }
+  if (mode[0] == 'a')
+    seek (fd, filesize (fd));
+  return f;
+}
+
+/* Returns a stream over the open file descriptor FD, opened in
+   MODE as for fopen(), or a null pointer on failure. */
+FILE *
+fdopen (int fd, const char *mode)
+{
+  return new_stream (fd, mode);
+}
+
+/* Writes out the output buffered in F, or drops the input read
+   ahead into it, seeking back so that the descriptor's position
+   matches F's. */
+static int
+drain (FILE *f)
+{
+  if (f->writing)
+    {
+      size_t ofs = 0;
+
+      while (ofs < f->len)
+        {
+          int n = write (f->fd, f->buf + ofs, f->len - ofs);
+          if (n <= 0)
+            {
+              f->error = true;
+              memmove (f->buf, f->buf + ofs, f->len - ofs);
+              f->len -= ofs;
+              return EOF;
+            }
+          ofs += n;
+        }
+      f->writing = false;
+    }
+  else if (f->pos < f->len)
+    seek (f->fd, tell (f->fd) - (f->len - f->pos));
+  f->pos = f->len = 0;
+  return 0;
+}
+
+/* Writes out any output buffered in F, or in every stream if F
+   is a null pointer.  Returns 0 if successful, EOF on error. */
+int
+fflush (FILE *f)
+{
+  int retval = 0;
+
+  if (f == NULL)
+    {
+      size_t i;
+
+      for (i = 0; i < FOPEN_MAX; i++)
+        if (streams[i].in_use && streams[i].writing
+            && drain (&streams[i]) == EOF)
+          retval = EOF;
+      return retval;
+    }
+  return f->writing ? drain (f) : 0;
+}
+
+/* Flushes and closes F, even if flushing fails.  Returns 0 if
+   successful, EOF on error. */
+int
+fclose (FILE *f)
+{
+  int retval = fflush (f);
+
+  if (f->fd != STDIN_FILENO && f->fd != STDOUT_FILENO)
+    close (f->fd);
+  f->in_use = false;
+  return retval;
+}
+
+/* Writes the SIZE bytes in BUFFER to F.  Returns the number of
+   bytes written, which is less than SIZE only on error. */
+static size_t
+put_bytes (const void *buffer, size_t size, FILE *f)
+{
+  const char *p = buffer;
+  size_t done = 0;
+
+  if (!f->writable)
+    {
+      f->error = true;
+      return 0;
+    }
+  if (!f->writing && drain (f) == EOF)
+    return 0;
+  f->writing = true;
+
+  while (done < size)
+    {
+      size_t room = BUFSIZ - f->len;
+      size_t chunk = size - done;
+
+      /* Write big chunks, and everything if unbuffered, straight
+         from BUFFER, after what is already buffered. */
+      if (f->buffering == NO_BUF || (f->len == 0 && chunk >= BUFSIZ))
+        {
+          int n;
+
+          if (drain (f) == EOF)
+            break;
+          n = write (f->fd, p + done, chunk);
+          if (n <= 0)
+            {
+              f->error = true;
+              break;
+            }
+          done += n;
+          continue;
+        }
+
+      if (chunk > room)
+        chunk = room;
+      memcpy (f->buf + f->len, p + done, chunk);
+      f->len += chunk;
+      done += chunk;
+      if (f->len == BUFSIZ && drain (f) == EOF)
+        break;
+      f->writing = true;
+    }
+
+  if (f->buffering == LINE_BUF && f->writing
+      && memchr (p, '\n', done) != NULL)
+    drain (f);
+  return done;
+}
+
+/* Reads up to SIZE bytes from F into BUFFER.  Returns the number
+   of bytes read, which is less than SIZE only at end of file or
+   on error. */
+static size_t
+get_bytes (void *buffer, size_t size, FILE *f)
+{
+  char *p = buffer;
+  size_t done = 0;
+
+  if (!f->readable)
+    {
+      f->error = true;
+      return 0;
+    }
+  if (f->writing && drain (f) == EOF)
+    return 0;
+
+  while (done < size)
+    {
+      size_t chunk;
+
+      if (f->pos == f->len)
+        {
+          /* Read big chunks, and everything if unbuffered,
+             straight into BUFFER. */
+          void *dst = f->buffering == NO_BUF || size - done >= BUFSIZ
+                      ? p + done : f->buf;
+          size_t want = dst == f->buf ? BUFSIZ : size - done;
+          int n = read (f->fd, dst, want);
+
+          if (n <= 0)
+            {
+              if (n < 0)
+                f->error = true;
+              else
+                f->eof = true;
+              break;
+            }
+          if (dst != f->buf)
+            {
+              done += n;
+              continue;
+            }
+          f->pos = 0;
+          f->len = n;
+        }
+
+      chunk = f->len - f->pos;
+      if (chunk > size - done)
+        chunk = size - done;
+      memcpy (p + done, f->buf + f->pos, chunk);
+      f->pos += chunk;
+      done += chunk;
+    }
+  return done;
+}
+
+/* Reads up to CNT items of SIZE bytes each from F into BUFFER.
+   Returns the number of whole items read. */
+size_t
+fread (void *buffer, size_t size, size_t cnt, FILE *f)
+{
+  return size == 0 ? 0 : get_bytes (buffer, size * cnt, f) / size;
+}
+
+/* Writes CNT items of SIZE bytes each from BUFFER to F.  Returns
+   the number of whole items written. */
+size_t
+fwrite (const void *buffer, size_t size, size_t cnt, FILE *f)
+{
+  return size == 0 ? 0 : put_bytes (buffer, size * cnt, f) / size;
+}
+
+/* Reads and returns a byte from F, or EOF at end of file or on
+   error. */
+int
+fgetc (FILE *f)
+{
+  unsigned char c;
+  return get_bytes (&c, 1, f) == 1 ? c : EOF;
+}
+
+/* Writes C to F.  Returns C, or EOF on error. */
+int
+fputc (int c, FILE *f)
+{
+  unsigned char c2 = c;
+  return put_bytes (&c2, 1, f) == 1 ? c2 : EOF;
+}
+
+/* Writes string S to F.  Returns 0 if successful, EOF on
+   error. */
+int
+fputs (const char *s, FILE *f)
+{
+  size_t len = strlen (s);
+  return put_bytes (s, len, f) == len ? 0 : EOF;
+}
+
+/* Returns true if F has reached end of file. */
+bool
+feof (FILE *f)
+{
+  return f->eof;
+}
+
+/* Returns true if an operation on F has failed. */
+bool
+ferror (FILE *f)
+{
+  return f->error;
+}
+
+/* Returns F's file descriptor. */
+int
+fileno (FILE *f)
+{
+  return f->fd;
+}
+
+/* Auxiliary data for vfprintf_helper(). */
+struct vfprintf_aux
+  {
+    FILE *stream;       /* Output stream. */
+    int char_cnt;       /* Total characters written so far. */
+  };
+
+/* Writes the SIZE characters in RUN to the stream in AUX. */
+static void
+vfprintf_helper (const char *run, size_t size, void *aux_)
+{
+  struct vfprintf_aux *aux = aux_;
+  aux->char_cnt += put_bytes (run, size, aux->stream);
+}
+
+/* Like vprintf(), but writes output to stream F. */
+int
+vfprintf (FILE *f, const char *format, va_list args)
+{
+  struct vfprintf_aux aux;
+
+  aux.stream = f;
+  aux.char_cnt = 0;
+  __vprintf (format, args, vfprintf_helper, &aux);
+  return aux.char_cnt;
+}
+
+/* Like printf(), but writes output to stream F. */
+int
+fprintf (FILE *f, const char *format, ...)
+{
+  va_list args;
+  int retval;
+
+  va_start (args, format);
+  retval = vfprintf (f, format, args);
+  va_end (args);
+
+  return retval;
+}
@@ -4,4 +4,29 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffered streams.  See lib/user/stdio.c. */
+typedef struct __FILE FILE;
+
+#define EOF (-1)
+#define BUFSIZ 512              /* Bytes buffered per stream. */
+#define FOPEN_MAX 16            /* Streams open at once, at most. */
+
+extern FILE *stdin;
+extern FILE *stdout;
+
+FILE *fopen (const char *name, const char *mode);
+FILE *fdopen (int fd, const char *mode);
+int fclose (FILE *);
+int fflush (FILE *);
+size_t fread (void *, size_t size, size_t cnt, FILE *);
+size_t fwrite (const void *, size_t size, size_t cnt, FILE *);
+int fgetc (FILE *);
+int fputc (int, FILE *);
+int fputs (const char *, FILE *);
+bool feof (FILE *);
+bool ferror (FILE *);
+int fileno (FILE *);
+int fprintf (FILE *, const char *, ...) PRINTF_FORMAT (2, 3);
+int vfprintf (FILE *, const char *, va_list) PRINTF_FORMAT (2, 0);
+
 #endif /* lib/user/stdio.h */
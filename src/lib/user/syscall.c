@@ -1,16 +1,31 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* True to enter the kernel through SYSENTER instead of the
+   int $0x30 gate.  Set at startup by _start(). */
+bool syscall_fast;
+
+/* Enters the kernel with the system call number and arguments on
+   top of the stack.  SYSENTER saves neither the return address
+   nor the stack pointer, so they go in %edx and %ecx for the
+   kernel to hand back to SYSEXIT; both registers are clobbered. */
+#define SYSCALL_TRAP                                            \
+        "cmpb $0, syscall_fast; je 2f; "                        \
+        "movl %%esp, %%ecx; movl $1f, %%edx; sysenter; "        \
+        "2: int $0x30; 1: "
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $4, %%esp"                                   \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -20,11 +35,12 @@
         ({                                                               \
           int retval;                                                    \
           asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
+            ("pushl %[arg0]; pushl %[number]; " SYSCALL_TRAP             \
+             "addl $8, %%esp"                                            \
                : "=a" (retval)                                           \
                : [number] "i" (NUMBER),                                  \
                  [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
+               : "ecx", "edx", "memory");                                \
           retval;                                                        \
         })
 
@@ -35,12 +51,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $12, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -51,13 +68,33 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $16, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1),                             \
                  [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2, and
+   ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; " SYSCALL_TRAP    \
+             "addl $20, %%esp"                                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -71,6 +108,7 @@ halt (void)
 void
 exit (int status)
 {
+  fflush (NULL);
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -87,6 +125,18 @@ wait (pid_t pid)
   return syscall1 (SYS_WAIT, pid);
 }
 
+pid_t
+wait_any (int *status)
+{
+  return (pid_t) syscall2 (SYS_WAIT_ANY, status, 0);
+}
+
+pid_t
+wait_poll (int *status)
+{
+  return (pid_t) syscall2 (SYS_WAIT_ANY, status, WAIT_NOHANG);
+}
+
 bool
 create (const char *file, unsigned initial_size)
 {
@@ -114,6 +164,9 @@ filesize (int fd)
 int
 read (int fd, void *buffer, unsigned size)
 {
+  /* Show any prompt before waiting for input. */
+  if (fd == STDIN_FILENO)
+    fflush (stdout);
   return syscall3 (SYS_READ, fd, buffer, size);
 }
 
@@ -182,3 +235,249 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+vmstat (struct vm_stats *stats)
+{
+  return syscall1 (SYS_VMSTAT, stats);
+}
+
+mapid_t
+mmap_flags (int fd, void *addr, int flags)
+{
+  return syscall3 (SYS_MMAP_FLAGS, fd, addr, flags);
+}
+
+int
+msync (mapid_t mapid, size_t offset, size_t length)
+{
+  return syscall3 (SYS_MSYNC, mapid, offset, length);
+}
+
+int
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+mapid_t
+mmap_anon (void *addr, size_t length)
+{
+  return syscall2 (SYS_MMAP_ANON, addr, length);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned len)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, len);
+}
+
+int
+ring_setup (struct sys_ring *ring)
+{
+  return syscall1 (SYS_RING_SETUP, ring);
+}
+
+int
+ring_enter (void)
+{
+  return syscall0 (SYS_RING_ENTER);
+}
+
+int
+scstat (int which, struct sc_stats *stats)
+{
+  return syscall2 (SYS_SCSTAT, which, stats);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+pid_t
+spawn (const char *file)
+{
+  return (pid_t) syscall1 (SYS_SPAWN, file);
+}
+
+int
+gettime (uint64_t *ns)
+{
+  return syscall1 (SYS_GETTIME, ns);
+}
+
+void
+msleep (unsigned ms)
+{
+  syscall1 (SYS_MSLEEP, ms);
+}
+
+int
+futex_wait (int *addr, int expected)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int n)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, n);
+}
+
+pid_t
+thread_spawn (void (*entry) (void *), void *arg, void *stack)
+{
+  return (pid_t) syscall3 (SYS_THREAD_SPAWN, entry, arg, stack);
+}
+
+void
+allocstat (void)
+{
+  syscall0 (SYS_ALLOCSTAT);
+}
+
+int
+fallocate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FALLOCATE, fd, length);
+}
+
+int
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+fadvise (int fd, unsigned offset, unsigned len, int advice)
+{
+  return syscall4 (SYS_FADVISE, fd, offset, len, advice);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+int
+blkstat (int role, struct blk_stats *stats)
+{
+  return syscall2 (SYS_BLKSTAT, role, stats);
+}
+
+int
+stats (int category, void *buffer, unsigned size)
+{
+  return syscall3 (SYS_STATS, category, buffer, size);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+shm_create (size_t size)
+{
+  return syscall1 (SYS_SHM_CREATE, size);
+}
+
+int
+shm_attach (int id, void *addr)
+{
+  return syscall2 (SYS_SHM_ATTACH, id, addr);
+}
+
+int
+shm_detach (void *addr)
+{
+  return syscall1 (SYS_SHM_DETACH, addr);
+}
+
+int
+getdents (int fd, struct dirent *buffer, unsigned size, int flags)
+{
+  return syscall4 (SYS_GETDENTS, fd, buffer, size, flags);
+}
+
+int
+setpriority (int priority)
+{
+  return syscall1 (SYS_SETPRIORITY, priority);
+}
+
+int
+nice (int increment)
+{
+  return syscall1 (SYS_NICE, increment);
+}
+
+int
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+int
+poll (struct pollfd *fds, unsigned n, int timeout)
+{
+  return syscall3 (SYS_POLL, fds, n, timeout);
+}
+
+int
+gettunable (int idx, struct tunable_info *info)
+{
+  return syscall2 (SYS_GETTUNABLE, idx, info);
+}
+
+int
+settunable (const char *name, int value)
+{
+  return syscall2 (SYS_SETTUNABLE, name, value);
+}
+
+int
+snapshot (const char *file)
+{
+  return syscall1 (SYS_SNAPSHOT, file);
+}
+
+pid_t
+restore (const char *file)
+{
+  return syscall1 (SYS_RESTORE, file);
+}
@@ -2,7 +2,20 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <blkstat.h>
 #include <debug.h>
+#include <dirent.h>
+#include <iovec.h>
+#include <poll.h>
+#include <rusage.h>
+#include <scstat.h>
+#include <stats.h>
+#include <syscall-nr.h>
+#include <sysring.h>
+#include <tunable.h>
+#include <vmstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -12,6 +25,11 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Priorities for setpriority(). */
+#define PRI_MIN 0               /* Lowest priority. */
+#define PRI_MAX 63              /* Highest priority. */
+#define PRI_RT 64               /* The real-time FIFO class. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -19,11 +37,18 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* True if system calls enter the kernel through SYSENTER, false
+   for the int $0x30 gate.  _start() turns it on when the CPU
+   supports SYSENTER; a program may turn it back off. */
+extern bool syscall_fast;
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
 int wait (pid_t);
+pid_t wait_any (int *status);
+pid_t wait_poll (int *status);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
@@ -45,4 +70,47 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int vmstat (struct vm_stats *);
+mapid_t mmap_flags (int fd, void *addr, int flags);
+int msync (mapid_t, size_t offset, size_t length);
+int madvise (void *addr, size_t length, int advice);
+mapid_t mmap_anon (void *addr, size_t length);
+void *sbrk (intptr_t increment);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int pread (int fd, void *buffer, unsigned size, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned size, unsigned offset);
+int copy_file_range (int fd_in, int fd_out, unsigned len);
+int ring_setup (struct sys_ring *);
+int ring_enter (void);
+int scstat (int which, struct sc_stats *);
+pid_t fork (void);
+pid_t spawn (const char *file);
+int gettime (uint64_t *ns);
+void msleep (unsigned ms);
+int futex_wait (int *addr, int expected);
+int futex_wake (int *addr, int n);
+pid_t thread_spawn (void (*entry) (void *), void *arg, void *stack);
+void allocstat (void);
+int fallocate (int fd, unsigned length);
+int fsync (int fd);
+int fadvise (int fd, unsigned offset, unsigned len, int advice);
+void sync (void);
+int blkstat (int role, struct blk_stats *);
+int stats (int category, void *buffer, unsigned size);
+int pipe (int fds[2]);
+int shm_create (size_t size);
+int shm_attach (int id, void *addr);
+int shm_detach (void *addr);
+int getdents (int fd, struct dirent *, unsigned size, int flags);
+int setpriority (int priority);
+int nice (int increment);
+int getrusage (int who, struct rusage *);
+int poll (struct pollfd *, unsigned n, int timeout);
+int gettunable (int idx, struct tunable_info *);
+int settunable (const char *name, int value);
+int snapshot (const char *file);
+pid_t restore (const char *file);
+
 #endif /* lib/user/syscall.h */
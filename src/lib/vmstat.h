@@ -0,0 +1,57 @@
+#ifndef __LIB_VMSTAT_H
+#define __LIB_VMSTAT_H
+
+#include <stdint.h>
+
+/* Number of buckets in the page fault latency histogram.  Bucket N
+   counts faults that took 2**N to 2**(N+1)-1 TSC cycles. */
+#define VM_FAULT_BUCKETS 32
+
+/* Number of buckets in the page age histogram.  Bucket 0 counts
+   frames referenced since the idle page scanner's last pass, bucket
+   N those unreferenced for 2**(N-1) to 2**N-1 passes, and the last
+   bucket everything older. */
+#define VM_AGE_BUCKETS 8
+
+/* Virtual memory statistics, as returned by the vmstat system
+   call. */
+struct vm_stats
+  {
+    uint64_t page_faults;       /* Page faults handled. */
+    uint64_t swap_ins;          /* Pages read from swap. */
+    uint64_t swap_outs;         /* Pages written to swap. */
+    uint64_t zswap_stores;      /* Of those, kept compressed in RAM. */
+    uint64_t clean_drops;       /* Evicted pages that needed no write. */
+    uint64_t zero_drops;        /* Evicted pages that were all zeros. */
+    uint64_t mmap_writebacks;   /* Dirty mmap pages written to files. */
+    uint64_t readaheads;        /* Pages read ahead from swap. */
+    uint64_t fault_arounds;     /* File pages mapped around a fault. */
+    uint64_t large_maps;        /* 4 MB pages mapped. */
+    uint64_t cow_copies;        /* Copy-on-write pages copied. */
+    uint64_t victim_calls;      /* Calls to find_victims(). */
+    uint64_t frames_scanned;    /* Frames the replacement policy looked at. */
+    uint32_t swap_slots_used;   /* Swap slots currently filled. */
+    uint32_t swap_slots;        /* Swap slots in total. */
+    uint64_t fault_cycles[VM_FAULT_BUCKETS]; /* Fault latency histogram. */
+    uint64_t stack_prefaults;   /* Stack pages mapped ahead of a fault. */
+    uint64_t swap_waits;        /* Times a thread waited for a swap slot. */
+    uint64_t oom_kills;         /* Processes killed for want of memory. */
+    uint64_t idle_scans;        /* Passes of the idle page scanner. */
+    uint32_t page_ages[VM_AGE_BUCKETS]; /* Frames by age, at the last pass. */
+    uint32_t rss;               /* Frames the calling process has. */
+    uint32_t wss;               /* Of those, its estimated working set. */
+    uint64_t exec_replays;      /* Pages mapped at exec from earlier runs. */
+    uint64_t compactions;       /* Contiguous runs freed up by moving frames. */
+    uint64_t compact_moves;     /* Frames moved to do so. */
+    uint64_t merge_scans;       /* Passes of the page merger. */
+    uint64_t pages_merged;      /* Pages merged into another's frame. */
+    uint64_t zero_merges;       /* Pages merged into the zero page. */
+    uint64_t wake_prefetches;   /* Pages read back as a sleeper woke. */
+    uint64_t pages_lent;        /* Page cache frames mapped by read(). */
+    uint64_t sweep_pauses;      /* Sweeps that let frame_lock go midway. */
+    uint64_t sweep_waits;       /* Victim searches left to another sweep. */
+    uint64_t priority_spares;   /* Frames passed over for their priority. */
+    uint64_t lends_capped;      /* read() pages copied for the loan caps. */
+  };
+
+#endif /* lib/vmstat.h */
@@ -0,0 +1,55 @@
+/* Times creating, opening and removing empty files. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILES 64
+
+/* Stores the name of file I in NAME. */
+static void
+file_name (char name[16], int i)
+{
+  snprintf (name, 16, "file%d", i);
+}
+
+void
+test_main (void)
+{
+  struct bench b;
+  char name[16];
+  int i;
+
+  bench_start (&b);
+  for (i = 0; i < FILES; i++)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  bench_report (&b, "create", FILES);
+
+  bench_start (&b);
+  for (i = 0; i < FILES; i++)
+    {
+      int fd;
+
+      file_name (name, i);
+      fd = open (name);
+      if (fd < 0)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+  bench_report (&b, "open-close", FILES);
+
+  bench_start (&b);
+  for (i = 0; i < FILES; i++)
+    {
+      file_name (name, i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+  bench_report (&b, "remove", FILES);
+}
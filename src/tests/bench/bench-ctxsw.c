@@ -0,0 +1,65 @@
+/* Times a context switch round trip: two threads of one process
+   take turns through a futex, so that each turn switches from one
+   to the other and back. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 5000
+
+/* Whose turn it is: 0 for the main thread, 1 for the partner. */
+static volatile int turn;
+
+/* Waits until it is WHO's turn. */
+static void
+wait_turn (int who)
+{
+  int t;
+
+  while ((t = turn) != who)
+    futex_wait ((int *) &turn, t);
+}
+
+/* Hands the turn to WHO. */
+static void
+give_turn (int who)
+{
+  turn = who;
+  futex_wake ((int *) &turn, 1);
+}
+
+static void
+partner (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      wait_turn (1);
+      give_turn (0);
+    }
+  exit (0);
+}
+
+void
+test_main (void)
+{
+  struct bench b;
+  pid_t tid;
+  int i;
+
+  tid = thread_spawn (partner, NULL, NULL);
+  if (tid == PID_ERROR)
+    fail ("thread_spawn failed");
+
+  bench_start (&b);
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      give_turn (1);
+      wait_turn (0);
+    }
+  bench_report (&b, "ctxsw-round-trip", ITERATIONS);
+  wait (tid);
+}
@@ -0,0 +1,37 @@
+/* Times page faults on a mapped file, by touching one byte of each
+   of its pages.  Pages mapped around a fault save later faults,
+   which makes the cost per page smaller than per fault. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 64
+
+static char page[4096];
+
+void
+test_main (void)
+{
+  const volatile char *data = (const volatile char *) 0x10000000;
+  struct bench b;
+  mapid_t map;
+  size_t i;
+  int fd;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  memset (page, 0x5a, sizeof page);
+  for (i = 0; i < PAGES; i++)
+    if (write (fd, page, sizeof page) != sizeof page)
+      fail ("write \"data\" failed");
+  CHECK ((map = mmap (fd, (void *) data)) != MAP_FAILED, "mmap \"data\"");
+
+  bench_start (&b);
+  for (i = 0; i < PAGES; i++)
+    (void) data[i * 4096];
+  bench_report (&b, "fault-file", PAGES);
+  munmap (map);
+}
@@ -0,0 +1,30 @@
+/* Times faults that bring pages back from swap: writes more
+   memory than the machine has, so that the first pages written
+   are evicted, then touches each page again. */
+
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define PAGES (SIZE / 4096)
+
+static volatile unsigned buf[SIZE / sizeof (unsigned)];
+
+void
+test_main (void)
+{
+  struct bench b;
+  size_t i;
+
+  /* Fill every word with something that is neither zero nor the
+     same throughout a page, so that eviction has to keep it. */
+  msg ("fill");
+  for (i = 0; i < SIZE / sizeof *buf; i++)
+    buf[i] = i * 2654435761u;
+
+  bench_start (&b);
+  for (i = 0; i < PAGES; i++)
+    (void) buf[i * (4096 / sizeof *buf)];
+  bench_report (&b, "fault-swap", PAGES);
+}
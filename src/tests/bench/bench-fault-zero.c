@@ -0,0 +1,26 @@
+/* Times zero-fill page faults, by touching each page of a fresh
+   anonymous mapping once. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 256
+
+void
+test_main (void)
+{
+  volatile char *data = (volatile char *) 0x10000000;
+  struct bench b;
+  mapid_t map;
+  size_t i;
+
+  CHECK ((map = mmap_anon ((void *) data, PAGES * 4096)) != MAP_FAILED,
+         "mmap_anon");
+  bench_start (&b);
+  for (i = 0; i < PAGES; i++)
+    data[i * 4096] = 1;
+  bench_report (&b, "fault-zero", PAGES);
+  munmap (map);
+}
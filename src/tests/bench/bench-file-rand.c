@@ -0,0 +1,47 @@
+/* Times writing and reading single sectors at random offsets in a
+   file. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SECTOR 512
+#define FILE_SECTORS 512
+#define ITERATIONS 512
+
+static char buf[SECTOR];
+
+/* Returns the offset of a random sector of the file. */
+static unsigned
+random_ofs (void)
+{
+  return random_ulong () % FILE_SECTORS * SECTOR;
+}
+
+void
+test_main (void)
+{
+  struct bench b;
+  size_t i;
+  int fd;
+
+  CHECK (create ("data", FILE_SECTORS * SECTOR), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  memset (buf, 0x5a, sizeof buf);
+
+  bench_start (&b);
+  for (i = 0; i < ITERATIONS; i++)
+    if (pwrite (fd, buf, SECTOR, random_ofs ()) != SECTOR)
+      fail ("pwrite \"data\" failed");
+  bench_report (&b, "rand-write", ITERATIONS);
+
+  bench_start (&b);
+  for (i = 0; i < ITERATIONS; i++)
+    if (pread (fd, buf, SECTOR, random_ofs ()) != SECTOR)
+      fail ("pread \"data\" failed");
+  bench_report (&b, "rand-read", ITERATIONS);
+  close (fd);
+}
@@ -0,0 +1,39 @@
+/* Times writing a file from start to end in 4 kB chunks, then
+   reading it back the same way. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 4096
+#define CHUNKS 64
+
+static char buf[CHUNK];
+
+void
+test_main (void)
+{
+  struct bench b;
+  size_t i;
+  int fd;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  memset (buf, 0x5a, sizeof buf);
+
+  bench_start (&b);
+  for (i = 0; i < CHUNKS; i++)
+    if (write (fd, buf, CHUNK) != CHUNK)
+      fail ("write \"data\" failed");
+  bench_report (&b, "seq-write", CHUNKS);
+
+  seek (fd, 0);
+  bench_start (&b);
+  for (i = 0; i < CHUNKS; i++)
+    if (read (fd, buf, CHUNK) != CHUNK)
+      fail ("read \"data\" failed");
+  bench_report (&b, "seq-read", CHUNKS);
+  close (fd);
+}
@@ -0,0 +1,57 @@
+/* Times reading all of a mapped file, first with its pages not yet
+   mapped and then again with them in memory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 64
+
+static char page[4096];
+
+/* Returns the sum of the PAGES pages of words at DATA. */
+static unsigned
+sum (const volatile unsigned *data)
+{
+  unsigned total = 0;
+  size_t i;
+
+  for (i = 0; i < PAGES * 4096 / sizeof *data; i++)
+    total += data[i];
+  return total;
+}
+
+void
+test_main (void)
+{
+  const volatile unsigned *data = (const volatile unsigned *) 0x10000000;
+  struct bench b;
+  unsigned cold, warm;
+  mapid_t map;
+  size_t i;
+  int fd;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  for (i = 0; i < PAGES; i++)
+    {
+      memset (page, i, sizeof page);
+      if (write (fd, page, sizeof page) != sizeof page)
+        fail ("write \"data\" failed");
+    }
+  CHECK ((map = mmap (fd, (void *) data)) != MAP_FAILED, "mmap \"data\"");
+
+  bench_start (&b);
+  cold = sum (data);
+  bench_report (&b, "mmap-touch-cold", PAGES);
+
+  bench_start (&b);
+  warm = sum (data);
+  bench_report (&b, "mmap-touch-warm", PAGES);
+
+  if (cold != warm)
+    fail ("mapping read back differently");
+  munmap (map);
+}
@@ -0,0 +1,22 @@
+/* Times a null system call round trip.  ring_enter() with no ring
+   registered returns at once, so this measures little beyond
+   kernel entry and exit. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 20000
+
+void
+test_main (void)
+{
+  struct bench b;
+  int i;
+
+  bench_start (&b);
+  for (i = 0; i < ITERATIONS; i++)
+    ring_enter ();
+  bench_report (&b, "null-syscall", ITERATIONS);
+}
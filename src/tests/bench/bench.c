@@ -0,0 +1,45 @@
+/* Timing and reporting shared by the benchmarks.
+
+   Each result goes out as one line of the form
+     (TEST) result METRIC CYCLES cycles/op OPS ops/s
+   which bench.pm checks and "make bench" collects. */
+
+#include "tests/bench/bench.h"
+#include <inttypes.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Starts a timed run in B. */
+void
+bench_start (struct bench *b)
+{
+  gettime (&b->ns);
+  b->tsc = rdtsc ();
+}
+
+/* Reports the run started in B, which performed OPS operations,
+   as METRIC. */
+void
+bench_report (const struct bench *b, const char *metric, unsigned ops)
+{
+  uint64_t cycles = rdtsc () - b->tsc;
+  uint64_t ns;
+
+  gettime (&ns);
+  ns -= b->ns;
+  if (ops == 0)
+    ops = 1;
+  if (ns == 0)
+    ns = 1;
+  msg ("result %s %"PRIu64" cycles/op %"PRIu64" ops/s",
+       metric, cycles / ops, (uint64_t) ops * 1000000000 / ns);
+}
@@ -0,0 +1,16 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+/* Start of a timed run. */
+struct bench
+  {
+    uint64_t tsc;               /* Time-stamp counter at the start. */
+    uint64_t ns;                /* gettime() at the start. */
+  };
+
+void bench_start (struct bench *);
+void bench_report (const struct bench *, const char *metric, unsigned ops);
+
+#endif /* tests/bench/bench.h */
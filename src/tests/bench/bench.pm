@@ -0,0 +1,34 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# check_bench (@METRICS)
+#
+# Checks that the benchmark ran to the end and reported each of
+# @METRICS, in order, as "result METRIC N cycles/op N ops/s".
+# Other messages from the benchmark, which say what it is setting
+# up, are ignored; FAIL messages are caught by common_checks().
+sub check_bench {
+    my (@metrics) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+
+    my ($name) = $test =~ m%([^/]+)$%;
+    my (@lines) = grep (/^\(\Q$name\E\) (begin|end|result .*)$/,
+			get_core_output ("run", @output));
+    my (@expected) = ("($name) begin",
+		      map ("($name) result $_ N cycles/op N ops/s", @metrics),
+		      "($name) end");
+    s/ \d+ (cycles\/op|ops\/s)/ N $1/g foreach @lines;
+    fail ("Benchmark output failed to match.\n\n"
+	  . "Expected output, with N for any number:\n"
+	  . join ('', map ("  $_\n", @expected))
+	  . "Actual output:\n"
+	  . join ('', map ("  $_\n", @lines)))
+      if join ("\n", @lines) ne join ("\n", @expected);
+    pass;
+}
+
+1;
@@ -0,0 +1,230 @@
+/* Measures how the file system holds up under concurrent use, in
+   the manner of syn-read, syn-write and syn-rw, but with a chosen
+   number of processes and timing instead of checking contents.
+   "make fsscale" runs it over a range of process counts and
+   collects the results as CSV.
+
+   Usage: fsscale MODE SHARING PROCS OPS
+
+   PROCS subprocesses each perform OPS BLOCK_SIZE-byte operations
+   at random block-aligned offsets in a FILE_SIZE file.  MODE is
+   "read", "write" or "mixed", an even mix of the two.  SHARING is
+   "shared", with every subprocess working on the same file, or
+   "private", with one file for each.
+
+   Prints a line "(fsscale) result MODE,SHARING,PROCS,OPS,OPS_PER_SEC,
+   KB_PER_SEC,P50_US,P90_US,P99_US,MAX_US": the aggregate rate from
+   the first subprocess starting its operations to the last one
+   finishing, and percentiles of the latency of single operations
+   across all subprocesses, in microseconds. */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "fsscale";
+
+#define BLOCK_SIZE 512
+#define FILE_SIZE (64 * 1024)
+#define MAX_PROCS 16
+#define MAX_OPS 1024
+
+/* What a subprocess hands back in its "latN" file. */
+struct child_result
+  {
+    uint64_t start_ns;          /* gettime() before the first op. */
+    uint64_t end_ns;            /* gettime() after the last op. */
+    uint32_t lat_ns[MAX_OPS];   /* Each op's latency. */
+  };
+
+static struct child_result results[MAX_PROCS];
+static uint32_t all_lat[MAX_PROCS * MAX_OPS];
+static char block[BLOCK_SIZE];
+
+/* Returns the name of the file subprocess IDX works on. */
+static const char *
+data_name (bool shared, int idx, char *fn, size_t size)
+{
+  if (shared)
+    snprintf (fn, size, "data");
+  else
+    snprintf (fn, size, "data%d", idx);
+  return fn;
+}
+
+/* Performs OP_CNT operations of MODE on the file for subprocess
+   IDX and saves the timings to "latIDX". */
+static int
+child (const char *mode, bool shared, int idx, size_t op_cnt)
+{
+  struct child_result *r;
+  char fn[16];
+  size_t i;
+  int fd;
+
+  CHECK (idx >= 0 && idx < MAX_PROCS, "child index %d", idx);
+  r = &results[idx];
+  random_init (idx + 1);
+  memset (block, idx, sizeof block);
+  data_name (shared, idx, fn, sizeof fn);
+  CHECK ((fd = open (fn)) > 1, "open \"%s\"", fn);
+
+  gettime (&r->start_ns);
+  for (i = 0; i < op_cnt; i++)
+    {
+      unsigned long rnd = random_ulong ();
+      unsigned ofs = rnd % (FILE_SIZE / BLOCK_SIZE) * BLOCK_SIZE;
+      bool write_op = (!strcmp (mode, "write")
+                       || (!strcmp (mode, "mixed")
+                           && (rnd / (FILE_SIZE / BLOCK_SIZE)) % 2));
+      uint64_t before, after;
+
+      gettime (&before);
+      seek (fd, ofs);
+      if (write_op)
+        CHECK (write (fd, block, BLOCK_SIZE) == BLOCK_SIZE,
+               "write \"%s\" at %d", fn, (int) ofs);
+      else
+        CHECK (read (fd, block, BLOCK_SIZE) == BLOCK_SIZE,
+               "read \"%s\" at %d", fn, (int) ofs);
+      gettime (&after);
+      r->lat_ns[i] = after - before;
+    }
+  gettime (&r->end_ns);
+  close (fd);
+
+  snprintf (fn, sizeof fn, "lat%d", idx);
+  CHECK (create (fn, sizeof *r), "create \"%s\"", fn);
+  CHECK ((fd = open (fn)) > 1, "open \"%s\"", fn);
+  CHECK (write (fd, r, sizeof *r) == sizeof *r, "write \"%s\"", fn);
+  close (fd);
+  return 0;
+}
+
+/* Creates the file named FN, FILE_SIZE bytes long. */
+static void
+make_file (const char *fn)
+{
+  size_t ofs;
+  int fd;
+
+  CHECK (create (fn, 0), "create \"%s\"", fn);
+  CHECK ((fd = open (fn)) > 1, "open \"%s\"", fn);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += BLOCK_SIZE)
+    CHECK (write (fd, block, BLOCK_SIZE) == BLOCK_SIZE, "write \"%s\"", fn);
+  close (fd);
+}
+
+/* Reads back subprocess IDX's results into results[IDX]. */
+static void
+collect (int idx)
+{
+  char fn[16];
+  int fd;
+
+  snprintf (fn, sizeof fn, "lat%d", idx);
+  CHECK ((fd = open (fn)) > 1, "open \"%s\"", fn);
+  CHECK (read (fd, &results[idx], sizeof *results) == sizeof *results,
+         "read \"%s\"", fn);
+  close (fd);
+  remove (fn);
+}
+
+static int
+compare_u32 (const void *a_, const void *b_)
+{
+  const uint32_t *a = a_, *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Returns the PCT'th percentile of the CNT sorted values in LAT, in
+   microseconds. */
+static unsigned
+percentile_us (const uint32_t *lat, size_t cnt, unsigned pct)
+{
+  size_t i = cnt * pct / 100;
+  if (i >= cnt)
+    i = cnt - 1;
+  return lat[i] / 1000;
+}
+
+int
+main (int argc, char *argv[])
+{
+  pid_t children[MAX_PROCS];
+  uint64_t start, end, ns, ops;
+  size_t proc_cnt, op_cnt, lat_cnt;
+  const char *mode;
+  bool shared;
+  char fn[16];
+  size_t i;
+
+  quiet = true;
+  if (argc == 6 && !strcmp (argv[1], "child"))
+    return child (argv[2], !strcmp (argv[3], "shared"), atoi (argv[4]),
+                  atoi (argv[5]));
+
+  if (argc != 5)
+    fail ("usage: fsscale MODE SHARING PROCS OPS");
+  mode = argv[1];
+  if (strcmp (mode, "read") && strcmp (mode, "write")
+      && strcmp (mode, "mixed"))
+    fail ("unknown mode \"%s\"", mode);
+  if (strcmp (argv[2], "shared") && strcmp (argv[2], "private"))
+    fail ("unknown sharing \"%s\"", argv[2]);
+  shared = !strcmp (argv[2], "shared");
+  proc_cnt = atoi (argv[3]);
+  op_cnt = atoi (argv[4]);
+  if (proc_cnt == 0 || proc_cnt > MAX_PROCS)
+    fail ("PROCS must be between 1 and %d", MAX_PROCS);
+  if (op_cnt == 0 || op_cnt > MAX_OPS)
+    fail ("OPS must be between 1 and %d", MAX_OPS);
+
+  for (i = 0; i < (shared ? 1 : proc_cnt); i++)
+    make_file (data_name (shared, i, fn, sizeof fn));
+
+  for (i = 0; i < proc_cnt; i++)
+    {
+      char cmd[64];
+
+      snprintf (cmd, sizeof cmd, "fsscale child %s %s %zu %zu",
+                mode, argv[2], i, op_cnt);
+      CHECK ((children[i] = exec (cmd)) != -1, "exec \"%s\"", cmd);
+    }
+  for (i = 0; i < proc_cnt; i++)
+    CHECK (wait (children[i]) == 0, "wait for child %zu", i);
+
+  start = UINT64_MAX;
+  end = 0;
+  lat_cnt = 0;
+  for (i = 0; i < proc_cnt; i++)
+    {
+      collect (i);
+      if (results[i].start_ns < start)
+        start = results[i].start_ns;
+      if (results[i].end_ns > end)
+        end = results[i].end_ns;
+      memcpy (&all_lat[lat_cnt], results[i].lat_ns,
+              op_cnt * sizeof *all_lat);
+      lat_cnt += op_cnt;
+    }
+  qsort (all_lat, lat_cnt, sizeof *all_lat, compare_u32);
+  for (i = 0; i < (shared ? 1 : proc_cnt); i++)
+    remove (data_name (shared, i, fn, sizeof fn));
+
+  ns = end > start ? end - start : 1;
+  ops = lat_cnt;
+  quiet = false;
+  msg ("result %s,%s,%zu,%zu,%llu,%llu,%u,%u,%u,%u", mode, argv[2],
+       proc_cnt, op_cnt, ops * 1000000000 / ns,
+       ops * BLOCK_SIZE * 1000000000 / ns / 1024,
+       percentile_us (all_lat, lat_cnt, 50),
+       percentile_us (all_lat, lat_cnt, 90),
+       percentile_us (all_lat, lat_cnt, 99),
+       all_lat[lat_cnt - 1] / 1000);
+  return 0;
+}
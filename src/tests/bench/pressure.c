@@ -0,0 +1,234 @@
+/* Runs one of the page-merge or page-parallel workloads at a
+   given size and degree of parallelism, and reports what it cost
+   the VM system.  "make pressure" runs it under a range of user
+   pool sizes and collects the results as CSV.
+
+   Usage: pressure WORKLOAD CHUNKS PROCS
+
+   WORKLOAD is "sort", "qsort" or "qsort-mm", as in page-merge-seq
+   or -par, page-merge-stk and page-merge-mm: CHUNKS chunks of
+   128 kB of random data are sorted, each by a child-sort,
+   child-qsort or child-qsort-mm subprocess, then merged and
+   checked.  Or it is "linear", as in page-parallel: CHUNKS
+   child-linear subprocesses each work through 1 MB of their own.
+   At most PROCS subprocesses run at once.
+
+   Prints a line "(pressure) result WORKLOAD,CHUNKS,PROCS,TICKS,
+   FAULTS,SWAP_INS,SWAP_OUTS,VICTIM_CALLS,FRAMES_SCANNED" with the
+   timer ticks that passed and the VM counters' growth over the
+   run. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+
+const char *test_name = "pressure";
+
+#define CHUNK_SIZE (128 * 1024)
+
+/* A workload. */
+struct workload
+  {
+    const char *name;
+    const char *child;          /* Subprocess to run. */
+    int exit_status;            /* What the subprocess returns. */
+    bool merge;                 /* Sort chunks of data? */
+  };
+
+static const struct workload workloads[] =
+  {
+    {"sort", "child-sort", 123, true},
+    {"qsort", "child-qsort", 72, true},
+    {"qsort-mm", "child-qsort-mm", 80, true},
+    {"linear", "child-linear", 0x42, false},
+  };
+
+static unsigned char *buf1, *buf2;
+static size_t histogram[256];
+
+/* Fills the CHUNK_CNT chunks of buf1 with random data and counts
+   each value in it. */
+static void
+init (size_t chunk_cnt)
+{
+  struct arc4 arc4;
+  size_t i;
+
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf1, chunk_cnt * CHUNK_SIZE);
+  for (i = 0; i < chunk_cnt * CHUNK_SIZE; i++)
+    histogram[buf1[i]]++;
+}
+
+/* Starts W's subprocess on chunk I, writing the chunk out to its
+   file first if W sorts chunks.  Returns the subprocess. */
+static pid_t
+start_child (const struct workload *w, size_t i)
+{
+  char cmd[64];
+  pid_t child;
+
+  if (w->merge)
+    {
+      char fn[16];
+      int handle;
+
+      snprintf (fn, sizeof fn, "buf%zu", i);
+      create (fn, CHUNK_SIZE);
+      CHECK ((handle = open (fn)) > 1, "open \"%s\"", fn);
+      write (handle, buf1 + CHUNK_SIZE * i, CHUNK_SIZE);
+      close (handle);
+      snprintf (cmd, sizeof cmd, "%s %s", w->child, fn);
+    }
+  else
+    snprintf (cmd, sizeof cmd, "%s key%zu", w->child, i);
+
+  CHECK ((child = exec (cmd)) != -1, "exec \"%s\"", cmd);
+  return child;
+}
+
+/* Waits for subprocess CHILD, which ran W on chunk I, and reads
+   the chunk back if W sorts chunks. */
+static void
+finish_child (const struct workload *w, pid_t child, size_t i)
+{
+  CHECK (wait (child) == w->exit_status, "wait for child %zu", i);
+  if (w->merge)
+    {
+      char fn[16];
+      int handle;
+
+      snprintf (fn, sizeof fn, "buf%zu", i);
+      CHECK ((handle = open (fn)) > 1, "open \"%s\"", fn);
+      read (handle, buf1 + CHUNK_SIZE * i, CHUNK_SIZE);
+      close (handle);
+      remove (fn);
+    }
+}
+
+/* Runs W on CHUNK_CNT chunks, PROC_CNT subprocesses at a time. */
+static void
+run_children (const struct workload *w, size_t chunk_cnt, size_t proc_cnt)
+{
+  pid_t children[proc_cnt];
+  size_t next = 0, done = 0;
+
+  while (done < chunk_cnt)
+    {
+      while (next < chunk_cnt && next - done < proc_cnt)
+        {
+          children[next % proc_cnt] = start_child (w, next);
+          next++;
+        }
+      finish_child (w, children[done % proc_cnt], done);
+      done++;
+    }
+}
+
+/* Merges the CHUNK_CNT sorted chunks in buf1 into buf2. */
+static void
+merge (size_t chunk_cnt)
+{
+  unsigned char *mp[chunk_cnt];
+  size_t mp_left = chunk_cnt;
+  unsigned char *op = buf2;
+  size_t i;
+
+  for (i = 0; i < chunk_cnt; i++)
+    mp[i] = buf1 + CHUNK_SIZE * i;
+  while (mp_left > 0)
+    {
+      size_t min = 0;
+
+      for (i = 1; i < mp_left; i++)
+        if (*mp[i] < *mp[min])
+          min = i;
+      *op++ = *mp[min];
+      if ((++mp[min] - buf1) % CHUNK_SIZE == 0)
+        mp[min] = mp[--mp_left];
+    }
+}
+
+/* Checks that buf2 holds the values counted in histogram, in
+   order. */
+static void
+verify (void)
+{
+  size_t buf_idx = 0;
+  size_t hist_idx;
+
+  for (hist_idx = 0; hist_idx < sizeof histogram / sizeof *histogram;
+       hist_idx++)
+    while (histogram[hist_idx]-- > 0)
+      {
+        if (buf2[buf_idx] != hist_idx)
+          fail ("bad value %d in byte %zu", buf2[buf_idx], buf_idx);
+        buf_idx++;
+      }
+}
+
+/* Returns the timer ticks since boot. */
+static uint64_t
+ticks (void)
+{
+  struct sched_stats s;
+
+  stats (STATS_SCHED, &s, sizeof s);
+  return s.idle_ticks + s.kernel_ticks + s.user_ticks;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const struct workload *w = NULL;
+  struct vm_stats before, after;
+  uint64_t start, end;
+  size_t chunk_cnt, proc_cnt;
+  size_t i;
+
+  quiet = true;
+  if (argc != 4)
+    fail ("usage: pressure WORKLOAD CHUNKS PROCS");
+  for (i = 0; i < sizeof workloads / sizeof *workloads; i++)
+    if (!strcmp (argv[1], workloads[i].name))
+      w = &workloads[i];
+  if (w == NULL)
+    fail ("unknown workload \"%s\"", argv[1]);
+  chunk_cnt = atoi (argv[2]);
+  proc_cnt = atoi (argv[3]);
+  if (chunk_cnt == 0 || proc_cnt == 0)
+    fail ("CHUNKS and PROCS must be positive");
+
+  if (w->merge)
+    {
+      buf1 = malloc (chunk_cnt * CHUNK_SIZE);
+      buf2 = malloc (chunk_cnt * CHUNK_SIZE);
+      if (buf1 == NULL || buf2 == NULL)
+        fail ("out of memory for %zu chunks", chunk_cnt);
+      init (chunk_cnt);
+    }
+
+  start = ticks ();
+  stats (STATS_VM, &before, sizeof before);
+  run_children (w, chunk_cnt, proc_cnt);
+  if (w->merge)
+    merge (chunk_cnt);
+  stats (STATS_VM, &after, sizeof after);
+  end = ticks ();
+
+  if (w->merge)
+    verify ();
+
+  quiet = false;
+  msg ("result %s,%zu,%zu,%llu,%llu,%llu,%llu,%llu,%llu", w->name,
+       chunk_cnt, proc_cnt, end - start,
+       after.page_faults - before.page_faults,
+       after.swap_ins - before.swap_ins,
+       after.swap_outs - before.swap_outs,
+       after.victim_calls - before.victim_calls,
+       after.frames_scanned - before.frames_scanned);
+  return 0;
+}
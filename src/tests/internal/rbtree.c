@@ -0,0 +1,250 @@
+/* Test program for lib/kernel/rbtree.c.
+
+   Attempts to test the red-black tree functionality that is not
+   sufficiently tested elsewhere in Pintos: ordering of equal
+   nodes, the searches, stepping in both directions, and the
+   red-black invariants after every insertion and removal.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <random.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include "threads/test.h"
+
+/* Maximum number of nodes in a tree that we will test. */
+#define MAX_SIZE 64
+
+/* A tree node. */
+struct value
+  {
+    struct rb_node node;        /* Tree node. */
+    int key;                    /* Sort key. */
+    int seq;                    /* Insertion order among equal keys. */
+    bool in_tree;               /* Not yet removed? */
+  };
+
+static void shuffle (struct value *[], size_t);
+static bool value_less (const struct rb_node *, const struct rb_node *,
+                        void *);
+static int verify_subtree (const struct rb_node *);
+static void verify_tree (struct rb_tree *, struct value *[], int cnt);
+static void verify_searches (struct rb_tree *, int size);
+
+/* Test the red-black tree implementation. */
+void
+test (void)
+{
+  int size;
+
+  printf ("testing various size trees:");
+  for (size = 0; size < MAX_SIZE; size++)
+    {
+      int repeat;
+
+      printf (" %d", size);
+      for (repeat = 0; repeat < 10; repeat++)
+        {
+          static struct value values[MAX_SIZE];
+          static struct value *order[MAX_SIZE];
+          static struct value *sorted[MAX_SIZE];
+          struct rb_tree tree;
+          int i, cnt;
+
+          /* Keys 0, 0, 2, 2, 4, 4... so that each key is in the
+             tree twice and odd keys fall between nodes. */
+          for (i = 0; i < size; i++)
+            {
+              values[i].key = i / 2 * 2;
+              order[i] = &values[i];
+            }
+          shuffle (order, size);
+
+          /* Insert in random order, checking the invariants after
+             each insertion.  Equal keys must keep insertion order,
+             so number them as they go in. */
+          rb_init (&tree, value_less, NULL);
+          for (i = 0; i < size; i++)
+            {
+              int j, seq = 0;
+
+              for (j = 0; j < i; j++)
+                if (order[j]->key == order[i]->key)
+                  seq++;
+              order[i]->seq = seq;
+              order[i]->in_tree = true;
+              rb_insert (&tree, &order[i]->node);
+              verify_subtree (tree.root);
+            }
+          for (i = 0; i < size; i++)
+            sorted[values[i].key + values[i].seq] = &values[i];
+          verify_tree (&tree, sorted, size);
+          verify_searches (&tree, size);
+
+          /* Remove in random order, checking the invariants and the
+             ordering of what is left after each removal. */
+          shuffle (order, size);
+          for (cnt = size; cnt > 0; cnt--)
+            {
+              struct value *left[MAX_SIZE];
+              int n = 0;
+
+              rb_remove (&tree, &order[cnt - 1]->node);
+              order[cnt - 1]->in_tree = false;
+              for (i = 0; i < size; i++)
+                if (sorted[i]->in_tree)
+                  left[n++] = sorted[i];
+              verify_tree (&tree, left, n);
+            }
+          ASSERT (rb_empty (&tree));
+        }
+    }
+
+  printf (" done\n");
+  printf ("rbtree: PASS\n");
+}
+
+/* Shuffles the CNT elements in ARRAY into random order. */
+static void
+shuffle (struct value **array, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      size_t j = i + random_ulong () % (cnt - i);
+      struct value *t = array[j];
+      array[j] = array[i];
+      array[i] = t;
+    }
+}
+
+/* Returns true if value A's key is less than value B's, false
+   otherwise. */
+static bool
+value_less (const struct rb_node *a_, const struct rb_node *b_,
+            void *aux UNUSED)
+{
+  const struct value *a = rb_entry (a_, struct value, node);
+  const struct value *b = rb_entry (b_, struct value, node);
+
+  return a->key < b->key;
+}
+
+/* Checks the red-black invariants of the subtree rooted at N:
+   children point back to their parent and are ordered around it,
+   and no red node has a red child.  Returns the number of black
+   nodes on every path from N down to a leaf, which must be the
+   same on both sides. */
+static int
+verify_subtree (const struct rb_node *n)
+{
+  int left, right;
+
+  if (n == NULL)
+    return 1;
+  if (n->left != NULL)
+    {
+      ASSERT (n->left->parent == n);
+      ASSERT (!value_less (n, n->left, NULL));
+      ASSERT (!(n->red && n->left->red));
+    }
+  if (n->right != NULL)
+    {
+      ASSERT (n->right->parent == n);
+      ASSERT (!value_less (n->right, n, NULL));
+      ASSERT (!(n->red && n->right->red));
+    }
+  left = verify_subtree (n->left);
+  right = verify_subtree (n->right);
+  ASSERT (left == right);
+  return left + !n->red;
+}
+
+/* Verifies that TREE holds exactly the CNT values in EXPECT, which
+   are in key and then insertion order, when traversed in either
+   direction, and that the invariants hold. */
+static void
+verify_tree (struct rb_tree *tree, struct value *expect[], int cnt)
+{
+  struct rb_node *n;
+  int i;
+
+  ASSERT (tree->root == NULL || tree->root->parent == NULL);
+  ASSERT (tree->root == NULL || !tree->root->red);
+  verify_subtree (tree->root);
+  ASSERT (rb_size (tree) == (size_t) cnt);
+  ASSERT (rb_empty (tree) == (cnt == 0));
+
+  for (i = 0, n = rb_first (tree); i < cnt && n != NULL;
+       i++, n = rb_next (n))
+    ASSERT (rb_entry (n, struct value, node) == expect[i]);
+  ASSERT (i == cnt);
+  ASSERT (n == NULL);
+
+  for (i = cnt - 1, n = rb_last (tree); i >= 0 && n != NULL;
+       i--, n = rb_prev (n))
+    ASSERT (rb_entry (n, struct value, node) == expect[i]);
+  ASSERT (i == -1);
+  ASSERT (n == NULL);
+}
+
+/* Verifies rb_find(), rb_lower_bound() and rb_upper_bound() for
+   every key in and around TREE, which holds SIZE values with keys
+   0, 0, 2, 2, and so on. */
+static void
+verify_searches (struct rb_tree *tree, int size)
+{
+  int max = size > 0 ? (size - 1) / 2 * 2 : -1;   /* Largest key. */
+  int key;
+
+  for (key = -1; key <= max + 2; key++)
+    {
+      struct value probe;
+      struct rb_node *lower, *upper, *found;
+      int first = key < 0 ? 0 : (key + 1) / 2 * 2; /* First key >= KEY. */
+      int past = key < 0 ? 0 : key / 2 * 2 + 2;    /* First key > KEY. */
+
+      probe.key = key;
+      lower = rb_lower_bound (tree, &probe.node);
+      upper = rb_upper_bound (tree, &probe.node);
+      found = rb_find (tree, &probe.node);
+
+      if (first <= max)
+        {
+          struct value *v = rb_entry (lower, struct value, node);
+          ASSERT (v->key == first && v->seq == 0);
+          ASSERT (rb_prev (lower) == NULL
+                  || rb_entry (rb_prev (lower), struct value,
+                               node)->key < key);
+        }
+      else
+        {
+          ASSERT (lower == NULL);
+        }
+
+      if (past <= max)
+        {
+          struct value *v = rb_entry (upper, struct value, node);
+          ASSERT (v->key == past && v->seq == 0);
+        }
+      else
+        {
+          ASSERT (upper == NULL);
+        }
+
+      if (key >= 0 && key % 2 == 0 && key <= max)
+        {
+          ASSERT (found != NULL
+                  && rb_entry (found, struct value, node)->key == key);
+        }
+      else
+        {
+          ASSERT (found == NULL);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/* Does file I/O while three child-linear processes swap, with the
+   file system and swap on different IDE channels, and checks that
+   both channels were busy at the same time. */
+
+#include <stats.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 3
+
+/* Much bigger than the buffer cache, so that it is read from and
+   written to the disk each time around. */
+#define FILE_SIZE (256 * 1024)
+#define CHUNK 4096
+
+static char buf[CHUNK];
+
+/* Writes FILE_SIZE bytes to FD, flushes them to disk, and reads
+   them back, checking that ROUND's pattern came back. */
+static void
+write_and_read (int fd, int round)
+{
+  size_t ofs;
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+    {
+      memset (buf, (int) (ofs / CHUNK + round), CHUNK);
+      if (write (fd, buf, CHUNK) != CHUNK)
+        fail ("write at %zu failed", ofs);
+    }
+  if (fsync (fd) != 0)
+    fail ("fsync failed");
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK)
+    {
+      size_t i;
+
+      if (read (fd, buf, CHUNK) != CHUNK)
+        fail ("read at %zu failed", ofs);
+      for (i = 0; i < CHUNK; i++)
+        if (buf[i] != (char) (ofs / CHUNK + round))
+          fail ("byte %zu of round %d differs", ofs + i, round);
+    }
+}
+
+void
+test_main (void)
+{
+  struct ide_stats s;
+  int exited = 0;
+  int round;
+  int fd;
+  int i;
+
+  CHECK (create ("overlap.dat", FILE_SIZE), "create \"overlap.dat\"");
+  CHECK ((fd = open ("overlap.dat")) > 1, "open \"overlap.dat\"");
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (exec ("child-linear") != -1, "exec \"child-linear\"");
+
+  /* Keep the file system disk busy until every child has exited, so
+     that its I/O runs the whole time they swap. */
+  msg ("file I/O while the children swap");
+  for (round = 0; exited < CHILD_CNT; round++)
+    {
+      int status;
+      pid_t pid;
+
+      write_and_read (fd, round);
+      while ((pid = wait_poll (&status)) > 0)
+        {
+          if (status != 0x42)
+            fail ("child exited with %d", status);
+          exited++;
+        }
+    }
+  close (fd);
+
+  CHECK (stats (STATS_IDE, &s, sizeof s) >= (int) sizeof s,
+         "stats (STATS_IDE)");
+  if (s.transfers[1] == 0)
+    fail ("no transfers on the swap channel");
+  if (s.overlap_ns == 0)
+    fail ("the IDE channels never overlapped");
+  msg ("both IDE channels were busy at once");
+}
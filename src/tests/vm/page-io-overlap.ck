@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-io-overlap) begin
+(page-io-overlap) create "overlap.dat"
+(page-io-overlap) open "overlap.dat"
+(page-io-overlap) exec "child-linear"
+(page-io-overlap) exec "child-linear"
+(page-io-overlap) exec "child-linear"
+(page-io-overlap) file I/O while the children swap
+(page-io-overlap) stats (STATS_IDE)
+(page-io-overlap) both IDE channels were busy at once
+(page-io-overlap) end
+EOF
+pass;
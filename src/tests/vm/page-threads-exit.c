@@ -0,0 +1,49 @@
+/* Exits the main thread while one of its threads spins in user mode,
+   faulting in page after page, and another sleeps in futex_wait()
+   forever.  Both have to die with the process, which must not hang
+   waiting for them or pull the address space out from under them. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 256
+
+static char *const anon = (char *) 0x10000000;
+
+/* Set once both threads are running. */
+static volatile int spinning, sleeping;
+
+/* Never woken. */
+static int never;
+
+static void
+spinner (void *aux UNUSED)
+{
+  size_t i;
+
+  spinning = 1;
+  for (i = 0; ; i = (i + 1) % PAGE_CNT)
+    anon[i * 4096]++;
+}
+
+static void
+sleeper (void *aux UNUSED)
+{
+  sleeping = 1;
+  for (;;)
+    futex_wait (&never, 0);
+}
+
+void
+test_main (void)
+{
+  CHECK (mmap_anon (anon, PAGE_CNT * 4096) != MAP_FAILED, "mmap_anon");
+  CHECK (thread_spawn (spinner, NULL, NULL) != PID_ERROR,
+         "thread_spawn spinner");
+  CHECK (thread_spawn (sleeper, NULL, NULL) != PID_ERROR,
+         "thread_spawn sleeper");
+  while (!spinning || !sleeping)
+    msleep (1);
+  msg ("exit with both threads running");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(page-threads-exit) begin
+(page-threads-exit) mmap_anon
+(page-threads-exit) thread_spawn spinner
+(page-threads-exit) thread_spawn sleeper
+(page-threads-exit) exit with both threads running
+(page-threads-exit) end
+page-threads-exit: exit(0)
+EOF
+pass;
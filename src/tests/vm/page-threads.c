@@ -0,0 +1,75 @@
+/* Has several threads of one process fault in the same pages of an
+   anonymous mapping and of a file mapping at the same time, each
+   writing its own byte of every anonymous page, and checks that no
+   write was lost to a page faulted in twice and that the file pages
+   came in whole. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define PAGE_CNT 64
+
+static char *const anon = (char *) 0x10000000;
+static char *const mapped = (char *) 0x20000000;
+
+/* Set to 1 to let the threads go, all at once. */
+static volatile int start;
+
+/* Value that thread ID writes to its byte of page PAGE. */
+static char
+value (int id, size_t page)
+{
+  return (char) (page * THREAD_CNT + id + 1);
+}
+
+/* Waits for the start, then touches every anonymous page in turn,
+   in the same order as the other threads, and reads the file
+   mapping.  Exits with 0 if the file came back right. */
+static void
+toucher (void *id_)
+{
+  int id = (int) id_;
+  size_t i;
+
+  while (!start)
+    futex_wait ((int *) &start, 0);
+  for (i = 0; i < PAGE_CNT; i++)
+    anon[i * 4096 + id] = value (id, i);
+  exit (memcmp (mapped, sample, strlen (sample)) == 0 ? 0 : 1);
+}
+
+void
+test_main (void)
+{
+  pid_t tids[THREAD_CNT];
+  int handle;
+  size_t i;
+  int id;
+
+  CHECK (mmap_anon (anon, PAGE_CNT * 4096) != MAP_FAILED, "mmap_anon");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap (handle, mapped) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  for (id = 0; id < THREAD_CNT; id++)
+    {
+      tids[id] = thread_spawn (toucher, (void *) id, NULL);
+      if (tids[id] == PID_ERROR)
+        fail ("thread_spawn failed");
+    }
+  msg ("fault the same pages from %d threads", THREAD_CNT);
+  start = 1;
+  futex_wake ((int *) &start, THREAD_CNT);
+  for (id = 0; id < THREAD_CNT; id++)
+    if (wait (tids[id]) != 0)
+      fail ("thread %d read the wrong file data", id);
+
+  for (i = 0; i < PAGE_CNT; i++)
+    for (id = 0; id < THREAD_CNT; id++)
+      if (anon[i * 4096 + id] != value (id, i))
+        fail ("thread %d's write to page %zu was lost", id, i);
+  msg ("every write is there");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-threads) begin
+(page-threads) mmap_anon
+(page-threads) open "sample.txt"
+(page-threads) mmap "sample.txt"
+(page-threads) fault the same pages from 4 threads
+(page-threads) every write is there
+(page-threads) end
+EOF
+pass;
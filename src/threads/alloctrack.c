@@ -0,0 +1,124 @@
+#include "threads/alloctrack.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+#ifdef ALLOC_TRACK
+/* Most call sites tracked per allocator, including the catch-all
+   tag 0.  Tags must fit in an alloc_tag. */
+#define SITE_MAX 128
+
+/* Counters for one call site. */
+struct alloc_site
+  {
+    void *site;                 /* Caller's return address. */
+    size_t objects;             /* Blocks or pages not yet freed. */
+    size_t bytes;               /* Bytes not yet freed. */
+    size_t peak_bytes;          /* Most bytes held at once. */
+    uint64_t allocs;            /* Allocations ever. */
+  };
+
+/* Sites by allocator.  Entry 0 of each is the catch-all; the
+   others are claimed in order of first use and never given up, so
+   a tag stays valid for as long as its allocation lives. */
+static struct alloc_site sites[ALLOC_KIND_CNT][SITE_MAX];
+static size_t site_cnt[ALLOC_KIND_CNT];
+
+static const char *kind_names[ALLOC_KIND_CNT] = { "malloc", "palloc" };
+static const char *unit_names[ALLOC_KIND_CNT] = { "blocks", "pages" };
+
+/* Records that SITE allocated CNT blocks or pages, BYTES bytes in
+   all, from allocator KIND and returns the tag to pass to
+   alloctrack_remove() when they are freed.  Safe to call with
+   interrupts off. */
+alloc_tag
+alloctrack_add (enum alloc_kind kind, void *site, size_t cnt, size_t bytes)
+{
+  struct alloc_site *s;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  if (site_cnt[kind] == 0)
+    site_cnt[kind] = 1;
+  for (i = 1; i < site_cnt[kind]; i++)
+    if (sites[kind][i].site == site)
+      break;
+  if (i == site_cnt[kind])
+    {
+      if (i < SITE_MAX)
+        sites[kind][site_cnt[kind]++].site = site;
+      else
+        i = 0;
+    }
+
+  s = &sites[kind][i];
+  s->objects += cnt;
+  s->bytes += bytes;
+  if (s->bytes > s->peak_bytes)
+    s->peak_bytes = s->bytes;
+  s->allocs++;
+  intr_set_level (old_level);
+  return i;
+}
+
+/* Records that CNT blocks or pages, BYTES bytes in all, allocated
+   from KIND under TAG were freed. */
+void
+alloctrack_remove (enum alloc_kind kind, alloc_tag tag, size_t cnt,
+                   size_t bytes)
+{
+  struct alloc_site *s = &sites[kind][tag];
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  ASSERT (s->objects >= cnt && s->bytes >= bytes);
+  s->objects -= cnt;
+  s->bytes -= bytes;
+  intr_set_level (old_level);
+}
+
+/* Prints the call sites of allocator KIND that hold memory, those
+   holding the most first. */
+static void
+print_kind (enum alloc_kind kind)
+{
+  struct alloc_site *sorted[SITE_MAX];
+  size_t cnt = site_cnt[kind];
+  size_t i, j;
+
+  /* Insertion sort by bytes held. */
+  for (i = 0; i < cnt; i++)
+    {
+      struct alloc_site *s = &sites[kind][i];
+      for (j = i; j > 0 && sorted[j - 1]->bytes < s->bytes; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = s;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct alloc_site *s = sorted[i];
+      if (s->allocs == 0)
+        continue;
+      printf ("Alloc %s %p: %zu %s, %zu bytes (peak %zu), "
+              "%llu allocations\n",
+              kind_names[kind], s == &sites[kind][0] ? NULL : s->site,
+              s->objects, unit_names[kind], s->bytes, s->peak_bytes,
+              s->allocs);
+    }
+}
+#endif
+
+/* Prints per-call-site allocation counters, if they are compiled
+   in. */
+void
+alloctrack_print (void)
+{
+#ifdef ALLOC_TRACK
+  enum alloc_kind kind;
+
+  for (kind = 0; kind < ALLOC_KIND_CNT; kind++)
+    print_kind (kind);
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef THREADS_ALLOCTRACK_H
+#define THREADS_ALLOCTRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Allocation tracking by call site, for finding who holds kernel
+   memory and what leaks it.  Compiled in only when the kernel is
+   built with -DALLOC_TRACK, for example by adding it to DEFINES
+   in the build directory's Make.vars, since it changes the layout
+   of every malloc() block.  The call site, a return address, can
+   be turned into a source line with the "backtrace" tool. */
+
+/* Allocators whose call sites are counted separately. */
+enum alloc_kind
+  {
+    ALLOC_MALLOC,               /* malloc() blocks and bytes asked for. */
+    ALLOC_PALLOC,               /* palloc_get_*() pages and their bytes. */
+    ALLOC_KIND_CNT
+  };
+
+/* Tag 0 is shared by every site past the table's capacity. */
+typedef uint8_t alloc_tag;
+
+#ifdef ALLOC_TRACK
+alloc_tag alloctrack_add (enum alloc_kind, void *site, size_t cnt,
+                          size_t bytes);
+void alloctrack_remove (enum alloc_kind, alloc_tag, size_t cnt,
+                        size_t bytes);
+#endif
+void alloctrack_print (void);
+
+#endif /* threads/alloctrack.h */
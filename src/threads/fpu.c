@@ -0,0 +1,214 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+
+/* CR0 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR0_MP 0x00000002       /* Monitor coprocessor: let TS trap WAIT. */
+#define CR0_EM 0x00000004       /* Emulation: every FPU instruction traps. */
+#define CR0_TS 0x00000008       /* Task switched: next FPU instruction traps. */
+#define CR0_NE 0x00000020       /* Report x87 errors as #MF. */
+
+/* CR4 bits. */
+#define CR4_OSFXSR 0x00000200   /* OS uses FXSAVE/FXRSTOR; enables SSE. */
+#define CR4_OSXMMEXCPT 0x00000400 /* OS handles #XF. */
+
+/* FXSAVE area.  See [IA32-v2a] "FXSAVE". */
+struct fpu_state
+  {
+    uint8_t regs[512];
+  }
+__attribute__ ((aligned (16)));
+
+/* Can threads use the FPU? */
+static bool fpu_enabled;
+
+/* Thread whose state is in the FPU registers, or a null pointer. */
+static struct thread *fpu_owner;
+
+/* State right after FNINIT, with the default MXCSR, which every
+   thread starts from. */
+static struct fpu_state initial_state;
+
+/* Allocates struct fpu_state. */
+static struct slab_cache fpu_cache;
+
+/* Statistics. */
+static long long load_cnt;      /* Times #NM loaded a thread's state. */
+static long long first_cnt;     /* Threads that started using the FPU. */
+
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+static inline void
+fxsave (struct fpu_state *s)
+{
+  asm volatile ("fxsave %0" : "=m" (*s));
+}
+
+static inline void
+fxrstor (const struct fpu_state *s)
+{
+  asm volatile ("fxrstor %0" : : "m" (*s));
+}
+
+/* Turns on the FPU and SSE, if the CPU supports FXSAVE, with
+   CR0.TS set so that no thread owns it yet. */
+void
+fpu_init (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx, cr4;
+
+  slab_cache_init (&fpu_cache, "fpu", sizeof (struct fpu_state), NULL);
+
+  /* FXSR is CPUID.1:EDX bit 24, SSE bit 25. */
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  if (!(edx & (1 << 24)))
+    return;
+
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  cr4 |= CR4_OSFXSR;
+  if (edx & (1 << 25))
+    cr4 |= CR4_OSXMMEXCPT;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+
+  write_cr0 ((read_cr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  asm volatile ("fninit");
+  fxsave (&initial_state);
+  write_cr0 (read_cr0 () | CR0_TS);
+  fpu_enabled = true;
+}
+
+/* Handles #NM: gives the FPU to the running thread, loading its
+   state, after saving the previous owner's.  Returns false if the
+   FPU is disabled or there is no memory for the thread's state. */
+bool
+fpu_activate (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+
+  if (!fpu_enabled)
+    return false;
+  if (cur->fpu == NULL)
+    {
+      /* Allocating may sleep, but we had no state to lose. */
+      struct fpu_state *s = slab_alloc (&fpu_cache);
+      if (s == NULL)
+        return false;
+      *s = initial_state;
+      cur->fpu = s;
+      first_cnt++;
+    }
+
+  write_cr0 (read_cr0 () & ~CR0_TS);
+  if (fpu_owner != cur)
+    {
+      if (fpu_owner != NULL)
+        fxsave (fpu_owner->fpu);
+      fxrstor (cur->fpu);
+      fpu_owner = cur;
+      load_cnt++;
+    }
+  return true;
+}
+
+/* Called on every context switch to CUR, with interrupts off.
+   Lets CUR use the FPU without a trap if its state is still in the
+   registers, and makes its first use trap otherwise. */
+void
+fpu_schedule (struct thread *cur)
+{
+  uint32_t cr0;
+
+  if (!fpu_enabled)
+    return;
+  cr0 = read_cr0 ();
+  if (fpu_owner == cur)
+    {
+      if (cr0 & CR0_TS)
+        write_cr0 (cr0 & ~CR0_TS);
+    }
+  else if (!(cr0 & CR0_TS))
+    write_cr0 (cr0 | CR0_TS);
+}
+
+/* Gives the running thread, a new child of PARENT, a copy of
+   PARENT's FPU state, if it has any.  PARENT must not run in the
+   meantime.  Returns false if memory is short. */
+bool
+fpu_fork (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct fpu_state *s;
+  enum intr_level old_level;
+
+  ASSERT (cur->fpu == NULL);
+  if (parent->fpu == NULL)
+    return true;
+
+  s = slab_alloc (&fpu_cache);
+  if (s == NULL)
+    return false;
+
+  /* PARENT's state may still be in the registers. */
+  old_level = intr_disable ();
+  if (fpu_owner == parent)
+    {
+      write_cr0 (read_cr0 () & ~CR0_TS);
+      fxsave (parent->fpu);
+      write_cr0 (read_cr0 () | CR0_TS);
+    }
+  *s = *parent->fpu;
+  cur->fpu = s;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Frees the running thread's FPU state, as it exits. */
+void
+fpu_exit (void)
+{
+  struct thread *cur = thread_current ();
+  struct fpu_state *s = cur->fpu;
+  enum intr_level old_level;
+
+  if (s == NULL)
+    return;
+
+  old_level = intr_disable ();
+  if (fpu_owner == cur)
+    {
+      fpu_owner = NULL;
+      write_cr0 (read_cr0 () | CR0_TS);
+    }
+  cur->fpu = NULL;
+  intr_set_level (old_level);
+  slab_free (&fpu_cache, s);
+}
+
+/* Prints FPU statistics. */
+void
+fpu_print_stats (void)
+{
+  if (fpu_enabled)
+    printf ("FPU: %lld threads used it, %lld state loads\n",
+            first_cnt, load_cnt);
+}
@@ -0,0 +1,31 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* x87, MMX and SSE state.
+
+   A thread has no FPU state until its first FPU or SSE
+   instruction.  The CPU keeps CR0.TS set for every thread but the
+   one whose state is in the registers, so that instruction raises
+   #NM, and fpu_activate() then saves the previous owner's
+   registers and loads the thread's own, allocating them the first
+   time.  Threads that never touch the FPU cost nothing beyond a
+   check at each context switch.
+
+   Needs FXSAVE and FXRSTOR.  On a CPU without them the FPU stays
+   disabled, as it was before, and using it kills the process.
+
+   Interrupt handlers must not use the FPU, since the state in the
+   registers then belongs to the thread they interrupted. */
+
+void fpu_init (void);
+bool fpu_activate (void);
+void fpu_schedule (struct thread *);
+bool fpu_fork (struct thread *parent);
+void fpu_exit (void);
+void fpu_print_stats (void);
+
+#endif /* threads/fpu.h */
@@ -17,20 +17,31 @@
 #include "devices/shutdown.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/tunable.h"
 #include "vm/frame.h"
+#include "vm/mmap.h"
 #include "vm/page.h"
+#include "vm/replay.h"
+#include "vm/shm.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/process.h"
+#include "userprog/scstat.h"
+#include "userprog/sctrace.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -39,8 +50,12 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -62,8 +77,21 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* Boot profile: the time-stamp counter as each phase of main()
+   finished.  The TSC is read throughout, but only converted to
+   time once timer_calibrate() has measured it. */
+#define BOOT_PHASE_CNT 10
+struct boot_phase {
+  const char *name; /* Phase that just finished. */
+  uint64_t tsc;     /* rdtsc() at its end. */
+};
+static struct boot_phase boot_phases[BOOT_PHASE_CNT];
+static size_t boot_phase_cnt;
+
 static void bss_init(void);
 static void paging_init(void);
+static void boot_phase(const char *name);
+static void print_boot_profile(void);
 
 static char **read_command_line(void);
 static char **parse_options(char **argv);
@@ -83,6 +111,7 @@ int main(void) {
 
   /* Clear BSS. */
   bss_init();
+  boot_phase("loader");
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line();
@@ -100,8 +129,15 @@ int main(void) {
   /* Initialize memory system. */
   palloc_init(user_page_limit);
   malloc_init();
+  trace_init();
   frame_table_init(user_page_limit);
+  SPT_cache_init();
+  mapping_cache_init();
+  replay_init();
+  shm_init();
   paging_init();
+  fpu_init();
+  boot_phase("memory");
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -112,27 +148,41 @@ int main(void) {
   /* Initialize interrupt handlers. */
   intr_init();
   timer_init();
+  profile_init();
   kbd_init();
   input_init();
 #ifdef USERPROG
   exception_init();
   syscall_init();
+  process_init();
 #endif
+  boot_phase("interrupts");
 
   /* Start thread scheduler and enable interrupts. */
   thread_start();
+  console_start();
   serial_init_queue();
   timer_calibrate();
+  boot_phase("calibration");
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init();
+  virtio_blk_init();
+  ramdisk_init();
   locate_block_devices();
+  boot_phase("disks");
   filesys_init(format_filesys);
+  boot_phase("filesys");
   SD_init();
+  frame_cleaner_start();
+  frame_scanner_start();
+  frame_merger_start();
+  boot_phase("swap");
 #endif
 
   printf("Boot complete.\n");
+  print_boot_profile();
 
   /* Run actions specified on kernel command line. */
   run_actions(argv);
@@ -153,6 +203,28 @@ static void bss_init(void) {
   memset(&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Records that boot phase NAME has just finished. */
+static void boot_phase(const char *name) {
+  ASSERT(boot_phase_cnt < BOOT_PHASE_CNT);
+  boot_phases[boot_phase_cnt].name = name;
+  boot_phases[boot_phase_cnt].tsc = rdtsc();
+  boot_phase_cnt++;
+}
+
+/* Prints how long each boot phase took, in microseconds. */
+static void print_boot_profile(void) {
+  const struct boot_phase *p = boot_phases;
+  size_t i;
+
+  printf("Boot profile:");
+  for (i = 1; i < boot_phase_cnt; i++) {
+    uint64_t ns = clock_cycles_to_ns(p[i].tsc - p[i - 1].tsc);
+    printf("%s %s %" PRIu64 " us", i > 1 ? "," : "", p[i].name, ns / 1000);
+  }
+  printf("; total %" PRIu64 " us.\n",
+         clock_cycles_to_ns(p[boot_phase_cnt - 1].tsc - p[0].tsc) / 1000);
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
@@ -161,6 +233,11 @@ static void paging_init(void) {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t eax = 1, ebx, ecx, edx, cr4;
+
+  /* Find out about large pages (CPUID.1:EDX bit 3) and global
+     pages (bit 13). */
+  asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
 
   pd = init_page_dir = palloc_get_page(PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -176,7 +253,9 @@ static void paging_init(void) {
       pd[pde_idx] = pde_create(pt);
     }
 
-    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text);
+    /* Kernel mappings are the same in every page directory, so
+       mark them global to keep them in the TLB across CR3 loads. */
+    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text) | PTE_G;
   }
 
   /* Store the physical address of the page directory into CR3
@@ -185,6 +264,13 @@ static void paging_init(void) {
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile("movl %0, %%cr3" : : "r"(vtop(init_page_dir)));
+
+  /* Allow 4 MB pages in user page directories, and turn on global
+     pages, if the CPU has them. */
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  if (edx & (1 << 3)) cr4 |= CR4_PSE;
+  if (edx & (1 << 13)) cr4 |= CR4_PGE;
+  asm volatile("movl %0, %%cr4" : : "r"(cr4));
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -239,6 +325,16 @@ static char **parse_options(char **argv) {
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-ramdisk"))
+      ramdisk_set_sizes(value);
+    else if (!strcmp(name, "-flush"))
+      cache_set_flush_interval(atoi(value));
+    else if (!strcmp(name, "-trace-file"))
+      trace_set_file(value);
+    else if (!strcmp(name, "-inode")) {
+      if (value == NULL || !inode_set_layout(value))
+        PANIC("unknown inode layout `%s'", value ? value : "");
+    }
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -246,11 +342,59 @@ static char **parse_options(char **argv) {
 #endif
     else if (!strcmp(name, "-rs"))
       random_init(atoi(value));
-    else if (!strcmp(name, "-mlfqs"))
+    else if (!strcmp(name, "-calibrate")) {
+      char *khz = value != NULL ? strchr(value, ',') : NULL;
+      if (khz == NULL) PANIC("-calibrate needs LOOPS,KHZ");
+      timer_set_calibration(atoi(value), atoi(khz + 1));
+    } else if (!strcmp(name, "-mlfqs"))
       thread_mlfqs = true;
+    else if (!strcmp(name, "-lockprof"))
+      lock_profiling = true;
+    else if (!strcmp(name, "-intrlat"))
+      intr_latency_tracking = true;
+    else if (!strcmp(name, "-tune")) {
+      if (!tunable_parse(value))
+        PANIC("bad tunable setting `%s' (use -h for a list)",
+              value ? value : "");
+    }
+    else if (!strcmp(name, "-profile"))
+      profile_set_rate(value != NULL ? atoi(value) : 0);
+    else if (!strcmp(name, "-trace")) {
+      if (value == NULL || !trace_enable(value))
+        PANIC("unknown trace event in `%s'", value ? value : "");
+    }
 #ifdef USERPROG
     else if (!strcmp(name, "-ul"))
       user_page_limit = atoi(value);
+    else if (!strcmp(name, "-scstat"))
+      scstat_at_exit = true;
+    else if (!strcmp(name, "-sctrace"))
+      sctrace_prog = value;
+#endif
+#ifdef VM
+    else if (!strcmp(name, "-vm-policy")) {
+      if (value == NULL || !frame_set_policy(value))
+        PANIC("unknown replacement policy `%s'", value ? value : "");
+    } else if (!strcmp(name, "-vm-pff"))
+      frame_set_pff(true);
+    else if (!strcmp(name, "-zswap"))
+      zswap_set_pool_size(atoi(value));
+    else if (!strcmp(name, "-vm-large"))
+      SPT_set_large_pages(true);
+    else if (!strcmp(name, "-fault-around"))
+      SPT_set_fault_around(atoi(value));
+    else if (!strcmp(name, "-stack-chunk"))
+      SPT_set_stack_chunk(atoi(value));
+    else if (!strcmp(name, "-idle-scan"))
+      frame_set_idle_scan(atoi(value));
+    else if (!strcmp(name, "-vm-merge"))
+      frame_set_merge(atoi(value));
+    else if (!strcmp(name, "-exec-replay"))
+      replay_set_window(atoi(value));
+    else if (!strcmp(name, "-spt")) {
+      if (value == NULL || !SPT_set_impl(value))
+        PANIC("unknown SPT implementation `%s'", value ? value : "");
+    }
 #endif
     else
       PANIC("unknown option `%s' (use -h for help)", name);
@@ -301,6 +445,9 @@ static void run_actions(char **argv) {
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+#endif
+#ifdef VM
+      {"sptbench", 1, SPT_bench},
 #endif
       {NULL, 0, NULL},
   };
@@ -347,6 +494,9 @@ static void usage(void) {
       "Use these actions indirectly via `pintos' -g and -p options:\n"
       "  extract            Untar from scratch device into file system.\n"
       "  append FILE        Append FILE to tar file on scratch device.\n"
+#endif
+#ifdef VM
+      "  sptbench           Compare SPT hash table implementations.\n"
 #endif
       "\nOptions:\n"
       "  -h                 Print this help message and power off.\n"
@@ -356,16 +506,45 @@ static void usage(void) {
       "  -f                 Format file system device during startup.\n"
       "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
       "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+      "  -ramdisk=MB,...    Create RAM disks rd0, ... of MB megabytes each,\n"
+      "                     for use with -filesys, -scratch or -swap.\n"
+      "  -flush=MS          Write dirty cached sectors back every MS ms (0: off).\n"
+      "  -inode=NAME        Layout of new inodes: indexed, extent.\n"
+      "  -trace-file=NAME   Save the -trace records to file NAME.\n"
 #ifdef VM
       "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
       "  -rs=SEED           Set random number seed to SEED.\n"
+      "  -calibrate=LOOPS,KHZ  Skip timer calibration: LOOPS per tick,\n"
+      "                     TSC at KHZ kHz, as printed by an earlier boot.\n"
       "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+      "  -lockprof          Count lock contention; report at shutdown.\n"
+      "  -intrlat           Time interrupts-off windows; report the longest.\n"
+      "  -tune=NAME=VALUE   Set tunable NAME, as listed below, to VALUE.\n"
+      "  -profile[=HZ]      Sample kernel EIPs each tick, or HZ times a second;\n"
+      "                     print them at shutdown for backtrace --profile.\n"
+      "  -trace=EVENT,...   Record tracepoints (or \"all\"); print at shutdown.\n"
 #ifdef USERPROG
       "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+      "  -scstat            Print each process's syscall statistics at exit.\n"
+      "  -sctrace=PROG      Trace PROG's syscalls into trace.TID at its exit.\n"
+#endif
+#ifdef VM
+      "  -vm-policy=NAME    Page replacement: clock, clock2, clockpro.\n"
+      "  -vm-pff            Adjust frame quotas by page fault frequency.\n"
+      "  -zswap=PAGES       Keep up to PAGES pages of compressed swap in RAM.\n"
+      "  -vm-large          Map big mmaps and zero-fill areas with 4 MB pages.\n"
+      "  -fault-around=N    Map up to N file pages around a fault.\n"
+      "  -stack-chunk=N     Grow the stack by up to N pages per fault.\n"
+      "  -idle-scan=TICKS   Sample accessed bits every TICKS ticks (0: never).\n"
+      "  -vm-merge=TICKS    Merge identical private pages every TICKS ticks.\n"
+      "  -exec-replay=MS    Map pages faulted in the first MS ms of the last\n"
+      "                     runs at exec (0: never).\n"
+      "  -spt=NAME          Supplemental page table: hash, radix, open.\n"
 #endif
   );
+  tunable_print();
   shutdown_power_off();
 }
 
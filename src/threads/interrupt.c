@@ -11,6 +11,11 @@
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -39,6 +44,51 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Interrupts taken on each vector, and TSC cycles spent handling
+   them.  The cycles include any interrupts that nest inside the
+   handler.  For internal interrupts handled with interrupts on,
+   such as system calls and page faults, they also include time
+   that the handler spent sleeping. */
+static uint64_t intr_counts[INTR_CNT];
+static uint64_t intr_cycles[INTR_CNT];
+
+/* Interrupts-off latency tracking, turned on by kernel
+   command-line option "-intrlat" or tunable "debug.intrlat".  Each window that interrupts
+   spend off, from the intr_disable() or intr_set_level() that
+   turned them off to the one that turned them back on, is timed
+   with the TSC and charged to the address that turned them off.
+   A window can also end with an IRET into code running with
+   interrupts on, such as a new process's first return to user
+   mode; its end is not seen, so it is thrown away when the next
+   interrupt arrives.  Windows that hardware interrupt entry opens
+   are the handlers' time, counted in intr_cycles[] instead. */
+bool intr_latency_tracking;
+
+/* Call sites that turn interrupts off tracked.  Once every slot is
+   in use, a longer window evicts the site with the shortest
+   longest window. */
+#define INTR_LAT_SITES 64
+
+/* Sites printed by intr_latency_print(). */
+#define INTR_LAT_TOP 10
+
+/* Interrupts-off windows opened at one call site. */
+struct intr_lat_site {
+  void *caller;         /* Where interrupts were turned off. */
+  uint64_t cnt;         /* Windows. */
+  uint64_t cycles;      /* Total time off. */
+  uint64_t max_cycles;  /* Longest window. */
+  void *max_enabler;    /* Where that window ended. */
+};
+
+static struct intr_lat_site lat_sites[INTR_LAT_SITES];
+static uint64_t lat_off_start; /* TSC when interrupts went off, or 0. */
+static void *lat_off_caller;   /* Who turned them off. */
+
+/* Spurious IRQ 7 and IRQ 15 interrupts, which the PIC raises
+   without any device asking. */
+static unsigned int spurious_cnt;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -52,6 +102,7 @@ static bool yield_on_return;  /* Should we yield on interrupt return? */
 /* Programmable Interrupt Controller helpers. */
 static void pic_init(void);
 static void pic_end_of_interrupt(int irq);
+static bool pic_in_service(int irq);
 
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate(void (*)(void), int dpl);
@@ -60,32 +111,57 @@ static inline uint64_t make_idtr_operand(uint16_t limit, void *base);
 
 /* Interrupt handlers. */
 void intr_handler(struct intr_frame *args);
+static void external_handler(struct intr_frame *, uint64_t start);
 static void unexpected_interrupt(const struct intr_frame *);
 
-/* Returns the current interrupt status. */
-enum intr_level intr_get_level(void) {
-  uint32_t flags;
-
-  /* Push the flags register on the processor stack, then pop the
-     value off the stack into `flags'.  See [IA32-v2b] "PUSHF"
-     and "POP" and [IA32-v3a] 5.8.1 "Masking Maskable Hardware
-     Interrupts". */
-  asm volatile("pushfl; popl %0" : "=g"(flags));
-
-  return flags & FLAG_IF ? INTR_ON : INTR_OFF;
+/* Notes that CALLER just turned interrupts off.  Interrupts must
+   be off. */
+static void lat_begin(void *caller) {
+  lat_off_start = rdtsc();
+  lat_off_caller = caller;
 }
 
-/* Enables or disables interrupts as specified by LEVEL and
-   returns the previous interrupt status. */
-enum intr_level intr_set_level(enum intr_level level) {
-  return level == INTR_ON ? intr_enable() : intr_disable();
+/* Charges the window since lat_begin() to its call site, as ended
+   by ENABLER.  Interrupts must be off. */
+static void lat_end(void *enabler) {
+  struct intr_lat_site *s, *shortest = &lat_sites[0];
+  uint64_t len;
+  size_t i;
+
+  if (lat_off_start == 0) return;
+  len = rdtsc() - lat_off_start;
+  lat_off_start = 0;
+
+  for (i = 0; i < INTR_LAT_SITES; i++) {
+    s = &lat_sites[i];
+    if (s->caller == lat_off_caller || s->caller == NULL) break;
+    if (s->max_cycles < shortest->max_cycles) shortest = s;
+  }
+  if (i == INTR_LAT_SITES) {
+    if (len <= shortest->max_cycles) return;
+    s = shortest;
+    s->caller = NULL;
+  }
+  if (s->caller == NULL) {
+    s->caller = lat_off_caller;
+    s->cnt = s->cycles = s->max_cycles = 0;
+  }
+  s->cnt++;
+  s->cycles += len;
+  if (len > s->max_cycles) {
+    s->max_cycles = len;
+    s->max_enabler = enabler;
+  }
 }
 
-/* Enables interrupts and returns the previous interrupt status. */
-enum intr_level intr_enable(void) {
+/* Enables interrupts on behalf of CALLER and returns the previous
+   interrupt status. */
+static enum intr_level enable_from(void *caller) {
   enum intr_level old_level = intr_get_level();
   ASSERT(!intr_context());
 
+  if (intr_latency_tracking && old_level == INTR_OFF) lat_end(caller);
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -95,8 +171,9 @@ enum intr_level intr_enable(void) {
   return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level intr_disable(void) {
+/* Disables interrupts on behalf of CALLER and returns the
+   previous interrupt status. */
+static enum intr_level disable_from(void *caller) {
   enum intr_level old_level = intr_get_level();
 
   /* Disable interrupts by clearing the interrupt flag.
@@ -104,9 +181,41 @@ enum intr_level intr_disable(void) {
      Hardware Interrupts". */
   asm volatile("cli" : : : "memory");
 
+  if (intr_latency_tracking && old_level == INTR_ON) lat_begin(caller);
+
   return old_level;
 }
 
+/* Returns the current interrupt status. */
+enum intr_level intr_get_level(void) {
+  uint32_t flags;
+
+  /* Push the flags register on the processor stack, then pop the
+     value off the stack into `flags'.  See [IA32-v2b] "PUSHF"
+     and "POP" and [IA32-v3a] 5.8.1 "Masking Maskable Hardware
+     Interrupts". */
+  asm volatile("pushfl; popl %0" : "=g"(flags));
+
+  return flags & FLAG_IF ? INTR_ON : INTR_OFF;
+}
+
+/* Enables or disables interrupts as specified by LEVEL and
+   returns the previous interrupt status. */
+enum intr_level intr_set_level(enum intr_level level) {
+  void *caller = __builtin_return_address(0);
+  return level == INTR_ON ? enable_from(caller) : disable_from(caller);
+}
+
+/* Enables interrupts and returns the previous interrupt status. */
+enum intr_level intr_enable(void) {
+  return enable_from(__builtin_return_address(0));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level intr_disable(void) {
+  return disable_from(__builtin_return_address(0));
+}
+
 /* Initializes the interrupt system. */
 void intr_init(void) {
   uint64_t idtr_operand;
@@ -240,11 +349,20 @@ static void pic_init(void) {
 static void pic_end_of_interrupt(int irq) {
   ASSERT(irq >= 0x20 && irq < 0x30);
 
-  /* Acknowledge master PIC. */
-  outb(0x20, 0x20);
+  /* Acknowledge the slave PIC first if this is a slave interrupt,
+     then the master. */
+  if (irq >= 0x28) outb(PIC1_CTRL, 0x20);
+  outb(PIC0_CTRL, 0x20);
+}
+
+/* Returns true if the PIC that delivered IRQ, an interrupt
+   vector, has it in service, that is, if it was not spurious.
+   OCW3 0x0b selects the in-service register for reading. */
+static bool pic_in_service(int irq) {
+  uint16_t ctrl = irq >= 0x28 ? PIC1_CTRL : PIC0_CTRL;
 
-  /* Acknowledge slave PIC if this is a slave interrupt. */
-  if (irq >= 0x28) outb(0xa0, 0x20);
+  outb(ctrl, 0x0b);
+  return (inb(ctrl) & (1 << (irq & 7))) != 0;
 }
 
 /* Creates an gate that invokes FUNCTION.
@@ -307,43 +425,71 @@ static inline uint64_t make_idtr_operand(uint16_t limit, void *base) {
    intr-stubs.S.  FRAME describes the interrupt and the
    interrupted thread's registers. */
 void intr_handler(struct intr_frame *frame) {
-  bool external;
+  uint64_t start = rdtsc();
+  uint8_t vec_no = frame->vec_no;
   intr_handler_func *handler;
 
-  /* External interrupts are special.
-     We only handle one at a time (so interrupts must be off)
-     and they need to be acknowledged on the PIC (see below).
-     An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
-  if (external) {
-    ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT(!intr_context());
-
-    in_external_intr = true;
-    yield_on_return = false;
+  /* Interrupts were on when this one arrived, so any window still
+     open ended with an IRET that lat_end() never saw. */
+  if (frame->eflags & FLAG_IF) lat_off_start = 0;
+
+  intr_counts[vec_no]++;
+  if (vec_no >= 0x20 && vec_no < 0x30) {
+    external_handler(frame, start);
+    return;
   }
 
-  /* Invoke the interrupt's handler. */
-  handler = intr_handlers[frame->vec_no];
+  /* Invoke the interrupt's handler.  One that kills the process
+     does not return, and so is counted but not timed. */
+  handler = intr_handlers[vec_no];
   if (handler != NULL)
     handler(frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f) {
-    /* There is no handler, but this interrupt can trigger
-       spuriously due to a hardware fault or hardware race
-       condition.  Ignore it. */
-  } else
+  else
     unexpected_interrupt(frame);
+  intr_cycles[vec_no] += rdtsc() - start;
+}
 
-  /* Complete the processing of an external interrupt. */
-  if (external) {
-    ASSERT(intr_get_level() == INTR_OFF);
-    ASSERT(intr_context());
+/* Handles external interrupt FRAME, which arrived at TSC START.
 
-    in_external_intr = false;
-    pic_end_of_interrupt(frame->vec_no);
+   External interrupts are special.  We only handle one at a time
+   (so interrupts must be off) and they need to be acknowledged on
+   the PIC.  An external interrupt handler cannot sleep. */
+static void external_handler(struct intr_frame *frame, uint64_t start) {
+  uint8_t vec_no = frame->vec_no;
+  intr_handler_func *handler = intr_handlers[vec_no];
+
+  ASSERT(intr_get_level() == INTR_OFF);
+  ASSERT(!intr_context());
 
-    if (yield_on_return) thread_yield();
+  in_external_intr = true;
+  yield_on_return = false;
+  if (handler != NULL)
+    handler(frame);
+  else if ((vec_no == 0x27 || vec_no == 0x2f) && !pic_in_service(vec_no)) {
+    /* IRQ 7 and IRQ 15 can trigger spuriously due to a hardware
+       fault or hardware race condition.  Ignore it.  A spurious
+       interrupt is not in service, so it needs no EOI, except that
+       the master PIC does see the slave's IRQ 2 for IRQ 15. */
+    spurious_cnt++;
+    in_external_intr = false;
+    if (vec_no == 0x2f) outb(PIC0_CTRL, 0x20);
+    return;
+  } else
+    unexpected_interrupt(frame);
+  in_external_intr = false;
+  pic_end_of_interrupt(vec_no);
+
+  /* Account before yielding, which is not the handler's time. */
+  intr_cycles[vec_no] += rdtsc() - start;
+  if (yield_on_return) thread_yield();
+#ifdef USERPROG
+  /* A thread that never enters the kernel on its own still has to
+     die with its process, so check on the way back to user mode. */
+  if (frame->cs == SEL_UCSEG && process_dying()) {
+    intr_enable();
+    exit(-1);
   }
+#endif
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -387,5 +533,54 @@ void intr_dump_frame(const struct intr_frame *f) {
          f->cs, f->ds, f->es, f->ss);
 }
 
+/* Prints the interrupts taken on each vector and the average
+   time their handlers took. */
+void intr_print_stats(void) {
+  int i;
+
+  for (i = 0; i < INTR_CNT; i++)
+    if (intr_counts[i] != 0)
+      printf("Interrupt %#04x (%s): %llu, %llu ns each\n", i, intr_names[i],
+             intr_counts[i],
+             clock_cycles_to_ns(intr_cycles[i] / intr_counts[i]));
+  if (spurious_cnt != 0)
+    printf("Interrupts: %u spurious\n", spurious_cnt);
+}
+
+/* Turns latency tracking on or off, forgetting any window under
+   way, whose start the tracker may not have seen. */
+void intr_set_latency_tracking(bool on) {
+  enum intr_level old_level = intr_disable();
+  intr_latency_tracking = on;
+  lat_off_start = 0;
+  intr_set_level(old_level);
+}
+
+/* Prints the call sites with the longest interrupts-off windows,
+   if latency tracking is on. */
+void intr_latency_print(void) {
+  struct intr_lat_site *sorted[INTR_LAT_SITES];
+  size_t i, j, cnt = 0;
+
+  if (!intr_latency_tracking) return;
+
+  /* Insertion sort by longest window. */
+  for (i = 0; i < INTR_LAT_SITES && lat_sites[i].caller != NULL; i++) {
+    struct intr_lat_site *s = &lat_sites[i];
+    for (j = cnt; j > 0 && sorted[j - 1]->max_cycles < s->max_cycles; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = s;
+    cnt++;
+  }
+
+  for (i = 0; i < cnt && i < INTR_LAT_TOP; i++) {
+    struct intr_lat_site *s = sorted[i];
+    printf("Interrupts off at %p: %llu times, %llu ns each, "
+           "max %llu ns (on at %p)\n",
+           s->caller, s->cnt, clock_cycles_to_ns(s->cycles / s->cnt),
+           clock_cycles_to_ns(s->max_cycles), s->max_enabler);
+  }
+}
+
 /* Returns the name of interrupt VEC. */
 const char *intr_name(uint8_t vec) { return intr_names[vec]; }
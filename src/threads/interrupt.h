@@ -11,6 +11,9 @@ enum intr_level
     INTR_ON               /* Interrupts enabled. */
   };
 
+/* Set by kernel command-line option "-intrlat". */
+extern bool intr_latency_tracking;
+
 enum intr_level intr_get_level (void);
 enum intr_level intr_set_level (enum intr_level);
 enum intr_level intr_enable (void);
@@ -66,5 +69,8 @@ void intr_yield_on_return (void);
 
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
+void intr_print_stats (void);
+void intr_set_latency_tracking (bool);
+void intr_latency_print (void);
 
 #endif /* threads/interrupt.h */
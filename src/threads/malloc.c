@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/alloctrack.h"
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -32,7 +35,25 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor, every CPU has a "magazine": a
+   small stack of free blocks of that size that only it uses, so
+   most malloc() and free() calls just pop or push a pointer with
+   interrupts off and never touch the descriptor's lock.  An empty
+   magazine is refilled with MAG_BATCH blocks from the free list,
+   and a full one flushes MAG_BATCH blocks back to it.  Blocks in
+   a magazine still count as in use in their arena.
+
+   Big blocks of up to BIG_CLASS_MAX pages are not given straight
+   back to the page allocator when freed.  They are cached, one
+   list per page count, and reused for the next big request of the
+   same page count.  Once more than BIG_CACHE_MAX pages are cached,
+   the least recently freed big blocks go back to the page
+   allocator.
+
+   With ALLOC_TRACK, each block starts with a header recording the
+   size asked for and the tag of the call site that asked. */
 
 /* Descriptor. */
 struct desc
@@ -60,18 +81,69 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+#ifdef ALLOC_TRACK
+/* Header of a tracked block.  It keeps the rest of the block
+   8-byte aligned. */
+struct alloc_hdr
+  {
+    uint32_t size;              /* Bytes asked for. */
+    alloc_tag tag;              /* Call site's tag. */
+    uint8_t pad[3];
+  };
+#endif
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+#define DESC_MAX 10
+static struct desc descs[DESC_MAX]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* A CPU's cache of free blocks for one descriptor. */
+#define MAG_SIZE 16             /* Blocks a magazine holds. */
+#define MAG_BATCH 8             /* Blocks moved per refill or flush. */
+struct magazine
+  {
+    size_t cnt;                 /* Blocks in ROUNDS. */
+    struct block *rounds[MAG_SIZE]; /* Free blocks. */
+  };
+
+/* Magazines by CPU and descriptor.  Only their own CPU touches
+   them, with interrupts off. */
+static struct magazine magazines[CPU_MAX][DESC_MAX];
+
+/* Cache of freed big blocks. */
+#define BIG_CLASS_MAX 16        /* Largest cached big block, in pages. */
+#define BIG_CACHE_MAX 64        /* Most pages kept in the cache. */
+
+/* A cached big block, stored just past its arena header. */
+struct big_block
+  {
+    struct list_elem class_elem; /* Element in big_free[]. */
+    struct list_elem lru_elem;  /* Element in big_lru. */
+  };
+
+static struct lock big_lock;    /* Protects the members below. */
+static struct list big_free[BIG_CLASS_MAX + 1]; /* By page count, newest
+                                                   first. */
+static struct list big_lru;     /* All of them, newest first. */
+static size_t big_cached;       /* Pages in the cache. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t desc_get (struct desc *, struct block **, size_t cnt);
+static void desc_put (struct desc *, struct block **, size_t cnt);
+static void *malloc_at (size_t, void *site);
+static void *malloc_block (size_t);
+static struct arena *big_get (size_t page_cnt);
+static void big_put (struct arena *);
+static void *mag_get (struct desc *);
+static void mag_put (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
   size_t block_size;
+  size_t i;
 
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
@@ -82,15 +154,47 @@ malloc_init (void)
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+
+  for (i = 0; i <= BIG_CLASS_MAX; i++)
+    list_init (&big_free[i]);
+  list_init (&big_lru);
+  lock_init (&big_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Does the work of malloc(), on behalf of the caller at SITE. */
+static void *
+malloc_at (size_t size, void *site UNUSED)
+{
+#ifdef ALLOC_TRACK
+  struct alloc_hdr *h;
+
+  if (size == 0)
+    return NULL;
+  h = malloc_block (size + sizeof *h);
+  if (h == NULL)
+    return NULL;
+  h->size = size;
+  h->tag = alloctrack_add (ALLOC_MALLOC, site, 1, size);
+  return h + 1;
+#else
+  return malloc_block (size);
+#endif
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, or a
+   null pointer if memory is not available. */
+static void *
+malloc_block (size_t size)
 {
   struct desc *d;
-  struct block *b;
   struct arena *a;
 
   /* A null pointer satisfies a request for 0 bytes. */
@@ -107,7 +211,7 @@ malloc (size_t size)
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+      a = big_get (page_cnt);
       if (a == NULL)
         return NULL;
 
@@ -119,38 +223,7 @@ malloc (size_t size)
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  return mag_get (d);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -167,22 +240,41 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
   return p;
 }
 
+/* Returns the block behind P, a pointer returned by malloc(), and
+   stops tracking it. */
+static struct block *
+untrack (void *p)
+{
+#ifdef ALLOC_TRACK
+  struct alloc_hdr *h = (struct alloc_hdr *) p - 1;
+
+  alloctrack_remove (ALLOC_MALLOC, h->tag, 1, h->size);
+  return (struct block *) h;
+#else
+  return p;
+#endif
+}
+
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) 
 {
+#ifdef ALLOC_TRACK
+  return ((struct alloc_hdr *) block - 1)->size;
+#else
   struct block *b = block;
   struct arena *a = block_to_arena (b);
   struct desc *d = a->desc;
 
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+#endif
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -201,7 +293,7 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_at (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -220,7 +312,7 @@ free (void *p)
 {
   if (p != NULL)
     {
-      struct block *b = p;
+      struct block *b = untrack (p);
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
       
@@ -233,36 +325,251 @@ free (void *p)
           memset (b, 0xcc, d->block_size);
 #endif
   
-          lock_acquire (&d->lock);
+          mag_put (d, b);
+        }
+      else
+        {
+          /* It's a big block.  Cache or free its pages. */
+          big_put (a);
+          return;
+        }
+    }
+}
+
+/* Frees the least recently cached big blocks until no more than
+   MAX pages are cached.  The caller must hold big_lock. */
+static void
+big_trim (size_t max)
+{
+  while (big_cached > max)
+    {
+      struct big_block *bb = list_entry (list_pop_back (&big_lru),
+                                         struct big_block, lru_elem);
+      struct arena *a = (struct arena *) bb - 1;
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+      list_remove (&bb->class_elem);
+      big_cached -= a->free_cnt;
+      palloc_free_multiple (a, a->free_cnt);
+    }
+}
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
+/* Returns an arena of PAGE_CNT pages for a big block, reusing a
+   cached one if there is one, or a null pointer if memory is not
+   available.  The caller initializes the arena. */
+static struct arena *
+big_get (size_t page_cnt)
+{
+  struct arena *a = NULL;
+
+  if (page_cnt <= BIG_CLASS_MAX)
+    {
+      lock_acquire (&big_lock);
+      if (!list_empty (&big_free[page_cnt]))
+        {
+          struct big_block *bb = list_entry (
+            list_pop_front (&big_free[page_cnt]), struct big_block,
+            class_elem);
+          list_remove (&bb->lru_elem);
+          big_cached -= page_cnt;
+          a = (struct arena *) bb - 1;
+        }
+      lock_release (&big_lock);
+      if (a != NULL)
+        return a;
+    }
+
+  a = palloc_get_multiple (0, page_cnt);
+  if (a == NULL && big_cached > 0)
+    {
+      /* Cached blocks of other sizes are free memory too. */
+      lock_acquire (&big_lock);
+      big_trim (0);
+      lock_release (&big_lock);
+      a = palloc_get_multiple (0, page_cnt);
+    }
+  return a;
+}
+
+/* Caches big block arena A for reuse, or frees its pages if it is
+   too big to cache. */
+static void
+big_put (struct arena *a)
+{
+  struct big_block *bb = (struct big_block *) (a + 1);
+  size_t page_cnt = a->free_cnt;
+
+  if (page_cnt > BIG_CLASS_MAX)
+    {
+      palloc_free_multiple (a, page_cnt);
+      return;
+    }
+
+#ifndef NDEBUG
+  /* Clear the block to help detect use-after-free bugs. */
+  memset (a + 1, 0xcc, PGSIZE * page_cnt - sizeof *a);
+#endif
+
+  lock_acquire (&big_lock);
+  list_push_front (&big_free[page_cnt], &bb->class_elem);
+  list_push_front (&big_lru, &bb->lru_elem);
+  big_cached += page_cnt;
+  big_trim (BIG_CACHE_MAX);
+  lock_release (&big_lock);
+}
+
+/* Returns the running CPU's magazine for descriptor D.
+   Interrupts must be off. */
+static struct magazine *
+mag_current (struct desc *d)
+{
+  return &magazines[cpu_id ()][d - descs];
+}
+
+/* Returns a free block from descriptor D, from this CPU's magazine
+   if it has one, or a null pointer if memory is not available. */
+static void *
+mag_get (struct desc *d)
+{
+  struct block *batch[MAG_BATCH];
+  struct magazine *m;
+  enum intr_level old_level;
+  size_t cnt, i;
+
+  old_level = intr_disable ();
+  m = mag_current (d);
+  if (m->cnt > 0)
+    {
+      struct block *b = m->rounds[--m->cnt];
+      intr_set_level (old_level);
+      return b;
+    }
+  intr_set_level (old_level);
+
+  /* Refill.  We may sleep on the lock, so another thread on this
+     CPU may have refilled the magazine by the time we are back;
+     whatever no longer fits goes back to the free list. */
+  cnt = desc_get (d, batch, MAG_BATCH);
+  if (cnt == 0)
+    return NULL;
+  old_level = intr_disable ();
+  m = mag_current (d);
+  for (i = 1; i < cnt && m->cnt < MAG_SIZE; i++)
+    m->rounds[m->cnt++] = batch[i];
+  intr_set_level (old_level);
+  if (i < cnt)
+    desc_put (d, batch + i, cnt - i);
+  return batch[0];
+}
+
+/* Returns block B to descriptor D through this CPU's magazine. */
+static void
+mag_put (struct desc *d, struct block *b)
+{
+  struct block *batch[MAG_BATCH];
+  struct magazine *m;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  m = mag_current (d);
+  if (m->cnt < MAG_SIZE)
+    {
+      m->rounds[m->cnt++] = b;
+      intr_set_level (old_level);
+      return;
+    }
+
+  /* Full: take B and the oldest MAG_BATCH - 1 blocks out of the
+     magazine and give them back to the free list. */
+  batch[0] = b;
+  memcpy (batch + 1, m->rounds, (MAG_BATCH - 1) * sizeof *batch);
+  memmove (m->rounds, m->rounds + MAG_BATCH - 1,
+           (m->cnt - (MAG_BATCH - 1)) * sizeof *m->rounds);
+  m->cnt -= MAG_BATCH - 1;
+  intr_set_level (old_level);
+  desc_put (d, batch, MAG_BATCH);
+}
+
+/* Takes up to CNT blocks from descriptor D's free list into
+   BLOCKS, adding an arena first if the list is empty.  Returns
+   the number taken, which is 0 only if no memory is available. */
+static size_t
+desc_get (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t taken = 0;
+
+  lock_acquire (&d->lock);
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      struct arena *a;
+      size_t i;
 
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL) 
+        {
           lock_release (&d->lock);
+          return 0; 
         }
-      else
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++) 
         {
-          /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Get blocks from the free list. */
+  while (taken < cnt && !list_empty (&d->free_list))
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      block_to_arena (b)->free_cnt--;
+      blocks[taken++] = b;
+    }
+  lock_release (&d->lock);
+  return taken;
+}
+
+/* Returns the CNT blocks in BLOCKS to descriptor D's free list,
+   giving arenas that become entirely unused back to the page
+   allocator. */
+static void
+desc_put (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t k;
+
+  lock_acquire (&d->lock);
+  for (k = 0; k < cnt; k++)
+    {
+      struct block *b = blocks[k];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t i;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (i = 0; i < d->blocks_per_arena; i++) 
+            {
+              struct block *b = arena_to_block (a, i);
+              list_remove (&b->free_elem);
+            }
+          palloc_free_page (a);
         }
     }
+  lock_release (&d->lock);
 }
-
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
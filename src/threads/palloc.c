@@ -1,14 +1,17 @@
 #include "threads/palloc.h"
-#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/alloctrack.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/spinlock.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -21,27 +24,131 @@
    that the kernel needs to have memory for its own operations
    even if user processes are swapping like mad.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   At boot, half of system RAM is given to the kernel pool and
+   half to the user pool, but the split moves with demand.  Memory
+   is divided into chunks of CHUNK_PAGES pages, each owned by one
+   pool at a time.  A pool that runs out of pages borrows a wholly
+   free chunk from the other, as long as the lender keeps a reserve
+   of free pages and the user pool stays within its page limit.  A
+   chunk that the borrower later frees up entirely goes back to the
+   pool it came from, if that pool has run short since.  The chunk
+   that the boot-time split falls in, and a partial chunk at the end
+   of memory, never move.
+
+   Each pool is a binary buddy allocator.  Free memory is kept as
+   blocks of 2**K pages, for K up to ORDER_MAX, each aligned to its
+   size relative to the base of memory and linked on the free list
+   for its order.  An allocation takes the smallest block that
+   fits, splitting larger ones as needed, and gives back the pages
+   past the request.  Freeing a block merges it with its buddy, the
+   other half of the block it was split from, for as long as that
+   is free.  Both take O(log n) steps.  Each pool's page map covers
+   all of memory, with pages it does not own marked allocated, so
+   blocks never merge across chunks of different pools.
+
+   The idle thread zeroes free pages ahead of time, see
+   palloc_zero_idle(), and each pool keeps a few of them aside for
+   single-page PAL_ZERO requests, which then skip the memset().
+
+   In front of each pool, every CPU keeps a small cache of free
+   single pages, which it takes from and frees to with interrupts
+   off instead of the pool's lock.  An empty cache is refilled, and
+   a full one drained, PCP_BATCH pages at a time under the lock.
+   Cached pages look allocated to the buddy lists, so they go back
+   to them whenever a request or a chunk move needs contiguous free
+   memory, and pages of borrowed chunks are never cached, so that
+   the chunks can go back soon. */
+
+/* Largest block order: blocks of 2**ORDER_MAX pages. */
+#define ORDER_MAX 20
+
+/* Pools lend each other chunks of 2**CHUNK_ORDER pages, 256 kB. */
+#define CHUNK_ORDER PALLOC_CHUNK_ORDER
+#define CHUNK_PAGES PALLOC_CHUNK_PAGES
+
+/* A page's entry in its pool's page map.  The first page of a free
+   block records the block's order with PAGE_FREE set; every other
+   page's entry is 0. */
+#define PAGE_FREE 0x80
+
+/* Most pre-zeroed pages a pool keeps, and the free pages it leaves
+   alone so that zeroing never competes with real allocations. */
+#define ZEROED_MAX 64
+#define ZEROED_RESERVE (2 * ZEROED_MAX)
+
+/* A CPU's cache of free pages of one pool. */
+#define PCP_SIZE 16             /* Pages a cache holds. */
+#define PCP_BATCH 8             /* Pages moved per refill or drain. */
+struct page_cache
+  {
+    size_t cnt;                 /* Pages in PAGES. */
+    size_t pages[PCP_SIZE];     /* Free pages, by index. */
+  };
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    struct spinlock lock;               /* Mutual exclusion. */
+    uint8_t *page_map;                  /* One entry per page of memory. */
+    struct list free[ORDER_MAX + 1];    /* Free blocks by order. */
+    size_t page_cnt;                    /* Number of pages owned. */
+    size_t page_max;                    /* Most pages it may own. */
+    size_t reserve;                     /* Free pages it keeps when lending. */
+    size_t free_cnt;                    /* Number of free pages. */
+    size_t zeroed[ZEROED_MAX];          /* Pre-zeroed pages, by index. */
+    size_t zeroed_cnt;                  /* Number of pre-zeroed pages. */
+    size_t used_max;                    /* Most pages in use at once. */
+    size_t borrowed_cnt;                /* Chunks owned from the other pool. */
+    bool wanting;                       /* Failed to borrow since it last did? */
+    const char *name;                   /* Name, for statistics. */
+    struct page_cache caches[CPU_MAX];  /* Per-CPU caches, each only
+                                           touched by its own CPU with
+                                           interrupts off. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* The memory that the pools share, MEM_PAGE_CNT pages at MEM_BASE.
+   Pages below SPLIT started out in the kernel pool, the rest in
+   the user pool. */
+static uint8_t *mem_base;
+static size_t mem_page_cnt;
+static size_t split;
+
+/* A chunk of memory. */
+struct chunk
+  {
+    struct pool *owner;                 /* Current owner, null if fixed. */
+    struct pool *home;                  /* Owner at boot. */
+  };
+
+/* Chunk map, changed only with both pools' locks held. */
+static struct chunk *chunks;
+static size_t chunk_cnt;
+
+#ifdef ALLOC_TRACK
+static alloc_tag *tag_map;              /* Allocating site, per page. */
+#endif
+
+static void init_pool (struct pool *, size_t start, size_t end,
+                       size_t page_max, const char *name);
+static struct pool *page_pool (size_t page_idx);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static size_t pool_get (struct pool *, size_t page_cnt, bool zero,
+                        bool *zeroed);
+static void *get_pages (enum palloc_flags, size_t page_cnt, void *site);
+static size_t cache_get (struct pool *, bool zero);
+static bool cache_put (struct pool *, size_t page_idx);
+static size_t cache_drain (struct pool *);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void carve_block (struct pool *, size_t idx, int order,
+                         size_t page_idx, size_t page_cnt);
+static bool borrow (struct pool *);
+static void return_chunks (struct pool *, size_t page_idx, size_t page_cnt);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages are put into the user pool, now or later. */
 void
 palloc_init (size_t user_page_limit)
 {
@@ -49,16 +156,53 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t user_pages, map_bytes, map_pages;
+  uint8_t *maps = free_start;
+  size_t i;
+
+  /* We'll put both page maps, the tag map if allocations are
+     tracked, and the chunk map at the start of free memory.  They
+     are sized for all of free memory, a little more than they
+     cover. */
+#ifdef ALLOC_TRACK
+  map_bytes = free_pages * (2 + sizeof (alloc_tag));
+#else
+  map_bytes = free_pages * 2;
+#endif
+  map_bytes += DIV_ROUND_UP (free_pages, CHUNK_PAGES) * sizeof *chunks;
+  map_pages = DIV_ROUND_UP (map_bytes, PGSIZE);
+  if (map_pages >= free_pages)
+    PANIC ("Not enough memory for page maps.");
+  mem_base = free_start + map_pages * PGSIZE;
+  mem_page_cnt = free_pages - map_pages;
+  chunk_cnt = DIV_ROUND_UP (mem_page_cnt, CHUNK_PAGES);
+
+  kernel_pool.page_map = maps;
+  maps += mem_page_cnt;
+  user_pool.page_map = maps;
+  maps += mem_page_cnt;
+#ifdef ALLOC_TRACK
+  tag_map = (alloc_tag *) maps;
+  maps += mem_page_cnt * sizeof *tag_map;
+#endif
+  chunks = (struct chunk *) maps;
+
+  /* Give half of memory to kernel, half to user. */
+  user_pages = mem_page_cnt / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  split = mem_page_cnt - user_pages;
+  for (i = 0; i < chunk_cnt; i++)
+    {
+      size_t start = i * CHUNK_PAGES;
+      size_t end = start + CHUNK_PAGES;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+      chunks[i].home = start < split ? &kernel_pool : &user_pool;
+      chunks[i].owner = (end > mem_page_cnt || (start < split && split < end)
+                         ? NULL : chunks[i].home);
+    }
+  init_pool (&kernel_pool, 0, split, SIZE_MAX, "kernel pool");
+  init_pool (&user_pool, split, mem_page_cnt, user_page_limit, "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -69,29 +213,62 @@ palloc_init (size_t user_page_limit)
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return get_pages (flags, page_cnt, __builtin_return_address (0));
+}
+
+/* Does the work of palloc_get_multiple(), on behalf of the caller
+   at SITE. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, void *site UNUSED)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  size_t tries;
+  bool zeroed;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  page_idx = SIZE_MAX;
+  zeroed = false;
+  if (page_cnt == 1)
+    page_idx = cache_get (pool, flags & PAL_ZERO);
+  if (page_idx == SIZE_MAX)
+    {
+      spin_lock (&pool->lock);
+      page_idx = pool_get (pool, page_cnt, flags & PAL_ZERO, &zeroed);
+      spin_unlock (&pool->lock);
+    }
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  /* Out of pages: borrow from the other pool, a chunk for each
+     CHUNK_PAGES pages wanted, which is all that can help unless
+     the borrowed chunks happen to be adjacent. */
+  for (tries = DIV_ROUND_UP (page_cnt, CHUNK_PAGES);
+       page_idx == SIZE_MAX && tries > 0 && borrow (pool); tries--)
+    {
+      spin_lock (&pool->lock);
+      page_idx = pool_get (pool, page_cnt, flags & PAL_ZERO, &zeroed);
+      spin_unlock (&pool->lock);
+    }
+
+  if (page_idx != SIZE_MAX)
+    pages = mem_base + PGSIZE * page_idx;
   else
     pages = NULL;
 
-  if (pages != NULL) 
+  if (pages != NULL)
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
+#ifdef ALLOC_TRACK
+      memset (tag_map + page_idx,
+              alloctrack_add (ALLOC_PALLOC, site, page_cnt,
+                              PGSIZE * page_cnt), page_cnt);
+#endif
     }
-  else 
+  else
     {
       if (flags & PAL_ASSERT)
         PANIC ("palloc_get: out of pages");
@@ -108,14 +285,17 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
-palloc_get_page (enum palloc_flags flags) 
+palloc_get_page (enum palloc_flags flags)
 {
-  return palloc_get_multiple (flags, 1);
+  return get_pages (flags, 1, __builtin_return_address (0));
 }
 
-/* Frees the PAGE_CNT pages starting at PAGES. */
+/* Frees the PAGE_CNT pages starting at PAGES.  They need not be
+   exactly one earlier allocation: any run of allocated pages may
+   be freed.  This does not sleep, so the scheduler may free a
+   dead thread's page with it. */
 void
-palloc_free_multiple (void *pages, size_t page_cnt) 
+palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
@@ -124,59 +304,631 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
+  ASSERT ((uint8_t *) pages >= mem_base);
+  page_idx = pg_no (pages) - pg_no (mem_base);
+  ASSERT (page_idx + page_cnt <= mem_page_cnt);
 
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  /* The pages' chunks cannot move while they are allocated. */
+  pool = page_pool (page_idx);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+#ifdef ALLOC_TRACK
+  {
+    size_t i;
+    for (i = page_idx; i < page_idx + page_cnt; i++)
+      alloctrack_remove (ALLOC_PALLOC, tag_map[i], 1, PGSIZE);
+  }
+#endif
+
+  if (page_cnt == 1 && cache_put (pool, page_idx))
+    return;
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  spin_lock (&pool->lock);
+  pool_free (pool, page_idx, page_cnt);
+  spin_unlock (&pool->lock);
+
+  if (pool->borrowed_cnt > 0)
+    return_chunks (pool, page_idx, page_cnt);
 }
 
 /* Frees the page at PAGE. */
 void
-palloc_free_page (void *page) 
+palloc_free_page (void *page)
 {
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Moves a wholly free chunk from the other pool into the pool that
+   FLAGS selects, as when that pool runs out of pages, so that a
+   caller can grow it ahead of need.  Returns true if successful. */
+bool
+palloc_borrow (enum palloc_flags flags)
+{
+  return borrow (flags & PAL_USER ? &user_pool : &kernel_pool);
+}
+
+/* Returns true if the kernel pool has run short while the user
+   pool holds chunks borrowed from it, which it may then want to
+   free up. */
+bool
+palloc_reclaim_wanted (void)
+{
+  return kernel_pool.wanting && user_pool.borrowed_cnt > 0;
+}
+
+/* Returns true if the pool that FLAGS selects has failed to borrow
+   a chunk since it last got one. */
+bool
+palloc_borrow_wanted (enum palloc_flags flags)
+{
+  return (flags & PAL_USER ? &user_pool : &kernel_pool)->wanting;
+}
+
+/* Returns true if user pool page PAGE lies in a chunk that the
+   kernel pool lent and now wants back.  Once every page in the
+   chunk is freed, it goes back. */
+bool
+palloc_page_wanted (const void *page)
+{
+  struct chunk *c = &chunks[(pg_no (page) - pg_no (mem_base)) / CHUNK_PAGES];
+
+  return kernel_pool.wanting && c->owner == &user_pool
+         && c->home == &kernel_pool;
+}
+
+/* Returns true if PAGE lies in memory that the user pool owns now.
+   Chunks move between the pools, so this is only a hint unless
+   PAGE is allocated. */
+bool
+palloc_page_is_user (const void *page)
+{
+  size_t page_idx = pg_no (page) - pg_no (mem_base);
+
+  return page_idx < mem_page_cnt && page_pool (page_idx) == &user_pool;
+}
+
+/* Takes user pool page PAGE out of free memory, as if
+   palloc_get_page() had returned it, and returns true, if it is
+   free.  This lets the VM system free up a run of contiguous pages
+   one page at a time, see frame_compact(). */
+bool
+palloc_claim_page (void *page)
+{
+  struct pool *pool = &user_pool;
+  size_t page_idx = pg_no (page) - pg_no (mem_base);
+  bool claimed = false;
+  size_t i;
+  int order;
+
+  ASSERT (pg_ofs (page) == 0 && page_idx < mem_page_cnt);
+
+  /* The chunk map only changes with both pools' locks held. */
+  spin_lock (&pool->lock);
+  if (page_pool (page_idx) == pool)
+    {
+      struct page_cache *pc = &pool->caches[cpu_id ()];
+
+      for (i = 0; i < pc->cnt && !claimed; i++)
+        if (pc->pages[i] == page_idx)
+          {
+            pc->pages[i] = pc->pages[--pc->cnt];
+            claimed = true;
+          }
+      for (i = 0; i < pool->zeroed_cnt && !claimed; i++)
+        if (pool->zeroed[i] == page_idx)
+          {
+            pool->zeroed[i] = pool->zeroed[--pool->zeroed_cnt];
+            claimed = true;
+          }
+
+      /* Else PAGE is free only inside one free block. */
+      for (order = 0; order <= ORDER_MAX && !claimed; order++)
+        {
+          size_t idx = page_idx & ~(((size_t) 1 << order) - 1);
+          if (pool->page_map[idx] == (PAGE_FREE | order))
+            {
+              carve_block (pool, idx, order, page_idx, 1);
+              claimed = true;
+            }
+        }
+    }
+  spin_unlock (&pool->lock);
+
+#ifdef ALLOC_TRACK
+  if (claimed)
+    tag_map[page_idx] = alloctrack_add (ALLOC_PALLOC,
+                                        __builtin_return_address (0),
+                                        1, PGSIZE);
+#endif
+  return claimed;
+}
+
+/* Zeroes one free page of the user pool, or failing that the
+   kernel pool, and sets it aside for PAL_ZERO requests.  Returns
+   false if both pools have all the pre-zeroed pages they keep, or
+   too few free pages to spare one.  Called by the idle thread with
+   interrupts on: the memset() runs unlocked and preemptible, on a
+   page that nobody else can reach. */
+bool
+palloc_zero_idle (void)
+{
+  struct pool *pools[] = { &user_pool, &kernel_pool };
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      struct pool *pool = pools[i];
+      size_t page_idx = SIZE_MAX;
+
+      spin_lock (&pool->lock);
+      if (pool->zeroed_cnt < ZEROED_MAX
+          && pool->free_cnt > ZEROED_RESERVE)
+        page_idx = pool_alloc (pool, 1);
+      spin_unlock (&pool->lock);
+      if (page_idx == SIZE_MAX)
+        continue;
+
+      memset (mem_base + PGSIZE * page_idx, 0, PGSIZE);
+
+      /* The page's chunk cannot have moved, since the page was
+         allocated all along. */
+      spin_lock (&pool->lock);
+      if (pool->zeroed_cnt < ZEROED_MAX)
+        pool->zeroed[pool->zeroed_cnt++] = page_idx;
+      else
+        pool_free (pool, page_idx, 1);
+      spin_unlock (&pool->lock);
+      return true;
+    }
+  return false;
+}
+
+/* Prints each pool's page use now and at its peak, and the chunks
+   it has borrowed. */
+void
+palloc_print_stats (void)
+{
+  struct pool *pools[] = { &kernel_pool, &user_pool };
+  size_t i;
+
+  for (i = 0; i < sizeof pools / sizeof *pools; i++)
+    {
+      struct pool *pool = pools[i];
+      size_t cached = 0;
+      int cpu;
+
+      for (cpu = 0; cpu < CPU_MAX; cpu++)
+        cached += pool->caches[cpu].cnt;
+      printf ("Palloc: %s: %zu of %zu pages in use, peak %zu, "
+              "%zu chunks borrowed, %zu pages cached\n", pool->name,
+              pool->page_cnt - pool->free_cnt - pool->zeroed_cnt - cached,
+              pool->page_cnt, pool->used_max, pool->borrowed_cnt, cached);
+    }
+}
+
+/* Returns the kernel virtual address of the first page that may
+   ever be in the user pool.  User pages all lie within
+   palloc_user_page_max() pages of this address, so
+   (PAGE - palloc_user_base ()) / PGSIZE is a dense index for any
+   user page. */
+void *
+palloc_user_base (void)
+{
+  return mem_base;
+}
+
+/* Returns the number of pages in the range that user pages come
+   from, which bounds the size of the user pool. */
+size_t
+palloc_user_page_max (void)
+{
+  return mem_page_cnt;
+}
+
+/* Returns the number of pages in the user pool now. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return user_pool.page_cnt;
+}
+
+/* Initializes pool P as owning pages START through END - 1,
+   and at most PAGE_MAX pages later, naming it NAME for debugging
+   purposes. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, size_t start, size_t end, size_t page_max,
+           const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  int order;
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  printf ("%zu pages available in %s.\n", end - start, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Initialize the pool, with every page allocated, then free the
+     ones it owns. */
+  spin_init (&p->lock);
+  memset (p->page_map, 0, mem_page_cnt);
+  for (order = 0; order <= ORDER_MAX; order++)
+    list_init (&p->free[order]);
+  p->page_cnt = end - start;
+  p->page_max = page_max;
+  p->reserve = p->page_cnt / 8;
+  p->free_cnt = 0;
+  p->zeroed_cnt = 0;
+  p->used_max = 0;
+  p->borrowed_cnt = 0;
+  p->wanting = false;
+  p->name = name;
+  memset (p->caches, 0, sizeof p->caches);
+  pool_free (p, start, end - start);
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
+/* Returns the pool that owns page PAGE_IDX. */
+static struct pool *
+page_pool (size_t page_idx)
+{
+  struct pool *owner = chunks[page_idx / CHUNK_PAGES].owner;
+
+  if (owner != NULL)
+    return owner;
+  return page_idx < split ? &kernel_pool : &user_pool;
+}
+
+/* Returns the list element at the start of block IDX. */
+static struct list_elem *
+block_elem (size_t idx)
+{
+  return (struct list_elem *) (mem_base + PGSIZE * idx);
+}
+
+/* Returns the index of the block whose list element is E. */
+static size_t
+block_idx (struct list_elem *e)
+{
+  return ((uint8_t *) e - mem_base) / PGSIZE;
+}
+
+/* Frees the single block of 2**ORDER pages at IDX, which must be
+   aligned to its size, merging it with its buddies. */
+static void
+free_block (struct pool *pool, size_t idx, int order)
+{
+  pool->free_cnt += (size_t) 1 << order;
+  for (; order < ORDER_MAX; order++)
+    {
+      size_t buddy = idx ^ ((size_t) 1 << order);
+      if (buddy >= mem_page_cnt
+          || pool->page_map[buddy] != (PAGE_FREE | order))
+        break;
+      list_remove (block_elem (buddy));
+      pool->page_map[buddy] = 0;
+      idx &= ~((size_t) 1 << order);
+    }
+  pool->page_map[idx] = PAGE_FREE | order;
+  list_push_front (&pool->free[order], block_elem (idx));
+}
+
+/* Frees PAGE_CNT pages at PAGE_IDX in POOL as the largest aligned
+   blocks that tile them.  The caller must hold POOL's lock. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      while (order < ORDER_MAX
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      ASSERT (!(pool->page_map[page_idx] & PAGE_FREE));
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes the PAGE_CNT pages at PAGE_IDX out of POOL's free block of
+   2**ORDER pages at IDX, which must hold them all, and frees the
+   rest of the block again.  The caller must hold POOL's lock. */
+static void
+carve_block (struct pool *pool, size_t idx, int order, size_t page_idx,
+             size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+  size_t block_end = idx + ((size_t) 1 << order);
+
+  ASSERT (idx <= page_idx && end <= block_end);
+
+  list_remove (block_elem (idx));
+  pool->page_map[idx] = 0;
+  pool->free_cnt -= (size_t) 1 << order;
+  if (idx < page_idx)
+    pool_free (pool, idx, page_idx - idx);
+  if (end < block_end)
+    pool_free (pool, end, block_end - end);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or SIZE_MAX if no free block is big enough.
+   The caller must hold POOL's lock. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt)
+{
+  int want = 0, order;
+  size_t idx;
+
+  while (((size_t) 1 << want) < page_cnt)
+    if (++want > ORDER_MAX)
+      return SIZE_MAX;
+  if (page_cnt > pool->free_cnt)
+    return SIZE_MAX;
+
+  for (order = want; order <= ORDER_MAX; order++)
+    if (!list_empty (&pool->free[order]))
+      break;
+  if (order > ORDER_MAX)
+    return SIZE_MAX;
+
+  idx = block_idx (list_pop_front (&pool->free[order]));
+  pool->page_map[idx] = 0;
+  pool->free_cnt -= (size_t) 1 << order;
+
+  /* Split down to the order wanted, freeing upper halves. */
+  while (order > want)
+    {
+      order--;
+      free_block (pool, idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages past the request. */
+  if (page_cnt < ((size_t) 1 << want))
+    pool_free (pool, idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+  return idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL like pool_alloc(),
+   but serves a single page that is to be ZERO from the pre-zeroed
+   ones first.  Pre-zeroed pages are free memory too, so when the
+   buddy lists run dry one is handed out for any single-page
+   request, or for a multi-page one they all go back to the buddy
+   lists to coalesce, and so do the pages in this CPU's cache, as a
+   last resort.  Sets *ZEROED to true if the pages returned
+   are known to be zero.  The caller must hold POOL's lock. */
+static size_t
+pool_get (struct pool *pool, size_t page_cnt, bool zero, bool *zeroed)
+{
+  size_t idx = SIZE_MAX;
+
+  *zeroed = false;
+  if (!zero || page_cnt > 1 || pool->zeroed_cnt == 0)
+    idx = pool_alloc (pool, page_cnt);
+  if (idx == SIZE_MAX && pool->zeroed_cnt > 0)
+    {
+      if (page_cnt == 1)
+        {
+          *zeroed = true;
+          idx = pool->zeroed[--pool->zeroed_cnt];
+        }
+      else
+        {
+          while (pool->zeroed_cnt > 0)
+            pool_free (pool, pool->zeroed[--pool->zeroed_cnt], 1);
+          idx = pool_alloc (pool, page_cnt);
+        }
+    }
+  if (idx == SIZE_MAX && cache_drain (pool) > 0)
+    idx = pool_alloc (pool, page_cnt);
+
+  if (idx != SIZE_MAX
+      && pool->page_cnt - pool->free_cnt - pool->zeroed_cnt > pool->used_max)
+    pool->used_max = pool->page_cnt - pool->free_cnt - pool->zeroed_cnt;
+  return idx;
+}
+
+/* Acquires both pools' locks, always in the same order. */
+static void
+lock_pools (void)
+{
+  spin_lock (&kernel_pool.lock);
+  spin_lock (&user_pool.lock);
+}
+
+/* Releases both pools' locks, in the reverse order, which puts
+   the interrupt level back the way lock_pools() found it. */
+static void
+unlock_pools (void)
+{
+  spin_unlock (&user_pool.lock);
+  spin_unlock (&kernel_pool.lock);
+}
+
+/* Returns the index of the free block of POOL that holds all of
+   chunk C, and its order in *ORDER, or SIZE_MAX if some of C is
+   in use.  Since buddies always merge, a wholly free chunk lies in
+   one block. */
+static size_t
+chunk_block (struct pool *pool, size_t c, int *order)
+{
+  for (*order = CHUNK_ORDER; *order <= ORDER_MAX; (*order)++)
+    {
+      size_t idx = c * CHUNK_PAGES & ~(((size_t) 1 << *order) - 1);
+      if (pool->page_map[idx] == (PAGE_FREE | *order))
+        return idx;
+    }
+  return SIZE_MAX;
+}
+
+/* Moves chunk C, which is wholly free in FROM, to TO.  Both pools'
+   locks must be held. */
+static void
+move_chunk (size_t c, struct pool *from, struct pool *to)
+{
+  size_t start = c * CHUNK_PAGES;
+  int order;
+  size_t idx = chunk_block (from, c, &order);
+
+  ASSERT (chunks[c].owner == from && idx != SIZE_MAX);
+
+  carve_block (from, idx, order, start, CHUNK_PAGES);
+  from->page_cnt -= CHUNK_PAGES;
+
+  if (chunks[c].home == to)
+    from->borrowed_cnt--;
+  else
+    to->borrowed_cnt++;
+  chunks[c].owner = to;
+  to->page_cnt += CHUNK_PAGES;
+  to->wanting = false;
+  pool_free (to, start, CHUNK_PAGES);
+}
+
+/* Moves a wholly free chunk from the other pool to POOL, if POOL
+   may grow by a chunk.  Takes back a chunk that POOL lent out if
+   there is one; any other chunk only if the lender keeps its
+   reserve of free pages.  Returns true if successful.  If not,
+   POOL is marked as wanting, so that chunks it lent come back as
+   soon as they are free.  Must be called without either pool's
+   lock held. */
 static bool
-page_from_pool (const struct pool *pool, void *page) 
+borrow (struct pool *pool)
+{
+  struct pool *lender = pool == &kernel_pool ? &user_pool : &kernel_pool;
+  size_t found = SIZE_MAX;
+  size_t c;
+
+  lock_pools ();
+  if (pool->page_cnt + CHUNK_PAGES <= pool->page_max)
+    {
+      bool spare = (lender->free_cnt + lender->zeroed_cnt
+                    >= lender->reserve + CHUNK_PAGES);
+      int order;
+
+      /* Pre-zeroed and cached pages look allocated to the buddy
+         lists. */
+      while (lender->zeroed_cnt > 0)
+        pool_free (lender, lender->zeroed[--lender->zeroed_cnt], 1);
+      cache_drain (lender);
+
+      for (c = 0; c < chunk_cnt; c++)
+        if (chunks[c].owner == lender
+            && (chunks[c].home == pool || (spare && found == SIZE_MAX))
+            && chunk_block (lender, c, &order) != SIZE_MAX)
+          {
+            found = c;
+            if (chunks[c].home == pool)
+              break;
+          }
+    }
+  if (found != SIZE_MAX)
+    move_chunk (found, lender, pool);
+  else
+    pool->wanting = true;
+  unlock_pools ();
+
+  return found != SIZE_MAX;
+}
+
+/* Sends the chunks that PAGE_CNT pages at PAGE_IDX, just freed in
+   POOL, lie in back to the pool they were borrowed from, if they
+   are now wholly free and that pool has run short. */
+static void
+return_chunks (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t c;
+
+  lock_pools ();
+  for (c = page_idx / CHUNK_PAGES;
+       c <= (page_idx + page_cnt - 1) / CHUNK_PAGES; c++)
+    {
+      struct chunk *ch = &chunks[c];
+      int order;
+
+      if (ch->owner == pool && ch->home != pool && ch->home->wanting
+          && chunk_block (pool, c, &order) != SIZE_MAX)
+        move_chunk (c, pool, ch->home);
+    }
+  unlock_pools ();
+}
+
+/* Returns a free page of POOL from this CPU's cache, refilling it
+   first if it is empty, or SIZE_MAX if the pool has no free page.
+   A page that is to be ZERO comes from the pool's pre-zeroed pages
+   instead while there are any, since they save the memset(). */
+static size_t
+cache_get (struct pool *pool, bool zero)
+{
+  struct page_cache *pc;
+  enum intr_level old_level;
+  size_t page_idx = SIZE_MAX;
+
+  if (zero && pool->zeroed_cnt > 0)
+    return SIZE_MAX;
+
+  old_level = intr_disable ();
+  pc = &pool->caches[cpu_id ()];
+  if (pc->cnt == 0)
+    {
+      bool zeroed;
+
+      spin_lock (&pool->lock);
+      while (pc->cnt < PCP_BATCH)
+        {
+          size_t idx = pool_get (pool, 1, false, &zeroed);
+          if (idx == SIZE_MAX)
+            break;
+          pc->pages[pc->cnt++] = idx;
+        }
+      spin_unlock (&pool->lock);
+    }
+  if (pc->cnt > 0)
+    page_idx = pc->pages[--pc->cnt];
+  intr_set_level (old_level);
+  return page_idx;
+}
+
+/* Puts page PAGE_IDX, just freed, in this CPU's cache of POOL,
+   draining the oldest PCP_BATCH cached pages to the pool first if
+   the cache is full.  Returns false, caching nothing, if the page
+   lies in a chunk that POOL borrowed. */
+static bool
+cache_put (struct pool *pool, size_t page_idx)
+{
+  struct chunk *c = &chunks[page_idx / CHUNK_PAGES];
+  struct page_cache *pc;
+  enum intr_level old_level;
+  size_t i;
+
+  if (c->owner != NULL && c->owner != c->home)
+    return false;
+
+  old_level = intr_disable ();
+  pc = &pool->caches[cpu_id ()];
+  if (pc->cnt == PCP_SIZE)
+    {
+      spin_lock (&pool->lock);
+      for (i = 0; i < PCP_BATCH; i++)
+        pool_free (pool, pc->pages[i], 1);
+      spin_unlock (&pool->lock);
+      memmove (pc->pages, pc->pages + PCP_BATCH,
+               (pc->cnt - PCP_BATCH) * sizeof *pc->pages);
+      pc->cnt -= PCP_BATCH;
+    }
+  pc->pages[pc->cnt++] = page_idx;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Gives every page in this CPU's cache of POOL back to POOL's buddy
+   lists and returns how many there were.  The caller must hold
+   POOL's lock. */
+static size_t
+cache_drain (struct pool *pool)
 {
-  size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  struct page_cache *pc = &pool->caches[cpu_id ()];
+  size_t cnt = pc->cnt;
 
-  return page_no >= start_page && page_no < end_page;
+  while (pc->cnt > 0)
+    pool_free (pool, pc->pages[--pc->cnt], 1);
+  return cnt;
 }
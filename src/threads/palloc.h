@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -11,10 +12,25 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* The pools lend each other chunks of 2**PALLOC_CHUNK_ORDER pages. */
+#define PALLOC_CHUNK_ORDER 6
+#define PALLOC_CHUNK_PAGES ((size_t) 1 << PALLOC_CHUNK_ORDER)
+
 void palloc_init (size_t user_page_limit);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_borrow (enum palloc_flags);
+bool palloc_borrow_wanted (enum palloc_flags);
+bool palloc_reclaim_wanted (void);
+bool palloc_page_wanted (const void *);
+bool palloc_page_is_user (const void *);
+bool palloc_claim_page (void *);
+void *palloc_user_base (void);
+size_t palloc_user_page_max (void);
+size_t palloc_user_page_cnt (void);
+bool palloc_zero_idle (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
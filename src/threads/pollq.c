@@ -0,0 +1,108 @@
+#include "threads/pollq.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+
+/* Poll queues.
+
+   A thread polling several objects at once cannot sleep on any one
+   of them, so it registers a poll_entry on each object's poll_queue,
+   all pointing to its one poll_wait, and downs the poll_wait's
+   semaphore.  An object wakes its queue whenever it may have become
+   ready, which unlinks every entry and ups their semaphores; the
+   poller then checks all its objects again.  Queue operations run
+   with interrupts off, so that interrupt handlers may wake queues
+   and a poller may drop its entries with no lock of the objects'. */
+
+static void wait_expired (void *w_);
+
+/* Initializes Q to empty. */
+void
+poll_queue_init (struct poll_queue *q)
+{
+  list_init (&q->entries);
+}
+
+/* Registers E on Q for poller W.  E must not be queued already. */
+void
+poll_queue_add (struct poll_queue *q, struct poll_entry *e,
+                struct poll_wait *w)
+{
+  enum intr_level old_level;
+
+  ASSERT (!e->queued);
+
+  old_level = intr_disable ();
+  e->wait = w;
+  e->queued = true;
+  list_push_back (&q->entries, &e->elem);
+  intr_set_level (old_level);
+}
+
+/* Wakes every poller registered on Q and empties it.  May be
+   called from an interrupt handler. */
+void
+poll_queue_wake (struct poll_queue *q)
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (!list_empty (&q->entries))
+    {
+      struct poll_entry *e = list_entry (list_pop_front (&q->entries),
+                                         struct poll_entry, elem);
+      e->queued = false;
+      sema_up (&e->wait->wake);
+    }
+  intr_set_level (old_level);
+}
+
+/* Unlinks E from the queue it is on, if any. */
+void
+poll_entry_remove (struct poll_entry *e)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (e->queued)
+    {
+      list_remove (&e->elem);
+      e->queued = false;
+    }
+  intr_set_level (old_level);
+}
+
+/* Initializes W to time out TICKS timer ticks from now, or never
+   if TICKS is negative. */
+void
+poll_wait_init (struct poll_wait *w, int64_t ticks)
+{
+  sema_init (&w->wake, 0);
+  w->timer.armed = false;
+  w->expired = false;
+  if (ticks >= 0)
+    timer_arm (&w->timer, timer_ticks () + ticks, wait_expired, w);
+}
+
+/* Sleeps until an object W is registered with wakes it or W times
+   out. */
+void
+poll_wait_sleep (struct poll_wait *w)
+{
+  sema_down (&w->wake);
+}
+
+/* Disarms W's timeout.  Call once done with W, and with none of
+   its entries queued anymore. */
+void
+poll_wait_done (struct poll_wait *w)
+{
+  timer_cancel (&w->timer);
+}
+
+/* Timer callback: W_'s timeout passed. */
+static void
+wait_expired (void *w_)
+{
+  struct poll_wait *w = w_;
+
+  w->expired = true;
+  sema_up (&w->wake);
+}
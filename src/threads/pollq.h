@@ -0,0 +1,45 @@
+#ifndef THREADS_POLLQ_H
+#define THREADS_POLLQ_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+
+/* A thread in poll(), sleeping until any of several objects might
+   have become ready, or until its timeout expires. */
+struct poll_wait
+  {
+    struct semaphore wake;      /* Upped by each wakeup. */
+    struct timer timer;         /* Fires at the timeout. */
+    bool expired;               /* Timeout passed? */
+  };
+
+/* One registration of a poll_wait, on one object's queue.  The
+   poller owns it, typically one per descriptor it polls. */
+struct poll_entry
+  {
+    struct list_elem elem;      /* Element in a poll_queue. */
+    struct poll_wait *wait;     /* Who to wake. */
+    bool queued;                /* In a queue? */
+  };
+
+/* What an object, such as a pipe or the console input buffer,
+   wakes when its readiness may have changed. */
+struct poll_queue
+  {
+    struct list entries;        /* struct poll_entry. */
+  };
+
+void poll_queue_init (struct poll_queue *);
+void poll_queue_add (struct poll_queue *, struct poll_entry *,
+                     struct poll_wait *);
+void poll_queue_wake (struct poll_queue *);
+void poll_entry_remove (struct poll_entry *);
+
+void poll_wait_init (struct poll_wait *, int64_t ticks);
+void poll_wait_sleep (struct poll_wait *);
+void poll_wait_done (struct poll_wait *);
+
+#endif /* threads/pollq.h */
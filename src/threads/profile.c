@@ -0,0 +1,186 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/rtc.h"
+#include "devices/timer.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Samples kept.  Past this many, each new sample overwrites the
+   oldest, so the profile covers the end of the run. */
+#define PROFILE_SAMPLES 4096
+
+/* Addresses per sample: the interrupted EIP and up to
+   PROFILE_DEPTH - 1 return addresses found by following saved
+   frame pointers.  Those are only as good as the frame pointers
+   are: build with -fno-omit-frame-pointer for whole call chains. */
+#define PROFILE_DEPTH 4
+
+/* One sample, or after merging in profile_print(), CNT identical
+   ones. */
+struct profile_sample
+  {
+    unsigned cnt;                       /* Number of samples. */
+    uintptr_t pc[PROFILE_DEPTH];        /* EIP, then callers; 0 pads. */
+  };
+
+/* How samples are taken. */
+enum profile_mode
+  {
+    PROFILE_OFF,                        /* Not at all. */
+    PROFILE_TICKS,                      /* On each timer tick. */
+    PROFILE_RTC                         /* Off the real-time clock. */
+  };
+
+static enum profile_mode mode;
+static unsigned rtc_hz;                 /* Rate asked for with RTC. */
+static unsigned sample_hz;              /* Rate samples are taken at. */
+
+/* Taken from the page allocator only if profiling is on, to keep
+   the kernel image small. */
+static struct profile_sample *samples;
+static uint64_t sample_cnt;             /* Samples ever taken. */
+static size_t next_sample;              /* Next entry in samples[]. */
+
+static intr_handler_func rtc_sample;
+
+/* Turns on profiling: on each timer tick if HZ is 0, otherwise HZ
+   times a second off the real-time clock.  Must be called before
+   profile_init(). */
+void
+profile_set_rate (unsigned hz)
+{
+  mode = hz == 0 ? PROFILE_TICKS : PROFILE_RTC;
+  rtc_hz = hz;
+}
+
+/* Starts taking samples, if profiling is on.  Must be called after
+   palloc_init() and intr_init(). */
+void
+profile_init (void)
+{
+  if (mode == PROFILE_OFF)
+    return;
+  samples = palloc_get_multiple (PAL_ASSERT,
+                                 DIV_ROUND_UP (PROFILE_SAMPLES
+                                               * sizeof *samples, PGSIZE));
+  if (mode == PROFILE_TICKS)
+    sample_hz = TIMER_FREQ;
+  else if (mode == PROFILE_RTC)
+    sample_hz = rtc_start_periodic (rtc_hz, rtc_sample);
+}
+
+/* Records a sample of the code that F interrupted. */
+static void
+record (const struct intr_frame *f)
+{
+  struct profile_sample *s = &samples[next_sample];
+  int depth = 1;
+
+  s->cnt = 1;
+  s->pc[0] = (uintptr_t) f->eip;
+
+  /* Walk the interrupted kernel code's frames, which are above F
+     on the same stack page.  User frames are not trusted. */
+  if (f->cs == SEL_KCSEG)
+    {
+      const uint32_t *fp = (const uint32_t *) f->ebp;
+
+      for (; depth < PROFILE_DEPTH; depth++)
+        {
+          if (fp <= (const uint32_t *) f
+              || pg_round_down (fp) != pg_round_down (f)
+              || pg_ofs (fp) > PGSIZE - 2 * sizeof *fp
+              || (uintptr_t) fp % sizeof *fp != 0
+              || fp[1] == 0)
+            break;
+          s->pc[depth] = fp[1];
+          fp = (const uint32_t *) fp[0];
+        }
+    }
+  for (; depth < PROFILE_DEPTH; depth++)
+    s->pc[depth] = 0;
+
+  sample_cnt++;
+  if (++next_sample == PROFILE_SAMPLES)
+    next_sample = 0;
+}
+
+/* Called from the timer interrupt handler with its frame F. */
+void
+profile_tick (const struct intr_frame *f)
+{
+  if (mode == PROFILE_TICKS)
+    record (f);
+}
+
+/* Real-time clock periodic interrupt handler. */
+static void
+rtc_sample (struct intr_frame *f)
+{
+  if (mode == PROFILE_RTC)
+    record (f);
+}
+
+/* Orders samples A and B by their addresses. */
+static int
+compare_pcs (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const struct profile_sample *a = a_;
+  const struct profile_sample *b = b_;
+
+  return memcmp (a->pc, b->pc, sizeof a->pc);
+}
+
+/* Orders samples A and B by descending count. */
+static int
+compare_cnts (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const struct profile_sample *a = a_;
+  const struct profile_sample *b = b_;
+
+  return a->cnt < b->cnt ? 1 : a->cnt > b->cnt ? -1 : 0;
+}
+
+/* Stops profiling and prints the samples, identical ones merged,
+   most frequent first. */
+void
+profile_print (void)
+{
+  enum intr_level old_level;
+  size_t cnt, merged, i;
+  int d;
+
+  if (mode == PROFILE_OFF)
+    return;
+  old_level = intr_disable ();
+  mode = PROFILE_OFF;
+  intr_set_level (old_level);
+
+  cnt = sample_cnt < PROFILE_SAMPLES ? sample_cnt : PROFILE_SAMPLES;
+  printf ("Profile: %"PRIu64" samples at %u Hz, %"PRIu64" overwritten.\n",
+          sample_cnt, sample_hz, sample_cnt - cnt);
+
+  sort (samples, cnt, sizeof *samples, compare_pcs, NULL);
+  merged = 0;
+  for (i = 0; i < cnt; i++)
+    if (merged > 0 && compare_pcs (&samples[merged - 1], &samples[i],
+                                   NULL) == 0)
+      samples[merged - 1].cnt++;
+    else
+      samples[merged++] = samples[i];
+  sort (samples, merged, sizeof *samples, compare_cnts, NULL);
+
+  for (i = 0; i < merged; i++)
+    {
+      printf ("Profile sample: %u", samples[i].cnt);
+      for (d = 0; d < PROFILE_DEPTH && samples[i].pc[d] != 0; d++)
+        printf (" %#"PRIxPTR, samples[i].pc[d]);
+      printf ("\n");
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* Sampling profiler.  Turned on by kernel command-line option
+   "-profile", which samples on every timer tick, or "-profile=HZ",
+   which samples HZ times a second off the real-time clock instead.
+   Each sample is the interrupted EIP and a few return addresses
+   above it.  profile_print() prints the samples at shutdown as
+   "Profile sample:" lines, which "backtrace --profile" turns into
+   a flat profile. */
+
+void profile_set_rate (unsigned hz);
+void profile_init (void);
+void profile_tick (const struct intr_frame *);
+void profile_print (void);
+
+#endif /* threads/profile.h */
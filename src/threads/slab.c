@@ -0,0 +1,106 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A typed object cache.
+
+   Unlike malloc(), which rounds each request up to a power of 2,
+   a cache hands out objects of exactly one (word-aligned) size.
+   When its free list runs dry it takes a page from the page
+   allocator and divides all of it into objects.  Pages are never
+   given back: caches hold long-lived kernel structures whose peak
+   count is bounded by the number of frames and pages in use.
+
+   Free objects are chained through a link word.  If the cache has
+   a constructor, the constructor runs once per object when its
+   page is carved up, and freed objects must be returned in their
+   constructed state; the link then lives just past the object so
+   that it does not clobber that state.  Otherwise the link
+   overlays the start of the free object. */
+
+/* Returns the address of OBJ's free-list link in cache C. */
+static void **
+obj_link (struct slab_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + (c->ctor != NULL ? c->obj_size : 0));
+}
+
+/* Initializes cache C for objects of SIZE bytes.  If CTOR is
+   nonnull, it is called on each object before its first use. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 void (*ctor) (void *))
+{
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->slot_size = c->obj_size + (ctor != NULL ? sizeof (void *) : 0);
+  c->objs_per_slab = PGSIZE / c->slot_size;
+  c->ctor = ctor;
+  c->free_list = NULL;
+  c->slab_cnt = 0;
+  c->used_cnt = 0;
+  lock_init (&c->lock);
+  ASSERT (c->objs_per_slab > 0);
+}
+
+/* Adds a new page of objects to C's free list.
+   Returns false if no page is available. */
+static bool
+slab_grow (struct slab_cache *c)
+{
+  uint8_t *slab = palloc_get_page (0);
+  size_t i;
+
+  if (slab == NULL)
+    return false;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void *obj = slab + i * c->slot_size;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = c->free_list;
+      c->free_list = obj;
+    }
+  c->slab_cnt++;
+  return true;
+}
+
+/* Obtains an object from C.  Returns a null pointer if memory is
+   not available. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  void *obj = NULL;
+
+  lock_acquire (&c->lock);
+  if (c->free_list != NULL || slab_grow (c))
+    {
+      obj = c->free_list;
+      c->free_list = *obj_link (c, obj);
+      c->used_cnt++;
+    }
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, previously obtained from C, to C.
+   A null OBJ is ignored. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  if (obj == NULL)
+    return;
+
+  lock_acquire (&c->lock);
+  ASSERT (c->used_cnt > 0);
+  *obj_link (c, obj) = c->free_list;
+  c->free_list = obj;
+  c->used_cnt--;
+  lock_release (&c->lock);
+}
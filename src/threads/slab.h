@@ -0,0 +1,27 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* A cache of equally sized objects, carved out of whole pages
+   obtained from the page allocator. */
+struct slab_cache
+  {
+    const char *name;           /* For debugging. */
+    size_t obj_size;            /* Object size, rounded for alignment. */
+    size_t slot_size;           /* Bytes taken by one object. */
+    size_t objs_per_slab;       /* Objects per page. */
+    void (*ctor) (void *);      /* Constructor, or a null pointer. */
+    void *free_list;            /* Free objects. */
+    size_t slab_cnt;            /* Pages obtained so far. */
+    size_t used_cnt;            /* Objects handed out. */
+    struct lock lock;           /* Protects the members above. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      void (*ctor) (void *));
+void *slab_alloc (struct slab_cache *) __attribute__ ((malloc));
+void slab_free (struct slab_cache *, void *);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,61 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include "threads/interrupt.h"
+
+/* A spinlock, for data shared with code that cannot sleep, such
+   as interrupt handlers.  Holding one also keeps
+   interrupts off on this CPU, so the holder cannot be preempted
+   while another thread on the same CPU spins.  On a uniprocessor
+   the lock is never contended and only documents the critical
+   section; the atomic exchange keeps it correct once other CPUs
+   share the data. */
+struct spinlock
+  {
+    volatile int locked;        /* Nonzero while held. */
+    enum intr_level saved;      /* Interrupt level before acquiring. */
+  };
+
+/* Initializes spinlock SL, unlocked. */
+static inline void
+spin_init (struct spinlock *sl)
+{
+  sl->locked = 0;
+  sl->saved = INTR_OFF;
+}
+
+/* Turns interrupts off and acquires SL, spinning until it is
+   free. */
+static inline void
+spin_lock (struct spinlock *sl)
+{
+  enum intr_level old_level = intr_disable ();
+  int one = 1;
+
+  for (;;)
+    {
+      asm volatile ("xchgl %0, %1" : "+r" (one), "+m" (sl->locked)
+                    : : "memory");
+      if (one == 0)
+        break;
+      while (sl->locked)
+        asm volatile ("pause");
+    }
+  sl->saved = old_level;
+}
+
+/* Releases SL and restores the interrupt level from before
+   spin_lock(). */
+static inline void
+spin_unlock (struct spinlock *sl)
+{
+  enum intr_level old_level = sl->saved;
+
+  ASSERT (sl->locked);
+  asm volatile ("movl $0, %0" : "=m" (sl->locked) : : "memory");
+  intr_set_level (old_level);
+}
+
+#endif /* threads/spinlock.h */
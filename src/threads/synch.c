@@ -29,8 +29,77 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+
+/* Maximum length of a chain of lock holders that a donation is
+   passed down, as a guard against runaway nesting. */
+#define DONATION_DEPTH_MAX 8
+
+/* One thread waiting on a condition variable. */
+struct cond_waiter
+  {
+    struct list_elem elem;              /* Element in the waiters. */
+    struct thread *thread;              /* Thread waiting. */
+    bool signaled;                      /* Set when signaled. */
+  };
+
+/* Returns the thread whose wait queue element is E.  Semaphores
+   queue threads by their elem, condition variables queue struct
+   cond_waiter, so COND says which kind of queue E is on. */
+static struct thread *
+waiter_thread (struct list_elem *e, bool cond)
+{
+  return cond ? list_entry (e, struct cond_waiter, elem)->thread
+              : list_entry (e, struct thread, elem);
+}
+
+/* Inserts T, whose element in LIST is ELEM, into wait queue LIST,
+   which is kept in descending order of priority and in arrival
+   order among equals, so the waiter to wake is always the front
+   one.  The scan starts from the back, so waiters of equal
+   priority, the common case, are queued in constant time.
+   Interrupts must be off. */
+static void
+waitq_insert (struct list *list, struct list_elem *elem, struct thread *t)
+{
+  bool cond = elem != &t->elem;
+  struct list_elem *e;
+
+  for (e = list_rbegin (list); e != list_rend (list); e = list_prev (e))
+    if (waiter_thread (e, cond)->priority >= t->priority)
+      break;
+  list_insert (list_next (e), elem);
+  t->wait_list = list;
+  t->wait_elem = elem;
+}
+
+/* Removes and returns the thread at the front of wait queue LIST,
+   which must not be empty.  Interrupts must be off. */
+static struct thread *
+waitq_pop (struct list *list, bool cond)
+{
+  struct thread *t = waiter_thread (list_pop_front (list), cond);
+
+  t->wait_list = NULL;
+  return t;
+}
+
+/* Moves blocked thread T, whose priority has just changed, to its
+   new place in the wait queue it sleeps on, if any.  Interrupts
+   must be off. */
+void
+waitq_requeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->wait_list == NULL)
+    return;
+  list_remove (t->wait_elem);
+  waitq_insert (t->wait_list, t->wait_elem, t);
+}
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -68,7 +137,8 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      struct thread *cur = thread_current ();
+      waitq_insert (&sema->waiters, &cur->elem, cur);
       thread_block ();
     }
   sema->value--;
@@ -114,10 +184,17 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    thread_unblock (waitq_pop (&sema->waiters, false));
   sema->value++;
   intr_set_level (old_level);
+
+  /* Let a woken thread of higher priority run now.  Callers that
+     had interrupts off are in a critical section of their own and
+     get preempted once they turn them back on. */
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_check_priority ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -157,6 +234,50 @@ sema_test_helper (void *sema_)
     }
 }
 
+/* Makes the running thread, which is about to block on LOCK,
+   donate its priority to LOCK's holder and on down the chain of
+   holders that it and they are in turn waiting for.  Interrupts
+   must be off. */
+static void
+lock_donate (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  int depth;
+
+  cur->waiting_on = lock;
+  cur->donee = lock->holder;
+  heap_push (&lock->holder->donors, &cur->donorelem);
+  for (depth = 0; lock != NULL && lock->holder != NULL
+                  && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      thread_update_priority (lock->holder);
+      lock = lock->holder->waiting_on;
+    }
+}
+
+/* Makes the running thread the holder of LOCK, which it has just
+   acquired.  Threads still waiting for LOCK now donate to it.
+   Interrupts must be off. */
+static void
+lock_take (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  lock->holder = cur;
+  if (thread_mlfqs)
+    return;
+  for (e = list_begin (&lock->semaphore.waiters);
+       e != list_end (&lock->semaphore.waiters); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      t->waiting_on = lock;
+      t->donee = cur;
+      heap_push (&cur->donors, &t->donorelem);
+    }
+  thread_update_priority (cur);
+}
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -178,9 +299,123 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
+  lock->profile = NULL;
   sema_init (&lock->semaphore, 1);
 }
 
+/* Most locks that lock_register() can name.  Registered locks are
+   long-lived kernel locks, some set up before malloc() works, so
+   their counters come from a fixed table. */
+#define LOCK_PROFILE_MAX 32
+
+bool lock_profiling;
+
+static struct lock_profile lock_profiles[LOCK_PROFILE_MAX];
+static size_t lock_profile_cnt;
+
+/* Names LOCK, which must be initialized, for the lock contention
+   report, so that its acquisitions, waits and holds are counted
+   while lock_profiling is on.  Past LOCK_PROFILE_MAX locks, further
+   locks go unnamed and uncounted. */
+void
+lock_register (struct lock *lock, const char *name)
+{
+  struct lock_profile *p;
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+
+  old_level = intr_disable ();
+  if (lock_profile_cnt < LOCK_PROFILE_MAX)
+    {
+      p = &lock_profiles[lock_profile_cnt++];
+      memset (p, 0, sizeof *p);
+      p->name = name;
+      lock->profile = p;
+    }
+  intr_set_level (old_level);
+}
+
+/* Records that the current thread acquired LOCK at CALLER, having
+   begun to wait for it at START (zero if it did not have to).
+   Interrupts must be off. */
+static void
+lock_profile_acquired (struct lock *lock, uint64_t start, void *caller)
+{
+  struct lock_profile *p = lock->profile;
+  uint64_t now = rdtsc ();
+
+  p->acquisitions++;
+  if (start != 0)
+    {
+      uint64_t wait = now - start;
+      p->contended++;
+      p->wait_cycles += wait;
+      if (wait > p->max_wait_cycles)
+        p->max_wait_cycles = wait;
+    }
+  p->acquired_at = now;
+  p->caller = caller;
+}
+
+/* Records that LOCK's holder is releasing it.  Interrupts must be
+   off. */
+static void
+lock_profile_released (struct lock *lock)
+{
+  struct lock_profile *p = lock->profile;
+  uint64_t hold;
+
+  /* Profiling was turned on while the lock was held. */
+  if (p->acquired_at == 0)
+    return;
+  hold = rdtsc () - p->acquired_at;
+  p->hold_cycles += hold;
+  if (hold > p->max_hold_cycles)
+    {
+      p->max_hold_cycles = hold;
+      p->max_hold_caller = p->caller;
+    }
+  p->acquired_at = 0;
+}
+
+/* Prints the registered locks' counters, most time spent waiting
+   first. */
+void
+lock_profile_print (void)
+{
+  struct lock_profile *sorted[LOCK_PROFILE_MAX];
+  size_t i, j, cnt;
+
+  if (!lock_profiling)
+    return;
+
+  /* Insertion sort by total wait; there are only a few locks. */
+  cnt = lock_profile_cnt;
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_profile *p = &lock_profiles[i];
+      for (j = i; j > 0 && sorted[j - 1]->wait_cycles < p->wait_cycles; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = p;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_profile *p = sorted[i];
+      if (p->acquisitions == 0)
+        continue;
+      printf ("Lock %s: %llu acquired, %llu contended, "
+              "%llu ns waited (max %llu), %llu ns held (max %llu by %p)\n",
+              p->name, p->acquisitions, p->contended,
+              clock_cycles_to_ns (p->wait_cycles),
+              clock_cycles_to_ns (p->max_wait_cycles),
+              clock_cycles_to_ns (p->hold_cycles),
+              clock_cycles_to_ns (p->max_hold_cycles), p->max_hold_caller);
+    }
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -192,12 +427,37 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool profile;
+  uint64_t start = 0;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  /* This is sema_down() with priority donation: while we wait,
+     the holder and, in turn, whatever holders it is waiting for
+     run at no less than our priority. */
+  old_level = intr_disable ();
+  profile = lock->profile != NULL && lock_profiling;
+  if (profile && lock->semaphore.value == 0)
+    start = rdtsc ();
+  if (lock->semaphore.value == 0)
+    TRACE (TRACE_LOCK_CONTENDED, lock);
+  while (lock->semaphore.value == 0)
+    {
+      if (lock->holder != NULL && !thread_mlfqs)
+        lock_donate (lock);
+      waitq_insert (&lock->semaphore.waiters, &cur->elem, cur);
+      thread_block ();
+      cur->waiting_on = NULL;
+    }
+  lock->semaphore.value--;
+  lock_take (lock);
+  if (profile)
+    lock_profile_acquired (lock, start, __builtin_return_address (0));
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -209,14 +469,21 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock_take (lock);
+      if (lock->profile != NULL && lock_profiling)
+        lock_profile_acquired (lock, 0, __builtin_return_address (0));
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -228,10 +495,32 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  /* Drop the donations made through LOCK; those waiters now
+     donate to its next holder instead.  Every thread donating
+     through LOCK is among its waiters. */
+  old_level = intr_disable ();
+  for (e = list_begin (&lock->semaphore.waiters);
+       e != list_end (&lock->semaphore.waiters); e = list_next (e))
+    {
+      struct thread *d = list_entry (e, struct thread, elem);
+      if (d->donee == cur)
+        {
+          heap_remove (&cur->donors, &d->donorelem);
+          d->donee = NULL;
+        }
+    }
+  thread_update_priority (cur);
+  if (lock->profile != NULL && lock_profiling)
+    lock_profile_released (lock);
   lock->holder = NULL;
+  intr_set_level (old_level);
   sema_up (&lock->semaphore);
 }
 
@@ -246,13 +535,6 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
-
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -287,20 +569,41 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  struct thread *cur = thread_current ();
+  struct cond_waiter waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
+  /* With interrupts off, releasing LOCK cannot let a signaler in
+     before we are asleep. */
+  old_level = intr_disable ();
+  waiter.thread = cur;
+  waiter.signaled = false;
+  waitq_insert (&cond->waiters, &waiter.elem, cur);
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+  while (!waiter.signaled)
+    thread_block ();
+  intr_set_level (old_level);
   lock_acquire (lock);
 }
 
+/* Wakes the highest-priority waiter on COND's queue.  Interrupts
+   must be off. */
+static void
+cond_wake_one (struct condition *cond)
+{
+  struct cond_waiter *w = list_entry (list_front (&cond->waiters),
+                                      struct cond_waiter, elem);
+
+  waitq_pop (&cond->waiters, true);
+  w->signaled = true;
+  thread_unblock (w->thread);
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -311,14 +614,19 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    cond_wake_one (cond);
+  intr_set_level (old_level);
+  if (old_level == INTR_ON)
+    thread_check_priority ();
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -330,9 +638,90 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
 void
 cond_broadcast (struct condition *cond, struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
 
+  /* Empty the queue in one critical section and check for
+     preemption once, rather than once per waiter. */
+  old_level = intr_disable ();
   while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
+    cond_wake_one (cond);
+  intr_set_level (old_level);
+  if (old_level == INTR_ON)
+    thread_check_priority ();
+}
+
+/* Initializes readers-writer lock RW. */
+void
+rw_lock_init (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writer_ok);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = false;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  This function may sleep, so it must not be called
+   within an interrupt handler. */
+void
+rw_lock_acquire_read (struct rw_lock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer || rw->waiting_writers > 0)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rw_lock_release_read (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it.  This function may sleep, so it must not be called
+   within an interrupt handler. */
+void
+rw_lock_acquire_write (struct rw_lock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer || rw->readers > 0)
+    cond_wait (&rw->writer_ok, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = true;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rw_lock_release_write (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer);
+  rw->writer = false;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
 }
@@ -3,28 +3,56 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiting threads, highest priority
+                                   first. */
   };
 
+struct thread;
+
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
+void waitq_requeue (struct thread *);
 
 /* Lock. */
 struct lock 
   {
-    struct thread *holder;      /* Thread holding lock (for debugging). */
+    struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct lock_profile *profile; /* Contention counters, or null. */
   };
 
+/* Contention counters for a lock given a name by lock_register().
+   Times are in TSC cycles and are only gathered while
+   lock_profiling is true. */
+struct lock_profile
+  {
+    const char *name;           /* Name given to lock_register(). */
+    uint64_t acquisitions;      /* Times acquired. */
+    uint64_t contended;         /* Times the acquirer had to wait. */
+    uint64_t wait_cycles;       /* Total time spent waiting. */
+    uint64_t max_wait_cycles;   /* Longest wait. */
+    uint64_t hold_cycles;       /* Total time held. */
+    uint64_t max_hold_cycles;   /* Longest hold. */
+    void *max_hold_caller;      /* Who acquired it for that hold. */
+    uint64_t acquired_at;       /* When the holder acquired it. */
+    void *caller;               /* Where the holder acquired it. */
+  };
+
+/* Set by kernel command-line option "-lockprof". */
+extern bool lock_profiling;
+
 void lock_init (struct lock *);
+void lock_register (struct lock *, const char *name);
+void lock_profile_print (void);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -33,7 +61,7 @@ bool lock_held_by_current_thread (const struct lock *);
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct list waiters;        /* Waiters, highest priority first. */
   };
 
 void cond_init (struct condition *);
@@ -41,6 +69,25 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.  Any number of readers or one writer may
+   hold it.  Waiting writers keep new readers out, so that a steady
+   stream of readers cannot starve them. */
+struct rw_lock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writer_ok; /* Signaled when a writer may enter. */
+    int readers;                /* Readers holding the lock. */
+    int waiting_writers;        /* Writers waiting for the lock. */
+    bool writer;                /* A writer holds the lock. */
+  };
+
+void rw_lock_init (struct rw_lock *);
+void rw_lock_acquire_read (struct rw_lock *);
+void rw_lock_release_read (struct rw_lock *);
+void rw_lock_acquire_write (struct rw_lock *);
+void rw_lock_release_write (struct rw_lock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -7,11 +7,13 @@
 #include <string.h>
 
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -23,17 +25,26 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Lists of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running: a FIFO run
+   queue per priority.  Bit P of ready_mask is set exactly when
+   ready_queues[P] is not empty, so finding the highest priority
+   that can run takes a bit scan instead of a list walk.
+
+   Real-time threads go ahead of all of these, in one FIFO queue of
+   their own.  Interrupts must be off to use any of these. */
+#if PRI_MAX >= 64
+#error "ready_mask needs a bit per priority"
+#endif
+static struct list ready_queues[PRI_MAX + 1];
+static struct list ready_rt_queue;
+static uint64_t ready_mask;
+static int ready_cnt; /* Number of threads in the ready queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* List of processes in sleeping state. */
-static struct list sleeping_list;
-
 /* Idle thread. */
 static struct thread* idle_thread;
 
@@ -55,8 +66,27 @@ static long long idle_ticks;   /* # of timer ticks spent idle. */
 static long long kernel_ticks; /* # of timer ticks in kernel threads. */
 static long long user_ticks;   /* # of timer ticks in user programs. */
 
+/* Histogram of ready-to-run latency.  Bucket N counts switches
+   to a thread that had been ready for 2**N to 2**(N+1)-1 TSC
+   cycles. */
+#define READY_WAIT_BUCKETS 32
+static long long ready_waits[READY_WAIT_BUCKETS];
+static long long voluntary_switches;   /* # of switches away from a
+                                          blocked or dying thread. */
+static long long involuntary_switches; /* # of switches away from a
+                                          thread still ready. */
+
+/* Pages of dead threads kept for reuse by thread_create(), linked
+   through their first word.  Reusing one skips the page allocator,
+   and only the struct thread at its bottom needs zeroing, not the
+   stack above it. */
+#define THREAD_POOL_MAX 16
+static void* thread_pool;
+static size_t thread_pool_cnt;
+
 /* Scheduling. */
 #define TIME_SLICE 4          /* # of timer ticks to give each thread. */
+int thread_time_slice = TIME_SLICE; /* Tunable "sched.time_slice". */
 static unsigned thread_ticks; /* # of timer ticks since last yield. */
 
 /* If false (default), use round-robin scheduler.
@@ -64,6 +94,18 @@ static unsigned thread_ticks; /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* 4.4BSD scheduler state, used only with -o mlfqs.  Each tick
+   only the running thread's recent_cpu changes, so priorities are
+   recomputed every TIME_SLICE ticks for just the threads on
+   mlfqs_dirty_list, the ones that ran since the last recompute.
+   Once a second every thread's recent_cpu decays and everything
+   is recomputed. */
+static fixed_t load_avg;
+static struct list mlfqs_dirty_list;
+
+static void mlfqs_tick(struct thread*);
+static void mlfqs_update_priority(struct thread*);
+
 static void kernel_thread(thread_func*, void* aux);
 
 static void idle(void* aux UNUSED);
@@ -72,25 +114,52 @@ static struct thread* next_thread_to_run(void);
 static void init_thread(struct thread*, const char* name, int priority);
 static bool is_thread(struct thread*) UNUSED;
 static void* alloc_frame(struct thread*, size_t size);
+static struct thread* thread_page_alloc(void);
 static void schedule(void);
 void thread_schedule_tail(struct thread* prev);
 static tid_t allocate_tid(void);
 
-/* Compares priority between two thread. Made to utilize list sort.
-   It makes the ready list sort in the descening order of priority. */
-bool thread_priority_greater(const struct list_elem* a,
-                             const struct list_elem* b, void* aux UNUSED) {
-  struct thread* ta = list_entry(a, struct thread, elem);
-  struct thread* tb = list_entry(b, struct thread, elem);
-  return ta->priority > tb->priority;
+/* Appends T to the run queue for its priority.  Interrupts must be
+   off. */
+static void ready_push(struct thread* t) {
+  if (t->rt)
+    list_push_back(&ready_rt_queue, &t->elem);
+  else {
+    list_push_back(&ready_queues[t->priority], &t->elem);
+    ready_mask |= (uint64_t)1 << t->priority;
+  }
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue.  Interrupts must be
+   off. */
+static void ready_remove(struct thread* t) {
+  list_remove(&t->elem);
+  if (!t->rt && list_empty(&ready_queues[t->priority]))
+    ready_mask &= ~((uint64_t)1 << t->priority);
+  ready_cnt--;
+}
+
+/* Returns the highest priority set in MASK, or -1 if no bit is
+   set. */
+static int mask_max(uint64_t mask) {
+  uint32_t hi = mask >> 32, lo = (uint32_t)mask;
+  uint32_t bit;
+
+  if (hi == 0 && lo == 0) return -1;
+  asm("bsrl %1, %0" : "=r"(bit) : "rm"(hi != 0 ? hi : lo));
+  return hi != 0 ? 32 + (int)bit : (int)bit;
 }
 
-/* Compares "wake_me_up" tick between two thread. Made to utilize list sort. */
-bool thread_wake_me_at_less(const struct list_elem* a,
-                            const struct list_elem* b, void* aux UNUSED) {
-  struct thread* ta = list_entry(a, struct thread, elem);
-  struct thread* tb = list_entry(b, struct thread, elem);
-  return ta->wake_me_at < tb->wake_me_at;
+/* Returns the highest priority of any ready thread, PRI_RT for a
+   real-time one, or -1 if no thread is ready. */
+static int ready_max(void) {
+  return !list_empty(&ready_rt_queue) ? PRI_RT : mask_max(ready_mask);
+}
+
+/* Returns the priority T runs at, PRI_RT if it is real-time. */
+static int run_priority(const struct thread* t) {
+  return t->rt ? PRI_RT : t->priority;
 }
 
 /* Initializes the threading system by transforming the code
@@ -107,12 +176,17 @@ bool thread_wake_me_at_less(const struct list_elem* a,
    It is not safe to call thread_current() until this function
    finishes. */
 void thread_init(void) {
+  int i;
+
   ASSERT(intr_get_level() == INTR_OFF);
 
   lock_init(&tid_lock);
-  list_init(&ready_list);
+  lock_register(&tid_lock, "tid");
+  for (i = 0; i <= PRI_MAX; i++) list_init(&ready_queues[i]);
+  list_init(&ready_rt_queue);
+  ready_mask = 0;
   list_init(&all_list);
-  list_init(&sleeping_list);
+  list_init(&mlfqs_dirty_list);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread();
@@ -136,11 +210,19 @@ void thread_start(void) {
   sema_down(&idle_started);
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
-void thread_tick(void) {
+/* Called by the timer interrupt handler at each timer tick, which
+   interrupted user code if USER is true.  Thus, this function runs
+   in an external interrupt context. */
+void thread_tick(bool user) {
   struct thread* t = thread_current();
 
+  if (t != idle_thread) {
+    if (user)
+      t->rusage.user_ticks++;
+    else
+      t->rusage.kernel_ticks++;
+  }
+
   /* Update statistics. */
   if (t == idle_thread) idle_ticks++;
 #ifdef USERPROG
@@ -150,14 +232,98 @@ void thread_tick(void) {
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE) intr_yield_on_return();
+  if (thread_mlfqs) mlfqs_tick(t);
+
+  /* Enforce preemption.  Real-time threads have no time slice. */
+  if (!t->rt && ++thread_ticks >= (unsigned)thread_time_slice)
+    intr_yield_on_return();
+}
+
+/* Counts TICKS timer ticks that the idle thread spent halted
+   with the timer interrupt stopped.  Interrupts must be off. */
+void thread_idle_ticks(int64_t ticks) { idle_ticks += ticks; }
+
+/* Copies the scheduler statistics into STATS. */
+void thread_get_stats(struct sched_stats* stats) {
+  enum intr_level old_level = intr_disable();
+  int i;
+
+  stats->idle_ticks = idle_ticks;
+  stats->kernel_ticks = kernel_ticks;
+  stats->user_ticks = user_ticks;
+  stats->voluntary_switches = voluntary_switches;
+  stats->involuntary_switches = involuntary_switches;
+  stats->threads = list_size(&all_list);
+  stats->ready = ready_cnt;
+  for (i = 0; i < SCHED_WAIT_BUCKETS; i++)
+    stats->ready_waits[i] = i < READY_WAIT_BUCKETS ? ready_waits[i] : 0;
+  intr_set_level(old_level);
+}
+
+/* Adds the usage in SRC to DST. */
+void thread_rusage_add(struct rusage* dst, const struct rusage* src) {
+  dst->user_ticks += src->user_ticks;
+  dst->kernel_ticks += src->kernel_ticks;
+  dst->minor_faults += src->minor_faults;
+  dst->major_faults += src->major_faults;
+  dst->swap_ins += src->swap_ins;
+  dst->block_reads += src->block_reads;
+  dst->block_writes += src->block_writes;
+  dst->voluntary_switches += src->voluntary_switches;
+  dst->involuntary_switches += src->involuntary_switches;
+}
+
+#ifdef USERPROG
+/* Usage of the threads of one process, summed by add_process_rusage(). */
+struct rusage_sum {
+  struct thread* proc;
+  struct rusage usage;
+};
+
+/* Thread action that adds T's usage to the rusage_sum AUX if T is a
+   thread of its process. */
+static void add_process_rusage(struct thread* t, void* aux) {
+  struct rusage_sum* sum = aux;
+  if (t->proc == sum->proc) thread_rusage_add(&sum->usage, &t->rusage);
+}
+
+/* Stores in USAGE the usage of process PROC: of its threads alive
+   now and of those that have exited. */
+void thread_process_rusage(struct thread* proc, struct rusage* usage) {
+  struct rusage_sum sum;
+  enum intr_level old_level;
+
+  sum.proc = proc;
+  sum.usage = proc->exited_rusage;
+  old_level = intr_disable();
+  thread_foreach(add_process_rusage, &sum);
+  intr_set_level(old_level);
+  *usage = sum.usage;
 }
+#endif
 
 /* Prints thread statistics. */
 void thread_print_stats(void) {
+  struct list_elem* e;
+  int i;
+
   printf("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
          idle_ticks, kernel_ticks, user_ticks);
+  printf("Thread: %lld voluntary, %lld involuntary context switches\n",
+         voluntary_switches, involuntary_switches);
+  for (i = 0; i < READY_WAIT_BUCKETS; i++)
+    if (ready_waits[i] != 0)
+      printf("Thread: ready waits of 2^%d cycles (%llu ns): %lld\n", i,
+             clock_cycles_to_ns((uint64_t)1 << i), ready_waits[i]);
+  for (e = list_begin(&all_list); e != list_end(&all_list); e = list_next(e)) {
+    struct thread* t = list_entry(e, struct thread, allelem);
+    printf("Thread: %-16s %llu voluntary, %llu involuntary switches, "
+           "%llu ns ready, %llu ns running\n",
+           t->name, t->rusage.voluntary_switches,
+           t->rusage.involuntary_switches,
+           clock_cycles_to_ns(t->ready_cycles),
+           clock_cycles_to_ns(t->run_cycles));
+  }
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -187,7 +353,7 @@ tid_t thread_create(const char* name, int priority, thread_func* function,
   ASSERT(function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page(PAL_ZERO);
+  t = thread_page_alloc();
   if (t == NULL) return TID_ERROR;
 
   /* Initialize thread. */
@@ -250,7 +416,9 @@ void thread_block(void) {
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  The exception is a real-time thread woken
+   from an interrupt handler, which runs as soon as the handler
+   returns. */
 void thread_unblock(struct thread* t) {
   enum intr_level old_level;
 
@@ -258,12 +426,18 @@ void thread_unblock(struct thread* t) {
 
   old_level = intr_disable();
   ASSERT(t->status == THREAD_BLOCKED);
-  list_insert_ordered(&ready_list, &t->elem, thread_priority_greater, NULL);
+  t->ready_since = rdtsc();
+  ready_push(t);
   t->status = THREAD_READY;
+  if (t->rt && intr_context() && !thread_current()->rt) intr_yield_on_return();
   intr_set_level(old_level);
 }
 
-/* Put thread into a sleeping list */
+/* Timer callback that wakes the thread T sleeping in
+   thread_sleep(). */
+static void thread_wake(void* t) { thread_unblock(t); }
+
+/* Blocks the running thread until timer tick TICKS. */
 void thread_sleep(int64_t ticks) {
   enum intr_level old_level;
 
@@ -271,37 +445,11 @@ void thread_sleep(int64_t ticks) {
   ASSERT(is_thread(t));
 
   old_level = intr_disable();
-  t->status = THREAD_BLOCKED;
-  t->wake_me_at = ticks;
-  list_insert_ordered(&sleeping_list, &t->elem, thread_wake_me_at_less, NULL);
-  schedule();
+  timer_arm(&t->sleep_timer, ticks, thread_wake, t);
+  thread_block();
   intr_set_level(old_level);
 }
 
-/* Wake up sleeping thread */
-void thread_wake_sleeping(int64_t ticks) {
-  if (list_empty(&sleeping_list)) return;
-
-  struct list_elem* e;
-  struct thread* t;
-
-  while (!list_empty(&sleeping_list))
-  // for (e = list_begin (&sleeping_list); e != list_end (&sleeping_list); e =
-  // list_next (e))
-  {
-    t = list_entry(list_front(&sleeping_list), struct thread, elem);
-    // t = list_entry (e, struct thread, elem);
-    if (t->wake_me_at <= ticks && t->status == THREAD_BLOCKED) {
-      // printf("%s is waking up\n", t->name);
-      list_pop_front(&sleeping_list);
-      // list_remove (e);
-      thread_unblock(t);
-    } else {
-      return;
-    }
-  }
-}
-
 /* Returns the name of the running thread. */
 const char* thread_name(void) { return thread_current()->name; }
 
@@ -333,12 +481,14 @@ void thread_exit(void) {
 #ifdef USERPROG
   process_exit();
 #endif
+  fpu_exit();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable();
   list_remove(&thread_current()->allelem);
+  if (thread_current()->mlfqs_dirty) list_remove(&thread_current()->dirtyelem);
   thread_current()->status = THREAD_DYING;
   schedule();
   NOT_REACHED();
@@ -353,8 +503,10 @@ void thread_yield(void) {
   ASSERT(!intr_context());
 
   old_level = intr_disable();
-  if (cur != idle_thread)
-    list_insert_ordered(&ready_list, &cur->elem, thread_priority_greater, NULL);
+  if (cur != idle_thread) {
+    cur->ready_since = rdtsc();
+    ready_push(cur);
+  }
   cur->status = THREAD_READY;
   schedule();
   intr_set_level(old_level);
@@ -378,42 +530,166 @@ void thread_foreach(thread_action_func* func, void* aux) {
    highest priority of thread in ready queue. If there is a
    thread having higher priority in ready queue, then yield. */
 void thread_check_priority(void) {
-  if (list_empty(&ready_list)) return;
-  if (thread_get_priority() <
-      list_entry(list_front(&ready_list), struct thread, elem)->priority)
-    thread_yield();
+  if (ready_max() > thread_get_priority()) thread_yield();
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY, or puts
+   it in the real-time class if that is PRI_RT.  A higher priority
+   donated through a held lock stays in effect until that lock is
+   released.  Under -o mlfqs, where the scheduler computes
+   priorities, NEW_PRIORITY only decides the class. */
 void thread_set_priority(int new_priority) {
-  thread_current()->priority = new_priority;
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+
+  if (thread_mlfqs && new_priority != PRI_RT && !cur->rt) return;
+  old_level = intr_disable();
+  cur->rt = new_priority == PRI_RT;
+  if (cur->rt || !thread_mlfqs) {
+    if (!cur->rt) cur->base_priority = new_priority;
+    thread_update_priority(cur);
+  } else
+    mlfqs_update_priority(cur);
+  intr_set_level(old_level);
   /* After setting the current thread's priority, check
      if the current thread should yield cpu */
   thread_check_priority();
 }
 
-/* Returns the current thread's priority. */
-int thread_get_priority(void) { return thread_current()->priority; }
+/* Recomputes T's effective priority as the highest of its base
+   priority and the priorities of the threads donating to it,
+   moving T to the matching run queue if it is ready.  Interrupts
+   must be off. */
+void thread_update_priority(struct thread* t) {
+  struct heap_elem* top = heap_top(&t->donors);
+  int pri = t->rt ? PRI_MAX : t->base_priority;
 
-/* Sets the current thread's nice value to NICE. */
-void thread_set_nice(int nice UNUSED) { /* Not yet implemented. */ }
+  ASSERT(intr_get_level() == INTR_OFF);
 
-/* Returns the current thread's nice value. */
-int thread_get_nice(void) {
-  /* Not yet implemented. */
-  return 0;
+  if (top != NULL) {
+    struct thread* d = heap_entry(top, struct thread, donorelem);
+    if (d->priority > pri) pri = d->priority;
+  }
+  if (pri == t->priority) return;
+
+  // A ready real-time thread keeps its place in the FIFO.
+  if (t->status == THREAD_READY && !t->rt) {
+    ready_remove(t);
+    t->priority = pri;
+    ready_push(t);
+  } else {
+    t->priority = pri;
+    if (t->status == THREAD_BLOCKED) waitq_requeue(t);
+  }
+  // Keep T's place among the donors of the thread it donates to.
+  if (t->donee != NULL) heap_update(&t->donee->donors, &t->donorelem);
+}
+
+/* Returns the current thread's priority, PRI_RT if it is
+   real-time. */
+int thread_get_priority(void) { return run_priority(thread_current()); }
+
+/* Sets the current thread's nice value to NICE and recomputes its
+   priority, yielding if it no longer has the highest. */
+void thread_set_nice(int nice) {
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN) nice = NICE_MIN;
+  if (nice > NICE_MAX) nice = NICE_MAX;
+
+  old_level = intr_disable();
+  thread_current()->nice = nice;
+  if (thread_mlfqs) mlfqs_update_priority(thread_current());
+  intr_set_level(old_level);
+  thread_check_priority();
 }
 
+/* Returns the current thread's nice value. */
+int thread_get_nice(void) { return thread_current()->nice; }
+
 /* Returns 100 times the system load average. */
 int thread_get_load_avg(void) {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int load = fp_round(load_avg * 100);
+  intr_set_level(old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int thread_get_recent_cpu(void) {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable();
+  int cpu = fp_round(thread_current()->recent_cpu * 100);
+  intr_set_level(old_level);
+  return cpu;
+}
+
+/* Sets T's priority from its recent_cpu and nice values, moving
+   it to the matching run queue if it is ready.  Interrupts must
+   be off. */
+static void mlfqs_update_priority(struct thread* t) {
+  int pri = PRI_MAX - fp_trunc(t->recent_cpu / 4) - t->nice * 2;
+
+  if (t->rt) return;
+  if (pri < PRI_MIN) pri = PRI_MIN;
+  if (pri > PRI_MAX) pri = PRI_MAX;
+  if (pri == t->priority) return;
+
+  if (t->status == THREAD_READY) {
+    ready_remove(t);
+    t->priority = pri;
+    ready_push(t);
+  } else {
+    t->priority = pri;
+    if (t->status == THREAD_BLOCKED) waitq_requeue(t);
+  }
+}
+
+/* Decays T's recent_cpu by the load-dependent factor COEF and
+   recomputes its priority.  Called once a second for every
+   thread. */
+static void mlfqs_decay(struct thread* t, void* coef_) {
+  fixed_t* coef = coef_;
+
+  if (t == idle_thread) return;
+  t->recent_cpu = fp_add_int(fp_mul(*coef, t->recent_cpu), t->nice);
+  mlfqs_update_priority(t);
+}
+
+/* Updates the 4.4BSD scheduler state for a timer tick during
+   which CUR was running. */
+static void mlfqs_tick(struct thread* cur) {
+  int64_t now = timer_ticks();
+
+  if (cur != idle_thread) {
+    cur->recent_cpu = fp_add_int(cur->recent_cpu, 1);
+    if (!cur->mlfqs_dirty) {
+      cur->mlfqs_dirty = true;
+      list_push_back(&mlfqs_dirty_list, &cur->dirtyelem);
+    }
+  }
+
+  if (now % TIMER_FREQ == 0) {
+    int ready = ready_cnt + (cur != idle_thread);
+    fixed_t coef;
+
+    load_avg = fp_mul(fp_div(fp_from_int(59), fp_from_int(60)), load_avg) +
+               fp_from_int(ready) / 60;
+    coef = fp_div(2 * load_avg, fp_add_int(2 * load_avg, 1));
+    thread_foreach(mlfqs_decay, &coef);
+
+    while (!list_empty(&mlfqs_dirty_list))
+      list_entry(list_pop_front(&mlfqs_dirty_list), struct thread, dirtyelem)
+          ->mlfqs_dirty = false;
+  } else if (now % TIME_SLICE == 0) {
+    while (!list_empty(&mlfqs_dirty_list)) {
+      struct thread* t = list_entry(list_pop_front(&mlfqs_dirty_list),
+                                    struct thread, dirtyelem);
+      t->mlfqs_dirty = false;
+      mlfqs_update_priority(t);
+    }
+  }
+
+  if (ready_max() > run_priority(cur)) intr_yield_on_return();
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -431,10 +707,19 @@ static void idle(void* idle_started_ UNUSED) {
   sema_up(idle_started);
 
   for (;;) {
+    /* Spend idle time zeroing free pages for later PAL_ZERO
+       requests.  Interrupts are on, so a thread that becomes ready
+       preempts us between pages. */
+    while (palloc_zero_idle()) continue;
+
     /* Let someone else run. */
     intr_disable();
     thread_block();
 
+    /* Nothing will run until an interrupt makes a thread ready,
+       so stop taking timer ticks that would have nothing to do. */
+    timer_idle_enter();
+
     /* Re-enable interrupts and wait for the next one.
 
        The `sti' instruction disables interrupts until the
@@ -477,27 +762,69 @@ static bool is_thread(struct thread* t) {
   return t != NULL && t->magic == THREAD_MAGIC;
 }
 
+/* Orders a thread's donors by priority, highest on top. */
+static bool donor_less(const struct heap_elem* a, const struct heap_elem* b,
+                       void* aux UNUSED) {
+  return heap_entry(a, struct thread, donorelem)->priority <
+         heap_entry(b, struct thread, donorelem)->priority;
+}
+
 /* Does basic initialization of T as a blocked thread named
    NAME. */
 static void init_thread(struct thread* t, const char* name, int priority) {
   ASSERT(t != NULL);
-  ASSERT(PRI_MIN <= priority && priority <= PRI_MAX);
+  ASSERT(PRI_MIN <= priority && priority <= PRI_RT);
   ASSERT(name != NULL);
 
   memset(t, 0, sizeof *t);
+  if (priority == PRI_RT) {
+    t->rt = true;
+    priority = PRI_MAX;
+  }
   t->status = THREAD_BLOCKED;
   strlcpy(t->name, name, sizeof t->name);
   t->stack = (uint8_t*)t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  heap_init(&t->donors, donor_less, NULL);
   t->magic = THREAD_MAGIC;
+  /* Inherit the creator's niceness and limits; the main thread
+     starts from zero, with no limits. */
+  if (t == running_thread()) {
+    t->pri_limit = PRI_MAX;
+    t->nice_limit = NICE_MIN;
+  } else {
+    t->nice = running_thread()->nice;
+    t->pri_limit = running_thread()->pri_limit;
+    t->nice_limit = running_thread()->nice_limit;
+  }
+  if (thread_mlfqs && !t->rt) {
+    /* Inherit the creator's scheduling inputs. */
+    t->recent_cpu = running_thread()->recent_cpu;
+    t->priority = PRI_MAX - fp_trunc(t->recent_cpu / 4) - t->nice * 2;
+    if (t->priority < PRI_MIN) t->priority = PRI_MIN;
+    if (t->priority > PRI_MAX) t->priority = PRI_MAX;
+  }
   list_push_back(&all_list, &t->allelem);
 
 #ifdef USERPROG
-  int i;
-  for (i = 0; i < FD_TABLE_SIZE; i++) t->fd_table[i] = NULL;
+  t->proc = t;
+  t->stack_slot = -1;
+  fd_table_init(&t->fd_table);
+  lock_init(&t->SPT_lock);
 
   t->parent = running_thread();
+  /* A user process hands on no more than it has itself, so only the
+     ones the kernel starts may raise their priority or lower their
+     niceness past what they start with. */
+  if (t->parent->pagedir != NULL) {
+    t->pri_limit = t->parent->base_priority;
+    t->nice_limit = t->parent->nice;
+    if (!thread_mlfqs && t->base_priority > t->pri_limit)
+      t->priority = t->base_priority = t->pri_limit;
+  }
   list_init(&(t->children));
+  list_init(&t->exited);
+  sema_init(&t->exited_sema, 0);
   list_push_back(&(t->parent->children), &(t->childelem));
 
   sema_init(&(t->child_sema), 0);
@@ -508,7 +835,7 @@ static void init_thread(struct thread* t, const char* name, int priority) {
   t->load_status = true;
   t->executable = NULL;
 
-  list_init(&(t->mmap_table));
+  mmap_table_init(&t->mmap_table);
 #endif
 }
 
@@ -529,10 +856,16 @@ static void* alloc_frame(struct thread* t, size_t size) {
    will be in the run queue.)  If the run queue is empty, return
    idle_thread. */
 static struct thread* next_thread_to_run(void) {
-  if (list_empty(&ready_list))
-    return idle_thread;
+  int pri = ready_max();
+  struct thread* t;
+
+  if (pri < 0) return idle_thread;
+  if (pri == PRI_RT)
+    t = list_entry(list_front(&ready_rt_queue), struct thread, elem);
   else
-    return list_entry(list_pop_front(&ready_list), struct thread, elem);
+    t = list_entry(list_front(&ready_queues[pri]), struct thread, elem);
+  ready_remove(t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -562,6 +895,27 @@ void thread_schedule_tail(struct thread* prev) {
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Trap the first FPU instruction unless our state is loaded. */
+  fpu_schedule(cur);
+
+  /* Charge the time since it became ready to the new thread. */
+  if (prev != NULL) {
+    uint64_t now = rdtsc();
+    if (cur->ready_since != 0) {
+      uint64_t wait = now - cur->ready_since;
+      int bucket = 0;
+
+      cur->ready_cycles += wait;
+      while (wait > 1 && bucket < READY_WAIT_BUCKETS - 1) {
+        wait >>= 1;
+        bucket++;
+      }
+      ready_waits[bucket]++;
+      cur->ready_since = 0;
+    }
+    cur->run_since = now;
+  }
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate();
@@ -574,8 +928,43 @@ void thread_schedule_tail(struct thread* prev) {
      palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) {
     ASSERT(prev != cur);
-    palloc_free_page(prev);
+#ifdef USERPROG
+    /* A process's teardown is left to the reaper thread. */
+    if (process_reap(prev)) return;
+#endif
+    thread_page_free(prev);
+  }
+}
+
+/* Returns a page for a new thread, from the pool if there is one
+   there.  Only init_thread() clears it. */
+static struct thread* thread_page_alloc(void) {
+  enum intr_level old_level = intr_disable();
+  void* page = thread_pool;
+
+  if (page != NULL) {
+    thread_pool = *(void**)page;
+    thread_pool_cnt--;
   }
+  intr_set_level(old_level);
+  return page != NULL ? page : palloc_get_page(0);
+}
+
+/* Releases the page of dead thread T, keeping it for reuse if the
+   pool has room. */
+void thread_page_free(struct thread* t) {
+  enum intr_level old_level = intr_disable();
+
+  /* A stale pointer must not look like a live thread. */
+  t->magic = 0;
+  if (thread_pool_cnt < THREAD_POOL_MAX) {
+    *(void**)t = thread_pool;
+    thread_pool = t;
+    thread_pool_cnt++;
+    t = NULL;
+  }
+  intr_set_level(old_level);
+  if (t != NULL) palloc_free_page(t);
 }
 
 /* Schedules a new process.  At entry, interrupts must be off and
@@ -594,7 +983,20 @@ static void schedule(void) {
   ASSERT(cur->status != THREAD_RUNNING);
   ASSERT(is_thread(next));
 
-  if (cur != next) prev = switch_threads(cur, next);
+  if (cur == idle_thread && next != cur) timer_idle_exit();
+  if (cur != next) {
+    uint64_t now = rdtsc();
+    cur->run_cycles += now - cur->run_since;
+    if (cur->status == THREAD_READY) {
+      cur->rusage.involuntary_switches++;
+      involuntary_switches++;
+    } else {
+      cur->rusage.voluntary_switches++;
+      voluntary_switches++;
+    }
+    TRACE(TRACE_SCHEDULE, next->tid);
+    prev = switch_threads(cur, next);
+  }
   thread_schedule_tail(prev);
 }
 
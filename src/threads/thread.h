@@ -3,10 +3,23 @@
 
 #include <debug.h>
 #include <hash.h>
+#include <heap.h>
 #include <list.h>
+#include <ptrmap.h>
+#include <rbtree.h>
+#include <rusage.h>
+#include <stats.h>
 #include <stdint.h>
 
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
+#ifdef USERPROG
+#include "userprog/fdtable.h"
+#include "vm/mmap.h"
+#endif
+
+struct fpu_state;
 
 /* States in a thread's life cycle. */
 enum thread_status {
@@ -26,10 +39,16 @@ typedef int tid_t;
 #define PRI_DEFAULT 31 /* Default priority. */
 #define PRI_MAX 63     /* Highest priority. */
 
-/* Maximum number of files that one thread can open: 128
-   stdin, stdout: 2
-   128 + 2 = 130 */
-#define FD_TABLE_SIZE 130
+/* The real-time FIFO class, above every priority.  A thread created
+   with or set to PRI_RT is never preempted by the time slice or by
+   another real-time thread: it runs until it blocks or yields.  As
+   soon as it becomes ready, it preempts any thread outside the class.
+   Its priority, for lock donation and wait queues, is PRI_MAX. */
+#define PRI_RT (PRI_MAX + 1)
+
+/* Nice values. */
+#define NICE_MIN -20   /* Least nice. */
+#define NICE_MAX 20    /* Nicest. */
 
 /* A kernel thread or user process.
 
@@ -93,22 +112,55 @@ struct thread {
   enum thread_status status; /* Thread state. */
   char name[16];             /* Name (for debugging purposes). */
   uint8_t* stack;            /* Saved stack pointer. */
-  int priority;              /* Priority. */
+  struct fpu_state* fpu;     /* FPU state, null until first used. */
+  int priority;              /* Effective priority, with donations. */
+  int base_priority;         /* Priority before donations. */
+  bool rt;                   /* In the real-time FIFO class? */
   struct list_elem allelem;  /* List element for all threads list. */
-  int64_t wake_me_at;        /* Tick to wake up the thread. */
+  struct timer sleep_timer;  /* Wakes the thread from thread_sleep(). */
+  int nice;                  /* Niceness, for -o mlfqs, I/O and paging. */
+  int pri_limit;             /* Highest priority setpriority() may set. */
+  int nice_limit;            /* Lowest niceness nice() may set. */
+  fixed_t recent_cpu;        /* Recent CPU time, for -o mlfqs. */
+  bool mlfqs_dirty;          /* In mlfqs_dirty_list? */
+  struct list_elem dirtyelem; /* Element in mlfqs_dirty_list. */
+
+  /* Scheduler statistics, in TSC cycles. */
+  uint64_t ready_since;      /* When the thread last became ready. */
+  uint64_t run_since;        /* When the thread last started running. */
+  uint64_t ready_cycles;     /* Total time spent ready but not running. */
+  uint64_t run_cycles;       /* Total time spent running. */
+  struct rusage rusage;      /* Resources it used, for getrusage(). */
 
   /* Shared between thread.c and synch.c. */
-  struct list_elem elem; /* List element. */
+  struct list_elem elem;      /* List element. */
+  struct lock* waiting_on;    /* Lock this thread is blocked on. */
+  struct heap donors;         /* Threads waiting on locks we hold. */
+  struct heap_elem donorelem; /* Element in the holder's donors. */
+  struct thread* donee;       /* Thread whose donors we are in, or null. */
+  struct list* wait_list;     /* Wait queue it is blocked on, or null. */
+  struct list_elem* wait_elem; /* Its element in wait_list. */
+
+  /* Owned by devices/block.c. */
+  int io_class; /* Class of its block requests, an enum bio_class. */
 
 #ifdef USERPROG
   /* Owned by userprog/process.c. */
   uint32_t* pagedir; /* Page directory. */
+  struct thread* proc; /* Owner of the address space and the rest
+                          of the process state below: this thread,
+                          or the one it shares them with. */
+  int stack_slot;      /* Stack slot of a thread_spawn() thread. */
+  uint32_t stack_slots; /* In a process, stack slots in use. */
 
-  struct file* fd_table[FD_TABLE_SIZE]; /* Per-process file descriptor table */
+  struct fd_table fd_table; /* Per-process file descriptor table */
 
   struct thread* parent;      /* Parent process */
   struct list children;       /* List of child processes */
   struct list_elem childelem; /* List element for child processes list */
+  struct list exited;         /* Children that exited, not waited for yet */
+  struct semaphore exited_sema; /* Counts the children in exited */
+  struct list_elem exitelem;  /* List element for the parent's exited */
 
   struct semaphore child_sema; /* Semaphore for waiting child */
   struct semaphore exit_sema;  /* Semaphore for right order of exiting */
@@ -118,12 +170,43 @@ struct thread {
   bool load_status;        /* Loaded successfully or not */
   int exit_status;         /* Return value of calling exit */
   struct file* executable; /* Current running file */
-
-  struct hash SPT; /* PER-PROCESS SPT */
+  struct file* snapshot;   /* Snapshot restored from, or NULL */
+
+  struct hash SPT;          /* PER-PROCESS SPT */
+  struct page*** SPT_dir;   /* Two-level SPT, used with -spt=radix */
+  struct ptrmap SPT_map;    /* Open-addressing SPT, used with -spt=open */
+  struct rb_tree SPT_regions; /* Lazily populated SPT regions, by start */
+  struct lock SPT_lock;     /* Held by the thread using the SPT, its
+                               regions or mmap_table, see SPT_lock() */
   void* esp;       /* stack pointer of this process.*/
+  bool in_uaccess; /* Probing user memory: bad accesses return -1 */
 
-  struct list mmap_table;   /* List of mappings (mmap table) */
+  struct mmap_table mmap_table; /* Mappings (mmap table) */
   void* data_segment_start; /* Pointer to the starting point of data segment */
+  uint8_t* heap_start;      /* First page after the loaded segments */
+  uint8_t* heap_brk;        /* Current break, moved by sbrk() */
+  struct sys_ring* sys_ring; /* Batched syscall ring, in user memory */
+  struct sc_stats* sc_stats; /* System call counters, or NULL */
+  struct sctrace* sctrace;   /* System call trace ring, or NULL */
+
+  size_t rss;          /* Frames currently owned (resident set size). */
+  size_t lent_cnt;     /* Page cache frames borrowed through read(). */
+  size_t rss_quota;    /* Frame quota set by PFF, 0 for an equal share. */
+  size_t wss;          /* Working set estimated by the idle page scanner. */
+  size_t wss_scan;     /* The scanner's count in the pass under way. */
+  unsigned pff_faults; /* Faults in the current PFF window. */
+  int64_t pff_start;   /* Tick at which the current PFF window began. */
+  bool oom_killed;     /* Picked by the OOM killer: exit on return. */
+  bool exiting;        /* Leader has exited: its threads exit too. */
+  int64_t replay_until; /* Tick until which faults are noted for replay. */
+  struct wake_log* wake_log; /* Pages evicted while it slept, or NULL */
+  struct rusage exited_rusage; /* Of its thread_spawn() threads gone */
+  struct rusage child_rusage;  /* Of the children it waited for */
+#endif
+
+#ifdef FILESYS
+  /* Owned by filesys/journal.c. */
+  int journal_depth; /* Nesting of journal transactions, 0 if none. */
 #endif
 
   /* Owned by thread.c. */
@@ -135,13 +218,20 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
-list_less_func thread_priority_greater;
-list_less_func thread_wake_me_up_less;
+/* Timer ticks a thread runs before it is preempted, TIME_SLICE
+   unless changed through tunable "sched.time_slice". */
+extern int thread_time_slice;
 
 void thread_init(void);
 void thread_start(void);
 
-void thread_tick(void);
+void thread_tick(bool user);
+void thread_idle_ticks(int64_t ticks);
+void thread_get_stats(struct sched_stats*);
+void thread_rusage_add(struct rusage*, const struct rusage*);
+#ifdef USERPROG
+void thread_process_rusage(struct thread* proc, struct rusage*);
+#endif
 void thread_print_stats(void);
 
 typedef void thread_func(void* aux);
@@ -149,11 +239,26 @@ tid_t thread_create(const char* name, int priority, thread_func*, void*);
 
 void thread_block(void);
 void thread_unblock(struct thread*);
+void thread_page_free(struct thread*);
 
 void thread_sleep(int64_t ticks);
-void thread_wake_sleeping(int64_t ticks);
 
 struct thread* thread_current(void);
+
+/* Most CPUs the kernel runs on.  Only the boot CPU is brought up
+   so far. */
+#define CPU_MAX 1
+
+/* Returns the index of the CPU we are running on. */
+static inline int cpu_id(void) { return 0; }
+
+#ifdef USERPROG
+/* Returns the thread that holds the running thread's process
+   state: its address space, open files and mappings. */
+static inline struct thread* process_current(void) {
+  return thread_current()->proc;
+}
+#endif
 tid_t thread_tid(void);
 const char* thread_name(void);
 
@@ -165,6 +270,8 @@ typedef void thread_action_func(struct thread* t, void* aux);
 void thread_foreach(thread_action_func*, void*);
 
 int thread_get_priority(void);
+void thread_check_priority(void);
+void thread_update_priority(struct thread*);
 void thread_set_priority(int);
 
 int thread_get_nice(void);
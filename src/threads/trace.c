@@ -0,0 +1,248 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#endif
+
+/* Records per CPU.  Must be a power of 2.  Past this many, each
+   new record overwrites the oldest, so the trace covers the end of
+   the run. */
+#define TRACE_RECORDS 8192
+
+uint32_t trace_mask;
+
+/* A CPU's records.  Only that CPU writes them, with interrupts off,
+   so no lock is needed. */
+struct trace_ring
+  {
+    struct trace_record *records;       /* TRACE_RECORDS records. */
+    uint64_t cnt;                       /* Records ever written. */
+  };
+
+static struct trace_ring rings[CPU_MAX];
+
+/* File to write the trace to, or null for the console. */
+static const char *file_name;
+
+static const char *event_names[TRACE_EVENT_CNT] =
+  {
+    "fault-enter", "fault-exit", "evict", "swap-in", "swap-out",
+    "block-submit", "block-complete", "schedule", "lock-contended",
+  };
+
+/* Enables the events named in EVENTS, a comma-separated list of
+   names or "all".  Returns false if a name is unknown.  Must be
+   called before trace_init(). */
+bool
+trace_enable (const char *events)
+{
+  const char *p = events;
+
+  while (*p != '\0')
+    {
+      size_t len = strcspn (p, ",");
+      int i;
+
+      if (len == 3 && !memcmp (p, "all", 3))
+        trace_mask = (1u << TRACE_EVENT_CNT) - 1;
+      else
+        {
+          for (i = 0; i < TRACE_EVENT_CNT; i++)
+            if (strlen (event_names[i]) == len
+                && !memcmp (p, event_names[i], len))
+              break;
+          if (i == TRACE_EVENT_CNT)
+            return false;
+          trace_mask |= 1u << i;
+        }
+      p += len;
+      if (*p == ',')
+        p++;
+    }
+  return true;
+}
+
+/* Makes trace_save() write the trace to file NAME instead of
+   trace_print() printing it. */
+void
+trace_set_file (const char *name)
+{
+  file_name = name;
+}
+
+/* Allocates the ring buffers, if any event is enabled.  Must be
+   called after palloc_init(). */
+void
+trace_init (void)
+{
+  size_t pages = DIV_ROUND_UP (TRACE_RECORDS * sizeof (struct trace_record),
+                               PGSIZE);
+  int cpu;
+
+  if (trace_mask == 0)
+    return;
+  for (cpu = 0; cpu < CPU_MAX; cpu++)
+    rings[cpu].records = palloc_get_multiple (PAL_ASSERT, pages);
+}
+
+/* Records EVENT with ARG.  Use TRACE() rather than calling this
+   directly.  Safe to call from interrupt handlers and from the
+   scheduler. */
+void
+trace_record (enum trace_event event, uint32_t arg)
+{
+  struct trace_ring *ring = &rings[cpu_id ()];
+  enum intr_level old_level;
+  struct trace_record *r;
+  struct thread *t;
+
+  if (ring->records == NULL)
+    return;
+
+  /* Not thread_current(), whose checks fail inside schedule(). */
+  t = pg_round_down (&r);
+
+  old_level = intr_disable ();
+  r = &ring->records[ring->cnt++ & (TRACE_RECORDS - 1)];
+  r->tsc = rdtsc ();
+  r->arg = arg;
+  r->event = event;
+  r->tid = t->tid;
+  intr_set_level (old_level);
+}
+
+/* Formats record R from CPU into BUF, which must have room for
+   64 bytes, and returns its length. */
+static int
+format_record (char *buf, int cpu, const struct trace_record *r)
+{
+  return snprintf (buf, 64, "Trace: %"PRIu64" %d %s %d %#"PRIx32"\n",
+                   r->tsc, cpu, event_names[r->event], r->tid, r->arg);
+}
+
+/* Calls OUTPUT (LINE, LENGTH, AUX) for each record, oldest first
+   within each CPU, once tracing has stopped. */
+static void
+for_each_record (void (*output) (const char *, int, void *), void *aux)
+{
+  char line[64];
+  int cpu;
+
+  for (cpu = 0; cpu < CPU_MAX; cpu++)
+    {
+      struct trace_ring *ring = &rings[cpu];
+      uint64_t i = ring->cnt > TRACE_RECORDS ? ring->cnt - TRACE_RECORDS : 0;
+
+      for (; i < ring->cnt; i++)
+        {
+          const struct trace_record *r;
+
+          r = &ring->records[i & (TRACE_RECORDS - 1)];
+          output (line, format_record (line, cpu, r), aux);
+        }
+    }
+}
+
+/* Stops tracing. */
+static void
+trace_stop (void)
+{
+  enum intr_level old_level = intr_disable ();
+  trace_mask = 0;
+  intr_set_level (old_level);
+}
+
+#ifdef FILESYS
+/* Batch of output for save_line(). */
+struct save_aux
+  {
+    struct file *file;
+    char *buf;                  /* One page. */
+    size_t len;
+  };
+
+/* Adds LINE, LEN bytes long, to the batch in AUX_, writing the
+   batch out first if it is full. */
+static void
+save_line (const char *line, int len, void *aux_)
+{
+  struct save_aux *aux = aux_;
+
+  if (aux->len + len > PGSIZE)
+    {
+      file_write (aux->file, aux->buf, aux->len);
+      aux->len = 0;
+    }
+  memcpy (aux->buf + aux->len, line, len);
+  aux->len += len;
+}
+#endif
+
+/* Writes the trace to the file set with trace_set_file(), if any.
+   Must be called while the file system is still up. */
+void
+trace_save (void)
+{
+#ifdef FILESYS
+  struct save_aux aux;
+
+  if (rings[0].records == NULL || file_name == NULL)
+    return;
+  trace_stop ();
+
+  filesys_remove (file_name);
+  if (!filesys_create (file_name, 0)
+      || (aux.file = filesys_open (file_name)) == NULL)
+    {
+      printf ("Trace: could not create \"%s\".\n", file_name);
+      return;
+    }
+  aux.buf = palloc_get_page (PAL_ASSERT);
+  aux.len = 0;
+  for_each_record (save_line, &aux);
+  file_write (aux.file, aux.buf, aux.len);
+  palloc_free_page (aux.buf);
+  file_close (aux.file);
+#endif
+}
+
+/* Prints LINE, LEN bytes long, to the console. */
+static void
+print_line (const char *line, int len UNUSED, void *aux UNUSED)
+{
+  printf ("%s", line);
+}
+
+/* Prints how many records were taken and, unless trace_save()
+   wrote them to a file, the records themselves. */
+void
+trace_print (void)
+{
+  uint64_t cnt = 0, kept = 0;
+  int cpu;
+
+  if (rings[0].records == NULL)
+    return;
+  trace_stop ();
+
+  for (cpu = 0; cpu < CPU_MAX; cpu++)
+    {
+      cnt += rings[cpu].cnt;
+      kept += rings[cpu].cnt < TRACE_RECORDS ? rings[cpu].cnt : TRACE_RECORDS;
+    }
+  printf ("Trace: %"PRIu64" records, %"PRIu64" overwritten%s%s.\n",
+          cnt, cnt - kept, file_name != NULL ? ", saved to " : "",
+          file_name != NULL ? file_name : "");
+  if (file_name == NULL)
+    for_each_record (print_line, NULL);
+}
@@ -0,0 +1,62 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Static tracepoints.
+
+   TRACE (EVENT, ARG) at a point of interest records a fixed-size
+   binary record, with a TSC timestamp and the running thread's
+   tid, in the running CPU's ring buffer.  Kernel command-line
+   option "-trace=EVENT,..." (or "-trace=all") enables events; a
+   disabled tracepoint costs one load and branch.  The trace is
+   printed to the console at shutdown, or with "-trace-file=NAME"
+   written to file NAME in the file system instead, for "pintos
+   -g" to fetch.  Either way, records are written out only after
+   the run, so tracing itself does not go through the serial port
+   while timing matters. */
+
+/* Events, and what their ARG is. */
+enum trace_event
+  {
+    TRACE_FAULT_ENTER,          /* Page fault begun: fault address. */
+    TRACE_FAULT_EXIT,           /* Page fault handled: resuming EIP. */
+    TRACE_EVICT,                /* Frame evicted: user page. */
+    TRACE_SWAP_IN,              /* Swap slot read: slot. */
+    TRACE_SWAP_OUT,             /* Swap slot written: slot. */
+    TRACE_BLOCK_SUBMIT,         /* Block request queued: sector. */
+    TRACE_BLOCK_COMPLETE,       /* Block request over: sector. */
+    TRACE_SCHEDULE,             /* Switching threads: next thread's tid. */
+    TRACE_LOCK_CONTENDED,       /* Waiting for a lock: lock address. */
+    TRACE_EVENT_CNT
+  };
+
+/* One record.  16 bytes. */
+struct trace_record
+  {
+    uint64_t tsc;               /* Time-stamp counter. */
+    uint32_t arg;               /* Depends on EVENT. */
+    uint16_t event;             /* enum trace_event. */
+    int16_t tid;                /* Running thread. */
+  };
+
+/* Bit N is set if event N is enabled. */
+extern uint32_t trace_mask;
+
+#define TRACE(EVENT, ARG)                                       \
+        do                                                      \
+          {                                                     \
+            if (trace_mask & (1u << (EVENT)))                   \
+              trace_record ((EVENT), (uint32_t) (ARG));         \
+          }                                                     \
+        while (0)
+
+bool trace_enable (const char *events);
+void trace_set_file (const char *name);
+void trace_init (void);
+void trace_record (enum trace_event, uint32_t arg);
+void trace_save (void);
+void trace_print (void);
+
+#endif /* threads/trace.h */
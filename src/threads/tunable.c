@@ -0,0 +1,171 @@
+#include "threads/tunable.h"
+#include <ctype.h>
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/inode.h"
+#include "filesys/warmup.h"
+#endif
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Kind of variable a tunable sets. */
+enum tunable_type
+  {
+    TUNABLE_INT,                /* int, between MIN and MAX. */
+    TUNABLE_BOOL                /* bool, set with 0 or 1. */
+  };
+
+/* A kernel tunable.  Settings are a single word, so they are read
+   and stored without locking; code that uses one reads it afresh
+   each time, and at worst acts on the old value once more. */
+struct tunable
+  {
+    const char *name;           /* Group and parameter, e.g. "vm.x". */
+    enum tunable_type type;
+    void *var;                  /* The int or bool it sets. */
+    int min, max;               /* Range for TUNABLE_INT. */
+    void (*set) (int);          /* Applies a setting, if storing it to
+                                   VAR is not enough. */
+    const char *desc;           /* For the -h listing. */
+  };
+
+static void set_intrlat (int);
+
+#define INT(NAME, VAR, MIN, MAX, DESC) \
+        {NAME, TUNABLE_INT, &(VAR), MIN, MAX, NULL, DESC}
+#define BOOL(NAME, VAR, SET, DESC) \
+        {NAME, TUNABLE_BOOL, &(VAR), 0, 1, SET, DESC}
+
+static const struct tunable tunables[] =
+  {
+    INT ("sched.time_slice", thread_time_slice, 1, 1000,
+         "Timer ticks a thread runs before it is preempted"),
+    BOOL ("debug.intrlat", intr_latency_tracking, set_intrlat,
+          "Time interrupts-off windows"),
+#ifdef VM
+    INT ("vm.stack_limit", SPT_stack_limit, 64 * 1024, STACK_MAX,
+         "Bytes the user stack may grow to"),
+    INT ("vm.stack_slack", SPT_stack_slack, 0, 65536,
+         "Bytes below ESP a stack access may fault at"),
+    INT ("vm.swap_readahead", SPT_swap_readahead, 0, 16,
+         "Swap slots a swap-in fault reads ahead"),
+#endif
+#ifdef FILESYS
+    {"fs.flush_ms", TUNABLE_INT, &cache_flush_ms, 0, 60 * 1000,
+     cache_set_flush_interval, "Milliseconds between write-backs, 0 off"},
+    INT ("fs.readahead_max", inode_readahead_max, 1, 32,
+         "Most sectors a file's read-ahead window grows to"),
+    BOOL ("fs.warmup", warmup_enabled, NULL,
+          "Save hot cache sectors at shutdown, read them at boot"),
+#endif
+  };
+
+#define TUNABLE_CNT (sizeof tunables / sizeof *tunables)
+
+/* Applies a debug.intrlat setting of ON. */
+static void
+set_intrlat (int on)
+{
+  intr_set_latency_tracking (on);
+}
+
+/* Returns the tunable named NAME, or a null pointer. */
+static const struct tunable *
+lookup (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < TUNABLE_CNT; i++)
+    if (!strcmp (tunables[i].name, name))
+      return &tunables[i];
+  return NULL;
+}
+
+/* Returns the current setting of T. */
+static int
+get (const struct tunable *t)
+{
+  return t->type == TUNABLE_BOOL ? *(bool *) t->var : *(int *) t->var;
+}
+
+/* Stores the IDX'th tunable's name, setting and range in *INFO.
+   Returns false if there are only IDX tunables or fewer. */
+bool
+tunable_get (size_t idx, struct tunable_info *info)
+{
+  const struct tunable *t;
+
+  if (idx >= TUNABLE_CNT)
+    return false;
+  t = &tunables[idx];
+  strlcpy (info->name, t->name, sizeof info->name);
+  info->value = get (t);
+  info->min = t->min;
+  info->max = t->max;
+  return true;
+}
+
+/* Sets the tunable named NAME to VALUE.  Returns false if there is
+   no such tunable or VALUE is out of its range. */
+bool
+tunable_set (const char *name, int value)
+{
+  const struct tunable *t = lookup (name);
+
+  if (t == NULL || value < t->min || value > t->max)
+    return false;
+  if (t->set != NULL)
+    t->set (value);
+  else if (t->type == TUNABLE_BOOL)
+    *(bool *) t->var = value;
+  else
+    *(int *) t->var = value;
+  return true;
+}
+
+/* Applies the "NAME=VALUE" setting in S, as given to the kernel
+   command-line option "-tune".  Returns false if S is malformed or
+   tunable_set() refuses it. */
+bool
+tunable_parse (const char *s)
+{
+  char name[TUNABLE_NAME_MAX];
+  const char *eq = s != NULL ? strchr (s, '=') : NULL;
+  const char *digit;
+
+  if (eq == NULL || eq == s || (size_t) (eq - s) >= sizeof name)
+    return false;
+  strlcpy (name, s, eq - s + 1);
+
+  /* atoi() stops at the first non-digit; insist on a number. */
+  digit = eq[1] == '-' ? eq + 2 : eq + 1;
+  if (*digit == '\0' || strlen (digit) > 9)
+    return false;
+  for (; *digit != '\0'; digit++)
+    if (!isdigit (*digit))
+      return false;
+  return tunable_set (name, atoi (eq + 1));
+}
+
+/* Prints every tunable with its range and setting. */
+void
+tunable_print (void)
+{
+  size_t i;
+
+  printf ("Tunables, for -tune=NAME=VALUE:\n");
+  for (i = 0; i < TUNABLE_CNT; i++)
+    {
+      const struct tunable *t = &tunables[i];
+      printf ("  %-20s %s (%d..%d, now %d)\n",
+              t->name, t->desc, t->min, t->max, get (t));
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef THREADS_TUNABLE_H
+#define THREADS_TUNABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <tunable.h>
+
+/* Registry of kernel tunables: named, range-checked parameters
+   that can be set at boot with "-tune=NAME=VALUE" and read or set
+   at run time with the gettunable() and settunable() system
+   calls.  The table is in tunable.c. */
+
+bool tunable_get (size_t idx, struct tunable_info *);
+bool tunable_set (const char *name, int value);
+bool tunable_parse (const char *);
+void tunable_print (void);
+
+#endif /* threads/tunable.h */
@@ -0,0 +1,105 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Work queues.
+
+   Interrupt handlers and hot paths that must not block hand work
+   to a queue with work_enqueue(), which only links the item in and
+   ups a semaphore, so it is safe with interrupts off and in
+   interrupt context.  Each worker thread downs the semaphore,
+   takes the oldest item and runs it in ordinary thread context,
+   where it may sleep and take locks.  Queues live for as long as
+   the kernel does. */
+
+static void worker (void *wq_);
+
+/* Initializes work item W to run FUNC(AUX). */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Creates a work queue served by WORKERS kernel threads named
+   NAME, running at PRIORITY.  Returns the new queue, or a null
+   pointer if memory or the first worker could not be obtained.
+   If only some workers could be started, the queue runs with
+   those. */
+struct work_queue *
+work_queue_create (const char *name, int priority, size_t workers)
+{
+  struct work_queue *wq;
+  size_t started = 0;
+
+  ASSERT (workers > 0);
+
+  wq = malloc (sizeof *wq);
+  if (wq == NULL)
+    return NULL;
+  wq->name = name;
+  list_init (&wq->items);
+  sema_init (&wq->pending, 0);
+
+  while (started < workers
+         && thread_create (name, priority, worker, wq) != TID_ERROR)
+    started++;
+  if (started == 0)
+    {
+      free (wq);
+      return NULL;
+    }
+  return wq;
+}
+
+/* Queues W to run on WQ.  Returns false, and does nothing, if W
+   is already waiting in a queue.  May be called from an interrupt
+   handler or with interrupts off. */
+bool
+work_enqueue (struct work_queue *wq, struct work *w)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  ASSERT (wq != NULL);
+  ASSERT (w != NULL);
+
+  old_level = intr_disable ();
+  queued = !w->queued;
+  if (queued)
+    {
+      w->queued = true;
+      list_push_back (&wq->items, &w->elem);
+      sema_up (&wq->pending);
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Worker thread for work queue WQ_: runs queued items forever. */
+static void
+worker (void *wq_)
+{
+  struct work_queue *wq = wq_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      sema_down (&wq->pending);
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&wq->items), struct work, elem);
+      w->queued = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* A unit of deferred work: FUNC(AUX), run later on one of a work
+   queue's worker threads.  The caller owns the storage, which
+   must stay valid until FUNC starts running. */
+typedef void work_func (void *aux);
+
+struct work
+  {
+    struct list_elem elem;      /* Element in the queue's items. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+    bool queued;                /* Waiting in a queue? */
+  };
+
+/* A queue of work items and the kernel threads that run them. */
+struct work_queue
+  {
+    const char *name;           /* Worker thread name. */
+    struct list items;          /* Queued work, oldest first. */
+    struct semaphore pending;   /* Counts queued items. */
+  };
+
+void work_init (struct work *, work_func *, void *aux);
+struct work_queue *work_queue_create (const char *name, int priority,
+                                      size_t workers);
+bool work_enqueue (struct work_queue *, struct work *);
+
+#endif /* threads/workqueue.h */
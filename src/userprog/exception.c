@@ -6,24 +6,37 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "devices/block.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/off_t.h"
+#include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "userprog/tss.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"  // will be needed for stack swap!
+#include "vm/vmstat.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill(struct intr_frame*);
+static void debug_trap(struct intr_frame*);
+static void device_not_available(struct intr_frame*);
 static void page_fault(struct intr_frame*);
+static void handle_page_fault(struct intr_frame*);
+static bool resolve_fault(void* fault_addr, void* esp, bool write,
+                          bool not_present);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -54,9 +67,8 @@ void exception_init(void) {
      caused indirectly, e.g. #DE can be caused by dividing by
      0.  */
   intr_register_int(0, 0, INTR_ON, kill, "#DE Divide Error");
-  intr_register_int(1, 0, INTR_ON, kill, "#DB Debug Exception");
+  intr_register_int(1, 0, INTR_ON, debug_trap, "#DB Debug Exception");
   intr_register_int(6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int(7, 0, INTR_ON, kill, "#NM Device Not Available Exception");
   intr_register_int(11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int(12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int(13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -67,6 +79,12 @@ void exception_init(void) {
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int(14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+  /* The first FPU instruction after a context switch traps, so that
+     the FPU registers can be switched to the running thread's.  No
+     other thread may take the FPU in between. */
+  intr_register_int(7, 0, INTR_OFF, device_not_available,
+                    "#NM Device Not Available Exception");
 }
 
 /* Prints exception statistics. */
@@ -74,6 +92,28 @@ void exception_print_stats(void) {
   printf("Exception: %lld page faults\n", page_fault_cnt);
 }
 
+/* Handler for #DB.  A process that single-steps into SYSENTER
+   takes the trap on the first instruction of sysenter_entry(), in
+   kernel mode, so drop the trap flag and let the system call go
+   on.  Anything else is an ordinary exception. */
+static void debug_trap(struct intr_frame* f) {
+  if (f->cs == SEL_KCSEG && f->eip == sysenter_entry) {
+    f->eflags &= ~FLAG_TF;
+    return;
+  }
+  kill(f);
+}
+
+/* #NM handler: an FPU instruction with CR0.TS set.  Hands the FPU
+   to the running thread and retries the instruction, or kills the
+   process if the FPU cannot be used. */
+static void device_not_available(struct intr_frame* f) {
+  if (!fpu_activate()) {
+    intr_enable();
+    kill(f);
+  }
+}
+
 /* Handler for an exception (probably) caused by a user process. */
 static void kill(struct intr_frame* f) {
   /* This interrupt is one (probably) caused by a user process.
@@ -124,6 +164,37 @@ static void kill(struct intr_frame* f) {
    description of "Interrupt 14--Page Fault Exception (#PF)" in
    [IA32-v3a] section 5.15 "Exception and Interrupt Reference". */
 static void page_fault(struct intr_frame* f) {
+  uint64_t start = rdtsc();
+  struct rusage* usage = &thread_current()->rusage;
+  uint64_t reads = usage->block_reads;
+  enum bio_class old_class = block_set_class(BIO_FAULT);
+  handle_page_fault(f);
+  block_set_class(old_class);
+  vmstat_fault_done(start);
+  if (usage->block_reads != reads)
+    usage->major_faults++;
+  else
+    usage->minor_faults++;
+  TRACE(TRACE_FAULT_EXIT, f->eip);
+  // Killed while faulting: never run user code again.
+  if ((f->error_code & PF_U) && process_dying()) exit(-1);
+}
+
+/* Handles a fault that no page can satisfy by killing the process,
+   unless the kernel was probing user memory with get_user(), which
+   left the address to resume at in eax and sees -1 in it. */
+static void bad_access(struct intr_frame* f, bool user) {
+  if (!user && thread_current()->in_uaccess) {
+    f->eip = (void (*)(void))f->eax;
+    f->eax = 0xffffffff;
+    return;
+  }
+  exit(-1);
+}
+
+/* Does the work of page_fault().  Faults that kill the process do
+   not return, and so are not timed. */
+static void handle_page_fault(struct intr_frame* f) {
   bool not_present; /* True: not-present page, false: writing r/o page. */
   bool write;       /* True: access was write, false: access was read. */
   bool user;        /* True: access by user, false: access by kernel. */
@@ -137,6 +208,7 @@ static void page_fault(struct intr_frame* f) {
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
   asm("movl %%cr2, %0" : "=r"(fault_addr));
+  TRACE(TRACE_FAULT_ENTER, fault_addr);
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -150,258 +222,62 @@ static void page_fault(struct intr_frame* f) {
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
-
-  //  #ifdef USERPROG
-  //    printf("%s: exit(%d)\n", thread_name(),
-  //           thread_current()->exit_status);  // FIXME: pseudo-calling exit()
-  //  #endif
-  //    kill(f);
-
-  // #ifdef USERPROG
-  //  struct thread* cur = thread_current();
-  //  if (fault_addr == NULL || !is_user_vaddr(fault_addr)) exit(-1);
-  // #endif
-
   void* esp;
   if (user)
     esp = f->esp;
   else
     esp = thread_current()->esp;
 
-  // Case 0. Bad access -> just raise error.
+  // Bad access -> just raise error.
   if (fault_addr == NULL || !is_user_vaddr(fault_addr)) {
-    exit(-1);
+    bad_access(f, user);
+    return;
   }
 
-  // printf("Fault at %p, eip = %p, esp = %p\n", fault_addr, f->eip, f->esp);
-
-  ASSERT(is_user_vaddr(fault_addr));
+  bool locked = SPT_lock();
+  bool ok = resolve_fault(fault_addr, esp, write, not_present);
+  SPT_unlock(locked);
+  if (!ok) bad_access(f, user);
+}
 
+/* Maps in the page that the current process faulted on at FAULT_ADDR,
+   with ESP as its stack pointer, growing the stack if need be.
+   Returns false if the access was bad.  Call with the process's SPT
+   lock held. */
+static bool resolve_fault(void* fault_addr, void* esp, bool write,
+                          bool not_present) {
   void* fault_page_addr = pg_round_down(fault_addr);
-  // printf("Search for %p\n", fault_page_addr);
-  struct page* fault_page = SPT_search(thread_current(), fault_page_addr);
-
-  // Case 1. SPT does not exist
-  //  -> page fault is caused by stack growth attempt.
-  if (!fault_page) {
-    // 8MB stack size limit.
-    if (fault_addr <= PHYS_BASE - 0x800000) exit(-1);
-
-    if (fault_addr >= esp - 32) {
-      void* kpage = frame_alloc(PAL_USER | PAL_ZERO, false);
-      struct frame* f = find_frame(kpage);
-      f->is_evictable = true;
-      f->owner_thread = thread_current();
-
-      pagedir_set_page(thread_current()->pagedir, fault_page_addr, kpage, true);
-      SPT_insert(NULL, 0, fault_page_addr, kpage, 0, PGSIZE, true, FOR_STACK);
+  struct page* fault_page = SPT_lookup(fault_page_addr);
+
+  // Not in the SPT: only a stack growth attempt, within the stack size
+  // limit and not too far below ESP, is valid.
+  if (fault_page == NULL) {
+    if (fault_addr <= PHYS_BASE - SPT_stack_limit ||
+        fault_addr < esp - SPT_stack_slack)
+      return false;
+    fault_page = SPT_grow_stack(fault_page_addr, esp);
+    if (fault_page == NULL) return false;
+    if (fault_page->frame_addr != NULL) {
       thread_current()->esp = fault_addr;
-      return;
-    } else {
-      // printf("STACK GROWTH ERROR\n");
-      exit(-1);
+      return true;
     }
   }
 
-  // Case 2. SPT does exist
-  else {
-    // Reload load_segment's arguments
-    struct file* file = fault_page->page_file;
-    off_t ofs = fault_page->ofs;
-    uint8_t* upage = fault_page->page_addr;
-    size_t page_read_bytes = fault_page->read_bytes;
-    size_t page_zero_bytes = fault_page->zero_bytes;
-    bool writable = fault_page->is_writable;
-
-    // If this fault is caused by write, but the page is not writable,
-    // raise error!
-    if (write && !writable) {
-      // printf("WRITE PERM ERROR\n");
-      exit(-1);
-    }
-    switch (fault_page->purpose) {
-      case FOR_FILE:
-        if (!fault_page->is_swapped) {
-          // Repeat load_segment
-          file_seek(file, ofs);
-          uint8_t* kpage = frame_alloc(PAL_USER, true);
-
-          struct frame* f = find_frame(kpage);
-          f->page_addr = upage;
-          f->is_evictable = true;
-          f->owner_thread = thread_current();
-
-          fault_page->frame_addr = kpage;
-          fault_page->is_swapped = false;
-
-          off_t n = file_read(file, kpage, page_read_bytes);
-          if (n != (int)page_read_bytes) {
-            // printf("File read error\n");
-            frame_free(kpage);
-            exit(-1);
-          }
-          memset(kpage + page_read_bytes, 0, page_zero_bytes);
-
-          bool ok = pagedir_set_page(thread_current()->pagedir, upage, kpage,
-                                     writable);
-          if (!ok) {
-            printf("Failed!: pagedir_set_page in thread: %s\n", thread_name());
-          }
-
-          return;
-
-        } else {
-          // FIXME: Page is in the swap disk.
-          size_t swap_i = fault_page->swap_i;
-
-          // Repeat load_segment
-          file_seek(file, ofs);
-          uint8_t* kpage = frame_alloc(PAL_USER, true);
-          // if (!kpage) printf("Your frame_alloc is trash\n");
-          struct frame* f = find_frame(kpage);
-          f->page_addr = upage;
-          f->is_evictable = true;
-          f->owner_thread = thread_current();
-
-          fault_page->frame_addr = kpage;
-
-          // Read from corresponding disk file.
-          /*
-          printf(
-              "SPT_search hit: %p → frame_addr = %p, is_swapped = %d, swap_i = "
-              "%zu\n",
-              fault_page_addr, fault_page->frame_addr, fault_page->is_swapped,
-              fault_page->swap_i);
-              */
-
-          SD_read(swap_i, kpage);
-          fault_page->is_swapped = false;
-          // memset(kpage + page_read_bytes, 0, page_zero_bytes);
-          bool ok = pagedir_set_page(thread_current()->pagedir, upage, kpage,
-                                     writable);
-          if (!ok) {
-            printf("Failed!: pagedir_set_page in thread: %s\n", thread_name());
-          }
-          return;
-        }
-
-        break;
-
-      case FOR_STACK:
-        if (!fault_page->is_swapped) {
-          // This case should've covered by !fault_page check.
-          // I have no idea. Let's just pray.
-
-          // Allocate frame.
-          uint8_t* kpage = frame_alloc(PAL_USER, false);
-          fault_page->frame_addr = kpage;
-
-          // Setup stack.
-          pagedir_set_page(thread_current()->pagedir, upage, kpage, writable);
-          thread_current()->esp = fault_addr;
-          return;
-
-        } else {
-          // Page is in the swap disk.
-          size_t swap_i = fault_page->swap_i;
-
-          // Allocate frame
-          uint8_t* kpage = frame_alloc(PAL_USER, false);
-          struct frame* f = find_frame(kpage);
-          f->page_addr = upage;
-          f->is_evictable = true;
-          f->owner_thread = thread_current();
-
-          fault_page->frame_addr = kpage;
-          fault_page->is_swapped = false;
-
-          // Read from corresponding disk file.
-          // printf("Stack reading swap disk\n");
-          SD_read(swap_i, kpage);
-
-          pagedir_set_page(thread_current()->pagedir, upage, kpage, writable);
-          thread_current()->esp = fault_addr;
-          return;
-        }
-        break;
-
-      case FOR_MMAP:
-        /* TEMPORARILY COPIED FROM `FOR_FILE` */
-        if (!fault_page->is_swapped) {
-          // Repeat load_segment
-          file_seek(file, ofs);
-          uint8_t* kpage = frame_alloc(PAL_USER, true);
-
-          struct frame* f = find_frame(kpage);
-          f->page_addr = upage;
-          f->is_evictable = true;
-          f->owner_thread = thread_current();
-
-          fault_page->frame_addr = kpage;
-          fault_page->is_swapped = false;
-
-          off_t n = file_read(file, kpage, page_read_bytes);
-          if (n != (int)page_read_bytes) {
-            // printf("File read error\n");
-            frame_free(kpage);
-            exit(-1);
-          }
-          memset(kpage + page_read_bytes, 0, page_zero_bytes);
-
-          bool ok = pagedir_set_page(thread_current()->pagedir, upage, kpage,
-                                     writable);
-          if (!ok) {
-            printf("Failed!: pagedir_set_page in thread: %s\n", thread_name());
-          }
-
-          return;
-
-        } else {
-          // FIXME: Page is in the swap disk.
-          size_t swap_i = fault_page->swap_i;
-
-          // Repeat load_segment
-          file_seek(file, ofs);
-          uint8_t* kpage = frame_alloc(PAL_USER, true);
-          // if (!kpage) printf("Your frame_alloc is trash\n");
-          struct frame* f = find_frame(kpage);
-          f->page_addr = upage;
-          f->is_evictable = true;
-          f->owner_thread = thread_current();
-
-          fault_page->frame_addr = kpage;
-
-          // Read from corresponding disk file.
-          /*
-          printf(
-              "SPT_search hit: %p → frame_addr = %p, is_swapped = %d, swap_i = "
-              "%zu\n",
-              fault_page_addr, fault_page->frame_addr, fault_page->is_swapped,
-              fault_page->swap_i);
-              */
-
-          SD_read(swap_i, kpage);
-          fault_page->is_swapped = false;
-          // memset(kpage + page_read_bytes, 0, page_zero_bytes);
-          bool ok = pagedir_set_page(thread_current()->pagedir, upage, kpage,
-                                     writable);
-          if (!ok) {
-            printf("Failed!: pagedir_set_page in thread: %s\n", thread_name());
-          }
-          return;
-        }
-        break;
-
-      default:
-        printf("You reached the undefined purpose\n");
-        exit(-1);
-    }
+  // If this fault is caused by write, but the page is not writable,
+  // raise error!
+  if (write && !fault_page->is_writable) return false;
+  // Write to a page shared with a forked process: copy it now.
+  if (write && !not_present && fault_page->is_cow &&
+      frame_cow_break(fault_page))
+    return true;
+  if (fault_page->purpose == FOR_STACK) thread_current()->esp = fault_addr;
+  if (SPT_map_large(fault_page)) return true;
+
+  // Never-written zero page: map the shared zero page for reads, and
+  // give it a frame of its own on the first write.
+  if (fault_page->is_zero) {
+    SPT_map_zero(fault_page, write);
+    return true;
   }
-
-  printf("You reached the unreachable.\n");
-
-  exit(-1);
+  return SPT_fault_in(fault_page);
 }
@@ -0,0 +1,293 @@
+#include "userprog/fdtable.h"
+
+#include <bitmap.h>
+#include <debug.h>
+#include <string.h>
+
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "userprog/pipe.h"
+
+// Slots in a table's first allocation.
+#define FD_INITIAL_CAP 32
+
+void fd_table_init(struct fd_table* ft) {
+  lock_init(&ft->lock);
+  ft->slots = NULL;
+  ft->used = NULL;
+  ft->cap = 0;
+}
+
+/* Close whatever slot S has open and empty it */
+static void slot_close(struct fd_slot* s) {
+  if (s->pipe != NULL)
+    pipe_close(s->pipe, s->pipe_writer);
+  else if (s->dir != NULL)
+    dir_close(s->dir);
+  else if (s->file != NULL)
+    file_close(s->file);
+  s->file = NULL;
+  s->pipe = NULL;
+  s->dir = NULL;
+}
+
+/* Return whether slot S has anything open */
+static bool slot_open(const struct fd_slot* s) {
+  return s->file != NULL || s->pipe != NULL || s->dir != NULL;
+}
+
+/* Return the slot of FD in FT if it is open and not being closed, or
+   NULL.  Call with FT's lock held */
+static struct fd_slot* slot_find(struct fd_table* ft, int fd) {
+  struct fd_slot* s;
+
+  if (fd < FD_FIRST || (size_t)fd >= ft->cap) return NULL;
+  s = &ft->slots[fd];
+  return slot_open(s) && !s->closing ? s : NULL;
+}
+
+/* Empty FT's slot FD and free the descriptor, returning what it had
+   open for the caller to close once FT's lock is released, since
+   closing may block.  Call with the lock held */
+static struct fd_slot slot_take(struct fd_table* ft, int fd) {
+  struct fd_slot s = ft->slots[fd];
+
+  memset(&ft->slots[fd], 0, sizeof ft->slots[fd]);
+  bitmap_reset(ft->used, fd);
+  return s;
+}
+
+/* Close every file, directory and pipe left in FT and free its arrays.
+   No thread may be using FT any more */
+void fd_table_destroy(struct fd_table* ft) {
+  size_t fd;
+
+  for (fd = FD_FIRST; fd < ft->cap; fd++) slot_close(&ft->slots[fd]);
+  free(ft->slots);
+  if (ft->used != NULL) bitmap_destroy(ft->used);
+  fd_table_init(ft);
+}
+
+/* Double FT's capacity, up to FD_MAX slots.  Returns false if it is
+   that big already or memory is short */
+static bool grow(struct fd_table* ft) {
+  size_t cap = ft->cap ? ft->cap * 2 : FD_INITIAL_CAP;
+  struct fd_slot* slots;
+  struct bitmap* used;
+  size_t fd;
+
+  if (cap > FD_MAX) cap = FD_MAX;
+  if (cap <= ft->cap) return false;
+
+  used = bitmap_create(cap);
+  if (used == NULL) return false;
+  slots = realloc(ft->slots, cap * sizeof *slots);
+  if (slots == NULL) {
+    bitmap_destroy(used);
+    return false;
+  }
+  memset(slots + ft->cap, 0, (cap - ft->cap) * sizeof *slots);
+
+  // The console descriptors are never free.
+  bitmap_set_multiple(used, 0, FD_FIRST, true);
+  for (fd = FD_FIRST; fd < ft->cap; fd++)
+    if (slot_open(&slots[fd])) bitmap_mark(used, fd);
+  if (ft->used != NULL) bitmap_destroy(ft->used);
+
+  ft->slots = slots;
+  ft->used = used;
+  ft->cap = cap;
+  return true;
+}
+
+/* Take the lowest free descriptor in FT and return its slot, or NULL
+   if there is no room */
+static struct fd_slot* slot_alloc(struct fd_table* ft, int* fdp) {
+  size_t fd = BITMAP_ERROR;
+
+  if (ft->used != NULL) fd = bitmap_scan_and_flip(ft->used, FD_FIRST, 1, false);
+  if (fd == BITMAP_ERROR) {
+    // Every slot is taken, so the first new one is the lowest free.
+    fd = ft->cap > FD_FIRST ? ft->cap : FD_FIRST;
+    if (!grow(ft)) return NULL;
+    bitmap_mark(ft->used, fd);
+  }
+  *fdp = fd;
+  return &ft->slots[fd];
+}
+
+/* Put FILE in FT under the lowest free descriptor and return it, or
+   -1 if there is no room */
+int fd_table_insert(struct fd_table* ft, struct file* file) {
+  struct fd_slot* s;
+  int fd;
+
+  ASSERT(file != NULL);
+  lock_acquire(&ft->lock);
+  s = slot_alloc(ft, &fd);
+  if (s != NULL) s->file = file;
+  lock_release(&ft->lock);
+  return s != NULL ? fd : -1;
+}
+
+/* Put PIPE's write end if WRITER, or else its read end, in FT under
+   the lowest free descriptor and return it, or -1 if there is no
+   room */
+int fd_table_insert_pipe(struct fd_table* ft, struct pipe* pipe, bool writer) {
+  struct fd_slot* s;
+  int fd;
+
+  ASSERT(pipe != NULL);
+  lock_acquire(&ft->lock);
+  s = slot_alloc(ft, &fd);
+  if (s != NULL) {
+    s->pipe = pipe;
+    s->pipe_writer = writer;
+  }
+  lock_release(&ft->lock);
+  return s != NULL ? fd : -1;
+}
+
+/* Put DIR in FT under the lowest free descriptor and return it, or
+   -1 if there is no room */
+int fd_table_insert_dir(struct fd_table* ft, struct dir* dir) {
+  struct fd_slot* s;
+  int fd;
+
+  ASSERT(dir != NULL);
+  lock_acquire(&ft->lock);
+  s = slot_alloc(ft, &fd);
+  if (s != NULL) s->dir = dir;
+  lock_release(&ft->lock);
+  return s != NULL ? fd : -1;
+}
+
+/* Return the file open as FD in FT, taking a use of FD, or NULL if
+   FD is not open or is a pipe or directory */
+struct file* fd_table_get(struct fd_table* ft, int fd) {
+  struct fd_slot* s;
+  struct file* file = NULL;
+
+  lock_acquire(&ft->lock);
+  s = slot_find(ft, fd);
+  if (s != NULL && s->file != NULL) {
+    s->users++;
+    file = s->file;
+  }
+  lock_release(&ft->lock);
+  return file;
+}
+
+/* Return the pipe open as FD in FT, taking a use of FD, and set
+   *WRITER to whether FD is its write end, or return NULL if FD is
+   not a pipe */
+struct pipe* fd_table_get_pipe(struct fd_table* ft, int fd, bool* writer) {
+  struct fd_slot* s;
+  struct pipe* pipe = NULL;
+
+  lock_acquire(&ft->lock);
+  s = slot_find(ft, fd);
+  if (s != NULL && s->pipe != NULL) {
+    s->users++;
+    *writer = s->pipe_writer;
+    pipe = s->pipe;
+  }
+  lock_release(&ft->lock);
+  return pipe;
+}
+
+/* Return the directory open as FD in FT, taking a use of FD, or NULL
+   if FD is not a directory */
+struct dir* fd_table_get_dir(struct fd_table* ft, int fd) {
+  struct fd_slot* s;
+  struct dir* dir = NULL;
+
+  lock_acquire(&ft->lock);
+  s = slot_find(ft, fd);
+  if (s != NULL && s->dir != NULL) {
+    s->users++;
+    dir = s->dir;
+  }
+  lock_release(&ft->lock);
+  return dir;
+}
+
+/* Give back a use of FD in FT taken by fd_table_get*(), closing FD if
+   it was closed meanwhile and this was the last use */
+void fd_table_put(struct fd_table* ft, int fd) {
+  struct fd_slot* s;
+  struct fd_slot closed;
+  bool last;
+
+  lock_acquire(&ft->lock);
+  s = &ft->slots[fd];
+  ASSERT(s->users > 0);
+  last = --s->users == 0 && s->closing;
+  if (last) closed = slot_take(ft, fd);
+  lock_release(&ft->lock);
+  if (last) slot_close(&closed);
+}
+
+/* Close the file, directory or pipe open as FD in FT, or have its
+   last user close it if it is in use.  Returns false if FD was not
+   open */
+bool fd_table_close(struct fd_table* ft, int fd) {
+  struct fd_slot* s;
+  struct fd_slot closed;
+  bool now = false;
+
+  lock_acquire(&ft->lock);
+  s = slot_find(ft, fd);
+  if (s != NULL && s->users > 0)
+    s->closing = true;
+  else if (s != NULL) {
+    closed = slot_take(ft, fd);
+    now = true;
+  }
+  lock_release(&ft->lock);
+  if (now) slot_close(&closed);
+  return s != NULL;
+}
+
+/* Fill empty table DST with a copy of every file, directory and pipe
+   open in SRC, under the same descriptor, for fork().  Files and
+   directories are reopened at the same position; pipes are shared.
+   Returns false if memory is short; DST holds what was copied so far */
+bool fd_table_copy(struct fd_table* dst, struct fd_table* src) {
+  size_t fd;
+
+  ASSERT(dst->cap == 0);
+  lock_acquire(&src->lock);
+  while (dst->cap < src->cap)
+    if (!grow(dst)) goto fail;
+  for (fd = FD_FIRST; fd < src->cap; fd++) {
+    struct fd_slot* s = slot_find(src, fd);
+    struct file* file;
+
+    if (s == NULL) {
+      continue;
+    } else if (s->pipe != NULL) {
+      pipe_dup(s->pipe, s->pipe_writer);
+      dst->slots[fd].pipe = s->pipe;
+      dst->slots[fd].pipe_writer = s->pipe_writer;
+    } else if (s->dir != NULL) {
+      struct dir* dir = dir_reopen(s->dir);
+      if (dir == NULL) goto fail;
+      dir_seek(dir, dir_tell(s->dir));
+      dst->slots[fd].dir = dir;
+    } else {
+      file = file_reopen(s->file);
+      if (file == NULL) goto fail;
+      file_seek(file, file_tell(s->file));
+      dst->slots[fd].file = file;
+    }
+    bitmap_mark(dst->used, fd);
+  }
+  lock_release(&src->lock);
+  return true;
+
+fail:
+  lock_release(&src->lock);
+  return false;
+}
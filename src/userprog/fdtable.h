@@ -0,0 +1,63 @@
+#ifndef USERPROG_FDTABLE_H
+#define USERPROG_FDTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "threads/synch.h"
+
+struct file;
+struct bitmap;
+struct pipe;
+struct dir;
+
+// Descriptors 0 and 1 are the console and never have a file.
+#define FD_FIRST 2
+
+// Descriptors are below this.  The table grows as needed up to here,
+// so a descriptor out of range is a bad one, not just one that isn't
+// open.
+#define FD_MAX 4096
+
+// What a descriptor has open: a file, a directory, or one end of a
+// pipe.
+struct fd_slot {
+  struct file* file;
+  struct pipe* pipe;
+  bool pipe_writer;  // PIPE's write end, not its read end.
+  struct dir* dir;
+  int users;     // Lookups not yet given back by fd_table_put().
+  bool closing;  // Closed while in use: the last user closes it.
+};
+
+// A process's open files and pipes, indexed by descriptor.  USED
+// tracks which slots are taken, so open() finds the lowest free
+// descriptor by scanning a bitmap a word at a time.  Both grow by
+// doubling and start out empty, so a thread pays nothing until it
+// opens a file.
+//
+// The threads of a process share its table, so LOCK guards it, and
+// each fd_table_get*() that finds something takes a use of its slot
+// that the caller gives back with fd_table_put() once done with it.
+// Closing a descriptor that is in use only marks it: the last user
+// closes it, and until then the descriptor is neither open nor free.
+struct fd_table {
+  struct lock lock;
+  struct fd_slot* slots;
+  struct bitmap* used;
+  size_t cap;  // Slots in SLOTS and USED.
+};
+
+void fd_table_init(struct fd_table* ft);
+void fd_table_destroy(struct fd_table* ft);
+int fd_table_insert(struct fd_table* ft, struct file* file);
+struct file* fd_table_get(struct fd_table* ft, int fd);
+bool fd_table_copy(struct fd_table* dst, struct fd_table* src);
+int fd_table_insert_pipe(struct fd_table* ft, struct pipe* pipe, bool writer);
+struct pipe* fd_table_get_pipe(struct fd_table* ft, int fd, bool* writer);
+int fd_table_insert_dir(struct fd_table* ft, struct dir* dir);
+struct dir* fd_table_get_dir(struct fd_table* ft, int fd);
+void fd_table_put(struct fd_table* ft, int fd);
+bool fd_table_close(struct fd_table* ft, int fd);
+
+#endif /* userprog/fdtable.h */
@@ -0,0 +1,137 @@
+#include "userprog/futex.h"
+
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+
+// Futexes.  A user lock word only needs the kernel when a thread has
+// to sleep on it or wake a sleeper; the uncontended path is a plain
+// atomic instruction in user space.  Sleepers are keyed by the kernel
+// address of the word's frame, i.e. by physical memory, so processes
+// that share the frame share the futex whatever their user addresses.
+// The word's page stays pinned while its caller is in here, which
+// keeps that key valid for as long as anyone sleeps on it.
+
+// Buckets in the wait queue hash.  Each has its own lock, so
+// unrelated futexes rarely contend.
+#define FUTEX_BUCKETS 64
+
+// A thread sleeping in futex_wait().  Lives on its stack.
+struct futex_waiter {
+  struct list_elem elem;
+  const void* key;  // Kernel address of the futex word.
+  struct thread* proc;  // Process it sleeps in.
+  struct semaphore wake;
+};
+
+struct futex_bucket {
+  struct lock lock;
+  struct list waiters;  // struct futex_waiter, oldest first.
+};
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+void futex_init(void) {
+  int i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++) {
+    lock_init(&buckets[i].lock);
+    list_init(&buckets[i].waiters);
+  }
+}
+
+/* Pin the futex word at UADDR and return its kernel address, or kill
+   the process if it is misaligned or not mapped */
+static int* futex_pin(int* uaddr) {
+  if ((uintptr_t)uaddr % sizeof *uaddr != 0 ||
+      !validate_user_range(uaddr, sizeof *uaddr, false) ||
+      !frame_pin_range(uaddr, sizeof *uaddr, false))
+    exit(-1);
+  return pagedir_get_page(process_current()->pagedir, uaddr);
+}
+
+static struct futex_bucket* bucket_of(const void* key) {
+  return &buckets[hash_bytes(&key, sizeof key) % FUTEX_BUCKETS];
+}
+
+/* Sleep until woken by futex_wake() on the same word, if the word at
+   UADDR still holds EXPECTED.  Returns 0 once woken, or -1 at once if
+   the word had changed */
+int futex_wait(int* uaddr, int expected) {
+  int* kaddr = futex_pin(uaddr);
+  struct futex_bucket* b = bucket_of(kaddr);
+  struct futex_waiter w;
+  int ret = -1;
+
+  // A waker changes the word before taking the bucket lock, so
+  // checking it under the lock cannot miss a wakeup, and likewise
+  // futex_wake_proc() sets exiting first.
+  lock_acquire(&b->lock);
+  if (*kaddr == expected && !process_current()->exiting) {
+    w.key = kaddr;
+    w.proc = process_current();
+    sema_init(&w.wake, 0);
+    list_push_back(&b->waiters, &w.elem);
+    ret = 0;
+  }
+  lock_release(&b->lock);
+
+  if (ret == 0) sema_down(&w.wake);
+  frame_unpin_range(uaddr, sizeof *uaddr);
+  return ret;
+}
+
+/* Wake up to N threads sleeping on the word at UADDR, oldest first.
+   Returns how many were woken */
+int futex_wake(int* uaddr, int n) {
+  int* kaddr = futex_pin(uaddr);
+  struct futex_bucket* b = bucket_of(kaddr);
+  struct list_elem* e;
+  int woken = 0;
+
+  lock_acquire(&b->lock);
+  for (e = list_begin(&b->waiters); e != list_end(&b->waiters) && woken < n;) {
+    struct futex_waiter* w = list_entry(e, struct futex_waiter, elem);
+    e = list_next(e);
+    if (w->key == kaddr) {
+      list_remove(&w->elem);
+      sema_up(&w->wake);
+      woken++;
+    }
+  }
+  lock_release(&b->lock);
+
+  frame_unpin_range(uaddr, sizeof *uaddr);
+  return woken;
+}
+
+/* Wake every thread of PROC sleeping in futex_wait(), whatever the
+   word, once PROC's exiting flag is set so that none goes back to
+   sleep */
+void futex_wake_proc(struct thread* proc) {
+  int i;
+
+  ASSERT(proc->exiting);
+  for (i = 0; i < FUTEX_BUCKETS; i++) {
+    struct futex_bucket* b = &buckets[i];
+    struct list_elem* e;
+
+    lock_acquire(&b->lock);
+    for (e = list_begin(&b->waiters); e != list_end(&b->waiters);) {
+      struct futex_waiter* w = list_entry(e, struct futex_waiter, elem);
+      e = list_next(e);
+      if (w->proc == proc) {
+        list_remove(&w->elem);
+        sema_up(&w->wake);
+      }
+    }
+    lock_release(&b->lock);
+  }
+}
@@ -5,40 +5,87 @@
 #include <string.h>
 
 #include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 
+/* Number of PDEs that map user virtual memory. */
+#define USER_PDES (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* How a page directory uses its user page tables, kept in the page
+   after the directory itself: which PDEs point to a page table, and
+   how many PTEs in each table are in use.  A PTE is in use while it
+   is present or dirty, because its dirty bit outlives the mapping
+   until eviction or munmap has dealt with the page.
+
+   Tables that fall out of use are freed by unmapping paths that
+   leave them so: pagedir_clear_page_batch() and clearing a dirty
+   bit.  pagedir_clear_page() keeps the table, since its callers
+   mostly map the page again at once.
+
+   Interrupts are off while a PTE is looked up and used, so that
+   another thread cannot free its table in between on this single
+   CPU. */
+struct pt_usage {
+  uint32_t tables[USER_PDES / 32]; /* Bitmap of PDEs with a table. */
+  uint16_t used[USER_PDES];        /* PTEs in use in each table. */
+};
+
+/* Returns the page table usage of PD. */
+static inline struct pt_usage *pt_usage(uint32_t *pd) {
+  return (struct pt_usage *)(pd + PGSIZE / sizeof *pd);
+}
+
+/* Returns true if PTE counts as in use. */
+static inline bool pte_in_use(uint32_t pte) {
+  return (pte & (PTE_P | PTE_D)) != 0;
+}
+
 static uint32_t *active_pd(void);
 static void invalidate_pagedir(uint32_t *);
+static void invalidate_page(uint32_t *, const void *);
+static uint32_t *large_pde(uint32_t *pd, const void *vaddr);
+static uint32_t pte_bits(uint32_t *pd, const void *vaddr);
+static bool split_large_page(uint32_t *pd, uint32_t *pde);
+static void add_table(uint32_t *pd, size_t pde_idx, uint32_t *pt);
+static uint32_t *remove_table(uint32_t *pd, size_t pde_idx);
+static uint32_t *set_pte(uint32_t *pd, uint32_t *pte, const void *vaddr,
+                         uint32_t new, bool reclaim);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
    Returns the new page directory, or a null pointer if memory
    allocation fails. */
 uint32_t *pagedir_create(void) {
-  uint32_t *pd = palloc_get_page(0);
-  if (pd != NULL) memcpy(pd, init_page_dir, PGSIZE);
+  uint32_t *pd = palloc_get_multiple(0, 2);
+  if (pd != NULL) {
+    memcpy(pd, init_page_dir, PGSIZE);
+    memset(pt_usage(pd), 0, sizeof(struct pt_usage));
+  }
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD and its page tables.  The frames it
+   maps belong to the frame table, which releases them itself, so
+   PD may still map frames that are already free. */
 void pagedir_destroy(uint32_t *pd) {
-  uint32_t *pde;
+  struct pt_usage *u;
+  size_t i;
 
   if (pd == NULL) return;
 
   ASSERT(pd != init_page_dir);
-  for (pde = pd; pde < pd + pd_no(PHYS_BASE); pde++)
-    if (*pde & PTE_P) {
-      uint32_t *pt = pde_get_pt(*pde);
-      uint32_t *pte;
-
-      for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-        if (*pte & PTE_P) palloc_free_page(pte_get_page(*pte));
-      palloc_free_page(pt);
+  u = pt_usage(pd);
+  for (i = 0; i < USER_PDES / 32; i++) {
+    uint32_t bits = u->tables[i];
+    while (bits != 0) {
+      size_t pde_idx = i * 32 + __builtin_ctz(bits);
+      palloc_free_page(pde_get_pt(pd[pde_idx]));
+      bits &= bits - 1;
     }
-  palloc_free_page(pd);
+  }
+  palloc_free_multiple(pd, 2);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -46,11 +93,15 @@ void pagedir_destroy(uint32_t *pd) {
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   A 4 MB page that covers VADDR is first split into a page table
+   of equivalent PTEs; a null pointer is returned if that fails.
+   Must be called with interrupts off. */
 static uint32_t *lookup_page(uint32_t *pd, const void *vaddr, bool create) {
   uint32_t *pt, *pde;
 
   ASSERT(pd != NULL);
+  ASSERT(intr_get_level() == INTR_OFF);
 
   /* Shouldn't create new kernel virtual mappings. */
   ASSERT(!create || is_user_vaddr(vaddr));
@@ -63,10 +114,11 @@ static uint32_t *lookup_page(uint32_t *pd, const void *vaddr, bool create) {
       pt = palloc_get_page(PAL_ZERO);
       if (pt == NULL) return NULL;
 
-      *pde = pde_create(pt);
+      add_table(pd, pd_no(vaddr), pt);
     } else
       return NULL;
   }
+  if ((*pde & PTE_PS) && !split_large_page(pd, pde)) return NULL;
 
   /* Return the page table entry. */
   pt = pde_get_pt(*pde);
@@ -92,14 +144,103 @@ bool pagedir_set_page(uint32_t *pd, void *upage, void *kpage, bool writable) {
   ASSERT(vtop(kpage) >> PTSHIFT < init_ram_pages);
   ASSERT(pd != init_page_dir);
 
+  enum intr_level old_level = intr_disable();
   pte = lookup_page(pd, upage, true);
-
   if (pte != NULL) {
     ASSERT((*pte & PTE_P) == 0);
-    *pte = pte_create_user(kpage, writable);
-    return true;
-  } else
-    return false;
+    set_pte(pd, pte, upage, pte_create_user(kpage, writable), false);
+  }
+  intr_set_level(old_level);
+  return pte != NULL;
+}
+
+/* Returns how many of the CNT pages from VADDR on lie in the same
+   4 MB span as VADDR, that is, under the same PDE. */
+static size_t span_pages(const void *vaddr, size_t cnt) {
+  size_t left = (PTSPAN - ((uintptr_t)vaddr & (PTSPAN - 1))) / PGSIZE;
+  return cnt < left ? cnt : left;
+}
+
+/* Like pagedir_set_page() for the CNT consecutive pages from
+   UPAGE, mapping the Ith of them to KPAGES[I].  A null KPAGES[I]
+   leaves that page alone.  Each page table is looked up, or
+   created, once for the whole 4 MB it covers.  Returns the number
+   of pages the range was mapped up to: CNT, or less if a page
+   table could not be allocated, in which case the pages from there
+   on are not mapped. */
+size_t pagedir_set_range(uint32_t *pd, void *upage, void *const *kpages,
+                         size_t cnt, bool writable) {
+  uint8_t *va = upage;
+  size_t done = 0;
+
+  ASSERT(pg_ofs(upage) == 0);
+  ASSERT(cnt <= (size_t)((uint8_t *)PHYS_BASE - va) / PGSIZE);
+  ASSERT(pd != init_page_dir);
+
+  while (done < cnt) {
+    size_t n = span_pages(va, cnt - done), i;
+    uint32_t *pte;
+    enum intr_level old_level = intr_disable();
+
+    pte = lookup_page(pd, va, true);
+    if (pte == NULL) {
+      intr_set_level(old_level);
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      void *kpage = kpages[done + i];
+      if (kpage == NULL) continue;
+      ASSERT(pg_ofs(kpage) == 0);
+      ASSERT(vtop(kpage) >> PTSHIFT < init_ram_pages);
+      ASSERT((pte[i] & PTE_P) == 0);
+      set_pte(pd, pte + i, va, pte_create_user(kpage, writable), false);
+    }
+    intr_set_level(old_level);
+    va += n * PGSIZE;
+    done += n;
+  }
+  return done;
+}
+
+/* Maps the 4 MB of user virtual memory at UPAGE to the physically
+   contiguous frames at KPAGE with a single large-page PDE.  Both
+   must be 4 MB aligned, and none of the pages at UPAGE may be
+   mapped.  Returns false if the CPU lacks large pages or the range
+   is in use. */
+bool pagedir_set_large_page(uint32_t *pd, void *upage, void *kpage,
+                            bool writable) {
+  uint32_t *pde = pd + pd_no(upage);
+  uint32_t *pt = NULL;
+  uint32_t cr4;
+  enum intr_level old_level;
+
+  ASSERT((uintptr_t)upage % PTSPAN == 0);
+  ASSERT((uintptr_t)kpage % PTSPAN == 0);
+  ASSERT(is_user_vaddr((uint8_t *)upage + PTSPAN - 1));
+  ASSERT(pd != init_page_dir);
+
+  asm volatile("movl %%cr4, %0" : "=r"(cr4));
+  if (!(cr4 & CR4_PSE)) return false;
+
+  old_level = intr_disable();
+  if (*pde != 0) {
+    uint32_t *pte;
+
+    if (*pde & PTE_PS) goto fail;
+    pt = pde_get_pt(*pde);
+    for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+      if (*pte & PTE_P) goto fail;
+    remove_table(pd, pd_no(upage));
+  }
+  *pde = vtop(kpage) | PTE_PS | PTE_U | PTE_P | (writable ? PTE_W : 0);
+  invalidate_pagedir(pd);
+  intr_set_level(old_level);
+  palloc_free_page(pt);
+  return true;
+
+fail:
+  intr_set_level(old_level);
+  return false;
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -108,14 +249,22 @@ bool pagedir_set_page(uint32_t *pd, void *upage, void *kpage, bool writable) {
    UADDR is unmapped. */
 void *pagedir_get_page(uint32_t *pd, const void *uaddr) {
   uint32_t *pte;
+  void *kaddr = NULL;
 
   ASSERT(is_user_vaddr(uaddr));
 
-  pte = lookup_page(pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page(*pte) + pg_ofs(uaddr);
-  else
-    return NULL;
+  enum intr_level old_level = intr_disable();
+  uint32_t *pde = large_pde(pd, uaddr);
+  if (pde != NULL)
+    kaddr = ptov(*pde & ~(uint32_t)(PTSPAN - 1)) +
+            ((uintptr_t)uaddr & (PTSPAN - 1));
+  else {
+    pte = lookup_page(pd, uaddr, false);
+    if (pte != NULL && (*pte & PTE_P) != 0)
+      kaddr = pte_get_page(*pte) + pg_ofs(uaddr);
+  }
+  intr_set_level(old_level);
+  return kaddr;
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -128,11 +277,109 @@ void pagedir_clear_page(uint32_t *pd, void *upage) {
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(is_user_vaddr(upage));
 
+  enum intr_level old_level = intr_disable();
   pte = lookup_page(pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0) {
+    set_pte(pd, pte, upage, *pte & ~PTE_P, false);
+    invalidate_page(pd, upage);
+  } else if (pte == NULL && (pte = large_pde(pd, upage)) != NULL) {
+    /* Could not split the large page: unmap all of it. */
     *pte &= ~PTE_P;
-    invalidate_pagedir(pd);
+    invalidate_page(pd, upage);
   }
+  intr_set_level(old_level);
+}
+
+/* Marks the CNT consecutive pages from UPAGE "not present" in PD,
+   like pagedir_clear_page_batch() on each, but walking each page
+   table once for the 4 MB it covers.  Page tables left with no PTE
+   in use are freed.  The TLB is invalidated once, at the end. */
+void pagedir_clear_range(uint32_t *pd, void *upage, size_t cnt) {
+  struct pagedir_batch b;
+  uint8_t *va = upage;
+  size_t done = 0;
+
+  ASSERT(pg_ofs(upage) == 0);
+  ASSERT(cnt <= (size_t)((uint8_t *)PHYS_BASE - va) / PGSIZE);
+
+  pagedir_batch_init(&b);
+  while (done < cnt) {
+    size_t n = span_pages(va, cnt - done), i;
+    uint32_t *pte, *pt = NULL, *pde = pd + pd_no(va);
+    bool active = active_pd() == pd;
+    enum intr_level old_level = intr_disable();
+
+    /* A large page the range covers whole goes in one step; one
+       it only partly covers is split by lookup_page(). */
+    if (n == PTSPAN / PGSIZE && large_pde(pd, va) != NULL) {
+      *pde &= ~PTE_P;
+      b.cnt = PAGEDIR_BATCH_PAGES + 1;
+    } else if ((pte = lookup_page(pd, va, false)) != NULL) {
+      for (i = 0; i < n && pt == NULL; i++) {
+        if ((pte[i] & PTE_P) == 0) continue;
+        pt = set_pte(pd, pte + i, va + i * PGSIZE, pte[i] & ~PTE_P, true);
+        if (active && b.cnt < PAGEDIR_BATCH_PAGES)
+          b.pages[b.cnt] = va + i * PGSIZE;
+        b.cnt++;
+      }
+    } else if (large_pde(pd, va) != NULL) {
+      /* Could not split the large page: unmap all of it. */
+      *pde &= ~PTE_P;
+      b.cnt = PAGEDIR_BATCH_PAGES + 1;
+    }
+    intr_set_level(old_level);
+    palloc_free_page(pt);
+    va += n * PGSIZE;
+    done += n;
+  }
+  if (active_pd() == pd) pagedir_batch_flush(&b);
+}
+
+/* Starts an empty batch of TLB invalidations. */
+void pagedir_batch_init(struct pagedir_batch *b) { b->cnt = 0; }
+
+/* Like pagedir_clear_page(), but if PD is active, only records
+   UPAGE in B instead of invalidating its TLB entry right away.
+   The caller must call pagedir_batch_flush() before the frame
+   that was mapped at UPAGE may be reused.
+   For pages that are being evicted or unmapped: frees the page
+   table if this leaves none of its PTEs in use. */
+void pagedir_clear_page_batch(uint32_t *pd, void *upage,
+                              struct pagedir_batch *b) {
+  uint32_t *pte, *pt = NULL;
+
+  ASSERT(pg_ofs(upage) == 0);
+  ASSERT(is_user_vaddr(upage));
+
+  enum intr_level old_level = intr_disable();
+  pte = lookup_page(pd, upage, false);
+  if (pte == NULL || (*pte & PTE_P) == 0) {
+    intr_set_level(old_level);
+    pagedir_clear_page(pd, upage);
+    return;
+  }
+  pt = set_pte(pd, pte, upage, *pte & ~PTE_P, true);
+
+  /* If it took out PT, remove_table() flushed the whole TLB. */
+  if (pt == NULL && active_pd() == pd) {
+    if (b->cnt < PAGEDIR_BATCH_PAGES) b->pages[b->cnt] = upage;
+    b->cnt++;
+  }
+  intr_set_level(old_level);
+  palloc_free_page(pt);
+}
+
+/* Invalidates the TLB entries recorded in B, one page at a time,
+   or all at once if B overflowed, and empties B. */
+void pagedir_batch_flush(struct pagedir_batch *b) {
+  size_t i;
+
+  if (b->cnt > PAGEDIR_BATCH_PAGES)
+    pagedir_activate(active_pd());
+  else
+    for (i = 0; i < b->cnt; i++)
+      asm volatile("invlpg (%0)" : : "r"(b->pages[i]) : "memory");
+  b->cnt = 0;
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
@@ -140,22 +387,62 @@ void pagedir_clear_page(uint32_t *pd, void *upage) {
    installed.
    Returns false if PD contains no PTE for VPAGE. */
 bool pagedir_is_dirty(uint32_t *pd, const void *vpage) {
-  uint32_t *pte = lookup_page(pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return (pte_bits(pd, vpage) & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD.  Clearing the dirty bit of a page that is no longer
+   mapped frees its page table if no other PTE in it is in use. */
 void pagedir_set_dirty(uint32_t *pd, const void *vpage, bool dirty) {
+  uint32_t *pt = NULL;
+  enum intr_level old_level = intr_disable();
   uint32_t *pte = lookup_page(pd, vpage, false);
   if (pte != NULL) {
     if (dirty)
-      *pte |= PTE_D;
+      set_pte(pd, pte, vpage, *pte | PTE_D, false);
     else {
-      *pte &= ~(uint32_t)PTE_D;
-      invalidate_pagedir(pd);
+      bool present = (*pte & PTE_P) != 0;
+      pt = set_pte(pd, pte, vpage, *pte & ~(uint32_t)PTE_D, true);
+      if (pt == NULL && present) invalidate_page(pd, vpage);
     }
   }
+  intr_set_level(old_level);
+  palloc_free_page(pt);
+}
+
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Accessed and dirty bits are kept. */
+void pagedir_set_writable(uint32_t *pd, const void *vpage, bool writable) {
+  enum intr_level old_level = intr_disable();
+  uint32_t *pte = lookup_page(pd, vpage, false);
+  if (pte != NULL) {
+    if (writable)
+      *pte |= PTE_W;
+    else {
+      *pte &= ~(uint32_t)PTE_W;
+      invalidate_page(pd, vpage);
+    }
+  }
+  intr_set_level(old_level);
+}
+
+/* Points the present PTE for virtual page VPAGE in PD at KPAGE,
+   which must hold a copy of the page, keeping its writable,
+   accessed and dirty bits.  Returns false if VPAGE is not
+   mapped. */
+bool pagedir_move_page(uint32_t *pd, const void *vpage, void *kpage) {
+  ASSERT(pg_ofs(kpage) == 0);
+  ASSERT(vtop(kpage) >> PTSHIFT < init_ram_pages);
+
+  enum intr_level old_level = intr_disable();
+  uint32_t *pte = lookup_page(pd, vpage, false);
+  bool moved = pte != NULL && (*pte & PTE_P) != 0;
+  if (moved) {
+    *pte = vtop(kpage) | (*pte & PTE_FLAGS);
+    invalidate_page(pd, vpage);
+  }
+  intr_set_level(old_level);
+  return moved;
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD has been
@@ -163,22 +450,23 @@ void pagedir_set_dirty(uint32_t *pd, const void *vpage, bool dirty) {
    installed and the last time it was cleared.  Returns false if
    PD contains no PTE for VPAGE. */
 bool pagedir_is_accessed(uint32_t *pd, const void *vpage) {
-  uint32_t *pte = lookup_page(pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return (pte_bits(pd, vpage) & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
    VPAGE in PD. */
 void pagedir_set_accessed(uint32_t *pd, const void *vpage, bool accessed) {
+  enum intr_level old_level = intr_disable();
   uint32_t *pte = lookup_page(pd, vpage, false);
   if (pte != NULL) {
     if (accessed)
       *pte |= PTE_A;
     else {
       *pte &= ~(uint32_t)PTE_A;
-      invalidate_pagedir(pd);
+      invalidate_page(pd, vpage);
     }
   }
+  intr_set_level(old_level);
 }
 
 /* Loads page directory PD into the CPU's page directory base
@@ -205,6 +493,87 @@ static uint32_t *active_pd(void) {
   return ptov(pd);
 }
 
+/* Returns the PDE in PD if it maps VADDR with a 4 MB page, or a
+   null pointer otherwise. */
+static uint32_t *large_pde(uint32_t *pd, const void *vaddr) {
+  uint32_t *pde = pd + pd_no(vaddr);
+  return (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS) ? pde : NULL;
+}
+
+/* Returns the PTE, or large-page PDE, that maps VADDR in PD, or 0
+   if there is none. */
+static uint32_t pte_bits(uint32_t *pd, const void *vaddr) {
+  uint32_t bits = 0;
+  enum intr_level old_level = intr_disable();
+  uint32_t *pte = large_pde(pd, vaddr);
+  if (pte == NULL) pte = lookup_page(pd, vaddr, false);
+  if (pte != NULL) bits = *pte;
+  intr_set_level(old_level);
+  return bits;
+}
+
+/* Replaces the 4 MB page mapped by PDE in PD with a page table of
+   1,024 PTEs that map the same frames with the same flags.
+   Returns false if no page table could be allocated. */
+static bool split_large_page(uint32_t *pd, uint32_t *pde) {
+  uint32_t flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+  uint32_t paddr = *pde & ~(uint32_t)(PTSPAN - 1);
+  uint32_t *pt = palloc_get_page(0);
+  size_t i;
+
+  if (pt == NULL) return false;
+  for (i = 0; i < PGSIZE / sizeof *pt; i++) pt[i] = (paddr + i * PGSIZE) | flags;
+  add_table(pd, pde - pd, pt);
+  invalidate_pagedir(pd);
+  return true;
+}
+
+/* Points PD's PDE number PDE_IDX at page table PT and counts the
+   PTEs in use in it. */
+static void add_table(uint32_t *pd, size_t pde_idx, uint32_t *pt) {
+  struct pt_usage *u = pt_usage(pd);
+  size_t i, used = 0;
+
+  for (i = 0; i < PGSIZE / sizeof *pt; i++) used += pte_in_use(pt[i]);
+  pd[pde_idx] = pde_create(pt);
+  u->tables[pde_idx / 32] |= 1u << (pde_idx % 32);
+  u->used[pde_idx] = used;
+}
+
+/* Takes the page table that PD's PDE number PDE_IDX points to out
+   of PD and returns it, for the caller to free once interrupts
+   are back on. */
+static uint32_t *remove_table(uint32_t *pd, size_t pde_idx) {
+  struct pt_usage *u = pt_usage(pd);
+  uint32_t *pt = pde_get_pt(pd[pde_idx]);
+
+  pd[pde_idx] = 0;
+  u->tables[pde_idx / 32] &= ~(1u << (pde_idx % 32));
+  u->used[pde_idx] = 0;
+
+  /* The CPU may cache PDEs as well as PTEs. */
+  invalidate_pagedir(pd);
+  return pt;
+}
+
+/* Stores NEW in PTE, which maps VADDR in PD, and counts whether
+   it is in use.  If RECLAIM is true and its page table is left
+   with no PTE in use, takes the table out of PD and returns it for
+   the caller to free; otherwise returns a null pointer. */
+static uint32_t *set_pte(uint32_t *pd, uint32_t *pte, const void *vaddr,
+                         uint32_t new, bool reclaim) {
+  struct pt_usage *u = pt_usage(pd);
+  size_t pde_idx = pd_no(vaddr);
+  bool was_used = pte_in_use(*pte);
+
+  *pte = new;
+  if (pte_in_use(new) && !was_used)
+    u->used[pde_idx]++;
+  else if (!pte_in_use(new) && was_used)
+    u->used[pde_idx]--;
+  return reclaim && u->used[pde_idx] == 0 ? remove_table(pd, pde_idx) : NULL;
+}
+
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
    table.  When this happens, we have to "invalidate" the TLB by
@@ -220,3 +589,10 @@ static void invalidate_pagedir(uint32_t *pd) {
     pagedir_activate(pd);
   }
 }
+
+/* Invalidates the TLB entry for VADDR if PD is the active page
+   directory, leaving the rest of the TLB alone.  See [IA32-v3a]
+   3.12 "Translation Lookaside Buffers (TLBs)". */
+static void invalidate_page(uint32_t *pd, const void *vaddr) {
+  if (active_pd() == pd) asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
@@ -2,15 +2,38 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Pages a batch can invalidate one by one; a bigger batch flushes
+   the whole TLB instead. */
+#define PAGEDIR_BATCH_PAGES 32
+
+/* TLB invalidations deferred across several pagedir_clear_page_batch()
+   calls, for the active page directory. */
+struct pagedir_batch
+  {
+    size_t cnt;                                 /* Pages cleared. */
+    const void *pages[PAGEDIR_BATCH_PAGES];     /* The first ones. */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+bool pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage, bool rw);
+size_t pagedir_set_range (uint32_t *pd, void *upage, void *const *kpages,
+                          size_t cnt, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+void pagedir_clear_range (uint32_t *pd, void *upage, size_t cnt);
+void pagedir_batch_init (struct pagedir_batch *);
+void pagedir_clear_page_batch (uint32_t *pd, void *upage,
+                               struct pagedir_batch *);
+void pagedir_batch_flush (struct pagedir_batch *);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
+void pagedir_set_writable (uint32_t *pd, const void *upage, bool writable);
+bool pagedir_move_page (uint32_t *pd, const void *upage, void *kpage);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
 void pagedir_activate (uint32_t *pd);
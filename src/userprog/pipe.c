@@ -0,0 +1,255 @@
+#include "userprog/pipe.h"
+
+#include <debug.h>
+#include <list.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/pollq.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+// Pipes.  A pipe is a ring of up to PIPE_BUFS pages, each holding a
+// run of bytes written and not yet read.  Writes copy into the ring,
+// filling the last page before taking a new one, except that a
+// page-aligned part of the writer's buffer always starts a page of its
+// own.  A reader that wants such a whole page at a page-aligned
+// address of its own takes it by remapping: the page becomes the
+// frame of the reader's page, and the reader's old frame goes into
+// the ring in its place.  A page so moves between processes with a
+// single copy, and the data never goes near the file system.
+
+// Pages in a pipe's ring, 64 kB.
+#define PIPE_BUFS 16
+
+// Bytes [ofs, ofs + len) of PAGE are written and not yet read.
+struct pipe_buf {
+  void* page;
+  size_t ofs;
+  size_t len;
+};
+
+struct pipe {
+  struct lock lock;
+  struct pipe_buf bufs[PIPE_BUFS];
+  size_t head;             // First buffer with data.
+  size_t cnt;              // Buffers with data.
+  void* spare;             // A page read empty, for the next write.
+  int readers, writers;    // Descriptors open on each end.
+  struct list read_wait;   // struct pipe_waiter, for data or EOF.
+  struct list write_wait;  // struct pipe_waiter, for room.
+  struct poll_queue pollers;  // poll() on either end, for any change.
+};
+
+// A thread blocked on a pipe.  Lives on its stack.
+struct pipe_waiter {
+  struct list_elem elem;
+  struct semaphore wake;
+};
+
+struct pipe* pipe_create(void) {
+  struct pipe* p = calloc(1, sizeof *p);
+
+  if (p == NULL) return NULL;
+  lock_init(&p->lock);
+  list_init(&p->read_wait);
+  list_init(&p->write_wait);
+  poll_queue_init(&p->pollers);
+  p->readers = p->writers = 1;
+  return p;
+}
+
+/* Count another descriptor open on P's write end if WRITER, or else
+   its read end, as fork() makes */
+void pipe_dup(struct pipe* p, bool writer) {
+  lock_acquire(&p->lock);
+  if (writer)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release(&p->lock);
+}
+
+/* Sleep on queue Q of pipe P until woken.  Call with P's lock held,
+   which is released meanwhile */
+static void pipe_wait(struct pipe* p, struct list* q) {
+  struct pipe_waiter w;
+
+  sema_init(&w.wake, 0);
+  list_push_back(q, &w.elem);
+  lock_release(&p->lock);
+  sema_down(&w.wake);
+  lock_acquire(&p->lock);
+}
+
+/* Wake every thread sleeping on queue Q of pipe P, and every thread
+   polling P */
+static void pipe_wake(struct pipe* p, struct list* q) {
+  poll_queue_wake(&p->pollers);
+  while (!list_empty(q)) {
+    struct pipe_waiter* w =
+        list_entry(list_pop_front(q), struct pipe_waiter, elem);
+    sema_up(&w->wake);
+  }
+}
+
+/* Return a page for P's ring: the spare, or a new user pool page from
+   the frame table, which a reader can take as a frame, or failing that
+   a kernel pool page */
+static void* pipe_page(struct pipe* p) {
+  void* page = p->spare;
+
+  p->spare = NULL;
+  if (page == NULL) page = frame_buffer_alloc();
+  if (page == NULL) page = palloc_get_page(0);
+  return page;
+}
+
+/* Keep PAGE as P's spare, or free it if there is one already */
+static void pipe_put_page(struct pipe* p, void* page) {
+  if (p->spare == NULL)
+    p->spare = page;
+  else
+    frame_buffer_free(page);
+}
+
+/* Free P and the pages in its ring */
+static void pipe_free(struct pipe* p) {
+  size_t i;
+
+  for (i = 0; i < p->cnt; i++)
+    frame_buffer_free(p->bufs[(p->head + i) % PIPE_BUFS].page);
+  frame_buffer_free(p->spare);
+  free(p);
+}
+
+/* Drop a descriptor open on P's write end if WRITER, or else its read
+   end, freeing P once neither end is open.  Sleepers on the other end
+   learn of the close: readers see end of file once the ring is empty,
+   writers an error.  A thread in pipe_read() or pipe_write() holds a
+   use of its descriptor, which fd_table_put() closes only once that
+   thread has left, so P is never freed under it */
+void pipe_close(struct pipe* p, bool writer) {
+  bool dead;
+
+  lock_acquire(&p->lock);
+  if (writer) {
+    if (--p->writers == 0) pipe_wake(p, &p->read_wait);
+  } else {
+    if (--p->readers == 0) pipe_wake(p, &p->write_wait);
+  }
+  dead = p->readers == 0 && p->writers == 0;
+  // A poller on a descriptor another thread closed must not stay
+  // queued on a freed pipe.
+  poll_queue_wake(&p->pollers);
+  lock_release(&p->lock);
+
+  if (dead) pipe_free(p);
+}
+
+/* Read up to SIZE bytes from P into BUFFER, which is pinned user
+   memory, waiting until there is something to read.  Returns the
+   bytes read, or 0 at end of file */
+int pipe_read(struct pipe* p, void* buffer, unsigned size) {
+  uint8_t* dst = buffer;
+  size_t done = 0;
+
+  if (size == 0) return 0;
+
+  lock_acquire(&p->lock);
+  while (p->cnt == 0 && p->writers > 0) pipe_wait(p, &p->read_wait);
+
+  while (done < size && p->cnt > 0) {
+    struct pipe_buf* b = &p->bufs[p->head];
+    size_t n = b->len < size - done ? b->len : size - done;
+
+    if (n == PGSIZE && pg_ofs(dst + done) == 0 &&
+        frame_exchange(dst + done, &b->page)) {
+      // B's page is the reader's frame now, and B holds the old one.
+    } else {
+      memcpy(dst + done, (uint8_t*)b->page + b->ofs, n);
+    }
+    done += n;
+    b->ofs += n;
+    b->len -= n;
+    if (b->len == 0) {
+      pipe_put_page(p, b->page);
+      p->head = (p->head + 1) % PIPE_BUFS;
+      p->cnt--;
+    }
+  }
+  pipe_wake(p, &p->write_wait);
+  lock_release(&p->lock);
+  return done;
+}
+
+/* Write SIZE bytes from BUFFER, which is pinned user memory, to P,
+   waiting for room as needed.  Returns the bytes written, which are
+   fewer than SIZE only if memory runs out or the read end is closed
+   midway, or -1 if nothing could be written */
+int pipe_write(struct pipe* p, const void* buffer, unsigned size) {
+  const uint8_t* src = buffer;
+  size_t done = 0;
+
+  lock_acquire(&p->lock);
+  while (done < size && p->readers > 0) {
+    struct pipe_buf* tail =
+        p->cnt > 0 ? &p->bufs[(p->head + p->cnt - 1) % PIPE_BUFS] : NULL;
+    bool aligned = pg_ofs(src + done) == 0 && size - done >= PGSIZE;
+    size_t n;
+
+    if (tail != NULL && !aligned && tail->ofs + tail->len < PGSIZE) {
+      // Fill up the last page.
+      n = PGSIZE - (tail->ofs + tail->len);
+      if (n > size - done) n = size - done;
+      memcpy((uint8_t*)tail->page + tail->ofs + tail->len, src + done, n);
+      tail->len += n;
+    } else if (p->cnt < PIPE_BUFS) {
+      struct pipe_buf* b = &p->bufs[(p->head + p->cnt) % PIPE_BUFS];
+      b->page = pipe_page(p);
+      if (b->page == NULL) break;
+      n = size - done < PGSIZE ? size - done : PGSIZE;
+      memcpy(b->page, src + done, n);
+      b->ofs = 0;
+      b->len = n;
+      p->cnt++;
+    } else {
+      pipe_wake(p, &p->read_wait);
+      pipe_wait(p, &p->write_wait);
+      continue;
+    }
+    done += n;
+  }
+  pipe_wake(p, &p->read_wait);
+  lock_release(&p->lock);
+  return done > 0 || size == 0 ? (int)done : -1;
+}
+
+/* Return the poll events that P's write end, if WRITER, or else its
+   read end, is ready for.  If E is nonnull, also register it for
+   poller W, to be woken when anything about P changes */
+int pipe_poll(struct pipe* p, bool writer, struct poll_entry* e,
+              struct poll_wait* w) {
+  int events = 0;
+
+  lock_acquire(&p->lock);
+  if (writer) {
+    struct pipe_buf* tail =
+        p->cnt > 0 ? &p->bufs[(p->head + p->cnt - 1) % PIPE_BUFS] : NULL;
+    if (p->readers == 0)
+      events |= POLLERR;
+    else if (p->cnt < PIPE_BUFS || tail->ofs + tail->len < PGSIZE)
+      events |= POLLOUT;
+  } else {
+    if (p->cnt > 0) events |= POLLIN;
+    if (p->writers == 0) events |= POLLHUP;
+  }
+  if (e != NULL) poll_queue_add(&p->pollers, e, w);
+  lock_release(&p->lock);
+  return events;
+}
@@ -0,0 +1,18 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+
+struct pipe;
+struct poll_entry;
+struct poll_wait;
+
+struct pipe* pipe_create(void);
+void pipe_dup(struct pipe* p, bool writer);
+void pipe_close(struct pipe* p, bool writer);
+int pipe_read(struct pipe* p, void* buffer, unsigned size);
+int pipe_write(struct pipe* p, const void* buffer, unsigned size);
+int pipe_poll(struct pipe* p, bool writer, struct poll_entry* e,
+              struct poll_wait* w);
+
+#endif /* userprog/pipe.h */
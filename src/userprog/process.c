@@ -11,184 +11,418 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/scstat.h"
+#include "userprog/sctrace.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "vm/frame.h"
 #include "vm/mmap.h"
 #include "vm/page.h"
+#include "vm/replay.h"
+#include "vm/shm.h"
+#include "vm/snapshot.h"
 
 static thread_func start_process NO_RETURN;
-static bool load(const char* cmdline, void (**eip)(void), void** esp);
+static thread_func fork_process NO_RETURN;
+static thread_func restore_process NO_RETURN;
+static thread_func thread_start_user NO_RETURN;
+static void process_free(struct thread* t);
+
+/* Dead threads waiting for the reaper, linked through their elem. */
+static struct list reap_list;
+static struct work_queue* reaper;
+static struct work reap_work;
+
+/* A command line split into arguments, once, by process_execute().
+   The arguments are packed back to back, each with its null
+   terminator, exactly as they go at the top of the new stack, so
+   setup_stack() copies them there in one piece. */
+struct exec_args {
+  char* strings;   /* Packed arguments; STRINGS itself is argv[0]. */
+  size_t size;     /* Bytes of STRINGS in use. */
+  size_t page_cnt; /* Pages allocated for STRINGS. */
+  size_t* ofs;     /* Offset of each argument in STRINGS. */
+  int argc;        /* Number of arguments. */
+};
+
+static bool load(const struct exec_args* args, void (**eip)(void),
+                 void** esp);
+
+/* Frees ARGS. */
+static void args_free(struct exec_args* args) {
+  if (args->strings != NULL)
+    palloc_free_multiple(args->strings, args->page_cnt);
+  free(args->ofs);
+  free(args);
+}
+
+/* Splits CMDLINE at spaces into a new struct exec_args, in a single
+   pass that copies it too.  Returns NULL if CMDLINE has no
+   arguments or memory is short. */
+static struct exec_args* args_parse(const char* cmdline) {
+  size_t len = strnlen(cmdline, CMDLINE_MAX_PAGES * PGSIZE - 1);
+  struct exec_args* args = malloc(sizeof *args);
+  size_t cap = 0, i;
+  bool in_arg = false;
+
+  if (args == NULL) return NULL;
+  args->page_cnt = DIV_ROUND_UP(len + 1, PGSIZE);
+  args->strings = palloc_get_multiple(0, args->page_cnt);
+  args->size = 0;
+  args->ofs = NULL;
+  args->argc = 0;
+  if (args->strings == NULL) goto fail;
+
+  for (i = 0; i < len; i++) {
+    if (cmdline[i] == ' ') {
+      if (in_arg) args->strings[args->size++] = '\0';
+      in_arg = false;
+      continue;
+    }
+    if (!in_arg) {
+      if ((size_t)args->argc == cap) {
+        size_t* ofs = realloc(args->ofs, (cap ? cap * 2 : 8) * sizeof *ofs);
+        if (ofs == NULL) goto fail;
+        args->ofs = ofs;
+        cap = cap ? cap * 2 : 8;
+      }
+      args->ofs[args->argc++] = args->size;
+      in_arg = true;
+    }
+    args->strings[args->size++] = cmdline[i];
+  }
+  if (in_arg) args->strings[args->size++] = '\0';
+  if (args->argc == 0) goto fail;
+  return args;
+
+fail:
+  args_free(args);
+  return NULL;
+}
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
+   FILE_NAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
    thread id, or TID_ERROR if the thread cannot be created. */
 tid_t process_execute(const char* file_name) {
-  char* fn_copy;  // Kernel virtual address
+  struct exec_args* args;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
+  /* Split FILE_NAME into a copy of its own.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page(0);
-  if (fn_copy == NULL) return TID_ERROR;
-  strlcpy(fn_copy, file_name, PGSIZE);
-
-  // To pass only command name instead of the whole line with arguments
-  char* command = malloc(sizeof(char) * (strlen(file_name) + 1));
-  if (command == NULL) {
-    palloc_free_page(fn_copy);
-    return -1;
-  }
-  strlcpy(command, file_name, strlen(file_name) + 1);
-  char* save_ptr;
-  strtok_r(command, " ", &save_ptr);
+  args = args_parse(file_name);
+  if (args == NULL) return TID_ERROR;
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create(command, PRI_DEFAULT, start_process, fn_copy);
-
-  if (tid == TID_ERROR) palloc_free_page(fn_copy);
-  free(command);
+  /* Create a new thread to execute FILE_NAME, named after the
+     command only. */
+  tid = thread_create(args->strings, PRI_DEFAULT, start_process, args);
+  if (tid == TID_ERROR) args_free(args);
   return tid;
 }
 
-/* A function that pushes arguments to the user stack. */
-static void push_argv(int argc, char** argv, void** esp) {
-  int i;
-
-  // Testing validity of stack pointer
-  uintptr_t sp_int = (uint32_t)*esp;
+/* A thread function that loads a user process and starts it
+   running. */
+static void start_process(void* args_) {
+  struct exec_args* args = args_;
+  struct intr_frame if_;
+  bool success;
 
-  for (i = argc - 1; i >= 0; i--) {
-    int len = strlen(argv[i]) + 1;
-    sp_int -= len;
-  }
-  sp_int -= sp_int % 4;
-  sp_int -= 4;
-  for (i = argc - 1; i >= 0; i--) {
-    sp_int -= 4;
-  }
-  sp_int -= 12;
+  /* Initialize interrupt frame and load executable. */
+  memset(&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  success = load(args, &if_.eip, &if_.esp);
+  if (success) thread_current()->esp = if_.esp;
+  sema_up(&(thread_current()->load_sema));
 
-  // Check after movement
-  if (!is_user_vaddr((void*)sp_int)) {
-    printf("%s: exit(%d)\n", thread_name(), -1);
+  /* If load failed, quit.  A parent that did not wait for the load,
+     as with spawn, learns of the failure from wait. */
+  args_free(args);
+  if (!success) {
+    thread_current()->exit_status = -1;
     thread_exit();
-    return;
   }
 
-  // stack pointer is valid!
+  /* Start the user process by simulating a return from an
+     interrupt, implemented by intr_exit (in
+     threads/intr-stubs.S).  Because intr_exit takes all of its
+     arguments on the stack in the form of a `struct intr_frame',
+     we just point the stack pointer (%esp) to our stack frame
+     and jump to it. */
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+
+/* Starts a new process that is a copy of the current one, as it is
+   in the middle of a system call: the child returns from it with 0
+   in eax, to the same registers and memory.  Writable memory is
+   shared copy-on-write; memory mappings are not inherited, and open
+   files are reopened at the same positions.  Returns the child's
+   thread id, or TID_ERROR if the thread cannot be created.  Like
+   process_execute(), the caller waits on the child's load_sema for
+   the copy to succeed or fail. */
+tid_t process_fork(void) {
+  struct thread* cur = thread_current();
 
-  // push argv[i]
-  for (i = argc - 1; i >= 0; i--) {
-    int len = strlen(argv[i]) + 1;
-    *esp -= len;
-    strlcpy(*esp, argv[i], len);
-    argv[i] = *esp;
-  }
+  /* The user registers saved on entry to the kernel, by either
+     system call path, sit at the very top of the kernel stack. */
+  struct intr_frame* user_if = (struct intr_frame*)((uint8_t*)cur + PGSIZE) - 1;
 
-  // word-align
-  uintptr_t align = (uintptr_t)(*esp) % 4;
-  if (align) {
-    *esp -= align;
-    **(uint8_t**)esp = 0;
-  }
+  return thread_create(cur->name, cur->priority, fork_process, user_if);
+}
 
-  // argv[argc]: null pointer sentinel
-  *esp -= 4;
-  **(uint32_t**)esp = 0;
+/* Copies the parent's address space, files and FPU state into the
+   current, newly created thread.  Returns false if memory is short. */
+static bool fork_copy(struct thread* parent) {
+  struct thread* t = thread_current();
 
-  // push pointer to argv[i]
-  for (i = argc - 1; i >= 0; i--) {
-    *esp -= 4;
-    **(uint32_t**)esp = argv[i];
+  SPT_init();
+  scstat_init();
+  sctrace_init();
+
+  if (!fpu_fork(t->parent)) return false;
+  t->pagedir = pagedir_create();
+  if (t->pagedir == NULL) return false;
+  process_activate();
+
+  if (parent->executable != NULL) {
+    t->executable = file_reopen(parent->executable);
+    if (t->executable == NULL) return false;
+    file_deny_write(t->executable);
+  }
+  if (parent->snapshot != NULL) {
+    t->snapshot = file_reopen(parent->snapshot);
+    if (t->snapshot == NULL) return false;
+    file_deny_write(t->snapshot);
   }
+  if (!fd_table_copy(&t->fd_table, &parent->fd_table)) return false;
+
+  t->data_segment_start = parent->data_segment_start;
+  t->heap_start = parent->heap_start;
+  t->heap_brk = parent->heap_brk;
+  t->sys_ring = parent->sys_ring;
+  t->esp = parent->esp;
+  return SPT_fork(parent);
+}
 
-  // push pointer to argv
-  *esp -= 4;
-  **(uint32_t**)esp = *esp + 4;
+/* A thread function that turns a new thread into a copy of its
+   parent, whose saved user registers are at USER_IF_, and starts
+   it running. */
+static void fork_process(void* user_if_) {
+  struct thread* t = thread_current();
+  struct intr_frame if_ = *(struct intr_frame*)user_if_;
+  bool success;
+
+  /* The parent stays blocked until load_sema is up, so only
+     eviction changes its memory while we copy it. */
+  success = fork_copy(t->parent->proc);
+  if (!success) t->load_status = false;
+  sema_up(&t->load_sema);
+  if (!success) thread_exit();
 
-  // push argc
-  *esp -= 4;
-  **(uint32_t**)esp = argc;
+  if_.eax = 0;
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
 
-  // push fake return address
-  *esp -= 4;
-  **(uint32_t**)esp = 0;
+/* Starts a new process from the snapshot in FILE_NAME, written by
+   snapshot(), resuming from that call.  Like process_execute(), the
+   caller waits on the child's load_sema for the restore to succeed
+   or fail.  Returns the new process's thread id, or TID_ERROR if the
+   thread cannot be created. */
+tid_t process_restore(const char* file_name) {
+  char* name = palloc_get_page(0);
+  tid_t tid;
 
-  // for debugging
-  // hex_dump(*esp, *esp, 100, 1);
+  if (name == NULL) return TID_ERROR;
+  strlcpy(name, file_name, PGSIZE);
+  tid = thread_create(name, PRI_DEFAULT, restore_process, name);
+  if (tid == TID_ERROR) palloc_free_page(name);
+  return tid;
 }
 
-/* A thread function that loads a user process and starts it
-   running. */
-static void start_process(void* file_name_) {
-  // char *file_name = file_name_;
-  char* file_name = malloc(sizeof(char) * (strlen(file_name_) + 1));
-  if (file_name == NULL) {
-    palloc_free_page(file_name_);
-    thread_exit();
+/* Sets the current, newly created thread up from the snapshot named
+   NAME, storing the registers to start with in IF_.  Returns false
+   if it is not a valid snapshot or memory is short. */
+static bool restore_load(const char* name, struct intr_frame* if_) {
+  struct thread* t = thread_current();
+
+  SPT_init();
+  scstat_init();
+  sctrace_init();
+
+  t->pagedir = pagedir_create();
+  if (t->pagedir == NULL) return false;
+  process_activate();
+
+  t->snapshot = filesys_open(name);
+  if (t->snapshot == NULL) {
+    printf("restore: %s: open failed\n", name);
+    return false;
+  }
+  // The saved pages are read from the file as they are faulted in.
+  file_deny_write(t->snapshot);
+  if (!snapshot_restore(t->snapshot, if_)) {
+    printf("restore: %s: not a snapshot\n", name);
+    return false;
   }
-  strlcpy(file_name, file_name_, strlen(file_name_) + 1);
+  t->esp = if_->esp;
+  return true;
+}
+
+/* A thread function that restores a process from the snapshot named
+   NAME_ and starts it running. */
+static void restore_process(void* name_) {
+  char* name = name_;
   struct intr_frame if_;
   bool success;
 
-  // Count argc first and allocate argv array
-  int argc = 0;
-  char *token, *save_ptr;
-  for (token = strtok_r(file_name, " ", &save_ptr); token != NULL;
-       token = strtok_r(NULL, " ", &save_ptr))
-    argc++;
-  char** argv = malloc(sizeof(char*) * argc);
-  if (argv == NULL) {
-    palloc_free_page(file_name_);
-    free(file_name);
+  memset(&if_, 0, sizeof if_);
+  success = restore_load(name, &if_);
+  if (!success) thread_current()->load_status = false;
+  sema_up(&thread_current()->load_sema);
+  palloc_free_page(name);
+  if (!success) {
+    thread_current()->exit_status = -1;
     thread_exit();
   }
 
-  // Get the values of argv array
-  strlcpy(file_name, file_name_, strlen(file_name_) + 1);
-  int i = 0;
-  for (token = strtok_r(file_name, " ", &save_ptr); token != NULL;
-       token = strtok_r(NULL, " ", &save_ptr))
-    argv[i++] = token;
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+
+/* What a thread started by thread_spawn() needs to begin. */
+struct spawn_args {
+  struct thread* proc; /* Process to join. */
+  void* entry;         /* User function to run. */
+  void* arg;           /* Its argument. */
+  uint8_t* stack;      /* Top of its user stack. */
+  int slot;            /* Stack slot it was given, or -1. */
+};
+
+/* Starts a new thread in the current process, sharing its address
+   space, open files and mappings, that calls ENTRY(ARG) in user
+   mode on the user stack whose top is STACK.  If STACK is null, the
+   thread gets one of the process's stack slots below the main
+   stack.  The new thread is a child of the caller, so wait() joins
+   it, and a thread waits for its children when it exits.  Returns
+   the new thread's id, or TID_ERROR if no stack slot, memory or
+   thread was available. */
+tid_t process_thread_spawn(void* entry, void* arg, void* stack) {
+  struct thread* proc = process_current();
+  struct spawn_args* sa;
+  enum intr_level old_level;
+  tid_t tid;
+
+  sa = malloc(sizeof *sa);
+  if (sa == NULL) return TID_ERROR;
+  sa->proc = proc;
+  sa->entry = entry;
+  sa->arg = arg;
+  sa->stack = stack;
+  sa->slot = -1;
+
+  if (stack == NULL) {
+    old_level = intr_disable();
+    for (sa->slot = 0; sa->slot < THREAD_STACK_SLOTS; sa->slot++)
+      if (!(proc->stack_slots & (1u << sa->slot))) break;
+    if (sa->slot < THREAD_STACK_SLOTS) proc->stack_slots |= 1u << sa->slot;
+    intr_set_level(old_level);
+    if (sa->slot == THREAD_STACK_SLOTS) {
+      free(sa);
+      return TID_ERROR;
+    }
+    sa->stack = (uint8_t*)PHYS_BASE - THREAD_STACK_MAIN -
+                (size_t)sa->slot * THREAD_STACK_SIZE;
+  }
+
+  tid = thread_create(proc->name, thread_get_priority(), thread_start_user,
+                      sa);
+  if (tid == TID_ERROR) {
+    if (sa->slot >= 0) {
+      old_level = intr_disable();
+      proc->stack_slots &= ~(1u << sa->slot);
+      intr_set_level(old_level);
+    }
+    free(sa);
+  }
+  return tid;
+}
+
+/* A thread function that joins the process in SA_ and enters user
+   mode at its entry point. */
+static void thread_start_user(void* sa_) {
+  struct spawn_args sa = *(struct spawn_args*)sa_;
+  struct thread* t = thread_current();
+  struct intr_frame if_;
+  uint32_t frame[2];
+
+  free(sa_);
+  t->proc = sa.proc;
+  t->pagedir = sa.proc->pagedir;
+  t->stack_slot = sa.slot;
+  process_activate();
+
+  /* Call ENTRY(ARG) with a null return address: returning from
+     ENTRY faults and ends the thread.  Writing the words may grow
+     the stack, which page_fault() checks against our esp. */
+  frame[0] = 0;
+  frame[1] = (uint32_t)sa.arg;
+  t->esp = sa.stack - sizeof frame;
+  if (!copy_to_user(t->esp, frame, sizeof frame)) {
+    t->exit_status = -1;
+    thread_exit();
+  }
 
-  /* Initialize interrupt frame and load executable. */
   memset(&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load(argv[0], &if_.eip, &if_.esp);
-  sema_up(&(thread_current()->load_sema));
+  if_.eip = (void (*)(void))sa.entry;
+  if_.esp = t->esp;
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
 
-  if (success) {
-    push_argv(argc, argv, &if_.esp);
-    thread_current()->esp = if_.esp;
+/* Collects child T, which has exited and not been waited for yet,
+   and returns its exit status.  A process, unlike a thread_spawn()
+   thread, is in our exited list as well; the caller has taken its
+   count off exited_sema, and this takes it off the list.  T may be
+   gone once this returns. */
+static int reap_child(struct thread* t) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+  struct rusage usage;
+  int exit_status;
+
+  if (t->proc == t) {
+    old_level = intr_disable();
+    list_remove(&t->exitelem);
+    intr_set_level(old_level);
   }
 
-  /* If load failed, quit. */
-  palloc_free_page(file_name_);
-  free(file_name);
-  free(argv);
-  if (!success) thread_exit();
-
-  /* Start the user process by simulating a return from an
-     interrupt, implemented by intr_exit (in
-     threads/intr-stubs.S).  Because intr_exit takes all of its
-     arguments on the stack in the form of a `struct intr_frame',
-     we just point the stack pointer (%esp) to our stack frame
-     and jump to it. */
-  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
-  NOT_REACHED();
+  t->wait_status = true;         // Wait is already called
+  exit_status = t->exit_status;  // Save exit status
+  // Its usage, and its children's, passes on to us.
+  thread_process_rusage(t, &usage);
+  thread_rusage_add(&cur->proc->child_rusage, &usage);
+  thread_rusage_add(&cur->proc->child_rusage, &t->child_rusage);
+  sema_up(&(t->exit_sema));      // Now, we can remove childelem
+  return exit_status;
 }
 
 /* Waits for thread TID to die and returns its exit status.  If
@@ -201,7 +435,6 @@ static void start_process(void* file_name_) {
    This function will be implemented in problem 2-2.  For now, it
    does nothing. */
 int process_wait(tid_t child_tid) {
-  int exit_status = -1;
   struct list_elem* e;
 
   // Search the target child process
@@ -212,59 +445,141 @@ int process_wait(tid_t child_tid) {
       if (t->wait_status == true)  // If wait is already called, return -1
         return -1;
       sema_down(&(t->child_sema));   // Wait until child process exiting
-      t->wait_status = true;         // Wait is already called
-      exit_status = t->exit_status;  // Save exit status
-      sema_up(&(t->exit_sema));      // Now, we can remove childelem
-      return exit_status;
+      if (t->proc == t) sema_down(&thread_current()->exited_sema);
+      return reap_child(t);
     }
   }
 
   // If child_tid is not a child
-  return exit_status;
+  return -1;
+}
+
+/* Waits for whichever child of the current thread exits first, or
+   with BLOCK false only takes one that already has, and stores its
+   exit status in *STATUS.  Returns its tid, TID_ERROR if there is no
+   child left to wait for, or 0 if none has exited and BLOCK is
+   false. */
+tid_t process_wait_any(int* status, bool block) {
+  struct thread* cur = thread_current();
+  enum intr_level old_level;
+  struct list_elem* e;
+  struct thread* t;
+  bool waitable = false;
+  tid_t tid;
+
+  for (e = list_begin(&cur->children); e != list_end(&cur->children);
+       e = list_next(e))
+  {
+    t = list_entry(e, struct thread, childelem);
+    if (t->proc == t && !t->wait_status) {
+      waitable = true;
+      break;
+    }
+  }
+  if (!waitable) return TID_ERROR;
+  if (block)
+    sema_down(&cur->exited_sema);
+  else if (!sema_try_down(&cur->exited_sema))
+    return 0;
+
+  // Children queue up in the order they exit.
+  old_level = intr_disable();
+  t = list_entry(list_front(&cur->exited), struct thread, exitelem);
+  intr_set_level(old_level);
+  sema_down(&t->child_sema);
+  tid = t->tid;
+  *status = reap_child(t);
+  return tid;
+}
+
+/* Whether the running thread must exit as soon as it can, because
+   the OOM killer picked its process, or because it is a
+   thread_spawn() thread whose process's leader has exited.  Checked
+   on every way back to user mode. */
+bool process_dying(void) {
+  struct thread* cur = thread_current();
+
+  return cur->proc->oom_killed || (cur->proc->exiting && cur->proc != cur);
+}
+
+/* Waits until the threads that CUR, the current thread, spawned
+   have exited. */
+static void wait_threads(struct thread* cur) {
+  struct list_elem* e;
+
+  for (e = list_begin(&cur->children); e != list_end(&cur->children);) {
+    struct thread* t = list_entry(e, struct thread, childelem);
+    // Only T takes itself off the list, and only once reaped.
+    e = list_next(e);
+    if (t->proc != t && !t->wait_status) process_wait(t->tid);
+  }
 }
 
 /* Free the current process's resources. */
 void process_exit(void) {
   struct thread* cur = thread_current();
+  bool leader = cur->proc == cur;
   struct list_elem* e;
-
-  uint32_t* pd;
-  for (e = list_begin(&cur->mmap_table); e != list_end(&cur->mmap_table);
-       e = list_next(e)) {
-    struct mapping* m = list_entry(e, struct mapping, elem);
-    munmap_write(cur, m->id, false);
+  size_t k;
+
+  if (leader) {
+    /* The address space and open files outlive every thread using
+       them.  Threads in futex_wait() are woken to exit; the others
+       exit when they next come back from the kernel, or into it from
+       user mode. */
+    cur->exiting = true;
+    futex_wake_proc(cur);
+    wait_threads(cur);
+    scstat_exit();
+    sctrace_exit();
+    for (k = 0; k < cur->mmap_table.cnt; k++)
+      munmap_write(cur, cur->mmap_table.by_id[k]->id, false);
+    // Shared memory is detached while the page directory still shows
+    // which pages were written, for the attachments that remain.
+    for (k = cur->mmap_table.cnt; k-- > 0;)
+      if (cur->mmap_table.by_id[k]->shm != NULL)
+        shm_unmap(cur, cur->mmap_table.by_id[k]);
+    shm_exit();
+  } else {
+    /* A thread_spawn() thread leaves the process state to the thread
+       that owns it, which outlives it: each thread waits for the
+       threads it spawned.  Drop the shared page directory before
+       telling our waiter, who may be about to destroy it. */
+    enum intr_level old_level;
+
+    wait_threads(cur);
+    old_level = intr_disable();
+    if (cur->stack_slot >= 0)
+      cur->proc->stack_slots &= ~(1u << cur->stack_slot);
+    cur->pagedir = NULL;
+    process_activate();
+    // The process keeps what the thread used, counted once.
+    thread_rusage_add(&cur->proc->exited_rusage, &cur->rusage);
+    memset(&cur->rusage, 0, sizeof cur->rusage);
+    intr_set_level(old_level);
   }
 
   // release lock & remove childelem before destroying pd
+  if (leader) {
+    // Let a wait_any() in the parent find us.
+    enum intr_level old_level = intr_disable();
+    list_push_back(&cur->parent->exited, &cur->exitelem);
+    intr_set_level(old_level);
+    sema_up(&cur->parent->exited_sema);
+  }
   sema_up(&(cur->child_sema));
   sema_down(&(cur->exit_sema));
   list_remove(&(cur->childelem));
 
-  // Destroy all mappings
-  // printf("[Thread %s is calling munmap!]\n", thread_name());
-  for (e = list_begin(&cur->mmap_table); e != list_end(&cur->mmap_table);
-       e = list_next(e)) {
-    struct mapping* m = list_entry(e, struct mapping, elem);
-    munmap_free(cur, m->id);
-  }
-
-  // Close files that process opened
-  int i;
-  for (i = 2; i < FD_TABLE_SIZE; i++) {
-    if (cur->fd_table[i] != NULL) {
-      file_close(cur->fd_table[i]);
-      cur->fd_table[i] = NULL;
-    }
-  }
-
   // Close its executable file
   if (cur->executable != NULL) {
     file_close(cur->executable);
     cur->executable = NULL;
   }
-
-  // Destroy the current process's SPT.
-  SPT_destroy();
+  if (cur->snapshot != NULL) {
+    file_close(cur->snapshot);
+    cur->snapshot = NULL;
+  }
 
   // Call wait for all children
   for (e = list_begin(&(thread_current()->children));
@@ -273,23 +588,80 @@ void process_exit(void) {
     process_wait(t->tid);
   }
 
-  /* Destroy the current process's page directory and switch back
-   to the kernel-only page directory. */
-  pd = cur->pagedir;
+  if (!leader) return;
+
+  /* The address space, mappings and open files go with the struct
+     thread: to the reaper once we have switched away, see
+     process_reap().  A thread that never got an address space has
+     little to free, so it does that now. */
+  if (cur->pagedir == NULL || reaper == NULL) process_free(cur);
+}
+
+/* Frees dead process T's SPT with its frames and swap slots, its
+   mappings, its open files and its page directory.  The mappings'
+   dirty pages were written back by process_exit(). */
+static void process_free(struct thread* t) {
+  uint32_t* pd;
+  size_t k;
+
+  // SPT_destroy() frees mapped pages along with the rest, so only
+  // the mappings themselves are left.
+  SPT_destroy(t);
+  for (k = 0; k < t->mmap_table.cnt; k++)
+    mapping_free(t->mmap_table.by_id[k]);
+  mmap_table_destroy(&t->mmap_table);
+
+  // Close files that process opened
+  fd_table_destroy(&t->fd_table);
+
+  /* Destroy the page directory.  If it is ours, switch back to the
+     kernel-only page directory first.  Correct ordering here is
+     crucial.  We must set t->pagedir to NULL before switching page
+     directories, so that a timer interrupt can't switch back to the
+     process page directory.  We must activate the base page
+     directory before destroying the process's page directory, or
+     our active page directory will be one that's been freed (and
+     cleared). */
+  pd = t->pagedir;
   if (pd != NULL) {
-    /* Correct ordering here is crucial.  We must set
-       cur->pagedir to NULL before switching page directories,
-       so that a timer interrupt can't switch back to the
-       process page directory.  We must activate the base page
-       directory before destroying the process's page
-       directory, or our active page directory will be one
-       that's been freed (and cleared). */
-    cur->pagedir = NULL;
-    pagedir_activate(NULL);
+    t->pagedir = NULL;
+    if (t == thread_current()) pagedir_activate(NULL);
     pagedir_destroy(pd);
   }
 }
 
+/* Reaper work: frees the resources of dead processes and their
+   struct threads, off the exit and context switch path. */
+static void reap_dead(void* aux UNUSED) {
+  for (;;) {
+    enum intr_level old_level;
+    struct thread* t = NULL;
+
+    old_level = intr_disable();
+    if (!list_empty(&reap_list))
+      t = list_entry(list_pop_front(&reap_list), struct thread, elem);
+    intr_set_level(old_level);
+    if (t == NULL) return;
+
+    process_free(t);
+    thread_page_free(t);
+  }
+}
+
+/* Called by thread_schedule_tail() with interrupts off for thread T,
+   which has died and been switched away from, so its page directory
+   is no longer active.  Queues T for the reaper and returns true if
+   T has process resources to free, or returns false and leaves
+   freeing T to the caller. */
+bool process_reap(struct thread* t) {
+  ASSERT(intr_get_level() == INTR_OFF);
+
+  if (reaper == NULL || t->pagedir == NULL) return false;
+  list_push_back(&reap_list, &t->elem);
+  work_enqueue(reaper, &reap_work);
+  return true;
+}
+
 /* Sets up the CPU for running user code in the current
    thread.
    This function is called on every context switch. */
@@ -365,47 +737,113 @@ struct Elf32_Phdr {
 #define PF_W 2 /* Writable. */
 #define PF_R 4 /* Readable. */
 
-static bool setup_stack(void** esp);
+static bool setup_stack(const struct exec_args* args, void** esp);
 static bool validate_segment(const struct Elf32_Phdr*, struct file*);
 static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,
                          uint32_t read_bytes, uint32_t zero_bytes,
                          bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
-   Returns true if successful, false otherwise. */
-bool load(const char* file_name, void (**eip)(void), void** esp) {
-  struct thread* t = thread_current();
-  struct Elf32_Ehdr ehdr;
-  struct file* file = NULL;
-  off_t file_ofs;
-  bool success = false;
-  int i;
+/* Executable image cache.
+
+   Parsing an executable's headers takes a read for the ELF header
+   and one per program header, and the same few programs are run
+   over and over, so load() keeps what it learns here: the entry
+   point and each loadable segment, already validated and laid out
+   as load_segment() wants it.  A repeat exec goes straight from the
+   cached image to SPT regions, and the frame cache's shared
+   read-only pages supply its text.
+
+   Each image holds its inode open, so the inode it is keyed on
+   cannot be freed and its address reused.  An image is dropped once
+   its file is written, which moves the inode's generation on, or
+   removed. */
+
+/* Most images kept. */
+#define IMAGE_CACHE_SIZE 8
+
+/* A loadable segment, in load_segment()'s terms. */
+struct exec_segment {
+  uint32_t file_page;
+  uint32_t mem_page;
+  uint32_t read_bytes;
+  uint32_t zero_bytes;
+  bool writable;
+};
 
-  /* Init SPT, which is per-process. */
-  SPT_init();
+/* The parsed layout of an executable. */
+struct exec_image {
+  struct inode* inode;     /* File it was parsed from. */
+  unsigned generation;     /* INODE's generation when parsed. */
+  int ref_cnt;             /* The cache's reference, plus one per load. */
+  void (*entry)(void);     /* Entry point. */
+  void* data_segment_start; /* Start of the last loadable segment. */
+  size_t seg_cnt;          /* Loadable segments. */
+  struct exec_segment* segs;
+  struct list_elem elem;   /* In image_cache, most recently used first. */
+};
 
-  /* Allocate and activate page directory. */
-  t->pagedir = pagedir_create();
-  if (t->pagedir == NULL) goto done;
-  process_activate();
+static struct list image_cache;
+static size_t image_cache_cnt;
+static struct lock image_cache_lock;
+
+/* Initializes the executable image cache and starts the reaper. */
+void process_init(void) {
+  list_init(&image_cache);
+  lock_init(&image_cache_lock);
+  lock_register(&image_cache_lock, "image cache");
+  list_init(&reap_list);
+  work_init(&reap_work, reap_dead, NULL);
+  reaper = work_queue_create("reaper", PRI_DEFAULT, 1);
+}
 
-  /* Open executable file. */
-  file = filesys_open(file_name);
-  if (file == NULL) {
-    printf("load: %s: open failed\n", file_name);
-    file_close(file);
-    goto done;
-  }
+/* Frees IMG, whose last reference is gone. */
+static void image_free(struct exec_image* img) {
+  inode_close(img->inode);
+  free(img->segs);
+  free(img);
+}
+
+/* Drops a reference to IMG, freeing it with the last one. */
+static void image_put(struct exec_image* img) {
+  bool last;
+
+  lock_acquire(&image_cache_lock);
+  last = --img->ref_cnt == 0;
+  lock_release(&image_cache_lock);
+  if (last) image_free(img);
+}
+
+/* Takes IMG out of the cache, with image_cache_lock held.  It is freed
+   once the last load using it lets go. */
+static void image_evict(struct exec_image* img) {
+  list_remove(&img->elem);
+  image_cache_cnt--;
+  if (--img->ref_cnt == 0) image_free(img);
+}
+
+/* Reads and validates the headers of executable FILE.  Returns the
+   new image with one reference, for the caller, or NULL if FILE is
+   not a loadable executable or memory is short. */
+static struct exec_image* image_parse(struct file* file) {
+  struct Elf32_Ehdr ehdr;
+  struct exec_image* img;
+  off_t file_ofs;
+  int i;
 
   /* Read and verify executable header. */
-  if (file_read(file, &ehdr, sizeof ehdr) != sizeof ehdr ||
+  if (file_read_at(file, &ehdr, sizeof ehdr, 0) != sizeof ehdr ||
       memcmp(ehdr.e_ident, "\177ELF\1\1\1", 7) || ehdr.e_type != 2 ||
       ehdr.e_machine != 3 || ehdr.e_version != 1 ||
-      ehdr.e_phentsize != sizeof(struct Elf32_Phdr) || ehdr.e_phnum > 1024) {
-    printf("load: %s: error loading executable\n", file_name);
-    goto done;
+      ehdr.e_phentsize != sizeof(struct Elf32_Phdr) || ehdr.e_phnum > 1024)
+    return NULL;
+
+  img = calloc(1, sizeof *img);
+  if (img == NULL) return NULL;
+  img->ref_cnt = 1;
+  img->entry = (void (*)(void))ehdr.e_entry;
+  if (ehdr.e_phnum > 0) {
+    img->segs = malloc(ehdr.e_phnum * sizeof *img->segs);
+    if (img->segs == NULL) goto fail;
   }
 
   /* Read program headers. */
@@ -413,10 +851,9 @@ bool load(const char* file_name, void (**eip)(void), void** esp) {
   for (i = 0; i < ehdr.e_phnum; i++) {
     struct Elf32_Phdr phdr;
 
-    if (file_ofs < 0 || file_ofs > file_length(file)) goto done;
-    file_seek(file, file_ofs);
-
-    if (file_read(file, &phdr, sizeof phdr) != sizeof phdr) goto done;
+    if (file_ofs < 0 || file_ofs > file_length(file)) goto fail;
+    if (file_read_at(file, &phdr, sizeof phdr, file_ofs) != sizeof phdr)
+      goto fail;
     file_ofs += sizeof phdr;
     switch (phdr.p_type) {
       case PT_NULL:
@@ -429,46 +866,157 @@ bool load(const char* file_name, void (**eip)(void), void** esp) {
       case PT_DYNAMIC:
       case PT_INTERP:
       case PT_SHLIB:
-        goto done;
+        goto fail;
       case PT_LOAD:
         if (validate_segment(&phdr, file)) {
-          bool writable = (phdr.p_flags & PF_W) != 0;
-          t->data_segment_start = (void*)phdr.p_vaddr;
-          uint32_t file_page = phdr.p_offset & ~PGMASK;
-          uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+          struct exec_segment* seg = &img->segs[img->seg_cnt++];
           uint32_t page_offset = phdr.p_vaddr & PGMASK;
-          uint32_t read_bytes, zero_bytes;
+          seg->writable = (phdr.p_flags & PF_W) != 0;
+          seg->file_page = phdr.p_offset & ~PGMASK;
+          seg->mem_page = phdr.p_vaddr & ~PGMASK;
           if (phdr.p_filesz > 0) {
             /* Normal segment.
                Read initial part from disk and zero the rest. */
-            read_bytes = page_offset + phdr.p_filesz;
-            zero_bytes =
-                (ROUND_UP(page_offset + phdr.p_memsz, PGSIZE) - read_bytes);
+            seg->read_bytes = page_offset + phdr.p_filesz;
+            seg->zero_bytes = (ROUND_UP(page_offset + phdr.p_memsz, PGSIZE) -
+                               seg->read_bytes);
           } else {
             /* Entirely zero.
                Don't read anything from disk. */
-            read_bytes = 0;
-            zero_bytes = ROUND_UP(page_offset + phdr.p_memsz, PGSIZE);
+            seg->read_bytes = 0;
+            seg->zero_bytes = ROUND_UP(page_offset + phdr.p_memsz, PGSIZE);
           }
-          if (!load_segment(file, file_page, (void*)mem_page, read_bytes,
-                            zero_bytes, writable))
-            goto done;
+          img->data_segment_start = (void*)phdr.p_vaddr;
         } else
-          goto done;
+          goto fail;
         break;
     }
   }
+  return img;
 
-  /* Set up stack. */
-  if (!setup_stack(esp)) goto done;
+fail:
+  free(img->segs);
+  free(img);
+  return NULL;
+}
+
+/* Returns the image of executable FILE, from the cache if it is
+   there and still current, or else parsed afresh and cached.  The
+   caller must image_put() it.  Returns NULL if FILE is not a
+   loadable executable. */
+static struct exec_image* image_get(struct file* file) {
+  struct inode* inode = file_get_inode(file);
+  unsigned generation = inode_generation(inode);
+  struct exec_image* img;
+  struct list_elem* e;
+
+  lock_acquire(&image_cache_lock);
+  for (e = list_begin(&image_cache); e != list_end(&image_cache);) {
+    img = list_entry(e, struct exec_image, elem);
+    e = list_next(e);
+    if (img->inode == inode && img->generation == generation) {
+      list_remove(&img->elem);
+      list_push_front(&image_cache, &img->elem);
+      img->ref_cnt++;
+      lock_release(&image_cache_lock);
+      return img;
+    }
+    if (img->inode == inode || inode_is_removed(img->inode))
+      image_evict(img);
+  }
+  lock_release(&image_cache_lock);
+
+  img = image_parse(file);
+  if (img == NULL) return NULL;
+  img->inode = inode_reopen(inode);
+  img->generation = generation;
+
+  lock_acquire(&image_cache_lock);
+  for (e = list_begin(&image_cache); e != list_end(&image_cache);) {
+    struct exec_image* old = list_entry(e, struct exec_image, elem);
+    e = list_next(e);
+    // Another load may have parsed the same file meanwhile.
+    if (old->inode == inode) image_evict(old);
+  }
+  if (image_cache_cnt == IMAGE_CACHE_SIZE)
+    image_evict(list_entry(list_back(&image_cache), struct exec_image, elem));
+  list_push_front(&image_cache, &img->elem);
+  image_cache_cnt++;
+  img->ref_cnt++;
+  lock_release(&image_cache_lock);
+  return img;
+}
+
+/* Loads the ELF executable named by ARGS' first argument into the
+   current thread, with ARGS on its stack.
+   Stores the executable's entry point into *EIP
+   and its initial stack pointer into *ESP.
+   Returns true if successful, false otherwise. */
+bool load(const struct exec_args* args, void (**eip)(void), void** esp) {
+  const char* file_name = args->strings;
+  struct thread* t = thread_current();
+  struct exec_image* img = NULL;
+  struct file* file = NULL;
+  bool success = false;
+  size_t i;
+
+  /* Init SPT, which is per-process. */
+  SPT_init();
+  scstat_init();
+  sctrace_init();
+
+  /* Allocate and activate page directory. */
+  t->pagedir = pagedir_create();
+  if (t->pagedir == NULL) goto done;
+  process_activate();
+
+  /* Open executable file. */
+  file = filesys_open(file_name);
+  if (file == NULL) {
+    printf("load: %s: open failed\n", file_name);
+    file_close(file);
+    goto done;
+  }
+
+  /* Parse the headers, or find them already parsed. */
+  img = image_get(file);
+  if (img == NULL) {
+    printf("load: %s: error loading executable\n", file_name);
+    goto done;
+  }
+
+  /* Describe each segment in the SPT. */
+  for (i = 0; i < img->seg_cnt; i++) {
+    const struct exec_segment* seg = &img->segs[i];
+    if (!load_segment(file, seg->file_page, (void*)seg->mem_page,
+                      seg->read_bytes, seg->zero_bytes, seg->writable))
+      goto done;
+    // The heap starts after the highest segment.
+    uint8_t* seg_end =
+        (uint8_t*)(seg->mem_page + seg->read_bytes + seg->zero_bytes);
+    if (seg_end > t->heap_start) t->heap_start = seg_end;
+  }
+  if (img->seg_cnt > 0) t->data_segment_start = img->data_segment_start;
+
+  /* Set up stack, with the arguments on it. */
+  if (!setup_stack(args, esp)) goto done;
+
+  /* Set up an empty heap, for sbrk() to grow. */
+  t->heap_brk = t->heap_start;
+  if (!SPT_insert_region(NULL, 0, t->heap_start, 0, 0, true, FOR_ANON))
+    goto done;
 
   /* Start address. */
-  *eip = (void (*)(void))ehdr.e_entry;
+  *eip = img->entry;
+
+  /* Map what earlier runs faulted in right after starting. */
+  replay_exec(file);
 
   success = true;
 
 done:
   /* We arrive here whether the load is successful or not. */
+  if (img != NULL) image_put(img);
 
   /* Instead of closing the file, save the file pointer and
      prevent from writing the file.
@@ -547,70 +1095,47 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage,
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(ofs % PGSIZE == 0);
 
-  file_seek(file, ofs);
-  while (read_bytes > 0 || zero_bytes > 0) {
-    /* Calculate how to fill this page.
-       We will read PAGE_READ_BYTES bytes from FILE
-       and zero the final PAGE_ZERO_BYTES bytes. */
-    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-    size_t page_zero_bytes = PGSIZE - page_read_bytes;
-    /*
-
-    // Get a page of memory.
-    uint8_t* kpage = frame_alloc(PAL_USER);
-    // uint8_t* kpage = palloc_get_page(PAL_USER);
-    // frame_add(upage, kpage);
-    if (kpage == NULL) return false;
-
-    // Load this page.
-    if (file_read(file, kpage, page_read_bytes) != (int)page_read_bytes) {
-      frame_free(kpage);
-      return false;
-    }
-    memset(kpage + page_read_bytes, 0, page_zero_bytes);
+  /* Pages are read in on first fault; only describe the range here. */
+  return SPT_insert_region(file, ofs, upage, read_bytes, zero_bytes, writable,
+                           FOR_FILE);
+}
 
-    // Add the page to the process's address space.
-    if (!install_page(upage, kpage, writable)) {
+/* Create a minimal stack by mapping zeroed pages at the top of
+   user virtual memory, as many as ARGS take, and lay ARGS out on
+   it for main(): the packed strings at the very top, then, word
+   aligned, argv[] with its null sentinel, argv, argc and a fake
+   return address, where *ESP is left pointing. */
+static bool setup_stack(const struct exec_args* args, void** esp) {
+  struct thread* t = thread_current();
+  char* ustrings = (char*)PHYS_BASE - args->size;
+  char** uargv = (char**)ROUND_DOWN((uintptr_t)ustrings, sizeof(char*)) -
+                 (args->argc + 1);
+  uint32_t* sp = (uint32_t*)uargv - 3;
+  size_t page_cnt = DIV_ROUND_UP((uint8_t*)PHYS_BASE - (uint8_t*)sp, PGSIZE);
+  size_t i;
+  int k;
+
+  for (i = 0; i < page_cnt; i++) {
+    void* upage = (uint8_t*)PHYS_BASE - (i + 1) * PGSIZE;
+    uint8_t* kpage =
+        frame_alloc(PAL_USER | PAL_ZERO, t, upage, false)->frame_addr;
+    if (kpage == NULL) return false;
+    if (!install_page(upage, kpage, true)) {
       frame_free(kpage);
       return false;
     }
-
-    */
-
-    /* Insert page info to SPT. */
-    SPT_insert(file, ofs, upage, NULL, page_read_bytes, page_zero_bytes,
-               writable, FOR_FILE);
-
-    /* Advance. */
-    ofs += page_read_bytes;
-    read_bytes -= page_read_bytes;
-    zero_bytes -= page_zero_bytes;
-    upage += PGSIZE;
+    SPT_insert(NULL, 0, upage, kpage, 0, PGSIZE, true, FOR_STACK);
   }
-  return true;
-}
-
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
-static bool setup_stack(void** esp) {
-  // printf("[DEBUG] esp = %p, PHYS_BASE = %p\n", esp, PHYS_BASE);
-  uint8_t* kpage;
-  void* upage = ((uint8_t*)PHYS_BASE) - PGSIZE;
-  bool success = false;
 
-  kpage = frame_alloc(PAL_USER | PAL_ZERO, false);
-  // kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-  if (kpage != NULL) {
-    success = install_page(upage, kpage, true);
-    if (success) {
-      *esp = PHYS_BASE;
-      SPT_insert(NULL, 0, upage, kpage, 0, PGSIZE, true, FOR_STACK);
-    } else {
-      // palloc_free_page(kpage);
-      frame_free(kpage);
-    }
-  }
-  return success;
+  // One copy for all of the strings, then one pointer per argument.
+  memcpy(ustrings, args->strings, args->size);
+  for (k = 0; k < args->argc; k++) uargv[k] = ustrings + args->ofs[k];
+  uargv[args->argc] = NULL;
+  sp[2] = (uint32_t)uargv;
+  sp[1] = args->argc;
+  sp[0] = 0;
+  *esp = sp;
+  return true;
 }
 
 /* Adds a mapping from user virtual address UPAGE to kernel
@@ -3,9 +3,28 @@
 
 #include "threads/thread.h"
 
+/* Longest command line a process can be started with, in pages,
+   including its null terminator.  Longer ones are cut short. */
+#define CMDLINE_MAX_PAGES 32
+
+/* Stacks for threads started by thread_spawn() without a stack of
+   their own are carved out of the stack region, below the top
+   THREAD_STACK_MAIN bytes left to the main thread, THREAD_STACK_SIZE
+   bytes each.  They grow on demand like the main stack. */
+#define THREAD_STACK_MAIN (4 * 1024 * 1024)
+#define THREAD_STACK_SIZE (256 * 1024)
+#define THREAD_STACK_SLOTS 16
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_fork (void);
+tid_t process_restore (const char *file_name);
+tid_t process_thread_spawn (void *entry, void *arg, void *stack);
 int process_wait (tid_t);
+tid_t process_wait_any (int *status, bool block);
 void process_exit (void);
+bool process_dying (void);
+bool process_reap (struct thread *);
 void process_activate (void);
 
 #endif /* userprog/process.h */
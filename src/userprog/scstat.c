@@ -0,0 +1,80 @@
+#include "userprog/scstat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "userprog/syscall.h"
+
+bool scstat_at_exit;
+
+// Counters for every process since boot.  Like vm_stats they are
+// bumped without locking.
+static struct sc_stats scstat_global;
+
+void scstat_init(void) {
+  struct thread* t = process_current();
+
+  // Without memory for them, the process just goes uncounted.
+  if (t->sc_stats == NULL) t->sc_stats = malloc(sizeof *t->sc_stats);
+  if (t->sc_stats != NULL) memset(t->sc_stats, 0, sizeof *t->sc_stats);
+}
+
+// Print the nonzero counters in S, each line prefixed with WHO.
+static void print_stats(const char* who, const struct sc_stats* s) {
+  unsigned nr;
+
+  for (nr = 0; nr < SCSTAT_CNT; nr++) {
+    const struct sc_stat* c = &s->sc[nr];
+    uint64_t returned = c->calls;
+
+    if (c->calls == 0) continue;
+    // Calls that never came back have no cycles to average over.
+    if (nr == SYS_EXIT || nr == SYS_HALT) returned = 0;
+    printf("%s: %-16s %llu calls, %llu errors, %llu avg ns, %llu max\n",
+           who, syscall_name(nr), c->calls, c->errors,
+           returned != 0 ? clock_cycles_to_ns(c->cycles / returned) : 0,
+           clock_cycles_to_ns(c->max_cycles));
+  }
+}
+
+void scstat_exit(void) {
+  struct thread* t = process_current();
+
+  if (t->sc_stats == NULL) return;
+  if (scstat_at_exit) print_stats(t->name, t->sc_stats);
+  free(t->sc_stats);
+  t->sc_stats = NULL;
+}
+
+void scstat_begin(unsigned nr) {
+  struct sc_stats* proc = process_current()->sc_stats;
+
+  scstat_global.sc[nr].calls++;
+  if (proc != NULL) proc->sc[nr].calls++;
+}
+
+// Add a call of CYCLES cycles that returned RESULT to C.
+static void add(struct sc_stat* c, uint32_t result, uint64_t cycles) {
+  if (result == (uint32_t)-1) c->errors++;
+  c->cycles += cycles;
+  if (cycles > c->max_cycles) c->max_cycles = cycles;
+}
+
+void scstat_end(unsigned nr, uint32_t result, uint64_t cycles) {
+  struct sc_stats* proc = process_current()->sc_stats;
+
+  add(&scstat_global.sc[nr], result, cycles);
+  if (proc != NULL) add(&proc->sc[nr], result, cycles);
+}
+
+const struct sc_stats* scstat_get(bool all) {
+  return all ? &scstat_global : process_current()->sc_stats;
+}
+
+void scstat_print(void) {
+  print_stats("Syscall", &scstat_global);
+}
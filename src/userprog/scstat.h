@@ -0,0 +1,31 @@
+#ifndef USERPROG_SCSTAT_H
+#define USERPROG_SCSTAT_H
+
+#include <scstat.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// If true, each process prints its system call statistics at exit.
+// Controlled by kernel command-line option "-scstat".
+extern bool scstat_at_exit;
+
+// Give the current process a zeroed set of counters.
+void scstat_init(void);
+
+// Print and free the current process's counters.
+void scstat_exit(void);
+
+// Record the start of system call NR.
+void scstat_begin(unsigned nr);
+
+// Record that system call NR returned RESULT after CYCLES cycles.
+void scstat_end(unsigned nr, uint32_t result, uint64_t cycles);
+
+// Return the current process's counters, or with ALL the global ones.
+// A process that could not get counters has none, so this may be NULL.
+const struct sc_stats* scstat_get(bool all);
+
+// Print the global counters, for the shutdown report.
+void scstat_print(void);
+
+#endif /* userprog/scstat.h */
@@ -0,0 +1,129 @@
+#include "userprog/sctrace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+
+const char* sctrace_prog;
+
+// Calls a process's ring holds; older ones are overwritten.
+#define SCTRACE_RECS 1024
+
+struct sctrace {
+  uint64_t cnt;  // calls recorded, including overwritten ones
+  struct sctrace_rec recs[SCTRACE_RECS];
+};
+
+void sctrace_init(void) {
+  struct thread* t = process_current();
+
+  if (sctrace_prog == NULL || strcmp(t->name, sctrace_prog)) return;
+  // Without memory for it, the process just goes untraced.
+  if (t->sctrace == NULL) t->sctrace = malloc(sizeof *t->sctrace);
+  if (t->sctrace != NULL) t->sctrace->cnt = 0;
+}
+
+// Write the CNT bytes at BUF to FILE, returning false if they did not
+// all fit
+static bool write_all(struct file* file, const void* buf, size_t cnt) {
+  return file_write(file, buf, cnt) == (off_t)cnt;
+}
+
+void sctrace_exit(void) {
+  struct thread* t = process_current();
+  struct sctrace* tr = t->sctrace;
+  struct sctrace_header h;
+  struct file* file;
+  char name[16];
+  uint64_t i;
+
+  if (tr == NULL) return;
+  t->sctrace = NULL;
+
+  h.magic = SCTRACE_MAGIC;
+  h.rec_cnt = tr->cnt < SCTRACE_RECS ? tr->cnt : SCTRACE_RECS;
+  h.dropped = tr->cnt - h.rec_cnt;
+  h.ns_per_mcycle = clock_cycles_to_ns(1000000);
+  snprintf(name, sizeof name, "trace.%d", t->tid);
+  file = filesys_create(name, 0) ? filesys_open(name) : NULL;
+  if (file == NULL) {
+    printf("%s: sctrace: cannot create %s\n", t->name, name);
+    free(tr);
+    return;
+  }
+  bool ok = write_all(file, &h, sizeof h);
+  for (i = tr->cnt - h.rec_cnt; ok && i < tr->cnt; i++)
+    ok = write_all(file, &tr->recs[i % SCTRACE_RECS], sizeof *tr->recs);
+  file_close(file);
+  if (!ok) printf("%s: sctrace: %s is short, disk full\n", t->name, name);
+  free(tr);
+}
+
+// Copy the start of the string at user address USTR into PATH, which
+// is left empty if USTR is not readable
+static void copy_path(char* path, const char* ustr) {
+  size_t len = 0;
+
+  while (len < SCTRACE_PATH - 1) {
+    const char* chunk = ustr + len;
+    size_t n = (const char*)pg_round_down(chunk) + PGSIZE - chunk;
+    if (n > SCTRACE_PATH - 1 - len) n = SCTRACE_PATH - 1 - len;
+    if (!copy_from_user(path + len, chunk, n)) {
+      len = 0;
+      break;
+    }
+    if (memchr(path + len, '\0', n) != NULL) return;
+    len += n;
+  }
+  path[len] = '\0';
+}
+
+uint64_t sctrace_begin(unsigned nr, const uint32_t* args, size_t cnt) {
+  struct sctrace* tr = process_current()->sctrace;
+  struct sctrace_rec* r;
+  enum intr_level old_level;
+  uint64_t handle;
+
+  if (tr == NULL) return 0;
+  // Threads of one process share the ring.
+  old_level = intr_disable();
+  handle = tr->cnt++;
+  intr_set_level(old_level);
+
+  r = &tr->recs[handle % SCTRACE_RECS];
+  memset(r, 0, sizeof *r);
+  r->nr = nr;
+  if (cnt > SCTRACE_ARGS) cnt = SCTRACE_ARGS;
+  memcpy(r->args, args, cnt * sizeof *args);
+  r->tsc = rdtsc();
+  switch (nr) {
+    case SYS_EXEC:
+    case SYS_SPAWN:
+    case SYS_CREATE:
+    case SYS_REMOVE:
+    case SYS_OPEN:
+    case SYS_CHDIR:
+    case SYS_MKDIR:
+      copy_path(r->path, (const char*)args[0]);
+      break;
+  }
+  return handle;
+}
+
+void sctrace_end(uint64_t handle, uint32_t result, uint64_t cycles) {
+  struct sctrace* tr = process_current()->sctrace;
+
+  // The ring may have come around to this slot again meanwhile.
+  if (tr == NULL || tr->cnt - handle > SCTRACE_RECS) return;
+  tr->recs[handle % SCTRACE_RECS].result = result;
+  tr->recs[handle % SCTRACE_RECS].cycles = cycles;
+}
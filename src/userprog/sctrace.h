@@ -0,0 +1,26 @@
+#ifndef USERPROG_SCTRACE_H
+#define USERPROG_SCTRACE_H
+
+#include <sctrace.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Name of the program whose processes record a system call trace,
+// or NULL.  Set by kernel command-line option "-sctrace=PROG".
+extern const char* sctrace_prog;
+
+// Give the current process a trace ring if it runs sctrace_prog.
+void sctrace_init(void);
+
+// Write the current process's trace to "trace.TID" in its working
+// directory and free the ring.
+void sctrace_exit(void);
+
+// Record the entry of system call NR with the CNT words in ARGS.
+// Returns a handle for sctrace_end().
+uint64_t sctrace_begin(unsigned nr, const uint32_t* args, size_t cnt);
+
+// Record that the call behind HANDLE returned RESULT after CYCLES.
+void sctrace_end(uint64_t handle, uint32_t result, uint64_t cycles);
+
+#endif /* userprog/sctrace.h */
@@ -1,183 +1,921 @@
 #include "userprog/syscall.h"
 
+#include <bitmap.h>
 #include <hash.h>
+#include <limits.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 
+#include "devices/block.h"
+#include "devices/ide.h"
+#include "devices/input.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/alloctrack.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/pollq.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/tunable.h"
 #include "threads/vaddr.h"
+#include "userprog/fdtable.h"
+#include "userprog/futex.h"
 #include "userprog/pagedir.h"
+#include "userprog/pipe.h"
 #include "userprog/process.h"
+#include "userprog/scstat.h"
+#include "userprog/sctrace.h"
 #include "vm/frame.h"
 #include "vm/mmap.h"
 #include "vm/page.h"
-
-static void syscall_handler(struct intr_frame*);
+#include "vm/shm.h"
+#include "vm/snapshot.h"
+#include "vm/swap.h"
+#include "vm/vmstat.h"
 
 void syscall_init(void) {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
+  futex_init();
 }
 
 void exit(int status) {
-  printf("%s: exit(%d)\n", thread_name(), status);
+  // Only the end of a whole process is reported.
+  if (process_current() == thread_current())
+    printf("%s: exit(%d)\n", thread_name(), status);
   thread_current()->exit_status = status;
+  // Killed while it had the SPT locked, by a bad access or a failed
+  // check: the process's other threads still need it.
+  if (lock_held_by_current_thread(&process_current()->SPT_lock))
+    lock_release(&process_current()->SPT_lock);
   thread_exit();
 }
 
+/* Return the file the current process has open as FD, or NULL.  A
+   file returned stays open, even if another thread closes FD, until
+   fd_put(FD) */
+static struct file* fd_file(int fd) {
+  return fd_table_get(&process_current()->fd_table, fd);
+}
+
+/* Return the pipe the current process has open as FD, or NULL.  Pipe
+   ends only go one way: a write end does not read, nor a read end
+   write.  As with fd_file(), a pipe returned stays open until
+   fd_put(FD) */
+static struct pipe* fd_pipe(int fd, bool writer) {
+  struct fd_table* ft = &process_current()->fd_table;
+  bool is_writer;
+  struct pipe* p = fd_table_get_pipe(ft, fd, &is_writer);
+
+  if (p != NULL && is_writer != writer) {
+    fd_table_put(ft, fd);
+    p = NULL;
+  }
+  return p;
+}
+
+/* Give back FD, found by fd_file() or fd_pipe() */
+static void fd_put(int fd) { fd_table_put(&process_current()->fd_table, fd); }
+
+/* Read entries of the directory open as FD into BUFFER, as many
+   struct dirent as fit in SIZE bytes, up to a page's worth.  With
+   GETDENTS_STAT in FLAGS, each also gets its file's size and whether
+   it is a directory.  Returns the number of entries read, 0 at the
+   end of the directory, or -1 if FD is not a directory */
+int getdents(int fd, struct dirent* buffer, unsigned size, int flags) {
+  struct dir* dir = fd_table_get_dir(&process_current()->fd_table, fd);
+  size_t cnt = size / sizeof *buffer, n, i;
+  struct dir_info* info;
+  struct dirent* ents;
+
+  if (dir == NULL) return -1;
+  if (cnt > PGSIZE / sizeof *ents) cnt = PGSIZE / sizeof *ents;
+  if (cnt == 0 || !validate_user_range(buffer, cnt * sizeof *buffer, true)) {
+    fd_put(fd);
+    if (cnt == 0) return 0;
+    exit(-1);
+  }
+
+  ents = palloc_get_page(0);
+  info = malloc(cnt * sizeof *info);
+  if (ents == NULL || info == NULL) {
+    fd_put(fd);
+    palloc_free_page(ents);
+    free(info);
+    return -1;
+  }
+  n = filesys_read_dir(dir, info, cnt);
+  fd_put(fd);
+  for (i = 0; i < n; i++) {
+    struct dirent* e = &ents[i];
+
+    e->d_ino = info[i].inumber;
+    e->d_size = 0;
+    // The root is the only directory, and no entry names it.
+    e->d_isdir = info[i].inumber == ROOT_DIR_SECTOR;
+    strlcpy(e->d_name, info[i].name, sizeof e->d_name);
+    if (flags & GETDENTS_STAT) {
+      struct inode* inode = inode_open(info[i].inumber);
+      if (inode != NULL) e->d_size = inode_length(inode);
+      inode_close(inode);
+    }
+  }
+  free(info);
+  if (!copy_to_user(buffer, ents, n * sizeof *ents)) {
+    palloc_free_page(ents);
+    exit(-1);
+  }
+  palloc_free_page(ents);
+  return n;
+}
+
+/* Open a pipe, storing the descriptor of its read end in FDS[0] and
+   of its write end in FDS[1].  Returns 0, or -1 if out of memory or
+   descriptors */
+int pipe(int* fds) {
+  struct fd_table* ft = &process_current()->fd_table;
+  struct pipe* p;
+  int kfds[2];
+
+  if (!validate_user_range(fds, sizeof kfds, true)) exit(-1);
+  p = pipe_create();
+  if (p == NULL) return -1;
+  kfds[0] = fd_table_insert_pipe(ft, p, false);
+  if (kfds[0] < 0) {
+    pipe_close(p, false);
+    pipe_close(p, true);
+    return -1;
+  }
+  kfds[1] = fd_table_insert_pipe(ft, p, true);
+  if (kfds[1] < 0) {
+    fd_table_close(ft, kfds[0]);
+    pipe_close(p, true);
+    return -1;
+  }
+  if (!copy_to_user(fds, kfds, sizeof kfds)) exit(-1);
+  return 0;
+}
+
 int open(const char* file) {
-  struct file** fd_table = thread_current()->fd_table;
-  lock_acquire(&filesys_lock);
+  struct dir* dir = filesys_open_dir(file);
+  if (dir != NULL) {
+    int fd = fd_table_insert_dir(&process_current()->fd_table, dir);
+    if (fd < 0) dir_close(dir);
+    return fd;
+  }
+
   struct file* f = filesys_open(file);
   if (f == NULL) {
-    lock_release(&filesys_lock);
     return -1;  // error
   }
 
-  int i;
-  for (i = 2; i < 130; i++) {
-    if (fd_table[i] == NULL) {
-      fd_table[i] = f;
-      lock_release(&filesys_lock);
-      return i;
-    }
-  }
-  lock_release(&filesys_lock);
-  return -1;
+  int fd = fd_table_insert(&process_current()->fd_table, f);
+  if (fd < 0) file_close(f);
+  return fd;
 }
 
 int filesize(int fd) {
-  struct file** fd_table = thread_current()->fd_table;
-  if (fd < 2 || fd >= FD_TABLE_SIZE || fd_table[fd] == NULL) {
+  struct file* f = fd_file(fd);
+  if (f == NULL) {
     exit(-1);
     return -1;
   }
-  struct file* f = fd_table[fd];
-  if (f == NULL) {
-    return -1;  // error
-  }
-  lock_acquire(&filesys_lock);
   int ret = file_length(f);
-  lock_release(&filesys_lock);
+  fd_put(fd);
   return ret;
 }
 
 int read(int fd, void* buffer, unsigned size) {
-  if (fd < 0 || fd == 1 || fd >= FD_TABLE_SIZE) {
+  if (fd < 0 || fd == 1 || fd >= FD_MAX) {
+    exit(-1);
+    return -1;
+  }
+  if (!validate_user_range(buffer, size, true)) {
     exit(-1);
     return -1;
   }
-  int j;
-  for (j = 0; j < size; j++) touch_addr(buffer + j);
 
-  lock_acquire(&filesys_lock);
-  if (fd == 0) {
-    int i;
-    int* buffer_c = buffer;
-    for (i = 0; i < size; i++) buffer_c[i] = input_getc();
-    lock_release(&filesys_lock);
-    return size;
+  // Whole pages that the page cache holds, read into whole pages of
+  // the buffer, are mapped there copy-on-write instead of copied.
+  struct file* f = fd != 0 ? fd_file(fd) : NULL;
+  unsigned lent = 0;
+  if (f != NULL && pg_ofs(buffer) == 0 && size >= PGSIZE)
+    lent = file_read_lend(f, buffer, size);
+  buffer = (uint8_t*)buffer + lent;
+  size -= lent;
+
+  // Pin the rest of the buffer so the read below cannot fault halfway
+  // through or have its pages evicted under it.
+  if (!frame_pin_range(buffer, size, true)) {
+    if (f != NULL) fd_put(fd);
+    exit(-1);
+    return -1;
   }
 
-  struct file** fd_table = thread_current()->fd_table;
-  struct file* f = fd_table[fd];
-  if (f == NULL) {
-    lock_release(&filesys_lock);
-    return -1;  // error
+  int ret;
+  if (fd == 0) {
+    unsigned i;
+    uint8_t* buffer_c = buffer;
+    for (i = 0; i < size; i++) buffer_c[i] = input_getc();
+    ret = size;
+  } else {
+    struct pipe* p = f == NULL ? fd_pipe(fd, false) : NULL;
+    ret = p != NULL   ? pipe_read(p, buffer, size)
+          : f != NULL ? file_read(f, buffer, size)
+                      : -1;
+    if (p != NULL || f != NULL) fd_put(fd);
   }
-  int ret = file_read(f, buffer, size);
-  lock_release(&filesys_lock);
+  frame_unpin_range(buffer, size);
+  if (lent > 0) ret = ret > 0 ? (int)lent + ret : (int)lent;
   return ret;
 }
 
+int vmstat(struct vm_stats* stats) {
+  struct vm_stats snap;
+  vmstat_snapshot(&snap);
+  if (!copy_to_user(stats, &snap, sizeof snap)) exit(-1);
+  return 0;
+}
+
 int write(int fd, void* buffer, unsigned size) {
-  if (fd < 1 || fd >= FD_TABLE_SIZE) {
+  if (fd < 1 || fd >= FD_MAX) {
+    exit(-1);
+    return -1;
+  }
+  if (!validate_user_range(buffer, size, false) ||
+      !frame_pin_range(buffer, size, false)) {
     exit(-1);
     return -1;
   }
-  int j;
-  for (j = 0; j < size; j++) touch_addr(buffer + j);
 
-  lock_acquire(&filesys_lock);
+  int ret;
   if (fd == 1) {
     putbuf(buffer, size);
-    lock_release(&filesys_lock);
-    return size;
+    ret = size;
+  } else {
+    struct pipe* p = fd_pipe(fd, true);
+    struct file* f = p == NULL ? fd_file(fd) : NULL;
+    ret = p != NULL   ? pipe_write(p, buffer, size)
+          : f != NULL ? file_write(f, buffer, size)
+                      : -1;
+    if (p != NULL || f != NULL) fd_put(fd);
+  }
+  frame_unpin_range(buffer, size);
+  return ret;
+}
+
+/* Read SIZE bytes at OFFSET in file FD into BUFFER, leaving the
+   file position alone */
+int pread(int fd, void* buffer, unsigned size, unsigned offset) {
+  if (fd < 2 || fd >= FD_MAX) exit(-1);
+  if (!validate_user_range(buffer, size, true) ||
+      !frame_pin_range(buffer, size, true))
+    exit(-1);
+
+  struct file* f = fd_file(fd);
+  int ret = f != NULL ? file_read_at(f, buffer, size, offset) : -1;
+  if (f != NULL) fd_put(fd);
+  frame_unpin_range(buffer, size);
+  return ret;
+}
+
+/* Write SIZE bytes from BUFFER at OFFSET in file FD, leaving the
+   file position alone */
+int pwrite(int fd, void* buffer, unsigned size, unsigned offset) {
+  if (fd < 2 || fd >= FD_MAX) exit(-1);
+  if (!validate_user_range(buffer, size, false) ||
+      !frame_pin_range(buffer, size, false))
+    exit(-1);
+
+  struct file* f = fd_file(fd);
+  int ret = f != NULL ? file_write_at(f, buffer, size, offset) : -1;
+  if (f != NULL) fd_put(fd);
+  frame_unpin_range(buffer, size);
+  return ret;
+}
+
+/* Copy up to LEN bytes from file FD_IN to file FD_OUT, from and to
+   their current positions, inside the kernel */
+int copy_file_range(int fd_in, int fd_out, unsigned len) {
+  if (fd_in < 2 || fd_in >= FD_MAX || fd_out < 2 || fd_out >= FD_MAX)
+    exit(-1);
+  struct file* in = fd_file(fd_in);
+  struct file* out = fd_file(fd_out);
+  int ret = -1;
+  if (in != NULL && out != NULL)
+    ret = file_copy(out, in, len > INT_MAX ? INT_MAX : len);
+  if (in != NULL) fd_put(fd_in);
+  if (out != NULL) fd_put(fd_out);
+  return ret;
+}
+
+/* Reserve disk space for the first LENGTH bytes of file FD without
+   changing its size, so that writes there allocate nothing */
+int fallocate(int fd, unsigned length) {
+  if (fd < 2 || fd >= FD_MAX) exit(-1);
+  struct file* f = fd_file(fd);
+  if (f == NULL) return -1;
+  int ret = length <= INT_MAX && file_reserve(f, length) ? 0 : -1;
+  fd_put(fd);
+  return ret;
+}
+
+/* Write file FD's data and metadata to disk, returning once they
+   are there */
+int fsync(int fd) {
+  if (fd < 2 || fd >= FD_MAX) exit(-1);
+  struct file* f = fd_file(fd);
+  if (f == NULL) return -1;
+  file_sync(f);
+  fd_put(fd);
+  return 0;
+}
+
+/* Advise how LEN bytes of file FD from OFFSET will be read, with
+   one of the FADV_* values.  A LEN of 0 means to the end of the
+   file */
+int fadvise(int fd, unsigned offset, unsigned len, int advice) {
+  if (fd < 2 || fd >= FD_MAX) exit(-1);
+  struct file* f = fd_file(fd);
+  if (f == NULL) return -1;
+  struct inode* inode = file_get_inode(f);
+  off_t size = len == 0 || len > INT_MAX ? INT_MAX : (off_t)len;
+  int ret = 0;
+
+  switch (offset > INT_MAX ? -1 : advice) {
+    case FADV_NORMAL:
+      inode_set_access(inode, INODE_ACCESS_NORMAL);
+      break;
+    case FADV_RANDOM:
+      inode_set_access(inode, INODE_ACCESS_RANDOM);
+      break;
+    case FADV_SEQUENTIAL:
+      inode_set_access(inode, INODE_ACCESS_SEQUENTIAL);
+      break;
+    case FADV_WILLNEED:
+      inode_prefetch(inode, offset, size);
+      break;
+    case FADV_DONTNEED:
+      inode_drop_cache(inode, offset, size);
+      break;
+    default:
+      ret = -1;
+  }
+  fd_put(fd);
+  return ret;
+}
+
+/* Write everything the file system has cached to disk */
+void sync(void) { filesys_sync(); }
+
+/* Copy the name, setting and range of kernel tunable number IDX
+   out to INFO.  Returns -1 past the last tunable */
+int gettunable(int idx, struct tunable_info* info) {
+  struct tunable_info ti;
+
+  if (idx < 0 || !tunable_get(idx, &ti)) return -1;
+  if (!copy_to_user(info, &ti, sizeof ti)) exit(-1);
+  return 0;
+}
+
+/* Set kernel tunable NAME to VALUE.  Returns -1 if there is no
+   such tunable or VALUE is out of its range */
+int settunable(const char* name, int value) {
+  return tunable_set(name, value) ? 0 : -1;
+}
+
+/* Copy the statistics of the block device playing ROLE, one of
+   the BLKSTAT_* roles, out to STATS */
+int blkstat(int role, struct blk_stats* stats) {
+  struct blk_stats snap;
+  struct block* block;
+
+  if (role < BLKSTAT_KERNEL || role > BLKSTAT_SWAP) return -1;
+  block = block_get_role((enum block_type)role);
+  if (block == NULL) return -1;
+  block_get_stats(block, &snap);
+  if (!copy_to_user(stats, &snap, sizeof snap)) exit(-1);
+  return 0;
+}
+
+/* Copy the statistics in CATEGORY, one of the STATS_* categories,
+   out to the SIZE bytes at BUFFER, truncated if SIZE is too small.
+   Returns the size of the whole snapshot, or -1 if CATEGORY is
+   unknown or the device asked for does not exist */
+int stats(int category, void* buffer, unsigned size) {
+  union {
+    struct vm_stats vm;
+    struct cache_stats cache;
+    struct sched_stats sched;
+    struct blk_stats blk;
+    struct ide_stats ide;
+  } snap;
+  const void* src = &snap;
+  unsigned len;
+
+  switch (category) {
+    case STATS_VM:
+      vmstat_snapshot(&snap.vm);
+      len = sizeof snap.vm;
+      break;
+    case STATS_CACHE:
+      cache_get_stats(&snap.cache);
+      len = sizeof snap.cache;
+      break;
+    case STATS_SCHED:
+      thread_get_stats(&snap.sched);
+      len = sizeof snap.sched;
+      break;
+    case STATS_SYSCALL:
+      src = scstat_get(true);
+      len = sizeof(struct sc_stats);
+      break;
+    case STATS_IDE:
+      ide_get_stats(&snap.ide);
+      len = sizeof snap.ide;
+      break;
+    default: {
+      struct block* block;
+      if (category < STATS_BLOCK || category > STATS_BLOCK + BLKSTAT_SWAP)
+        return -1;
+      block = block_get_role((enum block_type)(category - STATS_BLOCK));
+      if (block == NULL) return -1;
+      block_get_stats(block, &snap.blk);
+      len = sizeof snap.blk;
+      break;
+    }
+  }
+  if (!copy_to_user(buffer, src, size < len ? size : len)) exit(-1);
+  return len;
+}
+
+/* Register RING, in the process's own memory, as its batched
+   syscall ring, or unregister with a null RING */
+int ring_setup(struct sys_ring* ring) {
+  struct sys_ring r;
+  if (ring != NULL && (!copy_from_user(&r, ring, sizeof r) || r.entries == 0))
+    return -1;
+  process_current()->sys_ring = ring;
+  return 0;
+}
+
+/* Run the operation SQE as the system call it names */
+static int ring_run(const struct ring_sqe* sqe) {
+  switch (sqe->op) {
+    case RING_OP_READ:
+      return read(sqe->fd, sqe->buf, sqe->len);
+    case RING_OP_WRITE:
+      return write(sqe->fd, sqe->buf, sqe->len);
+    case RING_OP_SEEK:
+      seek(sqe->fd, sqe->offset);
+      return 0;
+    case RING_OP_PREAD:
+      return pread(sqe->fd, sqe->buf, sqe->len, sqe->offset);
+    case RING_OP_PWRITE:
+      return pwrite(sqe->fd, sqe->buf, sqe->len, sqe->offset);
+    default:
+      return -1;
+  }
+}
+
+/* Run the operations queued on the registered ring in order, posting
+   each result, until none are left or the completion array is full.
+   Returns the number of operations run */
+int ring_enter(void) {
+  struct sys_ring* ring = process_current()->sys_ring;
+  struct sys_ring r;
+  int done = 0;
+
+  if (ring == NULL) return -1;
+  if (!copy_from_user(&r, ring, sizeof r)) exit(-1);
+  while (r.sq_head != r.sq_tail && r.cq_tail - r.cq_head < r.entries) {
+    struct ring_sqe sqe;
+    struct ring_cqe cqe;
+
+    if (!copy_from_user(&sqe, &r.sqes[r.sq_head % r.entries], sizeof sqe))
+      exit(-1);
+    cqe.user_data = sqe.user_data;
+    cqe.result = ring_run(&sqe);
+    if (!copy_to_user(&r.cqes[r.cq_tail % r.entries], &cqe, sizeof cqe))
+      exit(-1);
+    r.sq_head++;
+    r.cq_tail++;
+    done++;
+  }
+
+  // Only the kernel's own indices go back; the process owns the rest.
+  if (!copy_to_user(&ring->sq_head, &r.sq_head, sizeof r.sq_head) ||
+      !copy_to_user(&ring->cq_tail, &r.cq_tail, sizeof r.cq_tail))
+    exit(-1);
+  return done;
+}
+
+/* Store the nanoseconds since boot at NS. */
+int gettime(uint64_t* ns) {
+  uint64_t now = clock_ns();
+  if (!copy_to_user(ns, &now, sizeof now)) exit(-1);
+  return 0;
+}
+
+/* Sleep for at least MS milliseconds */
+void msleep(unsigned ms) { timer_msleep(ms); }
+
+/* Store the resources used by WHO, a RUSAGE_* value, in USAGE.
+   Returns -1 for an unknown WHO */
+int getrusage(int who, struct rusage* usage) {
+  struct thread* t = thread_current();
+  struct rusage u;
+
+  if (who == RUSAGE_SELF)
+    thread_process_rusage(t->proc, &u);
+  else if (who == RUSAGE_CHILDREN)
+    u = t->proc->child_rusage;
+  else if (who == RUSAGE_THREAD)
+    u = t->rusage;
+  else
+    return -1;
+  if (!copy_to_user(usage, &u, sizeof u)) exit(-1);
+  return 0;
+}
+
+/* Most descriptors one poll() watches. */
+#define POLL_MAX 256
+
+/* Return the poll events descriptor FD is ready for, out of EVENTS
+   and those always reported.  If E is nonnull and FD can block,
+   register E for poller W on what FD has open */
+static int fd_poll(int fd, int events, struct poll_entry* e,
+                   struct poll_wait* w) {
+  struct fd_table* ft = &process_current()->fd_table;
+  struct pipe* p;
+  bool writer;
+  int ready;
+
+  if (fd == STDIN_FILENO)
+    ready = input_poll(e, w) ? POLLIN : 0;
+  else if (fd == STDOUT_FILENO)
+    ready = POLLOUT;
+  else if (fd >= FD_MAX)
+    ready = POLLNVAL;
+  else if ((p = fd_table_get_pipe(ft, fd, &writer)) != NULL) {
+    ready = pipe_poll(p, writer, e, w);
+    fd_table_put(ft, fd);
+  } else if (fd_table_get(ft, fd) != NULL ||
+             fd_table_get_dir(ft, fd) != NULL) {
+    ready = POLLIN | POLLOUT;  // Files never block.
+    fd_table_put(ft, fd);
+  } else
+    ready = POLLNVAL;
+  return ready & (events | POLLERR | POLLHUP | POLLNVAL);
+}
+
+/* Wait until one of the N descriptors in FDS is ready for an event
+   it asks for, or for TIMEOUT milliseconds, forever if negative, and
+   store what each is ready for in its revents.  Sleeps on the
+   console, and on pipes, until something changes; files are always
+   ready.  Returns how many descriptors are ready, 0 on timeout, or
+   -1 if N is over POLL_MAX or memory is short */
+int poll(struct pollfd* fds, unsigned n, int timeout) {
+  struct pollfd* kfds;
+  struct poll_entry* entries;
+  struct poll_wait w;
+  unsigned i;
+  int ready;
+
+  if (n > POLL_MAX) return -1;
+  if (!validate_user_range(fds, n * sizeof *fds, true)) exit(-1);
+  // One more of each, so that a poll() of no descriptors, which just
+  // sleeps, gets memory too.
+  kfds = malloc((n + 1) * sizeof *kfds);
+  entries = calloc(n + 1, sizeof *entries);
+  if (kfds == NULL || entries == NULL) {
+    free(kfds);
+    free(entries);
+    return -1;
+  }
+  if (!copy_from_user(kfds, fds, n * sizeof *kfds)) {
+    free(kfds);
+    free(entries);
+    exit(-1);
+  }
+
+  poll_wait_init(&w, timeout < 0 ? -1
+                                 : DIV_ROUND_UP((int64_t)timeout * TIMER_FREQ,
+                                                1000));
+  for (;;) {
+    // Register before checking, so that no change in between is lost.
+    bool sleep = timeout != 0 && !w.expired;
+
+    ready = 0;
+    for (i = 0; i < n; i++) {
+      kfds[i].revents =
+          kfds[i].fd < 0 ? 0
+                         : fd_poll(kfds[i].fd, kfds[i].events,
+                                   sleep ? &entries[i] : NULL, &w);
+      if (kfds[i].revents != 0) ready++;
+    }
+    if (ready > 0 || !sleep) break;
+    poll_wait_sleep(&w);
+    for (i = 0; i < n; i++) poll_entry_remove(&entries[i]);
+  }
+  for (i = 0; i < n; i++) poll_entry_remove(&entries[i]);
+  poll_wait_done(&w);
+
+  if (!copy_to_user(fds, kfds, n * sizeof *kfds)) ready = -1;
+  free(kfds);
+  free(entries);
+  if (ready < 0) exit(-1);
+  return ready;
+}
+
+/* Set the calling thread's base priority to PRIORITY, or with PRI_RT
+   put it in the real-time class.  It may only go as high as the
+   thread's pri_limit, and only a process the kernel started may take
+   the real-time class.  Returns -1 if PRIORITY is out of range or
+   not allowed.  It is also -1 under -o mlfqs, where nice() is the
+   control, except that a normal priority takes a thread back out of
+   the real-time class */
+int setpriority(int priority) {
+  struct thread* t = thread_current();
+
+  if (priority == PRI_RT) {
+    if (t->pri_limit < PRI_MAX) return -1;
+  } else if (priority < PRI_MIN || priority > t->pri_limit ||
+             (thread_mlfqs && !t->rt))
+    return -1;
+  thread_set_priority(priority);
+  return 0;
+}
+
+/* Add INCREMENT to the calling thread's nice value, going no lower
+   than its nice_limit nor higher than NICE_MAX, and return the new
+   value */
+int nice(int increment) {
+  struct thread* t = thread_current();
+  int value = t->nice;
+
+  // Clamp before adding, so a huge INCREMENT cannot overflow.
+  if (increment < NICE_MIN - NICE_MAX) increment = NICE_MIN - NICE_MAX;
+  if (increment > NICE_MAX - NICE_MIN) increment = NICE_MAX - NICE_MIN;
+  value += increment;
+  if (value < t->nice_limit) value = t->nice_limit;
+  thread_set_nice(value);
+  return t->nice;
+}
+
+/* Copy the system call counters selected by WHICH, SCSTAT_SELF or
+   SCSTAT_ALL, out to STATS */
+
+int scstat(int which, struct sc_stats* stats) {
+  const struct sc_stats* s;
+
+  if (which != SCSTAT_SELF && which != SCSTAT_ALL) return -1;
+  s = scstat_get(which == SCSTAT_ALL);
+  if (s == NULL) return -1;
+  if (!copy_to_user(stats, s, sizeof *s)) exit(-1);
+  return 0;
+}
+
+/* Copy the IOVCNT buffer descriptors at user address UIOV into KIOV,
+   then validate and pin every buffer, for the kernel to write into
+   if WRITE.  Kills the process if any of them is bad. */
+static void iov_pin(struct iovec* kiov, const struct iovec* uiov, int iovcnt,
+                    bool write) {
+  int i;
+
+  if (!copy_from_user(kiov, uiov, iovcnt * sizeof *kiov)) exit(-1);
+  for (i = 0; i < iovcnt; i++)
+    if (!validate_user_range(kiov[i].iov_base, kiov[i].iov_len, write))
+      exit(-1);
+  for (i = 0; i < iovcnt; i++)
+    if (!frame_pin_range(kiov[i].iov_base, kiov[i].iov_len, write)) {
+      while (i-- > 0) frame_unpin_range(kiov[i].iov_base, kiov[i].iov_len);
+      exit(-1);
+    }
+}
+
+static void iov_unpin(const struct iovec* kiov, int iovcnt) {
+  int i;
+  for (i = 0; i < iovcnt; i++)
+    frame_unpin_range(kiov[i].iov_base, kiov[i].iov_len);
+}
+
+/* Total length of the IOVCNT buffers in IOV, or -1 if it does not
+   fit in an int */
+static int iov_total(const struct iovec* iov, int iovcnt) {
+  size_t total = 0;
+  int i;
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > (size_t)INT_MAX - total) return -1;
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/* Read into the IOVCNT buffers of IOV in turn, as a single read */
+int readv(int fd, const struct iovec* iov, int iovcnt) {
+  struct iovec kiov[IOV_MAX];
+  int ret, i;
+
+  if (fd < 0 || fd == 1 || fd >= FD_MAX) exit(-1);
+  if (iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+  iov_pin(kiov, iov, iovcnt, true);
+
+  if (iov_total(kiov, iovcnt) < 0)
+    ret = -1;
+  else if (fd == 0) {
+    ret = 0;
+    for (i = 0; i < iovcnt; i++) {
+      uint8_t* buffer_c = kiov[i].iov_base;
+      size_t j;
+      for (j = 0; j < kiov[i].iov_len; j++) buffer_c[j] = input_getc();
+      ret += kiov[i].iov_len;
+    }
   } else {
-    struct file** fd_table = thread_current()->fd_table;
-    struct file* f = fd_table[fd];
-    if (f == NULL) {
-      lock_release(&filesys_lock);
-      return -1;  // error
+    struct file* f = fd_file(fd);
+    ret = f != NULL ? file_readv(f, kiov, iovcnt) : -1;
+    if (f != NULL) fd_put(fd);
+  }
+  iov_unpin(kiov, iovcnt);
+  return ret;
+}
+
+/* Write the IOVCNT buffers of IOV in turn, as a single write */
+int writev(int fd, const struct iovec* iov, int iovcnt) {
+  struct iovec kiov[IOV_MAX];
+  int ret, i;
+
+  if (fd < 1 || fd >= FD_MAX) exit(-1);
+  if (iovcnt < 0 || iovcnt > IOV_MAX) return -1;
+  iov_pin(kiov, iov, iovcnt, false);
+
+  if (iov_total(kiov, iovcnt) < 0)
+    ret = -1;
+  else if (fd == 1) {
+    ret = 0;
+    for (i = 0; i < iovcnt; i++) {
+      putbuf(kiov[i].iov_base, kiov[i].iov_len);
+      ret += kiov[i].iov_len;
     }
-    int ret = file_write(f, buffer, size);
-    lock_release(&filesys_lock);
-    return ret;
+  } else {
+    struct file* f = fd_file(fd);
+    ret = f != NULL ? file_writev(f, kiov, iovcnt) : -1;
+    if (f != NULL) fd_put(fd);
   }
-  lock_release(&filesys_lock);
-  return -1;
+  iov_unpin(kiov, iovcnt);
+  return ret;
 }
 
 void seek(int fd, unsigned position) {
-  struct file** fd_table = thread_current()->fd_table;
-  if (fd < 2 || fd >= FD_TABLE_SIZE || fd_table[fd] == NULL) {
+  struct file* f = fd_file(fd);
+  if (f == NULL) {
     exit(-1);
     return -1;
   }
-  lock_acquire(&filesys_lock);
-  struct file* f = fd_table[fd];
   file_seek(f, position);
-  lock_release(&filesys_lock);
+  fd_put(fd);
 }
 
 unsigned tell(int fd) {
-  struct file** fd_table = thread_current()->fd_table;
-  if (fd < 2 || fd >= FD_TABLE_SIZE || fd_table[fd] == NULL) {
+  struct file* f = fd_file(fd);
+  if (f == NULL) {
     exit(-1);
     return -1;
   }
-  lock_acquire(&filesys_lock);
-  struct file* f = fd_table[fd];
   unsigned ret = file_tell(f);
-  lock_release(&filesys_lock);
+  fd_put(fd);
   return ret;
 }
 
 void close(int fd) {
-  struct file** fd_table = thread_current()->fd_table;
-  if (fd < 2 || fd >= FD_TABLE_SIZE || fd_table[fd] == NULL) {
-    exit(-1);
-    return;
-  } else {
-    lock_acquire(&filesys_lock);
-    file_close(fd_table[fd]);
-    fd_table[fd] = NULL;
-    lock_release(&filesys_lock);
-    return;
+  if (!fd_table_close(&process_current()->fd_table, fd)) exit(-1);
+}
+
+/* Reads a byte at user virtual address UADDR, which must be below
+   PHYS_BASE.  Returns the byte value, or -1 if the access faulted:
+   page_fault() then resumes at the address left in eax. */
+static int get_user(const uint8_t* uaddr) {
+  struct thread* t = thread_current();
+  int result;
+  t->in_uaccess = true;
+  asm volatile("movl $1f, %0; movzbl %1, %0; 1:" : "=&a"(result) : "m"(*uaddr));
+  t->in_uaccess = false;
+  return result;
+}
+
+/* Check that [UADDR, UADDR + SIZE) is user memory the process may
+   read, or also write if WRITE, faulting each page in by probing one
+   byte of it */
+bool validate_user_range(const void* uaddr, size_t size, bool write) {
+  const uint8_t* end = (const uint8_t*)uaddr + size;
+  const uint8_t* p;
+  bool locked, ok = true;
+
+  if (size == 0) return true;
+  if (end < (const uint8_t*)uaddr || !is_user_vaddr(end - 1)) return false;
+  locked = SPT_lock();
+  for (p = uaddr; ok && p < end;
+       p = (const uint8_t*)pg_round_down(p) + PGSIZE) {
+    if (get_user(p) == -1) ok = false;
+    // The kernel's writes ignore read-only PTEs, so check the SPT.
+    if (ok && write) {
+      struct page* pg = SPT_lookup(pg_round_down(p));
+      if (pg != NULL && !pg->is_writable) ok = false;
+    }
   }
+  SPT_unlock(locked);
+  return ok;
 }
 
-/* A function which checks if a virtual address is valid.
-   If not, the thread exits with exit code -1 */
-void check_valid(void* addr) {
-  uint32_t* current_pd = thread_current()->pagedir;
-  if (!addr || !is_user_vaddr(addr) || !pagedir_get_page(current_pd, addr)) {
-    exit(-1);
-    return;
+/* Copy SIZE bytes from user address USRC to KDST.  Returns false,
+   having copied nothing, if USRC is not readable user memory */
+bool copy_from_user(void* kdst, const void* usrc, size_t size) {
+  if (!validate_user_range(usrc, size, false)) return false;
+  // A page evicted since validation just faults back in.
+  memcpy(kdst, usrc, size);
+  return true;
+}
+
+/* Copy SIZE bytes from KSRC to user address UDST.  Returns false,
+   having copied nothing, if UDST is not writable user memory */
+bool copy_to_user(void* udst, const void* ksrc, size_t size) {
+  // Pinning gives zero pages frames of their own before the write.
+  if (!validate_user_range(udst, size, true) ||
+      !frame_pin_range(udst, size, true))
+    return false;
+  memcpy(udst, ksrc, size);
+  frame_unpin_range(udst, size);
+  return true;
+}
+
+/* Copy the string at user address USTR into new pages, as many as it
+   needs up to MAX_PAGES, and store how many in *PAGE_CNT.  The caller
+   must free them with palloc_free_multiple().  Longer strings are cut
+   short.  Returns NULL if USTR is not readable or memory is short */
+static char* copy_in_string_pages(const char* ustr, size_t max_pages,
+                                  size_t* page_cnt) {
+  size_t pages = 1;
+  char* kstr = palloc_get_page(0);
+  size_t len = 0;
+
+  if (kstr == NULL) return NULL;
+  for (;;) {
+    while (len < pages * PGSIZE - 1) {
+      // Copy up to the end of a page at a time: the string may end
+      // just before a page that is not mapped.
+      const char* chunk = ustr + len;
+      size_t n = (const char*)pg_round_down(chunk) + PGSIZE - chunk;
+      if (n > pages * PGSIZE - 1 - len) n = pages * PGSIZE - 1 - len;
+      if (!copy_from_user(kstr + len, chunk, n)) {
+        palloc_free_multiple(kstr, pages);
+        return NULL;
+      }
+      if (memchr(kstr + len, '\0', n) != NULL) {
+        *page_cnt = pages;
+        return kstr;
+      }
+      len += n;
+    }
+    if (pages == max_pages) break;
+
+    // Out of room: move to a run twice as long.
+    size_t more = pages * 2 < max_pages ? pages * 2 : max_pages;
+    char* bigger = palloc_get_multiple(0, more);
+    if (bigger == NULL) {
+      palloc_free_multiple(kstr, pages);
+      return NULL;
+    }
+    memcpy(bigger, kstr, len);
+    palloc_free_multiple(kstr, pages);
+    kstr = bigger;
+    pages = more;
   }
+  kstr[len] = '\0';
+  *page_cnt = pages;
+  return kstr;
+}
+
+/* Copy the string at user address USTR into a new page, which the
+   caller must free with palloc_free_page().  Strings longer than a
+   page are cut short.  Returns NULL if USTR is not readable */
+static char* copy_in_string(const char* ustr) {
+  size_t page_cnt;
+  return copy_in_string_pages(ustr, 1, &page_cnt);
 }
 
-/* Cause page fault by "touching". This forces lazy-load to actually load
- * something in that page.*/
-void touch_addr(void* addr) {
-  uint8_t* temp_addr = (void*)addr;
-  volatile uint8_t touch = *temp_addr;
+/* Fetch the CNT argument words of the system call in F into ARGS,
+   killing the process if they are not readable */
+static void syscall_args(struct intr_frame* f, uint32_t* args, size_t cnt) {
+  if (!copy_from_user(args, (uint32_t*)f->esp + 1, cnt * sizeof *args))
+    exit(-1);
 }
 
 /* Map files into process address space */
@@ -185,75 +923,189 @@ int mmap(int fd, void* addr) {
   // Validation
   if (fd == 0 || fd == 1 || addr == NULL) return -1;
   if (pg_ofs(addr) != 0) return -1;
-  struct thread* t = thread_current();
-  struct file** fd_table = t->fd_table;
-  struct file* f = fd_table[fd];
+  struct thread* t = process_current();
+  struct file* f = fd_file(fd);
   if (f == NULL) return -1;
   off_t len = file_length(f);
-  if (len == 0) return -1;
-  // The range of pages mapped overlaps any exisitng set of mapped pages -> fail
-  if (find_mapping_addr(&t->mmap_table, addr) != NULL) return -1;
-  if (addr >= PHYS_BASE - PGSIZE || addr <= t->data_segment_start) return -1;
-
-  // Insert mapping to mmap_table
-  struct mapping* m = malloc(sizeof(struct mapping));
-  m->id = list_size(&t->mmap_table) + 1;
+  struct file* reopened = file_reopen(f);
+  fd_put(fd);
+  if (reopened == NULL) return -1;
+  if (len == 0 || addr >= PHYS_BASE - PGSIZE ||
+      addr <= t->data_segment_start ||
+      !SPT_range_free(addr, (uint8_t*)addr + ROUND_UP(len, PGSIZE))) {
+    file_close(reopened);
+    return -1;
+  }
+
+  // Insert mapping to mmap_table, which fails if the range overlaps
+  // any existing set of mapped pages
+  struct mapping* m = mapping_alloc();
+  if (m == NULL) {
+    file_close(reopened);
+    return -1;
+  }
   m->addr = addr;
   m->size = len;
-  m->file = file_reopen(f);
   m->fd = fd;
+  m->shm = NULL;
   list_init(&m->pages);
-  list_push_back(&t->mmap_table, &m->elem);
-
-  // Page-wise file mapping
-  off_t read_bytes = len;
-  off_t ofs = 0;
-  while (read_bytes > 0) {
-    off_t page_read_bytes = PGSIZE, page_zero_bytes;
-    if (read_bytes < PGSIZE) page_read_bytes = read_bytes;
-    page_zero_bytes = PGSIZE - page_read_bytes;
-
-    uint8_t* kpage = palloc_get_page(0);
-    struct page *temp = SPT_insert(m->file, ofs, addr, kpage, page_read_bytes, page_zero_bytes,
-               true, FOR_MMAP);
-    list_push_back(&m->pages, &temp->MMAP_elem);
-
-    if (file_read(m->file, kpage, page_read_bytes) != page_read_bytes) {
-      ASSERT(0);
-      palloc_free_page(kpage);
-      return -1;
-    }
-    memset(kpage + page_read_bytes, 0, page_zero_bytes);
-
-    read_bytes -= page_read_bytes;
-    addr += PGSIZE;
-    ofs += page_read_bytes;
+  if (!mmap_table_insert(&t->mmap_table, m)) {
+    file_close(reopened);
+    mapping_free(m);
+    return -1;
+  }
+  m->file = reopened;
+
+  // Pages are read in on first fault
+  size_t zero_bytes = ROUND_UP(len, PGSIZE) - len;
+  if (!SPT_insert_region(m->file, 0, addr, len, zero_bytes, true, FOR_MMAP)) {
+    mmap_table_remove(&t->mmap_table, m);
+    file_close(m->file);
+    mapping_free(m);
+    return -1;
   }
 
   // return mapping id
   return m->id;
 }
 
+/* Map LENGTH bytes of zero-filled memory at ADDR.  Pages are
+   allocated as they are touched and swapped like stack pages */
+int mmap_anon(void* addr, size_t length) {
+  struct thread* t = process_current();
+  uint8_t* start = addr;
+
+  if (start == NULL || pg_ofs(start) != 0 || length == 0) return -1;
+  size_t size = ROUND_UP(length, PGSIZE);
+  if (size < length || size > (size_t)((uint8_t*)PHYS_BASE - start) ||
+      !SPT_range_free(start, start + size))
+    return -1;
+
+  struct mapping* m = mapping_alloc();
+  if (m == NULL) return -1;
+  m->addr = addr;
+  m->size = size;
+  m->fd = -1;
+  m->file = NULL;
+  m->shm = NULL;
+  list_init(&m->pages);
+  if (!mmap_table_insert(&t->mmap_table, m)) {
+    mapping_free(m);
+    return -1;
+  }
+  if (!SPT_insert_region(NULL, 0, addr, 0, size, true, FOR_ANON)) {
+    mmap_table_remove(&t->mmap_table, m);
+    mapping_free(m);
+    return -1;
+  }
+  return m->id;
+}
+
+/* Move the end of the heap by INCREMENT bytes.  Returns the old
+   end, or (void*)-1 if the heap cannot grow or shrink that far */
+void* sbrk(intptr_t increment) {
+  struct thread* t = process_current();
+  uint8_t* old_brk = t->heap_brk;
+  uint8_t* new_brk = old_brk + increment;
+
+  if (increment < 0 ? new_brk < t->heap_start || new_brk > old_brk
+                    : new_brk < old_brk)
+    return (void*)-1;
+  uint8_t* old_end = pg_round_up(old_brk);
+  uint8_t* new_end = pg_round_up(new_brk);
+  if (new_end > old_end && !SPT_range_free(old_end, new_end))
+    return (void*)-1;
+  if (!SPT_resize_region(t->heap_start, new_end - t->heap_start))
+    return (void*)-1;
+  t->heap_brk = new_brk;
+  return old_brk;
+}
+
+/* Map files into process address space; with MAP_POPULATE, also
+   fault every page of the mapping in before returning */
+int mmap_flags(int fd, void* addr, int flags) {
+  int id = mmap(fd, addr);
+  if (id == -1 || !(flags & MAP_POPULATE)) return id;
+
+  struct thread* t = process_current();
+  struct mapping* m = find_mapping_id(&t->mmap_table, id);
+  uint8_t* upage;
+  for (upage = m->addr; upage < (uint8_t*)m->addr + m->size; upage += PGSIZE) {
+    if (pagedir_get_page(t->pagedir, upage) != NULL) continue;
+    struct page* p = SPT_lookup(upage);
+    if (p != NULL && !SPT_fault_in(p)) break;
+  }
+  return id;
+}
+
+/* Write the dirty pages of mapping M in [START, END) back to its
+   file, one file_write_at() per run of adjacent dirty pages.  The
+   run is pinned while it is written from its user address, and its
+   dirty bits are cleared first so later writes are not lost. */
+static void mapping_writeback(struct thread* t, struct mapping* m,
+                              uint8_t* start, uint8_t* end) {
+  uint8_t* upage = start;
+
+  if (m->file == NULL) return;  // anonymous: nothing to write back
+  while (upage < end) {
+    uint8_t* run = upage;
+    off_t ofs = 0;
+    size_t bytes = 0;
+
+    while (upage < end) {
+      struct page* p = SPT_search(t, upage);
+      if (p == NULL || pagedir_get_page(t->pagedir, upage) == NULL ||
+          !pagedir_is_dirty(t->pagedir, upage))
+        break;
+      frame_pin(upage);
+      pagedir_set_dirty(t->pagedir, upage, false);
+      if (upage == run) ofs = p->ofs;
+      bytes += p->read_bytes;
+      vm_stats.mmap_writebacks++;
+      upage += PGSIZE;
+    }
+
+    if (upage == run) {
+      upage += PGSIZE;  // clean or not resident
+      continue;
+    }
+    file_write_at(m->file, run, bytes, ofs);
+    frame_unpin_range(run, upage - run);
+  }
+}
+
 /* Write mapping's content to the file */
 void munmap_write(struct thread* t, int mapping, bool unmap) {
   struct mapping* m = find_mapping_id(&t->mmap_table, mapping);
   if (m == NULL) exit(-1);
 
-  // Check whether the pages are dirty. If so, call `file_write_at`
-  struct list_elem* e;
-  // struct frame* f;
-  struct hash* spt = &t->SPT;
-  struct hash_iterator it;
-  hash_first(&it, spt);
-  lock_acquire(&filesys_lock);
-  while (hash_next(&it)) {
-    struct page* p = hash_entry(hash_cur(&it), struct page, SPT_elem);
-    if (p->purpose != FOR_MMAP) continue;
-    void* addr = p->page_addr;
-    if (pagedir_is_dirty(t->pagedir, addr))
-      file_write_at(p->page_file, p->page_addr, p->read_bytes, p->ofs);
-  }
-  lock_release(&filesys_lock);
+  mapping_writeback(t, m, m->addr,
+                    (uint8_t*)m->addr + ROUND_UP(m->size, PGSIZE));
+}
+
+/* Write the dirty pages of MAPPING that hold bytes OFFSET through
+   OFFSET + LENGTH - 1 back to the file */
+int msync(int mapping, size_t offset, size_t length) {
+  struct thread* t = process_current();
+  struct mapping* m = find_mapping_id(&t->mmap_table, mapping);
+  if (m == NULL) return -1;
+
+  size_t size = ROUND_UP(m->size, PGSIZE);
+  if (offset >= size || length == 0) return 0;
+  if (length > size - offset) length = size - offset;
+  mapping_writeback(t, m, (uint8_t*)m->addr + ROUND_DOWN(offset, PGSIZE),
+                    (uint8_t*)m->addr + ROUND_UP(offset + length, PGSIZE));
+  return 0;
+}
+
+/* Tell the VM how the pages from ADDR through ADDR + LENGTH - 1 will
+   be used.  ADDR must be page-aligned. */
+int madvise(void* addr, size_t length, int advice) {
+  uint8_t* start = addr;
+  if (pg_ofs(start) != 0 || start == NULL || !is_user_vaddr(start)) return -1;
+  if (length > (size_t)((uint8_t*)PHYS_BASE - start))
+    length = (uint8_t*)PHYS_BASE - start;
+  return SPT_advise(start, start + ROUND_UP(length, PGSIZE), advice) ? 0 : -1;
 }
 
 void munmap_free(struct thread* t, int mapping) {
@@ -267,16 +1119,26 @@ void munmap_free(struct thread* t, int mapping) {
   // file_close(m->file);
 
   // free mapping with unmapping page, clearing spt, free frame entry, ...
-  struct list_elem* e;
-  for (e = list_begin(&m->pages); e != list_end(&m->pages); e = list_next(e)) {
+  // Another process can only reuse a freed frame after a context
+  // switch, which flushes our TLB, so one flush at the end will do.
+  struct pagedir_batch tlb;
+  pagedir_batch_init(&tlb);
+  while (!list_empty(&m->pages)) {
+    struct list_elem* e = list_pop_front(&m->pages);
     struct page* p = list_entry(e, struct page, MMAP_elem);
-    frame_free(p->page_addr);
-    pagedir_clear_page(t->pagedir, p->page_addr);
-    // SPT_remove(p->page_addr);
-    hash_delete(&t->SPT, &p->SPT_elem);
+    void* kpage = pagedir_get_page(t->pagedir, p->page_addr);
+    pagedir_clear_page_batch(t->pagedir, p->page_addr, &tlb);
+    // The page is gone, so its dirty bit is moot; dropping it lets the
+    // page table go once nothing else in it is in use.
+    pagedir_set_dirty(t->pagedir, p->page_addr, false);
+    if (kpage != NULL) frame_free(kpage);
+    if (p->swap_i != BITMAP_ERROR) SD_free(p->swap_i);
+    SPT_remove(p->page_addr);
   }
-  list_remove(&m->elem);
-  free(m);
+  pagedir_batch_flush(&tlb);
+  SPT_remove_region(m->addr);
+  mmap_table_remove(&t->mmap_table, m);
+  mapping_free(m);
 
   /*
   // Check whether the pages are dirty. If so, call `file_write_at`
@@ -306,7 +1168,7 @@ void munmap_free(struct thread* t, int mapping) {
 /* Unmap the mapping */
 void munmap(int mapping) {
   /*
-  struct thread* t = thread_current();
+  struct thread* t = process_current();
   struct mapping* m = find_mapping_id(&t->mmap_table, mapping);
   if (m == NULL) exit(-1);
 
@@ -316,7 +1178,6 @@ void munmap(int mapping) {
   struct hash* spt = &t->SPT;
   struct hash_iterator it;
   hash_first(&it, spt);
-  lock_acquire(&filesys_lock);
   while (hash_next(&it)) {
     struct page* p = hash_entry(hash_cur(&it), struct page, SPT_elem);
     if (p->purpose != FOR_MMAP) continue;
@@ -324,7 +1185,6 @@ void munmap(int mapping) {
     if (pagedir_is_dirty(t->pagedir, addr))
       file_write_at(p->page_file, p->page_addr, p->read_bytes, p->ofs);
   }
-  lock_release(&filesys_lock);
 
   // Close reopened file
   file_close(m->file);
@@ -345,274 +1205,542 @@ void munmap(int mapping) {
   free(m);
   */
 
-  struct thread* t = thread_current();
+  struct thread* t = process_current();
+  struct mapping* m = find_mapping_id(&t->mmap_table, mapping);
+  if (m != NULL && m->shm != NULL) {
+    shm_unmap(t, m);
+    return;
+  }
   munmap_write(t, mapping, false);
   munmap_free(t, mapping);
 }
 
-static void syscall_handler(struct intr_frame* f) {
-  // printf("case: %d\n", *(uint32_t*)f->esp);
+/* Attach shared memory segment ID at ADDR, which must be page-aligned
+   and free for the whole segment.  A process attaches a segment at
+   most once.  Returns 0, or -1 on failure */
+int shm_attach(int id, void* addr) {
+  struct thread* t = process_current();
+  uint8_t* start = addr;
+  struct shm_segment* seg;
+  struct mapping* m;
+  size_t size, k;
+
+  if (start == NULL || pg_ofs(start) != 0 || !is_user_vaddr(start)) return -1;
+  seg = shm_get(id, &size);
+  if (seg == NULL) return -1;
+  for (k = 0; k < t->mmap_table.cnt; k++)
+    if (t->mmap_table.by_id[k]->shm == seg) goto fail;
+  if (size > (size_t)((uint8_t*)PHYS_BASE - start) ||
+      !SPT_range_free(start, start + size))
+    goto fail;
+
+  m = mapping_alloc();
+  if (m == NULL) goto fail;
+  m->addr = addr;
+  m->size = size;
+  m->fd = -1;
+  m->file = NULL;
+  m->shm = seg;
+  list_init(&m->pages);
+  if (!mmap_table_insert(&t->mmap_table, m)) {
+    mapping_free(m);
+    goto fail;
+  }
+  if (!SPT_insert_region(NULL, 0, addr, 0, size, true, FOR_SHM)) {
+    mmap_table_remove(&t->mmap_table, m);
+    mapping_free(m);
+    goto fail;
+  }
+  return 0;
 
-  // Before handling system call:
-  // Check if the stack pointer is valid (sc-bad-sp)
-  check_valid(f->esp);
+fail:
+  shm_put(seg);
+  return -1;
+}
 
-  // handling system call
-  switch (*(uint32_t*)f->esp) {
-    case SYS_HALT:
-      shutdown_power_off();
-      break;
+/* Detach the shared memory segment attached at ADDR.  Returns 0, or
+   -1 if no segment is attached there */
+int shm_detach(void* addr) {
+  struct thread* t = process_current();
+  struct mapping* m = find_mapping_addr(&t->mmap_table, addr);
 
-    case SYS_EXIT:
-      check_valid(f->esp + 4);
-      f->eax = *(uint32_t*)(f->esp + 4);  // update return value
-      exit(*(uint32_t*)(f->esp + 4));
-      break;
+  if (m == NULL || m->shm == NULL || m->addr != addr) return -1;
+  shm_unmap(t, m);
+  return 0;
+}
 
-    case SYS_EXEC:
-      // pid_t exec (const char *cmd_line)
+/* Drop shared memory mapping M of T, the current process, with its
+   pages, and its reference to the segment */
+void shm_unmap(struct thread* t, struct mapping* m) {
+  struct shm_segment* seg = m->shm;
 
-      // Runs the executable whose name is given in cmd line, passing any given
-      // arguments, and returns the new process’s program id(pid).
+  while (!list_empty(&m->pages)) {
+    struct list_elem* e = list_pop_front(&m->pages);
+    struct page* p = list_entry(e, struct page, MMAP_elem);
+    shm_unmap_page(p);
+    SPT_remove(p->page_addr);
+  }
+  SPT_remove_region(m->addr);
+  mmap_table_remove(&t->mmap_table, m);
+  mapping_free(m);
+  shm_put(seg);
+}
 
-      // tid_t process_execute(const char* file_name) // in process.c
+/* System call handlers.  Each takes the argument words the
+   syscall table says it has, already copied in from the user
+   stack, and returns the value for eax */
 
-      check_valid(f->esp + 4);
+static uint32_t sys_halt(const uint32_t* args UNUSED) {
+  shutdown_power_off();
+}
 
-      if (!pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 4))) {
-        f->eax = -1;
-        exit(-1);
-        return;
-      }
+static uint32_t sys_exit(const uint32_t* args) {
+  exit((int)args[0]);
+  NOT_REACHED();
+}
 
-      tid_t pid;
-      lock_acquire(&filesys_lock);
-      pid = process_execute((const void*)*(uint32_t*)(f->esp + 4));
-
-      // Search point to thread created, then wait for its loading
-      // If the loading failed, return value should become -1
-      struct list_elem* e;
-      for (e = list_begin(&(thread_current()->children));
-           e != list_end(&(thread_current()->children)); e = list_next(e)) {
-        struct thread* t = list_entry(e, struct thread, childelem);
-        if (t->tid == pid) {
-          sema_down(&(t->load_sema));
-          if (!t->load_status) pid = -1;
-          break;
-        }
-      }
+/* Wait for new child PID to finish loading, and return PID, or -1
+   if the loading failed */
+static tid_t wait_for_load(tid_t pid) {
+  struct list_elem* e;
 
-      lock_release(&filesys_lock);
-      f->eax = pid;
+  // Search point to thread created, then wait for its loading
+  // If the loading failed, return value should become -1
+  for (e = list_begin(&(thread_current()->children));
+       e != list_end(&(thread_current()->children)); e = list_next(e)) {
+    struct thread* t = list_entry(e, struct thread, childelem);
+    if (t->tid == pid) {
+      sema_down(&(t->load_sema));
+      // Collect a child that failed to load now, so that wait_any
+      // never reports a pid that exec did not return.
+      if (!t->load_status) {
+        process_wait(pid);
+        pid = -1;
+      }
       break;
+    }
+  }
+  return pid;
+}
 
-    case SYS_WAIT:
-      // int wait (pid t pid)
+/* Run the executable whose name is given in the command line,
+   passing any given arguments, and return the new process's pid,
+   or -1 if it could not be loaded */
+static uint32_t sys_exec(const uint32_t* args) {
+  size_t page_cnt;
+  char* name = copy_in_string_pages((const char*)args[0], CMDLINE_MAX_PAGES,
+                                    &page_cnt);
+  tid_t pid;
+
+  if (name == NULL) exit(-1);
+  pid = wait_for_load(process_execute(name));
+  palloc_free_multiple(name, page_cnt);
+  return pid;
+}
 
-      // Waits for a child process pid and retrieves the child’s exit status.
-      // Implementing this system call requires considerably more work than any
-      // of the rest.
+/* Like exec, but return the new process's pid as soon as it exists,
+   without waiting for it to load, so that many children can load at
+   once.  A child that fails to load exits with -1, which is what wait
+   returns for it */
+static uint32_t sys_spawn(const uint32_t* args) {
+  size_t page_cnt;
+  char* name = copy_in_string_pages((const char*)args[0], CMDLINE_MAX_PAGES,
+                                    &page_cnt);
+  tid_t pid;
+
+  if (name == NULL) exit(-1);
+  pid = process_execute(name);
+  palloc_free_multiple(name, page_cnt);
+  return pid;
+}
 
-      // int process_wait(tid_t child_tid) // in process.c
+/* Duplicate the calling process.  Returns the child's pid to the
+   parent and 0 to the child, or -1 if the child could not be made */
+static uint32_t sys_fork(const uint32_t* args UNUSED) {
+  return wait_for_load(process_fork());
+}
 
-      check_valid(f->esp + 4);
-      f->eax = process_wait((tid_t) * (uint32_t*)(f->esp + 4));
-      break;
+/* Save the calling process's memory and registers to a new file.
+   Returns 0, or 1 in a process restored from the file, or -1 if it
+   could not be saved */
+static uint32_t sys_snapshot(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  bool ok;
+
+  if (name == NULL) exit(-1);
+  ok = snapshot_save(name);
+  palloc_free_page(name);
+  return ok ? 0 : -1;
+}
 
-    case SYS_CREATE:
-      // bool create (const char *file, unsigned initial_size)
+/* Start a process from a snapshot file, resuming from its
+   snapshot() call, and return its pid, or -1 if it could not be
+   restored */
+static uint32_t sys_restore(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  tid_t pid;
+
+  if (name == NULL) exit(-1);
+  pid = wait_for_load(process_restore(name));
+  palloc_free_page(name);
+  return pid;
+}
 
-      // Creates a new file called file initially initial size bytes in size.
-      // Returns true if successful, false otherwise.
+static uint32_t sys_wait(const uint32_t* args) {
+  return process_wait((tid_t)args[0]);
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
+/* Wait for any child to exit, or with WAIT_NOHANG in FLAGS only take
+   one that has, and store its exit status in STATUS.  Returns its
+   pid, -1 if there is no child to wait for, or 0 if none has exited
+   and WAIT_NOHANG was given */
+static uint32_t sys_wait_any(const uint32_t* args) {
+  int* ustatus = (int*)args[0];
+  int status;
+  tid_t tid;
+
+  if (!validate_user_range(ustatus, sizeof *ustatus, true)) exit(-1);
+  tid = process_wait_any(&status, !(args[1] & WAIT_NOHANG));
+  if (tid > 0 && !copy_to_user(ustatus, &status, sizeof status)) exit(-1);
+  return tid;
+}
 
-      if (!is_user_vaddr((void*)*(uint32_t*)(f->esp + 4)) ||
-          !pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 4))) {
-        f->eax = -1;  // return 0 (false)
-        exit(-1);
-        return;
-      }
+static uint32_t sys_create(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  bool ok;
 
-      if (filesys_create((const char*)*(uint32_t*)(f->esp + 4),
-                         (unsigned)*((uint32_t*)(f->esp + 8)))) {
-        f->eax = 1;  // return 1 (true)
-      } else {
-        f->eax = 0;  // return 0 (false)
-      }
-      break;
+  if (name == NULL) exit(-1);
+  ok = filesys_create(name, (unsigned)args[1]);
+  palloc_free_page(name);
+  return ok;
+}
 
-    case SYS_REMOVE:
-      // bool remove (const char *file)
+/* A file may be removed whether or not it is open, and removing an
+   open file does not close it */
+static uint32_t sys_remove(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  bool ok;
 
-      // Deletes the file called file. Returns true if successful, false
-      // otherwise. A file may be removed regardless of whether it is open or
-      // closed, and removing an open file does not close it.
+  if (name == NULL) exit(-1);
+  ok = filesys_remove(name);
+  palloc_free_page(name);
+  return ok;
+}
 
-      // bool filesys_remove(const char* name) // in filesys.c
+static uint32_t sys_open(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  int fd;
 
-      check_valid(f->esp + 4);
+  if (name == NULL) exit(-1);
+  fd = open(name);
+  palloc_free_page(name);
+  return fd;
+}
 
-      if (!is_user_vaddr((void*)*(uint32_t*)(f->esp + 4)) ||
-          !pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 4))) {
-        f->eax = -1;  // return -1 (error)
-        exit(-1);
-        return;
-      }
+static uint32_t sys_filesize(const uint32_t* args) {
+  return filesize((int)args[0]);
+}
 
-      f->eax = filesys_remove((const char*)*(uint32_t*)(f->esp + 4));
+static uint32_t sys_read(const uint32_t* args) {
+  return read((int)args[0], (void*)args[1], (unsigned)args[2]);
+}
 
-      break;
+static uint32_t sys_write(const uint32_t* args) {
+  return write((int)args[0], (void*)args[1], (unsigned)args[2]);
+}
 
-    case SYS_OPEN:
-      // int open (const char *file)
+static uint32_t sys_seek(const uint32_t* args) {
+  seek((int)args[0], (unsigned)args[1]);
+  return 0;
+}
+
+static uint32_t sys_tell(const uint32_t* args) {
+  return tell((int)args[0]);
+}
 
-      // Opens the file called file. Returns a nonnegative integer handle called
-      // a “file descriptor” (fd), or -1 if the file could not be opened.
+static uint32_t sys_close(const uint32_t* args) {
+  close((int)args[0]);
+  return 0;
+}
 
-      check_valid(f->esp + 4);
+static uint32_t sys_mmap(const uint32_t* args) {
+  return mmap((int)args[0], (void*)args[1]);
+}
 
-      if (!is_user_vaddr((void*)*(uint32_t*)(f->esp + 4)) ||
-          !pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 4))) {
-        f->eax = -1;  // return -1 (error)
-        exit(-1);
-        return;
-      }
+static uint32_t sys_munmap(const uint32_t* args) {
+  munmap((int)args[0]);
+  return 0;
+}
 
-      f->eax = open((const char*)*(uint32_t*)(f->esp + 4));
-      break;
+static uint32_t sys_vmstat(const uint32_t* args) {
+  return vmstat((struct vm_stats*)args[0]);
+}
 
-    case SYS_FILESIZE:
-      // int filesize (int fd)
+static uint32_t sys_mmap_flags(const uint32_t* args) {
+  return mmap_flags((int)args[0], (void*)args[1], (int)args[2]);
+}
 
-      // Returns the size, in bytes, of the file open as fd.
+static uint32_t sys_msync(const uint32_t* args) {
+  return msync((int)args[0], args[1], args[2]);
+}
 
-      // struct inode_disk has member: off_t length, which is file size in bytes
-      check_valid(f->esp + 4);
-      f->eax = filesize((int)*(uint32_t*)(f->esp + 4));
+static uint32_t sys_madvise(const uint32_t* args) {
+  return madvise((void*)args[0], args[1], (int)args[2]);
+}
 
-      break;
+static uint32_t sys_mmap_anon(const uint32_t* args) {
+  return mmap_anon((void*)args[0], args[1]);
+}
 
-    case SYS_READ:
-      // int read(int fd, void* buffer, unsigned size)
+static uint32_t sys_sbrk(const uint32_t* args) {
+  return (uint32_t)sbrk((intptr_t)args[0]);
+}
 
-      // Reads size bytes from the file open as fd into buffer. Returns the
-      // number of bytes actually read(0 at end of file), or -1 if the file
-      // could not be read(due to a condition other than end of file).Fd 0 reads
-      // from the keyboard using input_getc().
+static uint32_t sys_readv(const uint32_t* args) {
+  return readv((int)args[0], (const struct iovec*)args[1], (int)args[2]);
+}
 
-      // off_t file_read(struct file* file, void* buffer, off_t size) // in
-      // file.c
+static uint32_t sys_writev(const uint32_t* args) {
+  return writev((int)args[0], (const struct iovec*)args[1], (int)args[2]);
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
-      check_valid(f->esp + 12);
+static uint32_t sys_pread(const uint32_t* args) {
+  return pread((int)args[0], (void*)args[1], (unsigned)args[2],
+               (unsigned)args[3]);
+}
 
-      touch_addr((const void*)*(uint32_t*)(f->esp + 8));
+static uint32_t sys_pwrite(const uint32_t* args) {
+  return pwrite((int)args[0], (void*)args[1], (unsigned)args[2],
+                (unsigned)args[3]);
+}
 
-      if (!is_user_vaddr((void*)*(uint32_t*)(f->esp + 8)) ||
-          !pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 8))) {
-        f->eax = -1;  // return -1 (false)
-        exit(-1);
-        return;
-      }
+static uint32_t sys_copy_file_range(const uint32_t* args) {
+  return copy_file_range((int)args[0], (int)args[1], (unsigned)args[2]);
+}
 
-      f->eax =
-          read((int)*(uint32_t*)(f->esp + 4), (void*)*(uint32_t*)(f->esp + 8),
-               (unsigned)*((uint32_t*)(f->esp + 12)));
+static uint32_t sys_fallocate(const uint32_t* args) {
+  return fallocate((int)args[0], (unsigned)args[1]);
+}
 
-      break;
+static uint32_t sys_fsync(const uint32_t* args) { return fsync((int)args[0]); }
 
-    case SYS_WRITE:
-      // int write (int fd, const void *buffer, unsigned size)
+static uint32_t sys_gettunable(const uint32_t* args) {
+  return gettunable((int)args[0], (struct tunable_info*)args[1]);
+}
 
-      // Writes size bytes from buffer to the open file fd. Returns the number
-      // of bytes actually written, which may be less than size if some bytes
-      // could not be written.
+static uint32_t sys_settunable(const uint32_t* args) {
+  char* name = copy_in_string((const char*)args[0]);
+  int result;
 
-      // off_t file_write(struct file* file, const void* buffer, off_t size) //
-      // in file.c
+  if (name == NULL) exit(-1);
+  result = settunable(name, (int)args[1]);
+  palloc_free_page(name);
+  return result;
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
-      check_valid(f->esp + 12);
+static uint32_t sys_fadvise(const uint32_t* args) {
+  return fadvise((int)args[0], (unsigned)args[1], (unsigned)args[2], (int)args[3]);
+}
 
-      touch_addr((const void*)*(uint32_t*)(f->esp + 8));
+static uint32_t sys_sync(const uint32_t* args UNUSED) {
+  sync();
+  return 0;
+}
 
-      if (!is_user_vaddr((void*)*(uint32_t*)(f->esp + 8)) ||
-          !pagedir_get_page((uint32_t*)thread_current()->pagedir,
-                            (const void*)*(uint32_t*)(f->esp + 8))) {
-        f->eax = -1;  // return -1 (false)
-        exit(-1);
-        return;
-      }
+static uint32_t sys_blkstat(const uint32_t* args) {
+  return blkstat((int)args[0], (struct blk_stats*)args[1]);
+}
 
-      f->eax =
-          write((int)*(uint32_t*)(f->esp + 4), (void*)*(uint32_t*)(f->esp + 8),
-                (unsigned)*((uint32_t*)(f->esp + 12)));
-      break;
+static uint32_t sys_stats(const uint32_t* args) {
+  return stats((int)args[0], (void*)args[1], args[2]);
+}
 
-    case SYS_SEEK:
-      // void seek (int fd, unsigned position)
+static uint32_t sys_ring_setup(const uint32_t* args) {
+  return ring_setup((struct sys_ring*)args[0]);
+}
 
-      // Changes the next byte to be read or written in open file fd to
-      // position, expressed in bytes from the beginning of the file.
+static uint32_t sys_ring_enter(const uint32_t* args UNUSED) {
+  return ring_enter();
+}
 
-      // void file_seek(struct file* file, off_t new_pos) // in file.c
+static uint32_t sys_scstat(const uint32_t* args) {
+  return scstat((int)args[0], (struct sc_stats*)args[1]);
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
+static uint32_t sys_gettime(const uint32_t* args) {
+  return gettime((uint64_t*)args[0]);
+}
 
-      seek((int)*(uint32_t*)(f->esp + 4), (unsigned)*((uint32_t*)(f->esp + 8)));
+static uint32_t sys_pipe(const uint32_t* args) { return pipe((int*)args[0]); }
 
-      break;
+static uint32_t sys_getdents(const uint32_t* args) {
+  return getdents((int)args[0], (struct dirent*)args[1], (unsigned)args[2],
+                  (int)args[3]);
+}
 
-    case SYS_TELL:
-      // unsigned tell (int fd)
+static uint32_t sys_shm_create(const uint32_t* args) {
+  return shm_create(args[0]);
+}
 
-      // Returns the position of the next byte to be read or written in open
-      // file fd, expressed in bytes from the beginning of the file.
+static uint32_t sys_shm_attach(const uint32_t* args) {
+  return shm_attach((int)args[0], (void*)args[1]);
+}
 
-      // off_t file_tell(struct file* file) // in file.c
+static uint32_t sys_shm_detach(const uint32_t* args) {
+  return shm_detach((void*)args[0]);
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
+static uint32_t sys_msleep(const uint32_t* args) {
+  msleep(args[0]);
+  return 0;
+}
 
-      f->eax = tell((int)*(uint32_t*)(f->esp + 4));
+static uint32_t sys_setpriority(const uint32_t* args) {
+  return setpriority((int)args[0]);
+}
 
-      break;
+static uint32_t sys_nice(const uint32_t* args) { return nice((int)args[0]); }
 
-    case SYS_CLOSE:
-      check_valid(f->esp + 4);
-      close((int)*(uint32_t*)(f->esp + 4));
-      break;
+static uint32_t sys_getrusage(const uint32_t* args) {
+  return getrusage((int)args[0], (struct rusage*)args[1]);
+}
 
-    case SYS_MMAP: /* Map a file into memory. */
-      // mapid_t mmap(int fd, void *addr)
+static uint32_t sys_poll(const uint32_t* args) {
+  return poll((struct pollfd*)args[0], args[1], (int)args[2]);
+}
 
-      check_valid(f->esp + 4);
-      check_valid(f->esp + 8);
+// Print the allocator statistics to the console.
+static uint32_t sys_allocstat(const uint32_t* args UNUSED) {
+  palloc_print_stats();
+  alloctrack_print();
+  return 0;
+}
 
-      f->eax =
-          mmap((int)*(uint32_t*)(f->esp + 4), (void*)*(uint32_t*)(f->esp + 8));
+static uint32_t sys_thread_spawn(const uint32_t* args) {
+  return process_thread_spawn((void*)args[0], (void*)args[1], (void*)args[2]);
+}
 
-      break;
+static uint32_t sys_futex_wait(const uint32_t* args) {
+  return futex_wait((int*)args[0], (int)args[1]);
+}
 
-    case SYS_MUNMAP: /* Remove a memory mapping. */
-      // void munmap(mapid_t mapping);
-      check_valid(f->esp + 4);
+static uint32_t sys_futex_wake(const uint32_t* args) {
+  return futex_wake((int*)args[0], (int)args[1]);
+}
 
-      munmap((int)*(uint32_t*)(f->esp + 4));
+/* Most argument words any system call takes */
+#define SYSCALL_MAX_ARGS 4
+
+/* A system call: its handler, how many argument words it takes,
+   and its name for statistics */
+struct syscall {
+  uint32_t (*func)(const uint32_t* args);
+  size_t argc;
+  const char* name;
+  bool vm;  // Changes the address space: runs holding the SPT lock.
+};
+
+/* System calls by number.  Numbers without a handler are ignored,
+   leaving eax as it was */
+static const struct syscall syscall_table[] = {
+    [SYS_HALT] = {sys_halt, 0, "halt"},
+    [SYS_EXIT] = {sys_exit, 1, "exit"},
+    [SYS_EXEC] = {sys_exec, 1, "exec"},
+    [SYS_WAIT] = {sys_wait, 1, "wait"},
+    [SYS_CREATE] = {sys_create, 2, "create"},
+    [SYS_REMOVE] = {sys_remove, 1, "remove"},
+    [SYS_OPEN] = {sys_open, 1, "open"},
+    [SYS_FILESIZE] = {sys_filesize, 1, "filesize"},
+    [SYS_READ] = {sys_read, 3, "read"},
+    [SYS_WRITE] = {sys_write, 3, "write"},
+    [SYS_SEEK] = {sys_seek, 2, "seek"},
+    [SYS_TELL] = {sys_tell, 1, "tell"},
+    [SYS_CLOSE] = {sys_close, 1, "close"},
+    [SYS_MMAP] = {sys_mmap, 2, "mmap", true},
+    [SYS_MUNMAP] = {sys_munmap, 1, "munmap", true},
+    [SYS_VMSTAT] = {sys_vmstat, 1, "vmstat"},
+    [SYS_MMAP_FLAGS] = {sys_mmap_flags, 3, "mmap_flags", true},
+    [SYS_MSYNC] = {sys_msync, 3, "msync", true},
+    [SYS_MADVISE] = {sys_madvise, 3, "madvise", true},
+    [SYS_MMAP_ANON] = {sys_mmap_anon, 2, "mmap_anon", true},
+    [SYS_SBRK] = {sys_sbrk, 1, "sbrk", true},
+    [SYS_READV] = {sys_readv, 3, "readv"},
+    [SYS_WRITEV] = {sys_writev, 3, "writev"},
+    [SYS_PREAD] = {sys_pread, 4, "pread"},
+    [SYS_PWRITE] = {sys_pwrite, 4, "pwrite"},
+    [SYS_COPY_FILE_RANGE] = {sys_copy_file_range, 3, "copy_file_range"},
+    [SYS_RING_SETUP] = {sys_ring_setup, 1, "ring_setup"},
+    [SYS_RING_ENTER] = {sys_ring_enter, 0, "ring_enter"},
+    [SYS_SCSTAT] = {sys_scstat, 2, "scstat"},
+    [SYS_FORK] = {sys_fork, 0, "fork"},
+    [SYS_SPAWN] = {sys_spawn, 1, "spawn"},
+    [SYS_GETTIME] = {sys_gettime, 1, "gettime"},
+    [SYS_FUTEX_WAIT] = {sys_futex_wait, 2, "futex_wait"},
+    [SYS_FUTEX_WAKE] = {sys_futex_wake, 2, "futex_wake"},
+    [SYS_THREAD_SPAWN] = {sys_thread_spawn, 3, "thread_spawn"},
+    [SYS_ALLOCSTAT] = {sys_allocstat, 0, "allocstat"},
+    [SYS_FALLOCATE] = {sys_fallocate, 2, "fallocate"},
+    [SYS_FSYNC] = {sys_fsync, 1, "fsync"},
+    [SYS_SYNC] = {sys_sync, 0, "sync"},
+    [SYS_BLKSTAT] = {sys_blkstat, 2, "blkstat"},
+    [SYS_STATS] = {sys_stats, 3, "stats"},
+    [SYS_MSLEEP] = {sys_msleep, 1, "msleep"},
+    [SYS_PIPE] = {sys_pipe, 1, "pipe"},
+    [SYS_SHM_CREATE] = {sys_shm_create, 1, "shm_create"},
+    [SYS_SHM_ATTACH] = {sys_shm_attach, 2, "shm_attach", true},
+    [SYS_SHM_DETACH] = {sys_shm_detach, 1, "shm_detach", true},
+    [SYS_GETDENTS] = {sys_getdents, 4, "getdents"},
+    [SYS_SETPRIORITY] = {sys_setpriority, 1, "setpriority"},
+    [SYS_NICE] = {sys_nice, 1, "nice"},
+    [SYS_GETRUSAGE] = {sys_getrusage, 2, "getrusage"},
+    [SYS_WAIT_ANY] = {sys_wait_any, 2, "wait_any"},
+    [SYS_POLL] = {sys_poll, 3, "poll"},
+    [SYS_FADVISE] = {sys_fadvise, 4, "fadvise"},
+    [SYS_GETTUNABLE] = {sys_gettunable, 2, "gettunable"},
+    [SYS_SETTUNABLE] = {sys_settunable, 2, "settunable"},
+    [SYS_SNAPSHOT] = {sys_snapshot, 1, "snapshot", true},
+    [SYS_RESTORE] = {sys_restore, 1, "restore"},
+};
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
+
+/* Return the name of system call NR, or "unknown" */
+const char* syscall_name(unsigned nr) {
+  if (nr >= SYSCALL_CNT || syscall_table[nr].name == NULL) return "unknown";
+  return syscall_table[nr].name;
+}
 
-      break;
+/* Handle the system call described by F, which came in through
+   either the int $0x30 gate or sysenter_entry() */
+void syscall_handler(struct intr_frame* f) {
+  uint32_t nr, args[SYSCALL_MAX_ARGS];
+  const struct syscall* sc;
+  uint64_t start, trace;
+  bool locked;
 
-    default:
-      break;
-  }
+  // Before handling system call:
+  // Check if the stack pointer is valid (sc-bad-sp)
+  if (process_dying()) exit(-1);
+  if (!copy_from_user(&nr, f->esp, sizeof nr)) exit(-1);
+  // Faults on the user stack from here on grow it relative to this.
+  thread_current()->esp = f->esp;
+
+  ASSERT(SYSCALL_CNT <= SCSTAT_CNT);
+  if (nr >= SYSCALL_CNT) return;
+  sc = &syscall_table[nr];
+  if (sc->func == NULL) return;
+
+  // All of the arguments come in as one validated copy.
+  syscall_args(f, args, sc->argc);
+  trace = sctrace_begin(nr, args, sc->argc);
+  start = rdtsc();
+  scstat_begin(nr);
+  locked = sc->vm && SPT_lock();
+  f->eax = sc->func(args);
+  SPT_unlock(locked);
+  scstat_end(nr, f->eax, rdtsc() - start);
+  sctrace_end(trace, f->eax, rdtsc() - start);
+  // If it slept in there, bring back what was evicted meanwhile.
+  SPT_wake_prefetch();
+  if (process_dying()) exit(-1);
 }
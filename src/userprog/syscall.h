@@ -1,24 +1,75 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <blkstat.h>
+#include <debug.h>
+#include <dirent.h>
+#include <iovec.h>
+#include <poll.h>
+#include <rusage.h>
+#include <scstat.h>
+#include <stats.h>
+#include <sysring.h>
+#include <tunable.h>
+#include <vmstat.h>
+
 #include "threads/synch.h"
 #include "threads/thread.h"
 
+struct intr_frame;
+struct mapping;
+
 void syscall_init(void);
+void syscall_handler(struct intr_frame* f);
+const char* syscall_name(unsigned nr);
+void exit(int status) NO_RETURN;
 int open(const char* file);
 int filesize(int fd);
 int read(int fd, void* buffer, unsigned size);
+int pread(int fd, void* buffer, unsigned size, unsigned offset);
+int pwrite(int fd, void* buffer, unsigned size, unsigned offset);
+int copy_file_range(int fd_in, int fd_out, unsigned len);
+int fallocate(int fd, unsigned length);
+int fsync(int fd);
+int fadvise(int fd, unsigned offset, unsigned len, int advice);
+int gettunable(int idx, struct tunable_info* info);
+int settunable(const char* name, int value);
+void sync(void);
+int blkstat(int role, struct blk_stats* stats);
+int stats(int category, void* buffer, unsigned size);
+int readv(int fd, const struct iovec* iov, int iovcnt);
+int ring_setup(struct sys_ring* ring);
+int ring_enter(void);
+int scstat(int which, struct sc_stats* stats);
+int gettime(uint64_t* ns);
+void msleep(unsigned ms);
+int setpriority(int priority);
+int nice(int increment);
+int getrusage(int who, struct rusage* usage);
+int poll(struct pollfd* fds, unsigned n, int timeout);
+int writev(int fd, const struct iovec* iov, int iovcnt);
 int write(int fd, void* buffer, unsigned size);
+int vmstat(struct vm_stats* stats);
 void seek(int fd, unsigned position);
 unsigned tell(int fd);
 void close(int fd);
+int pipe(int* fds);
+int getdents(int fd, struct dirent* buffer, unsigned size, int flags);
 
-void check_valid(void* addr);
+bool validate_user_range(const void* uaddr, size_t size, bool write);
+bool copy_from_user(void* kdst, const void* usrc, size_t size);
+bool copy_to_user(void* udst, const void* ksrc, size_t size);
 int mmap(int fd, void* addr);
+int mmap_flags(int fd, void* addr, int flags);
+int mmap_anon(void* addr, size_t length);
+void* sbrk(intptr_t increment);
+int msync(int mapping, size_t offset, size_t length);
+int madvise(void* addr, size_t length, int advice);
 void munmap_write(struct thread* t, int mapping, bool unmap);
 void munmap_free(struct thread* t, int mapping);
 void munmap(int mapping);
-
-struct lock filesys_lock;
+int shm_attach(int id, void* addr);
+int shm_detach(void* addr);
+void shm_unmap(struct thread* t, struct mapping* m);
 
 #endif /* userprog/syscall.h */
@@ -1,6 +1,7 @@
 #include "userprog/tss.h"
 #include <debug.h>
 #include <stddef.h>
+#include <sysenter.h>
 #include "userprog/gdt.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
@@ -75,6 +76,15 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* Model-specific registers that configure SYSENTER.  See
+   [IA32-v3a] 5.8.7 "Performing Fast Calls to System Procedures
+   with the SYSENTER and SYSEXIT Instructions". */
+#define MSR_SYSENTER_CS  0x174  /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Stack pointer on entry. */
+#define MSR_SYSENTER_EIP 0x176  /* Entry point. */
+
+static void sysenter_init (void);
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -86,6 +96,34 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+  if (sysenter_supported ())
+    sysenter_init ();
+}
+
+/* Writes VALUE to model-specific register MSR. */
+static void
+wrmsr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* Points SYSENTER at sysenter_entry().
+
+   SYSENTER loads a fixed stack pointer, but each thread has its
+   own kernel stack, so rather than rewriting the MSR on every
+   thread switch we point it at the top of the TSS's page, whose
+   tail is otherwise unused, and sysenter_entry() fetches esp0
+   from the TSS itself.  A debug trap on the first instruction of
+   sysenter_entry() is taken on that scratch stack, so it must be
+   big enough for an interrupt frame.  SYSENTER and SYSEXIT derive
+   the other three selectors from SEL_KCSEG, which is why the GDT
+   has the kernel and user segments in the order it does. */
+static void
+sysenter_init (void)
+{
+  wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+  wrmsr (MSR_SYSENTER_ESP, (uint32_t) tss + PGSIZE);
+  wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
 }
 
 /* Returns the kernel TSS. */
@@ -8,4 +8,7 @@ void tss_init (void);
 struct tss *tss_get (void);
 void tss_update (void);
 
+/* System call entry point for SYSENTER, in sysenter.S. */
+void sysenter_entry (void);
+
 #endif /* userprog/tss.h */
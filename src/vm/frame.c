@@ -14,221 +14,2234 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "devices/block.h"
 #include "devices/timer.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/vmstat.h"
+
+/* Frame table with one entry per page that may ever be in the user
+   pool, which grows and shrinks as it borrows from and lends to the
+   kernel pool.  Capacity is what the user pool holds now, see
+   palloc_user_page_cnt(). */
+static struct frame* frame_table;
+
+/* Number of entries in frame_table. */
+static size_t frame_cnt;
+
+/* Kernel virtual address of the frame described by frame_table[0]. */
+static uint8_t* frame_base;
+
+/* Lock for frame_alloc, which is critical section. */
+static struct lock frame_lock;
+
+/* Serializes sweeps of the clock hand.  Taken before frame_lock,
+   and held for a whole sweep, so it owns clock_hand, sweep_pass and
+   swap_starved while frame_lock is let go in mid-sweep. */
+static struct lock sweep_lock;
+
+/* Clock hand: index of the next frame find_victim() inspects. */
+static size_t clock_hand;
+
+/* Frames the clock hand passes between chances for threads waiting
+   on frame_lock to take it. */
+#define SWEEP_BATCH 32
+
+/* Frames the clock hand passed since the last such chance. */
+static size_t sweep_steps;
+
+/* Number of frames handed out by frame_alloc and not yet freed. */
+static size_t frame_used_cnt;
+
+/* User pool pages out in frame_buffer_alloc() buffers, which count in
+   frame_used_cnt too, and the fraction of the pool they may take. */
+static size_t buffer_cnt;
+#define BUFFER_DIV 8
+
+/* Upped by frame_alloc when free frames drop to the low watermark. */
+static struct semaphore cleaner_wake;
+
+/* Reclaimed frames kept out of palloc so that frame_alloc can pop
+   one instead of rescanning the user pool bitmap. */
+static struct list frame_reserve;
+
+/* Number of frames on frame_reserve. */
+static size_t reserve_cnt;
+
+/* Reclaimed frames beyond this many go back to palloc. */
+#define FRAME_RESERVE_MAX 64
+
+/* Maximum number of victims reclaimed per clock sweep. */
+#define EVICT_BATCH 8
+
+/* Number of processes that own at least one frame. */
+static size_t rss_procs;
+
+/* Passes of policy_sweep(), from the most selective.  PASS_CLEAN
+   only accepts frames that need no new swap slot, PASS_QUOTA frames
+   whose owner is over its quota. */
+enum sweep_pass { PASS_CLEAN, PASS_QUOTA, PASS_ANY };
+
+/* Pass that frame_can_evict() applies. */
+static enum sweep_pass sweep_pass = PASS_ANY;
+
+/* With fewer free swap slots than this, victims that need none are
+   taken first. */
+#define SWAP_LOW (4 * EVICT_BATCH)
+
+/* Set when frame_can_evict() turns a frame down because swap is full;
+   cleared by find_victims(). */
+static bool swap_starved;
+
+/* How long frame_alloc() waits for a swap slot to be freed before it
+   calls on the OOM killer, in timer ticks. */
+#define SWAP_WAIT_TICKS 10
+
+/* Page-fault-frequency control.  A process's faults are counted over
+   PFF_WINDOW ticks; more than PFF_HIGH grows its quota by PFF_STEP
+   frames, fewer than PFF_LOW shrinks it, never below QUOTA_MIN. */
+#define PFF_WINDOW 100
+#define PFF_HIGH 32
+#define PFF_LOW 4
+#define PFF_STEP 16
+#define QUOTA_MIN 16
+static bool pff_enabled;
+
+/* Kernel page of zeros mapped read-only for pages never written. */
+static void* zero_page;
+
+/* A loan pins its frame until the borrower writes or unmaps the
+   page, so loans are capped: at most 1/LEND_PROC_DIV of the user
+   frames per process and 1/LEND_TOTAL_DIV in all.  Past the caps
+   read() copies instead.  Protected by frame_lock. */
+#define LEND_PROC_DIV 16
+#define LEND_TOTAL_DIV 4
+static size_t lent_total;
+
+/* Page cache of shared file pages, keyed by (inode, offset).  The
+   length is left out of the key so that file I/O, which knows no
+   mapping's length, finds a page by position alone, and so that a
+   file position is cached in at most one frame that writes keep up
+   to date.  The length is kept in share_bytes instead: a mapping
+   shares a frame only if it reads as many bytes, and file I/O uses
+   only the bytes below it.  Protected by frame_lock. */
+static struct hash share_table;
+
+/* A page headed for swap, and the frame holding it meanwhile. */
+struct swap_out {
+  struct page* page;
+  uint32_t* pagedir;
+  struct frame* frame;
+  size_t slot;  // slot to rewrite, or BITMAP_ERROR for a new one
+};
+
+/* In-flight swap write of one evicted frame. */
+struct evict_io {
+  struct swap_req req;
+  struct frame* frame;
+  struct semaphore* waiter;  // upped instead of releasing the frame
+};
+
+/* Object caches for reverse-map entries and swap writes. */
+static struct slab_cache alias_cache;
+static struct slab_cache evict_io_cache;
+
+static void frame_release(struct frame* f);
+static struct frame* reserve_pop(void);
+static void evict_frames(struct frame** victims, size_t cnt,
+                         struct frame* keep);
+
+static unsigned share_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct frame* f = hash_entry(e, struct frame, share_elem);
+  return hash_bytes(&f->share_inode, sizeof f->share_inode) ^
+         hash_int(f->share_ofs);
+}
+
+static bool share_less(const struct hash_elem* a_, const struct hash_elem* b_,
+                       void* aux UNUSED) {
+  const struct frame* a = hash_entry(a_, struct frame, share_elem);
+  const struct frame* b = hash_entry(b_, struct frame, share_elem);
+  if (a->share_inode != b->share_inode) return a->share_inode < b->share_inode;
+  return a->share_ofs < b->share_ofs;
+}
 
 void frame_table_init(size_t user_frame_limit) {
-  list_init(&frame_table);  // initialize list frame_table.
-  lock_init(&frame_lock);   // initialize frame lock.
+  size_t bytes;
+
+  frame_base = palloc_user_base();
+  frame_cnt = palloc_user_page_max();
+  ASSERT(palloc_user_page_cnt() <= user_frame_limit);
+
+  // The table lives in the kernel pool for the lifetime of the kernel.
+  bytes = frame_cnt * sizeof(struct frame);
+  frame_table = palloc_get_multiple(PAL_ASSERT | PAL_ZERO,
+                                    DIV_ROUND_UP(bytes, PGSIZE));
+  lock_init(&frame_lock);  // initialize frame lock.
+  lock_register(&frame_lock, "frame");
+  lock_init(&sweep_lock);
+  lock_register(&sweep_lock, "frame sweep");
+  sema_init(&cleaner_wake, 0);
+  list_init(&frame_reserve);
+  hash_init(&share_table, share_hash, share_less, NULL);
+  zero_page = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+  clock_hand = 0;
+  slab_cache_init(&alias_cache, "frame_alias", sizeof(struct frame_alias),
+                  NULL);
+  slab_cache_init(&evict_io_cache, "evict_io", sizeof(struct evict_io), NULL);
+}
+
+/* Returns the frame table slot that describes KPAGE, regardless of
+   whether it is in use, or NULL if KPAGE is not a user pool page. */
+static struct frame* frame_slot(void* kpage) {
+  uint8_t* p = kpage;
+  if (frame_table == NULL || p < frame_base ||
+      p >= frame_base + frame_cnt * PGSIZE)
+    return NULL;
+  return &frame_table[(p - frame_base) / PGSIZE];
+}
+
+struct frame* find_frame(void* kpage) {
+  struct frame* f = frame_slot(kpage);
+  return f != NULL && f->in_use ? f : NULL;
+}
+
+/* Charges DELTA frames to T's resident set.  Call this with
+   frame_lock held. */
+static void rss_add(struct thread* t, int delta) {
+  if (t->rss == 0 && delta > 0) rss_procs++;
+  t->rss += delta;
+  if (t->rss == 0 && delta < 0) rss_procs--;
+}
+
+/* Returns T's frame quota. */
+static size_t frame_quota(struct thread* t) {
+  if (t->rss_quota != 0) return t->rss_quota;
+  return palloc_user_page_cnt() / (rss_procs > 0 ? rss_procs : 1);
+}
+
+// A niced or low-priority process gives up its frames first,
+// whatever its size.
+static bool frame_over_quota(struct thread* t) {
+  return t->rss > frame_quota(t) || t->nice > 0 ||
+         t->base_priority < PRI_DEFAULT;
+}
+
+/* Counts a fault by T and, at the end of each window, moves its
+   quota towards its fault rate.  Call this with frame_lock held. */
+static void pff_update(struct thread* t) {
+  int64_t now = timer_ticks();
+  size_t quota, capacity;
+
+  if (t->pff_start == 0) t->pff_start = now;
+  t->pff_faults++;
+  if (now - t->pff_start < PFF_WINDOW) return;
+
+  quota = frame_quota(t);
+  capacity = palloc_user_page_cnt();
+  if (t->pff_faults > PFF_HIGH)
+    quota = quota + PFF_STEP < capacity ? quota + PFF_STEP : capacity;
+  else if (t->pff_faults < PFF_LOW)
+    quota = quota > QUOTA_MIN + PFF_STEP ? quota - PFF_STEP : QUOTA_MIN;
+  t->rss_quota = quota;
+  t->pff_faults = 0;
+  t->pff_start = now;
+}
+
+void frame_set_pff(bool enable) { pff_enabled = enable; }
+
+/* Returns true if F may be evicted at all, updating its
+   is_evictable and needs_slot flags.  A frame that needs a new swap
+   slot is only accepted while one is free.  Call this with
+   frame_lock held. */
+static bool frame_can_evict(struct frame* f) {
+  if (!f->in_use || f->pin_cnt > 0) return false;
+  if (sweep_pass == PASS_QUOTA && !frame_over_quota(f->owner_thread))
+    return false;
+
+  uint32_t* pagedir = f->owner_thread->pagedir;
+  struct page* p = SPT_search(f->owner_thread, f->page_addr);
+  if (!p || !f->page_addr || pagedir == NULL ||
+      f->page_addr >= pg_round_down(PHYS_BASE - 0x800000)) {
+    f->is_evictable = false;
+  }
+  // Its swap slot would hold the page for the first mapping only, so
+  // a frame shared copy-on-write stays until it is unshared.
+  if (p != NULL && p->is_cow && !list_empty(&f->aliases)) return false;
+  if (!f->is_evictable) return false;
+
+  // The pages of a process the OOM killer picked are simply dropped.
+  f->needs_slot = !f->owner_thread->oom_killed && SPT_may_swap(p);
+  if (f->needs_slot) {
+    if (sweep_pass == PASS_CLEAN) return false;
+    if (SD_slots_free() == 0) {
+      swap_starved = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Reverse map.  A frame's first mapping is (owner_thread,
+   page_addr); every further mapping is a struct frame_alias on its
+   aliases list.  The helpers below apply to all mappings at once and
+   must be called with frame_lock held or on a detached frame. */
+
+bool frame_rmap_add(struct frame* f, struct thread* owner, void* upage) {
+  struct frame_alias* a = slab_alloc(&alias_cache);
+  if (a == NULL) return false;
+  a->owner = owner;
+  a->pagedir = owner->pagedir;
+  a->upage = upage;
+  a->lent = false;
+  list_push_back(&f->aliases, &a->elem);
+  return true;
+}
+
+/* Tests and clears the accessed bit of F's PTE in every process
+   mapping it. */
+static bool frame_clear_accessed_bits(struct frame* f) {
+  uint32_t* pagedir = f->owner_thread->pagedir;
+  bool accessed = pagedir_is_accessed(pagedir, f->page_addr);
+  struct list_elem* e;
+
+  if (accessed) pagedir_set_accessed(pagedir, f->page_addr, false);
+  for (e = list_begin(&f->aliases); e != list_end(&f->aliases);
+       e = list_next(e)) {
+    struct frame_alias* a = list_entry(e, struct frame_alias, elem);
+    if (pagedir_is_accessed(a->pagedir, a->upage)) {
+      pagedir_set_accessed(a->pagedir, a->upage, false);
+      accessed = true;
+    }
+  }
+  return accessed;
+}
+
+/* Tests and clears whether F was referenced since the last test,
+   including references that the idle page scanner took off the
+   PTEs in the meantime. */
+static bool frame_test_and_clear_accessed(struct frame* f) {
+  bool accessed = frame_clear_accessed_bits(f) || f->scan_ref;
+
+  f->scan_ref = false;
+  if (accessed) {
+    f->age = 0;
+    f->passes = 0;
+  }
+  return accessed;
+}
+
+/* Returns true if F was written through any of its mappings. */
+static bool frame_is_dirty(struct frame* f) {
+  struct list_elem* e;
+
+  if (pagedir_is_dirty(f->owner_thread->pagedir, f->page_addr)) return true;
+  for (e = list_begin(&f->aliases); e != list_end(&f->aliases);
+       e = list_next(e)) {
+    struct frame_alias* a = list_entry(e, struct frame_alias, elem);
+    if (pagedir_is_dirty(a->pagedir, a->upage)) return true;
+  }
+  return false;
+}
+
+/* Unmaps F from every process mapping it and drops its aliases.
+   The aliases' SPT entries forget the frame; the first mapping's
+   SPT entry is left to the caller.  Dirty bits survive in the
+   not-present PTEs.  TLB invalidations for the running process are
+   added to TLB for the caller to flush. */
+static void frame_unmap_all(struct frame* f, struct pagedir_batch* tlb) {
+  pagedir_clear_page_batch(f->owner_thread->pagedir, f->page_addr, tlb);
+  while (!list_empty(&f->aliases)) {
+    struct frame_alias* a =
+        list_entry(list_pop_front(&f->aliases), struct frame_alias, elem);
+    struct page* alias_page = SPT_search(a->owner, a->upage);
+    pagedir_clear_page_batch(a->pagedir, a->upage, tlb);
+    if (alias_page != NULL) alias_page->frame_addr = NULL;
+    slab_free(&alias_cache, a);
+  }
+}
+
+/* Removes F from the page cache, if it is there. */
+static void frame_unpublish(struct frame* f) {
+  if (f->share_inode == NULL) return;
+  hash_delete(&share_table, &f->share_elem);
+  f->share_inode = NULL;
+}
+
+/* Ends borrower T's loan of F, if LENT, releasing its pin.  Call
+   this with frame_lock held. */
+static void frame_unlend(struct frame* f, struct thread* t, bool lent) {
+  if (!lent) return;
+  ASSERT(f->lent_cnt > 0 && f->pin_cnt > 0);
+  ASSERT(t->lent_cnt > 0 && lent_total > 0);
+  f->lent_cnt--;
+  f->pin_cnt--;
+  t->lent_cnt--;
+  lent_total--;
+}
+
+/* Drops T's mapping of shared frame F, promoting an alias to be
+   the first mapping if T held it.  Returns false if F is not
+   shared by T and another process, in which case F should really
+   be freed.  Call this with frame_lock held. */
+static bool frame_unshare(struct frame* f, struct thread* t) {
+  struct list_elem* e;
+
+  if (list_empty(&f->aliases)) return false;
+  if (f->owner_thread == t) {
+    struct frame_alias* a =
+        list_entry(list_pop_front(&f->aliases), struct frame_alias, elem);
+    rss_add(t, -1);
+    rss_add(a->owner, 1);
+    frame_unlend(f, t, f->owner_lent);
+    f->owner_thread = a->owner;
+    f->page_addr = a->upage;
+    f->owner_lent = a->lent;
+    slab_free(&alias_cache, a);
+    return true;
+  }
+  for (e = list_begin(&f->aliases); e != list_end(&f->aliases);
+       e = list_next(e)) {
+    struct frame_alias* a = list_entry(e, struct frame_alias, elem);
+    if (a->owner == t) {
+      list_remove(e);
+      frame_unlend(f, t, a->lent);
+      slab_free(&alias_cache, a);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Detaches F from the frame table so nobody else picks it while it
+   is swapped out, and returns it.  Reserves the swap slot it needs,
+   which frame_can_evict() just saw free.  Swap slots are also
+   reserved without frame_lock, by shm_create() for one, so the slot
+   may be gone by now: then F stays where it is, and a null pointer
+   is returned as if swap had been full when F was looked at. */
+static struct frame* frame_detach(struct frame* f) {
+  if (f->needs_slot && !SD_reserve(1)) {
+    swap_starved = true;
+    return NULL;
+  }
+  frame_unpublish(f);
+  f->in_use = false;
+  frame_used_cnt--;
+  rss_add(f->owner_thread, -1);
+  return f;
+}
+
+/* Lets the threads waiting for frame_lock run in mid-sweep, so a
+   long sweep does not stall faults, allocations and frees that have
+   nothing to do with it.  The sweep keeps its place, since it holds
+   sweep_lock throughout, and the frames ahead of the hand are only
+   looked at under frame_lock again.  Frames already detached are not
+   in use, so nobody else touches them meanwhile. */
+static void sweep_pause(void) {
+  enum sweep_pass pass = sweep_pass;
+
+  // Other callers of frame_can_evict() must not see our pass.
+  sweep_pass = PASS_ANY;
+  lock_release(&frame_lock);
+  thread_yield();
+  lock_acquire(&frame_lock);
+  sweep_pass = pass;
+  vm_stats.sweep_pauses++;
+}
+
+/* Returns the frame under the clock hand and advances the hand. */
+static struct frame* clock_advance(void) {
+  if (++sweep_steps >= SWEEP_BATCH) {
+    sweep_steps = 0;
+    if (!list_empty(&frame_lock.semaphore.waiters)) sweep_pause();
+  }
+
+  struct frame* f = &frame_table[clock_hand];
+  clock_hand = (clock_hand + 1) % frame_cnt;
+  vm_stats.frames_scanned++;
+  return f;
+}
+
+/* Replacement policies.  Each sweep function is called with
+   frame_lock held and returns a detached victim, or NULL if none
+   was found after a bounded number of steps. */
+struct frame_policy {
+  const char* name;
+  struct frame* (*sweep)(void);
+  void (*on_alloc)(struct frame*);  // optional hook for new frames
+};
+
+/* Unreferenced frames at least this many idle scans old are taken
+   first by the clocks.  Set by each scan to cover the oldest
+   1/COLD_DIV of the frames. */
+static unsigned cold_age;
+#define COLD_DIV 8
+
+/* Whether the clock hand, COUNTER steps into a sweep, may take
+   unreferenced frame F.  The first revolution only takes cold
+   frames, if the idle page scanner found any. */
+static bool frame_is_cold(struct frame* f, size_t counter) {
+  return counter >= frame_cnt || f->age >= cold_age;
+}
+
+/* Levels of priority above PRI_DEFAULT that buy a process's frames
+   one more pass of the clock hand. */
+#define PRI_PER_PASS 8
+
+/* Whether the clock hand spares unreferenced frame F for its
+   owner's priority.  Frames of a process above PRI_DEFAULT survive
+   one pass for every PRI_PER_PASS levels, so its pages stay longer
+   than those of default and background processes.  A reference
+   restores the passes.  In the LAST revolution of a sweep nothing is
+   spared, so a sweep still finds a victim. */
+static bool frame_spared(struct frame* f, bool last) {
+  int pri = f->owner_thread->base_priority;
+  int passes = pri > PRI_DEFAULT ? DIV_ROUND_UP(pri - PRI_DEFAULT, PRI_PER_PASS)
+                                 : 0;
+
+  if (last || f->passes >= passes) return false;
+  f->passes++;
+  vm_stats.priority_spares++;
+  return true;
+}
+
+/* Single-handed second-chance clock.  Two revolutions always find a
+   victim if any evictable frame exists: the first clears accessed
+   bits and passes over warm and spared frames, the second takes the
+   first evictable frame not touched again since. */
+static struct frame* clock_sweep(void) {
+  size_t counter;
+
+  for (counter = 0; counter < 2 * frame_cnt; counter++) {
+    struct frame* f = clock_advance();
+    if (frame_can_evict(f) && !frame_test_and_clear_accessed(f) &&
+        frame_is_cold(f, counter) && !frame_spared(f, counter >= frame_cnt))
+      return frame_detach(f);
+  }
+  return NULL;
+}
+
+/* Distance between the leading and the trailing hand of the
+   two-handed clock, as a fraction of the frame table. */
+#define HAND_SPREAD_DIV 4
+
+/* Two-handed clock.  The leading hand runs HAND_SPREAD ahead and
+   clears accessed bits; the trailing hand (clock_hand) evicts any
+   frame that was not touched since the leading hand passed it.
+   Hot pages therefore only need to be referenced within the spread
+   window, not within a whole revolution, to survive. */
+static struct frame* clock2_sweep(void) {
+  size_t spread = frame_cnt / HAND_SPREAD_DIV;
+  size_t counter;
+
+  for (counter = 0; counter < 2 * frame_cnt; counter++) {
+    struct frame* lead = &frame_table[(clock_hand + spread) % frame_cnt];
+    struct frame* f = clock_advance();
+
+    if (frame_can_evict(lead)) frame_test_and_clear_accessed(lead);
+    if (frame_can_evict(f) && !frame_test_and_clear_accessed(f) &&
+        frame_is_cold(f, counter) && !frame_spared(f, counter >= frame_cnt))
+      return frame_detach(f);
+  }
+  return NULL;
+}
+
+/* CLOCK-Pro style policy.  Frames are hot or cold.  A cold frame
+   that is referenced during its test period (or that refaults soon
+   after eviction, as remembered by a small ring of non-resident
+   "test" pages) becomes hot.  Hot frames that go unreferenced for a
+   revolution are demoted to cold, and only cold frames are evicted.
+   The number of hot frames is capped so cold pages always exist. */
+#define GHOST_CNT 64
+
+/* Recently evicted pages, used to detect short refault distances. */
+static struct ghost {
+  struct thread* owner;
+  void* upage;
+} ghosts[GHOST_CNT];
+static size_t ghost_next;
+
+/* Number of hot frames, and the most allowed. */
+static size_t hot_cnt;
+#define HOT_MAX (palloc_user_page_cnt() * 3 / 4)
+
+static void clockpro_set_hot(struct frame* f, bool hot) {
+  if (f->is_hot != hot) hot_cnt += hot ? 1 : -1;
+  f->is_hot = hot;
+}
+
+static struct frame* clockpro_sweep(void) {
+  size_t counter;
+
+  for (counter = 0; counter < 3 * frame_cnt; counter++) {
+    struct frame* f = clock_advance();
+    if (!frame_can_evict(f)) continue;
+
+    bool accessed = frame_test_and_clear_accessed(f);
+    if (f->is_hot) {
+      // Hot frames survive while referenced, unless too many are hot.
+      if (!accessed || hot_cnt > HOT_MAX) clockpro_set_hot(f, false);
+    } else if (accessed) {
+      // Re-referenced cold frame: promote if it was still on test.
+      if (f->in_test && hot_cnt < HOT_MAX)
+        clockpro_set_hot(f, true);
+      f->in_test = true;
+    } else if (!frame_spared(f, counter >= 2 * frame_cnt)) {
+      // Unreferenced cold frame: evict, remembering it as a ghost.
+      ghosts[ghost_next].owner = f->owner_thread;
+      ghosts[ghost_next].upage = f->page_addr;
+      ghost_next = (ghost_next + 1) % GHOST_CNT;
+      clockpro_set_hot(f, false);
+      f->in_test = false;
+      return frame_detach(f);
+    }
+  }
+  return NULL;
+}
+
+/* A page that refaults while still remembered as a ghost was evicted
+   too early; bring it back as hot. */
+static void clockpro_on_alloc(struct frame* f) {
+  size_t i;
+
+  f->is_hot = false;
+  f->in_test = true;
+  for (i = 0; i < GHOST_CNT; i++)
+    if (ghosts[i].owner == f->owner_thread && ghosts[i].upage == f->page_addr &&
+        f->page_addr != NULL) {
+      ghosts[i].owner = NULL;
+      if (hot_cnt < HOT_MAX) clockpro_set_hot(f, true);
+      break;
+    }
+}
+
+static const struct frame_policy policies[] = {
+    {"clock", clock_sweep, NULL},
+    {"clock2", clock2_sweep, NULL},
+    {"clockpro", clockpro_sweep, clockpro_on_alloc},
+};
+
+/* Active replacement policy.  Selected with -vm-policy=NAME. */
+static const struct frame_policy* policy = &policies[0];
+
+bool frame_set_policy(const char* name) {
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp(name, policies[i].name)) {
+      policy = &policies[i];
+      return true;
+    }
+  return false;
+}
+
+/* Swap clustering: after VICTIM is chosen, also takes the frames
+   of the following pages of the same process, as long as they are
+   evictable and were not referenced, so that they are written to
+   adjacent swap slots.  Stores at most MAX of them in OUT and returns
+   how many.  Call this with frame_lock held. */
+static size_t take_neighbors(struct frame* victim, struct frame** out,
+                             size_t max) {
+  struct thread* t = victim->owner_thread;
+  uint8_t* upage = (uint8_t*)victim->page_addr + PGSIZE;
+  size_t cnt = 0;
+
+  while (cnt < max && is_user_vaddr(upage)) {
+    void* kpage = pagedir_get_page(t->pagedir, upage);
+    struct frame* f = kpage != NULL ? find_frame(pg_round_down(kpage)) : NULL;
+    if (f == NULL || f->owner_thread != t || f->page_addr != upage ||
+        !list_empty(&f->aliases) || !frame_can_evict(f) || f->scan_ref ||
+        pagedir_is_accessed(t->pagedir, upage) ||
+        (out[cnt] = frame_detach(f)) == NULL)
+      break;
+    cnt++;
+    upage += PGSIZE;
+  }
+  return cnt;
+}
+
+/* Runs the active policy, first only over frames that need no new
+   swap slot if swap is running low, so clean and file-backed pages
+   go before swap fills up.  Next only over frames of processes that
+   are over quota, so one process paging heavily takes frames from
+   itself before it takes them from small processes.  *PASS is the
+   first pass to try and moves on past each one that fails.  Call
+   this with frame_lock held. */
+static struct frame* policy_sweep(enum sweep_pass* pass) {
+  struct frame* f;
+
+  for (;;) {
+    if (*pass == PASS_CLEAN && SD_slots_free() >= SWAP_LOW) *pass = PASS_QUOTA;
+    if (*pass == PASS_QUOTA && rss_procs <= 1) *pass = PASS_ANY;
+    sweep_pass = *pass;
+    f = policy->sweep();
+    sweep_pass = PASS_ANY;
+    if (f != NULL || *pass == PASS_ANY) return f;
+    (*pass)++;
+  }
+}
+
+size_t find_victims(struct frame** victims, size_t max) {
+  // frame table is empty: nothing to evict
+  if (frame_cnt == 0) return 0;
+
+  size_t cnt = 0;
+  enum sweep_pass pass = PASS_CLEAN;
+
+  // Another thread is sweeping.  Sweeping after it would mostly pass
+  // over the frames it just took, so wait for it instead and let the
+  // caller try the reserve it refills.
+  if (!lock_try_acquire(&sweep_lock)) {
+    lock_acquire(&sweep_lock);
+    lock_release(&sweep_lock);
+    vm_stats.sweep_waits++;
+    return 0;
+  }
+
+  // One sweep collects the whole batch.
+  lock_acquire(&frame_lock);
+  vm_stats.victim_calls++;
+  swap_starved = false;
+  while (cnt < max) {
+    struct frame* f = policy_sweep(&pass);
+    if (f == NULL) break;
+    victims[cnt++] = f;
+    cnt += take_neighbors(f, victims + cnt, max - cnt);
+  }
+  lock_release(&frame_lock);
+  lock_release(&sweep_lock);
+
+  return cnt;
+}
+
+void* frame_zero_page(void) { return zero_page; }
+
+size_t frame_free_cnt(void) { return palloc_user_page_cnt() - frame_used_cnt; }
+
+struct frame* find_victim(void) {
+  struct frame* f;
+  return find_victims(&f, 1) ? f : NULL;
+}
+
+/* Number of free frames at or below which frame_alloc wakes the
+   page cleaner, and the number the cleaner refills up to. */
+static size_t cleaner_low, cleaner_high;
+
+
+/* True once the page cleaner thread is running. */
+static bool cleaner_running;
+
+/* Compaction.  A frame in use is moved out of the way of a run of
+   contiguous pages by copying it to another page and pointing every
+   mapping on its reverse map, and their SPT entries, at the copy.
+   Only frames reached through their PTEs alone are moved: not those
+   pinned, still being loaded and mapped, or of dead processes. */
+
+/* Returns true if F may be moved.  Call this with frame_lock held. */
+static bool frame_movable(struct frame* f) {
+  struct thread* owner = f->owner_thread;
+  struct list_elem* e;
+  struct page* p;
+
+  if (!f->in_use || f->pin_cnt > 0) return false;
+  // A dead process's frames are freed by address once its SPT goes,
+  // while its page directory still stands.
+  if (owner->pagedir == NULL || owner->status == THREAD_DYING) return false;
+  p = SPT_search(owner, f->page_addr);
+  if (p == NULL || p->frame_addr != f->frame_addr ||
+      pagedir_get_page(owner->pagedir, f->page_addr) != f->frame_addr)
+    return false;
+  for (e = list_begin(&f->aliases); e != list_end(&f->aliases);
+       e = list_next(e)) {
+    struct frame_alias* a = list_entry(e, struct frame_alias, elem);
+    p = SPT_search(a->owner, a->upage);
+    if (a->owner->status == THREAD_DYING || p == NULL ||
+        p->frame_addr != f->frame_addr)
+      return false;
+  }
+  return true;
+}
+
+/* Moves frame F's mappings to KPAGE, a user pool page allocated but
+   not in the frame table, copying its contents there if COPY, and
+   leaves F's own page allocated for the caller.  Call this with
+   frame_lock held. */
+static void frame_move(struct frame* f, uint8_t* kpage, bool copy) {
+  struct frame* n = frame_slot(kpage);
+  bool shared = f->share_inode != NULL;
+  enum intr_level old_level;
+  struct list_elem* e;
+
+  ASSERT(n != NULL && !n->in_use);
+  if (shared) hash_delete(&share_table, &f->share_elem);
+  *n = *f;
+  n->frame_addr = kpage;
+  list_init(&n->aliases);
+  while (!list_empty(&f->aliases))
+    list_push_back(&n->aliases, list_pop_front(&f->aliases));
+  if (shared) hash_insert(&share_table, &n->share_elem);
+
+  // With interrupts off, no process can write the old page between
+  // the copy and the switch of its mappings.
+  old_level = intr_disable();
+  if (copy) memcpy(kpage, f->frame_addr, PGSIZE);
+  pagedir_move_page(n->owner_thread->pagedir, n->page_addr, kpage);
+  SPT_search(n->owner_thread, n->page_addr)->frame_addr = kpage;
+  for (e = list_begin(&n->aliases); e != list_end(&n->aliases);
+       e = list_next(e)) {
+    struct frame_alias* a = list_entry(e, struct frame_alias, elem);
+    pagedir_move_page(a->pagedir, a->upage, kpage);
+    SPT_search(a->owner, a->upage)->frame_addr = kpage;
+  }
+  intr_set_level(old_level);
+
+  f->in_use = false;
+  f->share_inode = NULL;
+}
+
+/* Returns the first index of the run of CNT frame table entries,
+   among those at START + k * CNT, that takes the fewest frames moved
+   to free up, and stores that number in *MOVES.  Returns SIZE_MAX if
+   every run holds kernel pool pages or frames that cannot move.
+   Call this with frame_lock held. */
+static size_t compact_pick(size_t start, size_t cnt, size_t* moves) {
+  size_t best = SIZE_MAX, first, i, n;
+
+  *moves = SIZE_MAX;
+  for (first = start; first + cnt <= frame_cnt; first += cnt) {
+    for (i = first, n = 0; i < first + cnt && n < *moves; i++) {
+      struct frame* f = &frame_table[i];
+      if (!palloc_page_is_user(frame_base + i * PGSIZE)) break;
+      if (f->in_use && !frame_movable(f)) break;
+      if (f->in_use) n++;
+    }
+    if (i == first + cnt && n < *moves) {
+      best = first;
+      *moves = n;
+    }
+  }
+  return best;
+}
+
+/* Allocates the CNT pages from frame table index FIRST on, moving
+   the frames there elsewhere, and returns the first.  Returns NULL,
+   perhaps with some frames moved, if a page could not be claimed or
+   a frame not moved.  Call this with frame_lock held. */
+static uint8_t* compact_run(size_t first, size_t cnt) {
+  uint8_t* base = frame_base + first * PGSIZE;
+  struct frame* r;
+  size_t i;
+
+  // Reserve frames are allocated but idle; free them so that those
+  // in the run can be claimed.
+  while ((r = reserve_pop()) != NULL) palloc_free_page(r->frame_addr);
+
+  // Claim the free pages first, so that none becomes a destination.
+  for (i = 0; i < cnt; i++)
+    if (!frame_table[first + i].in_use &&
+        !palloc_claim_page(base + i * PGSIZE))
+      goto fail;
+  for (i = 0; i < cnt; i++) {
+    struct frame* f = &frame_table[first + i];
+    uint8_t* kpage;
+
+    if (!f->in_use) continue;
+    if (!frame_movable(f) || (kpage = palloc_get_page(PAL_USER)) == NULL) {
+      i = cnt;
+      goto fail;
+    }
+    frame_move(f, kpage, true);
+    vm_stats.compact_moves++;
+  }
+  vm_stats.compactions++;
+  return base;
+
+fail:
+  // Every page not in use before I is ours: claimed, or moved from.
+  while (i-- > 0)
+    if (!frame_table[first + i].in_use) palloc_free_page(base + i * PGSIZE);
+  return NULL;
+}
+
+/* Frees up and allocates CNT contiguous user pool pages, among the
+   runs at frame table index START + k * CNT, if at least MIN_FREE
+   frames are free besides.  Returns the first page, or NULL. */
+static uint8_t* frame_compact(size_t start, size_t cnt, size_t min_free) {
+  uint8_t* base = NULL;
+  size_t moves, first;
+
+  lock_acquire(&frame_lock);
+  first = compact_pick(start, cnt, &moves);
+  if (first != SIZE_MAX && frame_free_cnt() >= cnt + min_free)
+    base = compact_run(first, cnt);
+  lock_release(&frame_lock);
+  return base;
 }
 
-struct frame* find_frame(void* kpage) {
-  // frame table is empty: return NULL
-  if (list_empty(&frame_table)) return NULL;
+/* Evicts the frames in chunks that the kernel pool lent the user
+   pool and wants back, so that each chunk goes home when its last
+   page is freed.  Frames that cannot be evicted now stay, and their
+   chunks with them, until a later pass. */
+static void reclaim_chunks(void) {
+  size_t i = 0, c;
+
+  // Moving a chunk's frames elsewhere beats evicting them, while
+  // there is room for them.
+  for (c = 0; c + PALLOC_CHUNK_PAGES <= frame_cnt && palloc_reclaim_wanted();
+       c += PALLOC_CHUNK_PAGES) {
+    uint8_t* base = NULL;
+
+    if (!palloc_page_wanted(frame_base + c * PGSIZE)) continue;
+    lock_acquire(&frame_lock);
+    if (frame_free_cnt() >= PALLOC_CHUNK_PAGES + cleaner_high)
+      base = compact_run(c, PALLOC_CHUNK_PAGES);
+    lock_release(&frame_lock);
+    // Its last page freed, the chunk goes home.
+    if (base != NULL) palloc_free_multiple(base, PALLOC_CHUNK_PAGES);
+  }
+
+  while (i < frame_cnt && palloc_reclaim_wanted()) {
+    struct frame* victims[EVICT_BATCH];
+    size_t cnt = 0;
+
+    lock_acquire(&frame_lock);
+    for (; i < frame_cnt && cnt < EVICT_BATCH; i++) {
+      struct frame* f = &frame_table[i];
+      if (frame_can_evict(f) && palloc_page_wanted(f->frame_addr) &&
+          (victims[cnt] = frame_detach(f)) != NULL)
+        cnt++;
+    }
+    lock_release(&frame_lock);
+
+    if (cnt > 0) evict_frames(victims, cnt, NULL);
+  }
+}
+
+/* Page cleaner daemon.  Sleeps until free user frames run low,
+   then evicts clock victims (writing back dirty mmap pages and
+   swapping out dirty file pages) until cleaner_high frames are
+   free again, so faulting processes usually find a free frame
+   instead of waiting for a disk write. */
+static void page_cleaner(void* aux UNUSED) {
+  block_set_class(BIO_ASYNC);
+  for (;;) {
+    sema_down(&cleaner_wake);
+
+    for (;;) {
+      struct frame* victims[EVICT_BATCH];
+      size_t free_cnt, want, cnt;
+      enum sweep_pass pass = PASS_CLEAN;
+
+      lock_acquire(&frame_lock);
+      free_cnt = frame_free_cnt();
+      want = free_cnt < cleaner_high ? cleaner_high - free_cnt : 0;
+      lock_release(&frame_lock);
+
+      // Growing the user pool into idle kernel memory beats evicting.
+      if (want > 0 && palloc_borrow(PAL_USER)) continue;
+
+      lock_acquire(&sweep_lock);
+      lock_acquire(&frame_lock);
+      if (want > EVICT_BATCH) want = EVICT_BATCH;
+      // Each sweep is bounded by the policy, so a table full of hot
+      // frames cannot keep the cleaner spinning.  The bound is two
+      // revolutions, not one: the first clears the accessed bit of
+      // every frame it passes, and only the second can find those
+      // frames unreferenced and take them.
+      for (cnt = 0; cnt < want; cnt++) {
+        victims[cnt] = policy_sweep(&pass);
+        if (victims[cnt] == NULL) break;
+      }
+      lock_release(&frame_lock);
+      lock_release(&sweep_lock);
+
+      if (cnt == 0) break;
+      evict_frames(victims, cnt, NULL);
+    }
+
+    if (palloc_reclaim_wanted()) reclaim_chunks();
+  }
+}
+
+void frame_cleaner_start(void) {
+  cleaner_low = palloc_user_page_cnt() / 16;
+  cleaner_high = palloc_user_page_cnt() / 8;
+  if (cleaner_high <= cleaner_low) return;
+
+  cleaner_running = true;
+  thread_create("page-cleaner", PRI_DEFAULT, page_cleaner, NULL);
+}
+
+/* Idle page tracking.  Every scan_interval ticks the scanner samples
+   and clears the accessed bits of every frame.  A frame's age counts
+   the scans in a row that found it unreferenced; a reference the
+   scanner takes off the PTEs is kept in scan_ref, so the replacement
+   policy still sees it.  Frames referenced fewer than WSS_AGE scans
+   ago make up their owner's working set. */
+static int64_t scan_interval = TIMER_FREQ;
+#define WSS_AGE 4
+
+/* Frames scanned per frame_lock acquisition. */
+#define SCAN_BATCH 64
+
+void frame_set_idle_scan(int ticks) { scan_interval = ticks > 0 ? ticks : 0; }
+
+/* Returns the page age histogram bucket for AGE. */
+static int age_bucket(unsigned age) {
+  int bucket = 0;
+
+  while (age > 0 && bucket < VM_AGE_BUCKETS - 1) {
+    age >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static void wss_reset(struct thread* t, void* aux UNUSED) { t->wss_scan = 0; }
+static void wss_publish(struct thread* t, void* aux UNUSED) {
+  t->wss = t->wss_scan;
+}
+
+/* Makes one pass of the idle page scanner over the frame table, then
+   publishes the working set sizes and page ages it found and picks
+   the age of the frames the clocks take first. */
+static void idle_scan(void) {
+  uint32_t ages[VM_AGE_BUCKETS] = {0};
+  enum intr_level old_level;
+  size_t i = 0, total = 0, old = 0;
+  int bucket;
+
+  old_level = intr_disable();
+  thread_foreach(wss_reset, NULL);
+  intr_set_level(old_level);
+
+  while (i < frame_cnt) {
+    size_t end = i + SCAN_BATCH < frame_cnt ? i + SCAN_BATCH : frame_cnt;
+
+    lock_acquire(&frame_lock);
+    for (; i < end; i++) {
+      struct frame* f = &frame_table[i];
+      if (!f->in_use || f->owner_thread->pagedir == NULL) continue;
+      // Pinned frames are in use by definition.  Large pages are
+      // pinned, and clearing their accessed bit would split them.
+      if (f->pin_cnt > 0 || frame_clear_accessed_bits(f)) {
+        f->scan_ref = true;
+        f->age = 0;
+      } else if (f->age < UINT8_MAX) {
+        f->age++;
+      }
+      if (f->age < WSS_AGE) f->owner_thread->wss_scan++;
+      ages[age_bucket(f->age)]++;
+      total++;
+    }
+    lock_release(&frame_lock);
+  }
+
+  // The clocks take the oldest frames first, down to the youngest
+  // bucket that still makes up 1/COLD_DIV of the frames.
+  for (bucket = VM_AGE_BUCKETS - 1; bucket > 0; bucket--) {
+    old += ages[bucket];
+    if (old >= total / COLD_DIV) break;
+  }
+  cold_age = bucket > 0 ? 1u << (bucket - 1) : 0;
+
+  old_level = intr_disable();
+  thread_foreach(wss_publish, NULL);
+  memcpy(vm_stats.page_ages, ages, sizeof ages);
+  vm_stats.idle_scans++;
+  intr_set_level(old_level);
+}
+
+/* Frees up a chunk of the user pool for the kernel pool, which
+   failed to borrow one, by moving frames out of the way.  Nothing
+   is moved if a chunk is free already: the kernel pool was then
+   refused for the user pool's reserve of free pages, which moving
+   frames does not add to. */
+static void compact_for_kernel(void) {
+  uint8_t* base = NULL;
+  size_t moves, first;
+
+  lock_acquire(&frame_lock);
+  first = compact_pick(0, PALLOC_CHUNK_PAGES, &moves);
+  if (first != SIZE_MAX && moves > 0 &&
+      frame_free_cnt() >= PALLOC_CHUNK_PAGES + cleaner_high)
+    base = compact_run(first, PALLOC_CHUNK_PAGES);
+  lock_release(&frame_lock);
+  if (base != NULL) palloc_free_multiple(base, PALLOC_CHUNK_PAGES);
+}
+
+/* Idle page scanner thread.  Runs at the lowest priority, so a scan
+   only takes time that nobody else wants, and so does compacting
+   memory in the background after it. */
+static void idle_scanner(void* aux UNUSED) {
+  for (;;) {
+    timer_sleep(scan_interval);
+    idle_scan();
+    if (palloc_borrow_wanted(0) && !palloc_reclaim_wanted())
+      compact_for_kernel();
+  }
+}
+
+void frame_scanner_start(void) {
+  if (scan_interval > 0)
+    thread_create("idle-scan", PRI_MIN, idle_scanner, NULL);
+}
+
+/* Puts detached frame F on the reserve list, or returns its page to
+   palloc if the reserve is full.  Call this with frame_lock held. */
+static void frame_release(struct frame* f) {
+  ASSERT(!f->in_use);
+  if (reserve_cnt < FRAME_RESERVE_MAX && !palloc_page_wanted(f->frame_addr)) {
+    list_push_back(&frame_reserve, &f->reserve_elem);
+    reserve_cnt++;
+  } else {
+    palloc_free_page(f->frame_addr);
+  }
+}
+
+/* Pops a frame from the reserve list, or returns NULL if it is
+   empty.  Call this with frame_lock held. */
+static struct frame* reserve_pop(void) {
+  if (list_empty(&frame_reserve)) return NULL;
+  reserve_cnt--;
+  return list_entry(list_pop_front(&frame_reserve), struct frame, reserve_elem);
+}
+
+/* Returns true if every byte of KPAGE is zero. */
+static bool frame_is_zero(const void* kpage) {
+  const uint32_t* w = kpage;
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *w; i++)
+    if (w[i] != 0) return false;
+  return true;
+}
+
+/* Records that evicted PAGE only held zeros, so that it needs no
+   swap slot and faults back in as the shared zero page. */
+static void evict_zero(struct page* page) {
+  vm_stats.zero_drops++;
+  SD_free(page->swap_i);
+  page->swap_i = BITMAP_ERROR;
+  page->is_swapped = false;
+  page->is_zero = true;
+  page->frame_addr = NULL;
+}
+
+/* Completion callback, run on the swap I/O thread: the frame's
+   contents are safe on swap, so it may be reused. */
+static void evict_io_done(struct swap_req* req) {
+  struct evict_io* io = req->aux;
+
+  if (io->waiter != NULL) {
+    sema_up(io->waiter);
+  } else {
+    lock_acquire(&frame_lock);
+    frame_release(io->frame);
+    lock_release(&frame_lock);
+  }
+  slab_free(&evict_io_cache, io);
+}
+
+/* Writes the contents of the CNT frames in VICTIMS to their backing
+   stores and unmaps them from their owners.  Pages that go to swap
+   are given slots at once, a contiguous extent for new ones, and
+   their writes are queued on the swap I/O thread, against the slots
+   reserved when the victims were chosen.  Every victim
+   except KEEP is released, when its write completes if it has one.
+   KEEP, if not NULL, is returned to the caller once its contents are
+   safe, so only a thread that needs a frame right away blocks, and
+   only on its own page. */
+static void evict_frames(struct frame** victims, size_t cnt,
+                         struct frame* keep) {
+  struct swap_out outs[EVICT_BATCH];
+  size_t out_cnt = 0, new_cnt = 0, reserved_cnt = 0;
+  size_t first, i;
+  struct semaphore keep_done;
+  bool keep_pending = false;
+  struct page* pages[EVICT_BATCH];
+  bool dirties[EVICT_BATCH];
+  struct pagedir_batch tlb;
+
+  ASSERT(cnt <= EVICT_BATCH);
+
+  // Unmap the whole batch before any frame is reused, so no owner can
+  // keep writing into a frame that may already belong to someone
+  // else, and invalidate the TLB once for all of it.
+  pagedir_batch_init(&tlb);
+  for (i = 0; i < cnt; i++) {
+    // Assume that the victim is removed from the frame table.
+    struct frame* victim = victims[i];
+    if (victim->needs_slot) reserved_cnt++;
+    pages[i] = SPT_search(victim->owner_thread, victim->page_addr);
+    if (pages[i] == NULL) continue;
+    if (!is_user_vaddr(victim->page_addr)) {
+      PANIC("Tried to evict a kernel page!");
+    }
+    TRACE(TRACE_EVICT, victim->page_addr);
+    // A sleeper reads it back in one batch with the rest as it wakes.
+    if (victim->owner_thread->status == THREAD_BLOCKED)
+      SPT_wake_note(victim->owner_thread, victim->page_addr);
+    dirties[i] = frame_is_dirty(victim);
+    frame_unmap_all(victim, &tlb);
+  }
+  pagedir_batch_flush(&tlb);
+
+  for (i = 0; i < cnt; i++) {
+    struct frame* victim = victims[i];
+    void* page_addr = victim->page_addr;
+    void* frame_addr = victim->frame_addr;
+    struct thread* owner = victim->owner_thread;
+    struct page* page = pages[i];
+    bool to_swap = false;
+    if (!page) {
+      if (victim->is_evictable) printf("NOOOOO\n");
+      goto release;
+    }
+    bool dirty = dirties[i];
+
+    // Swap cache: a page swapped in earlier keeps its slot, which
+    // stays current until the page is written.  Clean pages are
+    // dropped, dirty ones rewritten in place.
+    if (page->swap_i != BITMAP_ERROR) {
+      if (dirty && frame_is_zero(frame_addr)) {
+        evict_zero(page);
+        goto release;
+      }
+      to_swap = dirty;
+      if (!dirty) vm_stats.clean_drops++;
+      page->is_swapped = true;
+    } else if (page->ops->evict(page, frame_addr, dirty) == PAGE_SWAP) {
+      if (frame_is_zero(frame_addr)) {
+        evict_zero(page);
+      } else if (victim->needs_slot) {
+        to_swap = true;
+      } else {
+        // Its owner is being killed and will never read it again.
+        page->is_swapped = false;
+      }
+    } else {
+      if (dirty)
+        pagedir_set_dirty(owner->pagedir, page_addr, false);
+      else
+        vm_stats.clean_drops++;
+      page->is_swapped = false;
+    }
+    page->frame_addr = NULL;
+
+    if (to_swap) {
+      outs[out_cnt].page = page;
+      outs[out_cnt].pagedir = owner->pagedir;
+      outs[out_cnt].frame = victim;
+      outs[out_cnt].slot = page->swap_i;
+      if (page->swap_i == BITMAP_ERROR) new_cnt++;
+      out_cnt++;
+      continue;
+    }
 
-  struct list_elem* e;
-  struct frame* f;
-  // lock_acquire(&frame_lock);
+  release:
+    if (victim != keep) {
+      lock_acquire(&frame_lock);
+      frame_release(victim);
+      lock_release(&frame_lock);
+    }
+  }
 
-  for (e = list_begin(&frame_table); e != list_end(&frame_table);
-       e = list_next(e)) {
-    f = list_entry(e, struct frame, ftable_elem);
-    if (f->frame_addr == kpage) return f;
+  // Order the batch by address space and page, so that neighboring
+  // pages land in neighboring slots and can be read ahead together.
+  for (i = 1; i < out_cnt; i++) {
+    size_t j;
+    for (j = i; j > 0 && (outs[j - 1].pagedir > outs[j].pagedir ||
+                          (outs[j - 1].pagedir == outs[j].pagedir &&
+                           outs[j - 1].page->page_addr >
+                               outs[j].page->page_addr));
+         j--) {
+      struct swap_out tmp = outs[j];
+      outs[j] = outs[j - 1];
+      outs[j - 1] = tmp;
+    }
   }
 
-  // lock_release(&frame_lock);
+  // Slot allocation is a short critical section; the writes are not.
+  if (reserved_cnt > new_cnt) SD_unreserve(reserved_cnt - new_cnt);
+  first = new_cnt > 1 ? SD_alloc(new_cnt) : BITMAP_ERROR;
+  for (i = 0; i < out_cnt; i++) {
+    struct swap_out* o = &outs[i];
+    struct page* page = o->page;
+    struct evict_io* io;
 
-  // No such frame is found: return NULL.
-  return NULL;
+    if (o->slot == BITMAP_ERROR) {
+      o->slot = first != BITMAP_ERROR ? first++ : SD_alloc(1);
+      ASSERT(o->slot != BITMAP_ERROR);
+      page->swap_i = o->slot;
+      page->is_swapped = true;
+      SD_set_page(o->slot, page);
+    }
+    pagedir_set_dirty(o->pagedir, page->page_addr, false);
+
+    io = slab_alloc(&evict_io_cache);
+    if (io == NULL) PANIC("out of memory for swap I/O");
+    io->frame = o->frame;
+    io->waiter = NULL;
+    if (o->frame == keep) {
+      sema_init(&keep_done, 0);
+      io->waiter = &keep_done;
+      keep_pending = true;
+    }
+    io->req.page = o->frame->frame_addr;
+    io->req.done = evict_io_done;
+    io->req.aux = io;
+    SD_write_async(&io->req, o->slot);
+  }
+
+  if (keep_pending) sema_down(&keep_done);
 }
 
-struct frame* find_victim() {
-  // frame table is empty: return NULL
-  if (list_empty(&frame_table)) return NULL;
-  if (!ft_cursor) ft_cursor = list_begin(&frame_table);
+void swap_frame(struct frame* victim) { evict_frames(&victim, 1, NULL); }
 
-  struct frame* f;
-  uint32_t* pagedir;
-  size_t loop_lim = 10000;
-  size_t counter = 0;
+// Fill in the frame table slot of KPAGE, just allocated, for OWNER's
+// page UPAGE.  Call with frame_lock held.
+static struct frame* frame_install(void* kpage, struct thread* owner,
+                                   void* upage, bool is_evictable) {
+  struct frame* f = frame_slot(kpage);
+  ASSERT(f != NULL && !f->in_use);
+  f->frame_addr = kpage;
+  f->page_addr = upage;
+  f->owner_thread = owner;
+  f->is_evictable = is_evictable;
+  f->pin_cnt = 0;
+  f->share_inode = NULL;
+  f->lent_cnt = 0;
+  f->owner_lent = false;
+  f->age = 0;
+  f->passes = 0;
+  f->scan_ref = false;
+  f->merge_hash = 0;
+  list_init(&f->aliases);
+  f->in_use = true;
+  if (policy->on_alloc != NULL) policy->on_alloc(f);
+  frame_used_cnt++;
+  rss_add(owner, 1);
+  if (pff_enabled) pff_update(owner);
+  return f;
+}
+
+// Whether an allocation should wake the page cleaner.  Call with
+// frame_lock held.
+static bool cleaner_should_wake(void) {
+  return cleaner_running &&
+         (frame_free_cnt() <= cleaner_low || palloc_reclaim_wanted());
+}
+
+/* Largest process by resident set seen by oom_pick(). */
+struct oom_pick {
+  struct thread* victim;
+  bool dying;  // a process killed earlier still holds frames
+};
+
+static void oom_pick(struct thread* t, void* pick_) {
+  struct oom_pick* pick = pick_;
+
+  if (t->pagedir == NULL || t->proc != t || t->rss == 0) return;
+  if (t->oom_killed)
+    pick->dying = true;
+  else if (pick->victim == NULL || t->rss > pick->victim->rss)
+    pick->victim = t;
+}
 
-  struct list_elem* victim_cursor = NULL;
+/* Last resort when memory and swap are both full: kills the process
+   with the largest resident set.  It exits the next time it enters
+   the kernel from user mode, and its frames are dropped rather than
+   swapped meanwhile, so the others can go on at once.  Kills no one
+   while an earlier victim still holds frames. */
+static void oom_kill(void) {
+  struct oom_pick pick = {NULL, false};
+  enum intr_level old_level;
+  char name[sizeof pick.victim->name];
+  size_t rss = 0;
+  tid_t tid = TID_ERROR;
 
   lock_acquire(&frame_lock);
+  old_level = intr_disable();
+  thread_foreach(oom_pick, &pick);
+  if (!pick.dying && pick.victim != NULL) {
+    pick.victim->oom_killed = true;
+    vm_stats.oom_kills++;
+    strlcpy(name, pick.victim->name, sizeof name);
+    rss = pick.victim->rss;
+    tid = pick.victim->tid;
+  }
+  intr_set_level(old_level);
+  lock_release(&frame_lock);
 
-  while (counter < loop_lim) {
-    f = list_entry(ft_cursor, struct frame, ftable_elem);
-    pagedir = f->owner_thread->pagedir;
-    struct page* p = SPT_search(f->owner_thread, f->page_addr);
-    if (!p || !f->page_addr ||
-        f->page_addr >= pg_round_down(PHYS_BASE - 0x800000)) {
-      f->is_evictable = false;
-    }
+  if (tid != TID_ERROR)
+    printf("Out of memory: killed process %d (%s), %zu frames.\n", tid, name,
+           rss);
+}
+
+struct frame* frame_alloc(enum palloc_flags flags, struct thread* owner,
+                          void* upage, bool is_evictable) {
+  struct frame* victim = NULL;
+
+  ASSERT(flags & PAL_USER);
+
+  // i) take a reclaimed frame from the reserve, then try palloc.
+  lock_acquire(&frame_lock);
+  struct frame* reserved = reserve_pop();
+  lock_release(&frame_lock);
 
-    if (!f->is_evictable || pagedir_is_accessed(pagedir, f->page_addr)) {
-      ft_cursor = list_next(ft_cursor);
-      if (ft_cursor == list_end(&frame_table))
-        ft_cursor = list_begin(&frame_table);
-      if (f->is_evictable) pagedir_set_accessed(pagedir, f->page_addr, false);
-      counter++;
+  uint8_t* kpage =
+      reserved != NULL ? reserved->frame_addr : palloc_get_page(flags);
+  while (!kpage) {
+    // have to use page replacement algorithm. The evicted frame is
+    // handed straight to us, so no other thread can steal it.
+    struct frame* victims[EVICT_BATCH];
+    size_t cnt = find_victims(victims, EVICT_BATCH);
+    if (cnt > 0) {
+      // Reclaim the whole batch at once; keep the first frame and
+      // leave the rest on the reserve for the next faults.
+      victim = victims[0];
+      evict_frames(victims, cnt, victim);
+      kpage = victim->frame_addr;
+    } else if (swap_starved) {
+      // Every frame that could go needs swap, and swap is full.  Wait
+      // for a slot, and make room by killing if none comes soon.
+      if (!SD_wait(SWAP_WAIT_TICKS)) oom_kill();
+      kpage = palloc_get_page(flags);
     } else {
-      victim_cursor = ft_cursor;
-      ft_cursor = list_next(ft_cursor);
-      if (ft_cursor == list_end(&frame_table))
-        ft_cursor = list_begin(&frame_table);
-      f = list_entry(victim_cursor, struct frame, ftable_elem);
-      break;
+      // Every frame is hot or pinned, or another thread swept and may
+      // have left spare frames on the reserve; let others run.
+      thread_yield();
+      lock_acquire(&frame_lock);
+      reserved = reserve_pop();
+      lock_release(&frame_lock);
+      kpage = reserved != NULL ? reserved->frame_addr : palloc_get_page(flags);
     }
   }
+  if ((reserved != NULL || victim != NULL) && (flags & PAL_ZERO))
+    memset(kpage, 0, PGSIZE);
 
+  // ii) fill in the frame table slot that belongs to kpage.
+  //     since this is the critical section, use lock!
+  lock_acquire(&frame_lock);
+  struct frame* f = frame_install(kpage, owner, upage, is_evictable);
+  bool wake = cleaner_should_wake();
   lock_release(&frame_lock);
 
+  // Let the page cleaner refill free frames before we run out.
+  if (wake) sema_up(&cleaner_wake);
+
+  // iii) return the frame descriptor itself, so callers need no lookup.
   return f;
 }
 
-void swap_frame(struct frame* victim) {
-  // Assume that the victim is removed from the frame table.
-  void* page_addr = victim->page_addr;
-  void* frame_addr = victim->frame_addr;
-  struct thread* owner = victim->owner_thread;
-  struct page* page = SPT_search(owner, page_addr);
-  // printf("Evicting page %p whose frame is %p\n", page_addr, frame_addr);
-  if (!page) {
-    if (victim->is_evictable) printf("NOOOOO\n");
-    palloc_free_page(frame_addr);
-    free(victim);
-    return;
-  }
-  if (!is_user_vaddr(page_addr)) {
-    PANIC("Tried to evict a kernel page!");
-  }
-
-  enum page_purpose pur = page->purpose;
-
-  switch (pur) {
-    case FOR_FILE:
-      if (pagedir_is_dirty(owner->pagedir, page_addr) || 
-          pagedir_is_dirty(owner->pagedir, frame_addr)) {
-        // printf("swap_i before write: %zu\n", page->swap_i);
-        uint8_t* bytes = frame_addr;
-        page->swap_i = SD_write(frame_addr);
-        page->is_swapped = true;
-        pagedir_set_dirty(owner->pagedir, page_addr, false);
+size_t frame_alloc_multiple(enum palloc_flags flags, struct thread* owner,
+                            void* const* upages, size_t cnt,
+                            struct frame** frames) {
+  void* kpages[FRAME_ALLOC_BATCH];
+  size_t got, i;
 
-      } else {
-        page->swap_i = BITMAP_ERROR;
-        page->is_swapped = false;
+  ASSERT(flags & PAL_USER);
+  ASSERT(cnt <= FRAME_ALLOC_BATCH);
+
+  // Plainly free pages only, so PAL_ZERO ones come pre-zeroed when
+  // the idle thread has had time to zero them.
+  for (got = 0; got < cnt; got++) {
+    kpages[got] = palloc_get_page(flags);
+    if (kpages[got] == NULL) break;
+  }
+  if (got == 0) return 0;
+
+  lock_acquire(&frame_lock);
+  for (i = 0; i < got; i++)
+    frames[i] = frame_install(kpages[i], owner, upages[i], true);
+  bool wake = cleaner_should_wake();
+  lock_release(&frame_lock);
+
+  if (wake) sema_up(&cleaner_wake);
+  return got;
+}
+
+struct frame* frame_alloc_large(struct thread* owner, void* upage) {
+  size_t cnt = PTSPAN / PGSIZE, i;
+  uint8_t *base, *kpage;
+
+  // Only take memory that is plainly free; never evict for this.
+  if (frame_free_cnt() < 2 * cnt) return NULL;
+  base = palloc_get_multiple(PAL_USER | PAL_ZERO, 2 * cnt - 1);
+  if (base != NULL) {
+    // Keep the 4 MB aligned run inside the allocation.  Kernel virtual
+    // addresses are physical ones plus PHYS_BASE, so alignment carries.
+    kpage = (uint8_t*)ROUND_UP((uintptr_t)base, PTSPAN);
+    if (kpage > base) palloc_free_multiple(base, (kpage - base) / PGSIZE);
+    if (kpage + PTSPAN < base + (2 * cnt - 1) * PGSIZE)
+      palloc_free_multiple(
+          kpage + PTSPAN,
+          (base + (2 * cnt - 1) * PGSIZE - (kpage + PTSPAN)) / PGSIZE);
+  } else {
+    // Free memory is too fragmented: move frames out of the way of
+    // the aligned run that needs the fewest moved.
+    size_t start =
+        (ROUND_UP((uintptr_t)frame_base, PTSPAN) - (uintptr_t)frame_base) /
+        PGSIZE;
+    kpage = frame_compact(start, cnt, cnt);
+    if (kpage == NULL) return NULL;
+    memset(kpage, 0, PTSPAN);
+  }
+
+  lock_acquire(&frame_lock);
+  for (i = 0; i < cnt; i++) {
+    struct frame* f = frame_slot(kpage + i * PGSIZE);
+    ASSERT(f != NULL && !f->in_use);
+    f->frame_addr = kpage + i * PGSIZE;
+    f->page_addr = (uint8_t*)upage + i * PGSIZE;
+    f->owner_thread = owner;
+    f->is_evictable = false;
+    f->pin_cnt = 1;  // a large page cannot be evicted piecemeal
+    f->share_inode = NULL;
+    f->lent_cnt = 0;
+    f->owner_lent = false;
+    list_init(&f->aliases);
+    f->in_use = true;
+    if (policy->on_alloc != NULL) policy->on_alloc(f);
+  }
+  frame_used_cnt += cnt;
+  rss_add(owner, cnt);
+  lock_release(&frame_lock);
+  return frame_slot(kpage);
+}
+
+void frame_update_upage(void* upage, void* kpage) {
+  // Reading frame table has potential race condition,
+  // so we use lock here again!
+  lock_acquire(&frame_lock);
+  struct frame* f = find_frame(kpage);
+  if (f) f->page_addr = upage;
+  lock_release(&frame_lock);
+}
+
+/* Drops T's mapping of F, freeing F if it was the last one.  Call
+   this with frame_lock held. */
+static void frame_drop(struct frame* f, struct thread* t) {
+  if (f->in_use && !frame_unshare(f, t)) {
+    // update frame table
+    frame_unpublish(f);
+    f->in_use = false;
+    frame_used_cnt--;
+    rss_add(f->owner_thread, -1);
+    clockpro_set_hot(f, false);
+
+    // keep it around for the next frame_alloc
+    frame_release(f);
+  }
+}
+
+void frame_free(void* kpage) {
+  struct frame* f = frame_slot(kpage);
+  bool acquired = false;
+  if (!f) return;
+
+  if (!lock_held_by_current_thread(&frame_lock)) {
+    lock_acquire(&frame_lock);
+    acquired = true;
+  }
+  frame_drop(f, process_current());
+  if (acquired) lock_release(&frame_lock);
+}
+
+void frame_free_multiple(struct thread* t, void** kpages, size_t cnt) {
+  size_t i;
+
+  lock_acquire(&frame_lock);
+  for (i = 0; i < cnt; i++) {
+    struct frame* f = frame_slot(kpages[i]);
+    if (f != NULL) frame_drop(f, t);
+  }
+  lock_release(&frame_lock);
+}
+
+/* Same-page merging.  Every merge_interval ticks, if turned on, the
+   page merger hashes the private, writable pages in memory and merges
+   those with the same contents into one frame that all of them map
+   copy-on-write, so the others' frames are free until somebody writes.
+   Pages of all zeros map the shared zero page instead.  A page is only
+   merged once its hash is the same two scans in a row, which leaves
+   alone the pages that are still being written. */
+static int64_t merge_interval;
+
+/* Frames hashed per frame_lock acquisition.  Hashing a page takes
+   longer than sampling its accessed bits. */
+#define MERGE_BATCH 16
+
+/* A frame of this scan whose contents were stable. */
+struct merge_node {
+  struct hash_elem elem;
+  unsigned hash;  // hash of the contents
+  struct frame* f;
+};
+
+void frame_set_merge(int ticks) { merge_interval = ticks > 0 ? ticks : 0; }
+
+static unsigned merge_node_hash(const struct hash_elem* e, void* aux UNUSED) {
+  return hash_entry(e, struct merge_node, elem)->hash;
+}
+
+static bool merge_node_less(const struct hash_elem* a,
+                            const struct hash_elem* b, void* aux UNUSED) {
+  return hash_entry(a, struct merge_node, elem)->hash <
+         hash_entry(b, struct merge_node, elem)->hash;
+}
+
+static void merge_node_free(struct hash_elem* e, void* aux UNUSED) {
+  free(hash_entry(e, struct merge_node, elem));
+}
+
+/* Returns true if T maps F. */
+static bool frame_mapped_by(struct frame* f, struct thread* t) {
+  struct list_elem* e;
+
+  if (f->owner_thread == t) return true;
+  for (e = list_begin(&f->aliases); e != list_end(&f->aliases);
+       e = list_next(e))
+    if (list_entry(e, struct frame_alias, elem)->owner == t) return true;
+  return false;
+}
+
+/* Returns the page in F if the page merger may merge it, or NULL.
+   It must be a private, writable page of a live process, mapped where
+   its SPT entry says.  Pages are only merged into a frame that is
+   shared already if it is shared copy-on-write, so read-only in every
+   process.  Call this with frame_lock held. */
+static struct page* merge_page(struct frame* f) {
+  struct thread* t = f->owner_thread;
+  struct page* p;
+
+  if (!f->in_use || f->pin_cnt > 0 || f->share_inode != NULL ||
+      t->pagedir == NULL || t->status == THREAD_DYING)
+    return NULL;
+  p = SPT_search(t, f->page_addr);
+  if (p == NULL || !p->is_writable || p->ops->share == SHARE_ALL ||
+      p->frame_addr != f->frame_addr ||
+      pagedir_get_page(t->pagedir, f->page_addr) != f->frame_addr)
+    return NULL;
+  if (!list_empty(&f->aliases) && !p->is_cow) return NULL;
+  return p;
+}
+
+/* Maps page P to the shared zero page if its frame F, which nobody
+   else maps, holds all zeros, and frees F, as evicting it would.
+   Returns false if F is not all zeros.  Call this with frame_lock
+   held. */
+static bool merge_zero(struct frame* f, struct page* p) {
+  uint32_t* pagedir = f->owner_thread->pagedir;
+  enum intr_level old_level;
+  bool zero;
+
+  // With interrupts off, no process can write the page between the
+  // check and the switch of its mapping.
+  old_level = intr_disable();
+  zero = frame_is_zero(f->frame_addr);
+  if (zero) {
+    pagedir_move_page(pagedir, p->page_addr, zero_page);
+    pagedir_set_writable(pagedir, p->page_addr, false);
+    p->frame_addr = zero_page;
+    p->is_zero = true;
+    p->is_cow = false;
+  }
+  intr_set_level(old_level);
+  if (!zero) return false;
+
+  SD_free(p->swap_i);
+  p->swap_i = BITMAP_ERROR;
+  p->is_swapped = false;
+  frame_drop(f, f->owner_thread);
+  vm_stats.zero_merges++;
+  return true;
+}
+
+/* Merges page DP, whose frame DF nobody else maps, into frame KF,
+   which holds page KP, if the two have the same contents, and frees
+   DF.  Both pages are then copy-on-write.  Returns false if they
+   differ.  Call this with frame_lock held. */
+static bool merge_frames(struct frame* kf, struct page* kp, struct frame* df,
+                         struct page* dp) {
+  struct thread* t = df->owner_thread;
+  enum intr_level old_level;
+  bool same;
+
+  // A process maps a frame only once, so that frame_drop() knows
+  // which of its mappings goes.
+  if (frame_mapped_by(kf, t) || !frame_rmap_add(kf, t, dp->page_addr))
+    return false;
+
+  // With interrupts off, no process can write either page between the
+  // comparison and the switch to read-only.  DP's PTE keeps its dirty
+  // bit, since its swap slot, if any, is as current as it was.
+  old_level = intr_disable();
+  same = memcmp(kf->frame_addr, df->frame_addr, PGSIZE) == 0;
+  if (same) {
+    pagedir_set_writable(kf->owner_thread->pagedir, kf->page_addr, false);
+    pagedir_move_page(t->pagedir, dp->page_addr, kf->frame_addr);
+    pagedir_set_writable(t->pagedir, dp->page_addr, false);
+    dp->frame_addr = kf->frame_addr;
+    kp->is_cow = dp->is_cow = true;
+  }
+  intr_set_level(old_level);
+  if (!same) {
+    frame_unshare(kf, t);
+    return false;
+  }
+
+  frame_drop(df, t);
+  vm_stats.pages_merged++;
+  return true;
+}
+
+/* Makes one pass of the page merger over the frame table.  Each
+   stable page is merged into the first frame of the scan with the
+   same hash, or into the zero page, or else becomes that first frame
+   itself. */
+static void merge_scan(void) {
+  struct hash stable;
+  unsigned zero_hash = hash_bytes(zero_page, PGSIZE);
+  size_t i = 0;
+
+  if (!hash_init(&stable, merge_node_hash, merge_node_less, NULL)) return;
+  while (i < frame_cnt) {
+    size_t end = i + MERGE_BATCH < frame_cnt ? i + MERGE_BATCH : frame_cnt;
+
+    lock_acquire(&frame_lock);
+    for (; i < end; i++) {
+      struct frame* f = &frame_table[i];
+      struct page* p = merge_page(f);
+      struct merge_node key, *n;
+      struct hash_elem* e;
+
+      if (p == NULL) continue;
+      key.hash = hash_bytes(f->frame_addr, PGSIZE);
+      if (key.hash != f->merge_hash) {
+        f->merge_hash = key.hash;
+        continue;
       }
 
-      break;
+      e = hash_find(&stable, &key.elem);
+      n = e != NULL ? hash_entry(e, struct merge_node, elem) : NULL;
+      if (list_empty(&f->aliases)) {
+        struct page* kp;
 
-    case FOR_STACK:
-      ASSERT(victim->is_evictable == false);
-      page->swap_i = SD_write(frame_addr);
-      page->is_swapped = true;
+        if (key.hash == zero_hash && merge_zero(f, p)) continue;
+        // The frame found earlier in the scan may have changed hands
+        // since; merge_frames() compares the contents anyway.
+        if (n != NULL && (kp = merge_page(n->f)) != NULL &&
+            merge_frames(n->f, kp, f, p))
+          continue;
+      }
+      if (n == NULL && (n = malloc(sizeof *n)) != NULL) {
+        n->hash = key.hash;
+        n->f = f;
+        hash_insert(&stable, &n->elem);
+      }
+    }
+    lock_release(&frame_lock);
+  }
+  hash_destroy(&stable, merge_node_free);
+
+  lock_acquire(&frame_lock);
+  vm_stats.merge_scans++;
+  lock_release(&frame_lock);
+}
+
+/* Page merger thread.  Runs at the lowest priority, like the idle
+   page scanner, so hashing pages only takes idle time. */
+static void page_merger(void* aux UNUSED) {
+  for (;;) {
+    timer_sleep(merge_interval);
+    merge_scan();
+  }
+}
+
+void frame_merger_start(void) {
+  if (merge_interval > 0)
+    thread_create("page-merge", PRI_MIN, page_merger, NULL);
+}
+
+bool frame_fork(struct thread* parent, struct page* pp, struct page* p) {
+  struct thread* t = process_current();
+  void* upage = pp->page_addr;
+  struct frame* f;
+  void* kpage;
+
+  for (;;) {
+    lock_acquire(&frame_lock);
+    kpage = pagedir_get_page(parent->pagedir, upage);
+    f = kpage != NULL ? find_frame(pg_round_down(kpage)) : NULL;
+    if (f != NULL || kpage == zero_page ||
+        (kpage == NULL && pp->frame_addr == NULL))
       break;
+    // Caught between eviction's unmapping and its SPT update.
+    lock_release(&frame_lock);
+    thread_yield();
+  }
 
-    case FOR_MMAP:
-      if (pagedir_is_dirty(owner->pagedir, page_addr)) {
-        file_write_at(page->page_file, frame_addr, PGSIZE, page->ofs);
-        pagedir_set_dirty(owner->pagedir, page_addr, false);
+  if (f != NULL && f->pin_cnt == 0) {
+    // Share the frame.  The child's PTE is dirty too if the frame holds
+    // anything its own backing store could not give back.
+    bool dirty = pagedir_is_dirty(parent->pagedir, upage) ||
+                 pp->swap_i != BITMAP_ERROR;
+    bool ok = pagedir_set_page(t->pagedir, upage, f->frame_addr, false);
+    if (ok && !frame_rmap_add(f, t, upage)) {
+      pagedir_clear_page(t->pagedir, upage);
+      ok = false;
+    }
+    if (ok) {
+      if (dirty) pagedir_set_dirty(t->pagedir, upage, true);
+      if (pp->is_writable) {
+        pagedir_set_writable(parent->pagedir, upage, false);
+        pp->is_cow = p->is_cow = true;
       }
-      page->swap_i = BITMAP_ERROR;
-      page->is_swapped = false;
-      break;
+      p->frame_addr = f->frame_addr;
+    }
+    lock_release(&frame_lock);
+    return ok;
   }
-  palloc_free_page(frame_addr);
-  page->frame_addr = NULL;
+  lock_release(&frame_lock);
 
-  pagedir_clear_page(owner->pagedir, page_addr);
-  free(victim);
+  // Not in memory: a page in swap gets a copy of its slot, since slots
+  // belong to one page; anything else loads lazily as it was.
+  if (f == NULL && !pp->is_swapped) return true;
+
+  // Pinned frames, mostly those of large pages, are copied outright.
+  // They stay mapped for as long as the parent, blocked in fork(), does.
+  struct frame* copy = frame_alloc(PAL_USER, t, upage, true);
+  if (f != NULL)
+    memcpy(copy->frame_addr, f->frame_addr, PGSIZE);
+  else
+    SD_read(pp->swap_i, copy->frame_addr);
+  if (!pagedir_set_page(t->pagedir, upage, copy->frame_addr,
+                        pp->is_writable)) {
+    frame_free(copy->frame_addr);
+    return false;
+  }
+  pagedir_set_dirty(t->pagedir, upage, true);
+  p->frame_addr = copy->frame_addr;
+  return true;
 }
 
-void* frame_alloc(enum palloc_flags flags, bool is_evictable) {
-  // i) create new struct frame
-  struct frame* new_frame = malloc(sizeof(struct frame));
-  struct frame* victim = NULL;
+bool frame_cow_break(struct page* p) {
+  struct thread* t = process_current();
+  void* upage = p->page_addr;
+  struct frame *f, *copy;
+  void* kpage;
 
-  // ii) assign palloc's result to member void* frame_addr
-  uint8_t* kpage = palloc_get_page(flags);
-  while (!kpage) {
-    // have to use page replacement algorithm
-    victim = find_victim();
+  for (;;) {
     lock_acquire(&frame_lock);
-    list_remove(&(victim->ftable_elem));
+    kpage = pagedir_get_page(t->pagedir, upage);
+    f = kpage != NULL ? find_frame(pg_round_down(kpage)) : NULL;
+    if (f != NULL || kpage == NULL) break;
+    // Being evicted, which is only possible once it is no longer
+    // shared; wait for it to be unmapped.
+    lock_release(&frame_lock);
+    thread_yield();
+  }
+
+  if (f == NULL) {
+    // Evicted once unshared: it faults back in writable.
+    p->is_cow = false;
+    lock_release(&frame_lock);
+    return false;
+  }
+  if (list_empty(&f->aliases)) {
+    // Everyone else exited or made a copy already.  A loan still in
+    // the page cache leaves it first, to be written only here.
+    frame_unpublish(f);
+    frame_unlend(f, t, f->owner_lent);
+    f->owner_lent = false;
+    pagedir_set_writable(t->pagedir, upage, true);
+    p->is_cow = false;
     lock_release(&frame_lock);
-    swap_frame(victim);
-    kpage = palloc_get_page(flags);
+    return true;
   }
-  new_frame->is_evictable = is_evictable;
-  new_frame->frame_addr = kpage;
-  new_frame->page_addr = NULL;
+  f->pin_cnt++;
+  lock_release(&frame_lock);
+
+  copy = frame_alloc(PAL_USER, t, upage, true);
+  memcpy(copy->frame_addr, f->frame_addr, PGSIZE);
+
+  lock_acquire(&frame_lock);
+  f->pin_cnt--;
+  pagedir_clear_page(t->pagedir, upage);
+  frame_free(f->frame_addr);  // drops our mapping, or the frame if last
+  pagedir_set_page(t->pagedir, upage, copy->frame_addr, true);
+  pagedir_set_dirty(t->pagedir, upage, true);
+  p->frame_addr = copy->frame_addr;
+  p->is_cow = false;
+  vm_stats.cow_copies++;
+  lock_release(&frame_lock);
+  return true;
+}
 
-  // iii) assign current thread to member owner_thread
-  new_frame->owner_thread = thread_current();
+/* Counts a page as out in a buffer if PAGES is 1, or back if -1. */
+static void buffer_count(int pages) {
+  lock_acquire(&frame_lock);
+  buffer_cnt += pages;
+  frame_used_cnt += pages;
+  lock_release(&frame_lock);
+}
 
-  // iv) record access time (redundant for second chance)
-  // new_frame->access_time = timer_ticks();
+void* frame_buffer_alloc(void) {
+  void* page;
 
-  // v) push struct into static struct list frame_table.
-  //    since this is the critical section, use lock!
   lock_acquire(&frame_lock);
-  list_push_back(&frame_table, &new_frame->ftable_elem);
-  if (!ft_cursor) ft_cursor = list_begin(&frame_table);
+  if (buffer_cnt >= palloc_user_page_cnt() / BUFFER_DIV) {
+    lock_release(&frame_lock);
+    return NULL;
+  }
+  buffer_cnt++;
+  frame_used_cnt++;
   lock_release(&frame_lock);
 
-  // vi) return kernel virtual address (physical address)
-  return kpage;
+  page = palloc_get_page(PAL_USER);
+  if (page == NULL) buffer_count(-1);
+  return page;
 }
 
-void frame_update_upage(void* upage, void* kpage) {
-  // Reading frame table has potential race condition,
-  // so we use lock here again!
+void frame_buffer_free(void* page) {
+  if (page == NULL) return;
+  if (palloc_page_is_user(page)) buffer_count(-1);
+  palloc_free_page(page);
+}
+
+bool frame_exchange(void* upage, void** kpage) {
+  struct thread* t = process_current();
+  struct frame* f;
+  struct page* p;
+  void* old;
+  bool locked, ok = false;
+
+  if (!palloc_page_is_user(*kpage)) return false;
+
+  locked = SPT_lock();
   lock_acquire(&frame_lock);
-  struct frame* f = find_frame(kpage);
-  if (f) f->page_addr = upage;
+  old = pagedir_get_page(t->pagedir, upage);
+  f = old != NULL ? find_frame(old) : NULL;
+  p = SPT_search(t, upage);
+  // Only the caller's own pin, or someone else is using the frame;
+  // large pages, which are not evictable, would be split.
+  if (f != NULL && f->owner_thread == t && f->pin_cnt == 1 &&
+      f->is_evictable && list_empty(&f->aliases) && f->share_inode == NULL &&
+      p != NULL && p->frame_addr == old && p->is_writable && !p->is_cow &&
+      p->purpose != FOR_MMAP) {
+    frame_move(f, *kpage, false);
+    // Its swap slot, if any, is stale now.
+    pagedir_set_dirty(t->pagedir, upage, true);
+    *kpage = old;
+    ok = true;
+  }
   lock_release(&frame_lock);
+  SPT_unlock(locked);
+  return ok;
 }
 
-void frame_free(void* kpage) {
-  if (!kpage) return;
-  struct list_elem* e;
+void frame_pin(void* upage) {
+  struct thread* t = process_current();
+
+  for (;;) {
+    lock_acquire(&frame_lock);
+    void* kpage = pagedir_get_page(t->pagedir, upage);
+    if (kpage != NULL) {
+      struct frame* f = find_frame(pg_round_down(kpage));
+      if (f != NULL) f->pin_cnt++;
+      lock_release(&frame_lock);
+      return;
+    }
+    lock_release(&frame_lock);
+
+    // Not resident: fault it in and try again, since it may be evicted
+    // again before we get the lock back.
+    volatile uint8_t touch UNUSED = *(volatile uint8_t*)upage;
+  }
+}
+
+void frame_unpin(void* upage) {
+  struct thread* t = process_current();
+
+  lock_acquire(&frame_lock);
+  void* kpage = pagedir_get_page(t->pagedir, upage);
+  struct frame* f = kpage != NULL ? find_frame(pg_round_down(kpage)) : NULL;
+  if (f != NULL && f->pin_cnt > 0) f->pin_cnt--;
+  lock_release(&frame_lock);
+}
+
+bool frame_pin_range(const void* uaddr, size_t size, bool write) {
+  uint8_t* start = pg_round_down(uaddr);
+  uint8_t* end = (uint8_t*)uaddr + size;
+  uint8_t* p;
+  bool locked;
+
+  if (size == 0) return true;
+  if (end < (uint8_t*)uaddr || !is_user_vaddr(end - 1)) return false;
+
+  locked = SPT_lock();
+  if (write)
+    for (p = start; p < end; p += PGSIZE) {
+      struct page* pg = SPT_lookup(p);
+      if (pg != NULL && !pg->is_writable) {
+        SPT_unlock(locked);
+        return false;
+      }
+    }
+
+  for (p = start; p < end; p += PGSIZE) {
+    struct page* pg = write ? SPT_lookup(p) : NULL;
+
+    // Kernel writes ignore read-only PTEs, so never let them land in
+    // the shared zero page or a copy-on-write frame: give the page its
+    // own frame first.
+    for (;;) {
+      if (pg != NULL && pg->is_zero) SPT_map_zero(pg, true);
+      if (pg != NULL && pg->is_cow) frame_cow_break(pg);
+      frame_pin(p);
+      if (pg == NULL || !pg->is_zero) break;
+      frame_unpin(p);  // evicted as a zero page again before pinning
+    }
+  }
+  SPT_unlock(locked);
+  return true;
+}
+
+void frame_unpin_range(const void* uaddr, size_t size) {
+  uint8_t* end = (uint8_t*)uaddr + size;
+  uint8_t* p;
+
+  if (size == 0) return;
+  for (p = pg_round_down(uaddr); p < end; p += PGSIZE) frame_unpin(p);
+}
+
+bool frame_share_map(struct page* page, struct inode* inode) {
+  struct thread* t = process_current();
+  struct frame key;
+  struct hash_elem* e;
+  bool mapped = false;
+
+  key.share_inode = inode;
+  key.share_ofs = page->ofs;
+
+  lock_acquire(&frame_lock);
+  e = hash_find(&share_table, &key.share_elem);
+  struct frame* f = e != NULL ? hash_entry(e, struct frame, share_elem) : NULL;
+  // A writable mapping of a read-only frame would let a process write
+  // into pages that others only execute.
+  if (f != NULL && f->share_bytes == page->read_bytes &&
+      f->share_writable == page->is_writable) {
+    // Map under frame_lock, so the frame cannot be evicted first.
+    if (pagedir_set_page(t->pagedir, page->page_addr, f->frame_addr,
+                         page->is_writable)) {
+      if (frame_rmap_add(f, t, page->page_addr)) {
+        page->frame_addr = f->frame_addr;
+        mapped = true;
+      } else {
+        pagedir_clear_page(t->pagedir, page->page_addr);
+      }
+    }
+  }
+  lock_release(&frame_lock);
+  return mapped;
+}
+
+void frame_share_insert(struct frame* f, struct page* page,
+                        struct inode* inode) {
+  lock_acquire(&frame_lock);
+  // F may have been evicted while it was being read.
+  if (f->in_use && f->owner_thread == process_current() &&
+      f->page_addr == page->page_addr && f->share_inode == NULL) {
+    f->share_inode = inode;
+    f->share_ofs = page->ofs;
+    f->share_bytes = page->read_bytes;
+    f->share_writable = page->is_writable;
+    // Somebody else published the same page first: stay private.
+    if (hash_insert(&share_table, &f->share_elem) != NULL)
+      f->share_inode = NULL;
+  }
+  lock_release(&frame_lock);
+}
+
+bool frame_unmap_shared(struct page* p, bool writeback) {
+  struct thread* t = process_current();
+  void* upage = p->page_addr;
   struct frame* f;
+  void* kpage;
+  bool dirty, freed;
 
-  if (!lock_held_by_current_thread(&frame_lock))
+  for (;;) {
     lock_acquire(&frame_lock);
+    kpage = pagedir_get_page(t->pagedir, upage);
+    f = kpage != NULL ? frame_slot(kpage) : NULL;
+    if (f != NULL ? f->in_use : p->frame_addr == NULL) break;
+    // Caught in eviction, which still uses P.
+    lock_release(&frame_lock);
+    thread_yield();
+  }
+  if (f == NULL) {
+    lock_release(&frame_lock);
+    return false;
+  }
 
-  if (list_empty(&frame_table)) {
+  dirty = pagedir_is_dirty(t->pagedir, upage);
+  pagedir_clear_page(t->pagedir, upage);
+  pagedir_set_dirty(t->pagedir, upage, false);
+  p->frame_addr = NULL;
+
+  if (!list_empty(&f->aliases)) {
+    // A remaining mapping takes over the dirty bit.
+    struct frame_alias* a =
+        list_entry(list_front(&f->aliases), struct frame_alias, elem);
+    if (dirty && f->owner_thread != t)
+      pagedir_set_dirty(f->owner_thread->pagedir, f->page_addr, true);
+    else if (dirty)
+      pagedir_set_dirty(a->pagedir, a->upage, true);
+    frame_drop(f, t);
     lock_release(&frame_lock);
-    return;
+    return false;
   }
 
-  for (e = list_begin(&frame_table); e != list_end(&frame_table);
-       e = list_next(e)) {
-    f = list_entry(e, struct frame, ftable_elem);
-    if (f->frame_addr == kpage) {
-      // update frame table
-      list_remove(e);
+  // The last mapping: save the page first if asked to.  Pinned, with
+  // no PTE left to write through, it holds still meanwhile.
+  if (dirty && writeback) {
+    f->pin_cnt++;
+    lock_release(&frame_lock);
+    p->ops->writeback(p, kpage);
+    lock_acquire(&frame_lock);
+    f->pin_cnt--;
+  }
+  // A fault may have found it in the page cache in the meantime.
+  freed = list_empty(&f->aliases);
+  frame_drop(f, t);
+  lock_release(&frame_lock);
+  return freed;
+}
 
-      // allocated by palloc_get_page(PAL_USER)
-      palloc_free_page(f->frame_addr);
+bool frame_cache_rw(struct inode* inode, off_t ofs, void* buf, size_t size,
+                    bool write) {
+  struct frame key;
+  struct hash_elem* e;
+  size_t page_ofs = ofs % PGSIZE;
+  bool hit = false;
 
-      // allocated by malloc(sizeof(struct frame))
-      free(f);
+  key.share_inode = inode;
+  key.share_ofs = ofs - page_ofs;
 
-      break;
+  // BUF is kernel memory or pinned, so copying cannot fault while
+  // frame_lock keeps the frame from being evicted.
+  lock_acquire(&frame_lock);
+  e = hash_find(&share_table, &key.share_elem);
+  if (e != NULL) {
+    struct frame* f = hash_entry(e, struct frame, share_elem);
+    uint8_t* kaddr = (uint8_t*)f->frame_addr + page_ofs;
+    if (!write && page_ofs + size <= f->share_bytes) {
+      memcpy(buf, kaddr, size);
+      hit = true;
+    } else if (write && f->lent_cnt > 0) {
+      // Borrowers keep what they read: the frame leaves the page
+      // cache as it is, and the write goes to the file alone.
+      frame_unpublish(f);
+    } else if (write && page_ofs < f->share_bytes) {
+      // Past share_bytes the frame holds zeros, not file data.
+      if (page_ofs + size > f->share_bytes) size = f->share_bytes - page_ofs;
+      // Writeback of the frame itself has nothing to copy.
+      if (buf != kaddr) memcpy(kaddr, buf, size);
+      hit = true;
     }
   }
   lock_release(&frame_lock);
+  return hit;
+}
+
+bool frame_cache_lend(struct inode* inode, off_t ofs, void* upage) {
+  struct thread* t = process_current();
+  bool locked = SPT_lock();
+  struct page* p = SPT_lookup(upage);
+  struct frame *f, *old = NULL;
+  struct frame key;
+  struct hash_elem* e;
+  void* kpage;
+  bool lent = false;
+
+  ASSERT(ofs % PGSIZE == 0 && pg_ofs(upage) == 0);
+  // Only private memory may take a frame that is not its own, and only
+  // memory that would be written anyway: read-only pages fault on the
+  // copy instead.
+  if (p == NULL || !p->is_writable || p->is_cow || p->ops->share == SHARE_ALL ||
+      p->purpose == FOR_MMAP || inode_length(inode) < ofs + PGSIZE) {
+    SPT_unlock(locked);
+    return false;
+  }
+
+  key.share_inode = inode;
+  key.share_ofs = ofs;
+
+  lock_acquire(&frame_lock);
+  if (t->lent_cnt >= palloc_user_page_cnt() / LEND_PROC_DIV ||
+      lent_total >= palloc_user_page_cnt() / LEND_TOTAL_DIV) {
+    vm_stats.lends_capped++;
+    goto done;
+  }
+  e = hash_find(&share_table, &key.share_elem);
+  f = e != NULL ? hash_entry(e, struct frame, share_elem) : NULL;
+  // Writable frames belong to shared mappings, whose writes the loan
+  // would show.  A process maps a frame only once.
+  if (f == NULL || f->share_bytes != PGSIZE || f->share_writable ||
+      !f->is_evictable || frame_mapped_by(f, t))
+    goto done;
+
+  // What UPAGE holds now is dropped, and must be in no one's hands.
+  kpage = pagedir_get_page(t->pagedir, upage);
+  if (kpage != NULL && kpage != zero_page) {
+    old = find_frame(kpage);
+    if (old == NULL || old->pin_cnt > 0) goto done;
+  } else if (kpage == NULL && p->frame_addr != NULL) {
+    goto done;  // caught in eviction
+  }
+
+  if (!frame_rmap_add(f, t, upage)) goto done;
+  if (kpage != NULL) {
+    pagedir_move_page(t->pagedir, upage, f->frame_addr);
+    pagedir_set_writable(t->pagedir, upage, false);
+  } else if (!pagedir_set_page(t->pagedir, upage, f->frame_addr, false)) {
+    frame_unshare(f, t);
+    goto done;
+  }
+  list_entry(list_back(&f->aliases), struct frame_alias, elem)->lent = true;
+  f->lent_cnt++;
+  f->pin_cnt++;
+  t->lent_cnt++;
+  lent_total++;
+  // The page's contents are in no backing store of its own now.
+  pagedir_set_dirty(t->pagedir, upage, true);
+  if (old != NULL) frame_drop(old, t);
+  SD_free(p->swap_i);
+  p->swap_i = BITMAP_ERROR;
+  p->is_swapped = false;
+  p->is_zero = false;
+  p->is_cow = true;
+  p->frame_addr = f->frame_addr;
+  vm_stats.pages_lent++;
+  lent = true;
+
+done:
+  lock_release(&frame_lock);
+  SPT_unlock(locked);
+  return lent;
 }
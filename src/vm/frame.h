@@ -1,6 +1,7 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <hash.h>
 #include <list.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -19,39 +20,125 @@
 //      a) Whether each frame is free or allocated
 //      b) If it is allocated, to which page of which process(es)
 
-/* Default implementation for frame. (without swap or evict, etc.) */
+/* Default implementation for frame. (without swap or evict, etc.)
+   The frame table is a flat array with one entry per user pool page,
+   indexed by (kpage - palloc_user_base ()) / PGSIZE. */
 struct frame {
   void* frame_addr;              // allocated frame's address. (=kpage)
   void* page_addr;               // virtual address pointing to page. (=upage)
   struct thread* owner_thread;   // Process(thread) who owns this frame
-  struct list_elem ftable_elem;  // list element for frame table list
   bool is_evictable;             // true iff the corresponding SPT exists.
+  bool in_use;                   // true iff frame_alloc handed this frame out.
+  struct list_elem reserve_elem; // list element for the free-frame reserve
+  bool is_hot;                   // CLOCK-Pro: frame is in the hot set.
+  bool in_test;                  // CLOCK-Pro: cold frame in its test period.
+  int pin_cnt;                   // > 0: never chosen as an eviction victim.
+  bool needs_slot;               // eviction takes a new swap slot
+  uint8_t age;                   // idle scans in a row that found it unused
+  uint8_t passes;                // clock passes survived for its owner's priority
+  bool scan_ref;                 // referenced, as seen by the idle scanner
+  unsigned merge_hash;           // contents' hash at the last merge scan
+
+  /* Reverse map.  owner_thread/page_addr is the first mapping; every
+     other (pagedir, upage) mapping the frame has an alias. */
+  struct list aliases;           // list of struct frame_alias
+
+  /* Page cache of file pages, keyed by (inode, page offset). */
+  struct inode* share_inode;     // page cache key, NULL if not shared
+  off_t share_ofs;
+  size_t share_bytes;            // bytes of the page backed by the file
+  bool share_writable;           // mapped writable (a shared mapping)
+  struct hash_elem share_elem;   // hash elem for the page cache
+
+  /* Page cache frames lent to read() buffers copy-on-write.  Each
+     loan pins the frame, since the borrower's page has no backing
+     store to load it back from. */
+  int lent_cnt;                  // mappings that are loans
+  bool owner_lent;               // owner_thread/page_addr is a loan
 };
 
-/* Frame table that keeps track of all available frames. */
-static struct list frame_table;
-
-/* Lock for frame_alloc, which is critical section. */
-static struct lock frame_lock;
+/* Additional mapping of a frame mapped by more than one page. */
+struct frame_alias {
+  struct thread* owner;   // process, to find the SPT entry
+  uint32_t* pagedir;      // page directory holding the mapping
+  void* upage;
+  bool lent;              // a loan, see struct frame
+  struct list_elem elem;
+};
 
-/* Cursor to imitate circular list behavior. */
-static struct list_elem* ft_cursor = NULL;
+struct page;
 
-// Initialize list object named frame_table
+// Initialize the frame table array, one entry per user pool page.
 void frame_table_init(size_t user_frame_limit);
 
-// Find frame with physical address. (call this with frame_lock!)
+// Find frame with physical address in O(1).
+// Returns NULL if KPAGE is not an allocated user frame.
 struct frame* find_frame(void* kpage);
 
-// Returns victim frame via second chance algorithm.
-struct frame* find_victim();
+// Returns victim frame via second chance algorithm, detached from the
+// frame table, or NULL if no frame can be evicted right now.
+struct frame* find_victim(void);
+
+// Select the replacement policy by NAME ("clock", "clock2" or
+// "clockpro"). Returns false if there is no such policy.
+bool frame_set_policy(const char* name);
+
+// Enable the page-fault-frequency controller for per-process frame
+// quotas.  Without it every process's quota is an equal share.
+void frame_set_pff(bool enable);
+
+// The shared all-zero page.  It is a kernel pool page, not in the
+// frame table, and must only ever be mapped read-only.
+void* frame_zero_page(void);
+
+// Number of user frames not currently handed out.
+size_t frame_free_cnt(void);
+
+// Collects up to MAX victims into VICTIMS in a single clock sweep and
+// returns how many were found. Each is detached from the frame table.
+size_t find_victims(struct frame** victims, size_t max);
+
+// Start the page cleaner daemon that keeps free user frames between
+// a low and a high watermark by evicting ahead of demand.
+void frame_cleaner_start(void);
+
+// Set how often the idle page scanner samples accessed bits, in timer
+// ticks, or turn it off with 0, and start it.
+void frame_set_idle_scan(int ticks);
+void frame_scanner_start(void);
+
+// Set how often the page merger looks for private pages with the same
+// contents to share copy-on-write, in timer ticks, or turn it off with
+// 0, the default, and start it.
+void frame_set_merge(int ticks);
+void frame_merger_start(void);
 
 // Swap the frame's content with the swap disk
 // & update corresponding SPT's swap_i value.
 void swap_frame(struct frame* victim);
 
-// Allocate frame & update frame table.
-void* frame_alloc(enum palloc_flags, bool);
+// Allocate a frame for OWNER's page UPAGE & insert a fully built
+// frame table entry in one step. Returns the new frame descriptor;
+// the kernel address of the frame is its frame_addr.
+struct frame* frame_alloc(enum palloc_flags, struct thread* owner, void* upage,
+                          bool is_evictable);
+
+// Most frames frame_alloc_multiple() hands out at once.
+#define FRAME_ALLOC_BATCH 32
+
+// Allocate frames for OWNER's CNT pages at UPAGES, taking the frame
+// table lock once for all of them, and store their descriptors in
+// FRAMES.  Only takes free memory, never evicting, so it may hand out
+// fewer; returns how many.  The frames are evictable.
+size_t frame_alloc_multiple(enum palloc_flags, struct thread* owner,
+                            void* const* upages, size_t cnt,
+                            struct frame** frames);
+
+// Allocate 4 MB of physically contiguous, 4 MB aligned, zeroed frames
+// for OWNER's pages from UPAGE on, for mapping as one large page.  The
+// frames stay pinned until freed one by one with frame_free().
+// Returns the first frame, or NULL if no such run is free.
+struct frame* frame_alloc_large(struct thread* owner, void* upage);
 
 // Set upage of corresponding struct frame.
 void frame_update_upage(void* upage, void* kpage);
@@ -59,4 +146,81 @@ void frame_update_upage(void* upage, void* kpage);
 // Free frame with corresponding physical address.
 void frame_free(void* kpage);
 
+// Free T's CNT frames in KPAGES, taking the frame table lock once.
+// T need not be the running thread.
+void frame_free_multiple(struct thread* t, void** kpages, size_t cnt);
+
+// Record that OWNER also maps F at UPAGE.  Accessed and dirty bits
+// are then checked across all mappings, and eviction unmaps every
+// one of them.  Call with F in use and its PTE already installed.
+bool frame_rmap_add(struct frame* f, struct thread* owner, void* upage);
+
+// If the page cache holds file page PAGE of INODE, map it at PAGE's
+// address in the current process and return true.  Read-only pages
+// only share read-only frames, writable ones only writable frames.
+bool frame_share_map(struct page* page, struct inode* inode);
+
+// Publish F, just loaded with PAGE of INODE, in the page cache so that
+// other processes can map it instead of reading their own copy.
+void frame_share_insert(struct frame* f, struct page* page,
+                        struct inode* inode);
+
+// Unmap the current process's page P, whose frame other processes
+// may map as well, as frame_free() would.  A dirty PTE passes its bit
+// on to a remaining mapping; if there is none, P's writeback operation
+// saves the frame first when WRITEBACK is set.  Returns true if the
+// frame was freed, false if it lives on or P was not in memory.
+bool frame_unmap_shared(struct page* p, bool writeback);
+
+// Copy SIZE bytes at OFS in INODE, not crossing a page, between BUF
+// and the page cache: into BUF, or out of it if WRITE.  Returns false
+// if the page is not cached, or for a read, not cached that far.
+bool frame_cache_rw(struct inode* inode, off_t ofs, void* buf, size_t size,
+                    bool write);
+
+// Map the page cache's frame for the whole page at OFS in INODE, a
+// multiple of PGSIZE, at UPAGE in the current process, copy-on-write,
+// in place of what UPAGE held, as if read() had copied the page there.
+// UPAGE must be a private, writable page.  Returns false, changing
+// nothing, if the page does not qualify or is not cached whole.
+bool frame_cache_lend(struct inode* inode, off_t ofs, void* upage);
+
+// Give P, the current process's copy of PARENT's page PP made by
+// fork(), PP's contents.  A private frame in memory is mapped by both,
+// read-only, and copied by whichever writes first; a page in swap or
+// in a large page is copied right away.  Returns false if memory is
+// short.
+bool frame_fork(struct thread* parent, struct page* pp, struct page* p);
+
+// Handle a write to the current process's copy-on-write page P: copy
+// its frame, or just make it writable if nobody else maps it anymore.
+// Returns false if P is no longer in memory, to be faulted in as usual.
+bool frame_cow_break(struct page* p);
+
+// Get a user pool page for the kernel to keep outside the frame table,
+// such as a pipe buffer, or return NULL if the pool is short or such
+// pages already take an eighth of it.  The page counts as a frame in
+// use until frame_buffer_free(), which also takes kernel pool pages.
+void* frame_buffer_alloc(void);
+void frame_buffer_free(void* page);
+
+// Replace the frame of the current process's private, writable page
+// UPAGE with *KPAGE, a page from frame_buffer_alloc() that holds the
+// page's new contents, and store the old frame's page in *KPAGE for
+// the caller to keep in its place.  The frame must be resident
+// and pinned once, by the caller.  The page needs no copy this way.
+// Returns false, changing nothing, if the page does not qualify.
+bool frame_exchange(void* upage, void** kpage);
+
+// Fault in the current process's page UPAGE if needed and pin its
+// frame, so it stays resident until frame_unpin().
+void frame_pin(void* upage);
+void frame_unpin(void* upage);
+
+// Pin or unpin every page overlapping [UADDR, UADDR + SIZE).
+// frame_pin_range() returns false, pinning nothing, if the range is
+// not user memory or if WRITE is true and a page is read-only.
+bool frame_pin_range(const void* uaddr, size_t size, bool write);
+void frame_unpin_range(const void* uaddr, size_t size);
+
 #endif /* vm/frame.h */
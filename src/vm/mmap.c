@@ -1,27 +1,129 @@
 #include "vm/mmap.h"
 
+#include <debug.h>
 #include <list.h>
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
 
-struct mapping *find_mapping_addr(struct list* mmap_table, void* addr) {
-	struct list_elem *e;
-	struct mapping *m;
-	
-	for (e = list_begin(mmap_table); e != list_end(mmap_table); e = list_next(e)) {
-		m = list_entry(e, struct mapping, elem);
-		if (m->addr <= addr && addr < m->addr + m->size)
-			return m;
+static struct slab_cache mapping_cache;
+
+void mapping_cache_init(void) {
+	slab_cache_init(&mapping_cache, "mapping", sizeof(struct mapping), NULL);
+}
+
+struct mapping *mapping_alloc(void) {
+	return slab_alloc(&mapping_cache);
+}
+
+void mapping_free(struct mapping *m) {
+	slab_free(&mapping_cache, m);
+}
+
+/* Returns the first byte past mapping M's pages. */
+static uint8_t *mapping_end(const struct mapping *m) {
+	return (uint8_t *) m->addr + ROUND_UP(m->size, PGSIZE);
+}
+
+/* Returns the index of the first mapping in MT that ends after ADDR,
+   which is MT->cnt if there is none. */
+static size_t addr_index(struct mmap_table *mt, const void *addr) {
+	size_t lo = 0, hi = mt->cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (mapping_end(mt->by_addr[mid]) <= (const uint8_t *) addr)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	return NULL;
+	return lo;
+}
+
+/* Returns the index of the mapping in MT with id ID, or of the first
+   one with a larger id. */
+static size_t id_index(struct mmap_table *mt, int id) {
+	size_t lo = 0, hi = mt->cnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (mt->by_id[mid]->id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void mmap_table_init(struct mmap_table *mt) {
+	mt->by_addr = NULL;
+	mt->by_id = NULL;
+	mt->cnt = mt->cap = 0;
+	mt->next_id = 1;
+}
+
+void mmap_table_destroy(struct mmap_table *mt) {
+	free(mt->by_addr);
+	free(mt->by_id);
+	mmap_table_init(mt);
 }
 
-struct mapping *find_mapping_id(struct list* mmap_table, int id) {
-	struct list_elem *e;
-	struct mapping *m;
-	
-	for (e = list_begin(mmap_table); e != list_end(mmap_table); e = list_next(e)) {
-		m = list_entry(e, struct mapping, elem);
-		if (m->id == id)
-			return m;
+/* Gives M the next id and adds it to MT.  Returns false if M overlaps
+   a mapping already in MT or memory is short. */
+bool mmap_table_insert(struct mmap_table *mt, struct mapping *m) {
+	size_t i = addr_index(mt, m->addr);
+
+	if (i < mt->cnt && (uint8_t *) mt->by_addr[i]->addr < mapping_end(m))
+		return false;
+
+	if (mt->cnt == mt->cap) {
+		size_t cap = mt->cap ? mt->cap * 2 : 8;
+		struct mapping **by_addr = realloc(mt->by_addr, cap * sizeof *by_addr);
+		if (by_addr == NULL)
+			return false;
+		mt->by_addr = by_addr;
+		struct mapping **by_id = realloc(mt->by_id, cap * sizeof *by_id);
+		if (by_id == NULL)
+			return false;
+		mt->by_id = by_id;
+		mt->cap = cap;
 	}
+
+	memmove(mt->by_addr + i + 1, mt->by_addr + i,
+	        (mt->cnt - i) * sizeof *mt->by_addr);
+	mt->by_addr[i] = m;
+	m->id = mt->next_id++;
+	mt->by_id[mt->cnt++] = m;
+	return true;
+}
+
+void mmap_table_remove(struct mmap_table *mt, struct mapping *m) {
+	size_t i = addr_index(mt, m->addr);
+	size_t j = id_index(mt, m->id);
+
+	ASSERT(i < mt->cnt && mt->by_addr[i] == m);
+	ASSERT(j < mt->cnt && mt->by_id[j] == m);
+	mt->cnt--;
+	memmove(mt->by_addr + i, mt->by_addr + i + 1,
+	        (mt->cnt - i) * sizeof *mt->by_addr);
+	memmove(mt->by_id + j, mt->by_id + j + 1,
+	        (mt->cnt - j) * sizeof *mt->by_id);
+}
+
+struct mapping *find_mapping_addr(struct mmap_table *mt, void *addr) {
+	size_t i = addr_index(mt, addr);
+
+	if (i < mt->cnt && mt->by_addr[i]->addr <= addr)
+		return mt->by_addr[i];
+	return NULL;
+}
+
+struct mapping *find_mapping_id(struct mmap_table *mt, int id) {
+	size_t i = id_index(mt, id);
+
+	if (i < mt->cnt && mt->by_id[i]->id == id)
+		return mt->by_id[i];
 	return NULL;
 }
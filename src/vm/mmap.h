@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 struct mapping {
@@ -11,11 +13,32 @@ struct mapping {
     int32_t size;
     struct file *file;
     int fd;
-    struct list_elem elem;
     struct list pages;
+    struct shm_segment *shm;    /* Attached segment, or NULL. */
 };
 
-struct mapping *find_mapping_addr(struct list* mmap_table, void* addr);
-struct mapping *find_mapping_id(struct list* mmap_table, int id);
+/* A process's mappings, kept in two sorted arrays: by address, for
+   lookups and overlap checks by binary search, and by id.  Ids are
+   handed out in increasing order, so the id array stays sorted by
+   appending. */
+struct mmap_table {
+    struct mapping **by_addr;
+    struct mapping **by_id;
+    size_t cnt;                 /* Mappings in both arrays. */
+    size_t cap;                 /* Room in both arrays. */
+    int next_id;                /* Id of the next mapping. */
+};
+
+void mapping_cache_init(void);
+struct mapping *mapping_alloc(void);
+void mapping_free(struct mapping *m);
+
+void mmap_table_init(struct mmap_table *mt);
+void mmap_table_destroy(struct mmap_table *mt);
+bool mmap_table_insert(struct mmap_table *mt, struct mapping *m);
+void mmap_table_remove(struct mmap_table *mt, struct mapping *m);
+
+struct mapping *find_mapping_addr(struct mmap_table *mt, void *addr);
+struct mapping *find_mapping_id(struct mmap_table *mt, int id);
 
-#endif  /* vm/mmap.h */
\ No newline at end of file
+#endif  /* vm/mmap.h */
@@ -4,32 +4,159 @@
 #include <debug.h>
 #include <hash.h>
 #include <inttypes.h>
+#include <ptrmap.h>
+#include <rbtree.h>
 #include <round.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 
 #include "devices/timer.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/replay.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#include "vm/vmstat.h"
 
-unsigned SPT_hash(const struct hash_elem *e, void *aux) {
-  struct page *p = hash_entry(e, struct page, SPT_elem);
+/* With -spt=radix the SPT is a two-level table shaped like the page
+   directory: SPT_dir[pd_no(upage)] points to a page of struct page
+   pointers indexed by pt_no(upage).  Lookups then need no hashing, and
+   walking a range visits pages in address order. */
+static bool spt_radix;
+
+/* With -spt=open the SPT is a ptrmap from user page to struct page,
+   whose keys sit inline in one flat array instead of behind the
+   hash_elems of struct hash. */
+static bool spt_open;
+
+/* Object caches for SPT entries and regions. */
+static struct slab_cache page_cache;
+static struct slab_cache region_cache;
+
+#define SPT_DIR_CNT (PGSIZE / sizeof(struct page **))
+#define SPT_TABLE_CNT (PGSIZE / sizeof(struct page *))
+
+bool SPT_set_impl(const char *name) {
+  if (!strcmp(name, "hash"))
+    spt_radix = spt_open = false;
+  else if (!strcmp(name, "radix")) {
+    spt_radix = true;
+    spt_open = false;
+  } else if (!strcmp(name, "open")) {
+    spt_radix = false;
+    spt_open = true;
+  } else
+    return false;
+  return true;
+}
+
+/* Returns the radix SPT slot of UPAGE in T, allocating its table if
+   CREATE is set.  Returns NULL if there is no such table. */
+static struct page **radix_slot(struct thread *t, const void *upage,
+                                bool create) {
+  struct page **table;
+
+  if (t->SPT_dir == NULL) return NULL;
+  table = t->SPT_dir[pd_no(upage)];
+  if (table == NULL) {
+    if (!create) return NULL;
+    table = palloc_get_page(PAL_ZERO);
+    if (table == NULL) return NULL;
+    t->SPT_dir[pd_no(upage)] = table;
+  }
+  return &table[pt_no(upage)];
+}
+
+static bool file_load(struct page *p, void *kpage) {
+  if (file_read_at(p->page_file, kpage, p->read_bytes, p->ofs) !=
+      (off_t)p->read_bytes)
+    return false;
+  memset((uint8_t *)kpage + p->read_bytes, 0, p->zero_bytes);
+  return true;
+}
+
+static enum page_evict file_evict(struct page *p, void *kpage UNUSED,
+                                  bool dirty) {
+  // Clean pages are reread from the executable; read-only ones cannot
+  // have been modified.
+  return p->is_writable && dirty ? PAGE_SWAP : PAGE_DROP;
+}
+
+static bool stack_load(struct page *p UNUSED, void *kpage) {
+  memset(kpage, 0, PGSIZE);
+  return true;
+}
+
+static enum page_evict stack_evict(struct page *p UNUSED, void *kpage UNUSED,
+                                   bool dirty UNUSED) {
+  return PAGE_SWAP;
+}
+
+static void mmap_writeback(struct page *p, const void *kaddr) {
+  vm_stats.mmap_writebacks++;
+  file_write_at(p->page_file, kaddr, p->read_bytes, p->ofs);
+}
 
-  // hash_bytes conveniently returns appropriate hash with given size,
-  // which is better than our previous hash function, pt_no.
-  return hash_bytes(&p->page_addr, sizeof(p->page_addr));
+static enum page_evict mmap_evict(struct page *p, void *kpage, bool dirty) {
+  // Mapped pages go back to their file, never to swap.
+  if (dirty) mmap_writeback(p, kpage);
+  return PAGE_DROP;
+}
+
+static const struct page_ops file_ops = {
+  "file", SHARE_READONLY, true, file_load, file_evict, NULL, SWAP_WRITABLE,
+};
+static const struct page_ops stack_ops = {
+  "stack", SHARE_NONE, false, stack_load, stack_evict, NULL, SWAP_ALWAYS,
+};
+static const struct page_ops mmap_ops = {
+  "mmap", SHARE_ALL, true, file_load, mmap_evict, mmap_writeback, SWAP_NEVER,
+};
+// Anonymous memory starts out as zero pages and is swapped like stack.
+static const struct page_ops anon_ops = {
+  "anon", SHARE_NONE, false, stack_load, stack_evict, NULL, SWAP_ALWAYS,
+};
+
+// Shared memory is backed by swap slots of its segment, which
+// eviction writes itself, so its pages never take slots of their own.
+static const struct page_ops shm_ops = {
+  "shm", SHARE_ALL, false, shm_load, shm_evict, shm_writeback, SWAP_NEVER,
+};
+
+static const struct page_ops *const purpose_ops[] = {
+  [FOR_FILE] = &file_ops, [FOR_STACK] = &stack_ops, [FOR_MMAP] = &mmap_ops,
+  [FOR_ANON] = &anon_ops, [FOR_SHM] = &shm_ops,
+};
+
+void SPT_cache_init(void) {
+  slab_cache_init(&page_cache, "page", sizeof(struct page), NULL);
+  slab_cache_init(&region_cache, "SPT_region", sizeof(struct SPT_region),
+                  NULL);
+}
+
+// Hash of the page at PAGE_ADDR, for SPT_hash() and SPT_hash_find().
+static inline unsigned page_addr_hash(void *page_addr) {
+  return hash_u32((uintptr_t)page_addr);
+}
+
+unsigned SPT_hash(const struct hash_elem *e, void *aux) {
+  return page_addr_hash(hash_entry(e, struct page, SPT_elem)->page_addr);
 }
 
 bool SPT_less(const struct hash_elem *a, const struct hash_elem *b, void *aux) {
@@ -38,42 +165,116 @@ bool SPT_less(const struct hash_elem *a, const struct hash_elem *b, void *aux) {
   return p_a->page_addr < p_b->page_addr;
 }
 
+// SPT_hash_find(SPT, page_addr): hash_find() on the SPT, with SPT_hash()
+// and SPT_less() inlined.
+HASH_FIND_BY_KEY(SPT_hash_find, struct page, SPT_elem, void *, page_addr,
+                 page_addr_hash)
+
+/* Pages whose frames and swap slots SPT_destroy() releases at once. */
+#define DESTROY_BATCH 32
+
+/* Frames and swap slots of destroyed pages, not yet released. */
+struct destroy_batch {
+  struct thread *owner;
+  void *kpages[DESTROY_BATCH];
+  size_t frame_cnt;
+  size_t slots[DESTROY_BATCH];
+  size_t slot_cnt;
+};
+
+// Releases everything in B.
+static void destroy_flush(struct destroy_batch *b) {
+  frame_free_multiple(b->owner, b->kpages, b->frame_cnt);
+  SD_free_multiple(b->slots, b->slot_cnt);
+  b->frame_cnt = b->slot_cnt = 0;
+}
+
+// Frees P, adding its frame and swap slot to destroy batch AUX.  The
+// PTE is left alone: only the dead process's page directory has it,
+// and pagedir_destroy() frees no frames.
+static void page_destroy(struct page *p, void *aux) {
+  struct destroy_batch *b = aux;
+
+  if (p->frame_addr != NULL && !p->is_swapped && find_frame(p->frame_addr))
+    b->kpages[b->frame_cnt++] = p->frame_addr;
+  if (p->swap_i != BITMAP_ERROR) b->slots[b->slot_cnt++] = p->swap_i;
+  slab_free(&page_cache, p);
+  if (b->frame_cnt == DESTROY_BATCH || b->slot_cnt == DESTROY_BATCH)
+    destroy_flush(b);
+}
+
 // Function used in SPT_destroy
 void SPT_destructor(struct hash_elem *e, void *aux) {
-  if (e != NULL) {
-    struct page *p = hash_entry(e, struct page, SPT_elem);
-    if (p->frame_addr != NULL && !p->is_swapped) {
-      pagedir_clear_page(thread_current()->pagedir, p->page_addr);
-      if (find_frame(p->frame_addr)) frame_free(p->frame_addr);
-    }
-    free(p);
-  }
+  if (e != NULL) page_destroy(hash_entry(e, struct page, SPT_elem), aux);
 }
 
-void SPT_init() { hash_init(&thread_current()->SPT, SPT_hash, SPT_less, NULL); }
+// Orders regions by start address.
+static bool region_less(const struct rb_node *a, const struct rb_node *b,
+                        void *aux UNUSED) {
+  return rb_entry(a, struct SPT_region, node)->start <
+         rb_entry(b, struct SPT_region, node)->start;
+}
+
+/* Pages of a process evicted while it was blocked, most recent last,
+   with room for SPT_wake_prefetch() to work on a snapshot of them. */
+#define WAKE_PAGES 64
+
+struct wake_log {
+  size_t cnt;
+  void *upages[WAKE_PAGES];
+  bool busy;                     // SPT_wake_prefetch() is running
+  void *taken[WAKE_PAGES];
+  struct page *pages[WAKE_PAGES];
+  size_t slots[WAKE_PAGES];
+  void *kpages[WAKE_PAGES];
+};
+
+void SPT_init() {
+  struct thread *t = process_current();
+
+  hash_init(&t->SPT, SPT_hash, SPT_less, NULL);
+  ptrmap_init(&t->SPT_map);
+  rb_init(&t->SPT_regions, region_less, NULL);
+  t->SPT_dir = spt_radix ? palloc_get_page(PAL_ZERO) : NULL;
+  if (spt_radix && t->SPT_dir == NULL) PANIC("SPT_init: out of memory");
+  // Without a log the process just faults its pages back in.
+  if (t->wake_log == NULL) t->wake_log = calloc(1, sizeof *t->wake_log);
+}
+
+bool SPT_lock(void) {
+  struct lock *lock = &process_current()->SPT_lock;
+
+  if (lock_held_by_current_thread(lock)) return false;
+  lock_acquire(lock);
+  return true;
+}
+
+void SPT_unlock(bool locked) {
+  if (locked) lock_release(&process_current()->SPT_lock);
+}
 
 struct page *SPT_search(struct thread *owner, void *page_addr) {
-  struct page temp;
-  temp.page_addr = page_addr;
-  struct hash_elem *e = hash_find(&(owner->SPT), &temp.SPT_elem);
-  if (e != NULL) {
-    struct page *p = hash_entry(e, struct page, SPT_elem);
-    return p;
-  } else {
-    return NULL;
+  if (owner->SPT_dir != NULL) {
+    struct page **slot = radix_slot(owner, page_addr, false);
+    return slot != NULL ? *slot : NULL;
   }
+  if (spt_open) return ptrmap_find(&owner->SPT_map, page_addr);
+
+  return SPT_hash_find(&owner->SPT, page_addr);
 }
 
 struct page *SPT_insert(struct file *f, off_t ofs, void *page_addr, void *frame_addr,
                         size_t read_bytes, size_t zero_bytes, bool writable,
                         enum page_purpose purpose) {
-  if (SPT_search(thread_current(), page_addr) != NULL) {
+  if (SPT_search(process_current(), page_addr) != NULL) {
     printf("EXIST NO!!!!\n");
-    return;
+    return NULL;
   }
   struct page *p;
-  p = malloc(sizeof(struct page));
+  p = slab_alloc(&page_cache);
+  if (p == NULL) return NULL;
   p->page_file = f;
+  p->shm = NULL;
   p->ofs = ofs;
   p->page_addr = page_addr;
   p->frame_addr = frame_addr;
@@ -82,25 +283,862 @@ struct page *SPT_insert(struct file *f, off_t ofs, void *page_addr, void *frame_
   p->is_writable = writable;
   p->is_swapped = false;
   p->purpose = purpose;
+  p->ops = purpose_ops[purpose];
   p->swap_i = BITMAP_ERROR;
+  // bss pages are zero-fill: share the zero page until written.
+  p->is_zero = (purpose == FOR_FILE || purpose == FOR_ANON) && read_bytes == 0;
+  p->is_cow = false;
 
   struct frame *frame = find_frame(frame_addr);
   if (frame) {
     frame->page_addr = page_addr;
     frame->is_evictable = true;
   }
-  hash_insert(&thread_current()->SPT, &p->SPT_elem);
+  if (process_current()->SPT_dir != NULL) {
+    struct page **slot = radix_slot(process_current(), page_addr, true);
+    if (slot == NULL) {
+      slab_free(&page_cache, p);
+      return NULL;
+    }
+    *slot = p;
+  } else if (spt_open) {
+    if (!ptrmap_insert(&process_current()->SPT_map, page_addr, p)) {
+      slab_free(&page_cache, p);
+      return NULL;
+    }
+  } else
+    hash_insert(&process_current()->SPT, &p->SPT_elem);
   return p;
 }
 
 void SPT_remove(void *page_addr) {
+  struct thread *t = process_current();
+
+  if (t->SPT_dir != NULL) {
+    struct page **slot = radix_slot(t, page_addr, false);
+    if (slot != NULL && *slot != NULL) {
+      slab_free(&page_cache, *slot);
+      *slot = NULL;
+    }
+    return;
+  }
+  if (spt_open) {
+    struct page *p = ptrmap_remove(&t->SPT_map, page_addr);
+    if (p != NULL) slab_free(&page_cache, p);
+    return;
+  }
+
   struct page temp;
   temp.page_addr = page_addr;
-  struct hash_elem *e = hash_delete(&thread_current()->SPT, &temp.SPT_elem);
+  struct hash_elem *e = hash_delete(&t->SPT, &temp.SPT_elem);
   if (e != NULL) {
     struct page *p = hash_entry(e, struct page, SPT_elem);
-    free(p);
+    slab_free(&page_cache, p);
+  }
+}
+
+void SPT_walk(struct thread *owner, void *start, void *end,
+              SPT_walk_func *fn, void *aux) {
+  if (start >= end) return;
+
+  if (spt_open) {
+    struct ptrmap_slot *s;
+    size_t pos = 0;
+
+    while ((s = ptrmap_next(&owner->SPT_map, &pos)) != NULL) {
+      struct page *p = s->value;
+      if (p->page_addr >= start && p->page_addr < end) fn(p, aux);
+    }
+    return;
+  }
+  if (owner->SPT_dir == NULL) {
+    struct hash_iterator it;
+
+    hash_first(&it, &owner->SPT);
+    while (hash_next(&it)) {
+      struct page *p = hash_entry(hash_cur(&it), struct page, SPT_elem);
+      if (p->page_addr >= start && p->page_addr < end) fn(p, aux);
+    }
+    return;
+  }
+
+  // Visit only the tables that exist, page by page within a table.
+  uint8_t *upage = pg_round_down(start);
+  while (upage < (uint8_t *)end) {
+    struct page **table = owner->SPT_dir[pd_no(upage)];
+    uint8_t *next = (uint8_t *)(((uintptr_t)upage | PTMASK | PGMASK) + 1);
+
+    if (table != NULL)
+      for (; upage < next && upage < (uint8_t *)end; upage += PGSIZE)
+        if (table[pt_no(upage)] != NULL) fn(table[pt_no(upage)], aux);
+    if (next == NULL) break;  // wrapped around the top of memory
+    upage = next;
+  }
+}
+
+void SPT_destroy(struct thread *t) {
+  struct rb_tree *regions = &t->SPT_regions;
+  struct destroy_batch b;
+
+  b.owner = t;
+  b.frame_cnt = b.slot_cnt = 0;
+
+  if (t->SPT_dir != NULL) {
+    size_t i, j;
+
+    for (i = 0; i < SPT_DIR_CNT; i++) {
+      struct page **table = t->SPT_dir[i];
+      if (table == NULL) continue;
+      for (j = 0; j < SPT_TABLE_CNT; j++)
+        if (table[j] != NULL) {
+          struct page *p = table[j];
+          table[j] = NULL;
+          page_destroy(p, &b);
+        }
+      t->SPT_dir[i] = NULL;
+      palloc_free_page(table);
+    }
+    palloc_free_page(t->SPT_dir);
+    t->SPT_dir = NULL;
+  } else if (spt_open) {
+    struct ptrmap_slot *s;
+    size_t pos = 0;
+
+    while ((s = ptrmap_next(&t->SPT_map, &pos)) != NULL)
+      page_destroy(s->value, &b);
+    ptrmap_destroy(&t->SPT_map);
+  } else {
+    t->SPT.aux = &b;
+    hash_destroy(&t->SPT, SPT_destructor);
+  }
+  destroy_flush(&b);
+  free(t->wake_log);
+  t->wake_log = NULL;
+  while (!rb_empty(regions)) {
+    struct SPT_region *r = rb_entry(regions->root, struct SPT_region, node);
+    rb_remove(regions, &r->node);
+    slab_free(&region_cache, r);
+  }
+}
+
+bool SPT_insert_region(struct file *f, off_t ofs, void *start,
+                       size_t read_bytes, size_t zero_bytes, bool writable,
+                       enum page_purpose purpose) {
+  struct SPT_region *r = slab_alloc(&region_cache);
+  if (r == NULL) return false;
+
+  ASSERT(pg_ofs(start) == 0);
+  ASSERT((read_bytes + zero_bytes) % PGSIZE == 0);
+  r->start = start;
+  r->length = read_bytes + zero_bytes;
+  r->file = f;
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  r->is_writable = writable;
+  r->purpose = purpose;
+  // Large pages are private; shared memory needs its frames shared.
+  r->large_ok = purpose != FOR_SHM;
+  r->advice = MADV_NORMAL;
+  rb_insert(&process_current()->SPT_regions, &r->node);
+  return true;
+}
+
+/* Returns T's first region starting at START, or NULL. */
+static struct SPT_region *region_at(struct thread *t, const void *start) {
+  struct SPT_region key = {.start = (uint8_t *)start};
+  struct rb_node *n;
+
+  n = rb_find(&t->SPT_regions, &key.node);
+  return n != NULL ? rb_entry(n, struct SPT_region, node) : NULL;
+}
+
+void SPT_remove_region(void *start) {
+  struct thread *t = process_current();
+  struct SPT_region *r = region_at(t, start);
+
+  if (r != NULL) {
+    rb_remove(&t->SPT_regions, &r->node);
+    slab_free(&region_cache, r);
+  }
+}
+
+bool SPT_resize_region(void *start, size_t length) {
+  struct thread *t = process_current();
+  struct SPT_region *r = region_at(t, start);
+  uint8_t *upage;
+
+  ASSERT(length % PGSIZE == 0);
+  if (r == NULL) return false;
+
+  for (upage = r->start + length; upage < r->start + r->length;
+       upage += PGSIZE) {
+    struct page *p = SPT_search(t, upage);
+    if (p == NULL) continue;
+    void *kpage = pagedir_get_page(t->pagedir, upage);
+    pagedir_clear_page(t->pagedir, upage);
+    pagedir_set_dirty(t->pagedir, upage, false);  // frees an empty table
+    if (kpage != NULL) frame_free(pg_round_down(kpage));
+    if (p->swap_i != BITMAP_ERROR) SD_free(p->swap_i);
+    SPT_remove(upage);
+  }
+  r->length = length;
+  return true;
+}
+
+/* Returns the node of T's last region starting below ADDR, or NULL.
+   Regions of nonzero length never overlap, so walking back from here
+   with rb_prev() visits them in decreasing order of end as well, and
+   a walk for regions overlapping a range can stop at the first one
+   that ends before it.  Zero-length regions, such as an empty heap,
+   can sit anywhere and are skipped over. */
+static struct rb_node *region_before(struct thread *t, const void *addr) {
+  struct SPT_region key = {.start = (uint8_t *)addr};
+  struct rb_node *n;
+
+  n = rb_lower_bound(&t->SPT_regions, &key.node);
+  return n != NULL ? rb_prev(n) : rb_last(&t->SPT_regions);
+}
+
+bool SPT_range_free(const void *start, const void *end) {
+  struct thread *t = process_current();
+  struct rb_node *n;
+
+  if (end < start || end > PHYS_BASE - STACK_MAX) return false;
+  for (n = region_before(t, end); n != NULL; n = rb_prev(n)) {
+    struct SPT_region *r = rb_entry(n, struct SPT_region, node);
+    if ((const uint8_t *)start < r->start + r->length) return false;
+    if (r->length > 0) break;
+  }
+  return true;
+}
+
+/* Returns T's region that covers UPAGE, or NULL. */
+static struct SPT_region *region_find(struct thread *t, const void *upage) {
+  struct rb_node *n;
+
+  for (n = region_before(t, (const uint8_t *)upage + 1); n != NULL;
+       n = rb_prev(n)) {
+    struct SPT_region *r = rb_entry(n, struct SPT_region, node);
+    if (r->length > 0)
+      return (size_t)((const uint8_t *)upage - r->start) < r->length ? r
+                                                                     : NULL;
+  }
+  return NULL;
+}
+
+struct page *SPT_lookup(void *page_addr) {
+  struct thread *t = process_current();
+  struct page *p = SPT_search(t, page_addr);
+  struct SPT_region *r;
+
+  if (p != NULL) return p;
+  r = region_find(t, page_addr);
+  if (r == NULL) return NULL;
+
+  // First touch: create the page's own entry.
+  size_t offset = (uint8_t *)page_addr - r->start;
+  size_t read_bytes = 0;
+  if (offset < r->read_bytes)
+    read_bytes =
+        r->read_bytes - offset < PGSIZE ? r->read_bytes - offset : PGSIZE;
+  p = SPT_insert(r->file, r->ofs + offset, page_addr, NULL, read_bytes,
+                 PGSIZE - read_bytes, r->is_writable, r->purpose);
+  if (p != NULL && (r->purpose == FOR_MMAP || r->purpose == FOR_ANON ||
+                    r->purpose == FOR_SHM)) {
+    struct mapping *m = find_mapping_addr(&t->mmap_table, page_addr);
+    if (m != NULL) {
+      list_push_back(&m->pages, &p->MMAP_elem);
+      p->shm = m->shm;
+    }
+  }
+  return p;
+}
+
+/* Number of following swap slots a swap-in fault reads ahead, and the
+   number of free frames that must remain for readahead to happen. */
+#define SWAP_READAHEAD 4
+#define READAHEAD_MIN_FREE 16
+
+int SPT_swap_readahead = SWAP_READAHEAD;
+
+void SPT_readahead(size_t swap_i) {
+  struct thread *t = process_current();
+  size_t k;
+
+  for (k = 1; k <= (size_t)SPT_swap_readahead; k++) {
+    // Only slots holding one of our own swapped-out pages qualify.
+    struct page *p = SD_slot_page(swap_i + k);
+    if (p == NULL || SPT_search(t, p->page_addr) != p || !p->is_swapped ||
+        p->purpose == FOR_MMAP)
+      break;
+    // Never evict anything to make room for a guess.
+    if (frame_free_cnt() <= READAHEAD_MIN_FREE) break;
+
+    void *kpage = frame_alloc(PAL_USER, t, p->page_addr, true)->frame_addr;
+    SD_read(p->swap_i, kpage);
+    vm_stats.readaheads++;
+    p->frame_addr = kpage;
+    p->is_swapped = false;
+    // The new PTE starts out not accessed, so the clock reclaims the
+    // page first if the guess was wrong; its slot stays valid.
+    pagedir_set_page(t->pagedir, p->page_addr, kpage, p->is_writable);
+  }
+}
+
+void SPT_wake_note(struct thread *owner, void *upage) {
+  struct wake_log *log = owner->wake_log;
+  enum intr_level old_level;
+
+  if (log == NULL) return;
+  old_level = intr_disable();
+  if (log->cnt < WAKE_PAGES) log->upages[log->cnt++] = upage;
+  intr_set_level(old_level);
+}
+
+void SPT_wake_prefetch(void) {
+  struct thread *t = process_current();
+  struct wake_log *log = t->wake_log;
+  enum intr_level old_level;
+  size_t taken_cnt, cnt = 0, i, j;
+  bool locked;
+
+  if (log == NULL || log->cnt == 0) return;
+  old_level = intr_disable();
+  if (log->busy) {
+    intr_set_level(old_level);
+    return;
+  }
+  log->busy = true;
+  taken_cnt = log->cnt;
+  memcpy(log->taken, log->upages, taken_cnt * sizeof *log->taken);
+  log->cnt = 0;
+  intr_set_level(old_level);
+  locked = SPT_lock();
+
+  // Keep the pages still out in swap, sorted by slot, so that the reads
+  // of neighboring slots go to the disk together.
+  for (i = 0; i < taken_cnt; i++) {
+    struct page *p = SPT_search(t, log->taken[i]);
+    if (p == NULL || !p->is_swapped || p->swap_i == BITMAP_ERROR ||
+        p->frame_addr != NULL || p->purpose == FOR_MMAP ||
+        p->purpose == FOR_SHM)
+      continue;
+    for (j = cnt; j > 0 && log->slots[j - 1] > p->swap_i; j--) continue;
+    if (j > 0 && log->slots[j - 1] == p->swap_i) continue;
+    memmove(&log->slots[j + 1], &log->slots[j],
+            (cnt - j) * sizeof *log->slots);
+    memmove(&log->pages[j + 1], &log->pages[j],
+            (cnt - j) * sizeof *log->pages);
+    log->slots[j] = p->swap_i;
+    log->pages[j] = p;
+    cnt++;
+  }
+
+  // Never evict anything to make room for pages nobody asked for yet.
+  for (i = 0; i < cnt && frame_free_cnt() > READAHEAD_MIN_FREE; i++)
+    log->kpages[i] =
+        frame_alloc(PAL_USER, t, log->pages[i]->page_addr, true)->frame_addr;
+  cnt = i;
+  if (cnt > 0) SD_read_multiple(log->slots, log->kpages, cnt);
+
+  for (i = 0; i < cnt; i++) {
+    struct page *p = log->pages[i];
+    // Another thread of the process may have faulted it in meanwhile.
+    if (SPT_search(t, p->page_addr) != p || !p->is_swapped ||
+        p->swap_i != log->slots[i] ||
+        pagedir_get_page(t->pagedir, p->page_addr) != NULL) {
+      frame_free(log->kpages[i]);
+      continue;
+    }
+    p->frame_addr = log->kpages[i];
+    p->is_swapped = false;
+    vm_stats.wake_prefetches++;
+    // Not accessed, as with readahead: a wrong guess is reclaimed first.
+    pagedir_set_page(t->pagedir, p->page_addr, p->frame_addr, p->is_writable);
+  }
+  SPT_unlock(locked);
+  log->busy = false;
+}
+
+/* Whether faults may map whole 4 MB chunks with large pages. */
+static bool large_pages;
+
+void SPT_set_large_pages(bool enable) { large_pages = enable; }
+
+bool SPT_map_large(struct page *fp) {
+  struct thread *t = process_current();
+  struct SPT_region *r = region_find(t, fp->page_addr);
+  uint8_t *chunk = (uint8_t *)((uintptr_t)fp->page_addr & ~(PTSPAN - 1));
+  uint8_t *upage, *kpage;
+  struct frame *f;
+  size_t i;
+
+  if (!large_pages || r == NULL || !r->large_ok || !r->is_writable) return false;
+  if (chunk < r->start || chunk + PTSPAN > r->start + r->length) return false;
+  if (r->purpose != FOR_MMAP && (size_t)(chunk - r->start) < r->read_bytes)
+    return false;
+  for (upage = chunk; upage < chunk + PTSPAN; upage += PGSIZE) {
+    struct page *p = SPT_search(t, upage);
+    if (pagedir_get_page(t->pagedir, upage) != NULL ||
+        (p != NULL && p->swap_i != BITMAP_ERROR)) {
+      r->large_ok = false;  // don't rescan on every fault
+      return false;
+    }
+  }
+
+  // Stop trying for this region once memory for one is not there.
+  f = frame_alloc_large(t, chunk);
+  if (f == NULL) {
+    r->large_ok = false;
+    return false;
+  }
+  kpage = f->frame_addr;
+  for (i = 0; i < PTSPAN / PGSIZE; i++) {
+    struct page *p = SPT_lookup(chunk + i * PGSIZE);
+    if (p == NULL || !p->ops->load(p, kpage + i * PGSIZE)) break;
+    p->frame_addr = kpage + i * PGSIZE;
+    p->is_zero = false;
   }
+  if (i == PTSPAN / PGSIZE &&
+      pagedir_set_large_page(t->pagedir, chunk, kpage, true)) {
+    vm_stats.large_maps++;
+    return true;
+  }
+
+  // Undo: give back every frame and forget the partial loads.
+  r->large_ok = false;
+  for (i = 0; i < PTSPAN / PGSIZE; i++) {
+    struct page *p = SPT_search(t, chunk + i * PGSIZE);
+    if (p != NULL && p->frame_addr == kpage + i * PGSIZE) {
+      p->frame_addr = NULL;
+      p->is_zero = (p->purpose == FOR_FILE || p->purpose == FOR_ANON) &&
+                   p->read_bytes == 0;
+    }
+    frame_free(kpage + i * PGSIZE);
+  }
+  return false;
+}
+
+/* Whether P's frame may be found through the page cache. */
+static bool page_can_share(const struct page *p) {
+  return p->ops->share == SHARE_ALL ||
+         (p->ops->share == SHARE_READONLY && !p->is_writable);
+}
+
+bool SPT_may_swap(const struct page *p) {
+  return p->swap_i == BITMAP_ERROR &&
+         (p->ops->swap == SWAP_ALWAYS ||
+          (p->ops->swap == SWAP_WRITABLE && p->is_writable));
+}
+
+bool SPT_fault_in(struct page *p) {
+  struct thread *t = process_current();
+  bool swapped = p->is_swapped;
+  size_t swap_i = p->swap_i;
+
+  if (p->purpose == FOR_SHM) return shm_fault_in(p);
+
+  // File pages are shared with anyone running or mapping the same file.
+  bool share = !swapped && page_can_share(p);
+  struct inode *inode = share ? file_get_inode(p->page_file) : NULL;
+  if (p->purpose == FOR_FILE) replay_note_fault(p);
+  if (share && frame_share_map(p, inode)) {
+    SPT_fault_around(p);
+    return true;
+  }
+
+  struct frame *f = frame_alloc(PAL_USER, t, p->page_addr, true);
+  void *kpage = f->frame_addr;
+  if (swapped)
+    SD_read(swap_i, kpage);
+  else if (!p->ops->load(p, kpage)) {
+    frame_free(kpage);
+    return false;
+  }
+  p->frame_addr = kpage;
+  p->is_swapped = false;
+  p->is_cow = false;
+  if (!pagedir_set_page(t->pagedir, p->page_addr, kpage, p->is_writable)) {
+    p->frame_addr = NULL;
+    frame_free(kpage);
+    return false;
+  }
+
+  if (swapped) {
+    struct SPT_region *r = region_find(t, p->page_addr);
+    if (r == NULL || r->advice != MADV_RANDOM) SPT_readahead(swap_i);
+  } else {
+    if (share) frame_share_insert(f, p, inode);
+    if (p->ops->fault_around) SPT_fault_around(p);
+  }
+  return true;
+}
+
+/* Size of the fault-around window in pages, 0 or 1 to disable. */
+static size_t fault_around_pages = 16;
+
+/* Pages read ahead of, and aged behind, a fault in a region advised
+   MADV_SEQUENTIAL. */
+#define SEQUENTIAL_PAGES 64
+
+void SPT_set_fault_around(size_t pages) { fault_around_pages = pages; }
+
+void SPT_fault_around(struct page *fp) {
+  struct thread *t = process_current();
+  struct SPT_region *r = region_find(t, fp->page_addr);
+  uint8_t *lo, *hi, *upage;
+
+  if (r == NULL || r->advice == MADV_RANDOM) return;
+
+  size_t span;
+  if (r->advice == MADV_SEQUENTIAL) {
+    // Read well ahead of the cursor, and let the clock take what is
+    // behind it first: a sequential reader will not be back.
+    span = SEQUENTIAL_PAGES * PGSIZE;
+    lo = fp->page_addr;
+    hi = lo + span;
+    upage = (size_t)(lo - r->start) > span ? lo - span : r->start;
+    for (; upage < lo; upage += PGSIZE)
+      pagedir_set_accessed(t->pagedir, upage, false);
+  } else {
+    // The window is aligned to its own size.
+    if (fault_around_pages <= 1) return;
+    span = fault_around_pages * PGSIZE;
+    lo = (uint8_t *)((uintptr_t)fp->page_addr / span * span);
+    hi = lo + span;
+  }
+  if (lo < r->start) lo = r->start;
+  if (hi > r->start + r->length) hi = r->start + r->length;
+
+  for (upage = lo; upage < hi; upage += PGSIZE) {
+    if (upage == fp->page_addr || pagedir_get_page(t->pagedir, upage) != NULL)
+      continue;
+    // As with readahead, never evict anything to make room for a guess.
+    if (frame_free_cnt() <= READAHEAD_MIN_FREE) break;
+
+    struct page *p = SPT_lookup(upage);
+    if (p == NULL || p->is_swapped || p->is_zero) continue;
+    if (!SPT_prefetch(p)) break;
+    vm_stats.fault_arounds++;
+  }
+}
+
+bool SPT_prefetch(struct page *p) {
+  struct thread *t = process_current();
+  bool share = page_can_share(p);
+  struct inode *inode = file_get_inode(p->page_file);
+  if (share && frame_share_map(p, inode)) return true;
+
+  struct frame *f = frame_alloc(PAL_USER, t, p->page_addr, true);
+  uint8_t *kpage = f->frame_addr;
+  if (!p->ops->load(p, kpage)) {
+    frame_free(kpage);
+    return false;
+  }
+  p->frame_addr = kpage;
+  // Installed not accessed, so the clock takes it first if unused.
+  if (!pagedir_set_page(t->pagedir, p->page_addr, kpage, p->is_writable)) {
+    p->frame_addr = NULL;
+    frame_free(kpage);
+    return false;
+  }
+  if (share) frame_share_insert(f, p, inode);
+  return true;
+}
+
+int SPT_stack_limit = STACK_MAX;
+int SPT_stack_slack = 32;
+
+/* Most pages one stack fault maps, 1 to map only the faulting one. */
+static size_t stack_chunk_pages = 8;
+
+void SPT_set_stack_chunk(size_t pages) {
+  if (pages < 1) pages = 1;
+  if (pages > FRAME_ALLOC_BATCH) pages = FRAME_ALLOC_BATCH;
+  stack_chunk_pages = pages;
 }
 
-void SPT_destroy() { hash_destroy(&thread_current()->SPT, SPT_destructor); }
+/* Returns true if UPAGE of T is in no page or region yet. */
+static bool stack_gap(struct thread *t, uint8_t *upage) {
+  return SPT_search(t, upage) == NULL && region_find(t, upage) == NULL;
+}
+
+struct page *SPT_grow_stack(void *fault_page, const void *esp) {
+  struct thread *t = process_current();
+  uint8_t *floor = (uint8_t *)PHYS_BASE - SPT_stack_limit;
+  uint8_t *esp_page = pg_round_down(esp);
+  uint8_t *lo = fault_page, *hi = lo + PGSIZE, *upage;
+  size_t max = stack_chunk_pages * PGSIZE;
+  void *upages[FRAME_ALLOC_BATCH];
+  struct page *pages[FRAME_ALLOC_BATCH];
+  struct frame *frames[FRAME_ALLOC_BATCH];
+  void *kpages[FRAME_ALLOC_BATCH];
+  size_t cnt = 0, got, mapped, i;
+
+  // Everything from ESP up to the lowest stack page is stack in use:
+  // first the gap above the fault, then what lies below it down to
+  // ESP.
+  while ((size_t)(hi - lo) < max && is_user_vaddr(hi) && stack_gap(t, hi))
+    hi += PGSIZE;
+  while ((size_t)(hi - lo) < max && lo > esp_page && lo - PGSIZE >= floor &&
+         stack_gap(t, lo - PGSIZE))
+    lo -= PGSIZE;
+
+  // The faulting page goes first.
+  upages[0] = fault_page;
+  for (upage = lo; upage < hi; upage += PGSIZE)
+    if (upage != fault_page) upages[++cnt] = upage;
+  cnt++;
+  for (i = 0; i < cnt; i++) {
+    pages[i] =
+        SPT_insert(NULL, 0, upages[i], NULL, 0, PGSIZE, true, FOR_STACK);
+    if (pages[i] == NULL) break;
+  }
+  if (i == 0) return NULL;
+  cnt = i;
+
+  // Beyond the faulting page, only take memory that is plainly free.
+  // Pages left without a frame fault in as usual.
+  if (frame_free_cnt() <= READAHEAD_MIN_FREE) cnt = 1;
+  got = frame_alloc_multiple(PAL_USER | PAL_ZERO, t, upages, cnt, frames);
+
+  // The pages lie between LO and HI, so one call maps all of them.
+  for (i = 0; i < (size_t)(hi - lo) / PGSIZE; i++) kpages[i] = NULL;
+  for (i = 0; i < got; i++)
+    kpages[((uint8_t *)upages[i] - lo) / PGSIZE] = frames[i]->frame_addr;
+  mapped = pagedir_set_range(t->pagedir, lo, kpages, (hi - lo) / PGSIZE, true);
+  for (i = 0; i < got; i++) {
+    void *kpage = frames[i]->frame_addr;
+    if ((size_t)((uint8_t *)upages[i] - lo) / PGSIZE >= mapped)
+      frame_free(kpage);
+    else {
+      pages[i]->frame_addr = kpage;
+      if (i > 0) vm_stats.stack_prefaults++;
+    }
+  }
+  return pages[0];
+}
+
+/* Drops private page P of T from memory and swap, so that it reads
+   back as it was first loaded: from its file, or zeros. */
+static void page_discard(struct thread *t, struct page *p) {
+  void *kpage = pagedir_get_page(t->pagedir, p->page_addr);
+
+  pagedir_clear_page(t->pagedir, p->page_addr);
+  if (kpage != NULL) frame_free(pg_round_down(kpage));
+  if (p->swap_i != BITMAP_ERROR) SD_free(p->swap_i);
+  p->swap_i = BITMAP_ERROR;
+  p->is_swapped = false;
+  p->frame_addr = NULL;
+  p->is_cow = false;
+  p->is_zero = p->purpose == FOR_STACK || p->read_bytes == 0;
+}
+
+bool SPT_advise(void *start, void *end, int advice) {
+  struct thread *t = process_current();
+  struct rb_node *n;
+  uint8_t *upage;
+
+  switch (advice) {
+    case MADV_NORMAL:
+    case MADV_SEQUENTIAL:
+    case MADV_RANDOM:
+      for (n = region_before(t, end); n != NULL; n = rb_prev(n)) {
+        struct SPT_region *r = rb_entry(n, struct SPT_region, node);
+        if (r->start + r->length > (uint8_t *)start)
+          r->advice = advice;
+        else if (r->length > 0)
+          break;
+      }
+      return true;
+
+    case MADV_WILLNEED:
+      for (upage = start; upage < (uint8_t *)end; upage += PGSIZE) {
+        if (pagedir_get_page(t->pagedir, upage) != NULL) continue;
+        // Like readahead this is only a hint: never evict for it.
+        if (frame_free_cnt() <= READAHEAD_MIN_FREE) break;
+        struct page *p = SPT_lookup(upage);
+        if (p == NULL || p->is_zero) continue;
+        if (!SPT_fault_in(p)) break;
+        // Not accessed until the process actually touches it.
+        pagedir_set_accessed(t->pagedir, upage, false);
+        vm_stats.readaheads++;
+      }
+      return true;
+
+    case MADV_DONTNEED:
+      // Mappings and shared memory are shared with others; their pages
+      // are kept.
+      for (upage = start; upage < (uint8_t *)end; upage += PGSIZE) {
+        struct page *p = SPT_search(t, upage);
+        if (p != NULL && p->ops->share != SHARE_ALL && p->is_writable)
+          page_discard(t, p);
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void SPT_map_zero(struct page *p, bool write) {
+  struct thread *t = process_current();
+  void *kpage;
+
+  if (pagedir_get_page(t->pagedir, p->page_addr) != NULL)
+    pagedir_clear_page(t->pagedir, p->page_addr);
+
+  if (write) {
+    kpage = frame_alloc(PAL_USER | PAL_ZERO, t, p->page_addr, true)->frame_addr;
+    p->is_zero = false;
+    p->is_cow = false;
+    p->frame_addr = kpage;
+    pagedir_set_page(t->pagedir, p->page_addr, kpage, p->is_writable);
+  } else {
+    p->frame_addr = frame_zero_page();
+    pagedir_set_page(t->pagedir, p->page_addr, p->frame_addr, false);
+  }
+}
+
+/* State of SPT_fork() while it walks the parent's pages. */
+struct fork_state {
+  struct thread *parent;
+  bool ok;
+};
+
+/* The child's file for one of PARENT's page files: its own handle on
+   the executable or snapshot, or nothing for pages without a file. */
+static struct file *fork_file(struct thread *parent, struct file *f) {
+  if (f != NULL && f == parent->executable) return process_current()->executable;
+  if (f != NULL && f == parent->snapshot) return process_current()->snapshot;
+  return NULL;
+}
+
+// Copies parent page PP into the current process.
+static void page_fork(struct page *pp, void *aux) {
+  struct fork_state *s = aux;
+  struct page *p;
+
+  if (!s->ok || find_mapping_addr(&s->parent->mmap_table, pp->page_addr))
+    return;
+  p = SPT_insert(fork_file(s->parent, pp->page_file), pp->ofs, pp->page_addr,
+                 NULL, pp->read_bytes, pp->zero_bytes, pp->is_writable,
+                 pp->purpose);
+  if (p == NULL) {
+    s->ok = false;
+    return;
+  }
+  p->is_zero = pp->is_zero;
+  if (!p->is_zero && !frame_fork(s->parent, pp, p)) s->ok = false;
+}
+
+bool SPT_fork(struct thread *parent) {
+  struct thread *t = process_current();
+  struct fork_state s = {parent, true};
+  struct rb_node *n;
+
+  for (n = rb_first(&parent->SPT_regions); n != NULL; n = rb_next(n)) {
+    struct SPT_region *r = rb_entry(n, struct SPT_region, node);
+    if (find_mapping_addr(&parent->mmap_table, r->start)) continue;
+
+    struct SPT_region *c = slab_alloc(&region_cache);
+    if (c == NULL) return false;
+    *c = *r;
+    c->file = fork_file(parent, r->file);
+    rb_insert(&t->SPT_regions, &c->node);
+  }
+  SPT_walk(parent, NULL, PHYS_BASE, page_fork, &s);
+  return s.ok;
+}
+
+/* Pages timed by SPT_bench(), a power of 2, and the times each is
+   looked up. */
+#define BENCH_PAGES 4096
+#define BENCH_ROUNDS 8
+
+/* Tables under test in SPT_bench(). */
+static struct hash bench_hash;
+static struct ptrmap bench_map;
+
+static void bench_hash_insert(struct page *p) {
+  hash_insert(&bench_hash, &p->SPT_elem);
+}
+static bool bench_hash_find(struct page *p) {
+  return hash_find(&bench_hash, &p->SPT_elem) != NULL;
+}
+static void bench_hash_remove(struct page *p) {
+  hash_delete(&bench_hash, &p->SPT_elem);
+}
+static void bench_open_insert(struct page *p) {
+  ptrmap_insert(&bench_map, p->page_addr, p);
+}
+static bool bench_open_find(struct page *p) {
+  return ptrmap_find(&bench_map, p->page_addr) != NULL;
+}
+static void bench_open_remove(struct page *p) {
+  ptrmap_remove(&bench_map, p->page_addr);
+}
+
+/* One table implementation to time. */
+struct bench_ops {
+  const char *name;
+  void (*insert)(struct page *);
+  bool (*find)(struct page *);
+  void (*remove)(struct page *);
+};
+
+static const struct bench_ops bench_ops[] = {
+  {"hash", bench_hash_insert, bench_hash_find, bench_hash_remove},
+  {"open", bench_open_insert, bench_open_find, bench_open_remove},
+};
+
+/* Prints the average cycles OPS takes to insert, find and remove
+   each of PAGES.  Lookups go in a scattered order, as page faults
+   of a large process would. */
+static void bench_run(const struct bench_ops *ops, struct page **pages) {
+  uint64_t start, insert, find, remove;
+  size_t i, found = 0;
+  int r;
+
+  start = rdtsc();
+  for (i = 0; i < BENCH_PAGES; i++) ops->insert(pages[i]);
+  insert = rdtsc() - start;
+
+  start = rdtsc();
+  for (r = 0; r < BENCH_ROUNDS; r++)
+    for (i = 0; i < BENCH_PAGES; i++)
+      found += ops->find(pages[(i * 2971 + r) & (BENCH_PAGES - 1)]);
+  find = rdtsc() - start;
+
+  start = rdtsc();
+  for (i = 0; i < BENCH_PAGES; i++) ops->remove(pages[i]);
+  remove = rdtsc() - start;
+
+  ASSERT(found == BENCH_PAGES * BENCH_ROUNDS);
+  printf("  %-5s insert %6" PRIu64 "  find %6" PRIu64 "  remove %6" PRIu64
+         "\n", ops->name, insert / BENCH_PAGES,
+         find / (BENCH_PAGES * BENCH_ROUNDS), remove / BENCH_PAGES);
+}
+
+void SPT_bench(char **argv UNUSED) {
+  struct page **pages = malloc(BENCH_PAGES * sizeof *pages);
+  size_t i;
+
+  if (pages == NULL) PANIC("sptbench: out of memory");
+  for (i = 0; i < BENCH_PAGES; i++) {
+    pages[i] = slab_alloc(&page_cache);
+    if (pages[i] == NULL) PANIC("sptbench: out of memory");
+    pages[i]->page_addr = (uint8_t *)0x08048000 + i * PGSIZE;
+  }
+
+  hash_init(&bench_hash, SPT_hash, SPT_less, NULL);
+  ptrmap_init(&bench_map);
+  printf("sptbench: %d pages, cycles per operation:\n", BENCH_PAGES);
+  for (i = 0; i < sizeof bench_ops / sizeof *bench_ops; i++)
+    bench_run(&bench_ops[i], pages);
+  hash_destroy(&bench_hash, NULL);
+  ptrmap_destroy(&bench_map);
+
+  for (i = 0; i < BENCH_PAGES; i++) slab_free(&page_cache, pages[i]);
+  free(pages);
+}
@@ -4,6 +4,7 @@
 #include <hash.h>
 #include <list.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "filesys/off_t.h"
 #include "threads/palloc.h"
@@ -27,19 +28,87 @@ This "metadata" includes:
 */
 
 // enums for specifying page's purpose
-enum page_purpose { FOR_FILE = 0, FOR_STACK = 1, FOR_MMAP = 2 };
+enum page_purpose {
+  FOR_FILE = 0,
+  FOR_STACK = 1,
+  FOR_MMAP = 2,
+  FOR_ANON = 3,
+  FOR_SHM = 4  // shared memory segment, see vm/shm.h
+};
+
+// Size limit of the user stack, which grows down from PHYS_BASE.
+#define STACK_MAX (8 * 1024 * 1024)
+
+// How far the stack may grow, up to STACK_MAX, and how far below ESP
+// a fault may be and still grow it.  Tunables "vm.stack_limit" and
+// "vm.stack_slack".
+extern int SPT_stack_limit;
+extern int SPT_stack_slack;
+
+// Swap slots a swap-in fault reads ahead; tunable "vm.swap_readahead".
+extern int SPT_swap_readahead;
+
+struct page;
+
+// What eviction does with a page that has no swap slot yet.
+enum page_evict {
+  PAGE_DROP,  // contents can be recreated (or were just written back)
+  PAGE_SWAP   // contents must go to swap
+};
+
+// Which pages of a purpose may live in the shared page cache.
+enum page_share {
+  SHARE_NONE,      // always private
+  SHARE_READONLY,  // read-only pages only; writable ones are private
+  SHARE_ALL        // every page: writes are meant to be seen by all
+};
+
+// Which pages of a purpose eviction may have to write to swap.
+enum page_swap {
+  SWAP_NEVER,     // contents can always be recreated or written back
+  SWAP_WRITABLE,  // writable pages, once written
+  SWAP_ALWAYS     // contents live only in memory and swap
+};
+
+/* Operations that differ by page purpose.  The fault and eviction
+   paths dispatch through these instead of switching on purpose. */
+struct page_ops {
+  const char *name;
+  enum page_share share;
+  bool fault_around;  // neighbours may be mapped along with a fault
+
+  // Fill KPAGE with P's initial contents.  Returns false on an I/O
+  // error.  Pages in swap are read by the caller instead.  Faults on
+  // the same file may run at once, so this reads at P's offset and
+  // never moves the file's position, which belongs to read().
+  bool (*load)(struct page *p, void *kpage);
+
+  // Decide how to evict P from KPAGE; DIRTY says whether it was
+  // written.  May write P back to its file itself.
+  enum page_evict (*evict)(struct page *p, void *kpage, bool dirty);
+
+  // Write P's contents at KADDR back to its file, or NULL if the page
+  // has no file to write to.
+  void (*writeback)(struct page *p, const void *kaddr);
+
+  enum page_swap swap;
+};
 
 struct page {
   void *page_addr;   // upage
   void *frame_addr;  // kpage
 
   bool is_writable;  // is writing on this page allowed?
-  size_t swap_i;     // index for swap disk (swapped page end up there)
+  size_t swap_i;     // swap slot; kept after swap-in as a swap cache
   bool is_swapped;   // true if this page is in swap_disk, false otherwise.
   enum page_purpose purpose;  // Purpose for this page
+  const struct page_ops *ops; // operations for this purpose
+  bool is_zero;      // all zeros: maps the shared zero page until written
+  bool is_cow;       // frame shared since fork(): mapped read-only until written
 
   /* File-related members */
   struct file *page_file;  // file for read (if purpose == FOR_FILE)
+  struct shm_segment *shm; // segment (if purpose == FOR_SHM)
   off_t ofs;               // file offset.
   size_t read_bytes;       // size of read bytes.
   size_t zero_bytes;       // size of remaining page (should be zeroed)
@@ -48,9 +117,46 @@ struct page {
   struct list_elem MMAP_elem; // list elem for MMAP mapping
 };
 
+/* A range of pages with common backing, such as an ELF segment or an
+   mmap.  Its pages get a struct page only once they are first looked
+   up by SPT_lookup(), so setting a region up costs O(1). */
+struct SPT_region {
+  uint8_t *start;             // first page
+  size_t length;              // bytes, a multiple of PGSIZE
+  struct file *file;          // backing file
+  off_t ofs;                  // file offset of start
+  size_t read_bytes;          // bytes read from file; the rest is zeroed
+  bool is_writable;
+  enum page_purpose purpose;
+  bool large_ok;              // may still try to map 4 MB pages
+  int advice;                 // MADV_NORMAL, MADV_SEQUENTIAL or MADV_RANDOM
+  struct rb_node node;        // node in thread's SPT_regions
+};
+
+// Select the SPT implementation: "hash" (the default), "radix", a
+// two-level table indexed like the page directory, or "open", an
+// open-addressing ptrmap.  Returns false for an unknown NAME.
+bool SPT_set_impl(const char *name);
+
+// Kernel action "sptbench": times lookups, insertions and removals of
+// page-sized keys in a struct hash and in a ptrmap.
+void SPT_bench(char **argv);
+
+// Set up the object caches for SPT entries.  Call this once at boot.
+void SPT_cache_init(void);
+
 // Initialize list object named frame_table. Call this in load()!
 void SPT_init();
 
+// Threads made by thread_spawn() share their process's SPT and
+// mappings, so everything that looks pages up and then acts on them,
+// faulting a page in or changing the mappings, does it holding the
+// process's SPT_lock.  SPT_lock() takes it unless the running thread
+// holds it already, as it does when a kernel access to user memory
+// faults under it, and returns whether it did, for SPT_unlock().
+bool SPT_lock(void);
+void SPT_unlock(bool locked);
+
 // Find page using page address as key.
 struct page *SPT_search(struct thread *owner, void *page_addr);
 
@@ -62,6 +168,110 @@ struct page *SPT_insert(struct file *f, off_t ofs, void *page_addr, void *frame_
 
 void SPT_remove(void *page_addr);
 
-void SPT_destroy();
+// Call FN(P, AUX) for each of OWNER's pages P in [START, END), in
+// address order with the radix SPT.  FN must not insert or remove pages.
+typedef void SPT_walk_func(struct page *p, void *aux);
+void SPT_walk(struct thread *owner, void *start, void *end,
+              SPT_walk_func *fn, void *aux);
+
+// Add a region of READ_BYTES + ZERO_BYTES bytes at page START, backed by
+// FILE from OFS, to the current process's SPT.
+bool SPT_insert_region(struct file *f, off_t ofs, void *start,
+                       size_t read_bytes, size_t zero_bytes, bool writable,
+                       enum page_purpose purpose);
+
+// Remove the region that starts at START, without touching pages that
+// were already created from it.
+void SPT_remove_region(void *start);
+
+// Make the region that starts at START LENGTH bytes long, a multiple
+// of PGSIZE.  Pages cut off the end are freed along with their frames
+// and swap slots.  Returns false if there is no such region.
+bool SPT_resize_region(void *start, size_t length);
+
+// Whether [START, END) is free for a new region: it overlaps no
+// region of the current process and stays clear of the stack.
+bool SPT_range_free(const void *start, const void *end);
+
+// Like SPT_search() on the current process, but creates the
+// struct page for a not yet touched page of a region.
+struct page *SPT_lookup(void *page_addr);
+
+// Free T's SPT along with its frames and swap slots, a batch at a time.
+// For dead processes only: T need not be running, and PTEs are left
+// for pagedir_destroy() to drop, so T must never run user code again.
+void SPT_destroy(struct thread *t);
+
+// Whether evicting P might take a new swap slot.  False for pages
+// that already have one, which they keep until written.
+bool SPT_may_swap(const struct page *p);
+
+// Bring non-zero page P of the current process into memory and map
+// it.  Returns false if its contents could not be read.
+bool SPT_fault_in(struct page *p);
+
+// Let faults map whole 4 MB chunks of mmaps and zero-fill segments
+// with large pages.
+void SPT_set_large_pages(bool enable);
+
+// Try to map the 4 MB chunk around the current process's page FP with
+// one large page.  The chunk must lie in a writable mmap or the
+// zero-fill part of a segment, with none of its pages in memory or
+// swap yet.  Tried once per region.  Returns true if FP got mapped.
+bool SPT_map_large(struct page *fp);
+
+// Set the fault-around window to PAGES pages; 0 disables it.
+void SPT_set_fault_around(size_t pages);
+
+// After the current process faulted in file-backed page FP, read and
+// map the not-present pages of its region around it as well.
+void SPT_fault_around(struct page *fp);
+
+// Read file page P of the current process, which is not in memory,
+// swap or the zero page, and map it, or map it from the page cache.
+// For guesses ahead of a fault: the caller checks that free frames
+// are plentiful first.  Returns false on failure.
+bool SPT_prefetch(struct page *p);
+
+// Set the most pages one stack growth fault maps, from 1 up to
+// FRAME_ALLOC_BATCH.
+void SPT_set_stack_chunk(size_t pages);
+
+// Grow the current process's stack for a fault at FAULT_PAGE, which
+// is in no page or region, with the stack pointer at ESP.  Adds the
+// page to the SPT and returns it, or NULL if memory is short.  The
+// other pages between ESP and the lowest stack page, up to the stack
+// chunk, are added and mapped with it, to zeroed frames allocated in
+// one batch, as is FAULT_PAGE if there are free frames for it.
+struct page *SPT_grow_stack(void *fault_page, const void *esp);
+
+// Make the current process, just created by fork(), a copy of PARENT:
+// the same regions and pages, with private frames shared copy-on-write.
+// Memory mappings are not inherited.  Returns false if memory is short.
+bool SPT_fork(struct thread *parent);
+
+// Map zero page P for the current process: the shared zero page for
+// a read, a fresh zeroed frame for a write.
+void SPT_map_zero(struct page *p, bool write);
+
+// Read the current process's pages held in the swap slots following
+// SWAP_I back into memory, after a fault on the page in SWAP_I.
+void SPT_readahead(size_t swap_i);
+
+// Note that OWNER's page UPAGE is being evicted while OWNER is blocked,
+// to be read back by SPT_wake_prefetch().  Safe with any lock held.
+void SPT_wake_note(struct thread *owner, void *upage);
+
+// Read the current process's pages noted by SPT_wake_note() back from
+// swap, sorted by slot, in one batch of reads, as it resumes after
+// sleeping.  Never evicts anything to make room.
+void SPT_wake_prefetch(void);
+
+// Apply madvise() ADVICE to the current process's pages in
+// [START, END), both page-aligned.  SEQUENTIAL, RANDOM and NORMAL are
+// kept per region, for every region the range touches; WILLNEED reads
+// the range in while frames are free, and DONTNEED drops the range's
+// private pages and their swap slots.  Returns false for bad ADVICE.
+bool SPT_advise(void *start, void *end, int advice);
 
 #endif /* vm/page.h */
@@ -0,0 +1,141 @@
+#include "vm/replay.h"
+
+#include <debug.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/vmstat.h"
+
+// Executables remembered, and pages remembered for each.
+#define REPLAY_EXECS 16
+#define REPLAY_PAGES 128
+
+// Pages are not replayed once free frames are down to this many, as
+// they are only a guess.
+#define REPLAY_MIN_FREE 32
+
+// Early faults of one executable, which is identified by its inode
+// number and told apart from an older version of itself by the
+// inode's write generation.
+struct replay_rec {
+  block_sector_t inumber;           // 0 if the record is unused
+  unsigned generation;
+  int64_t last_use;                 // tick of the last exec, for LRU
+  size_t page_cnt;
+  uint32_t pages[REPLAY_PAGES];     // page numbers, in ascending order
+};
+
+static struct replay_rec recs[REPLAY_EXECS];
+static struct lock replay_lock;
+
+// Recording window after each exec, in timer ticks.
+static int64_t window_ticks = TIMER_FREQ / 5;
+
+void replay_set_window(int ms) {
+  window_ticks = ms > 0 ? (ms * TIMER_FREQ + 999) / 1000 : 0;
+}
+
+void replay_init(void) {
+  lock_init(&replay_lock);
+  lock_register(&replay_lock, "replay");
+}
+
+// Returns the record for INODE, or NULL if there is none.  With
+// CREATE, makes one in place of the least recently used if needed.
+// Call this with replay_lock held.
+static struct replay_rec* rec_find(struct inode* inode, bool create) {
+  block_sector_t inumber = inode_get_inumber(inode);
+  unsigned generation = inode_generation(inode);
+  struct replay_rec* lru = &recs[0];
+  size_t i;
+
+  for (i = 0; i < REPLAY_EXECS; i++) {
+    struct replay_rec* r = &recs[i];
+    if (r->inumber == inumber) {
+      // The executable was rewritten: its old pages mean nothing.
+      if (r->generation != generation) {
+        r->generation = generation;
+        r->page_cnt = 0;
+      }
+      return r;
+    }
+    if (r->last_use < lru->last_use) lru = r;
+  }
+  if (!create) return NULL;
+  lru->inumber = inumber;
+  lru->generation = generation;
+  lru->page_cnt = 0;
+  return lru;
+}
+
+void replay_exec(struct file* file) {
+  struct thread* t = process_current();
+  uint32_t pages[REPLAY_PAGES];
+  size_t cnt = 0, i;
+
+  if (window_ticks == 0) return;
+
+  lock_acquire(&replay_lock);
+  struct replay_rec* r = rec_find(file_get_inode(file), true);
+  r->last_use = timer_ticks();
+  cnt = r->page_cnt;
+  memcpy(pages, r->pages, cnt * sizeof *pages);
+  lock_release(&replay_lock);
+
+  // In address order, which is file order within a segment, so the
+  // inode's read-ahead turns the loads into a few long reads.
+  for (i = 0; i < cnt; i++) {
+    void* upage = (void*)(pages[i] << PGBITS);
+    struct page* p;
+
+    if (frame_free_cnt() <= REPLAY_MIN_FREE) break;
+    if (pagedir_get_page(t->pagedir, upage) != NULL) continue;
+    p = SPT_lookup(upage);
+    if (p == NULL || p->purpose != FOR_FILE || p->is_zero || p->is_swapped ||
+        file_get_inode(p->page_file) != file_get_inode(file))
+      continue;
+    if (!SPT_prefetch(p)) break;
+    vm_stats.exec_replays++;
+  }
+
+  t->replay_until = timer_ticks() + window_ticks;
+}
+
+void replay_note_fault(const struct page* p) {
+  struct thread* t = process_current();
+  uint32_t pg = pg_no(p->page_addr);
+  size_t lo, hi;
+
+  if (timer_ticks() >= t->replay_until) return;
+
+  lock_acquire(&replay_lock);
+  struct replay_rec* r = rec_find(file_get_inode(p->page_file), false);
+  if (r != NULL && r->page_cnt < REPLAY_PAGES) {
+    // Binary search for where the page goes.
+    lo = 0;
+    hi = r->page_cnt;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (r->pages[mid] < pg)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo == r->page_cnt || r->pages[lo] != pg) {
+      memmove(r->pages + lo + 1, r->pages + lo,
+              (r->page_cnt - lo) * sizeof *r->pages);
+      r->pages[lo] = pg;
+      r->page_cnt++;
+    }
+  }
+  lock_release(&replay_lock);
+}
@@ -0,0 +1,28 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct file;
+struct page;
+
+// Exec-time working set replay.  For each of the most recently run
+// executables, remembers which of its file pages processes faulted in
+// during the first part of a run, and maps them all in one go at the
+// next load() of the same executable, before it starts running.
+
+// Record faults for MS milliseconds after each exec; 0 disables
+// recording and replay.  Set from the -exec-replay option.
+void replay_set_window(int ms);
+
+void replay_init(void);
+
+// Map the recorded pages of executable FILE into the current process,
+// which has just been loaded from it, and start recording its faults.
+void replay_exec(struct file* file);
+
+// Note that the current process faulted in FOR_FILE page P.
+void replay_note_fault(const struct page* p);
+
+#endif /* vm/replay.h */
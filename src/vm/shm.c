@@ -0,0 +1,248 @@
+#include "vm/shm.h"
+
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+// Segments that may exist at once; ids are indexes into segs.
+#define SHM_MAX 64
+
+// One page of a segment.  The slot is only written while the page is
+// resident and its frame is unmapped everywhere, and only read while
+// it is not resident, so neither needs the segment's lock; resident
+// does.
+struct shm_page {
+  size_t slot;    // swap slot with the contents, BITMAP_ERROR if zero
+  bool resident;  // a frame holds the page, or is being filled or saved
+};
+
+struct shm_segment {
+  struct lock lock;
+  struct condition changed;  // some page stopped being resident
+  size_t page_cnt;
+  size_t reserved;           // swap slots still reserved for pages
+  int refs;                  // attachments, under shm_lock
+  struct thread* creator;    // NULL once it has exited, under shm_lock
+  struct shm_page pages[];
+};
+
+static struct shm_segment* segs[SHM_MAX];
+static struct lock shm_lock;
+
+void shm_init(void) {
+  lock_init(&shm_lock);
+  lock_register(&shm_lock, "shm");
+}
+
+// The page cache key of SEG's frames.  A segment is never at the
+// address of an inode, so its pages cannot be mistaken for a file's.
+static struct inode* shm_key(struct shm_segment* seg) {
+  return (struct inode*)seg;
+}
+
+static struct shm_page* seg_page(const struct page* p) {
+  return &p->shm->pages[p->ofs / PGSIZE];
+}
+
+int shm_create(size_t size) {
+  struct shm_segment* seg;
+  size_t page_cnt, i;
+  int id;
+
+  if (size == 0 || size > SIZE_MAX - PGSIZE) return -1;
+  page_cnt = DIV_ROUND_UP(size, PGSIZE);
+  if (page_cnt > (SIZE_MAX - sizeof *seg) / sizeof *seg->pages) return -1;
+  seg = malloc(sizeof *seg + page_cnt * sizeof *seg->pages);
+  if (seg == NULL) return -1;
+  if (!SD_reserve(page_cnt)) {
+    free(seg);
+    return -1;
+  }
+  lock_init(&seg->lock);
+  cond_init(&seg->changed);
+  seg->page_cnt = seg->reserved = page_cnt;
+  seg->refs = 0;
+  seg->creator = process_current();
+  for (i = 0; i < page_cnt; i++) {
+    seg->pages[i].slot = BITMAP_ERROR;
+    seg->pages[i].resident = false;
+  }
+
+  lock_acquire(&shm_lock);
+  for (id = 0; id < SHM_MAX && segs[id] != NULL; id++) continue;
+  if (id < SHM_MAX) segs[id] = seg;
+  lock_release(&shm_lock);
+  if (id == SHM_MAX) {
+    SD_unreserve(page_cnt);
+    free(seg);
+    return -1;
+  }
+  return id;
+}
+
+struct shm_segment* shm_get(int id, size_t* size) {
+  struct shm_segment* seg = NULL;
+
+  if (id < 0 || id >= SHM_MAX) return NULL;
+  lock_acquire(&shm_lock);
+  if (segs[id] != NULL && segs[id]->creator != NULL) {
+    seg = segs[id];
+    seg->refs++;
+    *size = seg->page_cnt * PGSIZE;
+  }
+  lock_release(&shm_lock);
+  return seg;
+}
+
+// Frees SEG and its swap slots.  Nothing maps it anymore.
+static void shm_free(struct shm_segment* seg) {
+  size_t i;
+
+  for (i = 0; i < seg->page_cnt; i++) {
+    ASSERT(!seg->pages[i].resident);
+    SD_free(seg->pages[i].slot);
+  }
+  SD_unreserve(seg->reserved);
+  free(seg);
+}
+
+void shm_put(struct shm_segment* seg) {
+  bool dead;
+
+  lock_acquire(&shm_lock);
+  dead = --seg->refs == 0 && seg->creator == NULL;
+  lock_release(&shm_lock);
+  if (dead) shm_free(seg);
+}
+
+void shm_exit(void) {
+  struct thread* t = process_current();
+  int id;
+
+  for (id = 0; id < SHM_MAX; id++) {
+    struct shm_segment* seg = NULL;
+
+    lock_acquire(&shm_lock);
+    if (segs[id] != NULL && segs[id]->creator == t) {
+      segs[id]->creator = NULL;
+      if (segs[id]->refs == 0) seg = segs[id];
+      segs[id] = NULL;
+    }
+    lock_release(&shm_lock);
+    if (seg != NULL) shm_free(seg);
+  }
+}
+
+// Marks P's page of its segment no longer resident and wakes faults
+// waiting for that.
+static void shm_clear_resident(struct page* p) {
+  struct shm_segment* seg = p->shm;
+
+  lock_acquire(&seg->lock);
+  seg_page(p)->resident = false;
+  cond_broadcast(&seg->changed, &seg->lock);
+  lock_release(&seg->lock);
+}
+
+bool shm_fault_in(struct page* p) {
+  struct thread* t = process_current();
+  struct shm_segment* seg = p->shm;
+  struct shm_page* sp = seg_page(p);
+
+  // Only one fault reads a page in, so all attachments share one frame.
+  lock_acquire(&seg->lock);
+  for (;;) {
+    if (frame_share_map(p, shm_key(seg))) {
+      lock_release(&seg->lock);
+      return true;
+    }
+    if (!sp->resident) break;
+    // Another fault is reading it in, or eviction is saving it.
+    cond_wait(&seg->changed, &seg->lock);
+  }
+  sp->resident = true;
+  lock_release(&seg->lock);
+
+  struct frame* f = frame_alloc(PAL_USER, t, p->page_addr, true);
+  void* kpage = f->frame_addr;
+  shm_load(p, kpage);
+  p->frame_addr = kpage;
+  if (!pagedir_set_page(t->pagedir, p->page_addr, kpage, p->is_writable)) {
+    p->frame_addr = NULL;
+    frame_free(kpage);
+    shm_clear_resident(p);
+    return false;
+  }
+  frame_share_insert(f, p, shm_key(seg));
+
+  // Faults that found the page on its way in can map it now.
+  lock_acquire(&seg->lock);
+  cond_broadcast(&seg->changed, &seg->lock);
+  lock_release(&seg->lock);
+  return true;
+}
+
+void shm_unmap_page(struct page* p) {
+  struct shm_segment* seg = p->shm;
+  bool keep;
+
+  // Once the creator is gone nobody new can attach, so the last
+  // attachment's pages are not worth saving.
+  lock_acquire(&shm_lock);
+  keep = seg->creator != NULL || seg->refs > 1;
+  lock_release(&shm_lock);
+  if (frame_unmap_shared(p, keep)) shm_clear_resident(p);
+}
+
+bool shm_load(struct page* p, void* kpage) {
+  struct shm_page* sp = seg_page(p);
+
+  if (sp->slot != BITMAP_ERROR)
+    SD_read(sp->slot, kpage);
+  else
+    memset(kpage, 0, PGSIZE);
+  return true;
+}
+
+static void shm_write_done(struct swap_req* req) { sema_up(req->aux); }
+
+void shm_writeback(struct page* p, const void* kaddr) {
+  struct shm_segment* seg = p->shm;
+  struct shm_page* sp = seg_page(p);
+  struct semaphore done;
+  struct swap_req req;
+
+  if (sp->slot == BITMAP_ERROR) {
+    lock_acquire(&seg->lock);
+    ASSERT(seg->reserved > 0);
+    seg->reserved--;
+    lock_release(&seg->lock);
+    sp->slot = SD_alloc(1);
+    ASSERT(sp->slot != BITMAP_ERROR);
+  }
+
+  // The frame is freed once we return, so wait for the write.
+  sema_init(&done, 0);
+  req.page = (void*)kaddr;
+  req.done = shm_write_done;
+  req.aux = &done;
+  SD_write_async(&req, sp->slot);
+  sema_down(&done);
+}
+
+enum page_evict shm_evict(struct page* p, void* kpage, bool dirty) {
+  // The segment's own slot is the backing store of every attachment.
+  if (dirty) shm_writeback(p, kpage);
+  shm_clear_resident(p);
+  return PAGE_DROP;
+}
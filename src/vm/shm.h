@@ -0,0 +1,52 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm/page.h"
+
+struct shm_segment;
+
+// Shared memory segments.  A segment is a run of zero-filled pages
+// that any process may attach at an address of its own.  Its frames
+// go in the page cache, keyed by the segment, so every attachment maps
+// the same frame through the reverse map, and its swap slots belong
+// to the segment rather than to any one process's page.
+
+void shm_init(void);
+
+// Make a segment of SIZE bytes, rounded up to whole pages, owned by
+// the current process, and return its id, or -1 if SIZE is 0 or there
+// is no room for it in memory or swap.  The swap slots the segment
+// may ever need are reserved up front, so evicting it cannot fail.
+int shm_create(size_t size);
+
+// Take a reference to segment ID for an attachment and store its size
+// in *SIZE.  Returns NULL for an unknown id.  Segments can be looked
+// up until the process that created them exits.
+struct shm_segment* shm_get(int id, size_t* size);
+
+// Drop a reference from shm_get().  The segment is freed once its
+// creator has exited and the last attachment is gone.
+void shm_put(struct shm_segment* seg);
+
+// Forget the segments the current process created, which is exiting.
+void shm_exit(void);
+
+// Map the current process's shared page P, from the page cache if
+// another attachment has it in memory.  Returns false if memory is
+// short.
+bool shm_fault_in(struct page* p);
+
+// Unmap the current process's shared page P, which is about to be
+// removed, saving its contents to swap if it was the last mapping of
+// a dirty frame and the segment lives on.
+void shm_unmap_page(struct page* p);
+
+// Page operations for FOR_SHM pages.
+bool shm_load(struct page* p, void* kpage);
+enum page_evict shm_evict(struct page* p, void* kpage, bool dirty);
+void shm_writeback(struct page* p, const void* kaddr);
+
+#endif /* vm/shm.h */
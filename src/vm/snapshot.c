@@ -0,0 +1,279 @@
+#include "vm/snapshot.h"
+
+#include <debug.h>
+#include <round.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/flags.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/gdt.h"
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+
+// "SNAP", at the start of every snapshot file.
+#define SNAPSHOT_MAGIC 0x50414e53
+
+// Most pages and anonymous regions a snapshot holds.
+#define SNAPSHOT_PAGES 2048
+#define SNAPSHOT_REGIONS 32
+
+// Flags a restored process may set: the arithmetic ones and DF.
+#define FLAG_USER_BITS 0xcd5
+
+// A snapshot file is this header, the regions, the pages, and then
+// from data_ofs the contents of each page in turn.
+struct snapshot_header {
+  uint32_t magic;
+  uint32_t region_cnt;
+  uint32_t page_cnt;
+  uint32_t data_ofs;           // offset of the first page's contents
+  struct intr_frame regs;      // user registers at the snapshot() call
+  uint8_t* heap_start;
+  uint8_t* heap_brk;
+  void* data_segment_start;
+};
+
+// An anonymous region, which reads as zeros where no page is saved.
+struct snapshot_region {
+  uint8_t* start;
+  uint32_t length;             // bytes, a multiple of PGSIZE
+  bool writable;
+};
+
+// A saved page.
+struct snapshot_page {
+  uint8_t* upage;
+  bool writable;
+};
+
+// What snapshot_save() collects before it writes anything.
+struct snapshot_state {
+  struct thread* t;
+  struct snapshot_region regions[SNAPSHOT_REGIONS];
+  size_t region_cnt;
+  struct snapshot_page pages[SNAPSHOT_PAGES];
+  size_t page_cnt;
+  bool ok;                     // false once something did not fit
+};
+
+// Returns the file offset of the first page's contents in a snapshot
+// of REGION_CNT regions and PAGE_CNT pages.
+static uint32_t data_ofs(size_t region_cnt, size_t page_cnt) {
+  return ROUND_UP(sizeof(struct snapshot_header) +
+                      region_cnt * sizeof(struct snapshot_region) +
+                      page_cnt * sizeof(struct snapshot_page),
+                  PGSIZE);
+}
+
+// Memory mappings, shared memory included, are left out, as in fork().
+static bool is_mapped(struct thread* t, const void* upage) {
+  return find_mapping_addr(&t->mmap_table, (void*)upage) != NULL;
+}
+
+static bool in_anon_region(const struct snapshot_state* s,
+                           const uint8_t* upage) {
+  size_t i;
+
+  for (i = 0; i < s->region_cnt; i++)
+    if (upage >= s->regions[i].start &&
+        upage < s->regions[i].start + s->regions[i].length)
+      return true;
+  return false;
+}
+
+static void add_page(struct snapshot_state* s, uint8_t* upage, bool writable) {
+  if (s->page_cnt == SNAPSHOT_PAGES) {
+    s->ok = false;
+    return;
+  }
+  s->pages[s->page_cnt].upage = upage;
+  s->pages[s->page_cnt].writable = writable;
+  s->page_cnt++;
+}
+
+// Saves page P, unless it is mapped or reads as zeros anyway.
+static void note_page(struct page* p, void* aux) {
+  struct snapshot_state* s = aux;
+
+  if (is_mapped(s->t, p->page_addr)) return;
+  if (p->is_zero && in_anon_region(s, p->page_addr)) return;
+  add_page(s, p->page_addr, p->is_writable);
+}
+
+static int page_less(const void* a_, const void* b_) {
+  const struct snapshot_page *a = a_, *b = b_;
+  return a->upage < b->upage ? -1 : a->upage > b->upage;
+}
+
+// Fills in S from the regions and pages of S->t.  File regions are
+// saved whole, pages not yet touched included, so that the snapshot
+// does not depend on the executable.
+static void collect(struct snapshot_state* s) {
+  struct thread* t = s->t;
+  struct rb_node* n;
+  size_t i, j;
+
+  for (n = rb_first(&t->SPT_regions); n != NULL; n = rb_next(n)) {
+    struct SPT_region* r = rb_entry(n, struct SPT_region, node);
+    size_t ofs;
+
+    if (is_mapped(t, r->start)) continue;
+    if (r->file != NULL) {
+      for (ofs = 0; ofs < r->length; ofs += PGSIZE)
+        add_page(s, r->start + ofs, r->is_writable);
+    } else if (s->region_cnt < SNAPSHOT_REGIONS) {
+      s->regions[s->region_cnt].start = r->start;
+      s->regions[s->region_cnt].length = r->length;
+      s->regions[s->region_cnt].writable = r->is_writable;
+      s->region_cnt++;
+    } else
+      s->ok = false;
+  }
+  SPT_walk(t, NULL, PHYS_BASE, note_page, s);
+
+  // Touched pages of file regions were added twice.
+  qsort(s->pages, s->page_cnt, sizeof *s->pages, page_less);
+  for (i = j = 0; i < s->page_cnt; i++)
+    if (j == 0 || s->pages[i].upage != s->pages[j - 1].upage)
+      s->pages[j++] = s->pages[i];
+  s->page_cnt = j;
+}
+
+bool snapshot_save(const char* path) {
+  struct thread* t = process_current();
+  struct snapshot_state* s;
+  struct snapshot_header h;
+  struct file* file = NULL;
+  off_t ofs;
+  size_t i;
+  bool ok = false;
+
+  s = malloc(sizeof *s);
+  if (s == NULL) return false;
+  s->t = t;
+  s->region_cnt = s->page_cnt = 0;
+  s->ok = true;
+  collect(s);
+  if (!s->ok) goto done;
+
+  memset(&h, 0, sizeof h);
+  h.magic = SNAPSHOT_MAGIC;
+  h.region_cnt = s->region_cnt;
+  h.page_cnt = s->page_cnt;
+  h.data_ofs = data_ofs(s->region_cnt, s->page_cnt);
+  // The user registers saved on entry to the kernel sit at the very
+  // top of the kernel stack, as process_fork() relies on too.
+  h.regs = *((struct intr_frame*)((uint8_t*)thread_current() + PGSIZE) - 1);
+  h.heap_start = t->heap_start;
+  h.heap_brk = t->heap_brk;
+  h.data_segment_start = t->data_segment_start;
+
+  if (!filesys_create(path, 0) || (file = filesys_open(path)) == NULL)
+    goto done;
+  ofs = 0;
+  if (file_write_at(file, &h, sizeof h, ofs) != sizeof h) goto done;
+  ofs += sizeof h;
+  if (file_write_at(file, s->regions, s->region_cnt * sizeof *s->regions,
+                    ofs) != (off_t)(s->region_cnt * sizeof *s->regions))
+    goto done;
+  ofs += s->region_cnt * sizeof *s->regions;
+  if (file_write_at(file, s->pages, s->page_cnt * sizeof *s->pages, ofs) !=
+      (off_t)(s->page_cnt * sizeof *s->pages))
+    goto done;
+
+  // Each page is written straight from its user address, pinned so
+  // that it is faulted in first and stays while the write runs.
+  for (i = 0; i < s->page_cnt; i++) {
+    uint8_t* upage = s->pages[i].upage;
+    off_t n;
+
+    frame_pin(upage);
+    n = file_write_at(file, upage, PGSIZE, h.data_ofs + i * PGSIZE);
+    frame_unpin(upage);
+    if (n != PGSIZE) goto done;
+  }
+  ok = true;
+
+done:
+  file_close(file);
+  free(s);
+  return ok;
+}
+
+bool snapshot_restore(struct file* file, struct intr_frame* if_) {
+  struct thread* t = process_current();
+  struct snapshot_header h;
+  struct snapshot_region* regions = NULL;
+  struct snapshot_page* pages = NULL;
+  size_t region_bytes, page_bytes, i;
+  bool ok = false;
+
+  if (file_read_at(file, &h, sizeof h, 0) != sizeof h ||
+      h.magic != SNAPSHOT_MAGIC || h.region_cnt > SNAPSHOT_REGIONS ||
+      h.page_cnt > SNAPSHOT_PAGES ||
+      h.data_ofs != data_ofs(h.region_cnt, h.page_cnt) ||
+      file_length(file) < (off_t)(h.data_ofs + h.page_cnt * PGSIZE))
+    return false;
+  region_bytes = h.region_cnt * sizeof *regions;
+  page_bytes = h.page_cnt * sizeof *pages;
+  regions = malloc(region_bytes + 1);
+  pages = malloc(page_bytes + 1);
+  if (regions == NULL || pages == NULL ||
+      file_read_at(file, regions, region_bytes, sizeof h) !=
+          (off_t)region_bytes ||
+      file_read_at(file, pages, page_bytes, sizeof h + region_bytes) !=
+          (off_t)page_bytes)
+    goto done;
+
+  for (i = 0; i < h.region_cnt; i++) {
+    struct snapshot_region* r = &regions[i];
+    uint8_t* end = r->start + r->length;
+
+    if (pg_ofs(r->start) != 0 || r->length % PGSIZE != 0 ||
+        r->length == 0 || end <= r->start || !is_user_vaddr(end - 1) ||
+        !SPT_range_free(r->start, end) ||
+        !SPT_insert_region(NULL, 0, r->start, 0, r->length, r->writable,
+                           FOR_ANON))
+      goto done;
+  }
+  // Saved pages come back as private file pages backed by the
+  // snapshot: each is read on its first fault, and goes to swap once
+  // written, like those of an executable.
+  for (i = 0; i < h.page_cnt; i++) {
+    uint8_t* upage = pages[i].upage;
+
+    if (pg_ofs(upage) != 0 || !is_user_vaddr(upage) ||
+        SPT_search(t, upage) != NULL ||
+        SPT_insert(file, h.data_ofs + i * PGSIZE, upage, NULL, PGSIZE, 0,
+                   pages[i].writable, FOR_FILE) == NULL)
+      goto done;
+  }
+
+  if (!is_user_vaddr(h.heap_brk) || h.heap_start > h.heap_brk) goto done;
+  t->heap_start = h.heap_start;
+  t->heap_brk = h.heap_brk;
+  t->data_segment_start = h.data_segment_start;
+
+  // Resume from the snapshot() call, which returns 1 here, with user
+  // segments and flags whatever the file says.
+  *if_ = h.regs;
+  if_->gs = if_->fs = if_->es = if_->ds = if_->ss = SEL_UDSEG;
+  if_->cs = SEL_UCSEG;
+  if_->eflags = FLAG_IF | FLAG_MBS | (h.regs.eflags & FLAG_USER_BITS);
+  if_->eax = 1;
+  ok = true;
+
+done:
+  free(regions);
+  free(pages);
+  return ok;
+}
@@ -0,0 +1,29 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+struct file;
+struct intr_frame;
+
+// Process snapshots for warm starts.  A snapshot file holds the
+// contents of every page of a process's address space that is not a
+// memory mapping, the bounds of its anonymous regions (such as the
+// heap), and the registers it made the snapshot() call with.  A
+// process restored from it maps the saved pages lazily, as private
+// file pages backed by the snapshot, and resumes from that call.
+// Open files, mappings, other threads and FPU state are not saved.
+
+// Write a snapshot of the current process, as it is in the middle of
+// the system call, to a new file named PATH.  Returns false if PATH
+// exists, the process is too big, or the file could not be written,
+// in which case PATH may be left partly written.
+bool snapshot_save(const char* path);
+
+// Set up the current process, which has a fresh page directory and
+// SPT, from the snapshot in FILE, and store the registers to resume
+// with in IF_.  FILE must stay open for as long as the process runs.
+// Returns false if FILE is not a valid snapshot.
+bool snapshot_restore(struct file* file, struct intr_frame* if_);
+
+#endif /* vm/snapshot.h */
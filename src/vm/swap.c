@@ -1,75 +1,488 @@
 #include "vm/swap.h"
 
 #include <debug.h>
+#include <round.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "devices/block.h"
+#include "devices/timer.h"
 #include "lib/kernel/bitmap.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "vm/vmstat.h"
+#include "vm/zswap.h"
 
 #define SEC_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 #define FREE false
 #define FILLED true
 
-// Swap disk.
-static struct block *swap_disk;
+// Slots are handed out from clusters of this many consecutive slots,
+// so pages swapped out together end up next to each other on disk.
+#define SLOTS_PER_CLUSTER 32
 
-// Mapping of swap disk. false: empty, true: filled.
+// Swap devices.  Slots are striped round-robin across them, and
+// each has its own I/O thread, so writes to devices on different IDE
+// channels proceed in parallel.
+#define SWAP_DEV_MAX 4
+static struct swap_dev {
+  struct block *block;
+  struct list io_queue;       // writes waiting for this device
+  struct semaphore io_wake;   // one up per queued write
+} swap_devs[SWAP_DEV_MAX];
+static size_t swap_dev_cnt;
+
+// Mapping of swap disk, one bit per page-sized, page-aligned slot.
+// false: empty, true: filled.
 static struct bitmap *disk_map;
+static size_t slot_cnt;
+static size_t slots_used;
+
+// Free slots promised to evictions by SD_reserve() and not yet taken
+// by SD_alloc().  Slots are handed out only against a reservation, so
+// an eviction that has one never finds the disk full.
+static size_t slots_reserved;
+
+// Threads sleeping in SD_wait() until a slot is freed.
+static struct list slot_waiters;
+
+// A thread in SD_wait().
+struct slot_waiter {
+  struct semaphore sema;  // upped by the freer or by the timer
+  struct timer timer;     // gives up waiting
+  bool listed;            // still on slot_waiters
+  struct list_elem elem;
+};
+
+// Newest in-flight write of each slot, or NULL.
+static struct swap_req **pending;
+
+// SPT entry whose contents each filled slot holds, for readahead.
+static void **slot_page;
+
+// Number of filled slots in each cluster.
+static uint16_t *cluster_used;
+static size_t cluster_cnt;
+
+// Stack of clusters that were completely free when pushed.  Entries
+// may go stale when a listed cluster is allocated from by the
+// fallback scan; they are skipped when popped.
+static size_t *free_clusters;
+static size_t free_cluster_top;
+static struct bitmap *cluster_listed;
+
+// Next-fit cursor: next slot to hand out, and the end of its cluster.
+static size_t cursor, cursor_end;
 
 // Lock.
 static struct lock swap_lock;
 
+static void swap_io(void *aux);
+
+static void push_free_cluster(size_t c) {
+  if (bitmap_test(cluster_listed, c)) return;
+  bitmap_mark(cluster_listed, c);
+  free_clusters[free_cluster_top++] = c;
+}
+
+/* Adds swap device B, unless it is already known. */
+static void add_swap_dev(struct block *b) {
+  size_t i;
+
+  for (i = 0; i < swap_dev_cnt; i++)
+    if (swap_devs[i].block == b) return;
+  if (swap_dev_cnt == SWAP_DEV_MAX) {
+    printf("swap.c: ignoring swap device %s.\n", block_name(b));
+    return;
+  }
+  swap_devs[swap_dev_cnt].block = b;
+  list_init(&swap_devs[swap_dev_cnt].io_queue);
+  sema_init(&swap_devs[swap_dev_cnt].io_wake, 0);
+  swap_dev_cnt++;
+}
+
+/* Returns the device holding slot IDX and stores the slot's first
+   sector on it into SECTOR. */
+static struct swap_dev *slot_dev(size_t idx, block_sector_t *sector) {
+  *sector = idx / swap_dev_cnt * SEC_PER_PAGE;
+  return &swap_devs[idx % swap_dev_cnt];
+}
+
 void SD_init() {
-  swap_disk = block_get_role(BLOCK_SWAP);
-  if (!swap_disk) {
+  struct block *b;
+  size_t c, i, dev_slots;
+
+  lock_init(&swap_lock);
+  lock_register(&swap_lock, "swap");
+  list_init(&slot_waiters);
+  // The device chosen with -swap first, then every other swap device.
+  b = block_get_role(BLOCK_SWAP);
+  if (b != NULL) add_swap_dev(b);
+  for (b = block_first(); b != NULL; b = block_next(b))
+    if (block_type(b) == BLOCK_SWAP) add_swap_dev(b);
+  if (swap_dev_cnt == 0) {
     printf("swap.c: Swap disk does not exist.\n");
     return;
   }
 
-  size_t dsk_size = block_size(swap_disk);
+  // Striping needs the same number of slots on every device.
+  dev_slots = block_size(swap_devs[0].block) / SEC_PER_PAGE;
+  for (i = 1; i < swap_dev_cnt; i++)
+    if (block_size(swap_devs[i].block) / SEC_PER_PAGE < dev_slots)
+      dev_slots = block_size(swap_devs[i].block) / SEC_PER_PAGE;
+  slot_cnt = dev_slots * swap_dev_cnt;
+  cluster_cnt = DIV_ROUND_UP(slot_cnt, SLOTS_PER_CLUSTER);
 
-  disk_map = bitmap_create(dsk_size);
-  if (!disk_map) {
+  disk_map = bitmap_create(slot_cnt);
+  cluster_listed = bitmap_create(cluster_cnt);
+  cluster_used = calloc(cluster_cnt, sizeof *cluster_used);
+  free_clusters = malloc(cluster_cnt * sizeof *free_clusters);
+  slot_page = calloc(slot_cnt, sizeof *slot_page);
+  pending = calloc(slot_cnt, sizeof *pending);
+  if (!disk_map || !cluster_listed || !cluster_used || !free_clusters ||
+      !slot_page || !pending) {
     printf("swap.c: bitmap init failed.\n");
+    slot_cnt = 0;
     return;
   }
-  lock_init(&swap_lock);
+  // Speeds up the fallback scan in alloc_slots(), if memory allows.
+  bitmap_summarize(disk_map);
+
+  // Push in reverse so that the first clusters are used first.
+  for (c = cluster_cnt; c-- > 0;) push_free_cluster(c);
+
+  zswap_init(slot_cnt);
+  for (i = 0; i < swap_dev_cnt; i++)
+    thread_create("swap-io", PRI_RT, swap_io, &swap_devs[i]);
+}
+
+/* Wakes every thread in SD_wait(), since a slot became free.  All of
+   them get to retry: the caller may have freed a batch.  Call this
+   with swap_lock held. */
+static void wake_slot_waiters(void) {
+  while (!list_empty(&slot_waiters)) {
+    struct slot_waiter *w =
+        list_entry(list_pop_front(&slot_waiters), struct slot_waiter, elem);
+    w->listed = false;
+    sema_up(&w->sema);
+  }
+}
+
+/* Marks CNT slots starting at IDX as FILLED or FREE, keeping the
+   cluster counts up to date.  Call this with swap_lock held. */
+static void set_slots(size_t idx, size_t cnt, bool filled) {
+  size_t i;
+
+  if (!filled) wake_slot_waiters();
+
+  bitmap_set_multiple(disk_map, idx, cnt, filled);
+  slots_used += filled ? cnt : -cnt;
+  for (i = idx; i < idx + cnt; i++) {
+    size_t c = i / SLOTS_PER_CLUSTER;
+    slot_page[i] = NULL;
+    if (!filled) zswap_invalidate(i);
+    if (filled) {
+      cluster_used[c]++;
+    } else if (--cluster_used[c] == 0) {
+      push_free_cluster(c);
+    }
+  }
+}
+
+/* Allocates CNT contiguous slots and returns the first, or
+   BITMAP_ERROR if no such run is free.  Takes the slots after the
+   cursor if they are free and in the same cluster, then a whole
+   free cluster, and only then scans the bitmap.  Call this with
+   swap_lock held. */
+static size_t alloc_slots(size_t cnt) {
+  size_t idx;
+
+  if (cnt == 0 || cnt > slot_cnt) return BITMAP_ERROR;
+
+  if (cursor + cnt <= cursor_end &&
+      bitmap_none(disk_map, cursor, cnt)) {
+    idx = cursor;
+  } else {
+    idx = BITMAP_ERROR;
+    while (cnt <= SLOTS_PER_CLUSTER && free_cluster_top > 0) {
+      size_t c = free_clusters[--free_cluster_top];
+      bitmap_reset(cluster_listed, c);
+      if (cluster_used[c] != 0) continue;  // stale entry
+
+      cursor = c * SLOTS_PER_CLUSTER;
+      cursor_end = cursor + SLOTS_PER_CLUSTER < slot_cnt
+                       ? cursor + SLOTS_PER_CLUSTER
+                       : slot_cnt;
+      if (cursor + cnt <= cursor_end) idx = cursor;
+      break;
+    }
+    if (idx == BITMAP_ERROR) {
+      // Next fit: search from the cursor, then wrap around.
+      idx = bitmap_scan(disk_map, cursor, cnt, FREE);
+      if (idx == BITMAP_ERROR) idx = bitmap_scan(disk_map, 0, cnt, FREE);
+      if (idx == BITMAP_ERROR) return BITMAP_ERROR;
+      cursor_end = ROUND_UP(idx + cnt, SLOTS_PER_CLUSTER);
+      if (cursor_end > slot_cnt) cursor_end = slot_cnt;
+    }
+  }
+
+  set_slots(idx, cnt, FILLED);
+  cursor = idx + cnt;
+  return idx;
+}
+
+/* Stores PAGE as slot IDX, compressed in memory if possible and on
+   the swap disk otherwise.  The caller owns the slot; swap_lock must
+   not be held, so that transfers of different slots overlap. */
+static void write_slot(size_t idx, const void *page) {
+  block_sector_t sector;
+  struct swap_dev *dev = slot_dev(idx, &sector);
+
+  vm_stats.swap_outs++;
+  TRACE(TRACE_SWAP_OUT, idx);
+  if (zswap_store(idx, page)) {
+    vm_stats.zswap_stores++;
+    return;
+  }
+  block_write_multiple(dev->block, sector, SEC_PER_PAGE, page);
 }
 
 void SD_read(size_t idx, void *page) {
   lock_acquire(&swap_lock);
   if (idx == BITMAP_ERROR)
     PANIC("BUG: SD_read called with BITMAP_ERROR. frame addr: %p\n", page);
-  ASSERT(!bitmap_contains(disk_map, idx, SEC_PER_PAGE, FREE));
+  ASSERT(bitmap_test(disk_map, idx));
+  vm_stats.swap_ins++;
+  thread_current()->rusage.swap_ins++;
+  TRACE(TRACE_SWAP_IN, idx);
 
-  // printf("SD_read is reading idx: %zu\n", idx);
-  size_t i;
-  for (i = idx; i < idx + SEC_PER_PAGE; i++) {
-    block_read(swap_disk, i, page + BLOCK_SECTOR_SIZE * (i - idx));
+  // The frame of an in-flight write is not released before the write
+  // completes, which needs swap_lock, so it is safe to copy from.
+  if (pending[idx] != NULL) {
+    memcpy(page, pending[idx]->page, PGSIZE);
+    lock_release(&swap_lock);
+    return;
   }
-  if (idx != 0) bitmap_set_multiple(disk_map, idx, SEC_PER_PAGE, FREE);
   lock_release(&swap_lock);
+
+  block_sector_t sector;
+  struct swap_dev *dev = slot_dev(idx, &sector);
+  if (!zswap_load(idx, page))
+    block_read_multiple(dev->block, sector, SEC_PER_PAGE, page);
+}
+
+static void read_done(struct bio *b) { sema_up(b->aux); }
+
+void SD_read_multiple(const size_t *idx, void *const *pages, size_t cnt) {
+  struct bio *bios = malloc(cnt * sizeof *bios);
+  struct semaphore done;
+  size_t i, submitted = 0;
+
+  if (bios == NULL) {
+    for (i = 0; i < cnt; i++) SD_read(idx[i], pages[i]);
+    return;
+  }
+  sema_init(&done, 0);
+  for (i = 0; i < cnt; i++) {
+    lock_acquire(&swap_lock);
+    ASSERT(idx[i] != BITMAP_ERROR && bitmap_test(disk_map, idx[i]));
+    vm_stats.swap_ins++;
+    thread_current()->rusage.swap_ins++;
+    TRACE(TRACE_SWAP_IN, idx[i]);
+    if (pending[idx[i]] != NULL) {
+      memcpy(pages[i], pending[idx[i]]->page, PGSIZE);
+      lock_release(&swap_lock);
+      continue;
+    }
+    lock_release(&swap_lock);
+    if (zswap_load(idx[i], pages[i])) continue;
+
+    struct bio *b = &bios[submitted++];
+    b->block = slot_dev(idx[i], &b->sector)->block;
+    b->cnt = SEC_PER_PAGE;
+    b->buffer = pages[i];
+    b->write = false;
+    b->done = read_done;
+    b->aux = &done;
+    block_submit(b);
+  }
+  for (i = 0; i < submitted; i++) sema_down(&done);
+  free(bios);
+}
+
+bool SD_reserve(size_t cnt) {
+  bool ok;
+  lock_acquire(&swap_lock);
+  ok = slot_cnt - slots_used - slots_reserved >= cnt;
+  if (ok) slots_reserved += cnt;
+  lock_release(&swap_lock);
+  return ok;
+}
+
+void SD_unreserve(size_t cnt) {
+  lock_acquire(&swap_lock);
+  ASSERT(slots_reserved >= cnt);
+  slots_reserved -= cnt;
+  wake_slot_waiters();
+  lock_release(&swap_lock);
+}
+
+size_t SD_slots_free(void) {
+  size_t cnt;
+  lock_acquire(&swap_lock);
+  cnt = slot_cnt - slots_used - slots_reserved;
+  lock_release(&swap_lock);
+  return cnt;
+}
+
+size_t SD_alloc(size_t cnt) {
+  size_t idx;
+  lock_acquire(&swap_lock);
+  ASSERT(slots_reserved >= cnt);
+  idx = alloc_slots(cnt);
+  if (idx != BITMAP_ERROR) slots_reserved -= cnt;
+  lock_release(&swap_lock);
+  return idx;
 }
 
 size_t SD_write(void *page) {
   size_t idx;
+
+  if (!SD_reserve(1)) return BITMAP_ERROR;
+  idx = SD_alloc(1);
+  write_slot(idx, page);
+  return idx;
+}
+
+/* Timer callback for SD_wait(): wakes the waiter W_ without a slot. */
+static void slot_wait_timeout(void *w_) {
+  struct slot_waiter *w = w_;
+  sema_up(&w->sema);
+}
+
+bool SD_wait(int64_t ticks) {
+  struct slot_waiter w;
+  bool freed;
+
   lock_acquire(&swap_lock);
-  idx = bitmap_scan_and_flip(disk_map, 0, SEC_PER_PAGE, FREE);
-  // printf("bitmap_scan_and_flip returned: %zu\n", idx);
-  if (idx == BITMAP_ERROR) {
-    // printf("Somehow, you fucked up. idx=%zu\n", idx);
-    return idx;
+  if (slots_used + slots_reserved < slot_cnt) {
+    lock_release(&swap_lock);
+    return true;
   }
+  sema_init(&w.sema, 0);
+  w.timer.armed = false;
+  w.listed = true;
+  list_push_back(&slot_waiters, &w.elem);
+  vm_stats.swap_waits++;
+  lock_release(&swap_lock);
 
-  size_t i;
-  for (i = idx; i < idx + SEC_PER_PAGE; i++) {
-    block_write(swap_disk, i, page + BLOCK_SECTOR_SIZE * (i - idx));
+  timer_arm(&w.timer, timer_ticks() + ticks, slot_wait_timeout, &w);
+  sema_down(&w.sema);
+  timer_cancel(&w.timer);
+
+  lock_acquire(&swap_lock);
+  freed = !w.listed;
+  if (w.listed) list_remove(&w.elem);
+  lock_release(&swap_lock);
+  return freed;
+}
+
+void SD_write_async(struct swap_req *req, size_t idx) {
+  block_sector_t sector;
+  struct swap_dev *dev = slot_dev(idx, &sector);
+
+  req->idx = idx;
+  req->freed = false;
+
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(disk_map, idx));
+  // A newer write of the same slot supersedes an older one; the queue
+  // is FIFO, so the newest data also lands last.
+  pending[idx] = req;
+  list_push_back(&dev->io_queue, &req->elem);
+  lock_release(&swap_lock);
+  sema_up(&dev->io_wake);
+}
+
+/* Swap I/O thread for the struct swap_dev DEV_.  Performs the
+   device's queued writes one at a time and runs their completion
+   callbacks. */
+static void swap_io(void *dev_) {
+  struct swap_dev *dev = dev_;
+
+  block_set_class(BIO_ASYNC);
+  for (;;) {
+    struct swap_req *req;
+
+    sema_down(&dev->io_wake);
+    lock_acquire(&swap_lock);
+    req = list_entry(list_pop_front(&dev->io_queue), struct swap_req, elem);
+    lock_release(&swap_lock);
+
+    write_slot(req->idx, req->page);
+
+    lock_acquire(&swap_lock);
+    if (pending[req->idx] == req) pending[req->idx] = NULL;
+    if (req->freed) set_slots(req->idx, 1, FREE);
+    lock_release(&swap_lock);
+
+    req->done(req);
+  }
+}
+
+/* Frees slot IDX, or marks it to be freed once its pending write is
+   done.  Call this with swap_lock held. */
+static void free_slot(size_t idx) {
+  ASSERT(bitmap_test(disk_map, idx));
+  if (pending[idx] != NULL) {
+    // Reusing the slot now could let the old write land on top of
+    // the new owner's data; free it once the write is done.
+    pending[idx]->freed = true;
+    slot_page[idx] = NULL;
+  } else {
+    set_slots(idx, 1, FREE);
   }
+}
+
+void SD_free(size_t idx) {
+  if (idx == BITMAP_ERROR) return;
+  lock_acquire(&swap_lock);
+  free_slot(idx);
   lock_release(&swap_lock);
+}
 
-  return idx;
+void SD_free_multiple(const size_t *idx, size_t cnt) {
+  size_t i;
+
+  lock_acquire(&swap_lock);
+  for (i = 0; i < cnt; i++)
+    if (idx[i] != BITMAP_ERROR) free_slot(idx[i]);
+  lock_release(&swap_lock);
+}
+
+void SD_set_page(size_t idx, void *page) {
+  lock_acquire(&swap_lock);
+  ASSERT(idx < slot_cnt && bitmap_test(disk_map, idx));
+  slot_page[idx] = page;
+  lock_release(&swap_lock);
+}
+
+void *SD_slot_page(size_t idx) {
+  void *page = NULL;
+  lock_acquire(&swap_lock);
+  if (idx < slot_cnt) page = slot_page[idx];
+  lock_release(&swap_lock);
+  return page;
+}
+
+void SD_slot_counts(size_t *used, size_t *total) {
+  lock_acquire(&swap_lock);
+  *used = slots_used;
+  *total = slot_cnt;
+  lock_release(&swap_lock);
 }
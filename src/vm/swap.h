@@ -1,16 +1,76 @@
 #ifndef SWAP_H
 #define SWAP_H
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "devices/block.h"
 
 void SD_init();
 
-// Read PGSIZE bytes of data from the swap_disk to page
+// Read PGSIZE bytes of data from swap slot idx to page.  The slot stays
+// allocated, so a clean page can be evicted again without a write.
+// If a write of the slot is still in flight, its data is copied from
+// the page being written instead.
 void SD_read(size_t idx, void* page);
 
-// Write PGSIZE bytes of data from the page to the swap_disk,
-// with corresponding index.
+// Read the cnt slots in idx into pages, as SD_read() would one by one,
+// but with every disk read in flight at once, so that the block layer
+// serves reads of neighboring slots together.  Sort idx for that.
+void SD_read_multiple(const size_t* idx, void* const* pages, size_t cnt);
+
+// Write PGSIZE bytes of data from the page to a free swap slot and
+// return its index, or BITMAP_ERROR if the swap disk is full.
 size_t SD_write(void* page);
 
+// Set aside cnt free slots for SD_alloc(), or return false, setting
+// aside nothing, if fewer are free.  SD_unreserve() gives back a
+// reservation that turned out not to be needed.
+bool SD_reserve(size_t cnt);
+void SD_unreserve(size_t cnt);
+
+// Number of slots neither filled nor reserved.
+size_t SD_slots_free(void);
+
+// Allocate cnt contiguous swap slots out of those reserved and return
+// the first, or BITMAP_ERROR if there is no such run.  One slot is
+// always there for a reservation.
+size_t SD_alloc(size_t cnt);
+
+// Sleep until a swap slot is freed or ticks timer ticks pass.  Returns
+// true at once if a slot is already free, and false on a timeout.
+bool SD_wait(int64_t ticks);
+
+/* Asynchronous write of one page to a swap slot.  The caller fills
+   in page, done and aux, and must keep both the request and the page
+   intact until done runs, which happens on the swap I/O thread. */
+struct swap_req {
+  void* page;                      // data to write
+  void (*done)(struct swap_req*);  // completion callback
+  void* aux;
+
+  /* Owned by swap.c. */
+  size_t idx;             // slot being written
+  bool freed;             // slot was freed while in flight
+  struct list_elem elem;  // list element for the I/O queue
+};
+
+// Queue req for writing to slot idx, which the caller owns.
+void SD_write_async(struct swap_req* req, size_t idx);
+
+// Release swap slot idx.
+void SD_free(size_t idx);
+
+// Release the CNT swap slots in IDX, in one go.
+void SD_free_multiple(const size_t* idx, size_t cnt);
+
+// Remember that filled slot idx holds the contents of SPT entry page,
+// and look that up again.  SD_slot_page returns NULL for free slots.
+void SD_set_page(size_t idx, void* page);
+void* SD_slot_page(size_t idx);
+
+// Report how many swap slots are filled and how many there are.
+void SD_slot_counts(size_t* used, size_t* total);
+
 #endif /* vm/swap.h */
@@ -0,0 +1,90 @@
+#include "vm/vmstat.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "vm/swap.h"
+
+struct vm_stats vm_stats;
+
+void vmstat_fault_done(uint64_t start) {
+  uint64_t cycles = rdtsc() - start;
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < VM_FAULT_BUCKETS - 1) {
+    cycles >>= 1;
+    bucket++;
+  }
+  vm_stats.page_faults++;
+  vm_stats.fault_cycles[bucket]++;
+}
+
+void vmstat_snapshot(struct vm_stats* s) {
+  size_t used, total;
+  enum intr_level old_level;
+
+  SD_slot_counts(&used, &total);
+  old_level = intr_disable();
+  *s = vm_stats;
+  intr_set_level(old_level);
+  s->swap_slots_used = used;
+  s->swap_slots = total;
+  s->rss = process_current()->rss;
+  s->wss = process_current()->wss;
+}
+
+void vmstat_print(void) {
+  struct vm_stats s;
+  int i;
+
+  vmstat_snapshot(&s);
+  printf("VM: %llu faults, %llu swap ins, %llu swap outs (%llu compressed)\n",
+         s.page_faults, s.swap_ins, s.swap_outs, s.zswap_stores);
+  printf("VM: %llu clean drops, %llu zero drops, %llu mmap writebacks, "
+         "%llu readaheads, %llu fault-arounds\n",
+         s.clean_drops, s.zero_drops, s.mmap_writebacks, s.readaheads,
+         s.fault_arounds);
+  printf("VM: %llu large pages mapped, %llu copy-on-write copies, "
+         "%llu stack pages mapped ahead, %llu replayed at exec\n",
+         s.large_maps, s.cow_copies, s.stack_prefaults, s.exec_replays);
+  if (s.wake_prefetches != 0)
+    printf("VM: %llu pages read back for waking processes\n",
+           s.wake_prefetches);
+  if (s.pages_lent != 0)
+    printf("VM: %llu page cache pages mapped by read()\n", s.pages_lent);
+  if (s.lends_capped != 0)
+    printf("VM: %llu read() pages copied for the loan caps\n",
+           s.lends_capped);
+  if (s.sweep_pauses != 0 || s.sweep_waits != 0)
+    printf("VM: %llu sweeps paused for other faults, "
+           "%llu searches waited for another sweep\n",
+           s.sweep_pauses, s.sweep_waits);
+  if (s.priority_spares != 0)
+    printf("VM: %llu frames spared for their owner's priority\n",
+           s.priority_spares);
+  printf("VM: %llu frames scanned in %llu victim searches, "
+         "%u of %u swap slots used\n",
+         s.frames_scanned, s.victim_calls, s.swap_slots_used, s.swap_slots);
+  if (s.swap_waits != 0 || s.oom_kills != 0)
+    printf("VM: %llu waits for a swap slot, %llu processes killed\n",
+           s.swap_waits, s.oom_kills);
+  if (s.compactions != 0)
+    printf("VM: %llu runs compacted, %llu frames moved\n", s.compactions,
+           s.compact_moves);
+  if (s.merge_scans != 0)
+    printf("VM: %llu merge scans, %llu pages merged, %llu into the zero "
+           "page\n", s.merge_scans, s.pages_merged, s.zero_merges);
+  if (s.idle_scans != 0) {
+    printf("VM: %llu idle scans; frames by scans unreferenced:",
+           s.idle_scans);
+    for (i = 0; i < VM_AGE_BUCKETS; i++)
+      printf(" %u", s.page_ages[i]);
+    printf("\n");
+  }
+  for (i = 0; i < VM_FAULT_BUCKETS; i++)
+    if (s.fault_cycles[i] != 0)
+      printf("VM: faults of 2^%d cycles (%llu ns): %llu\n", i,
+             clock_cycles_to_ns((uint64_t)1 << i), s.fault_cycles[i]);
+}
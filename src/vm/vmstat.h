@@ -0,0 +1,23 @@
+#ifndef VMSTAT_H
+#define VMSTAT_H
+
+#include <stdint.h>
+#include <vmstat.h>
+
+#include "devices/timer.h"
+
+// Global VM counters.  They are bumped without locking, so they are
+// exact on a uniprocessor only while interrupts cannot race a bump,
+// which is good enough for statistics.
+extern struct vm_stats vm_stats;
+
+// Record a page fault that began at time-stamp START.
+void vmstat_fault_done(uint64_t start);
+
+// Copy the current statistics into S.
+void vmstat_snapshot(struct vm_stats* s);
+
+// Print the statistics, for the shutdown report.
+void vmstat_print(void);
+
+#endif /* vm/vmstat.h */
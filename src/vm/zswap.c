@@ -0,0 +1,244 @@
+#include "vm/zswap.h"
+
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+// The pool is a set of kernel pages cut into chunks.  A compressed
+// page occupies a run of chunks inside one pool page.
+#define CHUNK_SIZE 64
+#define CHUNKS_PER_PAGE (PGSIZE / CHUNK_SIZE)
+
+// Pages that do not compress to at most this size go to disk.
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+
+#define NO_ENTRY UINT32_MAX
+
+static size_t pool_size;      // requested pool pages
+static uint8_t** pool_pages;  // the pool itself
+static size_t pool_page_cnt;  // pages actually allocated
+static struct bitmap* chunk_map;
+
+// Per swap slot: first chunk and compressed length, or NO_ENTRY.
+static uint32_t* entry_chunk;
+static uint16_t* entry_len;
+static size_t entry_cnt;
+
+// Scratch buffer for the compressor.
+static uint8_t zbuf[PGSIZE];
+
+// Protects the pool, the entry table and zbuf.
+static struct lock zswap_lock;
+
+void zswap_set_pool_size(size_t pages) { pool_size = pages; }
+
+void zswap_init(size_t slot_cnt) {
+  size_t i;
+
+  lock_init(&zswap_lock);
+  lock_register(&zswap_lock, "zswap");
+  if (pool_size == 0 || slot_cnt == 0) return;
+
+  pool_pages = malloc(pool_size * sizeof *pool_pages);
+  entry_chunk = malloc(slot_cnt * sizeof *entry_chunk);
+  entry_len = malloc(slot_cnt * sizeof *entry_len);
+  if (!pool_pages || !entry_chunk || !entry_len) goto fail;
+
+  for (pool_page_cnt = 0; pool_page_cnt < pool_size; pool_page_cnt++) {
+    pool_pages[pool_page_cnt] = palloc_get_page(0);
+    if (pool_pages[pool_page_cnt] == NULL) break;
+  }
+  if (pool_page_cnt == 0) goto fail;
+  chunk_map = bitmap_create(pool_page_cnt * CHUNKS_PER_PAGE);
+  if (!chunk_map) goto fail;
+
+  for (i = 0; i < slot_cnt; i++) entry_chunk[i] = NO_ENTRY;
+  entry_cnt = slot_cnt;
+  printf("zswap: %zu page pool.\n", pool_page_cnt);
+  return;
+
+fail:
+  printf("zswap: pool init failed, disabled.\n");
+  while (pool_page_cnt > 0) palloc_free_page(pool_pages[--pool_page_cnt]);
+  free(pool_pages);
+  free(entry_chunk);
+  free(entry_len);
+  entry_cnt = 0;
+}
+
+/* LZRW1-style compressor.  The output is a sequence of groups, each
+   a 16-bit little-endian control word followed by up to 16 items.
+   A clear control bit is a literal byte; a set bit is a two-byte
+   copy of 3 to 18 bytes from 1 to 4096 bytes back. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18
+#define LZ_MAX_OFFSET 4096
+#define LZ_HASH_BITS 12
+
+static unsigned lz_hash(const uint8_t* p) {
+  uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the page at SRC into DST, which has MAX bytes of room.
+   Returns the compressed size, or 0 if it would not fit. */
+static size_t lz_compress(const uint8_t* src, uint8_t* dst, size_t max) {
+  // Position + 1 of the last occurrence of each hashed trigram.
+  static uint16_t table[1 << LZ_HASH_BITS];
+  const uint8_t* p = src;
+  const uint8_t* end = src + PGSIZE;
+  size_t out = 0;
+
+  memset(table, 0, sizeof table);
+  while (p < end) {
+    size_t ctrl_pos = out;
+    uint16_t ctrl = 0;
+    int bit;
+
+    out += 2;
+    for (bit = 0; bit < 16 && p < end; bit++) {
+      size_t len = 0, off = 0;
+
+      if (end - p >= LZ_MIN_MATCH) {
+        unsigned h = lz_hash(p);
+        const uint8_t* q = table[h] ? src + table[h] - 1 : NULL;
+        table[h] = p - src + 1;
+        if (q != NULL && p - q <= LZ_MAX_OFFSET && q[0] == p[0] &&
+            q[1] == p[1] && q[2] == p[2]) {
+          off = p - q;
+          len = LZ_MIN_MATCH;
+          while (len < LZ_MAX_MATCH && p + len < end && q[len] == p[len])
+            len++;
+        }
+      }
+
+      if (len != 0) {
+        uint16_t word = ((off - 1) << 4) | (len - LZ_MIN_MATCH);
+        if (out + 2 > max) return 0;
+        dst[out++] = word >> 8;
+        dst[out++] = word & 0xff;
+        ctrl |= 1 << bit;
+        p += len;
+      } else {
+        if (out + 1 > max) return 0;
+        dst[out++] = *p++;
+      }
+    }
+    if (out > max) return 0;
+    dst[ctrl_pos] = ctrl & 0xff;
+    dst[ctrl_pos + 1] = ctrl >> 8;
+  }
+  return out;
+}
+
+/* Decompresses LEN bytes at SRC into the page at DST.  Returns false
+   if the input is corrupt. */
+static bool lz_decompress(const uint8_t* src, size_t len, uint8_t* dst) {
+  size_t in = 0, out = 0;
+
+  while (out < PGSIZE) {
+    uint16_t ctrl;
+    int bit;
+
+    if (in + 2 > len) return false;
+    ctrl = src[in] | (src[in + 1] << 8);
+    in += 2;
+    for (bit = 0; bit < 16 && out < PGSIZE; bit++, ctrl >>= 1) {
+      if (ctrl & 1) {
+        uint16_t word;
+        size_t off, n;
+
+        if (in + 2 > len) return false;
+        word = (src[in] << 8) | src[in + 1];
+        in += 2;
+        off = (word >> 4) + 1;
+        n = (word & 0xf) + LZ_MIN_MATCH;
+        if (off > out || out + n > PGSIZE) return false;
+        // Byte by byte: the source may overlap the destination.
+        for (; n > 0; n--, out++) dst[out] = dst[out - off];
+      } else {
+        if (in >= len) return false;
+        dst[out++] = src[in++];
+      }
+    }
+  }
+  return true;
+}
+
+/* Allocates CNT chunks inside a single pool page and returns the
+   first, or BITMAP_ERROR. */
+static size_t alloc_chunks(size_t cnt) {
+  size_t start = 0;
+
+  for (;;) {
+    size_t idx = bitmap_scan(chunk_map, start, cnt, false);
+    if (idx == BITMAP_ERROR) return BITMAP_ERROR;
+    if (idx / CHUNKS_PER_PAGE == (idx + cnt - 1) / CHUNKS_PER_PAGE) {
+      bitmap_set_multiple(chunk_map, idx, cnt, true);
+      return idx;
+    }
+    start = (idx / CHUNKS_PER_PAGE + 1) * CHUNKS_PER_PAGE;
+  }
+}
+
+static uint8_t* chunk_addr(size_t chunk) {
+  return pool_pages[chunk / CHUNKS_PER_PAGE] +
+         chunk % CHUNKS_PER_PAGE * CHUNK_SIZE;
+}
+
+/* Drops the entry for slot IDX.  Call with zswap_lock held. */
+static void drop_entry(size_t idx) {
+  if (entry_chunk[idx] == NO_ENTRY) return;
+  bitmap_set_multiple(chunk_map, entry_chunk[idx],
+                      DIV_ROUND_UP(entry_len[idx], CHUNK_SIZE), false);
+  entry_chunk[idx] = NO_ENTRY;
+}
+
+bool zswap_store(size_t idx, const void* page) {
+  size_t len, chunk;
+  bool stored = false;
+
+  if (idx >= entry_cnt) return false;
+  lock_acquire(&zswap_lock);
+  drop_entry(idx);
+  len = lz_compress(page, zbuf, ZSWAP_MAX_SIZE);
+  if (len != 0) {
+    chunk = alloc_chunks(DIV_ROUND_UP(len, CHUNK_SIZE));
+    if (chunk != BITMAP_ERROR) {  // else the pool is full
+      memcpy(chunk_addr(chunk), zbuf, len);
+      entry_chunk[idx] = chunk;
+      entry_len[idx] = len;
+      stored = true;
+    }
+  }
+  lock_release(&zswap_lock);
+  return stored;
+}
+
+bool zswap_load(size_t idx, void* page) {
+  bool found;
+
+  if (idx >= entry_cnt) return false;
+  lock_acquire(&zswap_lock);
+  found = entry_chunk[idx] != NO_ENTRY;
+  if (found &&
+      !lz_decompress(chunk_addr(entry_chunk[idx]), entry_len[idx], page))
+    PANIC("zswap: corrupt entry for slot %zu", idx);
+  lock_release(&zswap_lock);
+  return found;
+}
+
+void zswap_invalidate(size_t idx) {
+  if (idx >= entry_cnt) return;
+  lock_acquire(&zswap_lock);
+  drop_entry(idx);
+  lock_release(&zswap_lock);
+}
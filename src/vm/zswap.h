@@ -0,0 +1,28 @@
+#ifndef ZSWAP_H
+#define ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compressed in-memory swap tier in front of the swap disk.  Entries
+// are keyed by swap slot, so the rest of the VM sees ordinary slots.
+// The caller owns the slots it passes in; zswap does its own locking.
+
+// Number of kernel pages to use for the compressed pool; 0 disables
+// zswap.  Call before SD_init(), e.g. from the -zswap option.
+void zswap_set_pool_size(size_t pages);
+
+// Allocate the pool and an entry table for SLOT_CNT swap slots.
+void zswap_init(size_t slot_cnt);
+
+// Try to store the page at PAGE compressed as slot IDX, replacing any
+// previous entry.  Returns false if the page must go to disk.
+bool zswap_store(size_t idx, const void* page);
+
+// If slot IDX is in the pool, decompress it into PAGE and return true.
+bool zswap_load(size_t idx, void* page);
+
+// Drop the pool entry for slot IDX, if any.
+void zswap_invalidate(size_t idx);
+
+#endif /* vm/zswap.h */